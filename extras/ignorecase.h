@@ -27,6 +27,10 @@
  * This code should be considered an aid for legacy code. New development
  *  shouldn't do things that require this aid in the first place.  :)
  *
+ * If you just want every lookup to ignore case, PHYSFS_setCaseInsensitive()
+ *  in PhysicsFS itself does that (including the write directory), without
+ *  listing directories on every call, and you don't need this at all.
+ *
  * Usage: Set up PhysicsFS as you normally would, then use
  *  PHYSFSEXT_locateCorrectCase() to get a "correct" pathname to pass to
  *  functions like PHYSFS_openRead(), etc.
@@ -1,7 +1,7 @@
 /*
- * This is a quick and dirty HTTP server that uses PhysicsFS to retrieve
- *  files. It is not robust at all, probably buggy, and definitely poorly
- *  designed. It's just meant to show that it can be done.
+ * This is a small HTTP server that uses PhysicsFS to retrieve files. It's
+ *  not meant to face the internet, but it should hold up to a LAN full of
+ *  clients.
  *
  * Basically, you compile this code, and run it:
  *   ./physfshttpd archive1.zip archive2.zip /path/to/a/real/dir etc...
@@ -9,12 +9,17 @@
  * The files are appended in order to the PhysicsFS search path, and when
  *  a client request comes in, it looks for the file in said search path.
  *
- * My goal was to make this work in less than 300 lines of C, so again, it's
- *  not to be used for any serious purpose. Patches to make this application
- *  suck less will be readily and gratefully accepted.
+ * One thread watches every socket with epoll (Linux) or kqueue (macOS and
+ *  the BSDs), and a fixed pool of worker threads does anything that might
+ *  block in PhysicsFS: looking files up, opening them, and reading chunks of
+ *  compressed ones. Files that PhysicsFS says sit verbatim in an OS file
+ *  (see PHYSFS_getNativeRange()), like uncompressed files in a .zip, go to
+ *  the socket with sendfile() straight from the archive, where the platform
+ *  has it. Connections are kept alive, and single HTTP byte ranges are
+ *  served, for resuming downloads.
  *
  * Command line I used to build this on Linux:
- *  gcc -Wall -Werror -g -o bin/physfshttpd extras/physfshttpd.c -lphysfs
+ *  gcc -Wall -Werror -g -o bin/physfshttpd extras/physfshttpd.c -lphysfs -lpthread
  *
  * License: this code is public domain. I make no warranty that it is useful,
  *  correct, harmless, or environmentally safe.
@@ -36,14 +41,37 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <errno.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#if defined(__linux__)
+#define HTTPD_EPOLL 1
+#define HTTPD_SENDFILE 1
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__DragonFly__)
+#define HTTPD_KQUEUE 1
+#define HTTPD_SENDFILE 1
+#include <sys/event.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#elif defined(__OpenBSD__) || defined(__NetBSD__)
+#define HTTPD_KQUEUE 1
+#define HTTPD_SENDFILE 0
+#include <sys/event.h>
+#include <sys/time.h>
+#else
+#error physfshttpd needs epoll or kqueue.
+#endif
+
 #ifndef LACKING_SIGNALS
 #include <signal.h>
 #endif
@@ -52,57 +80,207 @@
 #include <netdb.h>
 #endif
 
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  /* SIGPIPE is ignored, anyhow. */
+#endif
+
 #include "physfs.h"
 
 
 #define DEFAULT_PORTNUM 8080
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 64
+#define MAX_REQUEST 8192              /* request line and headers.        */
+#define CHUNK_SIZE (64 * 1024)        /* body bytes per worker read.      */
+#define WRITE_QUANTUM (256 * 1024)    /* per connection per wakeup.       */
+#define MAX_EVENTS 256
+
+#define WANT_READ 1
+#define WANT_WRITE 2
 
-typedef struct
+typedef enum
+{
+    CONN_READING,  /* waiting on a whole request from the client. */
+    CONN_WORKING,  /* a worker thread owns it until it's done.    */
+    CONN_WRITING   /* sending the response.                       */
+} http_state;
+
+typedef enum
+{
+    JOB_REQUEST,   /* look up the request and prepare a response. */
+    JOB_FILL       /* read the next chunk of the body into (out). */
+} http_job;
+
+typedef struct http_conn
 {
     int sock;
-    struct sockaddr *addr;
-    socklen_t addrlen;
-} http_args;
+    char ipstr[64];
+    http_state state;
+    http_job job;
+    int watched;                 /* registered with the poller?        */
+    int keepalive;               /* take another request when done?    */
+    char req[MAX_REQUEST + 1];   /* bytes from the client. */
+    size_t reqlen;               /* bytes in (req).                    */
+    size_t reqused;              /* bytes the current request takes.   */
+    char *out;                   /* headers, a page, or a body chunk.  */
+    size_t outlen;
+    size_t outpos;
+    size_t outalloc;
+    PHYSFS_File *file;           /* body's file, or NULL.              */
+    PHYSFS_uint64 remaining;     /* body bytes that aren't in (out).   */
+    int spanfd;                  /* >= 0 to sendfile() from here...    */
+    PHYSFS_uint64 spanpos;       /* ...at this offset.                 */
+    int failed;                  /* close once (out) is sent.          */
+    struct http_conn *next;      /* in the job queue or done list.     */
+    struct http_conn *prevconn;  /* in the list of all connections.    */
+    struct http_conn *nextconn;
+} http_conn;
 
 
 #define txt404 \
-    "HTTP/1.0 404 Not Found\n" \
-    "Connection: close\n" \
-    "Content-Type: text/html; charset=utf-8\n" \
-    "\n" \
     "<html><head><title>404 Not Found</title></head>\n" \
-    "<body>Can't find '%s'.</body></html>\n\n" \
+    "<body>Can't find '%s'.</body></html>\n"
+
+#define txt416 \
+    "<html><head><title>416 Range Not Satisfiable</title></head>\n" \
+    "<body>'%s' isn't that big.</body></html>\n"
+
+#define txt500 \
+    "<html><head><title>500 Internal Server Error</title></head>\n" \
+    "<body>Couldn't read '%s'.</body></html>\n"
 
-#define txt200 \
-    "HTTP/1.0 200 OK\n" \
-    "Connection: close\n" \
-    "Content-Type: %s\n" \
-    "\n"
+#define txt501 \
+    "<html><head><title>501 Not Implemented</title></head>\n" \
+    "<body>Only GET and HEAD are supported.</body></html>\n"
+
+static int quiet = 0;
+static int poller = -1;
+static int listensocket = -1;
+static int wakepipe[2] = { -1, -1 };
+static http_conn listenmarker;  /* dummy "connections" for poll events. */
+static http_conn wakemarker;
+static http_conn *allconns = NULL;
+static http_conn *deadconns = NULL;
+static pthread_mutex_t joblock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobcond = PTHREAD_COND_INITIALIZER;
+static http_conn *jobhead = NULL;
+static http_conn *jobtail = NULL;
+static http_conn *donelist = NULL;
+static int stopworkers = 0;
+static pthread_t workers[MAX_WORKERS];
+static int numworkers = 0;
+static volatile sig_atomic_t quitting = 0;
 
 static const char *lastError(void)
 {
     return PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode());
 } /* lastError */
 
-static int writeAll(const char *ipstr, const int sock, void *buf, const size_t len)
+
+static int setNonblocking(const int fd)
+{
+    const int flags = fcntl(fd, F_GETFL, 0);
+    return ((flags != -1) && (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1));
+} /* setNonblocking */
+
+
+/* tell the poller what we want to hear about (fd); zero for nothing. */
+static int watch(const int fd, void *ptr, int *watched, const int want)
 {
-    if (write(sock, buf, len) != len)
+#if HTTPD_EPOLL
+    struct epoll_event ev;
+    int rc = 0;
+
+    /* drop it entirely, or we'd still hear about hangups. */
+    if (want == 0)
     {
-        printf("%s: Write error to socket.\n", ipstr);
+        if (*watched)
+            rc = epoll_ctl(poller, EPOLL_CTL_DEL, fd, NULL);
+    } /* if */
+    else
+    {
+        memset(&ev, '\0', sizeof (ev));
+        ev.events = ((want & WANT_READ) ? EPOLLIN : 0) |
+                    ((want & WANT_WRITE) ? EPOLLOUT : 0);
+        ev.data.ptr = ptr;
+        rc = epoll_ctl(poller, (*watched) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev);
+    } /* else */
+#else
+    struct kevent ev[2];
+    int rc;
+    EV_SET(&ev[0], fd, EVFILT_READ,
+           EV_ADD | ((want & WANT_READ) ? EV_ENABLE : EV_DISABLE), 0, 0, ptr);
+    EV_SET(&ev[1], fd, EVFILT_WRITE,
+           EV_ADD | ((want & WANT_WRITE) ? EV_ENABLE : EV_DISABLE), 0, 0, ptr);
+    rc = kevent(poller, ev, 2, NULL, 0, NULL);
+#endif
+
+    if (rc == -1)
+    {
+        printf("Can't watch socket: %s\n", strerror(errno));
         return 0;
     } /* if */
 
+    *watched = (want != 0);
     return 1;
-} /* writeAll */
+} /* watch */
 
-static int writeString(const char *ipstr, const int sock, const char *fmt, ...)
+
+/* wait for sockets; fills in (ptrs) and what (ready) for each. */
+static int waitEvents(void **ptrs, int *ready)
 {
-    /* none of this is robust against large strings or HTML escaping. */
-    char buffer[1024];
-    int len;
+    int i, rc;
+
+#if HTTPD_EPOLL
+    struct epoll_event ev[MAX_EVENTS];
+    rc = epoll_wait(poller, ev, MAX_EVENTS, -1);
+    for (i = 0; i < rc; i++)
+    {
+        const PHYSFS_uint32 flags = (PHYSFS_uint32) ev[i].events;
+        ptrs[i] = ev[i].data.ptr;
+        ready[i] = ((flags & (EPOLLIN | EPOLLHUP | EPOLLERR)) ? WANT_READ : 0) |
+                   ((flags & (EPOLLOUT | EPOLLHUP | EPOLLERR)) ? WANT_WRITE : 0);
+    } /* for */
+#else
+    struct kevent ev[MAX_EVENTS];
+    rc = kevent(poller, NULL, 0, ev, MAX_EVENTS, NULL);
+    for (i = 0; i < rc; i++)
+    {
+        ptrs[i] = (void *) ev[i].udata;
+        ready[i] = (ev[i].filter == EVFILT_READ) ? WANT_READ : WANT_WRITE;
+    } /* for */
+#endif
+
+    return rc;
+} /* waitEvents */
+
+
+static int growOutput(http_conn *conn, const size_t len)
+{
+    if (conn->outalloc < len)
+    {
+        char *ptr = (char *) realloc(conn->out, len);
+        if (ptr == NULL)
+        {
+            printf("out of memory.\n");
+            return 0;
+        } /* if */
+        conn->out = ptr;
+        conn->outalloc = len;
+    } /* if */
+
+    return 1;
+} /* growOutput */
+
+
+static int appendOutput(http_conn *conn, const char *fmt, ...)
+{
+    /* none of this is robust against HTML escaping. */
     va_list ap;
+    int len;
+
     va_start(ap, fmt);
-    len = vsnprintf(buffer, sizeof (buffer), fmt, ap);
+    len = vsnprintf(NULL, 0, fmt, ap);
     va_end(ap);
     if (len < 0)
     {
@@ -110,177 +288,817 @@ static int writeString(const char *ipstr, const int sock, const char *fmt, ...)
         return 0;
     } /* if */
 
-    return writeAll(ipstr, sock, buffer, len);
-} /* writeString */
+    if (!growOutput(conn, conn->outlen + len + 1))
+        return 0;
 
+    va_start(ap, fmt);
+    vsnprintf(conn->out + conn->outlen, len + 1, fmt, ap);
+    va_end(ap);
+    conn->outlen += len;
+    return 1;
+} /* appendOutput */
 
-static void feed_file_http(const char *ipstr, int sock, const char *fname)
+
+static int writeHeaders(http_conn *conn, const int status, const char *what,
+                        const char *type, const PHYSFS_uint64 len)
 {
-    PHYSFS_File *in = PHYSFS_openRead(fname);
+    return appendOutput(conn,
+                        "HTTP/1.1 %d %s\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %llu\r\n"
+                        "Connection: %s\r\n",
+                        status, what, type, (unsigned long long) len,
+                        conn->keepalive ? "keep-alive" : "close");
+} /* writeHeaders */
+
+
+/* a whole response that's just a little HTML page. */
+static void respondPage(http_conn *conn, const int status, const char *what,
+                        const int headonly, const char *fmt, const char *arg,
+                        const char *extra)
+{
+    char body[1024];
+    const int len = snprintf(body, sizeof (body), fmt, arg);
+    const size_t bodylen = (len < 0) ? 0 : (len >= (int) sizeof (body)) ?
+                                (sizeof (body) - 1) : ((size_t) len);
 
-    if (in == NULL)
+    if (!writeHeaders(conn, status, what, "text/html; charset=utf-8", bodylen) ||
+        !appendOutput(conn, "%s\r\n", extra ? extra : "") ||
+        (!headonly && !appendOutput(conn, "%.*s", (int) bodylen, body)))
+        conn->failed = 1;
+} /* respondPage */
+
+
+static void respondDirectory(http_conn *conn, const char *dname,
+                             const int headonly)
+{
+    http_conn page;  /* just for its output buffer. */
+    char **list = PHYSFS_enumerateFiles(dname);
+    const char *prefix = (strcmp(dname, "/") == 0) ? "" : dname;
+    int ok;
+    int i;
+
+    if (list == NULL)
     {
-        printf("%s: Can't open [%s]: %s.\n", ipstr, fname, lastError());
-        writeString(ipstr, sock, txt404, fname);
+        printf("%s: Can't enumerate directory [%s]: %s.\n",
+               conn->ipstr, dname, lastError());
+        respondPage(conn, 404, "Not Found", headonly, txt404, dname, NULL);
         return;
     } /* if */
 
-    /* !!! FIXME: mimetype */
-    if (writeString(ipstr, sock, txt200, "text/plain; charset=utf-8"))
+    memset(&page, '\0', sizeof (page));
+    ok = appendOutput(&page,
+                      "<html><head><title>Directory %s</title></head>"
+                      "<body><p><h1>Directory %s</h1></p><p><ul>\n",
+                      dname, dname);
+    for (i = 0; (ok) && (list[i] != NULL); i++)
     {
-        do
-        {
-            char buffer[1024];
-            PHYSFS_sint64 br = PHYSFS_readBytes(in, buffer, sizeof (buffer));
-            if (br == -1)
-            {
-                printf("%s: Read error: %s.\n", ipstr, lastError());
-                break;
-            } /* if */
+        ok = appendOutput(&page, "<li><a href='%s/%s'>%s</a></li>\n",
+                          prefix, list[i], list[i]);
+    } /* for */
+    ok = ok && appendOutput(&page, "</ul></body></html>\n");
+    PHYSFS_freeList(list);
 
-            else if (!writeAll(ipstr, sock, buffer, (size_t) br))
-            {
-                break;
-            } /* else if */
-        } while (!PHYSFS_eof(in));
+    ok = ok && writeHeaders(conn, 200, "OK", "text/html; charset=utf-8",
+                            page.outlen);
+    ok = ok && appendOutput(conn, "\r\n");
+    if ((ok) && (!headonly))
+        ok = appendOutput(conn, "%.*s", (int) page.outlen, page.out);
+
+    if (!ok)
+        conn->failed = 1;
+
+    free(page.out);
+} /* respondDirectory */
+
+
+/*
+ * Parse a run of decimal digits at (*str) into (*val), moving (*str) past
+ *  them. Fails if there are no digits, unlike strtoull(), which also takes
+ *  signs and whitespace. Numbers too big for 64 bits saturate, since a huge
+ *  last-pos is legal and just means "to the end."
+ */
+static int parseRangeNumber(const char **str, PHYSFS_uint64 *val)
+{
+    const char *ptr = *str;
+    PHYSFS_uint64 retval = 0;
+
+    if (!isdigit((unsigned char) *ptr))
+        return 0;
+
+    while (isdigit((unsigned char) *ptr))
+    {
+        const PHYSFS_uint64 digit = (PHYSFS_uint64) (*ptr - '0');
+        if (retval > ((~((PHYSFS_uint64) 0)) - digit) / 10)
+            retval = ~((PHYSFS_uint64) 0);  /* saturate. */
+        else
+            retval = (retval * 10) + digit;
+        ptr++;
+    } /* while */
+
+    *str = ptr;
+    *val = retval;
+    return 1;
+} /* parseRangeNumber */
+
+
+/*
+ * Parse a "bytes=first-last" Range header against a file of (size) bytes.
+ *  Returns 1 and the inclusive range if it's one we can serve, 0 to ignore
+ *  the header and send the whole file (as HTTP allows, and as RFC 9110
+ *  wants for anything that doesn't parse), or -1 if it's valid but can't
+ *  be satisfied.
+ */
+static int parseRange(const char *str, const PHYSFS_uint64 size,
+                      PHYSFS_uint64 *first, PHYSFS_uint64 *last)
+{
+    const char *end;
+    PHYSFS_uint64 n;
+
+    while ((*str == ' ') || (*str == '\t'))
+        str++;
+
+    if (strncasecmp(str, "bytes=", 6) != 0)
+        return 0;
+    str += 6;
+
+    end = str + strlen(str);
+    while ((end > str) && ((end[-1] == ' ') || (end[-1] == '\t')))
+        end--;
+
+    if (memchr(str, ',', (size_t) (end - str)) != NULL)
+        return 0;  /* multiple ranges; just send it all. */
+
+    if (*str == '-')  /* suffix: the last N bytes. */
+    {
+        str++;
+        if ((!parseRangeNumber(&str, &n)) || (str != end))
+            return 0;
+        else if ((n == 0) || (size == 0))
+            return -1;
+        *first = (n >= size) ? 0 : (size - n);
+        *last = size - 1;
+        return 1;
     } /* if */
 
-    PHYSFS_close(in);
-} /* feed_file_http */
+    if ((!parseRangeNumber(&str, first)) || (*str != '-'))
+        return 0;
+    str++;
+
+    if (str == end)
+        *last = (size > 0) ? (size - 1) : 0;
+    else if ((!parseRangeNumber(&str, last)) || (str != end))
+        return 0;
+    else if (*last < *first)
+        return 0;  /* syntactically invalid, so ignore it. */
+
+    if (*first >= size)
+        return -1;
+    else if (*last >= size)
+        *last = size - 1;
 
+    return 1;
+} /* parseRange */
 
-static void feed_dirlist_http(const char *ipstr, int sock,
-                              const char *dname, char **list)
+
+static void respondFile(http_conn *conn, const char *fname,
+                        const char *range, const int headonly)
 {
-    int i;
+    PHYSFS_File *in = PHYSFS_openRead(fname);
+    PHYSFS_sint64 filelen;
+    PHYSFS_uint64 size, first, last;
+    PHYSFS_sint64 oshandle;
+    PHYSFS_uint64 offset, spanlen;
+    int partial = 0;
 
-    if (!writeString(ipstr, sock, txt200, "text/html; charset=utf-8"))
+    if (in == NULL)
+    {
+        printf("%s: Can't open [%s]: %s.\n", conn->ipstr, fname, lastError());
+        respondPage(conn, 404, "Not Found", headonly, txt404, fname, NULL);
         return;
+    } /* if */
 
-    else if (!writeString(ipstr, sock,
-                    "<html><head><title>Directory %s</title></head>"
-                    "<body><p><h1>Directory %s</h1></p><p><ul>\n",
-                    dname, dname))
+    filelen = PHYSFS_fileLength(in);
+    if (filelen < 0)
+    {
+        printf("%s: Can't size [%s]: %s.\n", conn->ipstr, fname, lastError());
+        PHYSFS_close(in);
+        respondPage(conn, 500, "Internal Server Error", headonly, txt500, fname, NULL);
         return;
+    } /* if */
 
-    if (strcmp(dname, "/") == 0)
-        dname = "";
+    size = (PHYSFS_uint64) filelen;
+    first = 0;
+    last = (size > 0) ? (size - 1) : 0;
+    if (range != NULL)
+        partial = parseRange(range, size, &first, &last);
 
-    for (i = 0; list[i]; i++)
+    if (partial < 0)
     {
-        const char *fname = list[i];
-        if (!writeString(ipstr, sock,
-            "<li><a href='%s/%s'>%s</a></li>\n", dname, fname, fname))
-            break;
-    } /* for */
+        char extra[64];
+        snprintf(extra, sizeof (extra), "Content-Range: bytes */%llu\r\n",
+                 (unsigned long long) size);
+        PHYSFS_close(in);
+        respondPage(conn, 416, "Range Not Satisfiable", headonly, txt416, fname, extra);
+        return;
+    } /* if */
 
-    writeString(ipstr, sock, "</ul></body></html>\n");
-} /* feed_dirlist_http */
+    /* HTTP ranges are just a seek for us. */
+    if ((first > 0) && (!PHYSFS_seek(in, first)))
+    {
+        printf("%s: Can't seek [%s]: %s.\n", conn->ipstr, fname, lastError());
+        PHYSFS_close(in);
+        respondPage(conn, 500, "Internal Server Error", headonly, txt500, fname, NULL);
+        return;
+    } /* if */
 
-static void feed_dir_http(const char *ipstr, int sock, const char *dname)
-{
-    char **list = PHYSFS_enumerateFiles(dname);
-    if (list == NULL)
+    /* !!! FIXME: mimetype */
+    conn->remaining = (size == 0) ? 0 : (last - first + 1);
+    if (partial)
     {
-        printf("%s: Can't enumerate directory [%s]: %s.\n",
-               ipstr, dname, lastError());
-        writeString(ipstr, sock, txt404, dname);
+        if (!writeHeaders(conn, 206, "Partial Content", "text/plain; charset=utf-8", conn->remaining) ||
+            !appendOutput(conn, "Content-Range: bytes %llu-%llu/%llu\r\n",
+                          (unsigned long long) first, (unsigned long long) last,
+                          (unsigned long long) size))
+            conn->failed = 1;
+    } /* if */
+    else if (!writeHeaders(conn, 200, "OK", "text/plain; charset=utf-8", conn->remaining))
+    {
+        conn->failed = 1;
+    } /* else if */
+
+    if (!appendOutput(conn, "Accept-Ranges: bytes\r\n\r\n"))
+        conn->failed = 1;
+
+    if ((headonly) || (conn->failed) || (conn->remaining == 0))
+    {
+        conn->remaining = 0;
+        PHYSFS_close(in);
         return;
     } /* if */
 
-    feed_dirlist_http(ipstr, sock, dname, list);
-    PHYSFS_freeList(list);
-} /* feed_dir_http */
+    conn->file = in;
+
+    /* stored verbatim in an OS file? Let the kernel send it from there. */
+    if ( (HTTPD_SENDFILE) &&
+         (PHYSFS_getNativeRange(in, &oshandle, &offset, &spanlen)) &&
+         (spanlen == size) )
+    {
+        conn->spanfd = (int) oshandle;
+        conn->spanpos = offset + first;
+    } /* if */
+} /* respondFile */
 
-static void feed_http_request(const char *ipstr, int sock, const char *fname)
+
+/* does (str) start with header (name), and a colon? Returns the value. */
+static const char *headerValue(const char *str, const char *name)
+{
+    const size_t len = strlen(name);
+    if ((strncasecmp(str, name, len) != 0) || (str[len] != ':'))
+        return NULL;
+    str += len + 1;
+    while ((*str == ' ') || (*str == '\t'))
+        str++;
+    return str;
+} /* headerValue */
+
+
+/* in a worker thread: figure out the response to (conn)'s request. */
+static void handleRequest(http_conn *conn)
 {
+    char hdr[MAX_REQUEST + 1];
+    const char *range = NULL;
+    char *method, *path, *version, *line, *ptr;
+    int headonly = 0;
     PHYSFS_Stat statbuf;
 
-    printf("%s: requested [%s].\n", ipstr, fname);
+    memcpy(hdr, conn->req, conn->reqused);
+    hdr[conn->reqused] = '\0';
 
-    if (!PHYSFS_stat(fname, &statbuf))
+    /* chop it into lines... */
+    for (ptr = hdr; *ptr; ptr++)
     {
-        printf("%s: Can't stat [%s]: %s.\n", ipstr, fname, lastError());
-        writeString(ipstr, sock, txt404, fname);
+        if ((*ptr == '\r') || (*ptr == '\n'))
+            *ptr = '\0';
+    } /* for */
+
+    method = hdr;
+    path = strchr(method, ' ');
+    version = NULL;
+    if (path != NULL)
+    {
+        *(path++) = '\0';
+        version = strchr(path, ' ');
+        if (version != NULL)
+            *(version++) = '\0';
+    } /* if */
+
+    conn->keepalive = ((version != NULL) && (strcmp(version, "HTTP/1.1") == 0));
+
+    /* ...and look at the headers after the request line. */
+    line = hdr + strlen(hdr) + 1;
+    if (path != NULL)
+        line = path + strlen(path) + 1;
+    if (version != NULL)
+        line = version + strlen(version) + 1;
+    while (line < hdr + conn->reqused)
+    {
+        const char *value;
+        if ((value = headerValue(line, "Range")) != NULL)
+            range = value;
+        else if ((value = headerValue(line, "Connection")) != NULL)
+        {
+            if (strncasecmp(value, "close", 5) == 0)
+                conn->keepalive = 0;
+            else if (strncasecmp(value, "keep-alive", 10) == 0)
+                conn->keepalive = 1;
+        } /* else if */
+        line += strlen(line) + 1;
+    } /* while */
+
+    if ((path == NULL) || (*path != '/'))
+    {
+        printf("%s: potentially bogus request.\n", conn->ipstr);
+        conn->keepalive = 0;
+        conn->failed = 1;  /* just hang up. */
         return;
     } /* if */
 
-    if (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY)
-        feed_dir_http(ipstr, sock, fname);
-    else
-        feed_file_http(ipstr, sock, fname);
-} /* feed_http_request */
-
-
-static void *do_http(void *_args)
-{
-    http_args *args = (http_args *) _args;
-    char ipstr[128];
-    char buffer[512];
-    char *ptr;
-    strncpy(ipstr, inet_ntoa(((struct sockaddr_in *) args->addr)->sin_addr),
-            sizeof (ipstr));
-    ipstr[sizeof (ipstr) - 1] = '\0';
-
-    printf("%s: connected.\n", ipstr);
-    read(args->sock, buffer, sizeof (buffer));
-    buffer[sizeof (buffer) - 1] = '\0';
-    ptr = strchr(buffer, '\n');
-    if (!ptr)
-        printf("%s: potentially bogus request.\n", ipstr);
-    else
+    if (strcasecmp(method, "HEAD") == 0)
+        headonly = 1;
+    else if (strcasecmp(method, "GET") != 0)
     {
+        respondPage(conn, 501, "Not Implemented", 0, txt501, NULL, NULL);
+        return;
+    } /* else if */
+
+    ptr = strchr(path, '?');  /* we don't do queries. */
+    if (ptr != NULL)
         *ptr = '\0';
-        ptr = strchr(buffer, '\r');
-        if (ptr != NULL)
-            *ptr = '\0';
 
-        if ((toupper(buffer[0]) == 'G') &&
-            (toupper(buffer[1]) == 'E') &&
-            (toupper(buffer[2]) == 'T') &&
-            (toupper(buffer[3]) == ' ') &&
-            (toupper(buffer[4]) == '/'))
+    if (!quiet)
+        printf("%s: requested [%s].\n", conn->ipstr, path);
+
+    if (!PHYSFS_stat(path, &statbuf))
+    {
+        printf("%s: Can't stat [%s]: %s.\n", conn->ipstr, path, lastError());
+        respondPage(conn, 404, "Not Found", headonly, txt404, path, NULL);
+    } /* if */
+    else if (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY)
+        respondDirectory(conn, path, headonly);
+    else
+        respondFile(conn, path, range, headonly);
+} /* handleRequest */
+
+
+/* in a worker thread: read the next chunk of (conn)'s body. */
+static void fillBody(http_conn *conn)
+{
+    const size_t want = (conn->remaining < CHUNK_SIZE) ?
+                            (size_t) conn->remaining : CHUNK_SIZE;
+    PHYSFS_sint64 br;
+
+    conn->outlen = conn->outpos = 0;
+    if (!growOutput(conn, CHUNK_SIZE))
+    {
+        conn->failed = 1;
+        return;
+    } /* if */
+
+    br = PHYSFS_readBytes(conn->file, conn->out, want);
+    if (br <= 0)
+    {
+        printf("%s: Read error: %s.\n", conn->ipstr,
+               (br == 0) ? "file is shorter than it said" : lastError());
+        conn->failed = 1;
+        return;
+    } /* if */
+
+    conn->outlen = (size_t) br;
+    conn->remaining -= (PHYSFS_uint64) br;
+} /* fillBody */
+
+
+static void *workerThread(void *unused)
+{
+    (void) unused;
+
+    while (1)
+    {
+        http_conn *conn;
+        int wake;
+
+        pthread_mutex_lock(&joblock);
+        while ((jobhead == NULL) && (!stopworkers))
+            pthread_cond_wait(&jobcond, &joblock);
+        conn = jobhead;
+        if (conn != NULL)
         {
-            ptr = strchr(buffer + 5, ' ');
-            if (ptr != NULL)
-                *ptr = '\0';
-            feed_http_request(ipstr, args->sock, buffer + 4);
+            jobhead = conn->next;
+            if (jobhead == NULL)
+                jobtail = NULL;
         } /* if */
-    } /* else */
+        pthread_mutex_unlock(&joblock);
+
+        if (conn == NULL)
+            break;  /* stopping, and nothing left to do. */
+
+        if (conn->job == JOB_REQUEST)
+            handleRequest(conn);
+        else
+            fillBody(conn);
+
+        /* hand it back to the event loop. */
+        pthread_mutex_lock(&joblock);
+        wake = (donelist == NULL);
+        conn->next = donelist;
+        donelist = conn;
+        pthread_mutex_unlock(&joblock);
+        if (wake)
+        {
+            const char byte = 0;
+            if (write(wakepipe[1], &byte, 1) < 0)
+                { /* full means it's already awake. */ }
+        } /* if */
+    } /* while */
 
-    /* !!! FIXME: Time the transfer. */
-    printf("%s: closing connection.\n", ipstr);
-    close(args->sock);
-    free(args->addr);
-    free(args);
     return NULL;
-} /* do_http */
+} /* workerThread */
+
+
+static void queueJob(http_conn *conn, const http_job job)
+{
+    conn->state = CONN_WORKING;
+    conn->job = job;
+    watch(conn->sock, conn, &conn->watched, 0);
+
+    pthread_mutex_lock(&joblock);
+    conn->next = NULL;
+    if (jobtail != NULL)
+        jobtail->next = conn;
+    else
+        jobhead = conn;
+    jobtail = conn;
+    pthread_cond_signal(&jobcond);
+    pthread_mutex_unlock(&joblock);
+} /* queueJob */
+
+
+static void closeConnection(http_conn *conn)
+{
+    if (conn->sock < 0)
+        return;  /* already dead. */
+
+    close(conn->sock);  /* this drops it from the poller, too. */
+    conn->sock = -1;
+    if (conn->file != NULL)
+        PHYSFS_close(conn->file);
+    conn->file = NULL;
+
+    if (conn->prevconn != NULL)
+        conn->prevconn->nextconn = conn->nextconn;
+    else
+        allconns = conn->nextconn;
+    if (conn->nextconn != NULL)
+        conn->nextconn->prevconn = conn->prevconn;
+
+    /* there might be more events for it in this batch; free it after. */
+    conn->next = deadconns;
+    deadconns = conn;
+} /* closeConnection */
+
+
+/* is there a whole request in (conn)'s buffer? Sets (reqused) if so. */
+static int haveRequest(http_conn *conn)
+{
+    const char *crlf = strstr(conn->req, "\r\n\r\n");
+    const char *lf = strstr(conn->req, "\n\n");
+
+    if ((crlf != NULL) && ((lf == NULL) || (crlf < lf)))
+        conn->reqused = (size_t) (crlf - conn->req) + 4;
+    else if (lf != NULL)
+        conn->reqused = (size_t) (lf - conn->req) + 2;
+    else
+        return 0;
+
+    return 1;
+} /* haveRequest */
+
+
+static void nextRequest(http_conn *conn)
+{
+    if (conn->file != NULL)
+        PHYSFS_close(conn->file);
+    conn->file = NULL;
+    conn->spanfd = -1;
+    conn->remaining = 0;
+    conn->outlen = conn->outpos = 0;
+
+    if (!conn->keepalive)
+    {
+        closeConnection(conn);
+        return;
+    } /* if */
+
+    /* keep anything the client pipelined after this request. */
+    memmove(conn->req, conn->req + conn->reqused, conn->reqlen - conn->reqused);
+    conn->reqlen -= conn->reqused;
+    conn->req[conn->reqlen] = '\0';
+    conn->reqused = 0;
+    conn->state = CONN_READING;
+
+    if (haveRequest(conn))
+        queueJob(conn, JOB_REQUEST);
+    else if (!watch(conn->sock, conn, &conn->watched, WANT_READ))
+        closeConnection(conn);
+} /* nextRequest */
+
+
+#if HTTPD_SENDFILE
+/* send up to (len) bytes of the body straight from the archive. */
+static PHYSFS_sint64 sendSpan(http_conn *conn, const size_t len, int *again)
+{
+    PHYSFS_sint64 sent = 0;
+    int rc;
+
+#if defined(__linux__)
+    off_t off = (off_t) conn->spanpos;
+    const ssize_t br = sendfile(conn->sock, conn->spanfd, &off, len);
+    rc = (br < 0) ? -1 : 0;
+    sent = (br < 0) ? 0 : (PHYSFS_sint64) br;
+#elif defined(__APPLE__)
+    off_t slen = (off_t) len;
+    rc = sendfile(conn->spanfd, conn->sock, (off_t) conn->spanpos, &slen, NULL, 0);
+    sent = (PHYSFS_sint64) slen;
+#else  /* FreeBSD, DragonFly */
+    off_t sbytes = 0;
+    rc = sendfile(conn->spanfd, conn->sock, (off_t) conn->spanpos, len, NULL, &sbytes, 0);
+    sent = (PHYSFS_sint64) sbytes;
+#endif
+
+    *again = ((rc == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)));
+    if ((rc == -1) && (!*again) && (sent == 0))
+        return -1;
+
+    conn->spanpos += (PHYSFS_uint64) sent;
+    conn->remaining -= (PHYSFS_uint64) sent;
+    return sent;
+} /* sendSpan */
+#endif
 
 
-static void serve_http_request(int sock, struct sockaddr *addr,
-                               socklen_t addrlen)
+/* in the event loop: send as much of the response as the socket takes. */
+static void writeResponse(http_conn *conn)
 {
-    http_args *args = (http_args *) malloc(sizeof (http_args));
-    if (args == NULL)
+    size_t budget = WRITE_QUANTUM;
+
+    conn->state = CONN_WRITING;
+
+    while (budget > 0)
+    {
+        if (conn->outpos < conn->outlen)
+        {
+            const ssize_t bw = send(conn->sock, conn->out + conn->outpos,
+                                    conn->outlen - conn->outpos, MSG_NOSIGNAL);
+            if (bw < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                else if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+                    break;
+                closeConnection(conn);  /* client went away, probably. */
+                return;
+            } /* if */
+
+            conn->outpos += (size_t) bw;
+            budget = ((size_t) bw >= budget) ? 0 : (budget - (size_t) bw);
+        } /* if */
+
+        else if (conn->failed)
+        {
+            conn->keepalive = 0;
+            nextRequest(conn);  /* ...which hangs up. */
+            return;
+        } /* else if */
+
+        else if (conn->remaining == 0)
+        {
+            nextRequest(conn);
+            return;
+        } /* else if */
+
+#if HTTPD_SENDFILE
+        else if (conn->spanfd >= 0)
+        {
+            const size_t len = (conn->remaining < budget) ?
+                                    (size_t) conn->remaining : budget;
+            int again = 0;
+            const PHYSFS_sint64 sent = sendSpan(conn, len, &again);
+            if ((sent < 0) || ((sent == 0) && (!again)))
+            {
+                if (sent == 0)
+                    printf("%s: file is shorter than it said.\n", conn->ipstr);
+                else if ((errno != EPIPE) && (errno != ECONNRESET))
+                    printf("%s: sendfile() failed: %s\n", conn->ipstr, strerror(errno));
+                closeConnection(conn);  /* ...or the client went away. */
+                return;
+            } /* if */
+            else if (again)
+                break;
+            budget = ((size_t) sent >= budget) ? 0 : (budget - (size_t) sent);
+        } /* else if */
+#endif
+
+        else  /* need the next chunk of the file. */
+        {
+            queueJob(conn, JOB_FILL);
+            return;
+        } /* else */
+    } /* while */
+
+    /* the socket's full, or this connection has had its turn. */
+    if (!watch(conn->sock, conn, &conn->watched, WANT_WRITE))
+        closeConnection(conn);
+} /* writeResponse */
+
+
+static void readRequest(http_conn *conn)
+{
+    ssize_t br;
+
+    if (conn->reqlen >= MAX_REQUEST)
     {
-        printf("out of memory.\n");
+        printf("%s: request is too big.\n", conn->ipstr);
+        closeConnection(conn);
         return;
     } /* if */
-    args->addr = (struct sockaddr *) malloc(addrlen);
-    if (args->addr == NULL)
+
+    br = recv(conn->sock, conn->req + conn->reqlen, MAX_REQUEST - conn->reqlen, 0);
+    if (br < 0)
     {
-        free(args);
-        printf("out of memory.\n");
+        if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            closeConnection(conn);
         return;
     } /* if */
+    else if (br == 0)
+    {
+        closeConnection(conn);  /* client hung up. */
+        return;
+    } /* else if */
+
+    conn->reqlen += (size_t) br;
+    conn->req[conn->reqlen] = '\0';
+    if (haveRequest(conn))
+        queueJob(conn, JOB_REQUEST);
+} /* readRequest */
+
+
+static void acceptConnections(void)
+{
+    while (1)
+    {
+        struct sockaddr_in addr;
+        socklen_t len = (socklen_t) sizeof (addr);
+        http_conn *conn;
+        const int s = accept(listensocket, (struct sockaddr *) &addr, &len);
+
+        if (s < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) &&
+                (errno != ECONNABORTED))
+                printf("accept() failed: %s\n", strerror(errno));
+            return;
+        } /* if */
+
+        conn = (http_conn *) calloc(1, sizeof (http_conn));
+        if ((conn == NULL) || (!setNonblocking(s)))
+        {
+            printf("Couldn't set up a connection.\n");
+            free(conn);
+            close(s);
+            continue;
+        } /* if */
 
-    args->sock = sock;
-    args->addrlen = addrlen;
-    memcpy(args->addr, addr, addrlen);
+        conn->sock = s;
+        conn->spanfd = -1;
+        conn->state = CONN_READING;
+        if (!inet_ntop(AF_INET, &addr.sin_addr, conn->ipstr, sizeof (conn->ipstr)))
+            strcpy(conn->ipstr, "?");
 
-    /* !!! FIXME: optionally spin a thread... */
-    do_http((void *) args);
-} /* server_http_request */
+        conn->nextconn = allconns;
+        if (allconns != NULL)
+            allconns->prevconn = conn;
+        allconns = conn;
+
+        if (!watch(s, conn, &conn->watched, WANT_READ))
+            closeConnection(conn);
+    } /* while */
+} /* acceptConnections */
+
+
+static void finishJobs(void)
+{
+    http_conn *conn;
+    char buf[64];
+
+    while (read(wakepipe[0], buf, sizeof (buf)) > 0)
+        { /* spin */ }
+
+    pthread_mutex_lock(&joblock);
+    conn = donelist;
+    donelist = NULL;
+    pthread_mutex_unlock(&joblock);
+
+    while (conn != NULL)
+    {
+        http_conn *next = conn->next;
+        writeResponse(conn);
+        conn = next;
+    } /* while */
+} /* finishJobs */
+
+
+static void runEventLoop(void)
+{
+    void *ptrs[MAX_EVENTS];
+    int ready[MAX_EVENTS];
+
+    while (!quitting)
+    {
+        const int rc = waitEvents(ptrs, ready);
+        int i;
+
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            printf("Waiting on sockets failed: %s\n", strerror(errno));
+            break;
+        } /* if */
+
+        for (i = 0; i < rc; i++)
+        {
+            http_conn *conn = (http_conn *) ptrs[i];
+            if (conn == &listenmarker)
+                acceptConnections();
+            else if (conn == &wakemarker)
+                finishJobs();
+            else if (conn->sock < 0)
+                continue;  /* closed earlier in this batch. */
+            else if ((conn->state == CONN_READING) && (ready[i] & WANT_READ))
+                readRequest(conn);
+            else if ((conn->state == CONN_WRITING) && (ready[i] & WANT_WRITE))
+                writeResponse(conn);
+        } /* for */
+
+        while (deadconns != NULL)
+        {
+            http_conn *next = deadconns->next;
+            free(deadconns->out);
+            free(deadconns);
+            deadconns = next;
+        } /* while */
+    } /* while */
+} /* runEventLoop */
+
+
+static int startWorkers(const int count)
+{
+    while (numworkers < count)
+    {
+        if (pthread_create(&workers[numworkers], NULL, workerThread, NULL) != 0)
+            break;
+        numworkers++;
+    } /* while */
+
+    return (numworkers > 0);
+} /* startWorkers */
+
+
+static void stopWorkers(void)
+{
+    int i;
+
+    pthread_mutex_lock(&joblock);
+    stopworkers = 1;
+    pthread_cond_broadcast(&jobcond);
+    pthread_mutex_unlock(&joblock);
+
+    for (i = 0; i < numworkers; i++)
+        pthread_join(workers[i], NULL);
+    numworkers = 0;
+
+    /* nothing owns these anymore; the loop isn't running. */
+    while (allconns != NULL)
+        closeConnection(allconns);
+    while (deadconns != NULL)
+    {
+        http_conn *next = deadconns->next;
+        free(deadconns->out);
+        free(deadconns);
+        deadconns = next;
+    } /* while */
+} /* stopWorkers */
 
 
 static int create_listen_socket(short portnum)
@@ -299,12 +1117,16 @@ static int create_listen_socket(short portnum)
     retval = socket(PF_INET, SOCK_STREAM, protocol);
     if (retval >= 0)
     {
+        const int on = 1;
         struct sockaddr_in addr;
+        memset(&addr, '\0', sizeof (addr));
         addr.sin_family = AF_INET;
         addr.sin_port = htons(portnum);
         addr.sin_addr.s_addr = INADDR_ANY;
+        setsockopt(retval, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
         if ((bind(retval, (struct sockaddr *) &addr, (socklen_t) sizeof (addr)) == -1) ||
-            (listen(retval, 5) == -1))
+            (listen(retval, SOMAXCONN) == -1) ||
+            (!setNonblocking(retval)))
         {
             close(retval);
             retval = -1;
@@ -315,15 +1137,8 @@ static int create_listen_socket(short portnum)
 } /* create_listen_socket */
 
 
-static int listensocket = -1;
-
 void at_exit_cleanup(void)
 {
-    /*
-     * !!! FIXME: If thread support, signal threads to terminate and
-     * !!! FIXME:  wait for them to clean up.
-     */
-
     if (listensocket >= 0)
         close(listensocket);
 
@@ -332,27 +1147,43 @@ void at_exit_cleanup(void)
 } /* at_exit_cleanup */
 
 
+#ifndef LACKING_SIGNALS
+static void quit_signal(int sig)
+{
+    const char byte = 0;
+    (void) sig;
+    quitting = 1;
+    if (write(wakepipe[1], &byte, 1) < 0)
+        { /* the loop will see (quitting) on its next wakeup anyhow. */ }
+} /* quit_signal */
+#endif
+
+
 int main(int argc, char **argv)
 {
     int i;
     int portnum = DEFAULT_PORTNUM;
+    int threads = DEFAULT_WORKERS;
 
     setbuf(stdout, NULL);
     setbuf(stderr, NULL);
 
-#ifndef LACKING_SIGNALS
-    /* I'm not sure if this qualifies as a cheap trick... */
-    signal(SIGTERM, exit);
-    signal(SIGINT, exit);
-    signal(SIGFPE, exit);
-    signal(SIGSEGV, exit);
-    signal(SIGPIPE, exit);
-    signal(SIGILL, exit);
-#endif
+    for (i = 1; (i < argc) && (argv[i][0] == '-'); i++)
+    {
+        if ((strcmp(argv[i], "-p") == 0) && (i + 1 < argc))
+            portnum = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "-t") == 0) && (i + 1 < argc))
+            threads = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-q") == 0)
+            quiet = 1;
+        else
+            break;
+    } /* for */
 
-    if (argc == 1)
+    if ((i == argc) || (argv[i][0] == '-') || (threads < 1) ||
+        (threads > MAX_WORKERS) || (portnum <= 0) || (portnum > 65535))
     {
-        printf("USAGE: %s <archive1> [archive2 [... archiveN]]\n", argv[0]);
+        printf("USAGE: %s [-p port] [-t threads] [-q] <archive1> [archive2 [... archiveN]]\n", argv[0]);
         return 42;
     } /* if */
 
@@ -365,36 +1196,65 @@ int main(int argc, char **argv)
     /* normally, this is bad practice, but oh well. */
     atexit(at_exit_cleanup);
 
-    for (i = 1; i < argc; i++)
+    for (; i < argc; i++)
     {
         if (!PHYSFS_mount(argv[i], NULL, 1))
             printf(" WARNING: failed to add [%s] to search path.\n", argv[i]);
-    } /* else */
+    } /* for */
+
+    if ((pipe(wakepipe) == -1) || (!setNonblocking(wakepipe[0])) ||
+        (!setNonblocking(wakepipe[1])))
+    {
+        printf("wakeup pipe failed to create.\n");
+        return 42;
+    } /* if */
+
+#ifndef LACKING_SIGNALS
+    /* I'm not sure if this qualifies as a cheap trick... */
+    signal(SIGTERM, quit_signal);
+    signal(SIGINT, quit_signal);
+    signal(SIGFPE, exit);
+    signal(SIGSEGV, exit);
+    signal(SIGPIPE, SIG_IGN);  /* a client hanging up isn't fatal. */
+    signal(SIGILL, exit);
+#endif
 
-    listensocket = create_listen_socket(portnum);
+    listensocket = create_listen_socket((short) portnum);
     if (listensocket < 0)
     {
         printf("listen socket failed to create.\n");
         return 42;
     } /* if */
 
-    while (1)  /* infinite loop for now. */
+#if HTTPD_EPOLL
+    poller = epoll_create(MAX_EVENTS);
+#else
+    poller = kqueue();
+#endif
+    if (poller < 0)
     {
-        struct sockaddr addr;
-        socklen_t len;
-        int s = accept(listensocket, &addr, &len);
-        if (s < 0)
-        {
-            printf("accept() failed: %s\n", strerror(errno));
-            close(listensocket);
-            return 42;
-        } /* if */
+        printf("Couldn't create a poller: %s\n", strerror(errno));
+        return 42;
+    } /* if */
 
-        serve_http_request(s, &addr, len);
-    } /* while */
+    if ( (!watch(listensocket, &listenmarker, &listenmarker.watched, WANT_READ)) ||
+         (!watch(wakepipe[0], &wakemarker, &wakemarker.watched, WANT_READ)) )
+        return 42;
+
+    if (!startWorkers(threads))
+    {
+        printf("Couldn't start any worker threads.\n");
+        return 42;
+    } /* if */
+
+    printf("Serving on port %d with %d worker thread%s.\n", portnum,
+           numworkers, (numworkers == 1) ? "" : "s");
+
+    runEventLoop();
+    stopWorkers();
+    close(poller);
 
     return 0;
 } /* main */
 
 /* end of physfshttpd.c ... */
-
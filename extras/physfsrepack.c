@@ -0,0 +1,1206 @@
+/*
+ * Build a .zip laid out the way PhysicsFS reads it, from an access log.
+ *
+ * Everything in the sources (directories or archives, mounted in the order
+ *  given, so the first one wins a name collision) is written to a new .zip.
+ *  Files named in the access log come first, in the order they were first
+ *  opened, so a game that loads the same way next time reads the archive
+ *  mostly front to back; everything else follows in directory order. Files
+ *  that are already compressed (images, audio, video, other archives), tiny
+ *  ones, and ones that don't shrink are stored; the rest are deflated (or
+ *  Zstandard-compressed, with -z). Stored data can be aligned with -a, so
+ *  PHYSFS_mapFile() and friends hand out well-aligned pointers. The central
+ *  directory goes right after the data, against the end-of-central-directory
+ *  record, so a mount reads all of it in one go. With -i, the archive also
+ *  carries its own mount index (see PHYSFS_setMountIndexDir()), just before
+ *  the central directory, with a locator for it at the end of the zipfile
+ *  comment; PhysicsFS loads that instead of parsing the central directory,
+ *  wherever the archive ends up. Other zip tools just see a comment and
+ *  some unused space. Changing the archive with them drops the index (but
+ *  not the files), since the locator only matches the central directory it
+ *  was written with.
+ *
+ * The access log is text, one line per event. A line is either just a path,
+ *  or tab-separated fields where the first is the event and the second the
+ *  path; only "open_read" events count, other lines are skipped, as are
+ *  blank ones and ones starting with '#'. A trace callback like this one
+ *  writes it:
+ *
+ *   static void logOpens(void *data, const PHYSFS_TraceEvent *event)
+ *   {
+ *       if ((event->type == PHYSFS_TRACE_OPEN_READ) && (event->result))
+ *           fprintf((FILE *) data, "open_read\t%s\t%s\n", event->filename, event->archive);
+ *   }
+ *
+ *   PHYSFS_setTraceCallback(logOpens, fopen("access.log", "w"));
+ *
+ * Paths in the log are where the app found them; if it mounts this archive
+ *  somewhere other than the root, pass that mount point with -p.
+ *
+ * This needs zlib (and libzstd, if built with -DREPACK_ZSTD=1), something
+ *  like:  cc -o physfsrepack physfsrepack.c -lphysfs -lz
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#ifndef REPACK_ZSTD
+#define REPACK_ZSTD 0
+#endif
+
+#if REPACK_ZSTD
+#include <zstd.h>
+#endif
+
+#include "physfs.h"
+
+/* files are read (and compressed) this much at a time... */
+#define REPACK_CHUNK          (1024 * 1024)
+/* ...and stored if the first chunk doesn't shrink by at least 1/this. */
+#define REPACK_MIN_SAVING     32
+/* files this small aren't worth compressing. */
+#define REPACK_MIN_COMPRESS   64
+#define REPACK_MAX_ALIGN      65536
+
+#define ZIP_LOCAL_FILE_SIG                  0x04034b50
+#define ZIP_CENTRAL_DIR_SIG                 0x02014b50
+#define ZIP_END_OF_CENTRAL_DIR_SIG          0x06054b50
+#define ZIP64_END_OF_CENTRAL_DIR_SIG        0x06064b50
+#define ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG 0x07064b50
+#define ZIP64_EXTRA_SIG                     0x0001
+#define ZIP_ALIGN_EXTRA_SIG                 0xD935  /* same as zipalign. */
+#define ZIP_GENERAL_BITS_UTF8               (1 << 11)
+
+/* what the zipfile comment ends with, when there's an index; see -i. */
+#define ZIP_INDEX_LOCATOR_MAGIC "PHYSFSIL"
+#define ZIP_INDEX_LOCATOR_LEN 44
+
+#define COMPMETH_NONE 0
+#define COMPMETH_DEFLATE 8
+#define COMPMETH_ZSTD 93
+
+/* a 32-bit size or offset field that's this big is in the Zip64 extra. */
+#define ZIP64_LIMIT  0xFFFFFFFFu
+/* leave room for a file that grows while being compressed. */
+#define ZIP64_MARGIN (REPACK_CHUNK * 2)
+
+typedef struct
+{
+    char *name;
+    PHYSFS_sint64 size;
+    PHYSFS_sint64 modtime;
+    int isdir;  /* an empty directory; others are implied by their files. */
+    size_t enumorder;  /* where it was found. */
+    size_t logorder;  /* where it was first opened; (size_t) -1 if never. */
+    PHYSFS_uint64 offset;  /* of its local header, once written. */
+    PHYSFS_uint64 compsize;
+    PHYSFS_uint32 crc;
+    PHYSFS_uint16 method;
+    PHYSFS_uint16 dostime;
+    PHYSFS_uint16 dosdate;
+    int zip64;  /* sizes didn't fit in the local header. */
+} RepackFile;
+
+/* compressed output goes to (pending) until we decide to keep it. */
+typedef struct
+{
+    unsigned char *ptr;
+    size_t len;
+    size_t alloc;
+} RepackBuffer;
+
+static RepackFile *files = NULL;
+static size_t fileCount = 0;
+static size_t fileAlloc = 0;
+static FILE *out = NULL;
+static const char *outName = NULL;
+static PHYSFS_uint64 outPos = 0;
+static int useZstd = 0;
+static int level = -1;  /* -1 means the compressor's default. */
+static int storeAll = 0;
+static unsigned int alignment = 1;
+static int embedIndex = 0;
+static int quiet = 0;
+static int failure = 0;
+
+static const char *storedExtensions[] = {
+    "png", "jpg", "jpeg", "gif", "webp", "avif", "heic", "jxl",
+    "ogg", "oga", "opus", "mp3", "m4a", "aac", "flac", "wma",
+    "mp4", "m4v", "webm", "mkv", "mov", "avi", "bik", "bk2", "ogv",
+    "zip", "7z", "rar", "gz", "tgz", "bz2", "xz", "zst", "lz4", "br",
+    "pk3", "pk4", "apk", "jar", "cab", "ktx2", "basis", NULL
+};
+
+
+static void fail(const char *fname, const char *what, const char *why)
+{
+    if (why == NULL)
+        why = PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode());
+    fprintf(stderr, "%s: %s failed: %s\n", fname, what, why);
+    failure = 1;
+} /* fail */
+
+
+static int outWrite(const void *ptr, size_t len)
+{
+    if ((len > 0) && (fwrite(ptr, len, 1, out) != 1))
+    {
+        fail(outName, "fwrite", "write error");
+        return 0;
+    } /* if */
+    outPos += (PHYSFS_uint64) len;
+    return 1;
+} /* outWrite */
+
+
+/* move around the output (to patch a local header) with 64-bit offsets. */
+static int outSeek(const PHYSFS_uint64 pos)
+{
+    int rc;
+#ifdef _WIN32
+    rc = _fseeki64(out, (__int64) pos, SEEK_SET);
+#else
+    rc = fseeko(out, (off_t) pos, SEEK_SET);
+#endif
+    if (rc != 0)
+        fail(outName, "fseek", "seek error");
+    return (rc == 0);
+} /* outSeek */
+
+
+static unsigned char *put16(unsigned char *ptr, const PHYSFS_uint32 val)
+{
+    ptr[0] = (unsigned char) (val & 0xFF);
+    ptr[1] = (unsigned char) ((val >> 8) & 0xFF);
+    return ptr + 2;
+} /* put16 */
+
+
+static unsigned char *put32(unsigned char *ptr, const PHYSFS_uint32 val)
+{
+    ptr = put16(ptr, val & 0xFFFF);
+    return put16(ptr, (val >> 16) & 0xFFFF);
+} /* put32 */
+
+
+static unsigned char *put64(unsigned char *ptr, const PHYSFS_uint64 val)
+{
+    ptr = put32(ptr, (PHYSFS_uint32) (val & 0xFFFFFFFF));
+    return put32(ptr, (PHYSFS_uint32) (val >> 32));
+} /* put64 */
+
+
+static unsigned char *putSize(unsigned char *ptr, const PHYSFS_uint64 val)
+{
+    return put32(ptr, (val >= ZIP64_LIMIT) ? ZIP64_LIMIT : (PHYSFS_uint32) val);
+} /* putSize */
+
+
+static int bufferAppend(RepackBuffer *buf, const void *ptr, size_t len)
+{
+    if ((buf->len + len) > buf->alloc)
+    {
+        size_t newalloc = buf->alloc ? buf->alloc : REPACK_CHUNK;
+        void *newptr;
+        while (newalloc < (buf->len + len))
+            newalloc *= 2;
+        newptr = realloc(buf->ptr, newalloc);
+        if (newptr == NULL)
+            return 0;
+        buf->ptr = (unsigned char *) newptr;
+        buf->alloc = newalloc;
+    } /* if */
+
+    memcpy(buf->ptr + buf->len, ptr, len);
+    buf->len += len;
+    return 1;
+} /* bufferAppend */
+
+
+static void toDosTime(RepackFile *file)
+{
+    time_t t = (time_t) ((file->modtime < 0) ? time(NULL) : file->modtime);
+    const struct tm *tm = localtime(&t);
+
+    if ((tm == NULL) || (tm->tm_year < 80))  /* DOS time starts at 1980. */
+    {
+        file->dostime = 0;
+        file->dosdate = (1 << 5) | 1;  /* 1980-01-01 */
+        return;
+    } /* if */
+
+    file->dostime = (PHYSFS_uint16) ((tm->tm_hour << 11) | (tm->tm_min << 5) | (tm->tm_sec / 2));
+    file->dosdate = (PHYSFS_uint16) (((tm->tm_year - 80) << 9) | ((tm->tm_mon + 1) << 5) | tm->tm_mday);
+} /* toDosTime */
+
+
+static int isStoredByName(const char *fname)
+{
+    const char *ext = strrchr(fname, '.');
+    size_t i;
+
+    if ((ext == NULL) || (strchr(ext, '/') != NULL))
+        return 0;
+
+    for (ext++, i = 0; storedExtensions[i] != NULL; i++)
+    {
+        const char *a = ext;
+        const char *b = storedExtensions[i];
+        while ((*a) && (*b) && ((*a | 0x20) == *b))
+            a++, b++;
+        if ((*a == '\0') && (*b == '\0'))
+            return 1;
+    } /* for */
+
+    return 0;
+} /* isStoredByName */
+
+
+static PHYSFS_uint16 generalBits(const RepackFile *file)
+{
+    const unsigned char *ptr;
+    for (ptr = (const unsigned char *) file->name; *ptr; ptr++)
+    {
+        if (*ptr >= 0x80)
+            return ZIP_GENERAL_BITS_UTF8;
+    } /* for */
+    return 0;
+} /* generalBits */
+
+
+static PHYSFS_uint16 versionNeeded(const RepackFile *file)
+{
+    if (file->method == COMPMETH_ZSTD)
+        return 63;
+    else if (file->zip64)
+        return 45;
+    return 20;
+} /* versionNeeded */
+
+
+/* how much padding puts the data of the file at (offset) on the alignment. */
+static size_t alignPadding(const RepackFile *file, const size_t extralen)
+{
+    const PHYSFS_uint64 datapos = file->offset + 30 + strlen(file->name) + extralen;
+    size_t pad;
+
+    if ((alignment <= 1) || (file->method != COMPMETH_NONE) || (file->isdir))
+        return 0;
+
+    pad = (size_t) ((alignment - (datapos % alignment)) % alignment);
+    while ((pad > 0) && (pad < 4))  /* an extra field needs its own header. */
+        pad += alignment;
+    return pad;
+} /* alignPadding */
+
+
+/* write (or rewrite, once the sizes are known) (file)'s local header. */
+static int writeLocalHeader(RepackFile *file)
+{
+    unsigned char hdr[30 + 20 + 4 + REPACK_MAX_ALIGN + 8];
+    const size_t namelen = strlen(file->name);
+    const size_t zip64len = file->zip64 ? 20 : 0;
+    const size_t pad = alignPadding(file, zip64len);
+    unsigned char *ptr = hdr;
+
+    ptr = put32(ptr, ZIP_LOCAL_FILE_SIG);
+    ptr = put16(ptr, versionNeeded(file));
+    ptr = put16(ptr, generalBits(file));
+    ptr = put16(ptr, file->method);
+    ptr = put16(ptr, file->dostime);
+    ptr = put16(ptr, file->dosdate);
+    ptr = put32(ptr, file->crc);
+    ptr = put32(ptr, file->zip64 ? ZIP64_LIMIT : (PHYSFS_uint32) file->compsize);
+    ptr = put32(ptr, file->zip64 ? ZIP64_LIMIT : (PHYSFS_uint32) file->size);
+    ptr = put16(ptr, (PHYSFS_uint32) namelen);
+    ptr = put16(ptr, (PHYSFS_uint32) (zip64len + pad));
+
+    if ((!outWrite(hdr, (size_t) (ptr - hdr))) || (!outWrite(file->name, namelen)))
+        return 0;
+
+    ptr = hdr;
+    if (file->zip64)
+    {
+        ptr = put16(ptr, ZIP64_EXTRA_SIG);
+        ptr = put16(ptr, 16);
+        ptr = put64(ptr, (PHYSFS_uint64) file->size);
+        ptr = put64(ptr, file->compsize);
+    } /* if */
+
+    if (pad > 0)
+    {
+        ptr = put16(ptr, ZIP_ALIGN_EXTRA_SIG);
+        ptr = put16(ptr, (PHYSFS_uint32) (pad - 4));
+        memset(ptr, '\0', pad - 4);
+        ptr += pad - 4;
+    } /* if */
+
+    return outWrite(hdr, (size_t) (ptr - hdr));
+} /* writeLocalHeader */
+
+
+typedef struct
+{
+    z_stream z;
+#if REPACK_ZSTD
+    ZSTD_CCtx *zstd;
+#endif
+    unsigned char outbuf[64 * 1024];
+} Compressor;
+
+static int compressorInit(Compressor *c, const RepackFile *file)
+{
+#if REPACK_ZSTD
+    if (useZstd)
+    {
+        c->zstd = ZSTD_createCCtx();
+        if (c->zstd == NULL)
+            return 0;
+        if (level != -1)
+            ZSTD_CCtx_setParameter(c->zstd, ZSTD_c_compressionLevel, level);
+        ZSTD_CCtx_setPledgedSrcSize(c->zstd, (unsigned long long) file->size);
+        return 1;
+    } /* if */
+#else
+    (void) file;
+#endif
+
+    memset(&c->z, '\0', sizeof (c->z));
+    return (deflateInit2(&c->z, (level == -1) ? Z_DEFAULT_COMPRESSION : level,
+                         Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+} /* compressorInit */
+
+
+static void compressorDeinit(Compressor *c)
+{
+#if REPACK_ZSTD
+    if (useZstd)
+    {
+        ZSTD_freeCCtx(c->zstd);
+        return;
+    } /* if */
+#endif
+    deflateEnd(&c->z);
+} /* compressorDeinit */
+
+
+/*
+ * Compress (len) bytes, to (pending) if it's non-NULL, else the output. The
+ *  first chunk is flushed, so we can see how well it did; the last ends it.
+ */
+static int compressorRun(Compressor *c, RepackFile *file, const void *ptr,
+                         const size_t len, const int last, const int flush,
+                         RepackBuffer *pending)
+{
+#if REPACK_ZSTD
+    if (useZstd)
+    {
+        ZSTD_inBuffer in;
+        int finished = 0;
+        in.src = ptr;
+        in.size = len;
+        in.pos = 0;
+        while (!finished)
+        {
+            ZSTD_outBuffer zout;
+            size_t rc;
+            zout.dst = c->outbuf;
+            zout.size = sizeof (c->outbuf);
+            zout.pos = 0;
+            rc = ZSTD_compressStream2(c->zstd, &zout, &in,
+                                      last ? ZSTD_e_end : flush ? ZSTD_e_flush : ZSTD_e_continue);
+            if (ZSTD_isError(rc))
+            {
+                fail(file->name, "ZSTD_compressStream2", ZSTD_getErrorName(rc));
+                return 0;
+            } /* if */
+            file->compsize += zout.pos;
+            if (pending ? !bufferAppend(pending, c->outbuf, zout.pos) : !outWrite(c->outbuf, zout.pos))
+                return 0;
+            finished = (last || flush) ? (rc == 0) : (in.pos == in.size);
+        } /* while */
+        return 1;
+    } /* if */
+#endif
+
+    c->z.next_in = (Bytef *) ptr;
+    c->z.avail_in = (uInt) len;
+    while (1)
+    {
+        size_t produced;
+        int rc;
+        c->z.next_out = c->outbuf;
+        c->z.avail_out = (uInt) sizeof (c->outbuf);
+        rc = deflate(&c->z, last ? Z_FINISH : flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+        if ((rc != Z_OK) && (rc != Z_STREAM_END) && (rc != Z_BUF_ERROR))
+        {
+            fail(file->name, "deflate", c->z.msg ? c->z.msg : "compression error");
+            return 0;
+        } /* if */
+        produced = sizeof (c->outbuf) - c->z.avail_out;
+        file->compsize += produced;
+        if (pending ? !bufferAppend(pending, c->outbuf, produced) : !outWrite(c->outbuf, produced))
+            return 0;
+        if (last ? (rc == Z_STREAM_END) : ((c->z.avail_in == 0) && (c->z.avail_out != 0)))
+            break;
+    } /* while */
+
+    return 1;
+} /* compressorRun */
+
+
+/*
+ * Write one file: its local header and data. The first chunk is compressed
+ *  into memory; if it doesn't shrink enough, the file is stored instead.
+ *  If the whole file fit in that chunk, the header's right the first time;
+ *  otherwise it's rewritten with the real sizes at the end.
+ */
+static int writeFile(RepackFile *file, unsigned char *chunk, RepackBuffer *pending)
+{
+    const PHYSFS_uint64 size = (PHYSFS_uint64) file->size;
+    Compressor *c = NULL;
+    PHYSFS_File *in = NULL;
+    PHYSFS_uint64 done = 0;
+    int needPatch = 0;
+    int ok = 0;
+
+    file->offset = outPos;
+    file->crc = (PHYSFS_uint32) crc32(0L, Z_NULL, 0);
+    file->compsize = 0;
+    file->zip64 = (size >= (ZIP64_LIMIT - ZIP64_MARGIN));
+    file->method = COMPMETH_NONE;
+    if ((!storeAll) && (size >= REPACK_MIN_COMPRESS) && (!isStoredByName(file->name)))
+        file->method = useZstd ? COMPMETH_ZSTD : COMPMETH_DEFLATE;
+    pending->len = 0;
+
+    if (file->isdir)
+        return writeLocalHeader(file);
+    else if ((in = PHYSFS_openRead(file->name)) == NULL)
+    {
+        fail(file->name, "PHYSFS_openRead", NULL);
+        return 0;
+    } /* else if */
+
+    if (file->method != COMPMETH_NONE)
+    {
+        c = (Compressor *) malloc(sizeof (Compressor));
+        if ((c == NULL) || (!compressorInit(c, file)))
+        {
+            free(c);
+            fail(file->name, "compressor init", "Out of memory!");
+            PHYSFS_close(in);
+            return 0;
+        } /* if */
+    } /* if */
+
+    do
+    {
+        const size_t want = (size_t) (((size - done) < REPACK_CHUNK) ? (size - done) : REPACK_CHUNK);
+        const int first = (done == 0);
+        const int last = ((done + want) == size);
+        const PHYSFS_sint64 br = PHYSFS_readBytes(in, chunk, want);
+
+        if (br != (PHYSFS_sint64) want)
+        {
+            fail(file->name, "PHYSFS_readBytes", (br < 0) ? NULL : "file changed size!");
+            goto writeFileDone;
+        } /* if */
+
+        file->crc = (PHYSFS_uint32) crc32(file->crc, chunk, (uInt) want);
+        done += want;
+
+        if (file->method == COMPMETH_NONE)
+        {
+            if (first)
+            {
+                file->compsize = size;
+                needPatch = !last;  /* for the CRC. */
+                if (!writeLocalHeader(file))
+                    goto writeFileDone;
+            } /* if */
+            if (!outWrite(chunk, want))
+                goto writeFileDone;
+            continue;
+        } /* if */
+
+        if (!compressorRun(c, file, chunk, want, last, first, first ? pending : NULL))
+            goto writeFileDone;
+
+        if (first)  /* decide: keep compressing, or just store it? */
+        {
+            if (pending->len > (want - (want / REPACK_MIN_SAVING)))
+            {
+                compressorDeinit(c);
+                free(c);
+                c = NULL;
+                file->method = COMPMETH_NONE;
+                file->compsize = size;
+                needPatch = !last;
+                if ((!writeLocalHeader(file)) || (!outWrite(chunk, want)))
+                    goto writeFileDone;
+            } /* if */
+            else
+            {
+                needPatch = !last;
+                if ((!writeLocalHeader(file)) || (!outWrite(pending->ptr, pending->len)))
+                    goto writeFileDone;
+            } /* else */
+        } /* if */
+    } while (done < size);
+
+    if ((!file->zip64) && (file->compsize >= (ZIP64_LIMIT - ZIP64_MARGIN)))
+    {
+        fail(file->name, "compress", "compressed data grew past 4 gigabytes");
+        goto writeFileDone;
+    } /* if */
+
+    if (needPatch)  /* go back and fill in the sizes and CRC. */
+    {
+        const PHYSFS_uint64 end = outPos;
+        outPos = file->offset;
+        if ((!outSeek(file->offset)) || (!writeLocalHeader(file)))
+            goto writeFileDone;
+        outPos = end;
+        if (!outSeek(end))
+            goto writeFileDone;
+    } /* if */
+
+    ok = 1;
+
+writeFileDone:
+    if (c != NULL)
+    {
+        compressorDeinit(c);
+        free(c);
+    } /* if */
+    PHYSFS_close(in);
+    return ok;
+} /* writeFile */
+
+
+/* the EOCD signature anywhere in the comment would look like the real one. */
+static int hasEndOfCentralDirSig(const unsigned char *ptr, const size_t len)
+{
+    size_t i;
+    for (i = 0; (i + 4) <= len; i++)
+    {
+        if ((ptr[i] == 0x50) && (ptr[i+1] == 0x4B) && (ptr[i+2] == 0x05) && (ptr[i+3] == 0x06))
+            return 1;
+    } /* for */
+    return 0;
+} /* hasEndOfCentralDirSig */
+
+
+/* (index), if not NULL, goes right before the central directory. */
+static int writeCentralDirectory(const RepackBuffer *index)
+{
+    unsigned char buf[128];
+    unsigned char locator[ZIP_INDEX_LOCATOR_LEN];
+    size_t commentlen = 0;
+    PHYSFS_uint64 cdofs;
+    PHYSFS_uint64 cdlen;
+    int zip64 = (fileCount >= 0xFFFF);
+    size_t i;
+
+    if ((index != NULL) && (!outWrite(index->ptr, index->len)))
+        return 0;
+
+    cdofs = outPos;
+
+    for (i = 0; i < fileCount; i++)
+    {
+        const RepackFile *file = &files[i];
+        const size_t namelen = strlen(file->name);
+        const PHYSFS_uint64 size = (PHYSFS_uint64) file->size;
+        size_t extralen = 0;
+        unsigned char *ptr = buf;
+
+        /* Zip64 only holds the fields that didn't fit, in this order. */
+        if (size >= ZIP64_LIMIT) extralen += 8;
+        if (file->compsize >= ZIP64_LIMIT) extralen += 8;
+        if (file->offset >= ZIP64_LIMIT) extralen += 8;
+        if (extralen > 0)
+        {
+            extralen += 4;
+            zip64 = 1;
+        } /* if */
+
+        ptr = put32(ptr, ZIP_CENTRAL_DIR_SIG);
+        ptr = put16(ptr, versionNeeded(file));  /* version made by: FAT. */
+        ptr = put16(ptr, versionNeeded(file));
+        ptr = put16(ptr, generalBits(file));
+        ptr = put16(ptr, file->method);
+        ptr = put16(ptr, file->dostime);
+        ptr = put16(ptr, file->dosdate);
+        ptr = put32(ptr, file->crc);
+        ptr = putSize(ptr, file->compsize);
+        ptr = putSize(ptr, size);
+        ptr = put16(ptr, (PHYSFS_uint32) namelen);
+        ptr = put16(ptr, (PHYSFS_uint32) extralen);
+        ptr = put16(ptr, 0);  /* comment length */
+        ptr = put16(ptr, 0);  /* disk number start */
+        ptr = put16(ptr, 0);  /* internal attributes */
+        ptr = put32(ptr, file->isdir ? 0x10 : 0);  /* external attributes */
+        ptr = putSize(ptr, file->offset);
+
+        if ((!outWrite(buf, (size_t) (ptr - buf))) || (!outWrite(file->name, namelen)))
+            return 0;
+
+        if (extralen > 0)
+        {
+            ptr = buf;
+            ptr = put16(ptr, ZIP64_EXTRA_SIG);
+            ptr = put16(ptr, (PHYSFS_uint32) (extralen - 4));
+            if (size >= ZIP64_LIMIT) ptr = put64(ptr, size);
+            if (file->compsize >= ZIP64_LIMIT) ptr = put64(ptr, file->compsize);
+            if (file->offset >= ZIP64_LIMIT) ptr = put64(ptr, file->offset);
+            if (!outWrite(buf, (size_t) (ptr - buf)))
+                return 0;
+        } /* if */
+    } /* for */
+
+    cdlen = outPos - cdofs;
+    if ((cdofs >= ZIP64_LIMIT) || (cdlen >= ZIP64_LIMIT))
+        zip64 = 1;
+
+    if (index != NULL)
+    {
+        PHYSFS_uint32 crc = (PHYSFS_uint32) crc32(0L, Z_NULL, 0);
+        unsigned char *ptr = locator;
+        size_t done;
+
+        for (done = 0; done < index->len; done += REPACK_CHUNK)
+        {
+            const size_t want = ((index->len - done) < REPACK_CHUNK) ? (index->len - done) : REPACK_CHUNK;
+            crc = (PHYSFS_uint32) crc32(crc, index->ptr + done, (uInt) want);
+        } /* for */
+
+        memcpy(ptr, ZIP_INDEX_LOCATOR_MAGIC, 8);
+        ptr += 8;
+        ptr = put64(ptr, (PHYSFS_uint64) index->len);
+        ptr = put32(ptr, crc);
+        ptr = put64(ptr, cdofs);
+        ptr = put64(ptr, cdlen);
+        ptr = put64(ptr, (PHYSFS_uint64) fileCount);
+        commentlen = sizeof (locator);
+
+        /* vanishingly unlikely, but it'd break the archive for everyone. */
+        if (hasEndOfCentralDirSig(locator, sizeof (locator)))
+        {
+            fprintf(stderr, "%s: can't write the mount index locator; leaving it out.\n", outName);
+            commentlen = 0;
+        } /* if */
+    } /* if */
+
+    if (zip64)
+    {
+        const PHYSFS_uint64 eocd64 = outPos;
+        unsigned char *ptr = buf;
+        ptr = put32(ptr, ZIP64_END_OF_CENTRAL_DIR_SIG);
+        ptr = put64(ptr, 44);  /* size of the rest of this record. */
+        ptr = put16(ptr, 45);  /* version made by */
+        ptr = put16(ptr, 45);  /* version needed */
+        ptr = put32(ptr, 0);  /* this disk */
+        ptr = put32(ptr, 0);  /* disk with the central directory */
+        ptr = put64(ptr, (PHYSFS_uint64) fileCount);
+        ptr = put64(ptr, (PHYSFS_uint64) fileCount);
+        ptr = put64(ptr, cdlen);
+        ptr = put64(ptr, cdofs);
+        ptr = put32(ptr, ZIP64_END_OF_CENTRAL_DIR_LOCATOR_SIG);
+        ptr = put32(ptr, 0);  /* disk with the Zip64 record */
+        ptr = put64(ptr, eocd64);
+        ptr = put32(ptr, 1);  /* total disks */
+        if (!outWrite(buf, (size_t) (ptr - buf)))
+            return 0;
+    } /* if */
+
+    {
+        const PHYSFS_uint32 count = (fileCount >= 0xFFFF) ? 0xFFFF : (PHYSFS_uint32) fileCount;
+        unsigned char *ptr = buf;
+        ptr = put32(ptr, ZIP_END_OF_CENTRAL_DIR_SIG);
+        ptr = put16(ptr, 0);  /* this disk */
+        ptr = put16(ptr, 0);  /* disk with the central directory */
+        ptr = put16(ptr, count);
+        ptr = put16(ptr, count);
+        ptr = putSize(ptr, cdlen);
+        ptr = putSize(ptr, cdofs);
+        ptr = put16(ptr, (PHYSFS_uint32) commentlen);
+        return outWrite(buf, (size_t) (ptr - buf)) && outWrite(locator, commentlen);
+    }
+} /* writeCentralDirectory */
+
+
+/*
+ * Mount the finished archive with a scratch mount index dir, which writes
+ *  its index, and read that back for -i. Offsets are resolved first, so the
+ *  index saves a mount the local headers as well as the central directory.
+ *  Only the new archive should be mounted when this is called.
+ */
+static int readMountIndex(RepackBuffer *index)
+{
+    const char *dir = PHYSFS_getPrefDir("icculus.org", "physfsrepack");
+    char path[64];
+    char **list;
+    char **i;
+    PHYSFS_File *in;
+    PHYSFS_sint64 len;
+    int retval = 0;
+
+    if ((dir == NULL) || (!PHYSFS_setWriteDir(dir)) || (!PHYSFS_mount(dir, "/index", 0)))
+        return 0;
+
+    /* anything in there is left over from an earlier run. */
+    list = PHYSFS_enumerateFiles("/index");
+    for (i = list; (i != NULL) && (*i != NULL); i++)
+        PHYSFS_delete(*i);
+    PHYSFS_freeList(list);
+
+    PHYSFS_setResolveOnMount(1);
+    if ((!PHYSFS_setMountIndexDir(dir)) || (!PHYSFS_mount(outName, "/archive", 1)))
+        return 0;
+    PHYSFS_unmount(outName);
+
+    list = PHYSFS_enumerateFiles("/index");
+    if ((list == NULL) || (list[0] == NULL) || (list[1] != NULL) ||
+        (strlen(list[0]) >= (sizeof (path) - 8)))
+    {
+        PHYSFS_freeList(list);
+        return 0;  /* the archive didn't save exactly one index. */
+    } /* if */
+
+    sprintf(path, "/index/%s", list[0]);
+    in = PHYSFS_openRead(path);
+    len = (in != NULL) ? PHYSFS_fileLength(in) : -1;
+    if ((len > 0) && (((PHYSFS_uint64) len) <= ((size_t) -1)))
+    {
+        index->ptr = (unsigned char *) malloc((size_t) len);
+        index->len = index->alloc = (size_t) len;
+        retval = (index->ptr != NULL) &&
+                 (PHYSFS_readBytes(in, index->ptr, (PHYSFS_uint64) len) == len);
+    } /* if */
+
+    if (in != NULL)
+        PHYSFS_close(in);
+    PHYSFS_delete(list[0]);
+    PHYSFS_freeList(list);
+    return retval;
+} /* readMountIndex */
+
+
+static int addFile(const char *fname, const PHYSFS_Stat *stat, const int isdir)
+{
+    RepackFile *file;
+
+    if (fileCount == fileAlloc)
+    {
+        const size_t newalloc = fileAlloc ? (fileAlloc * 2) : 1024;
+        void *ptr = realloc(files, newalloc * sizeof (RepackFile));
+        if (ptr == NULL)
+            return 0;
+        files = (RepackFile *) ptr;
+        fileAlloc = newalloc;
+    } /* if */
+
+    file = &files[fileCount];
+    memset(file, '\0', sizeof (*file));
+    file->name = (char *) malloc(strlen(fname) + 2);
+    if (file->name == NULL)
+        return 0;
+    strcpy(file->name, fname);
+    if (isdir)
+        strcat(file->name, "/");
+    file->size = isdir ? 0 : stat->filesize;
+    file->modtime = stat->modtime;
+    file->isdir = isdir;
+    file->enumorder = fileCount;
+    file->logorder = (size_t) -1;
+    toDosTime(file);
+    fileCount++;
+    return 1;
+} /* addFile */
+
+
+/*
+ * The callback enumerators report a name once per source that has it, so
+ *  this uses PHYSFS_enumerateFiles(), which merges them, and PHYSFS_stat(),
+ *  which sees the same file PHYSFS_openRead() will.
+ */
+static void addDirectory(const char *dir)
+{
+    char **list = PHYSFS_enumerateFiles(dir);
+    char **i;
+
+    if (list == NULL)
+    {
+        fail(dir, "PHYSFS_enumerateFiles", NULL);
+        return;
+    } /* if */
+
+    for (i = list; (!failure) && (*i != NULL); i++)
+    {
+        const size_t len = strlen(dir) + strlen(*i) + 2;
+        char *fname = (char *) malloc(len);
+        PHYSFS_Stat stat;
+
+        if (fname == NULL)
+        {
+            fail(*i, "malloc", "Out of memory!");
+            break;
+        } /* if */
+
+        if (*dir == '\0')
+            snprintf(fname, len, "%s", *i);
+        else
+            snprintf(fname, len, "%s/%s", dir, *i);
+
+        if (!PHYSFS_stat(fname, &stat))
+            fail(fname, "PHYSFS_stat", NULL);
+
+        else if (stat.filetype == PHYSFS_FILETYPE_DIRECTORY)
+        {
+            const size_t before = fileCount;
+            addDirectory(fname);
+            if ((fileCount == before) && (!addFile(fname, &stat, 1)))
+                fail(fname, "malloc", "Out of memory!");  /* empty ones need an entry. */
+        } /* else if */
+
+        else if (stat.filetype != PHYSFS_FILETYPE_REGULAR)
+        {
+            if (!quiet)
+                printf("%s (not a regular file; skipped)\n", fname);
+        } /* else if */
+
+        else if (stat.filesize < 0)
+            fail(fname, "PHYSFS_stat", "unknown file size");
+
+        else if (!addFile(fname, &stat, 0))
+            fail(fname, "malloc", "Out of memory!");
+
+        free(fname);
+    } /* for */
+
+    PHYSFS_freeList(list);
+} /* addDirectory */
+
+
+static int cmpByName(const void *_a, const void *_b)
+{
+    const RepackFile *a = *((const RepackFile * const *) _a);
+    const RepackFile *b = *((const RepackFile * const *) _b);
+    return strcmp(a->name, b->name);
+} /* cmpByName */
+
+
+static int cmpByOrder(const void *_a, const void *_b)
+{
+    const RepackFile *a = (const RepackFile *) _a;
+    const RepackFile *b = (const RepackFile *) _b;
+    if (a->isdir != b->isdir)
+        return a->isdir ? 1 : -1;  /* directories take no reads; last. */
+    else if (a->logorder != b->logorder)
+        return (a->logorder < b->logorder) ? -1 : 1;
+    else if (a->enumorder != b->enumorder)
+        return (a->enumorder < b->enumorder) ? -1 : 1;
+    return 0;
+} /* cmpByOrder */
+
+
+/* pull a path out of one line of the log, or NULL if it doesn't name one. */
+static char *logLinePath(char *line, const char *prefix)
+{
+    char *tab = strchr(line, '\t');
+    char *path = line;
+    size_t len;
+
+    if ((*line == '#') || (*line == '\0'))
+        return NULL;
+    else if (tab != NULL)
+    {
+        *tab = '\0';
+        if (strcmp(line, "open_read") != 0)
+            return NULL;
+        path = tab + 1;
+        tab = strchr(path, '\t');
+        if (tab != NULL)
+            *tab = '\0';
+    } /* else if */
+
+    while (*path == '/')
+        path++;
+
+    if (prefix != NULL)
+    {
+        len = strlen(prefix);
+        if ((strncmp(path, prefix, len) != 0) || ((path[len] != '/') && (path[len] != '\0')))
+            return NULL;  /* in some other archive. */
+        path += len;
+        while (*path == '/')
+            path++;
+    } /* if */
+
+    return (*path == '\0') ? NULL : path;
+} /* logLinePath */
+
+
+/* give each file its place in the log, if it's there; returns how many are. */
+static size_t readAccessLog(const char *fname, const char *prefix)
+{
+    RepackFile **sorted = NULL;
+    FILE *log = fopen(fname, "r");
+    size_t linealloc = 4096;
+    char *line = (char *) malloc(linealloc);
+    size_t found = 0;
+    size_t order = 0;
+    size_t i;
+
+    if ((log == NULL) || (line == NULL))
+    {
+        if (log != NULL)
+            fclose(log);
+        free(line);
+        fail(fname, "fopen", (log == NULL) ? "can't open access log" : "Out of memory!");
+        return 0;
+    } /* if */
+
+    if (prefix != NULL)
+    {
+        while (*prefix == '/')
+            prefix++;
+        if (*prefix == '\0')
+            prefix = NULL;
+    } /* if */
+
+    sorted = (RepackFile **) malloc(sizeof (RepackFile *) * (fileCount + 1));
+    if (sorted == NULL)
+    {
+        fclose(log);
+        free(line);
+        fail(fname, "malloc", "Out of memory!");
+        return 0;
+    } /* if */
+
+    for (i = 0; i < fileCount; i++)
+        sorted[i] = &files[i];
+    qsort(sorted, fileCount, sizeof (RepackFile *), cmpByName);
+
+    while (fgets(line, (int) linealloc, log) != NULL)
+    {
+        size_t len = strlen(line);
+        RepackFile key;
+        RepackFile *pkey = &key;
+        RepackFile **match;
+        char *path;
+
+        while ((len == (linealloc - 1)) && (line[len - 1] != '\n'))
+        {
+            char *ptr = (char *) realloc(line, linealloc * 2);  /* long line. */
+            if (ptr == NULL)
+                break;
+            line = ptr;
+            if (fgets(line + len, (int) linealloc + 1, log) == NULL)
+                break;
+            linealloc *= 2;
+            len += strlen(line + len);
+        } /* while */
+
+        while ((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r')))
+            line[--len] = '\0';
+
+        path = logLinePath(line, prefix);
+        if (path == NULL)
+            continue;
+
+        key.name = path;
+        match = (RepackFile **) bsearch(&pkey, sorted, fileCount, sizeof (RepackFile *), cmpByName);
+        if ((match != NULL) && ((*match)->logorder == (size_t) -1))
+        {
+            (*match)->logorder = order++;
+            found++;
+        } /* if */
+    } /* while */
+
+    if (ferror(log))
+        fail(fname, "fgets", "read error");
+
+    fclose(log);
+    free(sorted);
+    free(line);
+    return found;
+} /* readAccessLog */
+
+
+static int usage(const char *argv0)
+{
+    fprintf(stderr,
+        "USAGE: %s [-t accesslog] [-p mountpoint] [-a alignment] [-l level]\n"
+        "       [-0] [-z] [-i] [-q] <out.zip> <source> [source ...]\n"
+        "\n", argv0);
+    fprintf(stderr,
+        "  -t  lay out files opened in this log first, in first-open order\n"
+        "  -p  where the app mounts this archive (paths in the log start here)\n"
+        "  -a  align stored files' data to this many bytes (a power of two)\n"
+        "  -l  compression level\n"
+        "  -0  store everything\n"
+        "  -z  compress with Zstandard instead of deflate\n"
+        "  -i  put a mount index in the new archive\n"
+        "  -q  only report errors and the summary\n");
+    return 1;
+} /* usage */
+
+
+int main(int argc, char **argv)
+{
+    const char *logname = NULL;
+    const char *prefix = NULL;
+    RepackBuffer index = { NULL, 0, 0 };
+    PHYSFS_uint64 dataEnd = 0;
+    unsigned char *chunk = NULL;
+    RepackBuffer pending = { NULL, 0, 0 };
+    PHYSFS_uint64 totalIn = 0;
+    size_t logged = 0;
+    size_t stored = 0;
+    size_t i;
+    int argi;
+
+    for (argi = 1; (argi < argc) && (argv[argi][0] == '-'); argi++)
+    {
+        if (strcmp(argv[argi], "-q") == 0)
+            quiet = 1;
+        else if (strcmp(argv[argi], "-0") == 0)
+            storeAll = 1;
+        else if (strcmp(argv[argi], "-z") == 0)
+            useZstd = 1;
+        else if ((strcmp(argv[argi], "-t") == 0) && (argi + 1 < argc))
+            logname = argv[++argi];
+        else if ((strcmp(argv[argi], "-p") == 0) && (argi + 1 < argc))
+            prefix = argv[++argi];
+        else if (strcmp(argv[argi], "-i") == 0)
+            embedIndex = 1;
+        else if ((strcmp(argv[argi], "-a") == 0) && (argi + 1 < argc))
+            alignment = (unsigned int) atoi(argv[++argi]);
+        else if ((strcmp(argv[argi], "-l") == 0) && (argi + 1 < argc))
+            level = atoi(argv[++argi]);
+        else
+            return usage(argv[0]);
+    } /* for */
+
+    if ((argc - argi) < 2)
+        return usage(argv[0]);
+    else if ((alignment == 0) || (alignment > REPACK_MAX_ALIGN) || (alignment & (alignment - 1)))
+    {
+        fprintf(stderr, "Alignment must be a power of two, up to %d.\n", REPACK_MAX_ALIGN);
+        return 1;
+    } /* else if */
+#if !REPACK_ZSTD
+    else if (useZstd)
+    {
+        fprintf(stderr, "This build can't write Zstandard; rebuild with -DREPACK_ZSTD=1.\n");
+        return 1;
+    } /* else if */
+#endif
+
+    outName = argv[argi];
+
+    if (!PHYSFS_init(argv[0]))
+    {
+        fprintf(stderr, "PHYSFS_init() failed: %s\n", PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+        return 2;
+    } /* if */
+
+    for (i = (size_t) argi + 1; i < (size_t) argc; i++)
+    {
+        if (!PHYSFS_mount(argv[i], NULL, 1))
+        {
+            fprintf(stderr, "PHYSFS_mount('%s') failed: %s\n",
+                    argv[i], PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+            PHYSFS_deinit();
+            return 4;
+        } /* if */
+    } /* for */
+
+    addDirectory("");
+    if ((!failure) && (logname != NULL))
+        logged = readAccessLog(logname, prefix);
+    qsort(files, fileCount, sizeof (RepackFile), cmpByOrder);
+
+    chunk = (unsigned char *) malloc(REPACK_CHUNK);
+    out = fopen(outName, "wb");
+    if (chunk == NULL)
+        fail(outName, "malloc", "Out of memory!");
+    else if (out == NULL)
+        fail(outName, "fopen", "can't create output");
+
+    for (i = 0; (!failure) && (i < fileCount); i++)
+    {
+        RepackFile *file = &files[i];
+        if (!writeFile(file, chunk, &pending))
+            break;
+        totalIn += (PHYSFS_uint64) file->size;
+        stored += ((file->method == COMPMETH_NONE) && (!file->isdir));
+        if (!quiet)
+        {
+            printf("%s (%lld -> %llu bytes, %s)\n", file->name,
+                   (long long) file->size, (unsigned long long) file->compsize,
+                   file->isdir ? "directory" :
+                   (file->method == COMPMETH_NONE) ? "stored" :
+                   (file->method == COMPMETH_ZSTD) ? "zstd" : "deflated");
+        } /* if */
+    } /* for */
+
+    dataEnd = outPos;
+    if (!failure)
+        writeCentralDirectory(NULL);
+
+    if ((out != NULL) && (fclose(out) != 0))
+        fail(outName, "fclose", "write error");
+    out = NULL;
+    free(chunk);
+    free(pending.ptr);
+
+    /* the same entries again, after the index; the data doesn't move. */
+    if ((!failure) && (embedIndex))
+    {
+        PHYSFS_deinit();
+        if ((!PHYSFS_init(argv[0])) || (!readMountIndex(&index)))
+            fail(outName, "building the mount index", NULL);
+        PHYSFS_deinit();
+
+        if (!failure)
+        {
+            out = fopen(outName, "r+b");
+            outPos = dataEnd;
+            if (out == NULL)
+                fail(outName, "fopen", "can't reopen output");
+            else if (outSeek(dataEnd))
+                writeCentralDirectory(&index);
+        } /* if */
+
+        if ((out != NULL) && (fclose(out) != 0))
+            fail(outName, "fclose", "write error");
+        free(index.ptr);
+    } /* if */
+
+    if (failure)
+        remove(outName);
+    else
+    {
+        printf("%lu entries (%lu from the access log, %lu stored), %llu bytes in, %llu bytes out\n",
+               (unsigned long) fileCount, (unsigned long) logged, (unsigned long) stored,
+               (unsigned long long) totalIn, (unsigned long long) outPos);
+    } /* else */
+
+    PHYSFS_deinit();
+
+    for (i = 0; i < fileCount; i++)
+        free(files[i].name);
+    free(files);
+
+    return failure ? 5 : 0;
+} /* main */
+
+/* end of physfsrepack.c ... */
@@ -47,42 +47,192 @@ typedef struct __PHYSFS_DIRHANDLE__
     char *root;  /* subdirectory of archiver to use as root of archive (NULL for actual root) */
     size_t rootlen;  /* subdirectory of archiver to use as root of archive (NULL for actual root) */
     const PHYSFS_Archiver *funcs;  /* Ptr to archiver info for this handle. */
+    void *lock;  /* serializes calls into the archiver from lookups. */
+    int refcount;  /* search path, snapshots, and open files. */
+#if PHYSFS_SUPPORTS_STATS
+    PHYSFS_Stats stats;  /* for PHYSFS_getStats(); updated without locking. */
+#endif
     struct __PHYSFS_DIRHANDLE__ *next;  /* linked list stuff. */
 } DirHandle;
 
 
+/*
+ * With PHYSFS_setSearchPathIndexed(1), a search path snapshot (see below)
+ *  also gets a merged index
+ *  of every path in the search path, each naming the first archive that has
+ *  it, so lookups can skip archives that can't have a file at all. Archives
+ *  that can change under us (the physical filesystem) or that we couldn't
+ *  walk aren't in the index and are always probed. Paths are compared
+ *  case-insensitively here; that only makes the index find more candidates,
+ *  the archivers still decide what really matches.
+ */
+typedef struct
+{
+    __PHYSFS_DirTreeEntry tree;
+    DirHandle *owner;  /* first archive in search path order with this path. */
+} SearchPathIndexEntry;
+
+typedef struct __PHYSFS_SEARCHPATHINDEX__
+{
+    __PHYSFS_DirTree tree;  /* SearchPathIndexEntry items. */
+    size_t count;  /* number of items in (dirs) and (probe). */
+    DirHandle **dirs;  /* search path order when this was built. Not ref'd! */
+    PHYSFS_uint8 *probe;  /* non-zero if dirs[i] isn't in the index. */
+} SearchPathIndex;
+
+
+/*
+ * Lookups (opening, stat'ing and enumerating files) don't hold stateLock
+ *  while they walk the search path. They take a reference to an immutable
+ *  snapshot of it instead, and only lock each archive (DirHandle::lock)
+ *  while calling into it. Mounting, unmounting and PHYSFS_setRoot() change
+ *  the real list under stateLock and drop the current snapshot; the next
+ *  lookup builds a new one. A DirHandle is freed when its last reference
+ *  (from the search path, a snapshot, or an open file) goes away.
+ */
+typedef struct __PHYSFS_SEARCHPATHSNAPSHOT__
+{
+    int refcount;  /* one for being current, one per lookup using it. */
+    size_t longest_root;  /* longest_root when this was built. */
+    SearchPathIndex *index;  /* NULL if lookups have to probe everything. */
+    size_t count;  /* number of items in (dirs). */
+    DirHandle *dirs[1];  /* search path order; really (count) items. */
+} SearchPathSnapshot;
+
+
 typedef struct __PHYSFS_FILEHANDLE__
 {
     PHYSFS_Io *io;  /* Instance data unique to the archiver for this file. */
     PHYSFS_uint8 forReading; /* Non-zero if reading, zero if write/append */
-    const DirHandle *dirHandle;  /* Archiver instance that created this */
+    DirHandle *dirHandle;  /* Archiver instance that created this */
     PHYSFS_uint8 *buffer;  /* Buffer, if set (NULL otherwise). Don't touch! */
     size_t bufsize;  /* Bufsize, if set (0 otherwise). Don't touch! */
     size_t buffill;  /* Buffer fill size. Don't touch! */
     size_t bufpos;  /* Buffer position. Don't touch! */
+    size_t bufcap;  /* Allocated size of buffer, >= bufsize. Don't touch! */
+    size_t bufmin;  /* Smallest adaptive bufsize, 0 if not adaptive. */
+    size_t bufmax;  /* Largest adaptive bufsize. Don't touch! */
+    PHYSFS_uint8 bufseeked;  /* Seeked since last refill? Don't touch! */
+    struct __PHYSFS_WRITEBEHIND__ *writeBehind;  /* NULL if writes are ours. */
+    struct __PHYSFS_FILEHANDLE__ **list;  /* list it's in, NULL if closed. */
+    struct __PHYSFS_FILEHANDLE__ *prev;  /* linked list stuff. */
     struct __PHYSFS_FILEHANDLE__ *next;  /* linked list stuff. */
 } FileHandle;
 
 
+typedef struct __PHYSFS_FILEMAPPING__
+{
+    const void *ptr;  /* what we handed to the app. */
+    FileHandle *handle;  /* open file that owns (ptr), NULL if we own it. */
+    struct __PHYSFS_FILEMAPPING__ *next;  /* linked list stuff. */
+} FileMapping;
+
+
+typedef struct __PHYSFS_ASYNCREAD__
+{
+    PHYSFS_Io *io;  /* private duplicate of the file's Io. */
+    DirHandle *dirHandle;  /* reference that keeps the archive open. */
+    PHYSFS_uint64 offset;  /* where in the file to read from. */
+    void *buffer;  /* app's buffer. */
+    size_t len;  /* bytes requested. */
+    PHYSFS_AsyncReadCallback callback;  /* app's callback, NULL if none. */
+    void *callbackdata;  /* passed to (callback). */
+    PHYSFS_sint64 result;  /* like PHYSFS_readBytes()'s return value. */
+    PHYSFS_ErrorCode errcode;  /* why (result) is -1. */
+    void *lock;  /* protects (done); NULL if it finished before we returned. */
+    int done;  /* non-zero once the read and callback are finished. */
+    void *finished;  /* semaphore, posted once when (done) is set. */
+    struct __PHYSFS_ASYNCREAD__ *next;  /* linked list stuff. */
+} AsyncRead;
+
+
+typedef struct __PHYSFS_WRITEBEHINDJOB__
+{
+    struct __PHYSFS_WRITEBEHIND__ *file;  /* what to write to. */
+    size_t len;  /* bytes of data after this struct, 0 for close jobs. */
+    struct __PHYSFS_WRITEBEHINDJOB__ *next;  /* linked list stuff. */
+} WriteBehindJob;
+
+
+typedef struct __PHYSFS_PRELOAD__
+{
+    PHYSFS_Io *io;  /* private duplicate of the archive's Io. */
+    struct __PHYSFS_PRELOAD__ *next;  /* linked list stuff. */
+} Preload;
+
+
+typedef struct __PHYSFS_WRITEBEHIND__
+{
+    PHYSFS_Io *io;  /* the file's Io; only the writer uses it while busy. */
+    DirHandle *dirHandle;  /* reference held once the app closed the file. */
+    PHYSFS_uint64 pos;  /* where the file will be when the queue is done. */
+    size_t maxQueued;  /* most bytes to queue at once. */
+    size_t queued;  /* bytes queued and not written yet. */
+    int waiters;  /* threads waiting on (progress). */
+    void *progress;  /* semaphore, posted per waiter as each job finishes. */
+    PHYSFS_ErrorCode errcode;  /* first write that failed, sticks. */
+    WriteBehindJob closeJob;  /* always there, so closing can't fail. */
+} WriteBehind;
+
+
 typedef struct __PHYSFS_ERRSTATETYPE__
 {
+#ifdef PHYSFS_NO_THREAD_LOCAL
     void *tid;
-    PHYSFS_ErrorCode code;
     struct __PHYSFS_ERRSTATETYPE__ *next;
+#else
+    int generation;  /* state is stale if this doesn't match errorGeneration. */
+#endif
+    PHYSFS_ErrorCode code;
 } ErrState;
 
 
 /* General PhysicsFS state ... */
 static int initialized = 0;
+#ifdef PHYSFS_NO_THREAD_LOCAL
 static ErrState *errorStates = NULL;
+#else
+static __PHYSFS_THREAD_LOCAL ErrState threadErrorState;
+static int errorGeneration = 1;
+#endif
 static DirHandle *searchPath = NULL;
+static SearchPathSnapshot *searchPathSnapshot = NULL;
+static SearchPathIndex *spareSearchPathIndex = NULL;
+static PHYSFS_uint32 searchPathGeneration = 0;
+static int buildingSearchPathIndex = 0;
+static int indexSearchPath = 0;
 static DirHandle *writeDir = NULL;
 static FileHandle *openWriteList = NULL;
 static FileHandle *openReadList = NULL;
+static __PHYSFS_Pool fileHandlePool;
+static FileMapping *fileMappings = NULL;
+static AsyncRead *asyncReadQueue = NULL;
+static AsyncRead *asyncReadQueueTail = NULL;
+static void *asyncReadWork = NULL;  /* semaphore, posted per queued read. */
+static void **asyncReadThreads = NULL;
+static int asyncReadThreadCount = 0;
+static int asyncReadUnavailable = 0;  /* couldn't start threads; don't retry. */
+static WriteBehindJob *writeBehindQueue = NULL;
+static WriteBehindJob *writeBehindQueueTail = NULL;
+static void *writeBehindWork = NULL;  /* semaphore, posted per queued job. */
+static void *writeBehindThread = NULL;
+static int writeBehindUnavailable = 0;  /* couldn't start the thread. */
+static Preload *preloadQueue = NULL;
+static Preload *preloadQueueTail = NULL;
+static void *preloadWork = NULL;  /* semaphore, posted per queued preload. */
+static void *preloadThread = NULL;
+static int preloadUnavailable = 0;  /* couldn't start the thread. */
+static int preloadStopping = 0;  /* shutting down; abandon preloads. */
 static char *baseDir = NULL;
 static char *userDir = NULL;
 static char *prefDir = NULL;
 static int allowSymLinks = 0;
+static int caseInsensitive = 0;
+static int cacheDirectories = 0;
+static int verifyChecksums = 0;
+static int resolveOnMount = 0;
+static int mapArchives = 1;
+static char *mountIndexDir = NULL;
 static PHYSFS_Archiver **archivers = NULL;
 static PHYSFS_ArchiveInfo **archiveInfo = NULL;
 static volatile size_t numArchivers = 0;
@@ -91,11 +241,33 @@ static size_t longest_root = 0;
 /* mutexes ... */
 static void *errorLock = NULL;     /* protects error message list.        */
 static void *stateLock = NULL;     /* protects other PhysFS static state. */
+static void *asyncReadLock = NULL; /* protects async read queue.         */
+static void *writeBehindLock = NULL; /* protects write-behind queue+files. */
+static void *preloadLock = NULL;   /* protects preload queue.            */
 
 /* allocator ... */
 static int externalAllocator = 0;
 PHYSFS_Allocator allocator;
 
+/* tracing, from PHYSFS_setTraceCallback() ... */
+static PHYSFS_TraceCallback traceCallback = NULL;
+static void *traceCallbackData = NULL;
+
+#if PHYSFS_SUPPORTS_STATS
+PHYSFS_Stats __PHYSFS_globalStats;
+
+/* grab stateLock, counting how long we had to wait for it. */
+static void grabStateLock(void)
+{
+    const PHYSFS_uint64 started = __PHYSFS_platformNanoseconds();
+    __PHYSFS_platformGrabMutex(stateLock);
+    __PHYSFS_STAT_ADD_GLOBAL(lockWaitNanoseconds,
+                             __PHYSFS_platformNanoseconds() - started);
+} /* grabStateLock */
+#else
+#define grabStateLock() __PHYSFS_platformGrabMutex(stateLock)
+#endif
+
 
 #ifdef PHYSFS_NEED_ATOMIC_OP_FALLBACK
 static inline int __PHYSFS_atomicAdd(int *ptrval, const int val)
@@ -123,64 +295,150 @@ int __PHYSFS_ATOMIC_DECR(int *ptrval)
 
 /* PHYSFS_Io implementation for i/o to physical filesystem... */
 
+/*
+ * Read-only native Ios share one OS handle between duplicates, and each one
+ *  keeps its own position, reading with __PHYSFS_platformReadAt(). That way
+ *  opening files in a mounted archive doesn't reopen the archive on disk.
+ *  Writing and appending Ios (and platforms without positional reads) own
+ *  their handle and use its file pointer, like they always have.
+ */
+
 /* !!! FIXME: maybe refcount the paths in a string pool? */
-typedef struct __PHYSFS_NativeIoInfo
+typedef struct __PHYSFS_NativeIoFile
 {
     void *handle;
     const char *path;
     int mode;   /* 'r', 'w', or 'a' */
+    int refcount;
+    const PHYSFS_uint8 * volatile ram;  /* whole file, once preloaded. */
+    PHYSFS_uint64 ramlen;
+#if PHYSFS_SUPPORTS_STATS
+    PHYSFS_Stats *stats;  /* archive that reads count against, or NULL. */
+#endif
+} NativeIoFile;
+
+typedef struct __PHYSFS_NativeIoInfo
+{
+    NativeIoFile *file;
+    PHYSFS_uint64 pos;  /* only used by shared (positional) handles. */
 } NativeIoInfo;
 
+#ifdef PHYSFS_NO_POSITIONAL_READ
+#define nativeIoModeIsShared(mode) (0)
+#else
+#define nativeIoModeIsShared(mode) ((mode) == 'r')
+#endif
+#define nativeIoIsShared(file) nativeIoModeIsShared((file)->mode)
+
 static PHYSFS_sint64 nativeIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_platformRead(info->handle, buf, len);
+
+    #ifndef PHYSFS_NO_POSITIONAL_READ
+    if (nativeIoIsShared(info->file))
+    {
+        const PHYSFS_uint8 *ram = __PHYSFS_ATOMIC_GETPTR(&info->file->ram);
+        PHYSFS_sint64 rc;
+        if (ram != NULL)  /* preloaded; no need to bother the OS. */
+        {
+            const PHYSFS_uint64 ramlen = info->file->ramlen;
+            const PHYSFS_uint64 avail = (info->pos < ramlen) ? (ramlen - info->pos) : 0;
+            if (len > avail)
+                len = avail;
+            if (len > 0)
+                memcpy(buf, ram + info->pos, (size_t) len);
+            rc = (PHYSFS_sint64) len;
+        } /* if */
+        else
+        {
+            rc = __PHYSFS_platformReadAt(info->file->handle, buf, len, info->pos);
+        } /* else */
+
+        if (rc > 0)
+        {
+            info->pos += (PHYSFS_uint64) rc;
+            __PHYSFS_STAT_ADD(info->file->stats, archiveBytesRead, rc);
+        } /* if */
+        return rc;
+    } /* if */
+    #endif
+
+    {
+        const PHYSFS_sint64 rc = __PHYSFS_platformRead(info->file->handle, buf, len);
+        if (rc > 0)
+            __PHYSFS_STAT_ADD(info->file->stats, archiveBytesRead, rc);
+        return rc;
+    }
 } /* nativeIo_read */
 
 static PHYSFS_sint64 nativeIo_write(PHYSFS_Io *io, const void *buffer,
                                     PHYSFS_uint64 len)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_platformWrite(info->handle, buffer, len);
+    BAIL_IF(nativeIoIsShared(info->file), PHYSFS_ERR_OPEN_FOR_READING, -1);
+    return __PHYSFS_platformWrite(info->file->handle, buffer, len);
 } /* nativeIo_write */
 
 static int nativeIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_platformSeek(info->handle, offset);
+    if (nativeIoIsShared(info->file))
+    {
+        info->pos = offset;  /* like lseek(), past EOF is fine until a read. */
+        return 1;
+    } /* if */
+    return __PHYSFS_platformSeek(info->file->handle, offset);
 } /* nativeIo_seek */
 
 static PHYSFS_sint64 nativeIo_tell(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_platformTell(info->handle);
+    if (nativeIoIsShared(info->file))
+        return (PHYSFS_sint64) info->pos;
+    return __PHYSFS_platformTell(info->file->handle);
 } /* nativeIo_tell */
 
 static PHYSFS_sint64 nativeIo_length(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_platformFileLength(info->handle);
+    if (__PHYSFS_ATOMIC_GETPTR(&info->file->ram) != NULL)
+        return (PHYSFS_sint64) info->file->ramlen;
+    return __PHYSFS_platformFileLength(info->file->handle);
 } /* nativeIo_length */
 
+static PHYSFS_Io *createNativeIoForFile(NativeIoFile *file);
+
 static PHYSFS_Io *nativeIo_duplicate(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_createNativeIo(info->path, info->mode);
+    if (nativeIoIsShared(info->file))
+        return createNativeIoForFile(info->file);
+    return __PHYSFS_createNativeIo(info->file->path, info->file->mode);
 } /* nativeIo_duplicate */
 
 static int nativeIo_flush(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    return __PHYSFS_platformFlush(info->handle);
+    return __PHYSFS_platformFlush(info->file->handle);
 } /* nativeIo_flush */
 
 static void nativeIo_destroy(PHYSFS_Io *io)
 {
     NativeIoInfo *info = (NativeIoInfo *) io->opaque;
-    __PHYSFS_platformClose(info->handle);
-    allocator.Free((void *) info->path);
+    NativeIoFile *file = info->file;
+
     allocator.Free(info);
     allocator.Free(io);
+
+    if (__PHYSFS_ATOMIC_DECR(&file->refcount) == 0)
+    {
+        __PHYSFS_platformClose(file->handle);
+        if (file->path != NULL)
+            allocator.Free((void *) file->path);
+        if (file->ram != NULL)
+            allocator.Free((void *) file->ram);
+        allocator.Free(file);
+    } /* if */
 } /* nativeIo_destroy */
 
 static const PHYSFS_Io __PHYSFS_nativeIoInterface =
@@ -196,21 +454,73 @@ static const PHYSFS_Io __PHYSFS_nativeIoInterface =
     nativeIo_destroy
 };
 
-PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode)
+/* takes a new reference to (file) on success. */
+static PHYSFS_Io *createNativeIoForFile(NativeIoFile *file)
 {
     PHYSFS_Io *io = NULL;
     NativeIoInfo *info = NULL;
+
+    io = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    BAIL_IF(!io, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    info = (NativeIoInfo *) allocator.Malloc(sizeof (NativeIoInfo));
+    if (!info)
+    {
+        allocator.Free(io);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    (void) __PHYSFS_ATOMIC_INCR(&file->refcount);
+    info->file = file;
+    info->pos = 0;
+    memcpy(io, &__PHYSFS_nativeIoInterface, sizeof (*io));
+    io->opaque = info;
+    return io;
+} /* createNativeIoForFile */
+
+/*
+ * Takes over (handle) and (path), even on failure. (path) is only used to
+ *  reopen the file for a duplicate, so it can be NULL for shared handles.
+ */
+static PHYSFS_Io *createNativeIoForHandle(void *handle, char *path,
+                                          const int mode)
+{
+    NativeIoFile *file = NULL;
+    PHYSFS_Io *io = NULL;
+
+    file = (NativeIoFile *) allocator.Malloc(sizeof (NativeIoFile));
+    GOTO_IF(!file, PHYSFS_ERR_OUT_OF_MEMORY, createNativeIo_failed);
+
+    file->handle = handle;
+    file->path = path;
+    file->mode = mode;
+    file->refcount = 0;
+    file->ram = NULL;
+    file->ramlen = 0;
+#if PHYSFS_SUPPORTS_STATS
+    file->stats = NULL;
+#endif
+
+    io = createNativeIoForFile(file);
+    GOTO_IF_ERRPASS(!io, createNativeIo_failed);
+    return io;
+
+createNativeIo_failed:
+    __PHYSFS_platformClose(handle);
+    if (path != NULL) allocator.Free(path);
+    if (file != NULL) allocator.Free(file);
+    return NULL;
+} /* createNativeIoForHandle */
+
+PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode)
+{
     void *handle = NULL;
     char *pathdup = NULL;
 
     assert((mode == 'r') || (mode == 'w') || (mode == 'a'));
 
-    io = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    GOTO_IF(!io, PHYSFS_ERR_OUT_OF_MEMORY, createNativeIo_failed);
-    info = (NativeIoInfo *) allocator.Malloc(sizeof (NativeIoInfo));
-    GOTO_IF(!info, PHYSFS_ERR_OUT_OF_MEMORY, createNativeIo_failed);
     pathdup = (char *) allocator.Malloc(strlen(path) + 1);
-    GOTO_IF(!pathdup, PHYSFS_ERR_OUT_OF_MEMORY, createNativeIo_failed);
+    BAIL_IF(!pathdup, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    strcpy(pathdup, path);
 
     if (mode == 'r')
         handle = __PHYSFS_platformOpenRead(path);
@@ -219,23 +529,236 @@ PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode)
     else if (mode == 'a')
         handle = __PHYSFS_platformOpenAppend(path);
 
-    GOTO_IF_ERRPASS(!handle, createNativeIo_failed);
+    if (!handle)
+    {
+        allocator.Free(pathdup);
+        return NULL;
+    } /* if */
+
+    return createNativeIoForHandle(handle, pathdup, mode);
+} /* __PHYSFS_createNativeIo */
 
-    strcpy(pathdup, path);
-    info->handle = handle;
-    info->path = pathdup;
-    info->mode = mode;
-    memcpy(io, &__PHYSFS_nativeIoInterface, sizeof (*io));
+#ifdef PHYSFS_PLATFORM_POSIX
+PHYSFS_Io *__PHYSFS_createNativeIoAt(const int dirfd, const char *dirname,
+                                     const char *path, const int mode)
+{
+    char *fullpath = NULL;
+    void *handle;
+
+    assert((mode == 'r') || (mode == 'w') || (mode == 'a'));
+
+    /* shared handles never reopen by name, so don't bother building it. */
+    if (!nativeIoModeIsShared(mode))
+    {
+        const size_t dirlen = strlen(dirname);
+        fullpath = (char *) allocator.Malloc(dirlen + strlen(path) + 1);
+        BAIL_IF(!fullpath, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        memcpy(fullpath, dirname, dirlen);
+        strcpy(fullpath + dirlen, path);
+    } /* if */
+
+    handle = __PHYSFS_platformOpenAt(dirfd, path, mode);
+    if (!handle)
+    {
+        if (fullpath != NULL)
+            allocator.Free(fullpath);
+        return NULL;
+    } /* if */
+
+    return createNativeIoForHandle(handle, fullpath, mode);
+} /* __PHYSFS_createNativeIoAt */
+#endif
+
+
+/* PHYSFS_Io implementation for read-only, memory-mapped physical files... */
+
+typedef struct __PHYSFS_MappedFile
+{
+    const PHYSFS_uint8 *buf;
+    PHYSFS_uint64 len;
+    int refcount;
+    char *path;    /* for PHYSFS_getNativeRange() to open (handle) with. */
+    void *handle;  /* NULL until PHYSFS_getNativeRange() needs it. */
+    const PHYSFS_uint8 * volatile ram;  /* copy of (buf), once preloaded. */
+#if PHYSFS_SUPPORTS_STATS
+    PHYSFS_Stats *stats;  /* archive that reads count against, or NULL. */
+#endif
+} MappedFile;
+
+typedef struct __PHYSFS_MappedIoInfo
+{
+    MappedFile *map;   /* shared between duplicates. */
+    PHYSFS_uint64 pos;
+} MappedIoInfo;
+
+static PHYSFS_sint64 mappedIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+{
+    MappedIoInfo *info = (MappedIoInfo *) io->opaque;
+    const PHYSFS_uint64 avail = info->map->len - info->pos;
+    const PHYSFS_uint8 *src;
+    assert(avail <= info->map->len);
+
+    if (avail == 0)
+        return 0;  /* we're at EOF; nothing to do. */
+
+    if (len > avail)
+        len = avail;
+
+    src = __PHYSFS_ATOMIC_GETPTR(&info->map->ram);
+    if (src == NULL)
+        src = info->map->buf;  /* not preloaded (or it's locked in place). */
+    memcpy(buf, src + info->pos, (size_t) len);
+    info->pos += len;
+    __PHYSFS_STAT_ADD(info->map->stats, archiveBytesRead, len);
+    return len;
+} /* mappedIo_read */
+
+static PHYSFS_sint64 mappedIo_write(PHYSFS_Io *io, const void *buffer,
+                                    PHYSFS_uint64 len)
+{
+    BAIL(PHYSFS_ERR_OPEN_FOR_READING, -1);
+} /* mappedIo_write */
+
+static int mappedIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    MappedIoInfo *info = (MappedIoInfo *) io->opaque;
+    BAIL_IF(offset > info->map->len, PHYSFS_ERR_PAST_EOF, 0);
+    info->pos = offset;
+    return 1;
+} /* mappedIo_seek */
+
+static PHYSFS_sint64 mappedIo_tell(PHYSFS_Io *io)
+{
+    const MappedIoInfo *info = (MappedIoInfo *) io->opaque;
+    return (PHYSFS_sint64) info->pos;
+} /* mappedIo_tell */
+
+static PHYSFS_sint64 mappedIo_length(PHYSFS_Io *io)
+{
+    const MappedIoInfo *info = (MappedIoInfo *) io->opaque;
+    return (PHYSFS_sint64) info->map->len;
+} /* mappedIo_length */
+
+static PHYSFS_Io *createMappedIoForMap(MappedFile *map);
+
+static PHYSFS_Io *mappedIo_duplicate(PHYSFS_Io *io)
+{
+    MappedIoInfo *info = (MappedIoInfo *) io->opaque;
+    return createMappedIoForMap(info->map);  /* share the mapping. */
+} /* mappedIo_duplicate */
+
+static int mappedIo_flush(PHYSFS_Io *io) { return 1;  /* it's read-only. */ }
+
+static void mappedIo_destroy(PHYSFS_Io *io)
+{
+    MappedIoInfo *info = (MappedIoInfo *) io->opaque;
+    MappedFile *map = info->map;
+
+    allocator.Free(info);
+    allocator.Free(io);
+
+    if (__PHYSFS_ATOMIC_DECR(&map->refcount) == 0)
+    {
+        __PHYSFS_platformUnmapFile(map->buf, map->len);
+        if (map->handle != NULL)
+            __PHYSFS_platformClose(map->handle);
+        if (map->ram != NULL)
+            allocator.Free((void *) map->ram);
+        allocator.Free(map->path);
+        allocator.Free(map);
+    } /* if */
+} /* mappedIo_destroy */
+
+static const PHYSFS_Io __PHYSFS_mappedIoInterface =
+{
+    CURRENT_PHYSFS_IO_API_VERSION, NULL,
+    mappedIo_read,
+    mappedIo_write,
+    mappedIo_seek,
+    mappedIo_tell,
+    mappedIo_length,
+    mappedIo_duplicate,
+    mappedIo_flush,
+    mappedIo_destroy
+};
+
+/* takes a new reference to (map) on success. */
+static PHYSFS_Io *createMappedIoForMap(MappedFile *map)
+{
+    PHYSFS_Io *io = NULL;
+    MappedIoInfo *info = NULL;
+
+    io = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    BAIL_IF(!io, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    info = (MappedIoInfo *) allocator.Malloc(sizeof (MappedIoInfo));
+    if (!info)
+    {
+        allocator.Free(io);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    (void) __PHYSFS_ATOMIC_INCR(&map->refcount);
+    info->map = map;
+    info->pos = 0;
+    memcpy(io, &__PHYSFS_mappedIoInterface, sizeof (*io));
     io->opaque = info;
     return io;
+} /* createMappedIoForMap */
 
-createNativeIo_failed:
-    if (handle != NULL) __PHYSFS_platformClose(handle);
-    if (pathdup != NULL) allocator.Free(pathdup);
-    if (info != NULL) allocator.Free(info);
-    if (io != NULL) allocator.Free(io);
-    return NULL;
-} /* __PHYSFS_createNativeIo */
+PHYSFS_Io *__PHYSFS_createMappedIo(const char *path)
+{
+    MappedFile *map = NULL;
+    PHYSFS_Io *io = NULL;
+    PHYSFS_uint64 len = 0;
+    const void *buf;
+
+    buf = __PHYSFS_platformMapFile(path, &len);
+    BAIL_IF_ERRPASS(!buf, NULL);
+
+    map = (MappedFile *) allocator.Malloc(sizeof (MappedFile));
+    if (map != NULL)
+    {
+        map->buf = (const PHYSFS_uint8 *) buf;
+        map->len = len;
+        map->refcount = 0;
+        map->handle = NULL;
+        map->ram = NULL;
+        map->path = (char *) allocator.Malloc(strlen(path) + 1);
+#if PHYSFS_SUPPORTS_STATS
+        map->stats = NULL;
+#endif
+        if (map->path != NULL)
+        {
+            strcpy(map->path, path);
+            io = createMappedIoForMap(map);
+        } /* if */
+    } /* if */
+
+    if (!io)
+    {
+        if (map != NULL)
+        {
+            allocator.Free(map->path);
+            allocator.Free(map);
+        } /* if */
+        __PHYSFS_platformUnmapFile(buf, len);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    return io;
+} /* __PHYSFS_createMappedIo */
+
+
+#if PHYSFS_SUPPORTS_STATS
+/* count reads through (io), and its duplicates, against an archive's stats. */
+static void attachIoStats(PHYSFS_Io *io, PHYSFS_Stats *stats)
+{
+    if (io->destroy == nativeIo_destroy)
+        ((NativeIoInfo *) io->opaque)->file->stats = stats;
+    else if (io->destroy == mappedIo_destroy)
+        ((MappedIoInfo *) io->opaque)->map->stats = stats;
+} /* attachIoStats */
+#endif
 
 
 /* PHYSFS_Io implementation for i/o to a memory buffer... */
@@ -411,46 +934,193 @@ createMemoryIo_failed:
 } /* __PHYSFS_createMemoryIo */
 
 
-/* PHYSFS_Io implementation for i/o to a PHYSFS_File... */
-
-static PHYSFS_sint64 handleIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+const void *__PHYSFS_getIoBuffer(PHYSFS_Io *io, PHYSFS_uint64 *len)
 {
-    return PHYSFS_readBytes((PHYSFS_File *) io->opaque, buf, len);
-} /* handleIo_read */
+    const void *retval = NULL;
 
-static PHYSFS_sint64 handleIo_write(PHYSFS_Io *io, const void *buffer,
-                                    PHYSFS_uint64 len)
-{
-    return PHYSFS_writeBytes((PHYSFS_File *) io->opaque, buffer, len);
-} /* handleIo_write */
+    if (io->destroy == memoryIo_destroy)
+    {
+        const MemoryIoInfo *info = (MemoryIoInfo *) io->opaque;
+        *len = info->len;
+        retval = info->buf;
+    } /* if */
 
-static int handleIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
-{
-    return PHYSFS_seek((PHYSFS_File *) io->opaque, offset);
-} /* handleIo_seek */
+    else if (io->destroy == mappedIo_destroy)
+    {
+        const MappedIoInfo *info = (MappedIoInfo *) io->opaque;
+        *len = info->map->len;
+        retval = __PHYSFS_ATOMIC_GETPTR(&info->map->ram);
+        if (retval == NULL)
+            retval = info->map->buf;
+    } /* else if */
 
-static PHYSFS_sint64 handleIo_tell(PHYSFS_Io *io)
-{
-    return PHYSFS_tell((PHYSFS_File *) io->opaque);
-} /* handleIo_tell */
+    else if (io->destroy == nativeIo_destroy)
+    {
+        const NativeIoInfo *info = (NativeIoInfo *) io->opaque;
+        retval = __PHYSFS_ATOMIC_GETPTR(&info->file->ram);  /* if preloaded. */
+        if (retval != NULL)
+            *len = info->file->ramlen;
+    } /* else if */
 
-static PHYSFS_sint64 handleIo_length(PHYSFS_Io *io)
-{
-    return PHYSFS_fileLength((PHYSFS_File *) io->opaque);
-} /* handleIo_length */
+    #if PHYSFS_SUPPORTS_ZIP
+    if (retval == NULL)
+        retval = ZIP_getIoBuffer(io, len);
+    #endif
+    #if PHYSFS_SUPPORTS_7Z
+    if (retval == NULL)
+        retval = SZIP_getIoBuffer(io, len);
+    #endif
 
-static PHYSFS_Io *handleIo_duplicate(PHYSFS_Io *io)
+    return retval;
+} /* __PHYSFS_getIoBuffer */
+
+
+int __PHYSFS_getIoRange(PHYSFS_Io *io, PHYSFS_Io **base,
+                        PHYSFS_uint64 *offset, PHYSFS_uint64 *len, int *raw)
 {
-    /*
-     * There's no duplicate at the PHYSFS_File level, so we break the
+    PHYSFS_Io *parent = NULL;
+    PHYSFS_uint64 pos = 0;
+    PHYSFS_uint64 size = 0;
+    int verbatim = 0;
+    int found = 0;
+
+    #if PHYSFS_SUPPORTS_ZIP
+    if (!found)
+        found = ZIP_getIoRange(io, &parent, &pos, &size, &verbatim);
+    #endif
+    if (!found)
+        found = UNPK_getIoRange(io, &parent, &pos, &size, &verbatim);
+
+    if (!found)  /* can't see through this one; it's the bottom. */
+    {
+        const PHYSFS_sint64 iolen = io->length(io);
+        BAIL_IF_ERRPASS(iolen < 0, 0);
+        *base = io;
+        *offset = 0;
+        *len = (PHYSFS_uint64) iolen;
+        *raw = 1;
+        return 1;
+    } /* if */
+
+    /* if the parent isn't a plain slice of something, stop at the parent. */
+    if ((!__PHYSFS_getIoRange(parent, base, offset, len, raw)) || (!*raw))
+    {
+        *base = parent;
+        *offset = 0;
+    } /* if */
+
+    *offset += pos;
+    *len = size;
+    *raw = verbatim;
+    return 1;
+} /* __PHYSFS_getIoRange */
+
+
+int __PHYSFS_verifyIo(PHYSFS_Io *io, const int check)
+{
+    #if PHYSFS_SUPPORTS_ZIP
+    return ZIP_verifyIo(io, check);
+    #else
+    return 1;  /* nothing else checks. */
+    #endif
+} /* __PHYSFS_verifyIo */
+
+
+/*
+ * Closed FileHandles are kept for the next open, up to this many; programs
+ *  that stream lots of short-lived files skip a malloc/free pair per file.
+ */
+#ifndef PHYSFS_FILEHANDLE_POOL_SIZE
+#define PHYSFS_FILEHANDLE_POOL_SIZE 32
+#endif
+
+static FileHandle *allocFileHandle(void)
+{
+    FileHandle *fh = (FileHandle *) __PHYSFS_poolGet(&fileHandlePool);
+    if (fh == NULL)
+        fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
+    BAIL_IF(!fh, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(fh, '\0', sizeof (FileHandle));
+    return fh;
+} /* allocFileHandle */
+
+static void freeFileHandle(FileHandle *fh)
+{
+    if (!__PHYSFS_poolPut(&fileHandlePool, fh))
+        allocator.Free(fh);
+} /* freeFileHandle */
+
+static void freePooledFileHandle(void *fh)
+{
+    allocator.Free(fh);
+} /* freePooledFileHandle */
+
+/* MAKE SURE you hold stateLock before calling this! */
+static void linkFileHandle(FileHandle *fh, FileHandle **list)
+{
+    fh->list = list;
+    fh->prev = NULL;
+    fh->next = *list;
+    if (*list != NULL)
+        (*list)->prev = fh;
+    *list = fh;
+} /* linkFileHandle */
+
+/* MAKE SURE you hold stateLock before calling this! */
+static void unlinkFileHandle(FileHandle *fh)
+{
+    if (fh->prev != NULL)
+        fh->prev->next = fh->next;
+    else
+        *fh->list = fh->next;
+
+    if (fh->next != NULL)
+        fh->next->prev = fh->prev;
+
+    fh->list = NULL;
+    fh->prev = fh->next = NULL;
+} /* unlinkFileHandle */
+
+
+/* PHYSFS_Io implementation for i/o to a PHYSFS_File... */
+
+static PHYSFS_sint64 handleIo_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+{
+    return PHYSFS_readBytes((PHYSFS_File *) io->opaque, buf, len);
+} /* handleIo_read */
+
+static PHYSFS_sint64 handleIo_write(PHYSFS_Io *io, const void *buffer,
+                                    PHYSFS_uint64 len)
+{
+    return PHYSFS_writeBytes((PHYSFS_File *) io->opaque, buffer, len);
+} /* handleIo_write */
+
+static int handleIo_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    return PHYSFS_seek((PHYSFS_File *) io->opaque, offset);
+} /* handleIo_seek */
+
+static PHYSFS_sint64 handleIo_tell(PHYSFS_Io *io)
+{
+    return PHYSFS_tell((PHYSFS_File *) io->opaque);
+} /* handleIo_tell */
+
+static PHYSFS_sint64 handleIo_length(PHYSFS_Io *io)
+{
+    return PHYSFS_fileLength((PHYSFS_File *) io->opaque);
+} /* handleIo_length */
+
+static PHYSFS_Io *handleIo_duplicate(PHYSFS_Io *io)
+{
+    /*
+     * There's no duplicate at the PHYSFS_File level, so we break the
      *  abstraction. We're allowed to: we're physfs.c!
      */
     FileHandle *origfh = (FileHandle *) io->opaque;
-    FileHandle *newfh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
+    FileHandle *newfh = allocFileHandle();
     PHYSFS_Io *retval = NULL;
 
-    GOTO_IF(!newfh, PHYSFS_ERR_OUT_OF_MEMORY, handleIo_dupe_failed);
-    memset(newfh, '\0', sizeof (*newfh));
+    GOTO_IF_ERRPASS(!newfh, handleIo_dupe_failed);
 
     retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
     GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, handleIo_dupe_failed);
@@ -470,18 +1140,10 @@ static PHYSFS_Io *handleIo_duplicate(PHYSFS_Io *io)
 
     newfh->forReading = origfh->forReading;
     newfh->dirHandle = origfh->dirHandle;
+    (void) __PHYSFS_ATOMIC_INCR(&newfh->dirHandle->refcount);
 
-    __PHYSFS_platformGrabMutex(stateLock);
-    if (newfh->forReading)
-    {
-        newfh->next = openReadList;
-        openReadList = newfh;
-    } /* if */
-    else
-    {
-        newfh->next = openWriteList;
-        openWriteList = newfh;
-    } /* else */
+    grabStateLock();
+    linkFileHandle(newfh, newfh->forReading ? &openReadList : &openWriteList);
     __PHYSFS_platformReleaseMutex(stateLock);
 
     memcpy(retval, io, sizeof (PHYSFS_Io));
@@ -493,7 +1155,7 @@ handleIo_dupe_failed:
     {
         if (newfh->io != NULL) newfh->io->destroy(newfh->io);
         if (newfh->buffer != NULL) allocator.Free(newfh->buffer);
-        allocator.Free(newfh);
+        freeFileHandle(newfh);
     } /* if */
 
     return NULL;
@@ -536,38 +1198,175 @@ static PHYSFS_Io *__PHYSFS_createHandleIo(PHYSFS_File *f)
 
 /* functions ... */
 
+/*
+ * Lists we give the app (PHYSFS_enumerateFiles(), etc) are one allocation:
+ *  the NULL-terminated array of pointers, followed by all the strings, so
+ *  PHYSFS_freeList() only has one thing to free. While a list is being
+ *  built, the strings are packed into one growing block and we remember
+ *  where each starts; the real list is put together once, at the end.
+ *  If (hash) is used, it's an open-addressed set of string indices (plus
+ *  one, so zero means empty), to throw out duplicates.
+ */
 typedef struct
 {
-    char **list;
-    PHYSFS_uint32 size;
+    char *strings;  /* every string so far, back to back, null-terminated. */
+    size_t stringslen;  /* bytes of (strings) used. */
+    size_t stringsalloc;  /* bytes of (strings) allocated. */
+    size_t *offsets;  /* where each string starts in (strings). */
+    PHYSFS_uint32 size;  /* number of strings. */
+    PHYSFS_uint32 offsetsalloc;  /* slots allocated in (offsets). */
+    PHYSFS_uint32 *hash;  /* for dropping duplicates, NULL if we don't care. */
+    PHYSFS_uint32 hashalloc;  /* slots in (hash); a power of two. */
     PHYSFS_ErrorCode errcode;
 } EnumStringListCallbackData;
 
-static void enumStringListCallback(void *data, const char *str)
+static void freeStringListData(EnumStringListCallbackData *pecd)
 {
-    void *ptr;
-    char *newstr;
-    EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
+    allocator.Free(pecd->strings);
+    allocator.Free(pecd->offsets);
+    allocator.Free(pecd->hash);
+} /* freeStringListData */
 
-    if (pecd->errcode)
-        return;
 
-    ptr = allocator.Realloc(pecd->list, (pecd->size + 2) * sizeof (char *));
-    newstr = (char *) allocator.Malloc(strlen(str) + 1);
-    if (ptr != NULL)
-        pecd->list = (char **) ptr;
+static PHYSFS_uint32 *findStringListSlot(EnumStringListCallbackData *pecd,
+                                         const char *str)
+{
+    const PHYSFS_uint32 mask = pecd->hashalloc - 1;
+    PHYSFS_uint32 slot = __PHYSFS_hashString(str) & mask;
+    while (pecd->hash[slot] != 0)
+    {
+        const size_t offset = pecd->offsets[pecd->hash[slot] - 1];
+        if (strcmp(pecd->strings + offset, str) == 0)
+            break;
+        slot = (slot + 1) & mask;
+    } /* while */
+    return &pecd->hash[slot];
+} /* findStringListSlot */
+
 
-    if ((ptr == NULL) || (newstr == NULL))
+static int growStringListHash(EnumStringListCallbackData *pecd)
+{
+    const PHYSFS_uint32 oldalloc = pecd->hashalloc;
+    PHYSFS_uint32 *oldhash = pecd->hash;
+    PHYSFS_uint32 i;
+
+    pecd->hashalloc = oldalloc ? (oldalloc * 2) : 64;
+    pecd->hash = (PHYSFS_uint32 *) allocator.Malloc(pecd->hashalloc * sizeof (PHYSFS_uint32));
+    if (!pecd->hash)
     {
-        pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
-        pecd->list[pecd->size] = NULL;
-        PHYSFS_freeList(pecd->list);
-        return;
+        pecd->hash = oldhash;
+        pecd->hashalloc = oldalloc;
+        return 0;
+    } /* if */
+
+    memset(pecd->hash, '\0', pecd->hashalloc * sizeof (PHYSFS_uint32));
+    for (i = 0; i < pecd->size; i++)
+        *findStringListSlot(pecd, pecd->strings + pecd->offsets[i]) = i + 1;
+
+    allocator.Free(oldhash);
+    return 1;
+} /* growStringListHash */
+
+
+/* returns zero on allocation failure; dropping a duplicate is success. */
+static int addToStringList(EnumStringListCallbackData *pecd, const char *str,
+                           const int unique)
+{
+    const size_t len = strlen(str) + 1;
+    PHYSFS_uint32 *slot = NULL;
+
+    if (unique)
+    {
+        /* keep the set at most half full, so probe chains stay short. */
+        if ((pecd->size + 1) > (pecd->hashalloc / 2))
+            BAIL_IF(!growStringListHash(pecd), PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        slot = findStringListSlot(pecd, str);
+        if (*slot != 0)
+            return 1;  /* already in the list. */
+    } /* if */
+
+    if (pecd->size == pecd->offsetsalloc)
+    {
+        const PHYSFS_uint32 newalloc = pecd->offsetsalloc ? pecd->offsetsalloc * 2 : 64;
+        void *ptr = allocator.Realloc(pecd->offsets, newalloc * sizeof (size_t));
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        pecd->offsets = (size_t *) ptr;
+        pecd->offsetsalloc = newalloc;
+    } /* if */
+
+    if ((pecd->stringsalloc - pecd->stringslen) < len)
+    {
+        size_t newalloc = pecd->stringsalloc ? pecd->stringsalloc * 2 : 4096;
+        void *ptr;
+        while ((newalloc - pecd->stringslen) < len)
+            newalloc *= 2;
+        ptr = allocator.Realloc(pecd->strings, newalloc);
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        pecd->strings = (char *) ptr;
+        pecd->stringsalloc = newalloc;
+    } /* if */
+
+    memcpy(pecd->strings + pecd->stringslen, str, len);
+    pecd->offsets[pecd->size++] = pecd->stringslen;
+    pecd->stringslen += len;
+    if (slot != NULL)
+        *slot = pecd->size;
+    return 1;
+} /* addToStringList */
+
+
+static int cmpStringList(void *_a, size_t one, size_t two)
+{
+    char **a = (char **) _a;
+    return strcmp(a[one], a[two]);
+} /* cmpStringList */
+
+static void swapStringList(void *_a, size_t one, size_t two)
+{
+    char **a = (char **) _a;
+    char *tmp = a[one];
+    a[one] = a[two];
+    a[two] = tmp;
+} /* swapStringList */
+
+
+/* build the final list; frees (pecd)'s data either way. */
+static char **finishStringList(EnumStringListCallbackData *pecd,
+                               const int sorted)
+{
+    const size_t ptrlen = (pecd->size + 1) * sizeof (char *);
+    char **retval = NULL;
+    PHYSFS_uint32 i;
+
+    if (!pecd->errcode)
+    {
+        retval = (char **) allocator.Malloc(ptrlen + pecd->stringslen);
+        if (!retval)
+            pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
+        else
+        {
+            char *strings = ((char *) retval) + ptrlen;
+            if (pecd->stringslen)
+                memcpy(strings, pecd->strings, pecd->stringslen);
+            for (i = 0; i < pecd->size; i++)
+                retval[i] = strings + pecd->offsets[i];
+            retval[pecd->size] = NULL;
+            if (sorted)
+                __PHYSFS_sort(retval, pecd->size, cmpStringList, swapStringList);
+        } /* else */
     } /* if */
 
-    strcpy(newstr, str);
-    pecd->list[pecd->size] = newstr;
-    pecd->size++;
+    freeStringListData(pecd);
+    BAIL_IF(!retval, pecd->errcode, NULL);
+    return retval;
+} /* finishStringList */
+
+
+static void enumStringListCallback(void *data, const char *str)
+{
+    EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
+    if ((!pecd->errcode) && (!addToStringList(pecd, str, 0)))
+        pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
 } /* enumStringListCallback */
 
 
@@ -575,18 +1374,8 @@ static char **doEnumStringList(void (*func)(PHYSFS_StringCallback, void *))
 {
     EnumStringListCallbackData ecd;
     memset(&ecd, '\0', sizeof (ecd));
-    ecd.list = (char **) allocator.Malloc(sizeof (char *));
-    BAIL_IF(!ecd.list, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
     func(enumStringListCallback, &ecd);
-
-    if (ecd.errcode)
-    {
-        PHYSFS_setErrorCode(ecd.errcode);
-        return NULL;
-    } /* if */
-
-    ecd.list[ecd.size] = NULL;
-    return ecd.list;
+    return finishStringList(&ecd, 0);
 } /* doEnumStringList */
 
 
@@ -663,7 +1452,8 @@ void __PHYSFS_sort(void *entries, size_t max,
 } /* __PHYSFS_sort */
 
 
-static ErrState *findErrorForCurrentThread(void)
+#ifdef PHYSFS_NO_THREAD_LOCAL
+static ErrState *findErrorForCurrentThread(const int create)
 {
     ErrState *i;
     void *tid;
@@ -689,21 +1479,53 @@ static ErrState *findErrorForCurrentThread(void)
     if (errorLock != NULL)
         __PHYSFS_platformReleaseMutex(errorLock);
 
-    return NULL;   /* no error available. */
+    if (!create)
+        return NULL;   /* no error available. */
+
+    i = (ErrState *) allocator.Malloc(sizeof (ErrState));
+    if (i == NULL)
+        return NULL;   /* uhh...? */
+
+    memset(i, '\0', sizeof (ErrState));
+    i->tid = __PHYSFS_platformGetThreadID();
+
+    if (errorLock != NULL)
+        __PHYSFS_platformGrabMutex(errorLock);
+
+    i->next = errorStates;
+    errorStates = i;
+
+    if (errorLock != NULL)
+        __PHYSFS_platformReleaseMutex(errorLock);
+
+    return i;
+} /* findErrorForCurrentThread */
+#else
+/* Each thread has its own state here, so there's nothing to lock or find. */
+static ErrState *findErrorForCurrentThread(const int create)
+{
+    ErrState *err = &threadErrorState;
+    if (err->generation != errorGeneration)  /* set before a deinit? */
+    {
+        err->generation = errorGeneration;
+        err->code = PHYSFS_ERR_OK;
+    } /* if */
+    return err;
 } /* findErrorForCurrentThread */
+#endif
 
 
 /* this doesn't reset the error state. */
 static inline PHYSFS_ErrorCode currentErrorCode(void)
 {
-    const ErrState *err = findErrorForCurrentThread();
+    const ErrState *err = findErrorForCurrentThread(0);
     return err ? err->code : PHYSFS_ERR_OK;
 } /* currentErrorCode */
 
 
 PHYSFS_ErrorCode PHYSFS_getLastErrorCode(void)
 {
-    ErrState *err = findErrorForCurrentThread();
+    ErrState *err = findErrorForCurrentThread(0);
     const PHYSFS_ErrorCode retval = (err) ? err->code : PHYSFS_ERR_OK;
     if (err)
         err->code = PHYSFS_ERR_OK;
@@ -758,25 +1580,9 @@ void PHYSFS_setErrorCode(PHYSFS_ErrorCode errcode)
     if (!errcode)
         return;
 
-    err = findErrorForCurrentThread();
+    err = findErrorForCurrentThread(1);
     if (err == NULL)
-    {
-        err = (ErrState *) allocator.Malloc(sizeof (ErrState));
-        if (err == NULL)
-            return;   /* uhh...? */
-
-        memset(err, '\0', sizeof (ErrState));
-        err->tid = __PHYSFS_platformGetThreadID();
-
-        if (errorLock != NULL)
-            __PHYSFS_platformGrabMutex(errorLock);
-
-        err->next = errorStates;
-        errorStates = err;
-
-        if (errorLock != NULL)
-            __PHYSFS_platformReleaseMutex(errorLock);
-    } /* if */
+        return;   /* uhh...? */
 
     err->code = errcode;
 } /* PHYSFS_setErrorCode */
@@ -792,6 +1598,7 @@ const char *PHYSFS_getLastError(void)
 /* MAKE SURE that errorLock is held before calling this! */
 static void freeErrorStates(void)
 {
+#ifdef PHYSFS_NO_THREAD_LOCAL
     ErrState *i;
     ErrState *next;
 
@@ -802,6 +1609,10 @@ static void freeErrorStates(void)
     } /* for */
 
     errorStates = NULL;
+#else
+    /* we can't reach other threads' state, so just mark it all stale. */
+    errorGeneration++;
+#endif
 } /* freeErrorStates */
 
 
@@ -867,7 +1678,10 @@ static DirHandle *tryOpenDir(PHYSFS_Io *io, const PHYSFS_Archiver *funcs,
 } /* tryOpenDir */
 
 
-static DirHandle *openDirectory(PHYSFS_Io *io, const char *d, int forWriting)
+static void queuePreload(PHYSFS_Io *io);
+
+static DirHandle *openDirectory(PHYSFS_Io *io, const char *d, int forWriting,
+                                int preload)
 {
     DirHandle *retval = NULL;
     PHYSFS_Archiver **i;
@@ -892,7 +1706,17 @@ static DirHandle *openDirectory(PHYSFS_Io *io, const char *d, int forWriting)
                 return retval;
         } /* if */
 
-        io = __PHYSFS_createNativeIo(d, forWriting ? 'w' : 'r');
+        if ((!forWriting) && (mapArchives))
+        {
+            /* map read-only archives if we can; archivers won't know. */
+            const PHYSFS_ErrorCode prev = currentErrorCode();
+            io = __PHYSFS_createMappedIo(d);
+            if (!io)
+                PHYSFS_setErrorCode(prev);  /* not a real failure yet. */
+        } /* if */
+
+        if (!io)
+            io = __PHYSFS_createNativeIo(d, forWriting ? 'w' : 'r');
         BAIL_IF_ERRPASS(!io, NULL);
         created_io = 1;
     } /* if */
@@ -927,6 +1751,19 @@ static DirHandle *openDirectory(PHYSFS_Io *io, const char *d, int forWriting)
         io->destroy(io);
 
     BAIL_IF(!retval, errcode, NULL);
+
+    #if PHYSFS_SUPPORTS_STATS
+    if (created_io)
+        attachIoStats(io, &retval->stats);
+    #if PHYSFS_SUPPORTS_ZIP
+    if (retval->funcs->openArchive == __PHYSFS_Archiver_ZIP.openArchive)
+        ZIP_setStats(retval->opaque, &retval->stats);
+    #endif
+    #endif
+
+    if ((preload) && (created_io))  /* an app's Io is the app's business. */
+        queuePreload(io);
+
     return retval;
 } /* openDirectory */
 
@@ -1031,7 +1868,8 @@ static int partOfMountPoint(DirHandle *h, char *fname)
 
 
 static DirHandle *createDirHandle(PHYSFS_Io *io, const char *newDir,
-                                  const char *mountPoint, int forWriting)
+                                  const char *mountPoint, int forWriting,
+                                  int preload)
 {
     DirHandle *dirHandle = NULL;
     char *tmpmntpnt = NULL;
@@ -1048,9 +1886,13 @@ static DirHandle *createDirHandle(PHYSFS_Io *io, const char *newDir,
         mountPoint = tmpmntpnt;  /* sanitized version. */
     } /* if */
 
-    dirHandle = openDirectory(io, newDir, forWriting);
+    dirHandle = openDirectory(io, newDir, forWriting, preload);
     GOTO_IF_ERRPASS(!dirHandle, badDirHandle);
 
+    dirHandle->lock = __PHYSFS_platformCreateMutex();
+    GOTO_IF(!dirHandle->lock, PHYSFS_ERR_OUT_OF_MEMORY, badDirHandle);
+    dirHandle->refcount = 1;
+
     dirHandle->dirName = (char *) allocator.Malloc(strlen(newDir) + 1);
     GOTO_IF(!dirHandle->dirName, PHYSFS_ERR_OUT_OF_MEMORY, badDirHandle);
     strcpy(dirHandle->dirName, newDir);
@@ -1071,6 +1913,7 @@ badDirHandle:
     if (dirHandle != NULL)
     {
         dirHandle->funcs->closeArchive(dirHandle->opaque);
+        if (dirHandle->lock) __PHYSFS_platformDestroyMutex(dirHandle->lock);
         allocator.Free(dirHandle->dirName);
         allocator.Free(dirHandle->mountPoint);
         allocator.Free(dirHandle);
@@ -1081,6 +1924,21 @@ badDirHandle:
 } /* createDirHandle */
 
 
+/* Doesn't need stateLock. The last reference closes the archive. */
+static void releaseDirHandle(DirHandle *dh)
+{
+    if (__PHYSFS_ATOMIC_DECR(&dh->refcount) == 0)
+    {
+        dh->funcs->closeArchive(dh->opaque);
+        __PHYSFS_platformDestroyMutex(dh->lock);
+        if (dh->root) allocator.Free(dh->root);
+        allocator.Free(dh->dirName);
+        allocator.Free(dh->mountPoint);
+        allocator.Free(dh);
+    } /* if */
+} /* releaseDirHandle */
+
+
 /* MAKE SURE you've got the stateLock held before calling this! */
 static int freeDirHandle(DirHandle *dh, FileHandle *openList)
 {
@@ -1092,76 +1950,530 @@ static int freeDirHandle(DirHandle *dh, FileHandle *openList)
     for (i = openList; i != NULL; i = i->next)
         BAIL_IF(i->dirHandle == dh, PHYSFS_ERR_FILES_STILL_OPEN, 0);
 
-    dh->funcs->closeArchive(dh->opaque);
-
-    if (dh->root) allocator.Free(dh->root);
-    allocator.Free(dh->dirName);
-    allocator.Free(dh->mountPoint);
-    allocator.Free(dh);
+    releaseDirHandle(dh);  /* lookups still running might hold it a bit. */
     return 1;
 } /* freeDirHandle */
 
 
-static char *calculateBaseDir(const char *argv0)
+static void *dirTreeFind(__PHYSFS_DirTree *dt, const char *path,
+                         const int reorder);
+
+static void freeSearchPathIndex(SearchPathIndex *index)
 {
-    const char dirsep = __PHYSFS_platformDirSeparator;
-    char *retval = NULL;
-    char *ptr = NULL;
+    if (index != NULL)
+    {
+        __PHYSFS_DirTreeDeinit(&index->tree);
+        if (index->dirs) allocator.Free(index->dirs);
+        allocator.Free(index);
+    } /* if */
+} /* freeSearchPathIndex */
 
-    /* Give the platform layer first shot at this. */
-    retval = __PHYSFS_platformCalcBaseDir(argv0);
-    if (retval != NULL)
-        return retval;
 
-    /* We need argv0 to go on. */
-    BAIL_IF(argv0 == NULL, PHYSFS_ERR_ARGV0_IS_NULL, NULL);
+static void freeSearchPathSnapshot(SearchPathSnapshot *snap)
+{
+    size_t i;
+    for (i = 0; i < snap->count; i++)
+        releaseDirHandle(snap->dirs[i]);
+    freeSearchPathIndex(snap->index);
+    allocator.Free(snap);
+} /* freeSearchPathSnapshot */
 
-    ptr = strrchr(argv0, dirsep);
-    if (ptr != NULL)
+
+/* Doesn't need stateLock. */
+static void releaseSearchPath(SearchPathSnapshot *snap)
+{
+    if (__PHYSFS_ATOMIC_DECR(&snap->refcount) == 0)
+        freeSearchPathSnapshot(snap);
+} /* releaseSearchPath */
+
+
+/*
+ * MAKE SURE you've got the stateLock held before calling this!
+ *  Pass non-zero for (keepIndex) if the search path only gained archives,
+ *  so the next snapshot can extend the current index instead of starting
+ *  over. Anything else (unmounting, changing roots) must pass zero.
+ */
+static void invalidateSearchPath(const int keepIndex)
+{
+    SearchPathSnapshot *snap = searchPathSnapshot;
+
+    if ((!keepIndex) && (spareSearchPathIndex != NULL))
     {
-        const size_t size = ((size_t) (ptr - argv0)) + 1;
-        retval = (char *) allocator.Malloc(size + 1);
-        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
-        memcpy(retval, argv0, size);
-        retval[size] = '\0';
-        return retval;
+        freeSearchPathIndex(spareSearchPathIndex);
+        spareSearchPathIndex = NULL;
     } /* if */
 
-    /* argv0 wasn't helpful. */
-    BAIL(PHYSFS_ERR_INVALID_ARGUMENT, NULL);
-} /* calculateBaseDir */
+    searchPathGeneration++;  /* an index being built now is out of date. */
+    searchPathSnapshot = NULL;
+    if ((snap != NULL) && (__PHYSFS_ATOMIC_DECR(&snap->refcount) == 0))
+    {
+        /* nobody else is reading its index, so it can be extended. This
+           only happens if no lookup is using the snapshot right now. */
+        if ((keepIndex) && (snap->index != NULL))
+        {
+            assert(spareSearchPathIndex == NULL);
+            spareSearchPathIndex = snap->index;
+            snap->index = NULL;
+        } /* if */
+        freeSearchPathSnapshot(snap);
+    } /* if */
+} /* invalidateSearchPath */
 
 
-static int initializeMutexes(void)
+typedef struct
 {
-    errorLock = __PHYSFS_platformCreateMutex();
-    if (errorLock == NULL)
-        goto initializeMutexes_failed;
+    SearchPathIndex *index;
+    DirHandle *dh;
+    int override;  /* non-zero if (dh) comes before archives already added. */
+    char *arcpath;  /* scratch: path in the archive, with its root. */
+    size_t arcpathlen;
+    size_t arcrootlen;  /* chars in arcpath that (dh)'s root takes up. */
+    char *path;  /* scratch: same path as the application sees it. */
+    size_t pathlen;
+    size_t mntpntlen;  /* chars in path that (dh)'s mountpoint takes up. */
+    char **dirs;  /* stack of archive paths of directories still to walk. */
+    size_t dircount;
+    size_t dirspace;
+} SearchPathIndexBuild;
+
+/* Set path owners from (entry) up, as far as (build) needs to. */
+static void claimSearchPathIndexEntry(SearchPathIndexBuild *build,
+                                      SearchPathIndexEntry *entry)
+{
+    const __PHYSFS_DirTreeEntry *root = build->index->tree.root;
+    while ((__PHYSFS_DirTreeEntry *) entry != root)
+    {
+        if (entry->owner == build->dh)
+            break;  /* we already claimed this and everything above it. */
+        else if ((entry->owner != NULL) && (!build->override))
+            break;  /* an earlier archive has it, and so everything above. */
+        entry->owner = build->dh;
+        entry = (SearchPathIndexEntry *) entry->tree.parent;
+    } /* while */
+} /* claimSearchPathIndexEntry */
 
-    stateLock = __PHYSFS_platformCreateMutex();
-    if (stateLock == NULL)
-        goto initializeMutexes_failed;
+/* Add (build->path) to the index. Everything is a directory here, so a
+   path that's a file in one archive and a directory in another is fine. */
+static int addSearchPathIndexEntry(SearchPathIndexBuild *build)
+{
+    SearchPathIndexEntry *entry;
+    entry = (SearchPathIndexEntry *) __PHYSFS_DirTreeAdd(&build->index->tree,
+                                                         build->path, 1);
+    BAIL_IF_ERRPASS(!entry, 0);
+    claimSearchPathIndexEntry(build, entry);
+    return 1;
+} /* addSearchPathIndexEntry */
 
-    return 1;  /* success. */
+/* Make sure (*buf) can hold (len) bytes. */
+static int growSearchPathIndexScratch(char **buf, size_t *buflen,
+                                      const size_t len)
+{
+    if (len > *buflen)
+    {
+        void *ptr = allocator.Realloc(*buf, len);
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        *buf = (char *) ptr;
+        *buflen = len;
+    } /* if */
+    return 1;
+} /* growSearchPathIndexScratch */
 
-initializeMutexes_failed:
-    if (errorLock != NULL)
-        __PHYSFS_platformDestroyMutex(errorLock);
+static PHYSFS_EnumerateCallbackResult searchPathIndexCallback(void *data,
+                                       const char *origdir, const char *fname)
+{
+    SearchPathIndexBuild *build = (SearchPathIndexBuild *) data;
+    const size_t dirlen = strlen(origdir);
+    const size_t fnamelen = strlen(fname);
+    const size_t rellen = (dirlen > build->arcrootlen) ? dirlen - build->arcrootlen : 0;
+    const char *rel = origdir + (dirlen - rellen);
+    PHYSFS_Stat statbuf;
+    char *ptr;
 
-    if (stateLock != NULL)
-        __PHYSFS_platformDestroyMutex(stateLock);
+    if (*rel == '/')
+        rel++;
 
-    errorLock = stateLock = NULL;
-    return 0;  /* failed. */
-} /* initializeMutexes */
+    /* application's view: mountpoint/rest-of-dir/fname */
+    if (!growSearchPathIndexScratch(&build->path, &build->pathlen,
+                                    build->mntpntlen + rellen + fnamelen + 3))
+        return PHYSFS_ENUM_ERROR;
+    ptr = build->path + build->mntpntlen;
+    if (*rel)
+    {
+        if (ptr != build->path)
+            *(ptr++) = '/';
+        strcpy(ptr, rel);
+        ptr += strlen(rel);
+    } /* if */
+    if (ptr != build->path)
+        *(ptr++) = '/';
+    strcpy(ptr, fname);
 
+    if (!addSearchPathIndexEntry(build))
+        return PHYSFS_ENUM_ERROR;
 
-static int doRegisterArchiver(const PHYSFS_Archiver *_archiver);
+    /* archive's view, to see if we need to walk into this. */
+    if (!growSearchPathIndexScratch(&build->arcpath, &build->arcpathlen,
+                                    dirlen + fnamelen + 2))
+        return PHYSFS_ENUM_ERROR;
+    if (dirlen == 0)
+        strcpy(build->arcpath, fname);
+    else
+        snprintf(build->arcpath, build->arcpathlen, "%s/%s", origdir, fname);
 
-static int initStaticArchivers(void)
-{
-    #define REGISTER_STATIC_ARCHIVER(arc) { \
-        if (!doRegisterArchiver(&__PHYSFS_Archiver_##arc)) { \
+    if (!build->dh->funcs->stat(build->dh->opaque, build->arcpath, &statbuf))
+        return PHYSFS_ENUM_ERROR;
+    else if (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY)
+    {
+        if (build->dircount == build->dirspace)
+        {
+            const size_t newspace = build->dirspace * 2;
+            void *newdirs = allocator.Realloc(build->dirs, newspace * sizeof (char *));
+            BAIL_IF(!newdirs, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+            build->dirs = (char **) newdirs;
+            build->dirspace = newspace;
+        } /* if */
+
+        ptr = __PHYSFS_strdup(build->arcpath);
+        BAIL_IF_ERRPASS(!ptr, PHYSFS_ENUM_ERROR);
+        build->dirs[build->dircount++] = ptr;
+    } /* else if */
+
+    return PHYSFS_ENUM_OK;
+} /* searchPathIndexCallback */
+
+
+/*
+ * Add everything in (dh) to (index). If (override), (dh) is earlier in the
+ *  search path than what's there already and takes over paths it shares
+ *  with them. Returns zero if (dh) couldn't be indexed and has to be probed.
+ *  MAKE SURE you DON'T hold the stateLock: archivers can need it while we
+ *  hold (dh->lock), when they duplicate an Io from another archive.
+ */
+static int indexSearchPathArchive(SearchPathIndex *index, DirHandle *dh,
+                                  const int override)
+{
+    SearchPathIndexBuild build;
+    int retval = 1;
+
+    /* the physical filesystem changes behind our back; always probe it. */
+    if (dh->funcs == &__PHYSFS_Archiver_DIR)
+        return 0;
+
+    memset(&build, '\0', sizeof (build));
+    build.index = index;
+    build.dh = dh;
+    build.override = override;
+    build.mntpntlen = dh->mountPoint ? strlen(dh->mountPoint) - 1 : 0;
+
+    /* PHYSFS_setRoot() changes the root under (dh->lock). If it does while
+       we're working, it also throws away what we build here. */
+    __PHYSFS_platformGrabMutex(dh->lock);
+
+    build.dirspace = 16;
+    build.dirs = (char **) allocator.Malloc(build.dirspace * sizeof (char *));
+    build.pathlen = build.mntpntlen + 1;
+    build.path = (char *) allocator.Malloc(build.pathlen);
+    if (build.dirs != NULL)
+    {
+        build.dirs[0] = __PHYSFS_strdup(dh->root ? dh->root : "");
+        if (build.dirs[0] != NULL)
+            build.dircount = 1;
+    } /* if */
+    build.arcrootlen = dh->root ? dh->rootlen : 0;
+
+    if ((build.path == NULL) || (build.dircount == 0))
+    {
+        PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+        retval = 0;
+    } /* if */
+
+    /* the mountpoint and its parents are directories in (dh), too. */
+    else if (dh->mountPoint != NULL)
+    {
+        memcpy(build.path, dh->mountPoint, build.mntpntlen);
+        build.path[build.mntpntlen] = '\0';
+        retval = addSearchPathIndexEntry(&build);
+    } /* else if */
+
+    while ((retval) && (build.dircount > 0))
+    {
+        char *dir = build.dirs[--build.dircount];
+        PHYSFS_EnumerateCallbackResult rc;
+        rc = dh->funcs->enumerate(dh->opaque, dir,
+                                  searchPathIndexCallback, dir, &build);
+        retval = (rc != PHYSFS_ENUM_ERROR);
+        allocator.Free(dir);
+    } /* while */
+
+    __PHYSFS_platformReleaseMutex(dh->lock);
+
+    if (build.dirs != NULL)
+    {
+        while (build.dircount > 0)
+            allocator.Free(build.dirs[--build.dircount]);
+        allocator.Free(build.dirs);
+    } /* if */
+    if (build.path) allocator.Free(build.path);
+    if (build.arcpath) allocator.Free(build.arcpath);
+
+    /* paths already claimed stay claimed, but we'll probe (dh) anyhow,
+       so that's harmless. */
+    return retval;
+} /* indexSearchPathArchive */
+
+
+/*
+ * Build the index for (snap). If (index) isn't NULL, it's an old one to
+ *  extend, if (snap)'s search path is what it covered with archives added
+ *  at either end. Returns NULL if there's no index; lookups will probe
+ *  everything. MAKE SURE you DON'T hold the stateLock!
+ */
+static SearchPathIndex *buildSearchPathIndex(const SearchPathSnapshot *snap,
+                                             SearchPathIndex *index)
+{
+    PHYSFS_uint8 *probe;
+    DirHandle **dirs;
+    size_t first = 0;  /* where the old search path starts in (snap). */
+    size_t oldcount = 0;
+    size_t i;
+
+    if (index != NULL)
+    {
+        oldcount = index->count;
+        for (first = 0; first + oldcount <= snap->count; first++)
+        {
+            if (memcmp(&snap->dirs[first], index->dirs,
+                       oldcount * sizeof (DirHandle *)) == 0)
+                break;
+        } /* for */
+
+        if (first + oldcount > snap->count)  /* not just additions; start over. */
+        {
+            freeSearchPathIndex(index);
+            index = NULL;
+        } /* if */
+    } /* if */
+
+    if (index == NULL)
+    {
+        first = oldcount = 0;
+        index = (SearchPathIndex *) allocator.Malloc(sizeof (SearchPathIndex));
+        BAIL_IF(!index, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        memset(index, '\0', sizeof (*index));
+        if (!__PHYSFS_DirTreeInit(&index->tree, sizeof (SearchPathIndexEntry), 0, 0, 0))
+        {
+            freeSearchPathIndex(index);
+            return NULL;
+        } /* if */
+    } /* if */
+
+    /* (dirs) and (probe) share one allocation. */
+    dirs = (DirHandle **) allocator.Malloc(snap->count * (sizeof (DirHandle *) + 1) + 1);
+    if (!dirs)
+    {
+        freeSearchPathIndex(index);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    probe = (PHYSFS_uint8 *) (dirs + snap->count);
+    memcpy(dirs, snap->dirs, snap->count * sizeof (DirHandle *));
+    if (oldcount)
+        memcpy(probe + first, index->probe, oldcount);
+    if (index->dirs) allocator.Free(index->dirs);
+    index->dirs = dirs;
+    index->probe = probe;
+    index->count = snap->count;
+
+    /* archives in front of the old path take over what they share with it,
+       so add those closest to it first. Archives behind it only get paths
+       nobody has yet. */
+    for (i = first; i > 0; i--)
+        probe[i - 1] = !indexSearchPathArchive(index, dirs[i - 1], 1);
+    for (i = first + oldcount; i < snap->count; i++)
+        probe[i] = !indexSearchPathArchive(index, dirs[i], 0);
+
+    return index;
+} /* buildSearchPathIndex */
+
+
+/* MAKE SURE you've got the stateLock held before calling this! */
+static SearchPathSnapshot *createSearchPathSnapshot(void)
+{
+    SearchPathSnapshot *retval;
+    DirHandle *i;
+    size_t count = 0;
+    size_t len;
+
+    for (i = searchPath; i != NULL; i = i->next)
+        count++;
+
+    len = sizeof (SearchPathSnapshot) + (count * sizeof (DirHandle *));
+    retval = (SearchPathSnapshot *) allocator.Malloc(len);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    retval->refcount = 1;
+    retval->longest_root = longest_root;
+    retval->index = NULL;
+    retval->count = count;
+    count = 0;
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        (void) __PHYSFS_ATOMIC_INCR(&i->refcount);
+        retval->dirs[count++] = i;
+    } /* for */
+
+    return retval;
+} /* createSearchPathSnapshot */
+
+
+/* Get a reference to the current search path; releaseSearchPath() it. */
+static SearchPathSnapshot *grabSearchPath(void)
+{
+    SearchPathSnapshot *retval;
+    SearchPathIndex *spare;
+    PHYSFS_uint32 generation;
+
+    grabStateLock();
+
+    retval = searchPathSnapshot;
+    if (retval == NULL)
+    {
+        retval = createSearchPathSnapshot();
+        BAIL_IF_MUTEX_ERRPASS(!retval, stateLock, NULL);
+
+        /* someone else is indexing this; use it unindexed meanwhile. */
+        if ((indexSearchPath) && (buildingSearchPathIndex))
+        {
+            __PHYSFS_platformReleaseMutex(stateLock);
+            return retval;
+        } /* if */
+
+        else if (indexSearchPath)
+        {
+            /* this walks every archive, so don't hold stateLock for it. */
+            buildingSearchPathIndex = 1;
+            generation = searchPathGeneration;
+            spare = spareSearchPathIndex;
+            spareSearchPathIndex = NULL;
+            __PHYSFS_platformReleaseMutex(stateLock);
+
+            /* no index is just slower, so failing to build one is fine. */
+            retval->index = buildSearchPathIndex(retval, spare);
+
+            grabStateLock();
+            buildingSearchPathIndex = 0;
+            if (generation != searchPathGeneration)
+            {
+                /* the search path changed meanwhile. This is still good
+                   for the lookup that asked for it, but nothing else. */
+                __PHYSFS_platformReleaseMutex(stateLock);
+                return retval;
+            } /* if */
+            assert(searchPathSnapshot == NULL);
+        } /* else if */
+
+        searchPathSnapshot = retval;
+    } /* if */
+
+    (void) __PHYSFS_ATOMIC_INCR(&retval->refcount);
+
+    __PHYSFS_platformReleaseMutex(stateLock);
+    return retval;
+} /* grabSearchPath */
+
+
+/*
+ * Find where in (snap) a lookup of (fname) (sanitized, as the application
+ *  sees it) has to start. Archives before that can only have (fname) if
+ *  searchPathCandidate() says so.
+ */
+static size_t searchPathFirstCandidate(const SearchPathSnapshot *snap,
+                                       const char *fname)
+{
+    const SearchPathIndexEntry *entry;
+    size_t i;
+
+    if ((snap->index == NULL) || (*fname == '\0'))
+        return 0;  /* no index (or the root, which is everywhere). */
+
+    entry = (const SearchPathIndexEntry *)
+                dirTreeFind(&snap->index->tree, fname, 0);
+    if (entry == NULL)
+        return snap->count;  /* not in any indexed archive. */
+
+    for (i = 0; i < snap->count; i++)
+    {
+        if (snap->dirs[i] == entry->owner)
+            break;
+    } /* for */
+    return i;
+} /* searchPathFirstCandidate */
+
+/* Should we ask archive (idx) in (snap) about a path with this (first)? */
+#define searchPathCandidate(snap, idx, first) \
+    (((idx) >= (first)) || ((snap)->index->probe[idx]))
+
+
+static char *calculateBaseDir(const char *argv0)
+{
+    const char dirsep = __PHYSFS_platformDirSeparator;
+    char *retval = NULL;
+    char *ptr = NULL;
+
+    /* Give the platform layer first shot at this. */
+    retval = __PHYSFS_platformCalcBaseDir(argv0);
+    if (retval != NULL)
+        return retval;
+
+    /* We need argv0 to go on. */
+    BAIL_IF(argv0 == NULL, PHYSFS_ERR_ARGV0_IS_NULL, NULL);
+
+    ptr = strrchr(argv0, dirsep);
+    if (ptr != NULL)
+    {
+        const size_t size = ((size_t) (ptr - argv0)) + 1;
+        retval = (char *) allocator.Malloc(size + 1);
+        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        memcpy(retval, argv0, size);
+        retval[size] = '\0';
+        return retval;
+    } /* if */
+
+    /* argv0 wasn't helpful. */
+    BAIL(PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+} /* calculateBaseDir */
+
+
+static int initializeMutexes(void)
+{
+    errorLock = __PHYSFS_platformCreateMutex();
+    if (errorLock == NULL)
+        goto initializeMutexes_failed;
+
+    stateLock = __PHYSFS_platformCreateMutex();
+    if (stateLock == NULL)
+        goto initializeMutexes_failed;
+
+    return 1;  /* success. */
+
+initializeMutexes_failed:
+    if (errorLock != NULL)
+        __PHYSFS_platformDestroyMutex(errorLock);
+
+    if (stateLock != NULL)
+        __PHYSFS_platformDestroyMutex(stateLock);
+
+    errorLock = stateLock = NULL;
+    return 0;  /* failed. */
+} /* initializeMutexes */
+
+
+static int doRegisterArchiver(const PHYSFS_Archiver *_archiver);
+
+static int initStaticArchivers(void)
+{
+    #define REGISTER_STATIC_ARCHIVER(arc) { \
+        if (!doRegisterArchiver(&__PHYSFS_Archiver_##arc)) { \
             return 0; \
         } \
     }
@@ -1229,6 +2541,9 @@ int PHYSFS_init(const char *argv0)
 
     if (!initializeMutexes()) goto initFailed;
 
+    if (!__PHYSFS_poolInit(&fileHandlePool, PHYSFS_FILEHANDLE_POOL_SIZE))
+        goto initFailed;
+
     baseDir = calculateBaseDir(argv0);
     if (!baseDir) goto initFailed;
 
@@ -1243,6 +2558,12 @@ int PHYSFS_init(const char *argv0)
 
     if (!initStaticArchivers()) goto initFailed;
 
+    __PHYSFS_crc32Init();
+
+    #if PHYSFS_SUPPORTS_STATS
+    memset(&__PHYSFS_globalStats, '\0', sizeof (__PHYSFS_globalStats));
+    #endif
+
     initialized = 1;
 
     /* This makes sure that the error subsystem is initialized. */
@@ -1257,6 +2578,8 @@ initFailed:
 
 
 /* MAKE SURE you hold stateLock before calling this! */
+static int endWriteBehind(FileHandle *fh);
+
 static int closeFileHandleList(FileHandle **list)
 {
     FileHandle *i;
@@ -1267,14 +2590,21 @@ static int closeFileHandleList(FileHandle **list)
         PHYSFS_Io *io = i->io;
         next = i->next;
 
+        if (i->writeBehind != NULL)
+            (void) endWriteBehind(i);  /* get the writer off the Io. */
+
         if (io->flush && !io->flush(io))
         {
             *list = i;
+            i->prev = NULL;
             return 0;
         } /* if */
 
         io->destroy(io);
-        allocator.Free(i);
+        releaseDirHandle(i->dirHandle);
+        if (i->buffer != NULL)
+            allocator.Free(i->buffer);
+        freeFileHandle(i);
     } /* for */
 
     *list = NULL;
@@ -1282,6 +2612,24 @@ static int closeFileHandleList(FileHandle **list)
 } /* closeFileHandleList */
 
 
+/* Any handles these hold are closed with the rest of openReadList. */
+static void freeFileMappings(void)
+{
+    FileMapping *i;
+    FileMapping *next = NULL;
+
+    for (i = fileMappings; i != NULL; i = next)
+    {
+        next = i->next;
+        if (i->handle == NULL)
+            allocator.Free((void *) i->ptr);
+        allocator.Free(i);
+    } /* for */
+
+    fileMappings = NULL;
+} /* freeFileMappings */
+
+
 /* MAKE SURE you hold the stateLock before calling this! */
 static void freeSearchPath(void)
 {
@@ -1289,6 +2637,7 @@ static void freeSearchPath(void)
     DirHandle *next = NULL;
 
     closeFileHandleList(&openReadList);
+    invalidateSearchPath(0);
 
     if (searchPath != NULL)
     {
@@ -1359,14 +2708,24 @@ static void freeArchivers(void)
 } /* freeArchivers */
 
 
+static void stopAsyncReads(void);
+static void stopWriteBehind(void);
+static void stopPreload(void);
+
 static int doDeinit(void)
 {
     closeFileHandleList(&openWriteList);
     BAIL_IF(!PHYSFS_setWriteDir(NULL), PHYSFS_ERR_FILES_STILL_OPEN, 0);
 
+    stopAsyncReads();  /* finishes anything still queued, first. */
+    stopWriteBehind();  /* likewise. */
+    stopPreload();  /* abandons anything not done yet. */
+
+    freeFileMappings();
     freeSearchPath();
     freeArchivers();
     freeErrorStates();
+    __PHYSFS_poolDeinit(&fileHandlePool, freePooledFileHandle);
 
     if (baseDir != NULL)
     {
@@ -1386,6 +2745,12 @@ static int doDeinit(void)
         prefDir = NULL;
     } /* if */
 
+    if (mountIndexDir != NULL)
+    {
+        allocator.Free(mountIndexDir);
+        mountIndexDir = NULL;
+    } /* if */
+
     if (archiveInfo != NULL)
     {
         allocator.Free(archiveInfo);
@@ -1400,6 +2765,15 @@ static int doDeinit(void)
 
     longest_root = 0;
     allowSymLinks = 0;
+    caseInsensitive = 0;
+    cacheDirectories = 0;
+    verifyChecksums = 0;
+    resolveOnMount = 0;
+    mapArchives = 1;
+    indexSearchPath = 0;
+    asyncReadUnavailable = 0;
+    writeBehindUnavailable = 0;
+    preloadUnavailable = 0;
     initialized = 0;
 
     if (errorLock) __PHYSFS_platformDestroyMutex(errorLock);
@@ -1581,7 +2955,7 @@ int PHYSFS_registerArchiver(const PHYSFS_Archiver *archiver)
 {
     int retval;
     BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLock();
     retval = doRegisterArchiver(archiver);
     __PHYSFS_platformReleaseMutex(stateLock);
     return retval;
@@ -1595,7 +2969,7 @@ int PHYSFS_deregisterArchiver(const char *ext)
     BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, 0);
     BAIL_IF(!ext, PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLock();
     for (i = 0; i < numArchivers; i++)
     {
         if (PHYSFS_utf8stricmp(archiveInfo[i]->extension, ext) == 0)
@@ -1620,14 +2994,8 @@ const PHYSFS_ArchiveInfo **PHYSFS_supportedArchiveTypes(void)
 
 void PHYSFS_freeList(void *list)
 {
-    void **i;
     if (list != NULL)
-    {
-        for (i = (void **) list; *i != NULL; i++)
-            allocator.Free(*i);
-
-        allocator.Free(list);
-    } /* if */
+        allocator.Free(list);  /* the strings are in the same block. */
 } /* PHYSFS_freeList */
 
 
@@ -1716,7 +3084,7 @@ const char *PHYSFS_getWriteDir(void)
 {
     const char *retval = NULL;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLock();
     if (writeDir != NULL)
         retval = writeDir->dirName;
     __PHYSFS_platformReleaseMutex(stateLock);
@@ -1729,7 +3097,7 @@ int PHYSFS_setWriteDir(const char *newDir)
 {
     int retval = 1;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLock();
 
     if (writeDir != NULL)
     {
@@ -1740,7 +3108,7 @@ int PHYSFS_setWriteDir(const char *newDir)
 
     if (newDir != NULL)
     {
-        writeDir = createDirHandle(NULL, newDir, NULL, 1);
+        writeDir = createDirHandle(NULL, newDir, NULL, 1, 0);
         retval = (writeDir != NULL);
     } /* if */
 
@@ -1753,78 +3121,386 @@ int PHYSFS_setWriteDir(const char *newDir)
 int PHYSFS_setRoot(const char *archive, const char *subdir)
 {
     DirHandle *i;
+    char *ptr = NULL;
+    size_t rootlen = 0;
 
     BAIL_IF(!archive, PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    if (subdir && (strcmp(subdir, "/") != 0))
+    {
+        ptr = (char *) allocator.Malloc(strlen(subdir) + 1);
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        if (!sanitizePlatformIndependentPath(subdir, ptr))
+        {
+            allocator.Free(ptr);
+            return 0;
+        } /* if */
+        rootlen = strlen(ptr);  /* in case sanitizePlatformIndependentPath changed subdir */
+    } /* if */
+
+    grabStateLock();
 
     for (i = searchPath; i != NULL; i = i->next)
     {
         if ((i->dirName != NULL) && (strcmp(archive, i->dirName) == 0))
-        {
-            if (!subdir || (strcmp(subdir, "/") == 0))
-            {
-                if (i->root)
-                    allocator.Free(i->root);
-                i->root = NULL;
-                i->rootlen = 0;
-            } /* if */
-            else
-            {
-                const size_t len = strlen(subdir) + 1;
-                char *ptr = (char *) allocator.Malloc(len);
-                BAIL_IF_MUTEX(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
-                if (!sanitizePlatformIndependentPath(subdir, ptr))
-                {
-                    allocator.Free(ptr);
-                    BAIL_MUTEX_ERRPASS(stateLock, 0);
-                } /* if */
+            break;
+    } /* for */
 
-                if (i->root)
-                    allocator.Free(i->root);
-                i->root = ptr;
-                i->rootlen = strlen(i->root);  /* in case sanitizePlatformIndependentPath changed subdir */
+    if (i == NULL)  /* not mounted; nothing to do. */
+    {
+        __PHYSFS_platformReleaseMutex(stateLock);
+        if (ptr)
+            allocator.Free(ptr);
+        return 1;
+    } /* if */
 
-                if (longest_root < i->rootlen)
-                    longest_root = i->rootlen;
-            } /* else */
+    /* grow this first, so snapshots built from here on have room for it. */
+    if (longest_root < rootlen)
+        longest_root = rootlen;
 
-            break;
-        } /* if */
-    } /* for */
+    invalidateSearchPath(0);
+    (void) __PHYSFS_ATOMIC_INCR(&i->refcount);
+    __PHYSFS_platformReleaseMutex(stateLock);
 
+    /* lookups can be verifying paths against this right now. Never hold
+       stateLock while waiting on an archive's lock. */
+    __PHYSFS_platformGrabMutex(i->lock);
+    if (i->root)
+        allocator.Free(i->root);
+    i->root = ptr;
+    i->rootlen = rootlen;
+    __PHYSFS_platformReleaseMutex(i->lock);
+
+    /* the search path index might have been built with the old root. */
+    grabStateLock();
+    invalidateSearchPath(0);
     __PHYSFS_platformReleaseMutex(stateLock);
+
+    releaseDirHandle(i);
     return 1;
 } /* PHYSFS_setRoot */
 
 
-static int doMount(PHYSFS_Io *io, const char *fname,
-                   const char *mountPoint, int appendToPath)
+int PHYSFS_setMountIndexDir(const char *dir)
 {
-    DirHandle *dh;
-    DirHandle *prev = NULL;
-    DirHandle *i;
+    char *ptr = NULL;
 
-    BAIL_IF(!fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    if (dir != NULL)
+    {
+        ptr = __PHYSFS_strdup(dir);
+        BAIL_IF_ERRPASS(!ptr, 0);
+    } /* if */
 
-    if (mountPoint == NULL)
-        mountPoint = "/";
+    grabStateLock();
+    if (mountIndexDir != NULL)
+        allocator.Free(mountIndexDir);
+    mountIndexDir = ptr;
+    __PHYSFS_platformReleaseMutex(stateLock);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    return 1;
+} /* PHYSFS_setMountIndexDir */
 
-    for (i = searchPath; i != NULL; i = i->next)
-    {
-        /* already in search path? */
-        if ((i->dirName != NULL) && (strcmp(fname, i->dirName) == 0))
-            BAIL_MUTEX_ERRPASS(stateLock, 1);
-        prev = i;
-    } /* for */
 
-    dh = createDirHandle(io, fname, mountPoint, 0);
-    BAIL_IF_MUTEX_ERRPASS(!dh, stateLock, 0);
+const char *PHYSFS_getMountIndexDir(void)
+{
+    const char *retval;
+    grabStateLock();
+    retval = mountIndexDir;
+    __PHYSFS_platformReleaseMutex(stateLock);
+    return retval;
+} /* PHYSFS_getMountIndexDir */
 
-    if (appendToPath)
-    {
+
+/*
+ * PHYSFS_setTraceCallback() support. Everything that reports an event checks
+ *  (traceCallback) first, so apps that don't trace only pay for that test.
+ *  It can only change while we're not initialized, so there's no locking.
+ */
+static void initTraceEvent(PHYSFS_TraceEvent *event,
+                           const PHYSFS_TraceEventType type,
+                           const FileHandle *fh)
+{
+    memset(event, '\0', sizeof (*event));
+    event->type = type;
+    if (fh != NULL)
+    {
+        event->file = (PHYSFS_File *) fh;
+        event->archive = fh->dirHandle->dirName;
+    } /* if */
+} /* initTraceEvent */
+
+/* report (event) to the app, without disturbing our error code. */
+static void emitTraceEvent(const PHYSFS_TraceEvent *event)
+{
+    const PHYSFS_ErrorCode errcode = currentErrorCode();
+    traceCallback(traceCallbackData, event);
+    (void) PHYSFS_getLastErrorCode();  /* throw away anything the app set. */
+    PHYSFS_setErrorCode(errcode);
+} /* emitTraceEvent */
+
+
+static void traceMount(const PHYSFS_TraceEventType type, const char *fname,
+                       const char *mountPoint, const int rc,
+                       const PHYSFS_uint64 nanoseconds)
+{
+    PHYSFS_TraceEvent event;
+    initTraceEvent(&event, type, NULL);
+    event.filename = mountPoint;
+    event.archive = fname;
+    event.result = rc;
+    event.nanoseconds = nanoseconds;
+    emitTraceEvent(&event);
+} /* traceMount */
+
+
+/*
+ * PHYSFS_mountPreload() hands a duplicate of the archive's Io to one
+ *  background thread, which pulls the whole file into memory and then
+ *  switches the Io's shared state (the NativeIoFile or MappedFile that all
+ *  its duplicates point to) over to it, so every open file in the archive,
+ *  and every one opened later, reads from RAM from then on. A mapping is
+ *  locked in place if the OS allows it; otherwise it's copied, like a file
+ *  that isn't mapped. Until it's done, reads go to disk as usual. The
+ *  thread never takes the stateLock, and holding its own duplicate means it
+ *  doesn't care if the archive is unmounted in the meantime.
+ */
+#ifndef PHYSFS_PRELOAD_CHUNK
+#define PHYSFS_PRELOAD_CHUNK (1024 * 1024)
+#endif
+
+static int preloadCancelled(void)
+{
+    int retval;
+    __PHYSFS_platformGrabMutex(preloadLock);
+    retval = preloadStopping;
+    __PHYSFS_platformReleaseMutex(preloadLock);
+    return retval;
+} /* preloadCancelled */
+
+
+/* copy (len) bytes from (src), or from (handle) if (src) is NULL. */
+static const PHYSFS_uint8 *preloadCopy(const PHYSFS_uint8 *src, void *handle,
+                                       const PHYSFS_uint64 len)
+{
+    PHYSFS_uint8 *buf;
+    PHYSFS_uint64 pos = 0;
+
+    if ((len == 0) || (len != (size_t) len))
+        return NULL;  /* nothing to do, or it can't fit. */
+
+    buf = (PHYSFS_uint8 *) allocator.Malloc((size_t) len);
+    if (buf == NULL)
+        return NULL;
+
+    while ((pos < len) && (!preloadCancelled()))
+    {
+        const PHYSFS_uint64 avail = len - pos;
+        const size_t chunk = (size_t) ((avail < PHYSFS_PRELOAD_CHUNK) ? avail : PHYSFS_PRELOAD_CHUNK);
+        if (src != NULL)
+            memcpy(buf + pos, src + pos, chunk);
+        #ifndef PHYSFS_NO_POSITIONAL_READ
+        else
+        {
+            const PHYSFS_sint64 rc = __PHYSFS_platformReadAt(handle, buf + pos, chunk, pos);
+            if (rc <= 0)
+                break;  /* leave it on disk, then. */
+            pos += (PHYSFS_uint64) rc;
+            continue;
+        } /* else */
+        #endif
+        pos += chunk;
+    } /* while */
+
+    if (pos < len)
+    {
+        allocator.Free(buf);
+        return NULL;
+    } /* if */
+
+    return buf;
+} /* preloadCopy */
+
+
+static void runPreload(PHYSFS_Io *io)
+{
+    const PHYSFS_ErrorCode prev = currentErrorCode();
+
+    if (io->destroy == mappedIo_destroy)
+    {
+        MappedFile *map = ((MappedIoInfo *) io->opaque)->map;
+        if (!__PHYSFS_platformLockMapping(map->buf, map->len))
+        {
+            const PHYSFS_uint8 *ram = preloadCopy(map->buf, NULL, map->len);
+            if (ram != NULL)
+                __PHYSFS_ATOMIC_SETPTR(&map->ram, ram);
+        } /* if */
+    } /* if */
+
+    else if (io->destroy == nativeIo_destroy)
+    {
+        NativeIoFile *file = ((NativeIoInfo *) io->opaque)->file;
+        const PHYSFS_sint64 len = __PHYSFS_platformFileLength(file->handle);
+        if ((len > 0) && (nativeIoIsShared(file)))
+        {
+            const PHYSFS_uint8 *ram = preloadCopy(NULL, file->handle, (PHYSFS_uint64) len);
+            if (ram != NULL)
+            {
+                file->ramlen = (PHYSFS_uint64) len;  /* before (ram) shows up. */
+                __PHYSFS_ATOMIC_SETPTR(&file->ram, ram);
+            } /* if */
+        } /* if */
+    } /* else if */
+
+    /* nobody's listening for errors on this thread, but keep it tidy. */
+    PHYSFS_setErrorCode(prev);
+} /* runPreload */
+
+
+static void preloadWorker(void *unused)
+{
+    while (1)
+    {
+        Preload *job;
+        int stopping;
+
+        __PHYSFS_platformWaitSemaphore(preloadWork);
+        __PHYSFS_platformGrabMutex(preloadLock);
+        job = preloadQueue;
+        if (job != NULL)
+        {
+            preloadQueue = job->next;
+            if (preloadQueue == NULL)
+                preloadQueueTail = NULL;
+        } /* if */
+        stopping = preloadStopping;
+        __PHYSFS_platformReleaseMutex(preloadLock);
+
+        if (job == NULL)
+            break;  /* posted with nothing queued: we're shutting down. */
+
+        if (!stopping)
+            runPreload(job->io);
+        job->io->destroy(job->io);
+        allocator.Free(job);
+    } /* while */
+} /* preloadWorker */
+
+
+/* MAKE SURE you've got the stateLock held before calling this! */
+static int startPreload(void)
+{
+    if (preloadThread != NULL)
+        return 1;
+
+    BAIL_IF(preloadUnavailable, PHYSFS_ERR_UNSUPPORTED, 0);
+
+    preloadLock = __PHYSFS_platformCreateMutex();
+    GOTO_IF_ERRPASS(!preloadLock, startFailed);
+    preloadWork = __PHYSFS_platformCreateSemaphore();
+    GOTO_IF_ERRPASS(!preloadWork, startFailed);
+    preloadStopping = 0;
+    preloadThread = __PHYSFS_platformCreateThread(preloadWorker, NULL);
+    GOTO_IF(!preloadThread, PHYSFS_ERR_UNSUPPORTED, startFailed);
+    return 1;
+
+startFailed:
+    if (preloadWork) __PHYSFS_platformDestroySemaphore(preloadWork);
+    if (preloadLock) __PHYSFS_platformDestroyMutex(preloadLock);
+    preloadWork = preloadLock = NULL;
+    preloadUnavailable = 1;  /* don't keep trying. */
+    return 0;
+} /* startPreload */
+
+
+static void stopPreload(void)
+{
+    if (preloadThread == NULL)
+        return;
+
+    __PHYSFS_platformGrabMutex(preloadLock);
+    preloadStopping = 1;
+    __PHYSFS_platformReleaseMutex(preloadLock);
+
+    /* it drops what's queued before it sees this. */
+    __PHYSFS_platformPostSemaphore(preloadWork);
+    __PHYSFS_platformWaitThread(preloadThread);
+
+    assert(preloadQueue == NULL);
+    __PHYSFS_platformDestroySemaphore(preloadWork);
+    __PHYSFS_platformDestroyMutex(preloadLock);
+    preloadWork = preloadLock = preloadThread = NULL;
+} /* stopPreload */
+
+
+/*
+ * Start pulling (io) into memory in the background. Best effort: if it
+ *  can't be done, the archive just stays on disk, so this doesn't fail.
+ *  MAKE SURE you've got the stateLock held before calling this!
+ */
+static void queuePreload(PHYSFS_Io *io)
+{
+    const PHYSFS_ErrorCode prev = currentErrorCode();
+    Preload *job = NULL;
+
+    if ((io->destroy != mappedIo_destroy) && (io->destroy != nativeIo_destroy))
+        return;  /* not ours; only the app knows where it lives. */
+    else if (!startPreload())
+        goto queuePreload_done;
+
+    job = (Preload *) allocator.Malloc(sizeof (Preload));
+    if (job == NULL)
+        goto queuePreload_done;
+
+    job->io = io->duplicate(io);  /* shares the file, so shares the RAM. */
+    if (job->io == NULL)
+    {
+        allocator.Free(job);
+        goto queuePreload_done;
+    } /* if */
+
+    __PHYSFS_platformGrabMutex(preloadLock);
+    job->next = NULL;
+    if (preloadQueueTail == NULL)
+        preloadQueue = job;
+    else
+        preloadQueueTail->next = job;
+    preloadQueueTail = job;
+    __PHYSFS_platformReleaseMutex(preloadLock);
+    __PHYSFS_platformPostSemaphore(preloadWork);
+
+queuePreload_done:
+    PHYSFS_setErrorCode(prev);  /* not a failure of the mount. */
+} /* queuePreload */
+
+
+static int addToSearchPath(PHYSFS_Io *io, const char *fname,
+                           const char *mountPoint, int appendToPath,
+                           int preload)
+{
+    DirHandle *dh;
+    DirHandle *prev = NULL;
+    DirHandle *i;
+
+    BAIL_IF(!fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    if (mountPoint == NULL)
+        mountPoint = "/";
+
+    grabStateLock();
+
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        /* already in search path? */
+        if ((i->dirName != NULL) && (strcmp(fname, i->dirName) == 0))
+            BAIL_MUTEX_ERRPASS(stateLock, 1);
+        prev = i;
+    } /* for */
+
+    dh = createDirHandle(io, fname, mountPoint, 0, preload);
+    BAIL_IF_MUTEX_ERRPASS(!dh, stateLock, 0);
+
+    if (appendToPath)
+    {
         if (prev == NULL)
             searchPath = dh;
         else
@@ -1836,8 +3512,27 @@ static int doMount(PHYSFS_Io *io, const char *fname,
         searchPath = dh;
     } /* else */
 
+    invalidateSearchPath(1);
+
     __PHYSFS_platformReleaseMutex(stateLock);
     return 1;
+} /* addToSearchPath */
+
+
+static int doMount(PHYSFS_Io *io, const char *fname,
+                   const char *mountPoint, int appendToPath, int preload)
+{
+    PHYSFS_uint64 started;
+    int rc;
+
+    if (traceCallback == NULL)
+        return addToSearchPath(io, fname, mountPoint, appendToPath, preload);
+
+    started = __PHYSFS_platformNanoseconds();
+    rc = addToSearchPath(io, fname, mountPoint, appendToPath, preload);
+    traceMount(PHYSFS_TRACE_MOUNT, fname, mountPoint ? mountPoint : "/",
+               rc, __PHYSFS_platformNanoseconds() - started);
+    return rc;
 } /* doMount */
 
 
@@ -1847,7 +3542,7 @@ int PHYSFS_mountIo(PHYSFS_Io *io, const char *fname,
     BAIL_IF(!io, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     BAIL_IF(!fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     BAIL_IF(io->version != 0, PHYSFS_ERR_UNSUPPORTED, 0);
-    return doMount(io, fname, mountPoint, appendToPath);
+    return doMount(io, fname, mountPoint, appendToPath, 0);
 } /* PHYSFS_mountIo */
 
 
@@ -1863,7 +3558,7 @@ int PHYSFS_mountMemory(const void *buf, PHYSFS_uint64 len, void (*del)(void *),
 
     io = __PHYSFS_createMemoryIo(buf, len, del);
     BAIL_IF_ERRPASS(!io, 0);
-    retval = doMount(io, fname, mountPoint, appendToPath);
+    retval = doMount(io, fname, mountPoint, appendToPath, 0);
     if (!retval)
     {
         /* docs say not to call (del) in case of failure, so cheat. */
@@ -1887,7 +3582,7 @@ int PHYSFS_mountHandle(PHYSFS_File *file, const char *fname,
 
     io = __PHYSFS_createHandleIo(file);
     BAIL_IF_ERRPASS(!io, 0);
-    retval = doMount(io, fname, mountPoint, appendToPath);
+    retval = doMount(io, fname, mountPoint, appendToPath, 0);
     if (!retval)
     {
         /* docs say not to destruct in case of failure, so cheat. */
@@ -1902,10 +3597,218 @@ int PHYSFS_mountHandle(PHYSFS_File *file, const char *fname,
 int PHYSFS_mount(const char *newDir, const char *mountPoint, int appendToPath)
 {
     BAIL_IF(!newDir, PHYSFS_ERR_INVALID_ARGUMENT, 0);
-    return doMount(NULL, newDir, mountPoint, appendToPath);
+    return doMount(NULL, newDir, mountPoint, appendToPath, 0);
 } /* PHYSFS_mount */
 
 
+int PHYSFS_mountPreload(const char *newDir, const char *mountPoint,
+                        int appendToPath)
+{
+    BAIL_IF(!newDir, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    return doMount(NULL, newDir, mountPoint, appendToPath, 1);
+} /* PHYSFS_mountPreload */
+
+
+/*
+ * PHYSFS_mountMultiple() opens its archives on several threads at once.
+ *  Each thread claims the next item until there are none left; the calling
+ *  thread works too, so this still gets done if no threads can be started.
+ *  The caller holds stateLock the whole time, like doMount() does, so the
+ *  workers can read the archiver list, etc, without locking. Nothing they
+ *  do may grab stateLock, which is why this only takes real paths: an
+ *  archive read through a PHYSFS_File would need it.
+ */
+#ifndef PHYSFS_MOUNT_MAX_THREADS
+#define PHYSFS_MOUNT_MAX_THREADS 16
+#endif
+
+typedef struct
+{
+    const char *fname;
+    const char *mountPoint;
+    DirHandle *dh;  /* the opened archive, NULL if not (yet). */
+    PHYSFS_ErrorCode errcode;  /* why (dh) couldn't be opened. */
+    int skip;  /* already mounted (or listed twice); nothing to do. */
+    PHYSFS_uint64 nanoseconds;  /* time it took to open, if tracing. */
+} MountBatchItem;
+
+typedef struct
+{
+    MountBatchItem *items;
+    int count;
+    int claimed;  /* items handed out so far. Atomic. */
+} MountBatch;
+
+static void mountBatchWorker(void *_batch)
+{
+    MountBatch *batch = (MountBatch *) _batch;
+    int idx;
+
+    while ((idx = __PHYSFS_ATOMIC_INCR(&batch->claimed) - 1) < batch->count)
+    {
+        MountBatchItem *item = &batch->items[idx];
+        PHYSFS_uint64 started = 0;
+        if (item->skip)
+            continue;
+
+        if (traceCallback != NULL)
+            started = __PHYSFS_platformNanoseconds();
+
+        item->dh = createDirHandle(NULL, item->fname, item->mountPoint, 0, 0);
+        if (item->dh == NULL)
+        {
+            item->errcode = PHYSFS_getLastErrorCode();
+            if (item->errcode == PHYSFS_ERR_OK)
+                item->errcode = PHYSFS_ERR_OTHER_ERROR;
+        } /* if */
+
+        if (traceCallback != NULL)
+            item->nanoseconds = __PHYSFS_platformNanoseconds() - started;
+    } /* while */
+} /* mountBatchWorker */
+
+
+int PHYSFS_mountMultiple(const char * const *newDirs,
+                         const char * const *mountPoints,
+                         PHYSFS_uint32 count, int appendToPath)
+{
+    void *threads[PHYSFS_MOUNT_MAX_THREADS];
+    PHYSFS_ErrorCode errcode = PHYSFS_ERR_OK;
+    MountBatchItem *items;
+    MountBatch batch;
+    DirHandle *first = NULL;
+    DirHandle *last = NULL;
+    DirHandle *i;
+    int nthreads;
+    int idx;
+    int j;
+
+    BAIL_IF(!newDirs && count, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(count > 0x7FFFFFFF, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    for (idx = 0; idx < (int) count; idx++)
+        BAIL_IF(!newDirs[idx], PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    if (count == 0)
+        return 1;  /* that was easy. */
+
+    items = (MountBatchItem *) allocator.Malloc(count * sizeof (MountBatchItem));
+    BAIL_IF(!items, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(items, '\0', count * sizeof (MountBatchItem));
+    for (idx = 0; idx < (int) count; idx++)
+    {
+        items[idx].fname = newDirs[idx];
+        items[idx].mountPoint = "/";
+        if ((mountPoints != NULL) && (mountPoints[idx] != NULL))
+            items[idx].mountPoint = mountPoints[idx];
+    } /* for */
+
+    memset(&batch, '\0', sizeof (batch));
+    batch.items = items;
+    batch.count = (int) count;
+
+    grabStateLock();
+
+    /* like PHYSFS_mount(), mounting something twice is a successful no-op. */
+    for (idx = 0; idx < batch.count; idx++)
+    {
+        for (i = searchPath; (i != NULL) && (!items[idx].skip); i = i->next)
+        {
+            if ((i->dirName != NULL) && (strcmp(items[idx].fname, i->dirName) == 0))
+                items[idx].skip = 1;
+        } /* for */
+
+        for (j = 0; (j < idx) && (!items[idx].skip); j++)
+        {
+            if (strcmp(items[idx].fname, items[j].fname) == 0)
+                items[idx].skip = 1;
+        } /* for */
+    } /* for */
+
+    /* the calling thread counts as one of them. */
+#ifdef PHYSFS_NEED_ATOMIC_OP_FALLBACK
+    nthreads = 1;  /* fallback atomics need stateLock, which we're holding. */
+#else
+    nthreads = __PHYSFS_platformCPUCount();
+#endif
+    if (nthreads > batch.count)
+        nthreads = batch.count;
+    if (nthreads > PHYSFS_MOUNT_MAX_THREADS)
+        nthreads = PHYSFS_MOUNT_MAX_THREADS;
+    for (j = 0; j < nthreads - 1; j++)
+    {
+        threads[j] = __PHYSFS_platformCreateThread(mountBatchWorker, &batch);
+        if (threads[j] == NULL)
+            break;  /* do with what we've got. */
+    } /* for */
+    nthreads = j;
+
+    mountBatchWorker(&batch);
+
+    for (j = 0; j < nthreads; j++)
+        __PHYSFS_platformWaitThread(threads[j]);
+
+    /* all or nothing; report the first failure, in the order requested. */
+    for (idx = 0; (idx < batch.count) && (!errcode); idx++)
+    {
+        if ((!items[idx].skip) && (!items[idx].dh))
+            errcode = items[idx].errcode;
+    } /* for */
+
+    for (idx = 0; idx < batch.count; idx++)
+    {
+        DirHandle *dh = items[idx].dh;
+        if (dh == NULL)
+            continue;
+        else if (errcode)
+            releaseDirHandle(dh);
+        else
+        {
+            if (last == NULL)
+                first = dh;
+            else
+                last->next = dh;
+            last = dh;
+        } /* else */
+    } /* for */
+
+    if (first != NULL)
+    {
+        if (!appendToPath)
+        {
+            last->next = searchPath;
+            searchPath = first;
+        } /* if */
+        else if (searchPath == NULL)
+            searchPath = first;
+        else
+        {
+            for (i = searchPath; i->next != NULL; i = i->next) { /* spin */ }
+            i->next = first;
+        } /* else */
+
+        invalidateSearchPath(1);
+    } /* if */
+
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    if (traceCallback != NULL)
+    {
+        for (idx = 0; idx < batch.count; idx++)
+        {
+            const MountBatchItem *item = &items[idx];
+            const int rc = item->skip || ((item->dh != NULL) && !errcode);
+            traceMount(PHYSFS_TRACE_MOUNT, item->fname, item->mountPoint,
+                       rc, item->nanoseconds);
+        } /* for */
+    } /* if */
+
+    allocator.Free(items);
+
+    BAIL_IF(errcode, errcode, 0);
+    return 1;
+} /* PHYSFS_mountMultiple */
+
+
 int PHYSFS_addToSearchPath(const char *newDir, int appendToPath)
 {
     return PHYSFS_mount(newDir, NULL, appendToPath);
@@ -1918,7 +3821,7 @@ int PHYSFS_removeFromSearchPath(const char *oldDir)
 } /* PHYSFS_removeFromSearchPath */
 
 
-int PHYSFS_unmount(const char *oldDir)
+static int doUnmount(const char *oldDir)
 {
     DirHandle *i;
     DirHandle *prev = NULL;
@@ -1926,7 +3829,7 @@ int PHYSFS_unmount(const char *oldDir)
 
     BAIL_IF(oldDir == NULL, PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLock();
     for (i = searchPath; i != NULL; i = i->next)
     {
         if (strcmp(i->dirName, oldDir) == 0)
@@ -1940,12 +3843,29 @@ int PHYSFS_unmount(const char *oldDir)
             else
                 prev->next = next;
 
+            invalidateSearchPath(0);
             BAIL_MUTEX_ERRPASS(stateLock, 1);
         } /* if */
         prev = i;
     } /* for */
 
     BAIL_MUTEX(PHYSFS_ERR_NOT_MOUNTED, stateLock, 0);
+} /* doUnmount */
+
+
+int PHYSFS_unmount(const char *oldDir)
+{
+    PHYSFS_uint64 started;
+    int rc;
+
+    if (traceCallback == NULL)
+        return doUnmount(oldDir);
+
+    started = __PHYSFS_platformNanoseconds();
+    rc = doUnmount(oldDir);
+    traceMount(PHYSFS_TRACE_UNMOUNT, oldDir, NULL, rc,
+               __PHYSFS_platformNanoseconds() - started);
+    return rc;
 } /* PHYSFS_unmount */
 
 
@@ -1958,7 +3878,7 @@ char **PHYSFS_getSearchPath(void)
 const char *PHYSFS_getMountPoint(const char *dir)
 {
     DirHandle *i;
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLock();
     for (i = searchPath; i != NULL; i = i->next)
     {
         if (strcmp(i->dirName, dir) == 0)
@@ -1974,11 +3894,60 @@ const char *PHYSFS_getMountPoint(const char *dir)
 } /* PHYSFS_getMountPoint */
 
 
+#if PHYSFS_SUPPORTS_STATS
+static void copyStats(PHYSFS_Stats *dst, PHYSFS_Stats *src)
+{
+    dst->opens = __PHYSFS_STAT_ATOMIC_GET(&src->opens);
+    dst->failedLookups = __PHYSFS_STAT_ATOMIC_GET(&src->failedLookups);
+    dst->bytesRead = __PHYSFS_STAT_ATOMIC_GET(&src->bytesRead);
+    dst->archiveBytesRead = __PHYSFS_STAT_ATOMIC_GET(&src->archiveBytesRead);
+    dst->inflateBytes = __PHYSFS_STAT_ATOMIC_GET(&src->inflateBytes);
+    dst->inflateNanoseconds = __PHYSFS_STAT_ATOMIC_GET(&src->inflateNanoseconds);
+    dst->seekRewinds = __PHYSFS_STAT_ATOMIC_GET(&src->seekRewinds);
+    dst->bufferRefills = __PHYSFS_STAT_ATOMIC_GET(&src->bufferRefills);
+    dst->lockWaitNanoseconds = __PHYSFS_STAT_ATOMIC_GET(&src->lockWaitNanoseconds);
+} /* copyStats */
+#endif
+
+
+int PHYSFS_getStats(const char *archive, PHYSFS_Stats *stats)
+{
+#if !PHYSFS_SUPPORTS_STATS
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);
+#else
+    DirHandle *i;
+
+    BAIL_IF(!stats, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    if (archive == NULL)
+    {
+        copyStats(stats, &__PHYSFS_globalStats);
+        return 1;
+    } /* if */
+
+    grabStateLock();
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (strcmp(i->dirName, archive) == 0)
+            break;
+    } /* for */
+
+    if ((i == NULL) && (writeDir != NULL) && (strcmp(writeDir->dirName, archive) == 0))
+        i = writeDir;
+
+    BAIL_IF_MUTEX(!i, PHYSFS_ERR_NOT_MOUNTED, stateLock, 0);
+    copyStats(stats, &i->stats);
+    __PHYSFS_platformReleaseMutex(stateLock);
+    return 1;
+#endif
+} /* PHYSFS_getStats */
+
+
 void PHYSFS_getSearchPathCallback(PHYSFS_StringCallback callback, void *data)
 {
     DirHandle *i;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLock();
 
     for (i = searchPath; i != NULL; i = i->next)
         callback(data, i->dirName);
@@ -2100,22 +4069,129 @@ int PHYSFS_symbolicLinksPermitted(void)
 } /* PHYSFS_symbolicLinksPermitted */
 
 
-/*
- * Verify that (fname) (in platform-independent notation), in relation
- *  to (h) is secure. That means that each element of fname is checked
- *  for symlinks (if they aren't permitted). This also allows for quick
- *  rejection of files that exist outside an archive's mountpoint.
- *
- * With some exceptions (like PHYSFS_mkdir(), which builds multiple subdirs
- *  at a time), you should always pass zero for "allowMissing" for efficiency.
- *
- * (fname) must point to an output from sanitizePlatformIndependentPath(),
- *  since it will make sure that path names are in the right format for
- *  passing certain checks. It will also do checks for "insecure" pathnames
- *  like ".." which should be done once instead of once per archive. This also
- *  gives us license to treat (fname) as scratch space in this function.
- *
- * (fname)'s buffer must have enough space available before it for this
+void PHYSFS_setCaseInsensitive(int enable)
+{
+    caseInsensitive = (enable != 0);
+} /* PHYSFS_setCaseInsensitive */
+
+
+int PHYSFS_isCaseInsensitive(void)
+{
+    return caseInsensitive;
+} /* PHYSFS_isCaseInsensitive */
+
+
+void PHYSFS_setDirectoryCaching(int enable)
+{
+    cacheDirectories = (enable != 0);
+} /* PHYSFS_setDirectoryCaching */
+
+
+int PHYSFS_isDirectoryCaching(void)
+{
+    return cacheDirectories;
+} /* PHYSFS_isDirectoryCaching */
+
+
+void PHYSFS_setVerifyChecksums(int enable)
+{
+    verifyChecksums = (enable != 0);
+} /* PHYSFS_setVerifyChecksums */
+
+
+int PHYSFS_isVerifyingChecksums(void)
+{
+    return verifyChecksums;
+} /* PHYSFS_isVerifyingChecksums */
+
+
+void PHYSFS_setResolveOnMount(int enable)
+{
+    resolveOnMount = (enable != 0);
+} /* PHYSFS_setResolveOnMount */
+
+
+int PHYSFS_isResolvingOnMount(void)
+{
+    return resolveOnMount;
+} /* PHYSFS_isResolvingOnMount */
+
+
+void PHYSFS_setMapArchives(int enable)
+{
+    mapArchives = (enable != 0);
+} /* PHYSFS_setMapArchives */
+
+
+int PHYSFS_isMappingArchives(void)
+{
+    return mapArchives;
+} /* PHYSFS_isMappingArchives */
+
+
+/* This must hold the stateLock before calling. */
+static void refreshDirectoryCaches(void)
+{
+    DirHandle *i;
+    for (i = searchPath; i != NULL; i = i->next)
+    {
+        if (i->funcs == &__PHYSFS_Archiver_DIR)
+            DIR_refreshCache(i->opaque);
+    } /* for */
+} /* refreshDirectoryCaches */
+
+
+void PHYSFS_refreshDirectoryCaches(void)
+{
+    if (initialized)
+    {
+        grabStateLock();
+        refreshDirectoryCaches();
+        __PHYSFS_platformReleaseMutex(stateLock);
+    } /* if */
+} /* PHYSFS_refreshDirectoryCaches */
+
+
+void PHYSFS_setSearchPathIndexed(int enable)
+{
+    enable = (enable != 0);
+    if (!initialized)
+        indexSearchPath = enable;
+    else
+    {
+        grabStateLock();
+        if (indexSearchPath != enable)
+        {
+            indexSearchPath = enable;
+            invalidateSearchPath(0);
+        } /* if */
+        __PHYSFS_platformReleaseMutex(stateLock);
+    } /* else */
+} /* PHYSFS_setSearchPathIndexed */
+
+
+int PHYSFS_isSearchPathIndexed(void)
+{
+    return indexSearchPath;
+} /* PHYSFS_isSearchPathIndexed */
+
+
+/*
+ * Verify that (fname) (in platform-independent notation), in relation
+ *  to (h) is secure. That means that each element of fname is checked
+ *  for symlinks (if they aren't permitted). This also allows for quick
+ *  rejection of files that exist outside an archive's mountpoint.
+ *
+ * With some exceptions (like PHYSFS_mkdir(), which builds multiple subdirs
+ *  at a time), you should always pass zero for "allowMissing" for efficiency.
+ *
+ * (fname) must point to an output from sanitizePlatformIndependentPath(),
+ *  since it will make sure that path names are in the right format for
+ *  passing certain checks. It will also do checks for "insecure" pathnames
+ *  like ".." which should be done once instead of once per archive. This also
+ *  gives us license to treat (fname) as scratch space in this function.
+ *
+ * (fname)'s buffer must have enough space available before it for this
  *  function to prepend any root directory for this DirHandle.
  *
  * Returns non-zero if string is safe, zero if there's a security issue.
@@ -2209,6 +4285,20 @@ static int verifyPath(DirHandle *h, char **_fname, int allowMissing)
 } /* verifyPath */
 
 
+/*
+ * verifyPath() for lookups walking a search path snapshot. (*_fname) must
+ *  have (snap->longest_root + 1) bytes of room in front of it.
+ *  MAKE SURE you hold (h->lock)!
+ */
+static int verifySnapshotPath(const SearchPathSnapshot *snap, DirHandle *h,
+                              char **_fname)
+{
+    /* PHYSFS_setRoot() gave (h) a longer root since (snap) was built. */
+    BAIL_IF(h->rootlen > snap->longest_root, PHYSFS_ERR_NOT_FOUND, 0);
+    return verifyPath(h, _fname, 0);
+} /* verifySnapshotPath */
+
+
 /* This must hold the stateLock before calling. */
 static int doMkdir(const char *_dname, char *dname)
 {
@@ -2258,6 +4348,9 @@ static int doMkdir(const char *_dname, char *dname)
         start = end + 1;
     } /* while */
 
+    if (!exists)  /* we tried to make something, so it might be mounted, too. */
+        refreshDirectoryCaches();
+
     return retval;
 } /* doMkdir */
 
@@ -2270,7 +4363,7 @@ int PHYSFS_mkdir(const char *_dname)
 
     BAIL_IF(!_dname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLock();
     BAIL_IF_MUTEX(!writeDir, PHYSFS_ERR_NO_WRITE_DIR, stateLock, 0);
     len = strlen(_dname) + dirHandleRootLen(writeDir) + 1;
     dname = (char *) __PHYSFS_smallAlloc(len);
@@ -2288,7 +4381,9 @@ static int doDelete(const char *_fname, char *fname)
     DirHandle *h = writeDir;
     BAIL_IF_ERRPASS(!sanitizePlatformIndependentPathWithRoot(h, _fname, fname), 0);
     BAIL_IF_ERRPASS(!verifyPath(h, &fname, 0), 0);
-    return h->funcs->remove(h->opaque, fname);
+    BAIL_IF_ERRPASS(!h->funcs->remove(h->opaque, fname), 0);
+    refreshDirectoryCaches();
+    return 1;
 } /* doDelete */
 
 
@@ -2298,7 +4393,7 @@ int PHYSFS_delete(const char *_fname)
     char *fname;
     size_t len;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    grabStateLock();
     BAIL_IF_MUTEX(!writeDir, PHYSFS_ERR_NO_WRITE_DIR, stateLock, 0);
     len = strlen(_fname) + dirHandleRootLen(writeDir) + 1;
     fname = (char *) __PHYSFS_smallAlloc(len);
@@ -2310,128 +4405,75 @@ int PHYSFS_delete(const char *_fname)
 } /* PHYSFS_delete */
 
 
-static DirHandle *getRealDirHandle(const char *_fname)
+static const char *getRealDirName(const char *_fname)
 {
-    DirHandle *retval = NULL;
+    const char *retval = NULL;
+    SearchPathSnapshot *snap = NULL;
     char *allocated_fname = NULL;
     char *fname = NULL;
     size_t len;
 
     BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
 
-    __PHYSFS_platformGrabMutex(stateLock);
-    len = strlen(_fname) + longest_root + 2;
+    snap = grabSearchPath();
+    BAIL_IF_ERRPASS(!snap, NULL);
+    len = strlen(_fname) + snap->longest_root + 2;
     allocated_fname = __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, NULL);
-    fname = allocated_fname + longest_root + 1;
+    if (!allocated_fname)
+    {
+        releaseSearchPath(snap);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+    fname = allocated_fname + snap->longest_root + 1;
     if (sanitizePlatformIndependentPath(_fname, fname))
     {
-        DirHandle *i;
-        for (i = searchPath; i != NULL; i = i->next)
+        const size_t first = searchPathFirstCandidate(snap, fname);
+        size_t idx;
+        for (idx = 0; (idx < snap->count) && (!retval); idx++)
         {
+            DirHandle *i = snap->dirs[idx];
             char *arcfname = fname;
-            if (partOfMountPoint(i, arcfname))
-            {
-                retval = i;
-                break;
-            } /* if */
-            else if (verifyPath(i, &arcfname, 0))
+            if (!searchPathCandidate(snap, idx, first))
+                PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+            else if (partOfMountPoint(i, arcfname))
+                retval = i->dirName;
+            else
             {
-                PHYSFS_Stat statbuf;
-                if (i->funcs->stat(i->opaque, arcfname, &statbuf))
+                __PHYSFS_platformGrabMutex(i->lock);
+                if (verifySnapshotPath(snap, i, &arcfname))
                 {
-                    retval = i;
-                    break;
+                    PHYSFS_Stat statbuf;
+                    if (i->funcs->stat(i->opaque, arcfname, &statbuf))
+                        retval = i->dirName;
                 } /* if */
-            } /* if */
+                __PHYSFS_platformReleaseMutex(i->lock);
+            } /* else */
         } /* for */
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    releaseSearchPath(snap);
     __PHYSFS_smallFree(allocated_fname);
     return retval;
-} /* getRealDirHandle */
+} /* getRealDirName */
 
 const char *PHYSFS_getRealDir(const char *fname)
 {
-    DirHandle *dh = getRealDirHandle(fname);
-    return dh ? dh->dirName : NULL;
+    return getRealDirName(fname);
 } /* PHYSFS_getRealDir */
 
 
-static int locateInStringList(const char *str,
-                              char **list,
-                              PHYSFS_uint32 *pos)
-{
-    PHYSFS_uint32 len = *pos;
-    PHYSFS_uint32 half_len;
-    PHYSFS_uint32 lo = 0;
-    PHYSFS_uint32 middle;
-    int cmp;
-
-    while (len > 0)
-    {
-        half_len = len >> 1;
-        middle = lo + half_len;
-        cmp = strcmp(list[middle], str);
-
-        if (cmp == 0)  /* it's in the list already. */
-            return 1;
-        else if (cmp > 0)
-            len = half_len;
-        else
-        {
-            lo = middle + 1;
-            len -= half_len + 1;
-        } /* else */
-    } /* while */
-
-    *pos = lo;
-    return 0;
-} /* locateInStringList */
-
-
 static PHYSFS_EnumerateCallbackResult enumFilesCallback(void *data,
                                         const char *origdir, const char *str)
 {
-    PHYSFS_uint32 pos;
-    void *ptr;
-    char *newstr;
     EnumStringListCallbackData *pecd = (EnumStringListCallbackData *) data;
 
-    /*
-     * See if file is in the list already, and if not, insert it in there
-     *  alphabetically...
-     */
-    pos = pecd->size;
-    if (locateInStringList(str, pecd->list, &pos))
-        return PHYSFS_ENUM_OK;  /* already in the list, but keep going. */
-
-    ptr = allocator.Realloc(pecd->list, (pecd->size + 2) * sizeof (char *));
-    newstr = (char *) allocator.Malloc(strlen(str) + 1);
-    if (ptr != NULL)
-        pecd->list = (char **) ptr;
-
-    if ((ptr == NULL) || (newstr == NULL))
+    /* duplicates (the same name in several archives) are dropped here. */
+    if (!addToStringList(pecd, str, 1))
     {
-        if (newstr)
-            allocator.Free(newstr);
-
         pecd->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
         return PHYSFS_ENUM_ERROR;  /* better luck next time. */
     } /* if */
 
-    strcpy(newstr, str);
-
-    if (pos != pecd->size)
-    {
-        memmove(&pecd->list[pos+1], &pecd->list[pos],
-                 sizeof (char *) * ((pecd->size) - pos));
-    } /* if */
-
-    pecd->list[pos] = newstr;
-    pecd->size++;
-
     return PHYSFS_ENUM_OK;
 } /* enumFilesCallback */
 
@@ -2440,21 +4482,15 @@ char **PHYSFS_enumerateFiles(const char *path)
 {
     EnumStringListCallbackData ecd;
     memset(&ecd, '\0', sizeof (ecd));
-    ecd.list = (char **) allocator.Malloc(sizeof (char *));
-    BAIL_IF(!ecd.list, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
     if (!PHYSFS_enumerate(path, enumFilesCallback, &ecd))
     {
         const PHYSFS_ErrorCode errcode = currentErrorCode();
-        PHYSFS_uint32 i;
-        for (i = 0; i < ecd.size; i++)
-            allocator.Free(ecd.list[i]);
-        allocator.Free(ecd.list);
+        freeStringListData(&ecd);
         BAIL_IF(errcode == PHYSFS_ERR_APP_CALLBACK, ecd.errcode, NULL);
         return NULL;
     } /* if */
 
-    ecd.list[ecd.size] = NULL;
-    return ecd.list;
+    return finishStringList(&ecd, 1);  /* sorted, like it always was. */
 } /* PHYSFS_enumerateFiles */
 
 
@@ -2488,6 +4524,29 @@ static PHYSFS_EnumerateCallbackResult enumerateFromMountPoint(DirHandle *i,
 } /* enumerateFromMountPoint */
 
 
+/*
+ * Lookups never hold an archive's lock while the application's callback
+ *  runs, since the callback might go do lookups in other archives.
+ */
+typedef struct UnlockedCallbackData
+{
+    PHYSFS_EnumerateCallback callback;
+    void *callbackData;
+    DirHandle *dirhandle;
+} UnlockedCallbackData;
+
+static PHYSFS_EnumerateCallbackResult enumCallbackUnlocked(void *_data,
+                                    const char *origdir, const char *fname)
+{
+    UnlockedCallbackData *data = (UnlockedCallbackData *) _data;
+    PHYSFS_EnumerateCallbackResult retval;
+    __PHYSFS_platformReleaseMutex(data->dirhandle->lock);
+    retval = data->callback(data->callbackData, origdir, fname);
+    __PHYSFS_platformGrabMutex(data->dirhandle->lock);
+    return retval;
+} /* enumCallbackUnlocked */
+
+
 typedef struct SymlinkFilterData
 {
     PHYSFS_EnumerateCallback callback;
@@ -2542,6 +4601,7 @@ static PHYSFS_EnumerateCallbackResult enumCallbackFilterSymLinks(void *_data,
 int PHYSFS_enumerate(const char *_fn, PHYSFS_EnumerateCallback cb, void *data)
 {
     PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    SearchPathSnapshot *snap;
     size_t len;
     char *allocated_fname;
     char *fname;
@@ -2549,46 +4609,57 @@ int PHYSFS_enumerate(const char *_fn, PHYSFS_EnumerateCallback cb, void *data)
     BAIL_IF(!_fn, PHYSFS_ERR_INVALID_ARGUMENT, 0);
     BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    snap = grabSearchPath();
+    BAIL_IF_ERRPASS(!snap, 0);
 
-    len = strlen(_fn) + longest_root + 2;
+    len = strlen(_fn) + snap->longest_root + 2;
     allocated_fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
-    fname = allocated_fname + longest_root + 1;
+    if (!allocated_fname)
+    {
+        releaseSearchPath(snap);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+    fname = allocated_fname + snap->longest_root + 1;
     if (!sanitizePlatformIndependentPath(_fn, fname))
         retval = PHYSFS_ENUM_STOP;
     else
     {
-        DirHandle *i;
+        size_t idx;
         SymlinkFilterData filterdata;
+        UnlockedCallbackData unlockdata;
+
+        memset(&unlockdata, '\0', sizeof (unlockdata));
+        unlockdata.callback = cb;
+        unlockdata.callbackData = data;
 
         if (!allowSymLinks)
         {
             memset(&filterdata, '\0', sizeof (filterdata));
-            filterdata.callback = cb;
-            filterdata.callbackData = data;
+            filterdata.callback = enumCallbackUnlocked;
+            filterdata.callbackData = &unlockdata;
         } /* if */
 
-        for (i = searchPath; (retval == PHYSFS_ENUM_OK) && i; i = i->next)
+        for (idx = 0; (retval == PHYSFS_ENUM_OK) && (idx < snap->count); idx++)
         {
+            DirHandle *i = snap->dirs[idx];
             char *arcfname = fname;
+            PHYSFS_Stat statbuf;
 
             if (partOfMountPoint(i, arcfname))
-                retval = enumerateFromMountPoint(i, arcfname, cb, _fn, data);
-
-            else if (verifyPath(i, &arcfname, 0))
             {
-                PHYSFS_Stat statbuf;
-                if (!i->funcs->stat(i->opaque, arcfname, &statbuf))
-                {
-                    if (currentErrorCode() == PHYSFS_ERR_NOT_FOUND)
-                        continue;  /* no such dir in this archive, skip it. */
-                } /* if */
+                retval = enumerateFromMountPoint(i, arcfname, cb, _fn, data);
+                continue;
+            } /* if */
 
-                if (statbuf.filetype != PHYSFS_FILETYPE_DIRECTORY)
-                    continue;  /* not a directory in this archive, skip it. */
+            __PHYSFS_platformGrabMutex(i->lock);
 
-                else if ((!allowSymLinks) && (i->funcs->info.supportsSymlinks))
+            /* skip archives where this isn't a directory (or is missing). */
+            if ( (verifySnapshotPath(snap, i, &arcfname)) &&
+                 (i->funcs->stat(i->opaque, arcfname, &statbuf)) &&
+                 (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY) )
+            {
+                unlockdata.dirhandle = i;
+                if ((!allowSymLinks) && (i->funcs->info.supportsSymlinks))
                 {
                     filterdata.dirhandle = i;
                     filterdata.arcfname = arcfname;
@@ -2601,18 +4672,21 @@ int PHYSFS_enumerate(const char *_fn, PHYSFS_EnumerateCallback cb, void *data)
                         if (currentErrorCode() == PHYSFS_ERR_APP_CALLBACK)
                             PHYSFS_setErrorCode(filterdata.errcode);
                     } /* if */
-                } /* else if */
+                } /* if */
                 else
                 {
                     retval = i->funcs->enumerate(i->opaque, arcfname,
-                                                 cb, _fn, data);
+                                                 enumCallbackUnlocked,
+                                                 _fn, &unlockdata);
                 } /* else */
-            } /* else if */
+            } /* if */
+
+            __PHYSFS_platformReleaseMutex(i->lock);
         } /* for */
 
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    releaseSearchPath(snap);
 
     __PHYSFS_smallFree(allocated_fname);
 
@@ -2620,106 +4694,909 @@ int PHYSFS_enumerate(const char *_fn, PHYSFS_EnumerateCallback cb, void *data)
 } /* PHYSFS_enumerate */
 
 
-typedef struct
+/* PHYSFS_enumerateWithStat() passes mount point pieces through here. */
+typedef struct MountPointStatData
 {
-    PHYSFS_EnumFilesCallback callback;
-    void *data;
-} LegacyEnumFilesCallbackData;
+    PHYSFS_EnumerateStatCallback callback;
+    void *callbackData;
+    const SearchPathSnapshot *snap;
+    DirHandle *dirhandle;
+    size_t arcfnamelen;
+} MountPointStatData;
 
-static PHYSFS_EnumerateCallbackResult enumFilesCallbackAlwaysSucceed(void *d,
+static PHYSFS_EnumerateCallbackResult enumMountPointStat(void *_data,
                                     const char *origdir, const char *fname)
 {
-    LegacyEnumFilesCallbackData *cbdata = (LegacyEnumFilesCallbackData *) d;
-    cbdata->callback(cbdata->data, origdir, fname);
-    return PHYSFS_ENUM_OK;
-} /* enumFilesCallbackAlwaysSucceed */
+    MountPointStatData *data = (MountPointStatData *) _data;
+    DirHandle *dh = data->dirhandle;
+    const size_t len = data->arcfnamelen;
+    const char *rest = dh->mountPoint + ((len) ? len + 1 : 0) + strlen(fname);
+    PHYSFS_Stat statbuf;
 
-void PHYSFS_enumerateFilesCallback(const char *fname,
-                                   PHYSFS_EnumFilesCallback callback,
-                                   void *data)
-{
-    LegacyEnumFilesCallbackData cbdata;
-    cbdata.callback = callback;
-    cbdata.data = data;
-    (void) PHYSFS_enumerate(fname, enumFilesCallbackAlwaysSucceed, &cbdata);
-} /* PHYSFS_enumerateFilesCallback */
+    /* same thing PHYSFS_stat() reports for these. */
+    statbuf.filesize = -1;
+    statbuf.modtime = -1;
+    statbuf.createtime = -1;
+    statbuf.accesstime = -1;
+    statbuf.filetype = PHYSFS_FILETYPE_DIRECTORY;
+    statbuf.readonly = 1;
+
+    /* the last piece of the mount point is the archive's root. */
+    assert(*rest == '/');
+    if (rest[1] == '\0')
+    {
+        const size_t rootlen = data->snap->longest_root;
+        const size_t mntpntlen = strlen(dh->mountPoint);
+        char *allocated = (char *) __PHYSFS_smallAlloc(rootlen+mntpntlen+2);
+        char *arcfname;
+        int rc;
+
+        BAIL_IF(!allocated, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+        arcfname = allocated + rootlen + 1;
+        strcpy(arcfname, dh->mountPoint);
+        arcfname[mntpntlen - 1] = '\0';  /* drop the trailing '/'. */
+
+        __PHYSFS_platformGrabMutex(dh->lock);
+        rc = ( (verifySnapshotPath(data->snap, dh, &arcfname)) &&
+               (dh->funcs->stat(dh->opaque, arcfname, &statbuf)) );
+        __PHYSFS_platformReleaseMutex(dh->lock);
+        __PHYSFS_smallFree(allocated);
+        BAIL_IF_ERRPASS(!rc, PHYSFS_ENUM_ERROR);
+    } /* if */
 
+    return data->callback(data->callbackData, origdir, fname, &statbuf);
+} /* enumMountPointStat */
 
-int PHYSFS_exists(const char *fname)
-{
-    return (getRealDirHandle(fname) != NULL);
-} /* PHYSFS_exists */
 
+typedef struct StatEnumData
+{
+    PHYSFS_EnumerateStatCallback callback;
+    void *callbackData;
+    DirHandle *dirhandle;
+    const char *arcfname;
+    int filterSymLinks;
+    int unlock;  /* non-zero to let go of (dirhandle) during (callback). */
+    PHYSFS_ErrorCode errcode;
+} StatEnumData;
 
-PHYSFS_sint64 PHYSFS_getLastModTime(const char *fname)
+/* drops symlinks if needed, and lets go of the archive for the callback. */
+static PHYSFS_EnumerateCallbackResult enumStatCallbackFiltered(void *_data,
+                                    const char *origdir, const char *fname,
+                                    const PHYSFS_Stat *stat)
 {
-    PHYSFS_Stat statbuf;
-    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), -1);
-    return statbuf.modtime;
-} /* PHYSFS_getLastModTime */
+    StatEnumData *data = (StatEnumData *) _data;
+    PHYSFS_EnumerateCallbackResult retval;
 
+    if ((data->filterSymLinks) && (stat->filetype == PHYSFS_FILETYPE_SYMLINK))
+        return PHYSFS_ENUM_OK;
 
-int PHYSFS_isDirectory(const char *fname)
-{
-    PHYSFS_Stat statbuf;
-    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), 0);
-    return (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY);
-} /* PHYSFS_isDirectory */
+    if (data->unlock)
+        __PHYSFS_platformReleaseMutex(data->dirhandle->lock);
+    retval = data->callback(data->callbackData, origdir, fname, stat);
+    if (data->unlock)
+        __PHYSFS_platformGrabMutex(data->dirhandle->lock);
 
+    if (retval == PHYSFS_ENUM_ERROR)
+        data->errcode = PHYSFS_ERR_APP_CALLBACK;
 
-int PHYSFS_isSymbolicLink(const char *fname)
+    return retval;
+} /* enumStatCallbackFiltered */
+
+
+/*
+ * For archivers that can't hand out metadata as they enumerate: stat each
+ *  name in this archive only. That's still a lot less than PHYSFS_stat()
+ *  would do, as it doesn't have to lock and search the whole search path.
+ */
+static PHYSFS_EnumerateCallbackResult enumStatCallbackByName(void *_data,
+                                    const char *origdir, const char *fname)
 {
+    StatEnumData *data = (StatEnumData *) _data;
+    const DirHandle *dh = data->dirhandle;
+    const char *arcfname = data->arcfname;
     PHYSFS_Stat statbuf;
-    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), 0);
-    return (statbuf.filetype == PHYSFS_FILETYPE_SYMLINK);
-} /* PHYSFS_isSymbolicLink */
+    const char *trimmedDir = (*arcfname == '/') ? (arcfname + 1) : arcfname;
+    const size_t slen = strlen(trimmedDir) + strlen(fname) + 2;
+    char *path = (char *) __PHYSFS_smallAlloc(slen);
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
 
+    if (path == NULL)
+    {
+        data->errcode = PHYSFS_ERR_OUT_OF_MEMORY;
+        return PHYSFS_ENUM_ERROR;
+    } /* if */
 
-static PHYSFS_File *doOpenWrite(const char *_fname, const int appending)
-{
-    FileHandle *fh = NULL;
-    DirHandle *h;
-    size_t len;
-    char *fname;
+    snprintf(path, slen, "%s%s%s", trimmedDir, *trimmedDir ? "/" : "", fname);
 
-    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    if (!dh->funcs->stat(dh->opaque, path, &statbuf))
+    {
+        data->errcode = currentErrorCode();
+        retval = PHYSFS_ENUM_ERROR;
+    } /* if */
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    __PHYSFS_smallFree(path);
 
-    h = writeDir;
-    BAIL_IF_MUTEX(!h, PHYSFS_ERR_NO_WRITE_DIR, stateLock, 0);
+    if (retval == PHYSFS_ENUM_OK)
+        retval = enumStatCallbackFiltered(data, origdir, fname, &statbuf);
 
-    len = strlen(_fname) + dirHandleRootLen(h) + 1;
-    fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
+    return retval;
+} /* enumStatCallbackByName */
 
-    if (sanitizePlatformIndependentPathWithRoot(h, _fname, fname))
+
+/*
+ * Enumerate (arcfname) in (data->dirhandle) with metadata, the cheapest way
+ *  that archiver allows. The dirhandle's lock must be held.
+ */
+static PHYSFS_EnumerateCallbackResult enumerateDirHandleWithStat(
+                                    StatEnumData *data, const char *arcfname,
+                                    const char *origdir)
+{
+    DirHandle *i = data->dirhandle;
+    PHYSFS_EnumerateCallbackResult retval;
+
+    data->arcfname = arcfname;
+    data->filterSymLinks = ((!allowSymLinks) && (i->funcs->info.supportsSymlinks));
+    data->errcode = PHYSFS_ERR_OK;
+
+    if ( (i->funcs->enumerate == __PHYSFS_DirTreeEnumerate) &&
+         (((__PHYSFS_DirTree *) i->opaque)->statEntry != NULL) )
     {
-        PHYSFS_Io *io = NULL;
-        char *arcfname = fname;
-        if (verifyPath(h, &arcfname, 0))
-        {
-            const PHYSFS_Archiver *f = h->funcs;
-            if (appending)
-                io = f->openAppend(h->opaque, arcfname);
-            else
-                io = f->openWrite(h->opaque, arcfname);
+        retval = __PHYSFS_DirTreeEnumerateStat(i->opaque, arcfname,
+                                               enumStatCallbackFiltered,
+                                               origdir, data);
+    } /* if */
+    else if (i->funcs == &__PHYSFS_Archiver_DIR)
+    {
+        retval = DIR_enumerateStat(i->opaque, arcfname,
+                                   enumStatCallbackFiltered, origdir, data);
+    } /* else if */
+    else
+    {
+        retval = i->funcs->enumerate(i->opaque, arcfname,
+                                     enumStatCallbackByName, origdir, data);
+    } /* else */
 
-            if (io)
-            {
-                fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
+    if (retval == PHYSFS_ENUM_ERROR)
+    {
+        if ( (currentErrorCode() == PHYSFS_ERR_APP_CALLBACK) &&
+             (data->errcode != PHYSFS_ERR_OK) )
+            PHYSFS_setErrorCode(data->errcode);
+    } /* if */
+
+    return retval;
+} /* enumerateDirHandleWithStat */
+
+
+int PHYSFS_enumerateWithStat(const char *_fn, PHYSFS_EnumerateStatCallback cb,
+                             void *data)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    SearchPathSnapshot *snap;
+    size_t len;
+    char *allocated_fname;
+    char *fname;
+
+    BAIL_IF(!_fn, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    snap = grabSearchPath();
+    BAIL_IF_ERRPASS(!snap, 0);
+
+    len = strlen(_fn) + snap->longest_root + 2;
+    allocated_fname = (char *) __PHYSFS_smallAlloc(len);
+    if (!allocated_fname)
+    {
+        releaseSearchPath(snap);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+    fname = allocated_fname + snap->longest_root + 1;
+    if (!sanitizePlatformIndependentPath(_fn, fname))
+        retval = PHYSFS_ENUM_STOP;
+    else
+    {
+        size_t idx;
+        MountPointStatData mpdata;
+        StatEnumData statdata;
+
+        mpdata.callback = cb;
+        mpdata.callbackData = data;
+        mpdata.snap = snap;
+
+        memset(&statdata, '\0', sizeof (statdata));
+        statdata.callback = cb;
+        statdata.callbackData = data;
+        statdata.unlock = 1;
+
+        for (idx = 0; (retval == PHYSFS_ENUM_OK) && (idx < snap->count); idx++)
+        {
+            DirHandle *i = snap->dirs[idx];
+            char *arcfname = fname;
+            PHYSFS_Stat statbuf;
+
+            if (partOfMountPoint(i, arcfname))
+            {
+                mpdata.dirhandle = i;
+                mpdata.arcfnamelen = strlen(arcfname);
+                retval = enumerateFromMountPoint(i, arcfname,
+                                                 enumMountPointStat,
+                                                 _fn, &mpdata);
+                continue;
+            } /* if */
+
+            __PHYSFS_platformGrabMutex(i->lock);
+
+            /* skip archives where this isn't a directory (or is missing). */
+            if ( (verifySnapshotPath(snap, i, &arcfname)) &&
+                 (i->funcs->stat(i->opaque, arcfname, &statbuf)) &&
+                 (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY) )
+            {
+                statdata.dirhandle = i;
+                retval = enumerateDirHandleWithStat(&statdata, arcfname, _fn);
+            } /* if */
+
+            __PHYSFS_platformReleaseMutex(i->lock);
+        } /* for */
+    } /* else */
+
+    releaseSearchPath(snap);
+
+    __PHYSFS_smallFree(allocated_fname);
+
+    return (retval == PHYSFS_ENUM_ERROR) ? 0 : 1;
+} /* PHYSFS_enumerateWithStat */
+
+
+/*
+ * PHYSFS_enumerateGlob() support.
+ *
+ * The pattern is split into its path elements, and matched against a path
+ *  one element at a time, like a little NFA: the state array has a flag for
+ *  each pattern element the next path element may match, plus a last flag
+ *  that means "everything matched." A "**" element can swallow any number
+ *  of path elements, so once it's reached it stays set, and the element
+ *  after it is reachable too. A directory is only descended into while
+ *  something besides that last flag is still set.
+ */
+#define GLOB_CASE_SENSITIVE 0
+#define GLOB_CASE_USASCII 1  /* only 'A' through 'Z' fold, like DirTrees. */
+#define GLOB_CASE_FOLD 2
+
+typedef struct GlobData
+{
+    char **elements;  /* pattern, split at each '/'. */
+    size_t count;  /* number of (elements); state arrays are count+1. */
+    PHYSFS_EnumerateCallback callback;
+    void *callbackData;
+    size_t patternlen;  /* strlen() of the whole (sanitized) pattern. */
+    SearchPathSnapshot *snap;
+    DirHandle *dirhandle;  /* archive being walked. */
+    int locked;  /* non-zero if we hold (dirhandle)'s lock right now. */
+    int caseMode;  /* GLOB_CASE_* for path elements inside (dirhandle). */
+    PHYSFS_ErrorCode errcode;  /* first thing that went wrong, if any. */
+} GlobData;
+
+typedef struct GlobLevel
+{
+    GlobData *glob;
+    const unsigned char *states;  /* matching is up to this directory. */
+    const char *arcdir;  /* this directory, in archive notation. */
+} GlobLevel;
+
+static PHYSFS_EnumerateCallbackResult globWalkDirHandle(GlobData *g,
+                                    const char *arcdir, const char *origdir,
+                                    const unsigned char *states);
+
+
+static inline int isGlobStar(const char *element)
+{
+    return ((element[0] == '*') && (element[1] == '*') && (element[2] == '\0'));
+} /* isGlobStar */
+
+
+static inline int hasGlobWildcard(const char *element)
+{
+    return ((strchr(element, '*') != NULL) || (strchr(element, '?') != NULL));
+} /* hasGlobWildcard */
+
+
+static PHYSFS_EnumerateCallbackResult globFail(GlobData *g,
+                                               const PHYSFS_ErrorCode err)
+{
+    if (g->errcode == PHYSFS_ERR_OK)
+        g->errcode = err;
+    return PHYSFS_ENUM_ERROR;
+} /* globFail */
+
+
+static PHYSFS_uint32 globNextChar(const char **_str, const int caseMode)
+{
+    if (caseMode == GLOB_CASE_USASCII)
+    {
+        const PHYSFS_uint32 ch = (PHYSFS_uint32) *((const PHYSFS_uint8 *) *_str);
+        if (ch != 0)
+            (*_str)++;
+        return ((ch >= 'A') && (ch <= 'Z')) ? (ch - ('A' - 'a')) : ch;
+    } /* if */
+    else
+    {
+        PHYSFS_uint32 cp = __PHYSFS_utf8codepoint(_str);
+        if (caseMode == GLOB_CASE_FOLD)
+        {
+            /* things that fold to several codepoints are left alone. */
+            PHYSFS_uint32 folded[3];
+            if (PHYSFS_caseFold(cp, folded) == 1)
+                cp = folded[0];
+        } /* if */
+        return cp;
+    } /* else */
+} /* globNextChar */
+
+
+/* Match one path element against one pattern element ('*' and '?'). */
+static int globMatchElement(const char *pat, const char *str,
+                            const int caseMode)
+{
+    const char *starpat = NULL;  /* just past the last '*' in (pat). */
+    const char *starstr = NULL;  /* where that '*' stopped eating (str). */
+
+    while (1)
+    {
+        const char *p = pat;
+        const char *s = str;
+        PHYSFS_uint32 pch, sch;
+
+        if (*pat == '*')
+        {
+            while (*pat == '*')
+                pat++;
+            starpat = pat;
+            starstr = str;
+            continue;
+        } /* if */
+
+        pch = globNextChar(&p, caseMode);
+        sch = globNextChar(&s, caseMode);
+        if ((pch == 0) && (sch == 0))
+            return 1;
+        else if ((sch != 0) && ((pch == sch) || (*pat == '?')))
+        {
+            pat = p;
+            str = s;
+            continue;
+        } /* else if */
+
+        /* mismatch: let the last '*' eat one more char and try again. */
+        if ((starpat == NULL) || (*starstr == '\0'))
+            return 0;
+        globNextChar(&starstr, caseMode);
+        pat = starpat;
+        str = starstr;
+    } /* while */
+
+    return 0;  /* shouldn't hit this. */
+} /* globMatchElement */
+
+
+/* Any "**" that's reachable lets the element after it be reached, too. */
+static void globClosure(const GlobData *g, unsigned char *states)
+{
+    size_t i;
+    for (i = 0; i < g->count; i++)
+    {
+        if ((states[i]) && (isGlobStar(g->elements[i])))
+            states[i + 1] = 1;
+    } /* for */
+} /* globClosure */
+
+
+/* Feed path element (name) to (from), putting the new states in (to). */
+static void globStep(const GlobData *g, const unsigned char *from,
+                     unsigned char *to, const char *name, const int caseMode)
+{
+    size_t i;
+    memset(to, '\0', g->count + 1);
+    for (i = 0; i < g->count; i++)
+    {
+        if (!from[i])
+            continue;
+        else if (isGlobStar(g->elements[i]))
+            to[i] = 1;
+        else if (globMatchElement(g->elements[i], name, caseMode))
+            to[i + 1] = 1;
+    } /* for */
+    globClosure(g, to);
+} /* globStep */
+
+
+/* non-zero if something deeper than the current path could still match. */
+static int globAlive(const GlobData *g, const unsigned char *states)
+{
+    size_t i;
+    for (i = 0; i < g->count; i++)
+    {
+        if (states[i])
+            return 1;
+    } /* for */
+    return 0;
+} /* globAlive */
+
+
+static char *globJoin(char *buf, const char *dir, const char *name,
+                      const size_t buflen)
+{
+    if (buf != NULL)
+        snprintf(buf, buflen, "%s%s%s", dir, *dir ? "/" : "", name);
+    return buf;
+} /* globJoin */
+
+#define GLOB_JOIN(buf, dir, name) { \
+    const size_t len = strlen(dir) + strlen(name) + 2; \
+    buf = globJoin((char *) __PHYSFS_smallAlloc(len), dir, name, len); \
+}
+
+
+static PHYSFS_EnumerateCallbackResult globReport(GlobData *g,
+                                    const char *origdir, const char *fname)
+{
+    PHYSFS_EnumerateCallbackResult retval;
+
+    if (g->locked)
+        __PHYSFS_platformReleaseMutex(g->dirhandle->lock);
+    retval = g->callback(g->callbackData, origdir, fname);
+    if (g->locked)
+        __PHYSFS_platformGrabMutex(g->dirhandle->lock);
+
+    if (retval == PHYSFS_ENUM_ERROR)
+        globFail(g, PHYSFS_ERR_APP_CALLBACK);
+
+    return retval;
+} /* globReport */
+
+
+/*
+ * DirTree archivers are walked straight through their entries: no path
+ *  strings, no hash lookups, and no stat calls except to drop symlinks.
+ */
+static PHYSFS_EnumerateCallbackResult globDirTree(GlobData *g,
+                                    __PHYSFS_DirTreeEntry *dir,
+                                    const char *origdir,
+                                    const unsigned char *states)
+{
+    __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) g->dirhandle->opaque;
+    const int filterSymLinks = ( (!allowSymLinks) && (tree->statEntry) &&
+                                 (g->dirhandle->funcs->info.supportsSymlinks) );
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    unsigned char *next = (unsigned char *) __PHYSFS_smallAlloc(g->count + 1);
+    __PHYSFS_DirTreeEntry *entry;
+
+    if (!next)
+        return globFail(g, PHYSFS_ERR_OUT_OF_MEMORY);
+    else if (!__PHYSFS_DirTreeLoad(tree, dir))
+    {
+        __PHYSFS_smallFree(next);
+        return globFail(g, currentErrorCode());
+    } /* else if */
+
+    for (entry = dir->children; entry && (retval == PHYSFS_ENUM_OK); entry = entry->sibling)
+    {
+        globStep(g, states, next, entry->name, g->caseMode);
+
+        if (next[g->count])
+        {
+            PHYSFS_Stat statbuf;
+            if (!filterSymLinks)
+                retval = globReport(g, origdir, entry->name);
+            else if (!tree->statEntry(tree, entry, &statbuf))
+                retval = globFail(g, currentErrorCode());
+            else if (statbuf.filetype != PHYSFS_FILETYPE_SYMLINK)
+                retval = globReport(g, origdir, entry->name);
+        } /* if */
+
+        if ((retval == PHYSFS_ENUM_OK) && (entry->isdir) && (globAlive(g, next)))
+        {
+            char *subdir;
+            GLOB_JOIN(subdir, origdir, entry->name);
+            if (!subdir)
+                retval = globFail(g, PHYSFS_ERR_OUT_OF_MEMORY);
+            else
+            {
+                retval = globDirTree(g, entry, subdir, next);
+                __PHYSFS_smallFree(subdir);
+            } /* else */
+        } /* if */
+    } /* for */
+
+    __PHYSFS_smallFree(next);
+    return retval;
+} /* globDirTree */
+
+
+static PHYSFS_EnumerateCallbackResult globStatCallback(void *_data,
+                                    const char *origdir, const char *fname,
+                                    const PHYSFS_Stat *stat)
+{
+    GlobLevel *level = (GlobLevel *) _data;
+    GlobData *g = level->glob;
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    unsigned char *next = (unsigned char *) __PHYSFS_smallAlloc(g->count + 1);
+
+    if (!next)
+        return globFail(g, PHYSFS_ERR_OUT_OF_MEMORY);
+
+    globStep(g, level->states, next, fname, g->caseMode);
+
+    if (next[g->count])
+        retval = globReport(g, origdir, fname);
+
+    if ( (retval == PHYSFS_ENUM_OK) && (globAlive(g, next)) &&
+         (stat->filetype == PHYSFS_FILETYPE_DIRECTORY) )
+    {
+        char *arcdir;
+        char *subdir;
+        GLOB_JOIN(arcdir, level->arcdir, fname);
+        GLOB_JOIN(subdir, origdir, fname);
+        if ((!arcdir) || (!subdir))
+            retval = globFail(g, PHYSFS_ERR_OUT_OF_MEMORY);
+        else
+            retval = globWalkDirHandle(g, arcdir, subdir, next);
+        __PHYSFS_smallFree(subdir);
+        __PHYSFS_smallFree(arcdir);
+    } /* if */
+
+    __PHYSFS_smallFree(next);
+    return retval;
+} /* globStatCallback */
+
+
+/* Everything else gets walked a directory at a time, with its stat data. */
+static PHYSFS_EnumerateCallbackResult globWalkDirHandle(GlobData *g,
+                                    const char *arcdir, const char *origdir,
+                                    const unsigned char *states)
+{
+    PHYSFS_EnumerateCallbackResult retval;
+    StatEnumData statdata;
+    GlobLevel level;
+
+    level.glob = g;
+    level.states = states;
+    level.arcdir = arcdir;
+
+    memset(&statdata, '\0', sizeof (statdata));
+    statdata.callback = globStatCallback;
+    statdata.callbackData = &level;
+    statdata.dirhandle = g->dirhandle;
+
+    retval = enumerateDirHandleWithStat(&statdata, arcdir, origdir);
+    if ((retval == PHYSFS_ENUM_ERROR) && (g->errcode == PHYSFS_ERR_OK))
+        g->errcode = currentErrorCode();
+    return retval;
+} /* globWalkDirHandle */
+
+
+/*
+ * Match (g)'s pattern against one archive in the search path, starting with
+ *  its mount point and then the literal directories at the front of the
+ *  pattern, so only the part of the archive that can match gets looked at.
+ *  (cur) and (next) are scratch state arrays.
+ */
+static PHYSFS_EnumerateCallbackResult globDirHandle(GlobData *g,
+                                    DirHandle *dh, unsigned char *cur,
+                                    unsigned char *next)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    const size_t mntpntlen = dh->mountPoint ? strlen(dh->mountPoint) : 0;
+    const size_t rootlen = g->snap->longest_root;
+    const size_t pathlen = mntpntlen + g->patternlen + 2;
+    char *allocated = (char *) __PHYSFS_smallAlloc(rootlen + pathlen + 1);
+    char *origdir = (char *) __PHYSFS_smallAlloc(pathlen);
+    char *path;
+    char *arcfname;
+    size_t i;
+
+    if ((!allocated) || (!origdir))
+    {
+        __PHYSFS_smallFree(origdir);
+        __PHYSFS_smallFree(allocated);
+        return globFail(g, PHYSFS_ERR_OUT_OF_MEMORY);
+    } /* if */
+
+    path = allocated + rootlen + 1;
+    *path = '\0';
+
+    memset(cur, '\0', g->count + 1);
+    cur[0] = 1;
+    globClosure(g, cur);
+
+    g->dirhandle = dh;
+    g->locked = 0;
+    g->caseMode = GLOB_CASE_SENSITIVE;
+
+    /* match the mount point's elements first; they might match, too. */
+    if (dh->mountPoint != NULL)
+    {
+        char *element;
+        strcpy(origdir, dh->mountPoint);
+        for (element = origdir; *element; )
+        {
+            char *sep = strchr(element, '/');
+            unsigned char *tmp;
+
+            assert(sep != NULL);  /* mount points always end with '/'. */
+            *sep = '\0';
+
+            globStep(g, cur, next, element, GLOB_CASE_SENSITIVE);
+            if (next[g->count])
+                retval = globReport(g, path, element);
+
+            tmp = cur; cur = next; next = tmp;
+            if ((retval != PHYSFS_ENUM_OK) || (!globAlive(g, cur)))
+                break;
+
+            if (*path)
+                strcat(path, "/");
+            strcat(path, element);
+            element = sep + 1;
+        } /* for */
+    } /* if */
+
+    /* then go straight to the deepest directory the pattern names outright. */
+    while ((retval == PHYSFS_ENUM_OK) && (globAlive(g, cur)))
+    {
+        size_t state = g->count;
+        size_t matching = 0;
+        for (i = 0; i < g->count; i++)
+        {
+            if (cur[i])
+            {
+                state = i;
+                matching++;
+            } /* if */
+        } /* for */
+
+        if ((matching != 1) || (state == g->count - 1))
+            break;
+        else if (hasGlobWildcard(g->elements[state]))
+            break;
+
+        if (*path)
+            strcat(path, "/");
+        strcat(path, g->elements[state]);
+        memset(cur, '\0', g->count + 1);
+        cur[state + 1] = 1;
+        globClosure(g, cur);
+    } /* while */
+
+    if ((retval != PHYSFS_ENUM_OK) || (!globAlive(g, cur)))
+    {
+        __PHYSFS_smallFree(origdir);
+        __PHYSFS_smallFree(allocated);
+        return retval;
+    } /* if */
+
+    /* verifySnapshotPath() writes over (path), so keep a copy to report. */
+    strcpy(origdir, path);
+
+    __PHYSFS_platformGrabMutex(dh->lock);
+    g->locked = 1;
+
+    arcfname = path;
+    if (verifySnapshotPath(g->snap, dh, &arcfname))
+    {
+        PHYSFS_Stat statbuf;
+
+        if (dh->funcs->enumerate == __PHYSFS_DirTreeEnumerate)
+        {
+            __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) dh->opaque;
+            __PHYSFS_DirTreeEntry *entry;
+            entry = (__PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeFind(tree, arcfname);
+            if (!tree->case_sensitive)
+                g->caseMode = tree->only_usascii ? GLOB_CASE_USASCII : GLOB_CASE_FOLD;
+            if ((entry != NULL) && (entry->isdir))
+                retval = globDirTree(g, entry, origdir, cur);
+        } /* if */
+
+        else if ( (dh->funcs->stat(dh->opaque, arcfname, &statbuf)) &&
+                  (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY) )
+        {
+            #if defined(PHYSFS_PLATFORM_WINDOWS) || defined(PHYSFS_PLATFORM_OS2)
+            if (dh->funcs == &__PHYSFS_Archiver_DIR)
+                g->caseMode = GLOB_CASE_FOLD;  /* these filesystems ignore case. */
+            #else
+            if ((dh->funcs == &__PHYSFS_Archiver_DIR) && (DIR_isCaseInsensitive(dh->opaque)))
+                g->caseMode = GLOB_CASE_FOLD;
+            #endif
+            retval = globWalkDirHandle(g, arcfname, origdir, cur);
+        } /* else if */
+    } /* if */
+
+    g->locked = 0;
+    __PHYSFS_platformReleaseMutex(dh->lock);
+
+    __PHYSFS_smallFree(origdir);
+    __PHYSFS_smallFree(allocated);
+    return retval;
+} /* globDirHandle */
+
+
+int PHYSFS_enumerateGlob(const char *pattern, PHYSFS_EnumerateCallback cb,
+                         void *data)
+{
+    static char globAny[2] = { '*', '\0' };
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    char *buf = NULL;
+    unsigned char *states = NULL;
+    GlobData g;
+    size_t i;
+    char *ptr;
+
+    BAIL_IF(!pattern, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!cb, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    memset(&g, '\0', sizeof (g));
+    g.callback = cb;
+    g.callbackData = data;
+
+    buf = (char *) allocator.Malloc(strlen(pattern) + 1);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    GOTO_IF_ERRPASS(!sanitizePlatformIndependentPath(pattern, buf), failed);
+
+    g.patternlen = strlen(buf);
+    if (*buf == '\0')  /* nothing can match an empty pattern. */
+    {
+        allocator.Free(buf);
+        return 1;
+    } /* if */
+
+    g.count = 1;
+    for (ptr = buf; *ptr; ptr++)
+    {
+        if (*ptr == '/')
+            g.count++;
+    } /* for */
+
+    /* one extra, in case we need to turn a trailing "**" into "**" + "*". */
+    g.elements = (char **) allocator.Malloc(sizeof (char *) * (g.count + 1));
+    GOTO_IF(!g.elements, PHYSFS_ERR_OUT_OF_MEMORY, failed);
+
+    ptr = buf;
+    for (i = 0; i < g.count; i++)
+    {
+        char *sep = strchr(ptr, '/');
+        g.elements[i] = ptr;
+        if (sep)
+        {
+            *sep = '\0';
+            ptr = sep + 1;
+        } /* if */
+    } /* for */
+
+    /* a trailing "**" means everything under there, not the dir itself. */
+    if (isGlobStar(g.elements[g.count - 1]))
+        g.elements[g.count++] = globAny;
+
+    states = (unsigned char *) allocator.Malloc((g.count + 1) * 2);
+    GOTO_IF(!states, PHYSFS_ERR_OUT_OF_MEMORY, failed);
+
+    g.snap = grabSearchPath();
+    GOTO_IF_ERRPASS(!g.snap, failed);
+
+    for (i = 0; (retval == PHYSFS_ENUM_OK) && (i < g.snap->count); i++)
+        retval = globDirHandle(&g, g.snap->dirs[i], states, states + g.count + 1);
+
+    releaseSearchPath(g.snap);
+
+    allocator.Free(states);
+    allocator.Free(g.elements);
+    allocator.Free(buf);
+
+    BAIL_IF(retval == PHYSFS_ENUM_ERROR, g.errcode, 0);
+    return 1;
+
+failed:
+    allocator.Free(states);
+    allocator.Free(g.elements);
+    allocator.Free(buf);
+    return 0;
+} /* PHYSFS_enumerateGlob */
+
+
+typedef struct
+{
+    PHYSFS_EnumFilesCallback callback;
+    void *data;
+} LegacyEnumFilesCallbackData;
+
+static PHYSFS_EnumerateCallbackResult enumFilesCallbackAlwaysSucceed(void *d,
+                                    const char *origdir, const char *fname)
+{
+    LegacyEnumFilesCallbackData *cbdata = (LegacyEnumFilesCallbackData *) d;
+    cbdata->callback(cbdata->data, origdir, fname);
+    return PHYSFS_ENUM_OK;
+} /* enumFilesCallbackAlwaysSucceed */
+
+void PHYSFS_enumerateFilesCallback(const char *fname,
+                                   PHYSFS_EnumFilesCallback callback,
+                                   void *data)
+{
+    LegacyEnumFilesCallbackData cbdata;
+    cbdata.callback = callback;
+    cbdata.data = data;
+    (void) PHYSFS_enumerate(fname, enumFilesCallbackAlwaysSucceed, &cbdata);
+} /* PHYSFS_enumerateFilesCallback */
+
+
+int PHYSFS_exists(const char *fname)
+{
+    return (getRealDirName(fname) != NULL);
+} /* PHYSFS_exists */
+
+
+PHYSFS_sint64 PHYSFS_getLastModTime(const char *fname)
+{
+    PHYSFS_Stat statbuf;
+    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), -1);
+    return statbuf.modtime;
+} /* PHYSFS_getLastModTime */
+
+
+int PHYSFS_isDirectory(const char *fname)
+{
+    PHYSFS_Stat statbuf;
+    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), 0);
+    return (statbuf.filetype == PHYSFS_FILETYPE_DIRECTORY);
+} /* PHYSFS_isDirectory */
+
+
+int PHYSFS_isSymbolicLink(const char *fname)
+{
+    PHYSFS_Stat statbuf;
+    BAIL_IF_ERRPASS(!PHYSFS_stat(fname, &statbuf), 0);
+    return (statbuf.filetype == PHYSFS_FILETYPE_SYMLINK);
+} /* PHYSFS_isSymbolicLink */
+
+
+static PHYSFS_File *doOpenWrite(const char *_fname, const int appending)
+{
+    FileHandle *fh = NULL;
+    DirHandle *h;
+    size_t len;
+    char *fname;
+
+    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    grabStateLock();
+
+    h = writeDir;
+    BAIL_IF_MUTEX(!h, PHYSFS_ERR_NO_WRITE_DIR, stateLock, 0);
+
+    len = strlen(_fname) + dirHandleRootLen(h) + 1;
+    fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF_MUTEX(!fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
+
+    if (sanitizePlatformIndependentPathWithRoot(h, _fname, fname))
+    {
+        PHYSFS_Io *io = NULL;
+        char *arcfname = fname;
+        if (verifyPath(h, &arcfname, 0))
+        {
+            const PHYSFS_Archiver *f = h->funcs;
+            if (appending)
+                io = f->openAppend(h->opaque, arcfname);
+            else
+                io = f->openWrite(h->opaque, arcfname);
+
+            if (io)
+            {
+                fh = allocFileHandle();
                 if (fh == NULL)
-                {
                     io->destroy(io);
-                    PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
-                } /* if */
                 else
                 {
-                    memset(fh, '\0', sizeof (FileHandle));
                     fh->io = io;
                     fh->dirHandle = h;
-                    fh->next = openWriteList;
-                    openWriteList = fh;
+                    (void) __PHYSFS_ATOMIC_INCR(&h->refcount);
+                    linkFileHandle(fh, &openWriteList);
+                    refreshDirectoryCaches();
                 } /* else */
             } /* if */
         } /* if */
@@ -2727,221 +5604,1621 @@ static PHYSFS_File *doOpenWrite(const char *_fname, const int appending)
 
     __PHYSFS_platformReleaseMutex(stateLock);
 
-    __PHYSFS_smallFree(fname);
-    return ((PHYSFS_File *) fh);
-} /* doOpenWrite */
+    __PHYSFS_smallFree(fname);
+    return ((PHYSFS_File *) fh);
+} /* doOpenWrite */
+
+
+static void traceOpen(const PHYSFS_TraceEventType type, const char *fname,
+                      PHYSFS_File *file, const PHYSFS_uint64 started)
+{
+    PHYSFS_TraceEvent event;
+    initTraceEvent(&event, type, (const FileHandle *) file);
+    event.filename = fname;
+    event.result = (file != NULL);
+    event.nanoseconds = __PHYSFS_platformNanoseconds() - started;
+    emitTraceEvent(&event);
+} /* traceOpen */
+
+
+static PHYSFS_File *doTracedOpenWrite(const char *fname, const int appending)
+{
+    const PHYSFS_uint64 started = __PHYSFS_platformNanoseconds();
+    PHYSFS_File *retval = doOpenWrite(fname, appending);
+    traceOpen(appending ? PHYSFS_TRACE_OPEN_APPEND : PHYSFS_TRACE_OPEN_WRITE,
+              fname, retval, started);
+    return retval;
+} /* doTracedOpenWrite */
+
+
+PHYSFS_File *PHYSFS_openWrite(const char *filename)
+{
+    if (traceCallback != NULL)
+        return doTracedOpenWrite(filename, 0);
+    return doOpenWrite(filename, 0);
+} /* PHYSFS_openWrite */
+
+
+PHYSFS_File *PHYSFS_openAppend(const char *filename)
+{
+    if (traceCallback != NULL)
+        return doTracedOpenWrite(filename, 1);
+    return doOpenWrite(filename, 1);
+} /* PHYSFS_openAppend */
+
+
+/* (*_dh) is set to the DirHandle (io) came from; it isn't referenced. */
+static PHYSFS_Io *openReadInSnapshot(SearchPathSnapshot *snap,
+                                     const char *_fname, DirHandle **_dh)
+{
+    PHYSFS_Io *io = NULL;
+    char *allocated_fname;
+    char *fname;
+    size_t len;
+
+    BAIL_IF(snap->count == 0, PHYSFS_ERR_NOT_FOUND, NULL);
+
+    len = strlen(_fname) + snap->longest_root + 2;
+    allocated_fname = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    fname = allocated_fname + snap->longest_root + 1;
+
+    if (sanitizePlatformIndependentPath(_fname, fname))
+    {
+        const size_t first = searchPathFirstCandidate(snap, fname);
+        DirHandle *i = NULL;
+        size_t idx;
+
+        for (idx = 0; (idx < snap->count) && (!io); idx++)
+        {
+            char *arcfname = fname;
+            i = snap->dirs[idx];
+            if (!searchPathCandidate(snap, idx, first))
+            {
+                /* we know it isn't here, so don't bother the archiver. */
+                PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+                continue;
+            } /* if */
+
+            __PHYSFS_platformGrabMutex(i->lock);
+            if (verifySnapshotPath(snap, i, &arcfname))
+            {
+                io = i->funcs->openRead(i->opaque, arcfname);
+                if (!io)
+                    __PHYSFS_STAT_ADD(&i->stats, failedLookups, 1);
+            } /* if */
+            __PHYSFS_platformReleaseMutex(i->lock);
+        } /* for */
+
+        if (io)
+        {
+            #if PHYSFS_SUPPORTS_STATS
+            attachIoStats(io, &i->stats);  /* files in a mounted directory. */
+            #endif
+            *_dh = i;
+        } /* if */
+    } /* if */
+
+    __PHYSFS_smallFree(allocated_fname);
+    return io;
+} /* openReadInSnapshot */
+
+
+static PHYSFS_File *doOpenRead(const char *_fname)
+{
+    SearchPathSnapshot *snap;
+    FileHandle *fh = NULL;
+    DirHandle *i = NULL;
+    PHYSFS_Io *io;
+
+    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    snap = grabSearchPath();
+    BAIL_IF_ERRPASS(!snap, 0);
+
+    io = openReadInSnapshot(snap, _fname, &i);
+    if (io)
+    {
+        fh = allocFileHandle();
+        if (fh == NULL)
+            io->destroy(io);
+        else
+        {
+            fh->io = io;
+            fh->forReading = 1;
+            fh->dirHandle = i;
+            (void) __PHYSFS_ATOMIC_INCR(&i->refcount);
+            __PHYSFS_STAT_ADD(&i->stats, opens, 1);
+            grabStateLock();
+            linkFileHandle(fh, &openReadList);
+            __PHYSFS_platformReleaseMutex(stateLock);
+        } /* else */
+    } /* if */
+
+    releaseSearchPath(snap);
+    return ((PHYSFS_File *) fh);
+} /* doOpenRead */
+
+
+PHYSFS_File *PHYSFS_openRead(const char *filename)
+{
+    PHYSFS_uint64 started;
+    PHYSFS_File *retval;
+
+    if (traceCallback == NULL)
+        return doOpenRead(filename);
+
+    started = __PHYSFS_platformNanoseconds();
+    retval = doOpenRead(filename);
+    traceOpen(PHYSFS_TRACE_OPEN_READ, filename, retval, started);
+    return retval;
+} /* PHYSFS_openRead */
+
+
+static int closeWriteBehind(FileHandle *fh);
+
+/*
+ * If (_dh) isn't NULL, it's set to a new reference to the handle's DirHandle,
+ *  even if closing fails, so the caller can still say where the file was.
+ *
+ * MAKE SURE you hold stateLock before calling this!
+ */
+static int closeFileHandle(FileHandle *handle, DirHandle **_dh)
+{
+    PHYSFS_Io *io = handle->io;
+    PHYSFS_uint8 *tmp = handle->buffer;
+    int retval = 1;
+
+    if (_dh != NULL)
+    {
+        (void) __PHYSFS_ATOMIC_INCR(&handle->dirHandle->refcount);
+        *_dh = handle->dirHandle;
+    } /* if */
+
+    if (handle->writeBehind != NULL)  /* the writer does all this for us. */
+    {
+        /* if a write failed, it's closed anyhow; see PHYSFS_setWriteBehind. */
+        retval = closeWriteBehind(handle);
+        if (handle->writeBehind != NULL)
+            return 0;  /* couldn't queue the buffer; still open. */
+    } /* if */
+
+    else
+    {
+        /* send our buffer to io... */
+        if (!handle->forReading)
+        {
+            if (!PHYSFS_flush((PHYSFS_File *) handle))
+                return 0;
+
+            /* ...then have io send it to the disk... */
+            else if (io->flush && !io->flush(io))
+                return 0;
+        } /* if */
+
+        /* ...then close the underlying file. */
+        io->destroy(io);
+    } /* else */
+
+    if (!handle->forReading)  /* its size and time are different now. */
+        refreshDirectoryCaches();
+
+    if (tmp != NULL)  /* free any associated buffer. */
+        allocator.Free(tmp);
+
+    unlinkFileHandle(handle);
+    releaseDirHandle(handle->dirHandle);
+    freeFileHandle(handle);
+    return retval;
+} /* closeFileHandle */
+
+
+static int doClose(FileHandle *handle, DirHandle **_dh)
+{
+    int rc;
+
+    BAIL_IF(!handle, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    grabStateLock();
+    /* handles that were closed and pooled have no list. */
+    BAIL_IF_MUTEX(!handle->list, PHYSFS_ERR_INVALID_ARGUMENT, stateLock, 0);
+    rc = closeFileHandle(handle, _dh);
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return rc;
+} /* doClose */
+
+
+int PHYSFS_close(PHYSFS_File *_handle)
+{
+    FileHandle *handle = (FileHandle *) _handle;
+    PHYSFS_TraceEvent event;
+    PHYSFS_uint64 started;
+    DirHandle *dh = NULL;
+
+    if (traceCallback == NULL)
+        return doClose(handle, NULL);
+
+    initTraceEvent(&event, PHYSFS_TRACE_CLOSE, NULL);
+    event.file = _handle;
+    started = __PHYSFS_platformNanoseconds();
+    event.result = doClose(handle, &dh);
+    event.nanoseconds = __PHYSFS_platformNanoseconds() - started;
+    if (dh != NULL)  /* not reported for handles that weren't open. */
+    {
+        event.archive = dh->dirName;
+        emitTraceEvent(&event);
+        releaseDirHandle(dh);
+    } /* if */
+    return (int) event.result;
+} /* PHYSFS_close */
+
+
+const void *PHYSFS_mapFile(const char *filename, PHYSFS_uint64 *_len)
+{
+    FileMapping *map = NULL;
+    PHYSFS_File *file = NULL;
+    PHYSFS_uint64 len = 0;
+    void *ptr = NULL;
+
+    BAIL_IF(!_len, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+
+    map = (FileMapping *) allocator.Malloc(sizeof (FileMapping));
+    BAIL_IF(!map, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    file = PHYSFS_openRead(filename);
+    GOTO_IF_ERRPASS(!file, mapFile_failed);
+
+    map->ptr = __PHYSFS_getIoBuffer(((FileHandle *) file)->io, &len);
+    if (map->ptr != NULL)  /* zero-copy; the open file keeps it alive. */
+        map->handle = (FileHandle *) file;
+    else
+    {
+        const PHYSFS_sint64 filelen = PHYSFS_fileLength(file);
+        PHYSFS_sint64 br;
+
+        GOTO_IF_ERRPASS(filelen < 0, mapFile_failed);
+        len = (PHYSFS_uint64) filelen;
+        GOTO_IF(len != (size_t) len, PHYSFS_ERR_OUT_OF_MEMORY, mapFile_failed);
+        ptr = allocator.Malloc((size_t) (len ? len : 1));
+        GOTO_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, mapFile_failed);
+        br = PHYSFS_readBytes(file, ptr, len);
+        GOTO_IF_ERRPASS(br < 0, mapFile_failed);
+        GOTO_IF(((PHYSFS_uint64) br) != len, PHYSFS_ERR_IO, mapFile_failed);
+        PHYSFS_close(file);
+        file = NULL;
+        map->ptr = ptr;
+        map->handle = NULL;
+    } /* else */
+
+    grabStateLock();
+    map->next = fileMappings;
+    fileMappings = map;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    *_len = len;
+    return map->ptr;
+
+mapFile_failed:
+    if (file != NULL)
+        PHYSFS_close(file);
+    if (ptr != NULL)
+        allocator.Free(ptr);
+    allocator.Free(map);
+    return NULL;
+} /* PHYSFS_mapFile */
+
+
+int PHYSFS_unmapFile(const void *ptr)
+{
+    FileMapping *prev = NULL;
+    FileMapping *map;
+
+    BAIL_IF(!ptr, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    grabStateLock();
+    for (map = fileMappings; map != NULL; map = map->next)
+    {
+        if (map->ptr == ptr)
+        {
+            if (prev == NULL)
+                fileMappings = map->next;
+            else
+                prev->next = map->next;
+            break;
+        } /* if */
+        prev = map;
+    } /* for */
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    BAIL_IF(!map, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    if (map->handle != NULL)
+        PHYSFS_close((PHYSFS_File *) map->handle);  /* can't fail; read-only. */
+    else
+        allocator.Free((void *) map->ptr);
+
+    allocator.Free(map);
+    return 1;
+} /* PHYSFS_unmapFile */
+
+
+/*
+ * Adaptive buffers (see PHYSFS_setAdaptiveBuffer()) double each time the
+ *  whole buffer was read straight through, and PHYSFS_seek() halves them
+ *  when it has to throw the buffer away. The allocation never shrinks, so
+ *  flipping between the two is cheap. Only call this while the buffer is
+ *  empty!
+ */
+static void adaptBuffer(FileHandle *fh)
+{
+    if (fh->bufseeked)
+        fh->bufseeked = 0;  /* random access; the seek already shrank it. */
+    else if (fh->bufsize < fh->bufmax)
+    {
+        const size_t newsize = (fh->bufsize > (fh->bufmax / 2)) ?
+                                fh->bufmax : (fh->bufsize * 2);
+        if (newsize > fh->bufcap)
+        {
+            PHYSFS_uint8 *newbuf;
+            newbuf = (PHYSFS_uint8 *) allocator.Realloc(fh->buffer, newsize);
+            if (!newbuf)
+                return;  /* oh well, keep what we've got. */
+            fh->buffer = newbuf;
+            fh->bufcap = newsize;
+        } /* if */
+        fh->bufsize = newsize;
+    } /* else if */
+} /* adaptBuffer */
+
+
+static PHYSFS_sint64 doBufferedRead(FileHandle *fh, void *_buffer, size_t len)
+{
+    PHYSFS_uint8 *buffer = (PHYSFS_uint8 *) _buffer;
+    PHYSFS_sint64 retval = 0;
+
+    while (len > 0)
+    {
+        const size_t avail = fh->buffill - fh->bufpos;
+        if (avail > 0)  /* data available in the buffer. */
+        {
+            const size_t cpy = (len < avail) ? len : avail;
+            memcpy(buffer, fh->buffer + fh->bufpos, cpy);
+            assert(len >= cpy);
+            buffer += cpy;
+            len -= cpy;
+            fh->bufpos += cpy;
+            retval += cpy;
+        } /* if */
+
+        else if (len >= fh->bufsize)  /* too big to bother buffering. */
+        {
+            PHYSFS_Io *io = fh->io;
+            const PHYSFS_sint64 rc = io->read(io, buffer, len);
+            fh->buffill = fh->bufpos = 0;  /* so seek doesn't look in there. */
+            if (fh->bufmin)
+                adaptBuffer(fh);  /* this is sequential access, too. */
+            if (rc > 0)
+                retval += rc;
+            else if (retval == 0)  /* report already-read data, or failure. */
+                retval = rc;
+            break;
+        } /* else if */
+
+        else   /* buffer is empty, refill it. */
+        {
+            PHYSFS_Io *io = fh->io;
+            PHYSFS_sint64 rc;
+            if (fh->bufmin)
+                adaptBuffer(fh);
+            rc = io->read(io, fh->buffer, fh->bufsize);
+            __PHYSFS_STAT_ADD(&fh->dirHandle->stats, bufferRefills, 1);
+            fh->bufpos = 0;
+            if (rc > 0)
+                fh->buffill = (size_t) rc;
+            else
+            {
+                fh->buffill = 0;
+                if (retval == 0)  /* report already-read data, or failure. */
+                    retval = rc;
+                break;
+            } /* else */
+        } /* else */
+    } /* while */
+
+    return retval;
+} /* doBufferedRead */
+
+
+PHYSFS_sint64 PHYSFS_read(PHYSFS_File *handle, void *buffer,
+                          PHYSFS_uint32 size, PHYSFS_uint32 count)
+{
+    const PHYSFS_uint64 len = ((PHYSFS_uint64) size) * ((PHYSFS_uint64) count);
+    const PHYSFS_sint64 retval = PHYSFS_readBytes(handle, buffer, len);
+    return ( (retval <= 0) ? retval : (retval / ((PHYSFS_sint64) size)) );
+} /* PHYSFS_read */
+
+
+static PHYSFS_sint64 doReadBytes(FileHandle *fh, void *buffer, size_t len)
+{
+    #if PHYSFS_SUPPORTS_STATS
+    const PHYSFS_sint64 rc = fh->buffer ? doBufferedRead(fh, buffer, len) :
+                             fh->io->read(fh->io, buffer, len);
+    if (rc > 0)
+        __PHYSFS_STAT_ADD(&fh->dirHandle->stats, bytesRead, rc);
+    return rc;
+    #else
+    if (fh->buffer)
+        return doBufferedRead(fh, buffer, len);
+
+    return fh->io->read(fh->io, buffer, len);
+    #endif
+} /* doReadBytes */
+
+
+PHYSFS_sint64 PHYSFS_readBytes(PHYSFS_File *handle, void *buffer,
+                               PHYSFS_uint64 _len)
+{
+    const size_t len = (size_t) _len;
+    FileHandle *fh = (FileHandle *) handle;
+
+#ifdef PHYSFS_NO_64BIT_SUPPORT
+    const PHYSFS_uint64 maxlen = __PHYSFS_UI64(0x7FFFFFFF);
+#else
+    const PHYSFS_uint64 maxlen = __PHYSFS_UI64(0x7FFFFFFFFFFFFFFF);
+#endif
+
+    if (!__PHYSFS_ui64FitsAddressSpace(_len))
+        BAIL(PHYSFS_ERR_INVALID_ARGUMENT, -1);
+
+    BAIL_IF(_len > maxlen, PHYSFS_ERR_INVALID_ARGUMENT, -1);
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, -1);
+    BAIL_IF_ERRPASS(len == 0, 0);
+
+    if (traceCallback != NULL)
+    {
+        PHYSFS_TraceEvent event;
+        PHYSFS_uint64 started;
+        initTraceEvent(&event, PHYSFS_TRACE_READ, fh);
+        event.offset = (PHYSFS_uint64) PHYSFS_tell(handle);
+        event.length = len;
+        started = __PHYSFS_platformNanoseconds();
+        event.result = doReadBytes(fh, buffer, len);
+        event.nanoseconds = __PHYSFS_platformNanoseconds() - started;
+        emitTraceEvent(&event);
+        return event.result;
+    } /* if */
+
+    return doReadBytes(fh, buffer, len);
+} /* PHYSFS_readBytes */
+
+
+/*
+ * Async reads are serviced by a small pool of threads, started the first
+ *  time one is requested. Each request reads through its own duplicate of
+ *  the file's Io, so it doesn't disturb the PHYSFS_File's position or
+ *  buffer, and doesn't need any lock while it runs; the app can keep using
+ *  (or close) the handle. The request holds a reference to the archive, so
+ *  unmounting can't pull it out from under a pending read.
+ *
+ * Uncompressed data in a file on disk (a file in a directory, or a stored
+ *  entry in an archive, mapped or not) skips the threads when the platform
+ *  has real async reads (io_uring, overlapped i/o): the OS reads straight
+ *  into the app's buffer and calls back from its own thread.
+ */
+#ifndef PHYSFS_ASYNC_READ_MAX_THREADS
+#define PHYSFS_ASYNC_READ_MAX_THREADS 4
+#endif
+
+static void finishAsyncRead(AsyncRead *req, PHYSFS_sint64 retval,
+                            PHYSFS_ErrorCode errcode)
+{
+    PHYSFS_Io *io = req->io;
+
+    req->result = retval;
+    if (retval < 0)
+        req->errcode = (errcode == PHYSFS_ERR_OK) ? PHYSFS_ERR_IO : errcode;
+
+    io->destroy(io);
+    req->io = NULL;
+    releaseDirHandle(req->dirHandle);
+    req->dirHandle = NULL;
+
+    if (req->callback != NULL)
+        req->callback(req->callbackdata, (PHYSFS_AsyncRead *) req,
+                      req->buffer, req->result);
+
+    if (req->lock != NULL)
+        __PHYSFS_platformGrabMutex(req->lock);
+    req->done = 1;
+    if (req->lock != NULL)
+        __PHYSFS_platformReleaseMutex(req->lock);
+
+    /* (req) may be freed as soon as this is posted. */
+    __PHYSFS_platformPostSemaphore(req->finished);
+} /* finishAsyncRead */
+
+
+static void runAsyncRead(AsyncRead *req)
+{
+    PHYSFS_Io *io = req->io;
+    PHYSFS_uint8 *ptr = (PHYSFS_uint8 *) req->buffer;
+    PHYSFS_sint64 retval = 0;
+    size_t len = req->len;
+
+    if (!io->seek(io, req->offset))
+        retval = -1;
+    else
+    {
+        while (len > 0)  /* Ios may return short reads; keep going. */
+        {
+            const PHYSFS_sint64 rc = io->read(io, ptr, len);
+            if (rc <= 0)
+            {
+                if ((rc < 0) && (retval == 0))  /* report data, or failure. */
+                    retval = -1;
+                break;
+            } /* if */
+            ptr += (size_t) rc;
+            len -= (size_t) rc;
+            retval += rc;
+        } /* while */
+    } /* else */
+
+    finishAsyncRead(req, retval, (retval < 0) ? PHYSFS_getLastErrorCode() : PHYSFS_ERR_OK);
+} /* runAsyncRead */
+
+
+#ifndef PHYSFS_NO_POSITIONAL_READ
+static void nativeAsyncReadDone(void *data, PHYSFS_sint64 rc,
+                                PHYSFS_ErrorCode err)
+{
+    finishAsyncRead((AsyncRead *) data, rc, err);
+} /* nativeAsyncReadDone */
+
+
+static void *getMappedFileHandle(MappedFile *map);
+
+/* hand (req) to the OS if it's a plain span of a file on disk. */
+static int startNativeAsyncRead(AsyncRead *req)
+{
+    const PHYSFS_ErrorCode prev = currentErrorCode();
+    PHYSFS_Io *base = NULL;
+    PHYSFS_Io *orig = NULL;
+    PHYSFS_Io *io = NULL;
+    void *handle = NULL;
+    PHYSFS_uint64 pos = 0;
+    PHYSFS_uint64 size = 0;
+    PHYSFS_uint64 len = req->len;
+    int raw = 0;
+
+    if ((!__PHYSFS_getIoRange(req->io, &base, &pos, &size, &raw)) || (!raw))
+    {
+        PHYSFS_setErrorCode(prev);  /* the threads will report it. */
+        return 0;
+    } /* if */
+    else if (!__PHYSFS_verifyIo(req->io, 0))
+    {
+        PHYSFS_setErrorCode(prev);  /* the threads check it as they read. */
+        return 0;
+    } /* else if */
+    else if ((req->offset >= size) || (len == 0))
+        return 0;  /* nothing to read; not worth a trip through the OS. */
+    else if (len > (size - req->offset))
+        len = size - req->offset;
+
+    /* preloaded data is faster through a plain copy. Either way, (base) is
+       shared by the whole archive, so we hold our own reference to it. */
+    if (base->destroy == nativeIo_destroy)
+    {
+        NativeIoFile *file = ((NativeIoInfo *) base->opaque)->file;
+        if ((nativeIoIsShared(file)) && (!__PHYSFS_ATOMIC_GETPTR(&file->ram)))
+        {
+            handle = file->handle;
+            io = createNativeIoForFile(file);
+        } /* if */
+    } /* if */
+    else if (base->destroy == mappedIo_destroy)
+    {
+        /* the pages might not be in yet; don't fault them in on a thread. */
+        MappedFile *map = ((MappedIoInfo *) base->opaque)->map;
+        if (!__PHYSFS_ATOMIC_GETPTR(&map->ram))
+        {
+            handle = getMappedFileHandle(map);
+            if (handle != NULL)
+                io = createMappedIoForMap(map);
+        } /* if */
+    } /* else if */
+
+    if (io == NULL)
+    {
+        PHYSFS_setErrorCode(prev);
+        return 0;
+    } /* if */
+
+    /* the callback might run before this returns, so set (req->io) first. */
+    orig = req->io;
+    req->io = io;
+    if (!__PHYSFS_platformReadAtAsync(handle, req->buffer, len,
+                                      pos + req->offset,
+                                      nativeAsyncReadDone, req))
+    {
+        req->io = orig;  /* the threads read through the file's own Io. */
+        io->destroy(io);
+        return 0;
+    } /* if */
+
+    orig->destroy(orig);
+    return 1;
+} /* startNativeAsyncRead */
+#endif
+
+
+static void asyncReadWorker(void *unused)
+{
+    while (1)
+    {
+        AsyncRead *req;
+
+        __PHYSFS_platformWaitSemaphore(asyncReadWork);
+        __PHYSFS_platformGrabMutex(asyncReadLock);
+        req = asyncReadQueue;
+        if (req != NULL)
+        {
+            asyncReadQueue = req->next;
+            if (asyncReadQueue == NULL)
+                asyncReadQueueTail = NULL;
+        } /* if */
+        __PHYSFS_platformReleaseMutex(asyncReadLock);
+
+        if (req == NULL)
+            break;  /* posted with nothing queued: we're shutting down. */
+
+        runAsyncRead(req);
+    } /* while */
+} /* asyncReadWorker */
+
+
+/* MAKE SURE you've got the stateLock held before calling this! */
+static int startAsyncReads(void)
+{
+    int nthreads;
+
+    if (asyncReadThreadCount > 0)
+        return 1;
+    else if (asyncReadUnavailable)
+        return 0;
+
+    nthreads = __PHYSFS_platformCPUCount();
+    if (nthreads > PHYSFS_ASYNC_READ_MAX_THREADS)
+        nthreads = PHYSFS_ASYNC_READ_MAX_THREADS;
+
+    asyncReadThreads = (void **) allocator.Malloc(sizeof (void *) * nthreads);
+    GOTO_IF(!asyncReadThreads, PHYSFS_ERR_OUT_OF_MEMORY, startFailed);
+    asyncReadLock = __PHYSFS_platformCreateMutex();
+    GOTO_IF_ERRPASS(!asyncReadLock, startFailed);
+    asyncReadWork = __PHYSFS_platformCreateSemaphore();
+    GOTO_IF_ERRPASS(!asyncReadWork, startFailed);
+
+    while (asyncReadThreadCount < nthreads)
+    {
+        void *thread = __PHYSFS_platformCreateThread(asyncReadWorker, NULL);
+        if (thread == NULL)
+            break;  /* do with what we've got. */
+        asyncReadThreads[asyncReadThreadCount++] = thread;
+    } /* while */
+
+    if (asyncReadThreadCount > 0)
+        return 1;
+
+startFailed:
+    if (asyncReadWork) __PHYSFS_platformDestroySemaphore(asyncReadWork);
+    if (asyncReadLock) __PHYSFS_platformDestroyMutex(asyncReadLock);
+    if (asyncReadThreads) allocator.Free(asyncReadThreads);
+    asyncReadWork = asyncReadLock = NULL;
+    asyncReadThreads = NULL;
+    asyncReadUnavailable = 1;  /* just do them synchronously from now on. */
+    return 0;
+} /* startAsyncReads */
+
+
+static void stopAsyncReads(void)
+{
+    int i;
+
+    #ifndef PHYSFS_NO_POSITIONAL_READ
+    __PHYSFS_platformStopAsyncReads();  /* waits for the OS to call back. */
+    #endif
+
+    if (asyncReadThreadCount == 0)
+        return;
+
+    /* one extra post per thread; each quits when it finds the queue empty. */
+    for (i = 0; i < asyncReadThreadCount; i++)
+        __PHYSFS_platformPostSemaphore(asyncReadWork);
+    for (i = 0; i < asyncReadThreadCount; i++)
+        __PHYSFS_platformWaitThread(asyncReadThreads[i]);
+
+    assert(asyncReadQueue == NULL);
+    __PHYSFS_platformDestroySemaphore(asyncReadWork);
+    __PHYSFS_platformDestroyMutex(asyncReadLock);
+    allocator.Free(asyncReadThreads);
+    asyncReadWork = asyncReadLock = NULL;
+    asyncReadThreads = NULL;
+    asyncReadThreadCount = 0;
+} /* stopAsyncReads */
+
+
+PHYSFS_AsyncRead *PHYSFS_readBytesAsync(PHYSFS_File *handle,
+                                        PHYSFS_uint64 offset, void *buffer,
+                                        PHYSFS_uint64 len,
+                                        PHYSFS_AsyncReadCallback callback,
+                                        void *data)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    AsyncRead *req = NULL;
+    int queued = 0;
+
+#ifdef PHYSFS_NO_64BIT_SUPPORT
+    const PHYSFS_uint64 maxlen = __PHYSFS_UI64(0x7FFFFFFF);
+#else
+    const PHYSFS_uint64 maxlen = __PHYSFS_UI64(0x7FFFFFFFFFFFFFFF);
+#endif
+
+    BAIL_IF(!fh, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(!buffer && len, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(len), PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(len > maxlen, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(offset > maxlen, PHYSFS_ERR_INVALID_ARGUMENT, NULL);
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, NULL);
+
+    req = (AsyncRead *) allocator.Malloc(sizeof (AsyncRead));
+    BAIL_IF(!req, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(req, '\0', sizeof (AsyncRead));
+    req->offset = offset;
+    req->buffer = buffer;
+    req->len = (size_t) len;
+    req->callback = callback;
+    req->callbackdata = data;
+
+    req->finished = __PHYSFS_platformCreateSemaphore();
+    GOTO_IF_ERRPASS(!req->finished, readAsyncFailed);
+    req->io = fh->io->duplicate(fh->io);
+    GOTO_IF_ERRPASS(!req->io, readAsyncFailed);
+    req->dirHandle = fh->dirHandle;
+    (void) __PHYSFS_ATOMIC_INCR(&req->dirHandle->refcount);
+
+    grabStateLock();
+    if (startAsyncReads())
+    {
+        req->lock = asyncReadLock;
+
+        #ifndef PHYSFS_NO_POSITIONAL_READ
+        if (startNativeAsyncRead(req))
+        {
+            __PHYSFS_platformReleaseMutex(stateLock);
+            return (PHYSFS_AsyncRead *) req;  /* may be done already! */
+        } /* if */
+        #endif
+
+        __PHYSFS_platformGrabMutex(asyncReadLock);
+        if (asyncReadQueueTail == NULL)
+            asyncReadQueue = req;
+        else
+            asyncReadQueueTail->next = req;
+        asyncReadQueueTail = req;
+        __PHYSFS_platformReleaseMutex(asyncReadLock);
+        __PHYSFS_platformPostSemaphore(asyncReadWork);
+        queued = 1;
+    } /* if */
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    if (!queued)
+        runAsyncRead(req);  /* no threads; it's done before we return. */
+
+    return (PHYSFS_AsyncRead *) req;
+
+readAsyncFailed:
+    if (req->finished) __PHYSFS_platformDestroySemaphore(req->finished);
+    allocator.Free(req);
+    return NULL;
+} /* PHYSFS_readBytesAsync */
+
+
+int PHYSFS_isAsyncReadDone(PHYSFS_AsyncRead *_req)
+{
+    AsyncRead *req = (AsyncRead *) _req;
+    int retval;
+
+    BAIL_IF(!req, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    if (req->lock == NULL)
+        return req->done;
+
+    __PHYSFS_platformGrabMutex(req->lock);
+    retval = req->done;
+    __PHYSFS_platformReleaseMutex(req->lock);
+    return retval;
+} /* PHYSFS_isAsyncReadDone */
+
+
+PHYSFS_sint64 PHYSFS_waitAsyncRead(PHYSFS_AsyncRead *_req)
+{
+    AsyncRead *req = (AsyncRead *) _req;
+    PHYSFS_ErrorCode errcode;
+    PHYSFS_sint64 retval;
+
+    BAIL_IF(!req, PHYSFS_ERR_INVALID_ARGUMENT, -1);
+    __PHYSFS_platformWaitSemaphore(req->finished);
+
+    retval = req->result;
+    errcode = req->errcode;
+    __PHYSFS_platformDestroySemaphore(req->finished);
+    allocator.Free(req);
+
+    BAIL_IF(retval < 0, errcode, -1);
+    return retval;
+} /* PHYSFS_waitAsyncRead */
+
+
+/*
+ * PHYSFS_readFiles() opens everything first, then reads in the order the
+ *  data sits in each archive instead of the order the app asked for.
+ *  Uncompressed entries that are close together in the same archive are
+ *  read with one big read from the archive itself (gaps and all; it's
+ *  usually just local headers), then copied out.
+ */
+#ifndef PHYSFS_READFILES_COALESCE_GAP
+#define PHYSFS_READFILES_COALESCE_GAP 4096
+#endif
+#ifndef PHYSFS_READFILES_COALESCE_MAX
+#define PHYSFS_READFILES_COALESCE_MAX (256 * 1024)
+#endif
+
+typedef struct
+{
+    PHYSFS_ReadRequest *req;
+    size_t reqidx;  /* position in the app's array, to break ties. */
+    PHYSFS_Io *io;
+    PHYSFS_Io *base;  /* what (io) is a slice of; see __PHYSFS_getIoRange. */
+    size_t diridx;  /* position of the archive in the search path. */
+    PHYSFS_uint64 offset;  /* where (io)'s data starts in (base). */
+    size_t want;  /* bytes we'll read: file length or buffer size. */
+    int coalesce;  /* non-zero if we can read (want) bytes from (base). */
+} ReadFilesItem;
+
+static int readFilesCmp(void *_a, size_t one, size_t two)
+{
+    const ReadFilesItem *a = ((const ReadFilesItem *) _a) + one;
+    const ReadFilesItem *b = ((const ReadFilesItem *) _a) + two;
+    if (a->diridx != b->diridx)
+        return (a->diridx < b->diridx) ? -1 : 1;
+    else if (a->offset != b->offset)
+        return (a->offset < b->offset) ? -1 : 1;
+    else if (a->reqidx != b->reqidx)
+        return (a->reqidx < b->reqidx) ? -1 : 1;
+    return 0;
+} /* readFilesCmp */
+
+static void readFilesSwap(void *_a, size_t one, size_t two)
+{
+    ReadFilesItem *a = (ReadFilesItem *) _a;
+    ReadFilesItem tmp;
+    memcpy(&tmp, &a[one], sizeof (ReadFilesItem));
+    memcpy(&a[one], &a[two], sizeof (ReadFilesItem));
+    memcpy(&a[two], &tmp, sizeof (ReadFilesItem));
+} /* readFilesSwap */
+
+
+/* read until (len) bytes, EOF, or failure. Like doBufferedRead's return. */
+static PHYSFS_sint64 readFully(PHYSFS_Io *io, void *_buffer, size_t len)
+{
+    PHYSFS_uint8 *buffer = (PHYSFS_uint8 *) _buffer;
+    PHYSFS_sint64 retval = 0;
+
+    while (len > 0)
+    {
+        const PHYSFS_sint64 rc = io->read(io, buffer, len);
+        if (rc <= 0)
+        {
+            if ((rc < 0) && (retval == 0))
+                retval = -1;
+            break;
+        } /* if */
+        buffer += (size_t) rc;
+        len -= (size_t) rc;
+        retval += rc;
+    } /* while */
+
+    return retval;
+} /* readFully */
+
+
+static void finishReadFilesItem(ReadFilesItem *item, const PHYSFS_sint64 rc,
+                                PHYSFS_ReadFilesCallback callback, void *data)
+{
+    item->req->result = rc;
+    if (rc < 0)
+    {
+        item->req->errcode = PHYSFS_getLastErrorCode();
+        if (item->req->errcode == PHYSFS_ERR_OK)
+            item->req->errcode = PHYSFS_ERR_IO;
+    } /* if */
+
+    if (callback != NULL)
+        callback(data, item->req);
+} /* finishReadFilesItem */
+
+
+/* read items [start, end) with one read of their span from the archive. */
+static int readFilesCoalesced(ReadFilesItem *items, const size_t start,
+                              const size_t end, PHYSFS_uint8 *scratch,
+                              PHYSFS_ReadFilesCallback callback, void *data)
+{
+    PHYSFS_Io *base = items[start].base;
+    const PHYSFS_uint64 first = items[start].offset;
+    const size_t span = (size_t) ((items[end-1].offset - first) + items[end-1].want);
+    size_t i;
+
+    if (!base->seek(base, first))
+        return 0;
+    else if (readFully(base, scratch, span) != (PHYSFS_sint64) span)
+        return 0;
+
+    for (i = start; i < end; i++)
+    {
+        ReadFilesItem *item = &items[i];
+        memcpy(item->req->buffer, scratch + (size_t) (item->offset - first),
+               item->want);
+        finishReadFilesItem(item, (PHYSFS_sint64) item->want, callback, data);
+    } /* for */
+
+    return 1;
+} /* readFilesCoalesced */
+
+
+int PHYSFS_readFiles(PHYSFS_ReadRequest *reqs, PHYSFS_uint32 count,
+                     PHYSFS_ReadFilesCallback callback, void *data)
+{
+    SearchPathSnapshot *snap = NULL;
+    ReadFilesItem *items = NULL;
+    PHYSFS_uint8 *scratch = NULL;
+    PHYSFS_ErrorCode errcode = PHYSFS_ERR_OK;
+    size_t total = 0;
+    int moved = 0;
+    size_t i, j;
+
+    BAIL_IF(!reqs && count, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    for (i = 0; i < count; i++)
+    {
+        BAIL_IF(!reqs[i].filename, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+        BAIL_IF(!reqs[i].buffer && reqs[i].len, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+        BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(reqs[i].len), PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    } /* for */
+
+    if (count == 0)
+        return 1;
+
+    items = (ReadFilesItem *) allocator.Malloc(sizeof (ReadFilesItem) * count);
+    BAIL_IF(!items, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    snap = grabSearchPath();
+    if (!snap)
+    {
+        allocator.Free(items);
+        return 0;
+    } /* if */
+
+    /* one snapshot for the whole batch: open everything. */
+    for (i = 0; i < count; i++)
+    {
+        PHYSFS_ReadRequest *req = &reqs[i];
+        ReadFilesItem *item = &items[total];
+        DirHandle *dh = NULL;
+        PHYSFS_sint64 filelen = -1;
+        PHYSFS_uint64 len = 0;
+        int raw = 0;
+
+        memset(item, '\0', sizeof (*item));
+        item->req = req;
+        item->reqidx = i;
+        req->result = -1;
+        req->errcode = PHYSFS_ERR_OK;
+
+        /* (len) is the raw span; the file's own length is what we want. */
+        item->io = openReadInSnapshot(snap, req->filename, &dh);
+        if (item->io != NULL)
+            filelen = item->io->length(item->io);
+        if ((filelen < 0) ||
+            (!__PHYSFS_getIoRange(item->io, &item->base, &item->offset, &len, &raw)))
+        {
+            finishReadFilesItem(item, -1, callback, data);
+            if (item->io != NULL)
+                item->io->destroy(item->io);
+            continue;
+        } /* if */
+
+        for (item->diridx = 0; snap->dirs[item->diridx] != dh; item->diridx++)
+            { /* spin */ }
+
+        len = (PHYSFS_uint64) filelen;
+        item->want = (size_t) ((req->len < len) ? req->len : len);
+
+        /* only slices of an archive; a file in a directory is its own base.
+           If the archive's in memory already, a copy would just be slower. */
+        item->coalesce = ( raw && (item->base != item->io) &&
+                           (item->want < PHYSFS_READFILES_COALESCE_MAX) &&
+                           (!__PHYSFS_getIoBuffer(item->base, &len)) &&
+                           (__PHYSFS_verifyIo(item->io, 0)) );
+        total++;
+    } /* for */
+
+    __PHYSFS_sort(items, total, readFilesCmp, readFilesSwap);
+
+    for (i = 0; i < total; i = j)
+    {
+        ReadFilesItem *item = &items[i];
+        const PHYSFS_uint64 first = item->offset;
+        PHYSFS_uint64 end = first + item->want;
+
+        /* find a run of nearby uncompressed entries in the same archive. */
+        for (j = i + 1; (j < total) && (item->coalesce); j++)
+        {
+            const ReadFilesItem *next = &items[j];
+            if ((!next->coalesce) || (next->diridx != item->diridx))
+                break;
+            else if (next->offset < end)  /* overlap?! Don't risk it. */
+                break;
+            else if ((next->offset - end) > PHYSFS_READFILES_COALESCE_GAP)
+                break;
+            else if (((next->offset + next->want) - first) > PHYSFS_READFILES_COALESCE_MAX)
+                break;
+            end = next->offset + next->want;
+        } /* for */
+
+        if ((j - i) > 1)
+        {
+            if (!scratch)
+                scratch = (PHYSFS_uint8 *) allocator.Malloc(PHYSFS_READFILES_COALESCE_MAX);
+            if ((scratch) && (readFilesCoalesced(items, i, j, scratch, callback, data)))
+                continue;
+            moved = 1;  /* do them one at a time, but (base) needs a seek. */
+        } /* if */
+
+        for (; i < j; i++)
+        {
+            PHYSFS_sint64 rc = -1;
+            item = &items[i];
+            if ((!moved) || (item->io->seek(item->io, 0)))
+                rc = readFully(item->io, item->req->buffer, item->want);
+            finishReadFilesItem(item, rc, callback, data);
+        } /* for */
+        moved = 0;
+    } /* for */
+
+    for (i = 0; i < total; i++)
+        items[i].io->destroy(items[i].io);
+
+    releaseSearchPath(snap);
+    if (scratch) allocator.Free(scratch);
+    allocator.Free(items);
+
+    for (i = 0; (i < count) && (!errcode); i++)
+    {
+        if (reqs[i].result < 0)
+            errcode = reqs[i].errcode;
+    } /* for */
+
+    BAIL_IF(errcode, errcode, 0);
+    return 1;
+} /* PHYSFS_readFiles */
+
+
+/* hint (len) bytes of (io), from (pos), to the OS. Advisory; never fails. */
+static void prefetchIo(PHYSFS_Io *io, PHYSFS_uint64 pos, PHYSFS_uint64 len)
+{
+    PHYSFS_Io *base = NULL;
+    PHYSFS_uint64 offset = 0;
+    PHYSFS_uint64 span = 0;
+    int raw = 0;
+
+    if (!__PHYSFS_getIoRange(io, &base, &offset, &span, &raw))
+        return;
+
+    /* compressed, etc? No telling what part we'll need, so take it all. */
+    if (raw)
+    {
+        if (pos >= span)
+            return;
+        else if (len > (span - pos))
+            len = span - pos;
+        offset += pos;
+        span = len;
+    } /* if */
+
+    if (span == 0)
+        return;
+    else if (base->destroy == nativeIo_destroy)
+    {
+        const NativeIoInfo *info = (const NativeIoInfo *) base->opaque;
+        if (__PHYSFS_ATOMIC_GETPTR(&info->file->ram) == NULL)
+            __PHYSFS_platformPrefetch(info->file->handle, offset, span);
+    } /* else if */
+    else if (base->destroy == mappedIo_destroy)
+    {
+        const MappedFile *map = ((const MappedIoInfo *) base->opaque)->map;
+        if (__PHYSFS_ATOMIC_GETPTR(&map->ram) != NULL)
+            return;  /* preloaded. */
+        else if (offset >= map->len)
+            return;
+        else if (span > (map->len - offset))
+            span = map->len - offset;
+        __PHYSFS_platformPrefetchMapping(map->buf + offset, span);
+    } /* else if */
+
+    /* memory Ios are already in memory; anything else, we can't help. */
+} /* prefetchIo */
+
+
+int PHYSFS_prefetch(PHYSFS_File *handle, PHYSFS_uint64 pos, PHYSFS_uint64 len)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    BAIL_IF(!fh, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, 0);
+    prefetchIo(fh->io, pos, len);
+    return 1;
+} /* PHYSFS_prefetch */
+
+
+/*
+ * A mapped archive only has a mapping, so the first time someone wants an OS
+ *  handle for it, open one to go with the mapping. It's closed along with
+ *  the mapping. If the file on disk isn't the one that was mapped anymore,
+ *  it's no use.
+ */
+static void *getMappedFileHandle(MappedFile *map)
+{
+    void *retval;
+
+    grabStateLock();
+    if (map->handle == NULL)
+    {
+        void *handle = __PHYSFS_platformOpenRead(map->path);
+        if (handle != NULL)
+        {
+            if (__PHYSFS_platformFileLength(handle) == (PHYSFS_sint64) map->len)
+                map->handle = handle;
+            else
+            {
+                __PHYSFS_platformClose(handle);
+                PHYSFS_setErrorCode(PHYSFS_ERR_UNSUPPORTED);
+            } /* else */
+        } /* if */
+    } /* if */
+    retval = map->handle;
+    __PHYSFS_platformReleaseMutex(stateLock);
+
+    return retval;
+} /* getMappedFileHandle */
+
+
+int PHYSFS_getNativeRange(PHYSFS_File *handle, PHYSFS_sint64 *oshandle,
+                          PHYSFS_uint64 *offset, PHYSFS_uint64 *len)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    PHYSFS_Io *base = NULL;
+    PHYSFS_uint64 pos = 0;
+    PHYSFS_uint64 size = 0;
+    void *platformHandle = NULL;
+    int raw = 0;
+
+    BAIL_IF(!fh || !oshandle || !offset || !len, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, 0);
+    BAIL_IF_ERRPASS(!__PHYSFS_getIoRange(fh->io, &base, &pos, &size, &raw), 0);
+    BAIL_IF(!raw, PHYSFS_ERR_UNSUPPORTED, 0);  /* compressed, etc. */
+    BAIL_IF_ERRPASS(!__PHYSFS_verifyIo(fh->io, 1), 0);  /* bad crc? */
+
+    if (base->destroy == nativeIo_destroy)
+        platformHandle = ((NativeIoInfo *) base->opaque)->file->handle;
+    else if (base->destroy == mappedIo_destroy)
+    {
+        platformHandle = getMappedFileHandle(((MappedIoInfo *) base->opaque)->map);
+        BAIL_IF_ERRPASS(!platformHandle, 0);
+    } /* else if */
+    else
+    {
+        BAIL(PHYSFS_ERR_UNSUPPORTED, 0);  /* in memory, or an app's Io. */
+    } /* else */
+
+    *oshandle = __PHYSFS_platformGetOsHandle(platformHandle);
+    *offset = pos;
+    *len = size;
+    return 1;
+} /* PHYSFS_getNativeRange */
+
+
+int PHYSFS_prefetchFiles(const char * const *filenames, PHYSFS_uint32 count)
+{
+    PHYSFS_ErrorCode errcode = PHYSFS_ERR_OK;
+    SearchPathSnapshot *snap;
+    PHYSFS_uint32 i;
+
+    BAIL_IF(!filenames && count, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    for (i = 0; i < count; i++)
+        BAIL_IF(!filenames[i], PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+    snap = grabSearchPath();
+    BAIL_IF_ERRPASS(!snap, 0);
 
+    for (i = 0; i < count; i++)
+    {
+        DirHandle *dh = NULL;
+        PHYSFS_Io *io = openReadInSnapshot(snap, filenames[i], &dh);
+        if (io == NULL)
+        {
+            if (!errcode)
+                errcode = currentErrorCode();
+            continue;  /* hint the rest anyhow. */
+        } /* if */
 
-PHYSFS_File *PHYSFS_openWrite(const char *filename)
-{
-    return doOpenWrite(filename, 0);
-} /* PHYSFS_openWrite */
+        prefetchIo(io, 0, __PHYSFS_UI64(0xFFFFFFFFFFFFFFFF));
+        io->destroy(io);
+    } /* for */
 
+    releaseSearchPath(snap);
 
-PHYSFS_File *PHYSFS_openAppend(const char *filename)
-{
-    return doOpenWrite(filename, 1);
-} /* PHYSFS_openAppend */
+    BAIL_IF(errcode, errcode, 0);
+    return 1;
+} /* PHYSFS_prefetchFiles */
 
 
-PHYSFS_File *PHYSFS_openRead(const char *_fname)
+/*
+ * Write-behind (see PHYSFS_setWriteBehind()) hands data to one background
+ *  thread, as jobs in a single queue, so everything written to a file lands
+ *  in the order the app wrote it. While a file has jobs queued, only that
+ *  thread touches its Io; anything else that needs the Io waits for the
+ *  queue to empty first. The thread never takes the stateLock, so waiting
+ *  on it with the stateLock held is safe.
+ */
+static void finishWriteBehindJob(WriteBehindJob *job, const PHYSFS_ErrorCode err)
 {
-    FileHandle *fh = NULL;
-    char *allocated_fname;
-    char *fname;
-    size_t len;
+    WriteBehind *wb = job->file;
 
-    BAIL_IF(!_fname, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    __PHYSFS_platformGrabMutex(writeBehindLock);
+    if ((err != PHYSFS_ERR_OK) && (wb->errcode == PHYSFS_ERR_OK))
+        wb->errcode = err;
+    wb->queued -= job->len;
+    while (wb->waiters > 0)
+    {
+        wb->waiters--;
+        __PHYSFS_platformPostSemaphore(wb->progress);
+    } /* while */
+    __PHYSFS_platformReleaseMutex(writeBehindLock);
+} /* finishWriteBehindJob */
 
-    __PHYSFS_platformGrabMutex(stateLock);
 
-    BAIL_IF_MUTEX(!searchPath, PHYSFS_ERR_NOT_FOUND, stateLock, 0);
+static void freeWriteBehind(WriteBehind *wb)
+{
+    assert(wb->queued == 0);
+    assert(wb->waiters == 0);
+    __PHYSFS_platformDestroySemaphore(wb->progress);
+    allocator.Free(wb);
+} /* freeWriteBehind */
 
-    len = strlen(_fname) + longest_root + 2;
-    allocated_fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
-    fname = allocated_fname + longest_root + 1;
 
-    if (sanitizePlatformIndependentPath(_fname, fname))
+static void runWriteBehindJob(WriteBehindJob *job)
+{
+    WriteBehind *wb = job->file;
+    PHYSFS_Io *io = wb->io;
+    PHYSFS_ErrorCode err = PHYSFS_ERR_OK;
+
+    if (job == &wb->closeJob)  /* app closed it; flush to disk and clean up. */
     {
-        PHYSFS_Io *io = NULL;
-        DirHandle *i;
+        if (io->flush)
+            io->flush(io);  /* nobody left to tell if this fails. */
+        io->destroy(io);
+        releaseDirHandle(wb->dirHandle);
+        freeWriteBehind(wb);
+        return;
+    } /* if */
 
-        for (i = searchPath; i != NULL; i = i->next)
-        {
-            char *arcfname = fname;
-            if (verifyPath(i, &arcfname, 0))
-            {
-                io = i->funcs->openRead(i->opaque, arcfname);
-                if (io)
-                    break;
-            } /* if */
-        } /* for */
+    /* once a write fails, drop the rest, so there's no hole in the file. */
+    __PHYSFS_platformGrabMutex(writeBehindLock);
+    err = wb->errcode;
+    __PHYSFS_platformReleaseMutex(writeBehindLock);
 
-        if (io)
+    if (err == PHYSFS_ERR_OK)
+    {
+        const PHYSFS_uint8 *ptr = (const PHYSFS_uint8 *) (job + 1);
+        size_t len = job->len;
+        while (len > 0)  /* Ios may write less than we asked; keep going. */
         {
-            fh = (FileHandle *) allocator.Malloc(sizeof (FileHandle));
-            if (fh == NULL)
+            const PHYSFS_sint64 rc = io->write(io, ptr, len);
+            if (rc <= 0)
             {
-                io->destroy(io);
-                PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+                err = PHYSFS_getLastErrorCode();
+                if (err == PHYSFS_ERR_OK)
+                    err = PHYSFS_ERR_IO;
+                break;
             } /* if */
-            else
-            {
-                memset(fh, '\0', sizeof (FileHandle));
-                fh->io = io;
-                fh->forReading = 1;
-                fh->dirHandle = i;
-                fh->next = openReadList;
-                openReadList = fh;
-            } /* else */
-        } /* if */
+            ptr += (size_t) rc;
+            len -= (size_t) rc;
+        } /* while */
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-    __PHYSFS_smallFree(allocated_fname);
-    return ((PHYSFS_File *) fh);
-} /* PHYSFS_openRead */
+    finishWriteBehindJob(job, err);
+    allocator.Free(job);
+} /* runWriteBehindJob */
 
 
-static int closeHandleInOpenList(FileHandle **list, FileHandle *handle)
+static void writeBehindWorker(void *unused)
 {
-    FileHandle *prev = NULL;
-    FileHandle *i;
-
-    for (i = *list; i != NULL; i = i->next)
+    while (1)
     {
-        if (i == handle)  /* handle is in this list? */
+        WriteBehindJob *job;
+
+        __PHYSFS_platformWaitSemaphore(writeBehindWork);
+        __PHYSFS_platformGrabMutex(writeBehindLock);
+        job = writeBehindQueue;
+        if (job != NULL)
         {
-            PHYSFS_Io *io = handle->io;
-            PHYSFS_uint8 *tmp = handle->buffer;
+            writeBehindQueue = job->next;
+            if (writeBehindQueue == NULL)
+                writeBehindQueueTail = NULL;
+        } /* if */
+        __PHYSFS_platformReleaseMutex(writeBehindLock);
 
-            /* send our buffer to io... */
-            if (!handle->forReading)
-            {
-                if (!PHYSFS_flush((PHYSFS_File *) handle))
-                    return -1;
+        if (job == NULL)
+            break;  /* posted with nothing queued: we're shutting down. */
 
-                /* ...then have io send it to the disk... */
-                else if (io->flush && !io->flush(io))
-                    return -1;
-            } /* if */
+        runWriteBehindJob(job);
+    } /* while */
+} /* writeBehindWorker */
 
-            /* ...then close the underlying file. */
-            io->destroy(io);
 
-            if (tmp != NULL)  /* free any associated buffer. */
-                allocator.Free(tmp);
+/* MAKE SURE you've got the stateLock held before calling this! */
+static int startWriteBehind(void)
+{
+    if (writeBehindThread != NULL)
+        return 1;
 
-            if (prev == NULL)
-                *list = handle->next;
-            else
-                prev->next = handle->next;
+    BAIL_IF(writeBehindUnavailable, PHYSFS_ERR_UNSUPPORTED, 0);
 
-            allocator.Free(handle);
-            return 1;
-        } /* if */
-        prev = i;
-    } /* for */
+    writeBehindLock = __PHYSFS_platformCreateMutex();
+    GOTO_IF_ERRPASS(!writeBehindLock, startFailed);
+    writeBehindWork = __PHYSFS_platformCreateSemaphore();
+    GOTO_IF_ERRPASS(!writeBehindWork, startFailed);
+    writeBehindThread = __PHYSFS_platformCreateThread(writeBehindWorker, NULL);
+    GOTO_IF(!writeBehindThread, PHYSFS_ERR_UNSUPPORTED, startFailed);
+    return 1;
 
+startFailed:
+    if (writeBehindWork) __PHYSFS_platformDestroySemaphore(writeBehindWork);
+    if (writeBehindLock) __PHYSFS_platformDestroyMutex(writeBehindLock);
+    writeBehindWork = writeBehindLock = NULL;
+    writeBehindUnavailable = 1;  /* don't keep trying. */
     return 0;
-} /* closeHandleInOpenList */
+} /* startWriteBehind */
 
 
-int PHYSFS_close(PHYSFS_File *_handle)
+static void stopWriteBehind(void)
 {
-    FileHandle *handle = (FileHandle *) _handle;
-    int rc;
+    if (writeBehindThread == NULL)
+        return;
 
-    __PHYSFS_platformGrabMutex(stateLock);
+    /* it works through what's queued before it sees this. */
+    __PHYSFS_platformPostSemaphore(writeBehindWork);
+    __PHYSFS_platformWaitThread(writeBehindThread);
+
+    assert(writeBehindQueue == NULL);
+    __PHYSFS_platformDestroySemaphore(writeBehindWork);
+    __PHYSFS_platformDestroyMutex(writeBehindLock);
+    writeBehindWork = writeBehindLock = writeBehindThread = NULL;
+} /* stopWriteBehind */
+
+
+static void queueWriteBehindJob(WriteBehindJob *job)
+{
+    __PHYSFS_platformGrabMutex(writeBehindLock);
+    job->file->queued += job->len;
+    job->next = NULL;
+    if (writeBehindQueueTail == NULL)
+        writeBehindQueue = job;
+    else
+        writeBehindQueueTail->next = job;
+    writeBehindQueueTail = job;
+    __PHYSFS_platformReleaseMutex(writeBehindLock);
+    __PHYSFS_platformPostSemaphore(writeBehindWork);
+} /* queueWriteBehindJob */
 
-    /* -1 == close failure. 0 == not found. 1 == success. */
-    rc = closeHandleInOpenList(&openReadList, handle);
-    BAIL_IF_MUTEX_ERRPASS(rc == -1, stateLock, 0);
-    if (!rc)
+
+/* Block until no more than (limit) bytes of (wb)'s are still queued. */
+static void waitWriteBehind(WriteBehind *wb, const size_t limit)
+{
+    __PHYSFS_platformGrabMutex(writeBehindLock);
+    while (wb->queued > limit)
     {
-        rc = closeHandleInOpenList(&openWriteList, handle);
-        BAIL_IF_MUTEX_ERRPASS(rc == -1, stateLock, 0);
-    } /* if */
+        wb->waiters++;
+        __PHYSFS_platformReleaseMutex(writeBehindLock);
+        __PHYSFS_platformWaitSemaphore(wb->progress);
+        __PHYSFS_platformGrabMutex(writeBehindLock);
+    } /* while */
+    __PHYSFS_platformReleaseMutex(writeBehindLock);
+} /* waitWriteBehind */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
-    BAIL_IF(!rc, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+
+/* Fail with the error from a background write, if there was one. */
+static int checkWriteBehind(WriteBehind *wb)
+{
+    PHYSFS_ErrorCode err;
+    __PHYSFS_platformGrabMutex(writeBehindLock);
+    err = wb->errcode;
+    __PHYSFS_platformReleaseMutex(writeBehindLock);
+    BAIL_IF(err != PHYSFS_ERR_OK, err, 0);
     return 1;
-} /* PHYSFS_close */
+} /* checkWriteBehind */
 
 
-static PHYSFS_sint64 doBufferedRead(FileHandle *fh, void *_buffer, size_t len)
+/* Queue a copy of (len) bytes at (buffer). If (mayBlock), keep to the
+   file's limit on queued bytes, waiting for room if we have to. */
+static int queueWriteBehind(WriteBehind *wb, const void *buffer, size_t len,
+                            const int mayBlock)
 {
-    PHYSFS_uint8 *buffer = (PHYSFS_uint8 *) _buffer;
-    PHYSFS_sint64 retval = 0;
+    const PHYSFS_uint8 *ptr = (const PHYSFS_uint8 *) buffer;
+
+    BAIL_IF_ERRPASS(!checkWriteBehind(wb), 0);
 
     while (len > 0)
     {
-        const size_t avail = fh->buffill - fh->bufpos;
-        if (avail > 0)  /* data available in the buffer. */
-        {
-            const size_t cpy = (len < avail) ? len : avail;
-            memcpy(buffer, fh->buffer + fh->bufpos, cpy);
-            assert(len >= cpy);
-            buffer += cpy;
-            len -= cpy;
-            fh->bufpos += cpy;
-            retval += cpy;
-        } /* if */
-
-        else   /* buffer is empty, refill it. */
-        {
-            PHYSFS_Io *io = fh->io;
-            const PHYSFS_sint64 rc = io->read(io, fh->buffer, fh->bufsize);
-            fh->bufpos = 0;
-            if (rc > 0)
-                fh->buffill = (size_t) rc;
-            else
-            {
-                fh->buffill = 0;
-                if (retval == 0)  /* report already-read data, or failure. */
-                    retval = rc;
-                break;
-            } /* else */
-        } /* else */
+        const size_t chunk = ((!mayBlock) || (len < wb->maxQueued)) ? len : wb->maxQueued;
+        WriteBehindJob *job;
+
+        if (mayBlock)
+            waitWriteBehind(wb, wb->maxQueued - chunk);
+
+        job = (WriteBehindJob *) allocator.Malloc(sizeof (WriteBehindJob) + chunk);
+        BAIL_IF(!job, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        job->file = wb;
+        job->len = chunk;
+        memcpy(job + 1, ptr, chunk);
+        queueWriteBehindJob(job);
+
+        wb->pos += chunk;
+        ptr += chunk;
+        len -= chunk;
     } /* while */
 
+    return 1;
+} /* queueWriteBehind */
+
+
+/* Wait for everything queued to be written, and stop using write-behind. */
+static int endWriteBehind(FileHandle *fh)
+{
+    WriteBehind *wb = fh->writeBehind;
+    PHYSFS_ErrorCode err;
+
+    waitWriteBehind(wb, 0);
+    err = wb->errcode;  /* nothing else is looking at it now. */
+    fh->writeBehind = NULL;
+    freeWriteBehind(wb);
+
+    BAIL_IF(err != PHYSFS_ERR_OK, err, 0);
+    return 1;
+} /* endWriteBehind */
+
+
+/* Queue what's left in (fh)'s buffer, then hand its Io to the writer to
+   close. Returns zero if a write failed, but (fh) is done with its Io
+   anyhow, unless (fh->writeBehind) is still set: then the buffer couldn't
+   be queued, and nothing happened. */
+static int closeWriteBehind(FileHandle *fh)
+{
+    WriteBehind *wb = fh->writeBehind;
+    int retval = 1;
+
+    if (fh->bufpos != fh->buffill)
+    {
+        if (!checkWriteBehind(wb))
+            retval = 0;  /* it's dropped anyhow; report and close. */
+        else if (!queueWriteBehind(wb, fh->buffer + fh->bufpos, fh->buffill - fh->bufpos, 0))
+            return 0;  /* out of memory; leave the file open so nothing's lost. */
+        fh->bufpos = fh->buffill = 0;
+    } /* if */
+
+    if (!checkWriteBehind(wb))
+        retval = 0;
+
+    (void) __PHYSFS_ATOMIC_INCR(&fh->dirHandle->refcount);
+    wb->dirHandle = fh->dirHandle;
+    wb->closeJob.file = wb;
+    wb->closeJob.len = 0;
+    fh->writeBehind = NULL;
+    queueWriteBehindJob(&wb->closeJob);  /* (wb) is the writer's now. */
     return retval;
-} /* doBufferedRead */
+} /* closeWriteBehind */
 
 
-PHYSFS_sint64 PHYSFS_read(PHYSFS_File *handle, void *buffer,
-                          PHYSFS_uint32 size, PHYSFS_uint32 count)
+/* Write through (fh)'s Io, or queue it for the writer to. */
+static PHYSFS_sint64 writeFileHandle(FileHandle *fh, const void *buffer,
+                                     const size_t len)
 {
-    const PHYSFS_uint64 len = ((PHYSFS_uint64) size) * ((PHYSFS_uint64) count);
-    const PHYSFS_sint64 retval = PHYSFS_readBytes(handle, buffer, len);
-    return ( (retval <= 0) ? retval : (retval / ((PHYSFS_sint64) size)) );
-} /* PHYSFS_read */
+    if (fh->writeBehind == NULL)
+        return fh->io->write(fh->io, buffer, len);
 
+    BAIL_IF_ERRPASS(!queueWriteBehind(fh->writeBehind, buffer, len, 1), -1);
+    return (PHYSFS_sint64) len;
+} /* writeFileHandle */
 
-PHYSFS_sint64 PHYSFS_readBytes(PHYSFS_File *handle, void *buffer,
-                               PHYSFS_uint64 _len)
+
+int PHYSFS_setWriteBehind(PHYSFS_File *handle, PHYSFS_uint64 maxqueued)
 {
-    const size_t len = (size_t) _len;
     FileHandle *fh = (FileHandle *) handle;
+    WriteBehind *wb;
+    PHYSFS_sint64 pos;
+    int started;
 
-#ifdef PHYSFS_NO_64BIT_SUPPORT
-    const PHYSFS_uint64 maxlen = __PHYSFS_UI64(0x7FFFFFFF);
-#else
-    const PHYSFS_uint64 maxlen = __PHYSFS_UI64(0x7FFFFFFFFFFFFFFF);
-#endif
+    BAIL_IF(!fh, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(fh->forReading, PHYSFS_ERR_OPEN_FOR_READING, 0);
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(maxqueued), PHYSFS_ERR_INVALID_ARGUMENT, 0);
 
-    if (!__PHYSFS_ui64FitsAddressSpace(_len))
-        BAIL(PHYSFS_ERR_INVALID_ARGUMENT, -1);
+    if (fh->writeBehind != NULL)
+    {
+        BAIL_IF_ERRPASS(!PHYSFS_flush(handle), 0);
+        if (maxqueued != 0)
+        {
+            fh->writeBehind->maxQueued = (size_t) maxqueued;
+            return 1;
+        } /* if */
+        return endWriteBehind(fh);
+    } /* if */
 
-    BAIL_IF(_len > maxlen, PHYSFS_ERR_INVALID_ARGUMENT, -1);
-    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, -1);
-    BAIL_IF_ERRPASS(len == 0, 0);
-    if (fh->buffer)
-        return doBufferedRead(fh, buffer, len);
+    if (maxqueued == 0)
+        return 1;  /* already off. */
 
-    return fh->io->read(fh->io, buffer, len);
-} /* PHYSFS_readBytes */
+    grabStateLock();
+    started = startWriteBehind();
+    __PHYSFS_platformReleaseMutex(stateLock);
+    BAIL_IF_ERRPASS(!started, 0);
+
+    pos = fh->io->tell(fh->io);
+    BAIL_IF_ERRPASS(pos < 0, 0);
+
+    wb = (WriteBehind *) allocator.Malloc(sizeof (WriteBehind));
+    BAIL_IF(!wb, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memset(wb, '\0', sizeof (WriteBehind));
+    wb->progress = __PHYSFS_platformCreateSemaphore();
+    if (!wb->progress)
+    {
+        allocator.Free(wb);
+        return 0;
+    } /* if */
+
+    wb->io = fh->io;
+    wb->pos = (PHYSFS_uint64) pos;
+    wb->maxQueued = (size_t) maxqueued;
+    fh->writeBehind = wb;
+    return 1;
+} /* PHYSFS_setWriteBehind */
+
+
+int PHYSFS_sync(PHYSFS_File *handle)
+{
+    FileHandle *fh = (FileHandle *) handle;
+    PHYSFS_Io *io;
+
+    BAIL_IF(!fh, PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(fh->forReading, PHYSFS_ERR_OPEN_FOR_READING, 0);
+    BAIL_IF_ERRPASS(!PHYSFS_flush(handle), 0);
+
+    if (fh->writeBehind != NULL)
+    {
+        waitWriteBehind(fh->writeBehind, 0);
+        BAIL_IF_ERRPASS(!checkWriteBehind(fh->writeBehind), 0);
+    } /* if */
+
+    io = fh->io;
+    BAIL_IF_ERRPASS(io->flush && !io->flush(io), 0);
+    return 1;
+} /* PHYSFS_sync */
 
 
 static PHYSFS_sint64 doBufferedWrite(PHYSFS_File *handle, const void *buffer,
@@ -2959,7 +7236,7 @@ static PHYSFS_sint64 doBufferedWrite(PHYSFS_File *handle, const void *buffer,
 
     /* would overflow buffer. Flush and then write the new objects, too. */
     BAIL_IF_ERRPASS(!PHYSFS_flush(handle), -1);
-    return fh->io->write(fh->io, buffer, len);
+    return writeFileHandle(fh, buffer, len);
 } /* doBufferedWrite */
 
 
@@ -2993,7 +7270,7 @@ PHYSFS_sint64 PHYSFS_writeBytes(PHYSFS_File *handle, const void *buffer,
     if (fh->buffer)
         return doBufferedWrite(handle, buffer, len);
 
-    return fh->io->write(fh->io, buffer, len);
+    return writeFileHandle(fh, buffer, len);
 } /* PHYSFS_write */
 
 
@@ -3023,7 +7300,9 @@ int PHYSFS_eof(PHYSFS_File *handle)
 PHYSFS_sint64 PHYSFS_tell(PHYSFS_File *handle)
 {
     FileHandle *fh = (FileHandle *) handle;
-    const PHYSFS_sint64 pos = fh->io->tell(fh->io);
+    const PHYSFS_sint64 pos = fh->writeBehind ?
+                              (PHYSFS_sint64) fh->writeBehind->pos :
+                              fh->io->tell(fh->io);
     const PHYSFS_sint64 retval = fh->forReading ?
                                  (pos - fh->buffill) + fh->bufpos :
                                  (pos + fh->buffill);
@@ -3031,7 +7310,7 @@ PHYSFS_sint64 PHYSFS_tell(PHYSFS_File *handle)
 } /* PHYSFS_tell */
 
 
-int PHYSFS_seek(PHYSFS_File *handle, PHYSFS_uint64 pos)
+static int doSeek(PHYSFS_File *handle, PHYSFS_uint64 pos)
 {
     FileHandle *fh = (FileHandle *) handle;
     BAIL_IF_ERRPASS(!PHYSFS_flush(handle), 0);
@@ -3051,15 +7330,51 @@ int PHYSFS_seek(PHYSFS_File *handle, PHYSFS_uint64 pos)
         } /* if */
     } /* if */
 
+    else if (fh->writeBehind)  /* the writer has to be done with the Io. */
+    {
+        waitWriteBehind(fh->writeBehind, 0);
+        BAIL_IF_ERRPASS(!checkWriteBehind(fh->writeBehind), 0);
+        BAIL_IF_ERRPASS(!fh->io->seek(fh->io, pos), 0);
+        fh->writeBehind->pos = pos;
+        return 1;
+    } /* else if */
+
     /* we have to fall back to a 'raw' seek. */
+    if ((fh->bufmin) && (fh->forReading))  /* random access; go smaller. */
+    {
+        fh->bufsize = (fh->bufsize / 2 > fh->bufmin) ? fh->bufsize / 2 : fh->bufmin;
+        fh->bufseeked = 1;
+    } /* if */
     fh->buffill = fh->bufpos = 0;
     return fh->io->seek(fh->io, pos);
+} /* doSeek */
+
+
+int PHYSFS_seek(PHYSFS_File *handle, PHYSFS_uint64 pos)
+{
+    PHYSFS_TraceEvent event;
+    PHYSFS_uint64 started;
+
+    if (traceCallback == NULL)
+        return doSeek(handle, pos);
+
+    initTraceEvent(&event, PHYSFS_TRACE_SEEK, (FileHandle *) handle);
+    event.offset = (PHYSFS_uint64) PHYSFS_tell(handle);
+    event.length = pos;
+    started = __PHYSFS_platformNanoseconds();
+    event.result = doSeek(handle, pos);
+    event.nanoseconds = __PHYSFS_platformNanoseconds() - started;
+    emitTraceEvent(&event);
+    return (int) event.result;
 } /* PHYSFS_seek */
 
 
 PHYSFS_sint64 PHYSFS_fileLength(PHYSFS_File *handle)
 {
-    PHYSFS_Io *io = ((FileHandle *) handle)->io;
+    FileHandle *fh = (FileHandle *) handle;
+    PHYSFS_Io *io = fh->io;
+    if (fh->writeBehind)  /* the writer has to be done with the Io. */
+        waitWriteBehind(fh->writeBehind, 0);
     return io->length(io);
 } /* PHYSFS_filelength */
 
@@ -3105,24 +7420,45 @@ int PHYSFS_setBuffer(PHYSFS_File *handle, PHYSFS_uint64 _bufsize)
         fh->buffer = newbuf;
     } /* else */
 
-    fh->bufsize = bufsize;
+    fh->bufsize = fh->bufcap = bufsize;
+    fh->bufmin = fh->bufmax = 0;  /* not adaptive (anymore). */
     fh->buffill = fh->bufpos = 0;
     return 1;
 } /* PHYSFS_setBuffer */
 
 
+int PHYSFS_setAdaptiveBuffer(PHYSFS_File *handle, PHYSFS_uint64 minsize,
+                             PHYSFS_uint64 maxsize)
+{
+    FileHandle *fh = (FileHandle *) handle;
+
+    BAIL_IF(!fh->forReading, PHYSFS_ERR_OPEN_FOR_WRITING, 0);
+    BAIL_IF((minsize == 0) || (minsize > maxsize), PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF(!__PHYSFS_ui64FitsAddressSpace(maxsize), PHYSFS_ERR_INVALID_ARGUMENT, 0);
+    BAIL_IF_ERRPASS(!PHYSFS_setBuffer(handle, minsize), 0);
+
+    fh->bufmin = (size_t) minsize;
+    fh->bufmax = (size_t) maxsize;
+    fh->bufseeked = 1;  /* don't grow until we've seen some reading. */
+    return 1;
+} /* PHYSFS_setAdaptiveBuffer */
+
+
 int PHYSFS_flush(PHYSFS_File *handle)
 {
     FileHandle *fh = (FileHandle *) handle;
-    PHYSFS_Io *io;
     PHYSFS_sint64 rc;
 
     if ((fh->forReading) || (fh->bufpos == fh->buffill))
-        return 1;  /* open for read or buffer empty are successful no-ops. */
+    {
+        /* open for read or buffer empty are successful no-ops... */
+        if (fh->writeBehind)  /* ...unless a write-behind has failed. */
+            return checkWriteBehind(fh->writeBehind);
+        return 1;
+    } /* if */
 
     /* dump buffer to disk. */
-    io = fh->io;
-    rc = io->write(io, fh->buffer + fh->bufpos, fh->buffill - fh->bufpos);
+    rc = writeFileHandle(fh, fh->buffer + fh->bufpos, fh->buffill - fh->bufpos);
     BAIL_IF_ERRPASS(rc <= 0, 0);
     fh->bufpos = fh->buffill = 0;
     return 1;
@@ -3131,6 +7467,7 @@ int PHYSFS_flush(PHYSFS_File *handle)
 
 int PHYSFS_stat(const char *_fname, PHYSFS_Stat *stat)
 {
+    SearchPathSnapshot *snap;
     int retval = 0;
     char *allocated_fname;
     char *fname;
@@ -3147,11 +7484,16 @@ int PHYSFS_stat(const char *_fname, PHYSFS_Stat *stat)
     stat->filetype = PHYSFS_FILETYPE_OTHER;
     stat->readonly = 1;
 
-    __PHYSFS_platformGrabMutex(stateLock);
-    len = strlen(_fname) + longest_root + 2;
+    snap = grabSearchPath();
+    BAIL_IF_ERRPASS(!snap, 0);
+    len = strlen(_fname) + snap->longest_root + 2;
     allocated_fname = (char *) __PHYSFS_smallAlloc(len);
-    BAIL_IF_MUTEX(!allocated_fname, PHYSFS_ERR_OUT_OF_MEMORY, stateLock, 0);
-    fname = allocated_fname + longest_root + 1;
+    if (!allocated_fname)
+    {
+        releaseSearchPath(snap);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+    fname = allocated_fname + snap->longest_root + 1;
 
     if (sanitizePlatformIndependentPath(_fname, fname))
     {
@@ -3163,11 +7505,19 @@ int PHYSFS_stat(const char *_fname, PHYSFS_Stat *stat)
         } /* if */
         else
         {
-            DirHandle *i;
+            const size_t first = searchPathFirstCandidate(snap, fname);
             int exists = 0;
-            for (i = searchPath; ((i != NULL) && (!exists)); i = i->next)
+            size_t idx;
+            for (idx = 0; (idx < snap->count) && (!exists); idx++)
             {
+                DirHandle *i = snap->dirs[idx];
                 char *arcfname = fname;
+                if (!searchPathCandidate(snap, idx, first))
+                {
+                    PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+                    continue;
+                } /* if */
+
                 exists = partOfMountPoint(i, arcfname);
                 if (exists)
                 {
@@ -3175,17 +7525,22 @@ int PHYSFS_stat(const char *_fname, PHYSFS_Stat *stat)
                     stat->readonly = 1;
                     retval = 1;
                 } /* if */
-                else if (verifyPath(i, &arcfname, 0))
+                else
                 {
-                    retval = i->funcs->stat(i->opaque, arcfname, stat);
-                    if ((retval) || (currentErrorCode() != PHYSFS_ERR_NOT_FOUND))
-                        exists = 1;
-                } /* else if */
+                    __PHYSFS_platformGrabMutex(i->lock);
+                    if (verifySnapshotPath(snap, i, &arcfname))
+                    {
+                        retval = i->funcs->stat(i->opaque, arcfname, stat);
+                        if ((retval) || (currentErrorCode() != PHYSFS_ERR_NOT_FOUND))
+                            exists = 1;
+                    } /* if */
+                    __PHYSFS_platformReleaseMutex(i->lock);
+                } /* else */
             } /* for */
         } /* else */
     } /* if */
 
-    __PHYSFS_platformReleaseMutex(stateLock);
+    releaseSearchPath(snap);
     __PHYSFS_smallFree(allocated_fname);
     return retval;
 } /* PHYSFS_stat */
@@ -3198,6 +7553,71 @@ int __PHYSFS_readAll(PHYSFS_Io *io, void *buf, const size_t _len)
 } /* __PHYSFS_readAll */
 
 
+int __PHYSFS_poolInit(__PHYSFS_Pool *pool, const size_t max)
+{
+    memset(pool, '\0', sizeof (*pool));
+    if (max == 0)
+        return 1;  /* pooling disabled; get and put always miss. */
+
+    pool->blocks = (void **) allocator.Malloc(sizeof (void *) * max);
+    BAIL_IF(!pool->blocks, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    pool->mutex = __PHYSFS_platformCreateMutex();
+    if (!pool->mutex)
+    {
+        allocator.Free(pool->blocks);
+        pool->blocks = NULL;
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+
+    pool->max = max;
+    return 1;
+} /* __PHYSFS_poolInit */
+
+
+void *__PHYSFS_poolGet(__PHYSFS_Pool *pool)
+{
+    void *retval = NULL;
+    if (pool->max > 0)
+    {
+        __PHYSFS_platformGrabMutex(pool->mutex);
+        if (pool->count > 0)
+            retval = pool->blocks[--pool->count];
+        __PHYSFS_platformReleaseMutex(pool->mutex);
+    } /* if */
+    return retval;
+} /* __PHYSFS_poolGet */
+
+
+int __PHYSFS_poolPut(__PHYSFS_Pool *pool, void *block)
+{
+    int retval = 0;
+    if (pool->max > 0)
+    {
+        __PHYSFS_platformGrabMutex(pool->mutex);
+        if (pool->count < pool->max)
+        {
+            pool->blocks[pool->count++] = block;
+            retval = 1;
+        } /* if */
+        __PHYSFS_platformReleaseMutex(pool->mutex);
+    } /* if */
+    return retval;
+} /* __PHYSFS_poolPut */
+
+
+void __PHYSFS_poolDeinit(__PHYSFS_Pool *pool, void (*destroy)(void *block))
+{
+    while (pool->count > 0)
+        destroy(pool->blocks[--pool->count]);
+
+    if (pool->mutex)
+        __PHYSFS_platformDestroyMutex(pool->mutex);
+    if (pool->blocks)
+        allocator.Free(pool->blocks);
+    memset(pool, '\0', sizeof (*pool));
+} /* __PHYSFS_poolDeinit */
+
+
 void *__PHYSFS_initSmallAlloc(void *ptr, const size_t len)
 {
     void *useHeap = ((ptr == NULL) ? ((void *) 1) : ((void *) 0));
@@ -3241,6 +7661,15 @@ int PHYSFS_setAllocator(const PHYSFS_Allocator *a)
 } /* PHYSFS_setAllocator */
 
 
+int PHYSFS_setTraceCallback(PHYSFS_TraceCallback callback, void *data)
+{
+    BAIL_IF(initialized, PHYSFS_ERR_IS_INITIALIZED, 0);
+    traceCallback = callback;
+    traceCallbackData = (callback != NULL) ? data : NULL;
+    return 1;
+} /* PHYSFS_setTraceCallback */
+
+
 const PHYSFS_Allocator *PHYSFS_getAllocator(void)
 {
     BAIL_IF(!initialized, PHYSFS_ERR_NOT_INITIALIZED, NULL);
@@ -3284,7 +7713,14 @@ static void setDefaultAllocator(void)
 } /* setDefaultAllocator */
 
 
-int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int case_sensitive, const int only_usascii)
+/* don't trust an archive's entry count with more than this many buckets. */
+#ifndef PHYSFS_DIRTREE_MAX_INITIAL_BUCKETS
+#define PHYSFS_DIRTREE_MAX_INITIAL_BUCKETS (64 * 1024)
+#endif
+
+int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen,
+                         const int case_sensitive, const int only_usascii,
+                         const PHYSFS_uint64 entrycount)
 {
     static char rootpath[2] = { '/', '\0' };
     size_t alloclen;
@@ -3292,7 +7728,7 @@ int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int
     assert(entrylen >= sizeof (__PHYSFS_DirTreeEntry));
 
     memset(dt, '\0', sizeof (*dt));
-    dt->case_sensitive = case_sensitive;
+    dt->case_sensitive = (case_sensitive && !caseInsensitive);
     dt->only_usascii = only_usascii;
 
     dt->root = (__PHYSFS_DirTreeEntry *) allocator.Malloc(entrylen);
@@ -3300,9 +7736,11 @@ int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int
     memset(dt->root, '\0', entrylen);
     dt->root->name = rootpath;
     dt->root->isdir = 1;
+    /* the hash grows once it has more entries than buckets; skip that. */
     dt->hashBuckets = 64;
-    if (!dt->hashBuckets)
-        dt->hashBuckets = 1;
+    while ((dt->hashBuckets < entrycount) &&
+           (dt->hashBuckets < PHYSFS_DIRTREE_MAX_INITIAL_BUCKETS))
+        dt->hashBuckets *= 2;
     dt->entrylen = entrylen;
 
     alloclen = dt->hashBuckets * sizeof (__PHYSFS_DirTreeEntry *);
@@ -3316,11 +7754,41 @@ int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int
 
 static PHYSFS_uint32 hashPathName(__PHYSFS_DirTree *dt, const char *name)
 {
-    const PHYSFS_uint32 hashval = dt->case_sensitive ? __PHYSFS_hashString(name) : dt->only_usascii ? __PHYSFS_hashStringCaseFoldUSAscii(name) : __PHYSFS_hashStringCaseFold(name);
-    return hashval % dt->hashBuckets;
+    return dt->case_sensitive ? __PHYSFS_hashString(name) : dt->only_usascii ? __PHYSFS_hashStringCaseFoldUSAscii(name) : __PHYSFS_hashStringCaseFold(name);
 } /* hashPathName */
 
 
+/*
+ * DirTree entries and their names are carved out of big blocks, so mounting
+ *  a huge archive isn't one malloc per file, and unmounting just frees a
+ *  handful of blocks. Each block starts with a pointer to the previous one.
+ */
+#define DIRTREE_ARENA_BLOCKSIZE (64 * 1024)
+#define DIRTREE_ARENA_ALIGN(x) (((x) + (sizeof (PHYSFS_uint64) - 1)) & ~((size_t) (sizeof (PHYSFS_uint64) - 1)))
+
+static void *dirTreeArenaAlloc(__PHYSFS_DirTree *dt, size_t len)
+{
+    void *retval;
+
+    len = DIRTREE_ARENA_ALIGN(len);
+    if ((dt->arena == NULL) || ((dt->arenaAvail - dt->arenaUsed) < len))
+    {
+        const size_t hdrlen = DIRTREE_ARENA_ALIGN(sizeof (void *));
+        const size_t blocklen = ((hdrlen + len) > DIRTREE_ARENA_BLOCKSIZE) ? (hdrlen + len) : DIRTREE_ARENA_BLOCKSIZE;
+        void **block = (void **) allocator.Malloc(blocklen);
+        BAIL_IF(!block, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        *block = dt->arena;
+        dt->arena = block;
+        dt->arenaUsed = hdrlen;
+        dt->arenaAvail = blocklen;
+    } /* if */
+
+    retval = ((PHYSFS_uint8 *) dt->arena) + dt->arenaUsed;
+    dt->arenaUsed += len;
+    return retval;
+} /* dirTreeArenaAlloc */
+
+
 /* Fill in missing parent directories. */
 static __PHYSFS_DirTreeEntry *addAncestors(__PHYSFS_DirTree *dt, char *name)
 {
@@ -3330,7 +7798,7 @@ static __PHYSFS_DirTreeEntry *addAncestors(__PHYSFS_DirTree *dt, char *name)
     if (sep)
     {
         *sep = '\0';  /* chop off last piece. */
-        retval = (__PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeFind(dt, name);
+        retval = (__PHYSFS_DirTreeEntry *) dirTreeFind(dt, name, 1);
 
         if (retval != NULL)
         {
@@ -3348,37 +7816,119 @@ static __PHYSFS_DirTreeEntry *addAncestors(__PHYSFS_DirTree *dt, char *name)
 } /* addAncestors */
 
 
+/* Double the hash table once it averages more than one entry per bucket. */
+static void maybeGrowHash(__PHYSFS_DirTree *dt)
+{
+    __PHYSFS_DirTreeEntry **newhash;
+    size_t newbuckets;
+    size_t alloclen;
+    size_t i;
+
+    if (dt->hashEntries <= dt->hashBuckets)
+        return;
+
+    newbuckets = dt->hashBuckets * 2;
+    alloclen = newbuckets * sizeof (__PHYSFS_DirTreeEntry *);
+    newhash = (__PHYSFS_DirTreeEntry **) allocator.Malloc(alloclen);
+    if (!newhash)
+        return;  /* not fatal, lookups just get slower. */
+    memset(newhash, '\0', alloclen);
+
+    for (i = 0; i < dt->hashBuckets; i++)
+    {
+        __PHYSFS_DirTreeEntry *entry;
+        __PHYSFS_DirTreeEntry *next;
+        for (entry = dt->hash[i]; entry; entry = next)
+        {
+            const PHYSFS_uint32 hashval = entry->hash % newbuckets;
+            next = entry->hashnext;
+            entry->hashnext = newhash[hashval];
+            newhash[hashval] = entry;
+        } /* for */
+    } /* for */
+
+    allocator.Free(dt->hash);
+    dt->hash = newhash;
+    dt->hashBuckets = newbuckets;
+} /* maybeGrowHash */
+
+
 void *__PHYSFS_DirTreeAdd(__PHYSFS_DirTree *dt, char *name, const int isdir)
 {
-    __PHYSFS_DirTreeEntry *retval = __PHYSFS_DirTreeFind(dt, name);
+    __PHYSFS_DirTreeEntry *retval = dirTreeFind(dt, name, 1);
     if (!retval)
     {
-        const size_t alloclen = strlen(name) + 1 + dt->entrylen;
+        const char *basename = strrchr(name, '/');
+        size_t alloclen;
         PHYSFS_uint32 hashval;
         __PHYSFS_DirTreeEntry *parent = addAncestors(dt, name);
         BAIL_IF_ERRPASS(!parent, NULL);
+        basename = basename ? basename + 1 : name;
+        alloclen = strlen(basename) + 1 + dt->entrylen;
         assert(dt->entrylen >= sizeof (__PHYSFS_DirTreeEntry));
-        retval = (__PHYSFS_DirTreeEntry *) allocator.Malloc(alloclen);
-        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+        retval = (__PHYSFS_DirTreeEntry *) dirTreeArenaAlloc(dt, alloclen);
+        BAIL_IF_ERRPASS(!retval, NULL);
         memset(retval, '\0', dt->entrylen);
         retval->name = ((char *) retval) + dt->entrylen;
-        strcpy(retval->name, name);
-        hashval = hashPathName(dt, name);
+        strcpy(retval->name, basename);
+        retval->parent = parent;
+        retval->hash = hashPathName(dt, name);
+        hashval = retval->hash % dt->hashBuckets;
         retval->hashnext = dt->hash[hashval];
         dt->hash[hashval] = retval;
         retval->sibling = parent->children;
-        retval->isdir = isdir;
+        retval->isdir = isdir ? 1 : 0;
         parent->children = retval;
+        dt->hashEntries++;
+        maybeGrowHash(dt);
     } /* if */
 
     return retval;
 } /* __PHYSFS_DirTreeAdd */
 
 
-/* Find the __PHYSFS_DirTreeEntry for a path in platform-independent notation. */
-void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path)
+/*
+ * Entries only store the last element of their path, so compare (path)
+ *  against the chain of parents. Returns a pointer just past the part of
+ *  (path) that matched (entry)'s full path, or NULL if it doesn't match.
+ */
+static const char *matchEntryPath(const __PHYSFS_DirTree *dt,
+                                  const __PHYSFS_DirTreeEntry *entry,
+                                  const char *path)
 {
-    const int cs = dt->case_sensitive;
+    const char *name = entry->name;
+
+    if (entry->parent != dt->root)
+    {
+        path = matchEntryPath(dt, entry->parent, path);
+        if ((path == NULL) || (*path != '/'))
+            return NULL;
+        path++;
+    } /* if */
+
+    if (!dt->case_sensitive)
+        return __PHYSFS_utf8stricmpPathElement(name, &path) ? path : NULL;
+
+    while ((*name != '\0') && (*name == *path))
+    {
+        name++;
+        path++;
+    } /* while */
+
+    return ((*name == '\0') && ((*path == '/') || (*path == '\0'))) ? path : NULL;
+} /* matchEntryPath */
+
+
+/*
+ * Find the __PHYSFS_DirTreeEntry for a path in platform-independent notation.
+ *  If (reorder), move it to the front of its hash bucket, which makes
+ *  repeated lookups faster but means (dt) can't be searched by more than
+ *  one thread at a time. Doesn't set an error if (path) isn't there.
+ */
+static void *dirTreeFind(__PHYSFS_DirTree *dt, const char *path,
+                         const int reorder)
+{
+    PHYSFS_uint32 fullhash;
     PHYSFS_uint32 hashval;
     __PHYSFS_DirTreeEntry *prev = NULL;
     __PHYSFS_DirTreeEntry *retval;
@@ -3386,13 +7936,19 @@ void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path)
     if (*path == '\0')
         return dt->root;
 
-    hashval = hashPathName(dt, path);
+    fullhash = hashPathName(dt, path);
+    hashval = fullhash % dt->hashBuckets;
     for (retval = dt->hash[hashval]; retval; retval = retval->hashnext)
     {
-        const int cmp = cs ? strcmp(retval->name, path) : PHYSFS_utf8stricmp(retval->name, path);
-        if (cmp == 0)
+        const char *end;
+        if (retval->hash != fullhash)
+            end = NULL;  /* can't match, don't bother comparing strings. */
+        else
+            end = matchEntryPath(dt, retval, path);
+
+        if ((end != NULL) && (*end == '\0'))
         {
-            if (prev != NULL)  /* move this to the front of the list */
+            if ((reorder) && (prev != NULL))  /* move to front of list. */
             {
                 prev->hashnext = retval->hashnext;
                 retval->hashnext = dt->hash[hashval];
@@ -3405,7 +7961,90 @@ void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path)
         prev = retval;
     } /* for */
 
-    BAIL(PHYSFS_ERR_NOT_FOUND, NULL);
+    return NULL;
+} /* dirTreeFind */
+
+
+void __PHYSFS_DirTreeDefer(__PHYSFS_DirTree *dt, __PHYSFS_DirTreeEntry *entry)
+{
+    assert(entry->isdir);
+    assert(dt->loadDir != NULL);
+    if (!entry->deferred)
+    {
+        entry->deferred = 1;
+        dt->deferredDirs++;
+    } /* if */
+} /* __PHYSFS_DirTreeDefer */
+
+
+int __PHYSFS_DirTreeLoad(__PHYSFS_DirTree *dt, __PHYSFS_DirTreeEntry *entry)
+{
+    if (!entry->deferred)
+        return 1;
+
+    /* not deferred while we load it, or adding its kids would try again. */
+    entry->deferred = 0;
+    dt->deferredDirs--;
+    if (!dt->loadDir(dt, entry))
+    {
+        entry->deferred = 1;
+        dt->deferredDirs++;
+        return 0;
+    } /* if */
+
+    return 1;
+} /* __PHYSFS_DirTreeLoad */
+
+
+/*
+ * Load any deferred dirs on the way from the root down to (path), so
+ *  everything that could hold it is in the hash. Returns zero if one of
+ *  them failed to load.
+ */
+static int dirTreeLoadPath(__PHYSFS_DirTree *dt, const char *path)
+{
+    const size_t len = strlen(path) + 1;
+    __PHYSFS_DirTreeEntry *dir = dt->root;
+    char *buf = (char *) __PHYSFS_smallAlloc(len);
+    char *sep;
+    int retval = 1;
+
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    memcpy(buf, path, len);
+
+    for (sep = buf; (dir != NULL) && (dir->isdir); sep++)
+    {
+        if (!__PHYSFS_DirTreeLoad(dt, dir))
+        {
+            retval = 0;
+            break;
+        } /* if */
+
+        sep = strchr(sep, '/');
+        if (sep == NULL)
+            break;  /* (path) itself is all that's left. */
+
+        *sep = '\0';
+        dir = (__PHYSFS_DirTreeEntry *) dirTreeFind(dt, buf, 1);
+        *sep = '/';
+    } /* for */
+
+    __PHYSFS_smallFree(buf);
+    return retval;
+} /* dirTreeLoadPath */
+
+
+/* Find the __PHYSFS_DirTreeEntry for a path in platform-independent notation. */
+void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path)
+{
+    void *retval = dirTreeFind(dt, path, 1);
+    if ((retval == NULL) && (dt->deferredDirs > 0))
+    {
+        BAIL_IF_ERRPASS(!dirTreeLoadPath(dt, path), NULL);
+        retval = dirTreeFind(dt, path, 1);
+    } /* if */
+    BAIL_IF(!retval, PHYSFS_ERR_NOT_FOUND, NULL);
+    return retval;
 } /* __PHYSFS_DirTreeFind */
 
 PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
@@ -3414,16 +8053,15 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
 {
     PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
     __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) opaque;
-    const __PHYSFS_DirTreeEntry *entry = __PHYSFS_DirTreeFind(tree, dname);
+    __PHYSFS_DirTreeEntry *entry = __PHYSFS_DirTreeFind(tree, dname);
     BAIL_IF(!entry, PHYSFS_ERR_NOT_FOUND, PHYSFS_ENUM_ERROR);
+    BAIL_IF_ERRPASS(!__PHYSFS_DirTreeLoad(tree, entry), PHYSFS_ENUM_ERROR);
 
     entry = entry->children;
 
     while (entry && (retval == PHYSFS_ENUM_OK))
     {
-        const char *name = entry->name;
-        const char *ptr = strrchr(name, '/');
-        retval = cb(callbackdata, origdir, ptr ? ptr + 1 : name);
+        retval = cb(callbackdata, origdir, entry->name);
         BAIL_IF(retval == PHYSFS_ENUM_ERROR, PHYSFS_ERR_APP_CALLBACK, retval);
         entry = entry->sibling;
     } /* while */
@@ -3432,6 +8070,34 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
 } /* __PHYSFS_DirTreeEnumerate */
 
 
+PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerateStat(void *opaque,
+                              const char *dname,
+                              PHYSFS_EnumerateStatCallback cb,
+                              const char *origdir, void *callbackdata)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    __PHYSFS_DirTree *tree = (__PHYSFS_DirTree *) opaque;
+    __PHYSFS_DirTreeEntry *entry = __PHYSFS_DirTreeFind(tree, dname);
+    PHYSFS_Stat statbuf;
+
+    assert(tree->statEntry != NULL);
+    BAIL_IF(!entry, PHYSFS_ERR_NOT_FOUND, PHYSFS_ENUM_ERROR);
+    BAIL_IF_ERRPASS(!__PHYSFS_DirTreeLoad(tree, entry), PHYSFS_ENUM_ERROR);
+
+    entry = entry->children;
+
+    while (entry && (retval == PHYSFS_ENUM_OK))
+    {
+        BAIL_IF_ERRPASS(!tree->statEntry(opaque, entry, &statbuf), PHYSFS_ENUM_ERROR);
+        retval = cb(callbackdata, origdir, entry->name, &statbuf);
+        BAIL_IF(retval == PHYSFS_ENUM_ERROR, PHYSFS_ERR_APP_CALLBACK, retval);
+        entry = entry->sibling;
+    } /* while */
+
+    return retval;
+} /* __PHYSFS_DirTreeEnumerateStat */
+
+
 void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt)
 {
     if (!dt)
@@ -3445,21 +8111,461 @@ void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt)
     } /* if */
 
     if (dt->hash)
+        allocator.Free(dt->hash);
+
+    while (dt->arena)
+    {
+        void *next = *((void **) dt->arena);
+        allocator.Free(dt->arena);
+        dt->arena = next;
+    } /* while */
+} /* __PHYSFS_DirTreeDeinit */
+
+
+/*
+ * Mount index files.
+ *
+ * An index file is a flattened __PHYSFS_DirTree, so the next mount of the
+ *  same archive can skip parsing the archive's own directory. The file
+ *  starts with a DirTreeIndexHeader, then the archive path, then the
+ *  archiver's extra data, then one record per entry in tree order: a
+ *  PHYSFS_uint32 name length, a PHYSFS_uint32 isdir flag, the full path
+ *  (not null-terminated) and the archiver's part of the entry, byte for byte.
+ *
+ * This is all native byte order and struct layout; an index is only trusted
+ *  if it was written by a build with the same layout, for an archive with the
+ *  same path, archiver, size and modification time. Anything else is ignored
+ *  and rewritten. Archivers with pointers in their entries set
+ *  dt->indexEntry, which gets a scratch copy of each entry to clean up
+ *  before it's written, and sees each entry again when an index loads.
+ *
+ * An archiver can also carry the same bytes inside the archive (the ZIP
+ *  archiver looks for one that physfsrepack wrote) and hand them to
+ *  __PHYSFS_DirTreeLoadIndexData(), which skips the path, size and time
+ *  checks; those bytes are archive data, so nothing in them is trusted
+ *  further than the parser and dt->indexEntry check it.
+ */
+#define DIRTREE_INDEX_MAGIC "PHYSFSIX"
+#define DIRTREE_INDEX_VERSION 1
+#define DIRTREE_INDEX_BYTEORDER 0x01020304
+
+/* names tried for a save's temp file; a save that crashes leaves its one. */
+#ifndef PHYSFS_INDEX_TMP_TRIES
+#define PHYSFS_INDEX_TMP_TRIES 16
+#endif
+
+typedef struct
+{
+    char magic[8];
+    PHYSFS_uint32 version;
+    PHYSFS_uint32 byteorder;
+    PHYSFS_uint32 entrylen;
+    PHYSFS_uint32 flags;
+    PHYSFS_uint64 archivelen;
+    PHYSFS_sint64 modtime;
+    PHYSFS_uint64 entrycount;
+    PHYSFS_uint64 totallen;
+    PHYSFS_uint32 pathlen;
+    PHYSFS_uint32 extralen;
+    char archiver[16];
+} DirTreeIndexHeader;
+
+typedef struct
+{
+    PHYSFS_uint32 namelen;
+    PHYSFS_uint32 isdir;
+} DirTreeIndexRecord;
+
+typedef struct
+{
+    PHYSFS_uint8 *buf;
+    size_t len;
+    size_t alloc;
+    char *path;
+    size_t pathalloc;
+    __PHYSFS_DirTreeEntry *scratch;  /* for dt->indexEntry; entrylen bytes. */
+    PHYSFS_uint64 count;
+} DirTreeIndexWriter;
+
+
+/* Fill in everything in a header but the counts; NULL if we can't index. */
+static char *dirTreeIndexPrep(const __PHYSFS_DirTree *dt, const char *arc,
+                              const char *archivePath, PHYSFS_Io *io,
+                              DirTreeIndexHeader *hdr)
+{
+    const char dirsep = __PHYSFS_platformDirSeparator;
+    PHYSFS_Stat statbuf;
+    PHYSFS_sint64 len;
+    char *retval;
+    size_t alloclen;
+
+    /* only trust archives that we know are the actual file on disk. */
+    if ((mountIndexDir == NULL) || ((io->destroy != nativeIo_destroy) &&
+                                    (io->destroy != mappedIo_destroy)))
+        return NULL;
+    else if (dt->deferredDirs > 0)
+        return NULL;  /* we'd only save part of the tree. */
+    else if (strlen(arc) >= sizeof (hdr->archiver))
+        return NULL;
+    else if (!__PHYSFS_platformStat(archivePath, &statbuf, 1))
+        return NULL;
+    else if ((len = io->length(io)) < 0)
+        return NULL;
+
+    memset(hdr, '\0', sizeof (*hdr));
+    memcpy(hdr->magic, DIRTREE_INDEX_MAGIC, sizeof (hdr->magic));
+    hdr->version = DIRTREE_INDEX_VERSION;
+    hdr->byteorder = DIRTREE_INDEX_BYTEORDER;
+    hdr->entrylen = (PHYSFS_uint32) dt->entrylen;
+    hdr->flags = (dt->case_sensitive ? 1 : 0) | (dt->only_usascii ? 2 : 0);
+    hdr->archivelen = (PHYSFS_uint64) len;
+    hdr->modtime = statbuf.modtime;
+    hdr->pathlen = (PHYSFS_uint32) strlen(archivePath);
+    strcpy(hdr->archiver, arc);
+
+    alloclen = strlen(mountIndexDir) + strlen(arc) + 32;
+    retval = (char *) allocator.Malloc(alloclen);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    snprintf(retval, alloclen, "%s%c%s-%08X.idx", mountIndexDir, dirsep, arc,
+             (unsigned int) __PHYSFS_hashString(archivePath));
+    return retval;
+} /* dirTreeIndexPrep */
+
+
+static int dirTreeIndexAppend(DirTreeIndexWriter *w, const void *data,
+                              const size_t len)
+{
+    if ((w->len + len) > w->alloc)
+    {
+        size_t newalloc = w->alloc ? w->alloc : (64 * 1024);
+        void *ptr;
+        while ((w->len + len) > newalloc)
+            newalloc *= 2;
+        ptr = allocator.Realloc(w->buf, newalloc);
+        BAIL_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+        w->buf = (PHYSFS_uint8 *) ptr;
+        w->alloc = newalloc;
+    } /* if */
+
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+    return 1;
+} /* dirTreeIndexAppend */
+
+
+/* Write (dir)'s children, and theirs, after (pathlen) bytes of w->path. */
+static int dirTreeIndexWriteChildren(const __PHYSFS_DirTree *dt,
+                                     DirTreeIndexWriter *w,
+                                     const __PHYSFS_DirTreeEntry *dir,
+                                     const size_t pathlen)
+{
+    const size_t payloadlen = dt->entrylen - sizeof (__PHYSFS_DirTreeEntry);
+    const __PHYSFS_DirTreeEntry **kids;
+    const __PHYSFS_DirTreeEntry *i;
+    size_t total = 0;
+    size_t idx;
+    int retval = 1;
+
+    for (i = dir->children; i != NULL; i = i->sibling)
+        total++;
+
+    if (total == 0)
+        return 1;
+
+    /* children are prepended as they're added, so write them backwards to
+       get the same order back when the index is loaded later. */
+    kids = (const __PHYSFS_DirTreeEntry **) allocator.Malloc(total * sizeof (*kids));
+    BAIL_IF(!kids, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    for (idx = total, i = dir->children; i != NULL; i = i->sibling)
+        kids[--idx] = i;
+
+    for (idx = 0; retval && (idx < total); idx++)
     {
-        size_t i;
-        for (i = 0; i < dt->hashBuckets; i++)
+        const __PHYSFS_DirTreeEntry *entry = kids[idx];
+        const __PHYSFS_DirTreeEntry *saved = entry;
+        const size_t namelen = strlen(entry->name);
+        const size_t sep = (pathlen > 0) ? 1 : 0;
+        const size_t newpathlen = pathlen + sep + namelen;
+        DirTreeIndexRecord rec;
+
+        if (newpathlen >= w->pathalloc)
         {
-            __PHYSFS_DirTreeEntry *entry;
-            __PHYSFS_DirTreeEntry *next;
-            for (entry = dt->hash[i]; entry; entry = next)
-            {
-                next = entry->hashnext;
-                allocator.Free(entry);
-            } /* for */
+            void *ptr = allocator.Realloc(w->path, newpathlen + 256);
+            GOTO_IF(!ptr, PHYSFS_ERR_OUT_OF_MEMORY, writeChildren_failed);
+            w->path = (char *) ptr;
+            w->pathalloc = newpathlen + 256;
+        } /* if */
+
+        if (sep)
+            w->path[pathlen] = '/';
+        memcpy(w->path + pathlen + sep, entry->name, namelen);
+
+        if (dt->indexEntry != NULL)
+        {
+            memcpy(w->scratch, entry, dt->entrylen);
+            GOTO_IF(!dt->indexEntry(w->scratch), PHYSFS_ERR_UNSUPPORTED, writeChildren_failed);
+            saved = w->scratch;
+        } /* if */
+
+        rec.namelen = (PHYSFS_uint32) newpathlen;
+        rec.isdir = entry->isdir ? 1 : 0;
+        retval = dirTreeIndexAppend(w, &rec, sizeof (rec)) &&
+                 dirTreeIndexAppend(w, w->path, newpathlen) &&
+                 dirTreeIndexAppend(w, saved + 1, payloadlen);
+        w->count++;
+
+        if (retval && entry->isdir)
+            retval = dirTreeIndexWriteChildren(dt, w, entry, newpathlen);
+    } /* for */
+
+    allocator.Free((void *) kids);
+    return retval;
+
+writeChildren_failed:
+    allocator.Free((void *) kids);
+    return 0;
+} /* dirTreeIndexWriteChildren */
+
+
+void __PHYSFS_DirTreeSaveIndex(const __PHYSFS_DirTree *dt, const char *arc,
+                               const char *archivePath, PHYSFS_Io *io,
+                               const void *extra, const size_t extralen)
+{
+    DirTreeIndexWriter w;
+    DirTreeIndexHeader hdr;
+    void *out = NULL;
+    char *tmpname = NULL;
+    char *fname;
+    int i;
+
+    fname = dirTreeIndexPrep(dt, arc, archivePath, io, &hdr);
+    if (!fname)
+        return;
+
+    memset(&w, '\0', sizeof (w));
+    hdr.extralen = (PHYSFS_uint32) extralen;
+    if (dt->indexEntry != NULL)
+    {
+        w.scratch = (__PHYSFS_DirTreeEntry *) allocator.Malloc(dt->entrylen);
+        if (!w.scratch)
+        {
+            allocator.Free(fname);
+            return;
+        } /* if */
+    } /* if */
+
+    if ( dirTreeIndexAppend(&w, &hdr, sizeof (hdr)) &&
+         dirTreeIndexAppend(&w, archivePath, hdr.pathlen) &&
+         dirTreeIndexAppend(&w, extra, extralen) &&
+         dirTreeIndexWriteChildren(dt, &w, dt->root, 0) )
+    {
+        /* now that we know the final counts, patch up the header. */
+        DirTreeIndexHeader *final = (DirTreeIndexHeader *) w.buf;
+        final->entrycount = w.count;
+        final->totallen = (PHYSFS_uint64) w.len;
+
+        /* write it beside the real one and rename it over, so a crash, or
+           someone else mounting this right now, never sees half of it. The
+           temp file has to be new: if another thread or process is saving
+           this index too, sharing one would splice the two together. */
+        tmpname = (char *) __PHYSFS_smallAlloc(strlen(fname) + 16);
+        for (i = 0; (tmpname != NULL) && (!out) && (i < PHYSFS_INDEX_TMP_TRIES); i++)
+        {
+            sprintf(tmpname, "%s.tmp%d", fname, i);
+            out = __PHYSFS_platformOpenNew(tmpname);
         } /* for */
-        allocator.Free(dt->hash);
+
+        if (out != NULL)
+        {
+            int ok = (__PHYSFS_platformWrite(out, w.buf, w.len) == ((PHYSFS_sint64) w.len));
+            ok = __PHYSFS_platformFlush(out) && ok;
+            __PHYSFS_platformClose(out);
+            if ((!ok) || (!__PHYSFS_platformRename(tmpname, fname)))
+                __PHYSFS_platformDelete(tmpname);  /* don't leave a partial index. */
+        } /* if */
+
+        __PHYSFS_smallFree(tmpname);
     } /* if */
-} /* __PHYSFS_DirTreeDeinit */
+
+    allocator.Free(w.scratch);
+    allocator.Free(w.buf);
+    allocator.Free(w.path);
+    allocator.Free(fname);
+} /* __PHYSFS_DirTreeSaveIndex */
+
+
+/* (dt) is a fresh tree; on failure, the caller throws it away. */
+static int dirTreeIndexParse(__PHYSFS_DirTree *dt, const PHYSFS_uint8 *buf,
+                             const size_t buflen, void *extra,
+                             const size_t extralen)
+{
+    const DirTreeIndexHeader *hdr = (const DirTreeIndexHeader *) buf;
+    const size_t payloadlen = dt->entrylen - sizeof (__PHYSFS_DirTreeEntry);
+    const PHYSFS_uint8 *ptr = buf + sizeof (*hdr) + hdr->pathlen;
+    const PHYSFS_uint8 *end = buf + buflen;
+    const PHYSFS_uint8 *extraptr;
+    char *name = NULL;
+    size_t namealloc = 0;
+    PHYSFS_uint64 i;
+
+    BAIL_IF(((size_t) (end - ptr)) < extralen, PHYSFS_ERR_CORRUPT, 0);
+    extraptr = ptr;
+    ptr += extralen;
+
+    for (i = 0; i < hdr->entrycount; i++)
+    {
+        DirTreeIndexRecord rec;
+        __PHYSFS_DirTreeEntry *entry;
+
+        GOTO_IF(((size_t) (end - ptr)) < sizeof (rec), PHYSFS_ERR_CORRUPT, parse_failed);
+        memcpy(&rec, ptr, sizeof (rec));
+        ptr += sizeof (rec);
+        GOTO_IF(rec.namelen == 0, PHYSFS_ERR_CORRUPT, parse_failed);
+        GOTO_IF(((size_t) (end - ptr)) < (((size_t) rec.namelen) + payloadlen), PHYSFS_ERR_CORRUPT, parse_failed);
+
+        if (rec.namelen >= namealloc)
+        {
+            void *newname = allocator.Realloc(name, rec.namelen + 256);
+            GOTO_IF(!newname, PHYSFS_ERR_OUT_OF_MEMORY, parse_failed);
+            name = (char *) newname;
+            namealloc = rec.namelen + 256;
+        } /* if */
+
+        memcpy(name, ptr, rec.namelen);
+        name[rec.namelen] = '\0';
+        ptr += rec.namelen;
+
+        entry = (__PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeAdd(dt, name, rec.isdir);
+        GOTO_IF_ERRPASS(!entry, parse_failed);
+        memcpy(entry + 1, ptr, payloadlen);
+        ptr += payloadlen;
+        if ((dt->indexEntry != NULL) && (!dt->indexEntry(entry)))
+            GOTO(PHYSFS_ERR_CORRUPT, parse_failed);
+    } /* for */
+
+    allocator.Free(name);
+    BAIL_IF(ptr != end, PHYSFS_ERR_CORRUPT, 0);
+    memcpy(extra, extraptr, extralen);
+    return 1;
+
+parse_failed:
+    allocator.Free(name);
+    return 0;
+} /* dirTreeIndexParse */
+
+
+/* build into a separate tree, so a bad index leaves (dt) alone. */
+static int dirTreeIndexLoad(__PHYSFS_DirTree *dt, const PHYSFS_uint8 *buf,
+                            const size_t buflen, void *extra,
+                            const size_t extralen)
+{
+    const DirTreeIndexHeader *hdr = (const DirTreeIndexHeader *) buf;
+    __PHYSFS_DirTree tmp;
+
+    if (!__PHYSFS_DirTreeInit(&tmp, dt->entrylen, dt->case_sensitive,
+                              dt->only_usascii, hdr->entrycount))
+        return 0;
+
+    tmp.statEntry = dt->statEntry;
+    tmp.indexEntry = dt->indexEntry;
+    /* keep whatever the archiver already stored in the root. */
+    memcpy(tmp.root + 1, dt->root + 1, dt->entrylen - sizeof (__PHYSFS_DirTreeEntry));
+    if (!dirTreeIndexParse(&tmp, buf, buflen, extra, extralen))
+    {
+        __PHYSFS_DirTreeDeinit(&tmp);
+        return 0;
+    } /* if */
+
+    __PHYSFS_DirTreeDeinit(dt);
+    memcpy(dt, &tmp, sizeof (*dt));
+    return 1;
+} /* dirTreeIndexLoad */
+
+
+int __PHYSFS_DirTreeLoadIndex(__PHYSFS_DirTree *dt, const char *arc,
+                              const char *archivePath, PHYSFS_Io *io,
+                              void *extra, const size_t extralen)
+{
+    DirTreeIndexHeader expected;
+    DirTreeIndexHeader *hdr;
+    PHYSFS_uint8 *buf = NULL;
+    PHYSFS_Io *in = NULL;
+    PHYSFS_sint64 len;
+    char *fname;
+    int retval = 0;
+
+    fname = dirTreeIndexPrep(dt, arc, archivePath, io, &expected);
+    if (!fname)
+        return 0;
+
+    in = __PHYSFS_createNativeIo(fname, 'r');
+    allocator.Free(fname);
+    if (!in)
+        return 0;
+
+    len = in->length(in);
+    if ((len >= (PHYSFS_sint64) sizeof (*hdr)) && (((PHYSFS_uint64) len) <= ((size_t) -1)))
+    {
+        buf = (PHYSFS_uint8 *) allocator.Malloc((size_t) len);
+        if (buf && !__PHYSFS_readAll(in, buf, (size_t) len))
+        {
+            allocator.Free(buf);
+            buf = NULL;
+        } /* if */
+    } /* if */
+    in->destroy(in);
+
+    if (!buf)
+        return 0;
+
+    hdr = (DirTreeIndexHeader *) buf;
+    expected.entrycount = hdr->entrycount;
+    expected.totallen = hdr->totallen;
+    expected.extralen = hdr->extralen;
+
+    if ( (memcmp(hdr, &expected, sizeof (expected)) == 0) &&
+         (hdr->totallen == (PHYSFS_uint64) len) &&
+         (hdr->extralen == extralen) &&
+         (((PHYSFS_uint64) len) >= (sizeof (*hdr) + hdr->pathlen)) &&
+         (memcmp(buf + sizeof (*hdr), archivePath, hdr->pathlen) == 0) )
+    {
+        retval = dirTreeIndexLoad(dt, buf, (size_t) len, extra, extralen);
+    } /* if */
+
+    allocator.Free(buf);
+    return retval;
+} /* __PHYSFS_DirTreeLoadIndex */
+
+
+int __PHYSFS_DirTreeLoadIndexData(__PHYSFS_DirTree *dt, const char *arc,
+                                  const void *buf, const size_t len,
+                                  void *extra, const size_t extralen)
+{
+    const DirTreeIndexHeader *hdr = (const DirTreeIndexHeader *) buf;
+    char archiver[sizeof (hdr->archiver)];
+    const PHYSFS_uint32 flags = (dt->case_sensitive ? 1 : 0) |
+                                (dt->only_usascii ? 2 : 0);
+
+    /* no path, size or mtime to go on here; the caller vouches for those. */
+    if ((len < sizeof (*hdr)) || (strlen(arc) >= sizeof (archiver)))
+        return 0;
+
+    memset(archiver, '\0', sizeof (archiver));
+    strcpy(archiver, arc);
+
+    if ( (memcmp(hdr->magic, DIRTREE_INDEX_MAGIC, sizeof (hdr->magic)) != 0) ||
+         (hdr->version != DIRTREE_INDEX_VERSION) ||
+         (hdr->byteorder != DIRTREE_INDEX_BYTEORDER) ||
+         (hdr->entrylen != (PHYSFS_uint32) dt->entrylen) ||
+         (hdr->flags != flags) ||
+         (memcmp(hdr->archiver, archiver, sizeof (archiver)) != 0) ||
+         (hdr->totallen != (PHYSFS_uint64) len) ||
+         (hdr->extralen != extralen) ||
+         (((PHYSFS_uint64) len) < (sizeof (*hdr) + hdr->pathlen)) )
+        return 0;
+
+    return dirTreeIndexLoad(dt, (const PHYSFS_uint8 *) buf, len, extra, extralen);
+} /* __PHYSFS_DirTreeLoadIndexData */
 
 /* end of physfs.c ... */
 
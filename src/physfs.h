@@ -1475,7 +1475,9 @@ PHYSFS_DECL PHYSFS_sint64 PHYSFS_fileLength(PHYSFS_File *handle);
  *  from this buffer until it is empty, and then refill it for more reading.
  *  Note that compressed files, like ZIP archives, will decompress while
  *  buffering, so this can be handy for offsetting CPU-intensive operations.
- *  The buffer isn't filled until you do your next read.
+ *  The buffer isn't filled until you do your next read. Once whatever is
+ *  already buffered is used up, reads at least as big as the buffer skip it
+ *  and go straight into your memory, since buffering wouldn't save anything.
  *
  * For files opened for writing, data will be buffered to memory until the
  *  buffer is full or the buffer is flushed. Closing a handle implicitly
@@ -1498,6 +1500,7 @@ PHYSFS_DECL PHYSFS_sint64 PHYSFS_fileLength(PHYSFS_File *handle);
  *   \param bufsize size, in bytes, of buffer to allocate.
  *  \return nonzero if successful, zero on error.
  *
+ * \sa PHYSFS_setAdaptiveBuffer
  * \sa PHYSFS_flush
  * \sa PHYSFS_read
  * \sa PHYSFS_write
@@ -2216,6 +2219,10 @@ PHYSFS_DECL int PHYSFS_setAllocator(const PHYSFS_Allocator *allocator);
  *  regardless of the state of PHYSFS_permitSymbolicLinks(). That function
  *  only deals with symlinks inside the mounted directory or archive.
  *
+ * Archive files are memory-mapped where the OS allows it, so don't truncate
+ *  or rewrite one in place while it's mounted; see
+ *  PHYSFS_setMapArchives().
+ *
  *   \param newDir directory or archive to add to the path, in
  *                   platform-dependent notation.
  *   \param mountPoint Location in the interpolated tree that this archive
@@ -3915,6 +3922,1173 @@ PHYSFS_DECL int PHYSFS_setRoot(const char *archive, const char *subdir);
 /* Everything above this line is part of the PhysicsFS 3.1 API. */
 
 
+/**
+ * \fn int PHYSFS_setMountIndexDir(const char *dir)
+ * \brief Cache parsed archive directories on disk, to speed up later mounts.
+ *
+ * Mounting a large archive means reading and parsing its whole table of
+ *  contents (for a .zip, the central directory) every time. If you set a
+ *  mount index directory, archivers that support it will save what they
+ *  parsed to a small index file in there, and the next time the same
+ *  archive is mounted (same path, size and modification time) they will
+ *  load the index instead of parsing the archive again.
+ *
+ * Currently the .zip and ISO9660 archivers use this. Indexes are only used
+ *  for archives that were opened from a real file (PHYSFS_mount(), not
+ *  PHYSFS_mountIo() and friends). An index that doesn't match the archive,
+ *  or was written by a different build of PhysicsFS, is ignored and
+ *  rewritten, so it's always safe to delete the contents of this directory.
+ *
+ * The directory must already exist and be writable; PhysicsFS will not
+ *  create it. Problems reading or writing index files are not reported;
+ *  the archive is just mounted the slow way.
+ *
+ * A .zip can also carry its own index (extras/physfsrepack.c writes one
+ *  with -i), which is used whether or not this is set, and wherever the
+ *  archive is mounted from; only an archive changed since, so its central
+ *  directory no longer matches, is parsed the slow way.
+ *
+ * This is off (NULL) by default.
+ *
+ *    \param dir Directory, in platform-dependent notation, to keep index
+ *               files in, or NULL to stop using indexes.
+ *   \return nonzero on success, zero on failure. Use
+ *           PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_getMountIndexDir
+ * \sa PHYSFS_mount
+ */
+PHYSFS_DECL int PHYSFS_setMountIndexDir(const char *dir);
+
+
+/**
+ * \fn const char *PHYSFS_getMountIndexDir(void)
+ * \brief Get the current mount index directory.
+ *
+ * The string belongs to PhysicsFS; don't free or change it. It's freed by
+ *  the next call to PHYSFS_setMountIndexDir() or PHYSFS_deinit(), so copy
+ *  it if you need it longer, and don't use it while another thread might
+ *  be setting a new directory.
+ *
+ * \return READ ONLY string of the directory set with
+ *         PHYSFS_setMountIndexDir(), in platform-dependent notation, or NULL
+ *         if mount indexes aren't being used.
+ *
+ * \sa PHYSFS_setMountIndexDir
+ */
+PHYSFS_DECL const char *PHYSFS_getMountIndexDir(void);
+
+
+/**
+ * \fn const void *PHYSFS_mapFile(const char *filename, PHYSFS_uint64 *len)
+ * \brief Get a read-only pointer to an entire file's contents.
+ *
+ * This finds (filename) in the search path, the same way PHYSFS_openRead()
+ *  does, and returns a pointer to all of its bytes. When the data is already
+ *  in memory, this is a pointer straight into it, with no copy made: files
+ *  in archives mounted with PHYSFS_mountMemory(), uncompressed (stored)
+ *  files in .zip archives that PhysicsFS was able to memory-map or that live
+ *  in memory, and files from 7zip solid blocks that are already
+ *  decompressed. Otherwise, PhysicsFS allocates a buffer and reads the file
+ *  into it, which is no worse than doing it yourself.
+ *
+ * The data must not be written to. It stays valid until you pass the
+ *  pointer to PHYSFS_unmapFile(). While a zero-copy mapping is outstanding,
+ *  it counts as an open file in its archive, so that archive can't be
+ *  unmounted. PHYSFS_deinit() releases any mappings you haven't. A pointer
+ *  into a memory-mapped archive crashes on touch if the archive is
+ *  truncated under it; PHYSFS_setMapArchives() explains, and how to avoid.
+ *
+ * If the same data is mapped more than once, you may get the same pointer
+ *  more than once; call PHYSFS_unmapFile() once per successful call here.
+ *
+ *    \param filename File to map, in platform-independent notation.
+ *    \param len Filled in with the size of the file in bytes.
+ *   \return A read-only pointer to the file's contents, or NULL on error.
+ *           Use PHYSFS_getLastErrorCode() to obtain the specific error.
+ *           An empty file still gets a non-NULL pointer (with (*len) == 0).
+ *
+ * \sa PHYSFS_unmapFile
+ * \sa PHYSFS_openRead
+ * \sa PHYSFS_setMapArchives
+ */
+PHYSFS_DECL const void *PHYSFS_mapFile(const char *filename,
+                                       PHYSFS_uint64 *len);
+
+
+/**
+ * \fn int PHYSFS_unmapFile(const void *ptr)
+ * \brief Release a pointer returned by PHYSFS_mapFile().
+ *
+ *    \param ptr Pointer returned by PHYSFS_mapFile().
+ *   \return nonzero on success, zero on failure (if (ptr) isn't a current
+ *           mapping). Use PHYSFS_getLastErrorCode() to obtain the specific
+ *           error.
+ *
+ * \sa PHYSFS_mapFile
+ */
+PHYSFS_DECL int PHYSFS_unmapFile(const void *ptr);
+
+
+/**
+ * \fn void PHYSFS_setSearchPathIndexed(int enable)
+ * \brief Keep a merged index of the search path, for faster lookups.
+ *
+ * Normally, finding a file means asking each archive in the search path, in
+ *  order, until one has it, so a file in the last of forty mounted archives
+ *  costs thirty-nine failed lookups first (and a missing file costs forty).
+ *  With this enabled, PhysicsFS lists the contents of every archive once and
+ *  notes which archive comes first for each path. PHYSFS_openRead(),
+ *  PHYSFS_stat(), PHYSFS_exists() and PHYSFS_getRealDir() then go straight
+ *  to the right archive.
+ *
+ * The index is built the first time it's needed after the search path
+ *  changes, so set up your search path before you start loading files.
+ *  Mounting more archives extends the existing index; unmounting one, or a
+ *  call to PHYSFS_setRoot(), means building it again from scratch.
+ *
+ * Directories from the physical filesystem aren't indexed, because their
+ *  contents can change at any time; they're still checked on every lookup,
+ *  in their proper place in the search path. The same goes for any archive
+ *  that can't be listed. Archives from PHYSFS_registerArchiver() are indexed
+ *  like any other, so they must not change their contents while mounted.
+ *
+ * Results are the same either way; this only changes how fast they arrive.
+ *  The index costs memory proportional to the number of files in the search
+ *  path. This is off by default, and turned off again by PHYSFS_deinit().
+ *
+ *   \param enable nonzero to keep an index, zero to stop.
+ *
+ * \sa PHYSFS_isSearchPathIndexed
+ * \sa PHYSFS_mount
+ */
+PHYSFS_DECL void PHYSFS_setSearchPathIndexed(int enable);
+
+
+/**
+ * \fn int PHYSFS_isSearchPathIndexed(void)
+ * \brief Determine if the search path is being indexed.
+ *
+ * This reports the setting from the last call to
+ *  PHYSFS_setSearchPathIndexed(). If it hasn't been called since the library
+ *  was last initialized, indexing is off by default.
+ *
+ *  \return true if the search path is indexed, false otherwise.
+ *
+ * \sa PHYSFS_setSearchPathIndexed
+ */
+PHYSFS_DECL int PHYSFS_isSearchPathIndexed(void);
+
+
+/**
+ * \fn int PHYSFS_mountMultiple(const char * const *newDirs, const char * const *mountPoints, PHYSFS_uint32 count, int appendToPath)
+ * \brief Add several archives or directories to the search path at once.
+ *
+ * This is like calling PHYSFS_mount() for each of (newDirs) in order, but
+ *  the archives are opened and their directories parsed on several threads
+ *  at once, which can make a big difference when there are many archives to
+ *  mount at startup. They are added to the search path together, as one
+ *  block in the order given: if (appendToPath) is zero, newDirs[0] ends up
+ *  first in the search path, followed by newDirs[1], and so on, ahead of
+ *  everything that was there before.
+ *
+ * This is all or nothing. If any item can't be mounted, nothing is added,
+ *  and the error code is the one from the first item (in the order given)
+ *  that failed; mount them one at a time if you need to know which. As with
+ *  PHYSFS_mount(), an item that's already in the search path (or is listed
+ *  more than once) is quietly mounted just once.
+ *
+ * Other threads can't use PhysicsFS while this runs, same as for a single
+ *  PHYSFS_mount(). On platforms without threads, this just does the work on
+ *  the calling thread.
+ *
+ *   \param newDirs array of (count) directories or archives to add, in
+ *                  platform-dependent notation.
+ *   \param mountPoints array of (count) locations in the interpolated tree,
+ *                      one for each of (newDirs). Either this, or any item
+ *                      in it, may be NULL to mean "/".
+ *   \param count number of items in (newDirs) (and (mountPoints)).
+ *   \param appendToPath nonzero to append to search path, zero to prepend.
+ *  \return nonzero if everything was added to the path, zero on failure.
+ *          Use PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_mount
+ */
+PHYSFS_DECL int PHYSFS_mountMultiple(const char * const *newDirs,
+                                     const char * const *mountPoints,
+                                     PHYSFS_uint32 count, int appendToPath);
+
+
+/**
+ * \struct PHYSFS_AsyncRead
+ * \brief A pending read started with PHYSFS_readBytesAsync().
+ *
+ * As with PHYSFS_File, treat this as opaque data. Every one of these you
+ *  get must be passed to PHYSFS_waitAsyncRead() exactly once, which frees
+ *  it.
+ *
+ * \sa PHYSFS_readBytesAsync
+ * \sa PHYSFS_isAsyncReadDone
+ * \sa PHYSFS_waitAsyncRead
+ */
+typedef struct PHYSFS_AsyncRead
+{
+    void *opaque;  /**< That's all you get. Don't touch. */
+} PHYSFS_AsyncRead;
+
+
+/**
+ * \typedef PHYSFS_AsyncReadCallback
+ * \brief Function signature for async read completion callbacks.
+ *
+ * This is called once a read from PHYSFS_readBytesAsync() is finished.
+ *  It runs on one of PhysicsFS's worker threads, not yours, so keep it
+ *  short and be careful what you touch. It may start more async reads, but
+ *  it must not call PHYSFS_waitAsyncRead() on (req); that will never return.
+ *
+ *    \param data User-defined data pointer, passed through from the
+ *                PHYSFS_readBytesAsync() call.
+ *    \param req The request that finished.
+ *    \param buffer The buffer that was read into.
+ *    \param result Number of bytes read, or -1 on failure, just like
+ *                  PHYSFS_readBytes() would return.
+ *
+ * \sa PHYSFS_readBytesAsync
+ */
+typedef void (*PHYSFS_AsyncReadCallback)(void *data, PHYSFS_AsyncRead *req,
+                                         void *buffer, PHYSFS_sint64 result);
+
+
+/**
+ * \fn PHYSFS_AsyncRead *PHYSFS_readBytesAsync(PHYSFS_File *handle, PHYSFS_uint64 offset, void *buffer, PHYSFS_uint64 len, PHYSFS_AsyncReadCallback callback, void *data)
+ * \brief Read data from a PhysicsFS file handle without blocking.
+ *
+ * This starts reading (len) bytes, from (offset) bytes into the file, into
+ *  (buffer), and returns right away. The work (including decompressing, if
+ *  the file is in a compressed archive) is done by a small pool of worker
+ *  threads inside PhysicsFS. When it's finished, (callback) is called, if it
+ *  isn't NULL; you can also check with PHYSFS_isAsyncReadDone(), or block
+ *  until it's done with PHYSFS_waitAsyncRead(), which you must eventually
+ *  do in any case to free the request.
+ *
+ * The read doesn't use or change the file handle's position or buffer, so
+ *  you can keep using (handle) while it runs, start several reads on it at
+ *  once, and even close it. Don't touch (buffer) until the read is done.
+ *
+ * On platforms without threads, the read happens before this returns.
+ *
+ * All async reads have to be waited on before PHYSFS_deinit().
+ *
+ *   \param handle handle returned from PHYSFS_openRead().
+ *   \param offset position in the file to start reading from.
+ *   \param buffer buffer to store read data into. Must stay valid until the
+ *                 read is done.
+ *   \param len number of bytes to read.
+ *   \param callback function to call when the read is done. May be NULL.
+ *   \param data passed to (callback).
+ *  \return a request to wait on, or NULL if the read couldn't be started.
+ *          Use PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_waitAsyncRead
+ * \sa PHYSFS_isAsyncReadDone
+ * \sa PHYSFS_readBytes
+ */
+PHYSFS_DECL PHYSFS_AsyncRead *PHYSFS_readBytesAsync(PHYSFS_File *handle,
+                                            PHYSFS_uint64 offset, void *buffer,
+                                            PHYSFS_uint64 len,
+                                            PHYSFS_AsyncReadCallback callback,
+                                            void *data);
+
+
+/**
+ * \fn int PHYSFS_isAsyncReadDone(PHYSFS_AsyncRead *req)
+ * \brief Check if an async read is finished, without blocking.
+ *
+ * Once this returns non-zero, the data is in the buffer and the callback, if
+ *  any, has returned; PHYSFS_waitAsyncRead() will return immediately.
+ *
+ *   \param req request returned from PHYSFS_readBytesAsync().
+ *  \return non-zero if the read is done, zero if it's still going.
+ *
+ * \sa PHYSFS_waitAsyncRead
+ */
+PHYSFS_DECL int PHYSFS_isAsyncReadDone(PHYSFS_AsyncRead *req);
+
+
+/**
+ * \fn PHYSFS_sint64 PHYSFS_waitAsyncRead(PHYSFS_AsyncRead *req)
+ * \brief Wait for an async read to finish, and free it.
+ *
+ * This blocks until the read is done, then returns the same thing
+ *  PHYSFS_readBytes() would have, and frees (req). Don't use (req) after
+ *  this.
+ *
+ *   \param req request returned from PHYSFS_readBytesAsync().
+ *  \return number of bytes read, which may be less than requested if the
+ *          end of the file was reached. -1 if the read failed; use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_readBytesAsync
+ * \sa PHYSFS_isAsyncReadDone
+ */
+PHYSFS_DECL PHYSFS_sint64 PHYSFS_waitAsyncRead(PHYSFS_AsyncRead *req);
+
+
+/**
+ * \struct PHYSFS_ReadRequest
+ * \brief One file to read with PHYSFS_readFiles().
+ *
+ * Fill in (filename), (buffer) and (len); PHYSFS_readFiles() fills in the
+ *  rest.
+ *
+ * \sa PHYSFS_readFiles
+ */
+typedef struct PHYSFS_ReadRequest
+{
+    const char *filename;  /**< File to read, platform-independent notation. */
+    void *buffer;  /**< Where to put its contents. */
+    PHYSFS_uint64 len;  /**< Size of (buffer); at most this much is read. */
+    PHYSFS_sint64 result;  /**< Set to bytes read, or -1 on failure. */
+    PHYSFS_ErrorCode errcode;  /**< Set to the failure reason, if any. */
+} PHYSFS_ReadRequest;
+
+
+/**
+ * \typedef PHYSFS_ReadFilesCallback
+ * \brief Function signature for PHYSFS_readFiles() progress callbacks.
+ *
+ * This is called once for each item passed to PHYSFS_readFiles(), as soon
+ *  as that item's (result) is set, from the thread that called
+ *  PHYSFS_readFiles(). Items finish in whatever order is fastest to read
+ *  them, not the order they were listed in.
+ *
+ *    \param data User-defined data pointer, passed through from the
+ *                PHYSFS_readFiles() call.
+ *    \param req The item that's finished.
+ *
+ * \sa PHYSFS_readFiles
+ */
+typedef void (*PHYSFS_ReadFilesCallback)(void *data, PHYSFS_ReadRequest *req);
+
+
+/**
+ * \fn int PHYSFS_readFiles(PHYSFS_ReadRequest *reqs, PHYSFS_uint32 count, PHYSFS_ReadFilesCallback callback, void *data)
+ * \brief Read many whole files at once, in the fastest order.
+ *
+ * This is like calling PHYSFS_openRead(), PHYSFS_readBytes() and
+ *  PHYSFS_close() for each item in (reqs), but all the files are found
+ *  first, against the same search path, and then read in the order their
+ *  data actually sits in each archive, so the disk sees mostly forward
+ *  reads. Uncompressed files stored near each other in an archive are read
+ *  with a single larger read. This can be much faster than opening the
+ *  files one at a time, especially on spinning disks or network drives.
+ *
+ * Each item gets up to (len) bytes from the start of its file; (result) is
+ *  set to the number of bytes read (less than (len) if the file is shorter,
+ *  which isn't a failure), or -1 and (errcode) if the file couldn't be
+ *  read. The other items still get read if one fails.
+ *
+ *   \param reqs array of (count) files to read.
+ *   \param count number of items in (reqs).
+ *   \param callback called as each item finishes, in the order they are
+ *                   read. May be NULL.
+ *   \param data passed to (callback).
+ *  \return non-zero if every file was read, zero if any failed. The error
+ *          code is that of the first failed item, in (reqs) order.
+ *
+ * \sa PHYSFS_openRead
+ * \sa PHYSFS_readBytes
+ */
+PHYSFS_DECL int PHYSFS_readFiles(PHYSFS_ReadRequest *reqs,
+                                 PHYSFS_uint32 count,
+                                 PHYSFS_ReadFilesCallback callback,
+                                 void *data);
+
+
+/**
+ * \fn int PHYSFS_prefetch(PHYSFS_File *handle, PHYSFS_uint64 pos, PHYSFS_uint64 len)
+ * \brief Hint that part of an open file is going to be read soon.
+ *
+ * This tells the OS that (len) bytes of (handle), starting at (pos), are
+ *  about to be needed, so it can start pulling them into its cache in the
+ *  background. PhysicsFS works out where that data really is, inside the
+ *  archive file on disk, first. If the file is compressed, the whole
+ *  compressed entry is hinted, since there's no telling which part of it
+ *  holds the requested region.
+ *
+ * This is only advice: it doesn't read anything itself, it doesn't block,
+ *  and on platforms (or archives) where it can't help, it does nothing and
+ *  still succeeds. It doesn't move the file position.
+ *
+ *   \param handle handle returned from PHYSFS_openRead().
+ *   \param pos position in the file where the region starts.
+ *   \param len length of the region, in bytes. It's fine if this goes past
+ *              the end of the file.
+ *  \return nonzero on success, zero on error (such as a bogus handle). Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_prefetchFiles
+ */
+PHYSFS_DECL int PHYSFS_prefetch(PHYSFS_File *handle, PHYSFS_uint64 pos,
+                                PHYSFS_uint64 len);
+
+
+/**
+ * \fn int PHYSFS_prefetchFiles(const char * const *filenames, PHYSFS_uint32 count)
+ * \brief Hint that some files are going to be read soon.
+ *
+ * This is PHYSFS_prefetch() on the whole of each file in (filenames),
+ *  without having to open them. It's handy for warming up the OS's cache
+ *  with the next level's data while the current one is still running.
+ *
+ *   \param filenames array of (count) files, in platform-independent
+ *                    notation.
+ *   \param count number of items in (filenames).
+ *  \return nonzero if every file was found, zero otherwise; the files that
+ *          were found are still hinted. Use PHYSFS_getLastErrorCode() to
+ *          obtain the specific error.
+ *
+ * \sa PHYSFS_prefetch
+ */
+PHYSFS_DECL int PHYSFS_prefetchFiles(const char * const *filenames,
+                                     PHYSFS_uint32 count);
+
+
+/**
+ * \fn int PHYSFS_setAdaptiveBuffer(PHYSFS_File *handle, PHYSFS_uint64 minsize, PHYSFS_uint64 maxsize)
+ * \brief Set up a read buffer that sizes itself to how the file is used.
+ *
+ * This is like PHYSFS_setBuffer(), but the buffer starts at (minsize)
+ *  bytes and changes size as you go: each time you read all the way through
+ *  it, it doubles (up to (maxsize)), so streaming through a file turns into
+ *  fewer, bigger reads. Each time a PHYSFS_seek() goes outside of what's
+ *  buffered, it halves (down to (minsize)), so random access doesn't drag
+ *  in lots of data you'll never look at.
+ *
+ * Calling PHYSFS_setBuffer() on the handle later turns this off again.
+ *  This only works on files opened for reading.
+ *
+ *   \param handle handle returned from PHYSFS_openRead().
+ *   \param minsize smallest the buffer gets, in bytes. Must be > 0.
+ *   \param maxsize biggest the buffer gets, in bytes. Must be >= (minsize).
+ *  \return nonzero if successful, zero on error. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_setBuffer
+ */
+PHYSFS_DECL int PHYSFS_setAdaptiveBuffer(PHYSFS_File *handle,
+                                         PHYSFS_uint64 minsize,
+                                         PHYSFS_uint64 maxsize);
+
+
+/**
+ * \typedef PHYSFS_EnumerateStatCallback
+ * \brief Function signature for callbacks that enumerate and stat files.
+ *
+ * This is PHYSFS_EnumerateCallback, plus the metadata for the file
+ *  reported. (stat) is filled in just like PHYSFS_stat() would fill it
+ *  in for the copy of (fname) in the archive that's being enumerated.
+ *  It is only valid until the callback returns.
+ *
+ *    \param data User-defined data pointer, passed through from the API
+ *                that eventually called the callback.
+ *    \param origdir A string containing the full path, in platform-
+ *                   independent notation, of the directory containing
+ *                   this file.
+ *    \param fname The filename that is being enumerated. It may not be in
+ *                 alphabetical order compared to other callbacks that have
+ *                 fired, and it will not contain the full path.
+ *    \param stat The file's metadata.
+ *   \return A value from PHYSFS_EnumerateCallbackResult.
+ *
+ * \sa PHYSFS_enumerateWithStat
+ * \sa PHYSFS_EnumerateCallback
+ */
+typedef PHYSFS_EnumerateCallbackResult (*PHYSFS_EnumerateStatCallback)(
+                                       void *data, const char *origdir,
+                                       const char *fname,
+                                       const PHYSFS_Stat *stat);
+
+
+/**
+ * \fn int PHYSFS_enumerateWithStat(const char *dir, PHYSFS_EnumerateStatCallback c, void *d)
+ * \brief Enumerate a directory, with each file's metadata.
+ *
+ * This works exactly like PHYSFS_enumerate(), except that the callback
+ *  also gets a PHYSFS_Stat for each file, so there's no need to call
+ *  PHYSFS_stat() on every name afterwards. The metadata comes from the
+ *  same pass over the archive (or the OS's directory listing) that found
+ *  the name, which is much cheaper than looking each file up again.
+ *
+ * As with PHYSFS_enumerate(), a name that is in several archives in the
+ *  search path is reported once for each of them, in search path order.
+ *  The first report for a name is the one PHYSFS_stat() would return.
+ *
+ *    \param dir Directory, in platform-independent notation, to enumerate.
+ *    \param c Callback function to notify about search path elements.
+ *    \param d Application-defined data passed to callback. Can be NULL.
+ *   \return non-zero on success, zero on failure. Use
+ *           PHYSFS_getLastErrorCode() to obtain the specific error. If the
+ *           callback returns PHYSFS_ENUM_STOP to stop early, this will be
+ *           considered success. Callbacks returning PHYSFS_ENUM_ERROR will
+ *           make this function return zero and set the error code to
+ *           PHYSFS_ERR_APP_CALLBACK.
+ *
+ * \sa PHYSFS_enumerate
+ * \sa PHYSFS_stat
+ */
+PHYSFS_DECL int PHYSFS_enumerateWithStat(const char *dir,
+                                         PHYSFS_EnumerateStatCallback c,
+                                         void *d);
+
+
+/**
+ * \fn int PHYSFS_enumerateGlob(const char *pattern, PHYSFS_EnumerateCallback c, void *d)
+ * \brief Find every file in the search path that matches a wildcard pattern.
+ *
+ * (pattern) is a path in platform-independent notation, where each element
+ *  may use wildcards: '*' matches any run of characters (including none)
+ *  and '?' matches any one character, but neither matches a '/'. An
+ *  element that is exactly "**" matches any number of directories,
+ *  including none, so a pattern with the elements "textures", "**" and
+ *  "*.dds" finds every .dds file anywhere under "textures". A trailing
+ *  "**" matches everything below that point.
+ *
+ * This is much faster than walking the tree with PHYSFS_enumerate() and
+ *  filtering the names yourself: each archive is searched in one pass,
+ *  only looking into directories that could hold a match, and most
+ *  archive types can do that without any per-directory lookups at all.
+ *
+ * The callback gets the directory each match is in (the full path, in
+ *  platform-independent notation, without a leading '/'; "" for the root)
+ *  and the match's name. Directories can match, too. Matches come in no
+ *  particular order, and like PHYSFS_enumerate(), a match in several
+ *  archives is reported once for each of them. Archives that are
+ *  case-insensitive for lookups are case-insensitive here, too. Symbolic
+ *  links are never descended into, and aren't reported unless
+ *  PHYSFS_permitSymbolicLinks() allows them.
+ *
+ *    \param pattern What to look for.
+ *    \param c Callback function to notify about each match.
+ *    \param d Application-defined data passed to callback. Can be NULL.
+ *   \return non-zero on success, zero on failure. Use
+ *           PHYSFS_getLastErrorCode() to obtain the specific error. Finding
+ *           no matches is a success. If the callback returns
+ *           PHYSFS_ENUM_STOP to stop early, this will be considered
+ *           success. Callbacks returning PHYSFS_ENUM_ERROR will make this
+ *           function return zero and set the error code to
+ *           PHYSFS_ERR_APP_CALLBACK.
+ *
+ * \sa PHYSFS_enumerate
+ */
+PHYSFS_DECL int PHYSFS_enumerateGlob(const char *pattern,
+                                     PHYSFS_EnumerateCallback c, void *d);
+
+
+/**
+ * \fn void PHYSFS_setCaseInsensitive(int enable)
+ * \brief Look up files without regard to case.
+ *
+ * Content authored on Windows tends to refer to "Textures/Wall.PNG" when the
+ *  file is really "textures/wall.png", which works there and fails on most
+ *  Unix filesystems and in archives like .zip, which are case-sensitive.
+ *  With this enabled, archives and directories mounted (or set as the write
+ *  dir) afterwards match paths case-insensitively, the way Windows does.
+ *
+ * Archives do this by hashing their contents by case-folded name, so lookups
+ *  cost the same as they do otherwise. Directories on the physical
+ *  filesystem try the path as given first; if that isn't found, they read
+ *  each directory along the way once, remember the real names with a
+ *  case-folded index, and use them from then on. New files are found when
+ *  a lookup misses, and names that have since gone away are forgotten.
+ *  Opening a file for writing or appending looks for an existing file with
+ *  the same name in any case, and only creates a new one if there isn't one.
+ *
+ * This is a per-mount setting: changing it doesn't affect anything that's
+ *  already mounted, so you can mix case-sensitive and case-insensitive
+ *  archives in the search path. Mount points themselves (the (mountPoint)
+ *  argument to PHYSFS_mount()) are always case-sensitive.
+ *
+ * Caveats: if an archive or directory has more than one file whose names
+ *  only differ by case, you'll get whichever one it lists first (an exact
+ *  match wins in physical directories), and some archivers will refuse to
+ *  mount such archives at all. Functions like PHYSFS_enumerateFiles() still
+ *  report names with their real case.
+ *
+ * This replaces the PHYSFSEXT_locateCorrectCase() extra in most cases, and
+ *  is much faster. It's off by default, and turned off again by
+ *  PHYSFS_deinit().
+ *
+ *   \param enable nonzero to match case-insensitively, zero to stop.
+ *
+ * \sa PHYSFS_isCaseInsensitive
+ * \sa PHYSFS_mount
+ */
+PHYSFS_DECL void PHYSFS_setCaseInsensitive(int enable);
+
+
+/**
+ * \fn int PHYSFS_isCaseInsensitive(void)
+ * \brief Determine if new mounts will ignore case.
+ *
+ * This reports the setting from the last call to PHYSFS_setCaseInsensitive().
+ *  If it hasn't been called since the library was last initialized, lookups
+ *  are case-sensitive by default (except where the underlying filesystem
+ *  ignores case itself).
+ *
+ *  \return true if new mounts ignore case, false otherwise.
+ *
+ * \sa PHYSFS_setCaseInsensitive
+ */
+PHYSFS_DECL int PHYSFS_isCaseInsensitive(void);
+
+
+/**
+ * \fn void PHYSFS_setDirectoryCaching(int enable)
+ * \brief Remember what's in mounted directories instead of asking the OS.
+ *
+ * Directories from the physical filesystem are normally checked on every
+ *  lookup, since their contents can change at any time. If you mount a
+ *  directory of loose files to override what's in your archives, each file
+ *  you open costs a trip to the OS for that directory, even when (as is
+ *  usually the case) the file isn't there.
+ *
+ * With this enabled, directories mounted afterwards read each subdirectory
+ *  listing once and keep it, along with stat results, so PHYSFS_stat(),
+ *  PHYSFS_exists(), PHYSFS_enumerate() and failed PHYSFS_openRead() calls
+ *  are answered from memory. Opening a file that exists still goes to the
+ *  OS, of course.
+ *
+ * The catch is that changes made to those directories behind PhysicsFS's
+ *  back aren't noticed until you call PHYSFS_refreshDirectoryCaches().
+ *  Changes through PhysicsFS's own write functions (PHYSFS_openWrite(),
+ *  PHYSFS_mkdir(), PHYSFS_delete(), and closing a file opened for writing)
+ *  refresh the caches automatically, in case the write dir is mounted,
+ *  too. A file that's open for writing may report an old size until it's
+ *  closed. The write dir itself is never cached.
+ *
+ * This is a per-mount setting, like PHYSFS_setCaseInsensitive(), and
+ *  doesn't affect anything already mounted. It's off by default, and turned
+ *  off again by PHYSFS_deinit().
+ *
+ *   \param enable nonzero to cache directories mounted from now on, zero to
+ *                 stop.
+ *
+ * \sa PHYSFS_isDirectoryCaching
+ * \sa PHYSFS_refreshDirectoryCaches
+ */
+PHYSFS_DECL void PHYSFS_setDirectoryCaching(int enable);
+
+
+/**
+ * \fn int PHYSFS_isDirectoryCaching(void)
+ * \brief Determine if new directory mounts will be cached.
+ *
+ * This reports the setting from the last call to
+ *  PHYSFS_setDirectoryCaching(). If it hasn't been called since the library
+ *  was last initialized, directories aren't cached by default.
+ *
+ *  \return true if new directory mounts are cached, false otherwise.
+ *
+ * \sa PHYSFS_setDirectoryCaching
+ */
+PHYSFS_DECL int PHYSFS_isDirectoryCaching(void);
+
+
+/**
+ * \fn void PHYSFS_refreshDirectoryCaches(void)
+ * \brief Forget everything cached about mounted directories.
+ *
+ * Call this after something other than PhysicsFS changes a directory that
+ *  was mounted with PHYSFS_setDirectoryCaching() enabled, such as a level
+ *  editor saving new files, or from a file watcher of your own. The next
+ *  lookups in those directories go back to the OS and fill the caches in
+ *  again. This does nothing for mounts that aren't cached.
+ *
+ * \sa PHYSFS_setDirectoryCaching
+ */
+PHYSFS_DECL void PHYSFS_refreshDirectoryCaches(void);
+
+
+/**
+ * \struct PHYSFS_Stats
+ * \brief Performance counters for the whole library or for one archive.
+ *
+ * PHYSFS_getStats() fills this in. Every field counts up from zero since the
+ *  library was initialized (or since the archive was mounted), and nothing
+ *  ever resets them; take two snapshots and subtract to measure a level load
+ *  or a single frame.
+ *
+ * Comparing (bytesRead) against (archiveBytesRead) shows how much extra work
+ *  the archives do for what you ask of them: compressed data, seeking back
+ *  through compressed files, and read-ahead all show up as a difference.
+ *  Only archives PhysicsFS opened itself by filename (and files in mounted
+ *  directories) report (archiveBytesRead); the bytes read from a PHYSFS_Io
+ *  you mounted with PHYSFS_mountIo() aren't counted.
+ *
+ * \sa PHYSFS_getStats
+ */
+typedef struct PHYSFS_Stats
+{
+	PHYSFS_uint64 opens; /**< files successfully opened for reading. */
+	PHYSFS_uint64 failedLookups; /**< times an archive was asked to open a file it didn't have. */
+	PHYSFS_uint64 bytesRead; /**< bytes PHYSFS_readBytes() handed to the app. */
+	PHYSFS_uint64 archiveBytesRead; /**< bytes read from the archive files on disk. */
+	PHYSFS_uint64 inflateBytes; /**< bytes produced by decompressing files. */
+	PHYSFS_uint64 inflateNanoseconds; /**< time spent decompressing them. */
+	PHYSFS_uint64 seekRewinds; /**< seeks back in a compressed file that restarted decompression. */
+	PHYSFS_uint64 bufferRefills; /**< times a PHYSFS_setBuffer() buffer was refilled. */
+	PHYSFS_uint64 lockWaitNanoseconds; /**< time spent waiting for the library's global lock (global totals only). */
+} PHYSFS_Stats;
+
+
+/**
+ * \fn int PHYSFS_getStats(const char *archive, PHYSFS_Stats *stats)
+ * \brief Get performance counters for the library or one archive.
+ *
+ * This lets you find out where file i/o time goes without a profiler: which
+ *  archives get probed for files they don't have, how much decompression
+ *  costs, whether code seeks backwards through compressed files, and if
+ *  threads fight over the library's internal lock.
+ *
+ * Pass NULL for (archive) to get totals for everything since
+ *  PHYSFS_init(), including archives that have since been unmounted. Pass
+ *  the same string you handed to PHYSFS_mount() (as PHYSFS_getSearchPath()
+ *  reports it) to get just that archive's counters, or the write dir's
+ *  path for the write dir. The global totals include every archive's, so
+ *  (failedLookups) there counts each archive that was asked, not each
+ *  failed PHYSFS_openRead().
+ *
+ * The counters are updated without locking, so a snapshot taken while other
+ *  threads are busy may be a little out of date.
+ *
+ * The library can be built without the counters, to shave a little off
+ *  every read. In that case, this always fails with PHYSFS_ERR_UNSUPPORTED.
+ *
+ *   \param archive the archive to report on, or NULL for global totals.
+ *   \param stats the PHYSFS_Stats to fill in.
+ *  \return non-zero on success, zero on failure. On failure, the reason can
+ *          be found by calling PHYSFS_getLastErrorCode().
+ *
+ * \sa PHYSFS_Stats
+ */
+PHYSFS_DECL int PHYSFS_getStats(const char *archive, PHYSFS_Stats *stats);
+
+
+/**
+ * \enum PHYSFS_TraceEventType
+ * \brief What a PHYSFS_TraceEvent is reporting.
+ *
+ * \sa PHYSFS_TraceEvent
+ * \sa PHYSFS_setTraceCallback
+ */
+typedef enum PHYSFS_TraceEventType
+{
+    PHYSFS_TRACE_MOUNT,  /**< PHYSFS_mount() and friends. */
+    PHYSFS_TRACE_UNMOUNT,  /**< PHYSFS_unmount(). */
+    PHYSFS_TRACE_OPEN_READ,  /**< PHYSFS_openRead(). */
+    PHYSFS_TRACE_OPEN_WRITE,  /**< PHYSFS_openWrite(). */
+    PHYSFS_TRACE_OPEN_APPEND,  /**< PHYSFS_openAppend(). */
+    PHYSFS_TRACE_CLOSE,  /**< PHYSFS_close(). */
+    PHYSFS_TRACE_READ,  /**< PHYSFS_readBytes() (and PHYSFS_read()). */
+    PHYSFS_TRACE_SEEK  /**< PHYSFS_seek(). */
+} PHYSFS_TraceEventType;
+
+
+/**
+ * \struct PHYSFS_TraceEvent
+ * \brief One call, as reported to a PHYSFS_TraceCallback.
+ *
+ * Fields that don't apply to an event's (type) are zero (or NULL). The
+ *  strings and (file) are only valid until the callback returns; by then a
+ *  closed file is gone, and so could an unmounted archive's name be.
+ *
+ * For mounts and unmounts, (archive) is the name the app passed in, and
+ *  (filename) is the mount point (NULL for unmounts). For opens, (filename)
+ *  is the path the app asked for, and (archive) is the search path (or
+ *  write dir) entry the file was found in, as PHYSFS_getRealDir() would
+ *  report it; it's NULL if the open failed. Reads, seeks and closes report
+ *  the (archive) their file was opened from.
+ *
+ * \sa PHYSFS_setTraceCallback
+ */
+typedef struct PHYSFS_TraceEvent
+{
+    PHYSFS_TraceEventType type;  /**< what happened. */
+    PHYSFS_File *file;  /**< the file involved; NULL for mounts and failed opens. */
+    const char *filename;  /**< path opened, or mount point. */
+    const char *archive;  /**< archive involved, NULL if none or unknown. */
+    PHYSFS_uint64 offset;  /**< file position a read or seek started at. */
+    PHYSFS_uint64 length;  /**< bytes asked to read, or position to seek to. */
+    PHYSFS_sint64 result;  /**< what the call returned; for opens, non-zero if it worked. */
+    PHYSFS_uint64 nanoseconds;  /**< how long the call took. */
+} PHYSFS_TraceEvent;
+
+
+/**
+ * \typedef PHYSFS_TraceCallback
+ * \brief Function signature for PHYSFS_setTraceCallback().
+ *
+ *   \param data the pointer passed to PHYSFS_setTraceCallback().
+ *   \param event what just happened.
+ *
+ * \sa PHYSFS_setTraceCallback
+ */
+typedef void (*PHYSFS_TraceCallback)(void *data, const PHYSFS_TraceEvent *event);
+
+
+/**
+ * \fn int PHYSFS_setTraceCallback(PHYSFS_TraceCallback callback, void *data)
+ * \brief Hook a function that hears about every open, read, seek and mount.
+ *
+ * (callback) is called after each mount, unmount, open, close, read and seek
+ *  finishes, with the archive it touched, the file offsets and sizes
+ *  involved, and how long it took. Feed that to a profiler, or log it to see
+ *  which files get read in which order, to decide how to lay out your
+ *  archives.
+ *
+ * Like PHYSFS_setAllocator(), this must be called before PHYSFS_init(), and
+ *  the callback stays in place across PHYSFS_deinit() until you change it.
+ *  Pass a NULL callback to stop tracing.
+ *
+ * The callback runs on whatever thread made the call, possibly several at
+ *  once, and no PhysicsFS locks are held while it runs. It can call into
+ *  PhysicsFS (those calls are traced, too), but it should be quick, since
+ *  the caller waits for it. The error
+ *  code that the traced call set is kept, whatever the callback does.
+ *
+ * Reads and seeks are reported per PHYSFS_readBytes() or PHYSFS_seek() call,
+ *  not per read the archive does underneath; see PHYSFS_getStats() for that.
+ *
+ *   \param callback function to report events to, NULL to stop tracing.
+ *   \param data passed to (callback) unchanged.
+ *  \return zero on failure, non-zero on success. This call only fails
+ *          when used between PHYSFS_init() and PHYSFS_deinit().
+ *
+ * \sa PHYSFS_TraceEvent
+ * \sa PHYSFS_getStats
+ */
+PHYSFS_DECL int PHYSFS_setTraceCallback(PHYSFS_TraceCallback callback,
+                                        void *data);
+
+
+/**
+ * \fn void PHYSFS_setVerifyChecksums(int enable)
+ * \brief Check file data against the archive's checksums as it's read.
+ *
+ * Archives like ZIP store a CRC-32 of each file, but normally nothing checks
+ *  it, so a damaged archive just hands back damaged data. With this enabled,
+ *  files opened afterwards keep a running CRC-32 of everything they hand
+ *  back, and the read that reaches the end of the file fails with
+ *  PHYSFS_ERR_CORRUPT if it doesn't match. That read's bytes are still in
+ *  your buffer; don't trust them. Every read of that handle after that
+ *  fails the same way, even after a seek. Small compressed files in a ZIP
+ *  are decompressed completely when opened, so for those PHYSFS_openRead()
+ *  itself fails.
+ *
+ * Some calls hand out a file's data without reading it through PhysicsFS:
+ *  PHYSFS_mapFile() and PHYSFS_getNativeRange() on an uncompressed entry,
+ *  and PHYSFS_readFiles() and PHYSFS_readBytesAsync() when they'd have the
+ *  OS read it directly. For files opened with this on, those check the
+ *  whole entry the first time, and remember that it passed for as long as
+ *  the archive is mounted. PHYSFS_mapFile() then reports a bad one the way
+ *  a read would, and PHYSFS_getNativeRange() fails with PHYSFS_ERR_CORRUPT;
+ *  the other two just read it the usual way. Files that were decompressed
+ *  and cached before this was turned on are checked when next opened.
+ *
+ * The CRC uses the CPU's own instructions for it where there are any, and
+ *  costs little next to decompression, so it's reasonable to leave on.
+ *
+ * Only a file that's read from start to end is checked; one that's seeked
+ *  around in an uncompressed entry, or closed before its end, isn't. Seeks
+ *  in compressed entries are fine, since those decompress everything up to
+ *  the new position anyhow. Archive types that have no checksums ignore
+ *  this.
+ *
+ * This is a per-file setting, decided when each file is opened. It's off by
+ *  default, and turned off again by PHYSFS_deinit().
+ *
+ *   \param enable nonzero to check files opened from now on, zero to stop.
+ *
+ * \sa PHYSFS_isVerifyingChecksums
+ */
+PHYSFS_DECL void PHYSFS_setVerifyChecksums(int enable);
+
+
+/**
+ * \fn int PHYSFS_isVerifyingChecksums(void)
+ * \brief Determine if newly opened files will be checked against checksums.
+ *
+ * This reports the setting from the last call to
+ *  PHYSFS_setVerifyChecksums(). If it hasn't been called since the library
+ *  was last initialized, files aren't checked by default.
+ *
+ *  \return true if files opened from now on are checked, false otherwise.
+ *
+ * \sa PHYSFS_setVerifyChecksums
+ */
+PHYSFS_DECL int PHYSFS_isVerifyingChecksums(void);
+
+
+/**
+ * \fn int PHYSFS_setWriteBehind(PHYSFS_File *handle, PHYSFS_uint64 maxqueued)
+ * \brief Have a background thread write a file's data out.
+ *
+ * Normally, writing to a file (or flushing its buffer, see
+ *  PHYSFS_setBuffer()) waits for the data to reach the operating system,
+ *  and PHYSFS_close() waits for it to reach the disk. With write-behind,
+ *  the data is copied into a queue and the call returns; one background
+ *  thread writes queued data out in order, for every file that uses it.
+ *  PHYSFS_close() just queues whatever is left and returns; the file is
+ *  flushed to disk and closed in the background.
+ *
+ * At most (maxqueued) bytes of a file's data are queued at once; a write
+ *  that would go over waits until the thread catches up, so a slow disk
+ *  can't use up all your memory. Closing the file doesn't wait, so it can
+ *  go over by up to one buffer's worth. A buffer (see PHYSFS_setBuffer())
+ *  is still a good idea, so each little write isn't queued separately.
+ *
+ * Use PHYSFS_sync() to wait until everything is written and flushed to
+ *  disk, and to find out for sure that it worked. If a background write
+ *  fails, nothing else is written to the file, and the next write that
+ *  reaches the queue, PHYSFS_flush(), PHYSFS_seek(), PHYSFS_sync() or
+ *  PHYSFS_close() fails with the error. PHYSFS_close() still closes the
+ *  file in that case. Errors flushing in the background after
+ *  PHYSFS_close() has returned can't be reported at all, so sync first if
+ *  you need to know.
+ *
+ * PHYSFS_seek() and PHYSFS_fileLength() wait for the queue to empty, so
+ *  they're only fast on files that don't use write-behind.
+ *
+ * PHYSFS_deinit() waits for all queued data to be written.
+ *
+ *   \param handle handle returned from PHYSFS_openWrite() or
+ *                 PHYSFS_openAppend().
+ *   \param maxqueued most bytes to queue for this file at once, or zero to
+ *                    wait for the queue to empty and stop using
+ *                    write-behind.
+ *  \return non-zero if successful, zero on error. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error; it's
+ *          PHYSFS_ERR_UNSUPPORTED if the background thread couldn't be
+ *          started (writes keep happening in your thread, then).
+ *
+ * \sa PHYSFS_sync
+ * \sa PHYSFS_setBuffer
+ */
+PHYSFS_DECL int PHYSFS_setWriteBehind(PHYSFS_File *handle,
+                                      PHYSFS_uint64 maxqueued);
+
+
+/**
+ * \fn int PHYSFS_sync(PHYSFS_File *handle)
+ * \brief Wait until everything written to a file is on the disk.
+ *
+ * This flushes the file's buffer, waits for any write-behind queue (see
+ *  PHYSFS_setWriteBehind()) to empty, then has the operating system write
+ *  its own caches out to disk, as PHYSFS_close() does.
+ *
+ *   \param handle handle returned from PHYSFS_openWrite() or
+ *                 PHYSFS_openAppend().
+ *  \return non-zero if everything is safely written, zero on error. Use
+ *          PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_setWriteBehind
+ * \sa PHYSFS_flush
+ */
+PHYSFS_DECL int PHYSFS_sync(PHYSFS_File *handle);
+
+
+/**
+ * \fn void PHYSFS_setResolveOnMount(int enable)
+ * \brief Do the archive's per-file setup while mounting, not on first open.
+ *
+ * Some archives need extra work the first time each file is opened. A .zip,
+ *  for example, keeps a second small header in front of every file's data,
+ *  and the real start of the data isn't known until it's been read. That's
+ *  a seek and a read, on the first open of every file, which is usually
+ *  when you least want it.
+ *
+ * With this enabled, archives mounted afterwards do that for all their
+ *  files while mounting, in one pass through the archive in file order, so
+ *  the first open of a file costs the same as any other. Mounting takes
+ *  longer, more so for archives of many files on slow media. If
+ *  PHYSFS_setMountIndexDir() is in use, the results go in the index, and
+ *  later mounts of the same archive don't have to do the pass at all.
+ *
+ * A file that turns out to be damaged doesn't fail the mount; opening it
+ *  fails, just as it would have without this. Currently only the .zip
+ *  archiver does anything with this, and symlinks in it are still resolved
+ *  when they're first used.
+ *
+ * This is off by default, and turned off again by PHYSFS_deinit().
+ *
+ *   \param enable nonzero to resolve files in archives mounted from now on,
+ *                 zero to leave it until they're opened.
+ *
+ * \sa PHYSFS_isResolvingOnMount
+ * \sa PHYSFS_setMountIndexDir
+ */
+PHYSFS_DECL void PHYSFS_setResolveOnMount(int enable);
+
+
+/**
+ * \fn int PHYSFS_isResolvingOnMount(void)
+ * \brief Determine if archives are resolved when they're mounted.
+ *
+ * This reports the setting from the last call to
+ *  PHYSFS_setResolveOnMount(). If it hasn't been called since the library
+ *  was last initialized, files are resolved when first opened.
+ *
+ *  \return true if archives mounted from now on are resolved while
+ *          mounting, false otherwise.
+ *
+ * \sa PHYSFS_setResolveOnMount
+ */
+PHYSFS_DECL int PHYSFS_isResolvingOnMount(void);
+
+
+/**
+ * \fn void PHYSFS_setMapArchives(int enable)
+ * \brief Choose whether archives on disk are memory-mapped when mounted.
+ *
+ * An archive file mounted for reading is normally memory-mapped, where the
+ *  OS allows it, so reads are a copy out of the page cache instead of a
+ *  system call each. The catch: if something truncates the archive while
+ *  it's mounted, touching the part that's gone doesn't fail like a read()
+ *  would. The OS kills your program instead: SIGBUS on Unix-like systems.
+ *  Windows won't let a mapped file be truncated, but a file on a network
+ *  share that goes away raises EXCEPTION_IN_PAGE_ERROR just the same. Bytes
+ *  rewritten in place show up in reads, half-written or not. The same goes
+ *  for the pointers PHYSFS_mapFile() hands out. Replacing the file with a
+ *  new one (writing a new file and renaming it over the old, as most
+ *  installers and updaters do) is fine on Unix-like systems; the mapping
+ *  keeps the old one.
+ *
+ * If your archives might be changed that way while you're using them (mods
+ *  a user drops in, or files on a network share), turn this off before
+ *  mounting them. They're read with normal file reads instead, and a
+ *  truncated archive just makes reads come up short or fail.
+ *
+ * This is on by default, and turned back on by PHYSFS_deinit(). It only
+ *  affects archives mounted after it's called.
+ *
+ *   \param enable nonzero to map archives mounted from now on, zero to read
+ *                 them with plain file reads.
+ *
+ * \sa PHYSFS_isMappingArchives
+ * \sa PHYSFS_mount
+ * \sa PHYSFS_mapFile
+ */
+PHYSFS_DECL void PHYSFS_setMapArchives(int enable);
+
+
+/**
+ * \fn int PHYSFS_isMappingArchives(void)
+ * \brief Determine if archives are memory-mapped when they're mounted.
+ *
+ * This reports the setting from the last call to PHYSFS_setMapArchives().
+ *  If it hasn't been called since the library was last initialized,
+ *  archives are mapped.
+ *
+ *  \return true if archives mounted from now on are memory-mapped where
+ *          possible, false otherwise.
+ *
+ * \sa PHYSFS_setMapArchives
+ */
+PHYSFS_DECL int PHYSFS_isMappingArchives(void);
+
+
+/**
+ * \fn int PHYSFS_getNativeRange(PHYSFS_File *handle, PHYSFS_sint64 *oshandle, PHYSFS_uint64 *offset, PHYSFS_uint64 *len)
+ * \brief Find where a file's bytes sit, verbatim, in a file the OS knows.
+ *
+ * Files in a real directory, and uncompressed (stored) files in a .zip and
+ *  other archives that keep files as plain spans, are just a run of bytes
+ *  in an OS file. This tells you which OS file and where, so you can hand
+ *  the data to the OS directly: sendfile() to a socket, for example, or
+ *  TransmitFile() on Windows, without the bytes ever passing through your
+ *  program.
+ *
+ * (*oshandle) is the OS's own handle for the file: the file descriptor on
+ *  Unix-like systems, or the HANDLE, cast to an integer, on Windows. It
+ *  belongs to PhysicsFS and is shared with its own reads. Only use it for
+ *  reads that take an explicit offset (pread(), or sendfile() with an
+ *  offset pointer); never close it, seek it, or change its flags. It stays
+ *  valid as long as (handle) is open.
+ *
+ * The file's contents are the (*len) bytes starting at (*offset) in that OS
+ *  file. This has nothing to do with (handle)'s own position, which isn't
+ *  changed. Reading the data this way skips PhysicsFS entirely, so if
+ *  (handle) was opened with PHYSFS_setVerifyChecksums() on, this reads and
+ *  checks the whole file first (once per mount), and fails with
+ *  PHYSFS_ERR_CORRUPT if it's bad.
+ *
+ * This fails with PHYSFS_ERR_UNSUPPORTED for files whose bytes aren't
+ *  stored verbatim in an OS file: compressed or encrypted entries, and
+ *  archives mounted from memory or an app's PHYSFS_Io. Read those the usual
+ *  way.
+ *
+ *    \param handle A file opened with PHYSFS_openRead().
+ *    \param oshandle Filled in with the OS handle of the file holding the
+ *                    data.
+ *    \param offset Filled in with where the data starts in that file.
+ *    \param len Filled in with the length of the data, in bytes.
+ *   \return nonzero on success, zero on failure (see above). Use
+ *           PHYSFS_getLastErrorCode() to obtain the specific error.
+ *
+ * \sa PHYSFS_mapFile
+ */
+PHYSFS_DECL int PHYSFS_getNativeRange(PHYSFS_File *handle,
+                                      PHYSFS_sint64 *oshandle,
+                                      PHYSFS_uint64 *offset,
+                                      PHYSFS_uint64 *len);
+
+
+/**
+ * \fn int PHYSFS_mountPreload(const char *newDir, const char *mountPoint, int appendToPath)
+ * \brief Mount an archive now, and pull it into memory in the background.
+ *
+ * This works like PHYSFS_mount(), and returns as quickly, reading the archive
+ *  from disk like any other. Meanwhile, a background thread reads the whole
+ *  archive into memory (or, where the OS allows it, locks its memory mapping
+ *  in place). Once that's done, every file opened from the archive, whether
+ *  it was opened before or after, reads from RAM, with no system calls and
+ *  no trips to the disk. This is meant for small, hot archives (the UI, for
+ *  example) that you'd otherwise have to load up front with
+ *  PHYSFS_mountMemory(), blocking startup to do it.
+ *
+ * Preloading is best effort. It's skipped, and the archive just stays on
+ *  disk, if there's no memory for it, the background thread can't be
+ *  started, or (newDir) is a directory instead of an archive. The mount
+ *  fails or succeeds just as PHYSFS_mount() would. All
+ *  preloads share one thread, and are done in the order they were asked for.
+ *
+ * The memory is released when the archive is unmounted and the last file
+ *  opened from it is closed. PHYSFS_deinit() abandons preloads it interrupts.
+ *  Mounting something that's already in the search path does nothing, just
+ *  like PHYSFS_mount(), and doesn't preload it.
+ *
+ *   \param newDir directory or archive to add to the path, in
+ *                   platform-dependent notation.
+ *   \param mountPoint Location in the interpolated tree that this archive
+ *                     will be "mounted", in platform-independent notation.
+ *                     NULL or "" is equivalent to "/".
+ *   \param appendToPath nonzero to append to search path, zero to prepend.
+ *  \return nonzero if added to path, zero on failure (bogus archive, dir
+ *          missing, etc). Use PHYSFS_getLastErrorCode() to obtain
+ *          the specific error.
+ *
+ * \sa PHYSFS_mount
+ * \sa PHYSFS_mountMemory
+ */
+PHYSFS_DECL int PHYSFS_mountPreload(const char *newDir,
+                                    const char *mountPoint,
+                                    int appendToPath);
+
+
+/* Everything above this line is part of the PhysicsFS 3.3 API. */
+
+
 #ifdef __cplusplus
 }
 #endif
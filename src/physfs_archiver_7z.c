@@ -13,6 +13,28 @@
 
 #include "physfs_lzmasdk.h"
 
+/*
+ * Decoded solid blocks are kept around so opening several files from the
+ *  same block only decompresses it once. SZIP_BLOCKCACHE_COUNT is how many
+ *  blocks each archive keeps; blocks larger than SZIP_BLOCKCACHE_MAXBLOCK
+ *  bytes are never cached (but are still shared by the file that forced
+ *  the decode and its duplicates).
+ */
+#ifndef SZIP_BLOCKCACHE_COUNT
+#define SZIP_BLOCKCACHE_COUNT 2
+#endif
+
+#ifndef SZIP_BLOCKCACHE_MAXBLOCK
+#define SZIP_BLOCKCACHE_MAXBLOCK (128 * 1024 * 1024)
+#endif
+
+#if SZIP_BLOCKCACHE_COUNT < 1
+#undef SZIP_BLOCKCACHE_COUNT
+#define SZIP_BLOCKCACHE_COUNT 1
+#undef SZIP_BLOCKCACHE_MAXBLOCK
+#define SZIP_BLOCKCACHE_MAXBLOCK 0
+#endif
+
 typedef struct
 {
     ISeekInStream seekStream; /* lzma sdk i/o interface (lower level).  */
@@ -27,14 +49,33 @@ typedef struct
     PHYSFS_uint32 dbidx;          /* index into lzma sdk database   */
 } SZIPentry;
 
+/* A decompressed solid block, shared by every open file inside it. */
+typedef struct
+{
+    UInt32 blockIndex;        /* lzma sdk folder index.                 */
+    Byte *buf;                /* decompressed block (SZIP_SzAlloc).     */
+    size_t len;               /* size of buf in bytes.                  */
+    int refcount;             /* cache slot plus each open PHYSFS_Io.   */
+} SZIPblock;
+
 /* One SZIPinfo is kept for each open 7zip archive. */
 typedef struct
 {
     __PHYSFS_DirTree tree;    /* manages directory tree.           */
     PHYSFS_Io *io;            /* physfs i/o interface for this archive. */
     CSzArEx db;               /* lzma sdk archive database object. */
+    SZIPblock *blockcache[SZIP_BLOCKCACHE_COUNT];  /* most recent first. */
 } SZIPinfo;
 
+/* One SZIPfileinfo is kept for each open file in a 7zip archive. */
+typedef struct
+{
+    SZIPblock *block;         /* block holding our data (NULL if empty). */
+    const Byte *buf;          /* start of this file inside block->buf.   */
+    PHYSFS_uint64 len;        /* size of this file in bytes.             */
+    PHYSFS_uint64 pos;        /* current read position.                  */
+} SZIPfileinfo;
+
 
 static PHYSFS_ErrorCode szipErrorCode(const SRes rc)
 {
@@ -76,6 +117,183 @@ static ISzAlloc SZIP_SzAlloc = {
 };
 
 
+static void szipReleaseBlock(SZIPblock *block)
+{
+    if ((block != NULL) && (__PHYSFS_ATOMIC_DECR(&block->refcount) == 0))
+    {
+        SZIP_SzAlloc.Free(&SZIP_SzAlloc, block->buf);
+        allocator.Free(block);
+    } /* if */
+} /* szipReleaseBlock */
+
+
+/* PHYSFS_Io implementation for files, reading straight out of the block. */
+
+static PHYSFS_sint64 SZIP_read(PHYSFS_Io *io, void *buf, PHYSFS_uint64 len)
+{
+    SZIPfileinfo *finfo = (SZIPfileinfo *) io->opaque;
+    const PHYSFS_uint64 avail = finfo->len - finfo->pos;
+
+    if (len > avail)
+        len = avail;
+
+    if (len > 0)
+    {
+        memcpy(buf, finfo->buf + finfo->pos, (size_t) len);
+        finfo->pos += len;
+    } /* if */
+
+    return (PHYSFS_sint64) len;
+} /* SZIP_read */
+
+
+static PHYSFS_sint64 SZIP_write(PHYSFS_Io *io, const void *b, PHYSFS_uint64 len)
+{
+    BAIL(PHYSFS_ERR_READ_ONLY, -1);
+} /* SZIP_write */
+
+
+static int SZIP_seek(PHYSFS_Io *io, PHYSFS_uint64 offset)
+{
+    SZIPfileinfo *finfo = (SZIPfileinfo *) io->opaque;
+    BAIL_IF(offset > finfo->len, PHYSFS_ERR_PAST_EOF, 0);
+    finfo->pos = offset;
+    return 1;
+} /* SZIP_seek */
+
+
+static PHYSFS_sint64 SZIP_tell(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPfileinfo *) io->opaque)->pos;
+} /* SZIP_tell */
+
+
+static PHYSFS_sint64 SZIP_length(PHYSFS_Io *io)
+{
+    return (PHYSFS_sint64) ((SZIPfileinfo *) io->opaque)->len;
+} /* SZIP_length */
+
+
+static PHYSFS_Io *szipCreateFileIo(SZIPblock *block, const Byte *buf,
+                                   const PHYSFS_uint64 len);
+
+static PHYSFS_Io *SZIP_duplicate(PHYSFS_Io *io)
+{
+    SZIPfileinfo *finfo = (SZIPfileinfo *) io->opaque;
+    return szipCreateFileIo(finfo->block, finfo->buf, finfo->len);
+} /* SZIP_duplicate */
+
+
+static int SZIP_flush(PHYSFS_Io *io) { return 1;  /* it's read-only. */ }
+
+
+static void SZIP_destroy(PHYSFS_Io *io)
+{
+    SZIPfileinfo *finfo = (SZIPfileinfo *) io->opaque;
+    szipReleaseBlock(finfo->block);
+    allocator.Free(finfo);
+    allocator.Free(io);
+} /* SZIP_destroy */
+
+
+static const PHYSFS_Io SZIP_Io =
+{
+    CURRENT_PHYSFS_IO_API_VERSION, NULL,
+    SZIP_read,
+    SZIP_write,
+    SZIP_seek,
+    SZIP_tell,
+    SZIP_length,
+    SZIP_duplicate,
+    SZIP_flush,
+    SZIP_destroy
+};
+
+
+const void *SZIP_getIoBuffer(PHYSFS_Io *io, PHYSFS_uint64 *len)
+{
+    const SZIPfileinfo *finfo;
+
+    if (io->destroy != SZIP_destroy)
+        return NULL;
+
+    finfo = (const SZIPfileinfo *) io->opaque;
+    if (finfo->buf == NULL)  /* empty file. */
+        return NULL;
+
+    *len = finfo->len;
+    return finfo->buf;
+} /* SZIP_getIoBuffer */
+
+
+/* takes a new reference to (block) on success. */
+static PHYSFS_Io *szipCreateFileIo(SZIPblock *block, const Byte *buf,
+                                   const PHYSFS_uint64 len)
+{
+    PHYSFS_Io *retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
+    SZIPfileinfo *finfo = (SZIPfileinfo *) allocator.Malloc(sizeof (SZIPfileinfo));
+
+    if (!retval || !finfo)
+    {
+        if (retval)
+            allocator.Free(retval);
+        if (finfo)
+            allocator.Free(finfo);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* if */
+
+    if (block != NULL)
+        (void) __PHYSFS_ATOMIC_INCR(&block->refcount);
+
+    finfo->block = block;
+    finfo->buf = buf;
+    finfo->len = len;
+    finfo->pos = 0;
+
+    memcpy(retval, &SZIP_Io, sizeof (*retval));
+    retval->opaque = finfo;
+    return retval;
+} /* szipCreateFileIo */
+
+
+/* returns the cached block (moved to the front), or NULL if not cached. */
+static SZIPblock *szipFindCachedBlock(SZIPinfo *info, const UInt32 blockIndex)
+{
+    SZIPblock **cache = info->blockcache;
+    int i;
+
+    for (i = 0; i < SZIP_BLOCKCACHE_COUNT; i++)
+    {
+        SZIPblock *block = cache[i];
+        if (block == NULL)
+            break;
+        else if (block->blockIndex == blockIndex)
+        {
+            memmove(&cache[1], &cache[0], i * sizeof (SZIPblock *));
+            cache[0] = block;
+            return block;
+        } /* else if */
+    } /* for */
+
+    return NULL;
+} /* szipFindCachedBlock */
+
+
+static void szipCacheBlock(SZIPinfo *info, SZIPblock *block)
+{
+    SZIPblock **cache = info->blockcache;
+
+    if (block->len > SZIP_BLOCKCACHE_MAXBLOCK)
+        return;
+
+    szipReleaseBlock(cache[SZIP_BLOCKCACHE_COUNT - 1]);
+    memmove(&cache[1], &cache[0], (SZIP_BLOCKCACHE_COUNT - 1) * sizeof (SZIPblock *));
+    (void) __PHYSFS_ATOMIC_INCR(&block->refcount);
+    cache[0] = block;
+} /* szipCacheBlock */
+
+
+
 /* we implement ISeekInStream, and then wrap that in LZMA SDK's CLookToRead,
    which implements the higher-level ILookInStream on top of that, handling
    buffering and such for us. */
@@ -181,14 +399,63 @@ static int szipLoadEntry(SZIPinfo *info, const PHYSFS_uint32 idx)
 } /* szipLoadEntry */
 
 
+static inline PHYSFS_uint64 lzmasdkTimeToPhysfsTime(const CNtfsFileTime *t)
+{
+    const PHYSFS_uint64 winEpochToUnixEpoch = __PHYSFS_UI64(0x019DB1DED53E8000);
+    const PHYSFS_uint64 nanosecToMillisec = __PHYSFS_UI64(10000000);
+    const PHYSFS_uint64 quad = (((PHYSFS_uint64) t->High) << 32) | t->Low;
+    return (quad - winEpochToUnixEpoch) / nanosecToMillisec;
+} /* lzmasdkTimeToPhysfsTime */
+
+
+static int szipStatEntry(void *opaque, __PHYSFS_DirTreeEntry *_entry,
+                         PHYSFS_Stat *stat)
+{
+    SZIPinfo *info = (SZIPinfo *) opaque;
+    const SZIPentry *entry = (const SZIPentry *) _entry;
+    const PHYSFS_uint32 idx = entry->dbidx;
+
+    if (entry->tree.isdir)
+    {
+        stat->filesize = -1;
+	    stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+    } /* if */
+    else
+    {
+        stat->filesize = (PHYSFS_sint64) SzArEx_GetFileSize(&info->db, idx);
+	    stat->filetype = PHYSFS_FILETYPE_REGULAR;
+    } /* else */
+
+    if (info->db.MTime.Vals != NULL)
+	    stat->modtime = lzmasdkTimeToPhysfsTime(&info->db.MTime.Vals[idx]);
+    else if (info->db.CTime.Vals != NULL)
+	    stat->modtime = lzmasdkTimeToPhysfsTime(&info->db.CTime.Vals[idx]);
+    else
+	    stat->modtime = -1;
+
+    if (info->db.CTime.Vals != NULL)
+	    stat->createtime = lzmasdkTimeToPhysfsTime(&info->db.CTime.Vals[idx]);
+    else if (info->db.MTime.Vals != NULL)
+	    stat->createtime = lzmasdkTimeToPhysfsTime(&info->db.MTime.Vals[idx]);
+    else
+	    stat->createtime = -1;
+
+	stat->accesstime = -1;
+	stat->readonly = 1;
+
+    return 1;
+} /* szipStatEntry */
+
+
 static int szipLoadEntries(SZIPinfo *info)
 {
+    const PHYSFS_uint32 count = info->db.NumFiles;
     int retval = 0;
 
-    if (__PHYSFS_DirTreeInit(&info->tree, sizeof (SZIPentry), 1, 0))
+    if (__PHYSFS_DirTreeInit(&info->tree, sizeof (SZIPentry), 1, 0, count))
     {
-        const PHYSFS_uint32 count = info->db.NumFiles;
         PHYSFS_uint32 i;
+        info->tree.statEntry = szipStatEntry;
         for (i = 0; i < count; i++)
             BAIL_IF_ERRPASS(!szipLoadEntry(info, i), 0);
         retval = 1;
@@ -203,6 +470,9 @@ static void SZIP_closeArchive(void *opaque)
     SZIPinfo *info = (SZIPinfo *) opaque;
     if (info)
     {
+        int i;
+        for (i = 0; i < SZIP_BLOCKCACHE_COUNT; i++)
+            szipReleaseBlock(info->blockcache[i]);  /* open files keep theirs. */
         if (info->io)
             info->io->destroy(info->io);
         SzArEx_Free(&info->db, &SZIP_SzAlloc);
@@ -255,9 +525,9 @@ failed:
 
 static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
 {
-    /* !!! FIXME: the current lzma sdk C API only allows you to decompress
-       !!! FIXME:  the entire file at once, which isn't ideal. Fix this in the
-       !!! FIXME:  SDK and then convert this all to a streaming interface. */
+    /* The lzma sdk C API only decompresses whole solid blocks, so we keep
+       recently-decoded blocks around and hand out PHYSFS_Ios that read
+       directly from the shared block instead of copying each file out. */
 
     SZIPinfo *info = (SZIPinfo *) opaque;
     SZIPentry *entry = (SZIPentry *) __PHYSFS_DirTreeFind(&info->tree, path);
@@ -265,22 +535,43 @@ static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
     SZIPLookToRead stream;
     PHYSFS_Io *retval = NULL;
     PHYSFS_Io *io = NULL;
+    SZIPblock *block = NULL;
     UInt32 blockIndex = 0xFFFFFFFF;
     Byte *outBuffer = NULL;
     size_t outBufferSize = 0;
     size_t offset = 0;
     size_t outSizeProcessed = 0;
-    void *buf = NULL;
     SRes rc;
 
     BAIL_IF_ERRPASS(!entry, NULL);
     BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
 
+    blockIndex = info->db.FileToFolder[entry->dbidx];
+    if (blockIndex == (UInt32) -1)  /* empty file, not in any block. */
+        return szipCreateFileIo(NULL, NULL, 0);
+
+    block = szipFindCachedBlock(info, blockIndex);
+    if (block != NULL)
+    {
+        /* the block is already decoded, so this just finds the file in it
+           and checks its CRC; the lzma sdk won't touch the stream. */
+        outBuffer = block->buf;
+        outBufferSize = block->len;
+        rc = SzArEx_Extract(&info->db, NULL, entry->dbidx, &blockIndex,
+                            &outBuffer, &outBufferSize, &offset,
+                            &outSizeProcessed, alloc, alloc);
+        assert(outBuffer == block->buf);
+        outBuffer = NULL;  /* still owned by the block. */
+        BAIL_IF(rc != SZ_OK, szipErrorCode(rc), NULL);
+        return szipCreateFileIo(block, block->buf + offset, outSizeProcessed);
+    } /* if */
+
     io = info->io->duplicate(info->io);
     GOTO_IF_ERRPASS(!io, SZIP_openRead_failed);
 
     szipInitStream(&stream, io);
 
+    blockIndex = 0xFFFFFFFF;
     rc = SzArEx_Extract(&info->db, &stream.lookStream.s, entry->dbidx,
                         &blockIndex, &outBuffer, &outBufferSize, &offset,
                         &outSizeProcessed, alloc, alloc);
@@ -290,27 +581,24 @@ static PHYSFS_Io *SZIP_openRead(void *opaque, const char *path)
     io->destroy(io);
     io = NULL;
 
-    buf = allocator.Malloc(outSizeProcessed ? outSizeProcessed : 1);
-    GOTO_IF(buf == NULL, PHYSFS_ERR_OUT_OF_MEMORY, SZIP_openRead_failed);
-
-    if (outSizeProcessed > 0)
-        memcpy(buf, outBuffer + offset, outSizeProcessed);
-
-    alloc->Free(alloc, outBuffer);
-    outBuffer = NULL;
-
-    retval = __PHYSFS_createMemoryIo(buf, outSizeProcessed, allocator.Free);
-    GOTO_IF_ERRPASS(!retval, SZIP_openRead_failed);
-
+    block = (SZIPblock *) allocator.Malloc(sizeof (SZIPblock));
+    GOTO_IF(!block, PHYSFS_ERR_OUT_OF_MEMORY, SZIP_openRead_failed);
+    block->blockIndex = blockIndex;
+    block->buf = outBuffer;
+    block->len = outBufferSize;
+    block->refcount = 1;  /* our reference, dropped below. */
+    outBuffer = NULL;  /* owned by the block now. */
+
+    retval = szipCreateFileIo(block, block->buf + offset, outSizeProcessed);
+    if (retval != NULL)
+        szipCacheBlock(info, block);
+    szipReleaseBlock(block);
     return retval;
 
 SZIP_openRead_failed:
     if (io != NULL)
         io->destroy(io);
 
-    if (buf)
-        allocator.Free(buf);
-
     if (outBuffer)
         alloc->Free(alloc, outBuffer);
 
@@ -342,54 +630,14 @@ static int SZIP_mkdir(void *opaque, const char *name)
 } /* SZIP_mkdir */
 
 
-static inline PHYSFS_uint64 lzmasdkTimeToPhysfsTime(const CNtfsFileTime *t)
-{
-    const PHYSFS_uint64 winEpochToUnixEpoch = __PHYSFS_UI64(0x019DB1DED53E8000);
-    const PHYSFS_uint64 nanosecToMillisec = __PHYSFS_UI64(10000000);
-    const PHYSFS_uint64 quad = (((PHYSFS_uint64) t->High) << 32) | t->Low;
-    return (quad - winEpochToUnixEpoch) / nanosecToMillisec;
-} /* lzmasdkTimeToPhysfsTime */
-
-
 static int SZIP_stat(void *opaque, const char *path, PHYSFS_Stat *stat)
 {
     SZIPinfo *info = (SZIPinfo *) opaque;
     SZIPentry *entry;
-    PHYSFS_uint32 idx;
 
     entry = (SZIPentry *) __PHYSFS_DirTreeFind(&info->tree, path);
     BAIL_IF_ERRPASS(!entry, 0);
-    idx = entry->dbidx;
-
-    if (entry->tree.isdir)
-    {
-        stat->filesize = -1;
-	    stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
-    } /* if */
-    else
-    {
-        stat->filesize = (PHYSFS_sint64) SzArEx_GetFileSize(&info->db, idx);
-	    stat->filetype = PHYSFS_FILETYPE_REGULAR;
-    } /* else */
-
-    if (info->db.MTime.Vals != NULL)
-	    stat->modtime = lzmasdkTimeToPhysfsTime(&info->db.MTime.Vals[idx]);
-    else if (info->db.CTime.Vals != NULL)
-	    stat->modtime = lzmasdkTimeToPhysfsTime(&info->db.CTime.Vals[idx]);
-    else
-	    stat->modtime = -1;
-
-    if (info->db.CTime.Vals != NULL)
-	    stat->createtime = lzmasdkTimeToPhysfsTime(&info->db.CTime.Vals[idx]);
-    else if (info->db.MTime.Vals != NULL)
-	    stat->createtime = lzmasdkTimeToPhysfsTime(&info->db.MTime.Vals[idx]);
-    else
-	    stat->createtime = -1;
-
-	stat->accesstime = -1;
-	stat->readonly = 1;
-
-    return 1;
+    return szipStatEntry(info, &entry->tree, stat);
 } /* SZIP_stat */
 
 
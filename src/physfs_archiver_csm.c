@@ -83,7 +83,7 @@ static void *CSM_openArchive(PHYSFS_Io *io, const char *name,
     count = PHYSFS_swapULE16(count);
 
 
-    unpkarc = UNPK_openArchive(io, 0, 1);
+    unpkarc = UNPK_openArchive(io, 0, 1, count);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
     if (!csmLoadEntries(io, count, unpkarc))
@@ -39,12 +39,59 @@ static char *cvtToDependent(const char *prepend, const char *path,
 
 
 
+/*
+ * With PHYSFS_setCaseInsensitive(), a DIR archive remembers the real names
+ *  it has seen in a case-insensitive DirTree, so a path in the wrong case
+ *  costs a directory listing per element the first time, and hash lookups
+ *  after that. Every entry is marked as a directory, since all we need is
+ *  its name; the filesystem has the final word on what it actually is.
+ *
+ * With PHYSFS_setDirectoryCaching(), the same tree is trusted instead: once
+ *  a directory is listed, anything not in it doesn't exist, and stat results
+ *  are kept, until PHYSFS_refreshDirectoryCaches() (or a write through
+ *  PhysicsFS) throws it all away.
+ */
+#if defined(PHYSFS_PLATFORM_WINDOWS) || defined(PHYSFS_PLATFORM_OS2)
+#define DIR_FILESYSTEM_IGNORES_CASE 1
+#else
+#define DIR_FILESYSTEM_IGNORES_CASE 0
+#endif
+
+typedef struct
+{
+    __PHYSFS_DirTreeEntry tree;
+    int listed;  /* with (cached), non-zero if all children are in the tree. */
+    int statted;  /* with (cached), non-zero if (stat) is filled in. */
+    PHYSFS_Stat stat;
+} DIRentry;
+
+typedef struct
+{
+    char *base;  /* platform-dependent path, ending with a dir separator. */
+    int ignoreCase;  /* non-zero to resolve case through (names). */
+    int cached;  /* non-zero to trust (names) as a cache of the disk. */
+    int caseSensitive;  /* how (names) compares them. */
+    __PHYSFS_DirTree names;  /* real names we've seen so far. */
+    void *lock;  /* protects (names). */
+    int dirfd;  /* (base), held open; -1 if we use full paths instead. */
+} DIRinfo;
+
+
+/* Set up an empty (info->names). */
+static int initNames(DIRinfo *info)
+{
+    BAIL_IF_ERRPASS(!__PHYSFS_DirTreeInit(&info->names, sizeof (DIRentry), info->caseSensitive, 0, 0), 0);
+    info->names.case_sensitive = info->caseSensitive;  /* fixed per mount. */
+    return 1;
+} /* initNames */
+
+
 static void *DIR_openArchive(PHYSFS_Io *io, const char *name,
                              int forWriting, int *claimed)
 {
     PHYSFS_Stat st;
     const char dirsep = __PHYSFS_platformDirSeparator;
-    char *retval = NULL;
+    DIRinfo *info = NULL;
     const size_t namelen = strlen(name);
     const size_t seplen = 1;
 
@@ -55,42 +102,147 @@ static void *DIR_openArchive(PHYSFS_Io *io, const char *name,
         BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
 
     *claimed = 1;
-    retval = allocator.Malloc(namelen + seplen + 1);
-    BAIL_IF(retval == NULL, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    info = (DIRinfo *) allocator.Malloc(sizeof (DIRinfo));
+    BAIL_IF(info == NULL, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(info, '\0', sizeof (*info));
+    info->dirfd = -1;
+
+    info->base = (char *) allocator.Malloc(namelen + seplen + 1);
+    GOTO_IF(info->base == NULL, PHYSFS_ERR_OUT_OF_MEMORY, failed);
 
-    strcpy(retval, name);
+    strcpy(info->base, name);
 
     /* make sure there's a dir separator at the end of the string */
-    if (retval[namelen - 1] != dirsep)
+    if (info->base[namelen - 1] != dirsep)
     {
-        retval[namelen] = dirsep;
-        retval[namelen + 1] = '\0';
+        info->base[namelen] = dirsep;
+        info->base[namelen + 1] = '\0';
     } /* if */
 
-    return retval;
+    /* some filesystems ignore case already, so there's nothing to do. */
+    info->ignoreCase = ((!DIR_FILESYSTEM_IGNORES_CASE) && (PHYSFS_isCaseInsensitive()));
+    info->cached = ((!forWriting) && (PHYSFS_isDirectoryCaching()));
+    info->caseSensitive = ((!DIR_FILESYSTEM_IGNORES_CASE) && (!info->ignoreCase));
+    if ((info->ignoreCase) || (info->cached))
+    {
+        info->lock = __PHYSFS_platformCreateMutex();
+        GOTO_IF_ERRPASS(!info->lock, failed);
+        GOTO_IF_ERRPASS(!initNames(info), failed);
+    } /* if */
+
+    #ifdef PHYSFS_PLATFORM_POSIX
+    info->dirfd = __PHYSFS_platformOpenDirFd(info->base);
+    #endif
+
+    return info;
+
+failed:
+    __PHYSFS_DirTreeDeinit(&info->names);
+    if (info->lock)
+        __PHYSFS_platformDestroyMutex(info->lock);
+    if (info->base)
+        allocator.Free(info->base);
+    allocator.Free(info);
+    return NULL;
 } /* DIR_openArchive */
 
 
-static PHYSFS_EnumerateCallbackResult DIR_enumerate(void *opaque,
-                         const char *dname, PHYSFS_EnumerateCallback cb,
-                         const char *origdir, void *callbackdata)
+int DIR_isCaseInsensitive(void *opaque)
 {
+    return ((DIRinfo *) opaque)->ignoreCase;
+} /* DIR_isCaseInsensitive */
+
+
+/* Throw away every name we know. Hold info->lock. */
+static int forgetNames(DIRinfo *info)
+{
+    __PHYSFS_DirTreeDeinit(&info->names);
+    if (!initNames(info))
+    {
+        __PHYSFS_DirTreeDeinit(&info->names);
+        memset(&info->names, '\0', sizeof (info->names));
+        info->ignoreCase = 0;  /* out of memory; go straight to the disk. */
+        info->cached = 0;
+        return 0;
+    } /* if */
+    return 1;
+} /* forgetNames */
+
+
+void DIR_refreshCache(void *opaque)
+{
+    DIRinfo *info = (DIRinfo *) opaque;
+    if (info->cached)
+    {
+        __PHYSFS_platformGrabMutex(info->lock);
+        if (info->cached)
+            forgetNames(info);
+        __PHYSFS_platformReleaseMutex(info->lock);
+    } /* if */
+} /* DIR_refreshCache */
+
+
+/*
+ * Everything below goes through these, with (path) relative to the mounted
+ *  dir in platform-independent notation. Where the platform can, we keep
+ *  the dir open and work relative to it, so there's no full path to build
+ *  and the OS doesn't walk the whole thing again on every call.
+ */
+static int diskStat(DIRinfo *info, const char *path, PHYSFS_Stat *stat)
+{
+    int retval;
     char *d;
+
+    #ifdef PHYSFS_PLATFORM_POSIX
+    if (info->dirfd != -1)
+        return __PHYSFS_platformStatAt(info->dirfd, path, stat, 0);
+    #endif
+
+    CVT_TO_DEPENDENT(d, info->base, path);
+    BAIL_IF_ERRPASS(!d, 0);
+    retval = __PHYSFS_platformStat(d, stat, 0);
+    __PHYSFS_smallFree(d);
+    return retval;
+} /* diskStat */
+
+
+static PHYSFS_EnumerateCallbackResult diskEnumerate(DIRinfo *info,
+                         const char *path, PHYSFS_EnumerateCallback cb,
+                         PHYSFS_EnumerateStatCallback statcb,
+                         const char *origdir, void *callbackdata)
+{
     PHYSFS_EnumerateCallbackResult retval;
-    CVT_TO_DEPENDENT(d, opaque, dname);
+    char *d;
+
+    #ifdef PHYSFS_PLATFORM_POSIX
+    if ((info->dirfd != -1) && (statcb != NULL))
+        return __PHYSFS_platformEnumerateStatAt(info->dirfd, path, statcb, origdir, callbackdata);
+    else if (info->dirfd != -1)
+        return __PHYSFS_platformEnumerateAt(info->dirfd, path, cb, origdir, callbackdata);
+    #endif
+
+    CVT_TO_DEPENDENT(d, info->base, path);
     BAIL_IF_ERRPASS(!d, PHYSFS_ENUM_ERROR);
-    retval = __PHYSFS_platformEnumerate(d, cb, origdir, callbackdata);
+    if (statcb != NULL)
+        retval = __PHYSFS_platformEnumerateStat(d, statcb, origdir, callbackdata);
+    else
+        retval = __PHYSFS_platformEnumerate(d, cb, origdir, callbackdata);
     __PHYSFS_smallFree(d);
     return retval;
-} /* DIR_enumerate */
+} /* diskEnumerate */
 
 
-static PHYSFS_Io *doOpen(void *opaque, const char *name, const int mode)
+static PHYSFS_Io *diskOpen(DIRinfo *info, const char *path, const int mode)
 {
-    PHYSFS_Io *io = NULL;
-    char *f = NULL;
+    PHYSFS_Io *io;
+    char *f;
 
-    CVT_TO_DEPENDENT(f, opaque, name);
+    #ifdef PHYSFS_PLATFORM_POSIX
+    if (info->dirfd != -1)
+        return __PHYSFS_createNativeIoAt(info->dirfd, info->base, path, mode);
+    #endif
+
+    CVT_TO_DEPENDENT(f, info->base, path);
     BAIL_IF_ERRPASS(!f, NULL);
 
     io = __PHYSFS_createNativeIo(f, mode);
@@ -103,6 +255,485 @@ static PHYSFS_Io *doOpen(void *opaque, const char *name, const int mode)
     } /* if */
 
     __PHYSFS_smallFree(f);
+    return io;
+} /* diskOpen */
+
+
+static int diskMkDir(DIRinfo *info, const char *path)
+{
+    int retval;
+    char *f;
+
+    #ifdef PHYSFS_PLATFORM_POSIX
+    if (info->dirfd != -1)
+        return __PHYSFS_platformMkDirAt(info->dirfd, path);
+    #endif
+
+    CVT_TO_DEPENDENT(f, info->base, path);
+    BAIL_IF_ERRPASS(!f, 0);
+    retval = __PHYSFS_platformMkDir(f);
+    __PHYSFS_smallFree(f);
+    return retval;
+} /* diskMkDir */
+
+
+static int diskDelete(DIRinfo *info, const char *path)
+{
+    int retval;
+    char *f;
+
+    #ifdef PHYSFS_PLATFORM_POSIX
+    if (info->dirfd != -1)
+        return __PHYSFS_platformDeleteAt(info->dirfd, path);
+    #endif
+
+    CVT_TO_DEPENDENT(f, info->base, path);
+    BAIL_IF_ERRPASS(!f, 0);
+    retval = __PHYSFS_platformDelete(f);
+    __PHYSFS_smallFree(f);
+    return retval;
+} /* diskDelete */
+
+
+/*
+ * Build (entry)'s real path, followed by (rest), in platform-independent
+ *  notation. Caller frees the result with allocator.Free().
+ */
+static char *casePath(const __PHYSFS_DirTree *dt,
+                      const __PHYSFS_DirTreeEntry *entry, const char *rest)
+{
+    const __PHYSFS_DirTreeEntry *i;
+    const size_t restlen = strlen(rest);
+    size_t len = restlen + 1;
+    char *retval;
+    char *ptr;
+
+    for (i = entry; i != dt->root; i = i->parent)
+        len += strlen(i->name) + 1;
+
+    retval = (char *) allocator.Malloc(len);
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    ptr = retval + (len - (restlen + 1));
+    memcpy(ptr, rest, restlen + 1);
+    for (i = entry; i != dt->root; i = i->parent)
+    {
+        const size_t namelen = strlen(i->name);
+        *(--ptr) = '/';
+        ptr -= namelen;
+        memcpy(ptr, i->name, namelen);
+    } /* for */
+
+    if ((restlen == 0) && (len > 1))
+        retval[len - 2] = '\0';  /* drop the separator we put before (rest). */
+
+    return retval;
+} /* casePath */
+
+
+static PHYSFS_EnumerateCallbackResult listDirCallback(void *data,
+                                       const char *origdir, const char *fname)
+{
+    __PHYSFS_DirTree *names = (__PHYSFS_DirTree *) data;
+    const size_t dirlen = strlen(origdir);
+    const size_t len = dirlen + strlen(fname) + 2;
+    char *path = (char *) __PHYSFS_smallAlloc(len);
+    void *entry;
+
+    BAIL_IF(!path, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+    if (dirlen == 0)
+        strcpy(path, fname);
+    else
+        snprintf(path, len, "%s/%s", origdir, fname);
+    entry = __PHYSFS_DirTreeAdd(names, path, 1);
+    __PHYSFS_smallFree(path);
+    return entry ? PHYSFS_ENUM_OK : PHYSFS_ENUM_ERROR;
+} /* listDirCallback */
+
+
+/* Add everything in (entry)'s directory on disk to (info->names). */
+static int listDir(DIRinfo *info, __PHYSFS_DirTreeEntry *entry)
+{
+    PHYSFS_EnumerateCallbackResult rc;
+    char *dir = casePath(&info->names, entry, "");
+
+    BAIL_IF_ERRPASS(!dir, 0);
+    rc = diskEnumerate(info, dir, listDirCallback, NULL, dir, &info->names);
+    allocator.Free(dir);
+    BAIL_IF_ERRPASS(rc == PHYSFS_ENUM_ERROR, 0);
+    ((DIRentry *) entry)->listed = 1;
+    return 1;
+} /* listDir */
+
+
+/*
+ * Find the real case of (name), as far as it exists on disk. Returns a new
+ *  path in platform-independent notation: elements that matched something
+ *  have their real case, and everything from the first one that didn't is
+ *  left as it was. If (fresh), forget what we knew first. (*cached) is set
+ *  if the last element came straight from what we knew, without looking at
+ *  the disk, so it might not be there anymore. Caller frees the result with
+ *  allocator.Free(). Leaves the current error code alone unless it fails.
+ */
+static char *resolveCase(DIRinfo *info, const char *name, int fresh,
+                         int *cached)
+{
+    __PHYSFS_DirTree *names = &info->names;
+    const PHYSFS_ErrorCode err = PHYSFS_getLastErrorCode();
+    const size_t len = strlen(name) + 1;
+    char *path = (char *) __PHYSFS_smallAlloc(len);
+    __PHYSFS_DirTreeEntry *entry = NULL;
+    char *retval = NULL;
+    char *ptr = NULL;
+
+    *cached = 0;
+    BAIL_IF(!path, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    __PHYSFS_platformGrabMutex(info->lock);
+
+    while (info->ignoreCase)
+    {
+        int stale = 0;
+
+        if ((fresh) && (!forgetNames(info)))
+            break;
+
+        memcpy(path, name, len);
+        entry = names->root;
+        ptr = path;
+        *cached = 0;
+
+        while (*ptr != '\0')
+        {
+            char *end = strchr(ptr, '/');
+            __PHYSFS_DirTreeEntry *child;
+
+            if (end != NULL)
+                *end = '\0';
+
+            child = (__PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeFind(names, path);
+            *cached = (child != NULL);
+            if (child == NULL)
+            {
+                if (listDir(info, entry))
+                    child = (__PHYSFS_DirTreeEntry *) __PHYSFS_DirTreeFind(names, path);
+                else if (PHYSFS_getLastErrorCode() == PHYSFS_ERR_NOT_FOUND)
+                    stale = (entry != names->root);  /* dir we knew is gone. */
+            } /* if */
+
+            if (end != NULL)
+                *end = '/';
+
+            if (child == NULL)
+                break;
+
+            entry = child;
+            ptr = (end != NULL) ? end + 1 : ptr + strlen(ptr);
+        } /* while */
+
+        if ((stale) && (!fresh))
+        {
+            fresh = 1;  /* start over from what's on disk now. */
+            continue;
+        } /* if */
+
+        if (*ptr != '\0')
+            *cached = 0;  /* we looked at the disk for the element we missed. */
+        break;
+    } /* while */
+
+    PHYSFS_setErrorCode(err);
+    if (ptr != NULL)
+        retval = casePath(names, entry, name + (ptr - path));
+    else
+        PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);  /* forgetNames failed. */
+
+    __PHYSFS_platformReleaseMutex(info->lock);
+    __PHYSFS_smallFree(path);
+    return retval;
+} /* resolveCase */
+
+
+/*
+ * Call this when an operation on (name), or on the last (*real) it gave
+ *  you, failed. If the failure could be down to case, this puts the next
+ *  path to try in (*real) and returns non-zero. Otherwise it leaves the
+ *  error alone and returns zero. Start with (*real) set to NULL and (*state)
+ *  set to zero, or to -1 to resolve (name) before trying the exact case at
+ *  all. Free (*real) with allocator.Free() when you're done.
+ */
+static int nextCasePath(DIRinfo *info, const char *name, char **real,
+                        int *state)
+{
+    const char *tried = (*real != NULL) ? *real : name;
+    PHYSFS_ErrorCode err = PHYSFS_ERR_OK;
+    int cached = 0;
+    char *path;
+
+    if ((!info->ignoreCase) || (*state > 1))
+        return 0;
+    else if (*state >= 0)
+    {
+        err = PHYSFS_getLastErrorCode();
+        PHYSFS_setErrorCode(err);
+        if (err != PHYSFS_ERR_NOT_FOUND)
+            return 0;
+    } /* else if */
+
+    path = resolveCase(info, name, (*state == 1), &cached);
+    if ((path != NULL) && (*state == 0) && (cached) && (strcmp(path, tried) == 0))
+    {
+        /* what we knew led right back to what failed; it might be stale. */
+        allocator.Free(path);
+        path = resolveCase(info, name, 1, &cached);
+    } /* if */
+
+    if (path == NULL)
+    {
+        *state = 2;
+        return 0;
+    } /* if */
+
+    else if ((*state >= 0) && (strcmp(path, tried) == 0))
+    {
+        allocator.Free(path);
+        PHYSFS_setErrorCode(err);
+        *state = 2;
+        return 0;
+    } /* else if */
+
+    if (*real != NULL)
+        allocator.Free(*real);
+    *real = path;
+    *state = cached ? 1 : 2;
+    return 1;
+} /* nextCasePath */
+
+
+/*
+ * Find (name) in the cache, listing directories on the way as needed. Hold
+ *  info->lock. Returns NULL with PHYSFS_ERR_NOT_FOUND if it isn't there,
+ *  without going to the disk at all once its parent has been listed.
+ */
+static DIRentry *cacheFind(DIRinfo *info, const char *name)
+{
+    __PHYSFS_DirTree *names = &info->names;
+    DIRentry *entry = (DIRentry *) names->root;
+    const size_t len = strlen(name) + 1;
+    char *path;
+    char *ptr;
+
+    BAIL_IF(!info->cached, PHYSFS_ERR_OUT_OF_MEMORY, NULL);  /* forgetNames() failed. */
+    if (*name == '\0')
+        return entry;
+
+    path = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!path, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memcpy(path, name, len);
+
+    ptr = path;
+    while ((entry != NULL) && (*ptr != '\0'))
+    {
+        char *end = strchr(ptr, '/');
+        DIRentry *child;
+
+        if (end != NULL)
+            *end = '\0';
+
+        child = (DIRentry *) __PHYSFS_DirTreeFind(names, path);
+        if ((child == NULL) && (!entry->listed) && (listDir(info, &entry->tree)))
+            child = (DIRentry *) __PHYSFS_DirTreeFind(names, path);
+
+        if (end != NULL)
+            *end = '/';
+
+        if ((child == NULL) && (entry->listed))
+            PHYSFS_setErrorCode(PHYSFS_ERR_NOT_FOUND);
+
+        entry = child;
+        ptr = (end != NULL) ? end + 1 : ptr + strlen(ptr);
+    } /* while */
+
+    __PHYSFS_smallFree(path);
+    return entry;
+} /* cacheFind */
+
+
+/* Fill in (stat) for (entry), from the disk if we don't have it yet. Hold
+   info->lock. */
+static int cacheStat(DIRinfo *info, DIRentry *entry, PHYSFS_Stat *stat)
+{
+    if (!entry->statted)
+    {
+        char *path = casePath(&info->names, &entry->tree, "");
+        int rc;
+        BAIL_IF_ERRPASS(!path, 0);
+        rc = diskStat(info, path, &entry->stat);
+        allocator.Free(path);
+        BAIL_IF_ERRPASS(!rc, 0);
+        entry->statted = 1;
+    } /* if */
+
+    memcpy(stat, &entry->stat, sizeof (*stat));
+    return 1;
+} /* cacheStat */
+
+
+typedef struct
+{
+    const char *name;
+    PHYSFS_Stat stat;
+} DIRlistItem;
+
+/*
+ * Enumerate (dname) from the cache, handing each entry to (cb), or to
+ *  (statcb) along with its stat if that isn't NULL. The names are copied
+ *  out first, so the callbacks run without info->lock held.
+ */
+static PHYSFS_EnumerateCallbackResult cacheEnumerate(DIRinfo *info,
+                         const char *dname, PHYSFS_EnumerateCallback cb,
+                         PHYSFS_EnumerateStatCallback statcb,
+                         const char *origdir, void *callbackdata)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    DIRlistItem *items = NULL;
+    size_t count = 0;
+    size_t total = 0;
+    DIRentry *entry;
+    DIRentry *i;
+    char *ptr;
+    size_t n;
+
+    __PHYSFS_platformGrabMutex(info->lock);
+
+    entry = cacheFind(info, dname);
+    if ((entry != NULL) && (!entry->listed) && (!listDir(info, &entry->tree)))
+        entry = NULL;
+
+    if (entry != NULL)
+    {
+        for (i = (DIRentry *) entry->tree.children; i; i = (DIRentry *) i->tree.sibling)
+        {
+            count++;
+            total += strlen(i->tree.name) + 1;
+        } /* for */
+
+        items = (DIRlistItem *) allocator.Malloc((count * sizeof (DIRlistItem)) + total + 1);
+        if (items == NULL)
+            PHYSFS_setErrorCode(PHYSFS_ERR_OUT_OF_MEMORY);
+    } /* if */
+
+    if (items == NULL)
+    {
+        __PHYSFS_platformReleaseMutex(info->lock);
+        return PHYSFS_ENUM_ERROR;
+    } /* if */
+
+    n = 0;
+    ptr = (char *) (items + count);
+    for (i = (DIRentry *) entry->tree.children; i; i = (DIRentry *) i->tree.sibling)
+    {
+        /* like __PHYSFS_platformEnumerateStat(), skip what vanished. */
+        if ((statcb != NULL) && (!cacheStat(info, i, &items[n].stat)))
+            continue;
+        strcpy(ptr, i->tree.name);
+        items[n++].name = ptr;
+        ptr += strlen(ptr) + 1;
+    } /* for */
+
+    __PHYSFS_platformReleaseMutex(info->lock);
+
+    for (count = 0; (retval == PHYSFS_ENUM_OK) && (count < n); count++)
+    {
+        if (statcb != NULL)
+            retval = statcb(callbackdata, origdir, items[count].name, &items[count].stat);
+        else
+            retval = cb(callbackdata, origdir, items[count].name);
+
+        if (retval == PHYSFS_ENUM_ERROR)
+            PHYSFS_setErrorCode(PHYSFS_ERR_APP_CALLBACK);
+    } /* for */
+
+    allocator.Free(items);
+    return retval;
+} /* cacheEnumerate */
+
+
+static PHYSFS_EnumerateCallbackResult doEnumerate(DIRinfo *info,
+                         const char *dname, PHYSFS_EnumerateCallback cb,
+                         PHYSFS_EnumerateStatCallback statcb,
+                         const char *origdir, void *callbackdata)
+{
+    PHYSFS_EnumerateCallbackResult retval;
+    char *real = NULL;
+    int state = 0;
+
+    if (info->cached)
+        return cacheEnumerate(info, dname, cb, statcb, origdir, callbackdata);
+
+    do
+    {
+        retval = diskEnumerate(info, real ? real : dname, cb, statcb, origdir, callbackdata);
+    } while ((retval == PHYSFS_ENUM_ERROR) && (nextCasePath(info, dname, &real, &state)));
+
+    if (real)
+        allocator.Free(real);
+    return retval;
+} /* doEnumerate */
+
+
+static PHYSFS_EnumerateCallbackResult DIR_enumerate(void *opaque,
+                         const char *dname, PHYSFS_EnumerateCallback cb,
+                         const char *origdir, void *callbackdata)
+{
+    return doEnumerate((DIRinfo *) opaque, dname, cb, NULL, origdir, callbackdata);
+} /* DIR_enumerate */
+
+
+PHYSFS_EnumerateCallbackResult DIR_enumerateStat(void *opaque,
+                         const char *dname, PHYSFS_EnumerateStatCallback cb,
+                         const char *origdir, void *callbackdata)
+{
+    return doEnumerate((DIRinfo *) opaque, dname, NULL, cb, origdir, callbackdata);
+} /* DIR_enumerateStat */
+
+
+static PHYSFS_Io *doOpen(void *opaque, const char *name, const int mode)
+{
+    DIRinfo *info = (DIRinfo *) opaque;
+    PHYSFS_Io *io = NULL;
+    char *real = NULL;
+    int state = 0;
+
+    if (info->cached)  /* the write dir is never cached. */
+    {
+        DIRentry *entry;
+        assert(mode == 'r');
+        __PHYSFS_platformGrabMutex(info->lock);
+        entry = cacheFind(info, name);
+        real = entry ? casePath(&info->names, &entry->tree, "") : NULL;
+        __PHYSFS_platformReleaseMutex(info->lock);
+        BAIL_IF_ERRPASS(!real, NULL);
+        io = diskOpen(info, real, mode);
+        allocator.Free(real);
+        return io;
+    } /* if */
+
+    /* don't create "a.txt" next to an "A.TXT" we should have written to. */
+    else if (mode != 'r')
+    {
+        state = -1;
+        if (info->ignoreCase)
+            BAIL_IF_ERRPASS(!nextCasePath(info, name, &real, &state), NULL);
+    } /* if */
+
+    do
+    {
+        io = diskOpen(info, real ? real : name, mode);
+    } while ((io == NULL) && (nextCasePath(info, name, &real, &state)));
+
+    if (real)
+        allocator.Free(real);
 
     return io;
 } /* doOpen */
@@ -128,45 +759,80 @@ static PHYSFS_Io *DIR_openAppend(void *opaque, const char *filename)
 
 static int DIR_remove(void *opaque, const char *name)
 {
+    DIRinfo *info = (DIRinfo *) opaque;
+    char *real = NULL;
+    int state = 0;
     int retval;
-    char *f;
 
-    CVT_TO_DEPENDENT(f, opaque, name);
-    BAIL_IF_ERRPASS(!f, 0);
-    retval = __PHYSFS_platformDelete(f);
-    __PHYSFS_smallFree(f);
+    do
+    {
+        retval = diskDelete(info, real ? real : name);
+    } while ((!retval) && (nextCasePath(info, name, &real, &state)));
+
+    if (real)
+        allocator.Free(real);
     return retval;
 } /* DIR_remove */
 
 
 static int DIR_mkdir(void *opaque, const char *name)
 {
+    DIRinfo *info = (DIRinfo *) opaque;
+    char *real = NULL;
+    int state = 0;
     int retval;
-    char *f;
 
-    CVT_TO_DEPENDENT(f, opaque, name);
-    BAIL_IF_ERRPASS(!f, 0);
-    retval = __PHYSFS_platformMkDir(f);
-    __PHYSFS_smallFree(f);
+    do
+    {
+        retval = diskMkDir(info, real ? real : name);
+    } while ((!retval) && (nextCasePath(info, name, &real, &state)));
+
+    if (real)
+        allocator.Free(real);
     return retval;
 } /* DIR_mkdir */
 
 
 static void DIR_closeArchive(void *opaque)
 {
-    allocator.Free(opaque);
+    DIRinfo *info = (DIRinfo *) opaque;
+    if ((info->ignoreCase) || (info->cached))
+        __PHYSFS_DirTreeDeinit(&info->names);
+    if (info->lock)
+        __PHYSFS_platformDestroyMutex(info->lock);
+    #ifdef PHYSFS_PLATFORM_POSIX
+    if (info->dirfd != -1)
+        __PHYSFS_platformCloseDirFd(info->dirfd);
+    #endif
+    allocator.Free(info->base);
+    allocator.Free(info);
 } /* DIR_closeArchive */
 
 
 static int DIR_stat(void *opaque, const char *name, PHYSFS_Stat *stat)
 {
-    int retval = 0;
-    char *d;
+    DIRinfo *info = (DIRinfo *) opaque;
+    char *real = NULL;
+    int state = 0;
+    int retval;
 
-    CVT_TO_DEPENDENT(d, opaque, name);
-    BAIL_IF_ERRPASS(!d, 0);
-    retval = __PHYSFS_platformStat(d, stat, 0);
-    __PHYSFS_smallFree(d);
+    if (info->cached)
+    {
+        DIRentry *entry;
+        __PHYSFS_platformGrabMutex(info->lock);
+        entry = cacheFind(info, name);
+        retval = entry ? cacheStat(info, entry, stat) : 0;
+        __PHYSFS_platformReleaseMutex(info->lock);
+        return retval;
+    } /* if */
+
+    do
+    {
+        retval = diskStat(info, real ? real : name, stat);
+    } while ((!retval) && (nextCasePath(info, name, &real, &state)));
+
+    if (real)
+        allocator.Free(real);
     return retval;
 } /* DIR_stat */
 
@@ -33,21 +33,53 @@
 
 #include <time.h>
 
+/*
+ * Directories are read this many bytes at a time (most are a single 2048
+ *  byte sector, so they're read in one go).
+ */
+#ifndef ISO9660_DIR_READ_SIZE
+#define ISO9660_DIR_READ_SIZE (16 * 2048)
+#endif
+
+/*
+ * If non-zero, only the root directory is read at mount time, and each
+ *  subdirectory is read the first time something looks into it. Mounting
+ *  with PHYSFS_setMountIndexDir() set still reads everything, so there's a
+ *  whole tree to save.
+ */
+#ifndef ISO9660_DEFER_DIRS
+#define ISO9660_DEFER_DIRS 1
+#endif
+
 /* ISO9660 often stores values in both big and little endian formats: little
    first, followed by big. While technically there might be different values
    in each, we just always use the littleendian ones and swap ourselves. The
    fields aren't aligned anyhow, so you have to serialize them in any case
    to avoid crashes on many CPU archs in any case. */
 
+static PHYSFS_uint16 iso9660LE16(const PHYSFS_uint8 *ptr)
+{
+    return (PHYSFS_uint16) (((PHYSFS_uint16) ptr[0]) |
+                            (((PHYSFS_uint16) ptr[1]) << 8));
+} /* iso9660LE16 */
+
+static PHYSFS_uint32 iso9660LE32(const PHYSFS_uint8 *ptr)
+{
+    return ((PHYSFS_uint32) ptr[0]) | (((PHYSFS_uint32) ptr[1]) << 8) |
+           (((PHYSFS_uint32) ptr[2]) << 16) | (((PHYSFS_uint32) ptr[3]) << 24);
+} /* iso9660LE32 */
+
+
 static int iso9660LoadEntries(PHYSFS_Io *io, const int joliet,
                               const char *base, const PHYSFS_uint64 dirstart,
-                              const PHYSFS_uint64 dirend, void *unpkarc);
+                              const PHYSFS_uint64 dirend, const int defer,
+                              void *unpkarc);
 
 static int iso9660AddEntry(PHYSFS_Io *io, const int joliet, const int isdir,
                            const char *base, PHYSFS_uint8 *fname,
                            const int fnamelen, const PHYSFS_sint64 ts,
                            const PHYSFS_uint64 pos, const PHYSFS_uint64 len,
-                           void *unpkarc)
+                           const int defer, void *unpkarc)
 {
     char *fullpath;
     char *fnamecpy;
@@ -114,122 +146,162 @@ static int iso9660AddEntry(PHYSFS_Io *io, const int joliet, const int isdir,
         } /* if */
     } /* else */
 
-    entry = UNPK_addEntry(unpkarc, fullpath, isdir, ts, ts, pos, len);
-    if ((entry) && (isdir))
+    if ((isdir) && (defer))
+        entry = UNPK_addDeferredDir(unpkarc, fullpath, ts, ts, pos, len);
+    else
     {
-        if (!iso9660LoadEntries(io, joliet, fullpath, pos, pos + len, unpkarc))
-            entry = NULL;  /* so we report a failure later. */
-    } /* if */
+        entry = UNPK_addEntry(unpkarc, fullpath, isdir, ts, ts, pos, len);
+        if ((entry) && (isdir))
+        {
+            if (!iso9660LoadEntries(io, joliet, fullpath, pos, pos + len, 0, unpkarc))
+                entry = NULL;  /* so we report a failure later. */
+        } /* if */
+    } /* else */
 
     __PHYSFS_smallFree(fullpath);
     return entry != NULL;
 } /* iso9660AddEntry */
 
+/* Add the entry for the (reclen) byte directory record at (record). */
+static int iso9660ParseRecord(PHYSFS_Io *io, const int joliet,
+                              const char *base, const PHYSFS_uint64 dirstart,
+                              const PHYSFS_uint8 *record, const size_t reclen,
+                              const int defer, void *unpkarc)
+{
+    PHYSFS_uint8 extattrlen;
+    PHYSFS_uint32 extent;
+    PHYSFS_uint32 datalen;
+    PHYSFS_uint8 flags;
+    PHYSFS_uint8 fnamelen;
+    PHYSFS_uint8 fname[256];
+    PHYSFS_sint64 timestamp;
+    struct tm t;
+    int isdir;
+    int multiextent;
+
+    BAIL_IF(reclen < 33, PHYSFS_ERR_CORRUPT, 0);
+
+    extattrlen = record[1];
+    extent = iso9660LE32(record + 2);  /* big endian copy at 6. */
+    datalen = iso9660LE32(record + 10);  /* big endian copy at 14. */
+
+    /* record timestamp is 7 bytes at 18: years since 1900, month, day,
+       hour, minute, second and GMT offset, which we ignore. */
+    t.tm_year = record[18];
+    t.tm_mon = record[19] - 1;
+    t.tm_mday = record[20];
+    t.tm_hour = record[21];
+    t.tm_min = record[22];
+    t.tm_sec = record[23];
+    t.tm_wday = 0;
+    t.tm_yday = 0;
+    t.tm_isdst = -1;
+    timestamp = (PHYSFS_sint64) mktime(&t);
+
+    flags = record[25];
+    isdir = (flags & (1 << 1)) != 0;
+    multiextent = (flags & (1 << 7)) != 0;
+    BAIL_IF(multiextent, PHYSFS_ERR_UNSUPPORTED, 0);  /* !!! FIXME */
+
+    /* then unit size, interleave gap and volume sequence number. */
+    fnamelen = record[32];
+    BAIL_IF(((size_t) fnamelen) + 33 > reclen, PHYSFS_ERR_CORRUPT, 0);
+    memcpy(fname, record + 33, fnamelen);  /* iso9660AddEntry writes to it. */
+
+    extent += extattrlen;  /* skip extended attribute record. */
+
+    /* infinite loop, corrupt file? ("." always points back here.) */
+    BAIL_IF(((((PHYSFS_uint64) extent) * 2048) == dirstart) &&
+            !((fnamelen == 1) && ((fname[0] == 0) || (fname[0] == 1))),
+            PHYSFS_ERR_CORRUPT, 0);
+
+    return iso9660AddEntry(io, joliet, isdir, base, fname, fnamelen,
+                           timestamp, ((PHYSFS_uint64) extent) * 2048,
+                           datalen, defer, unpkarc);
+} /* iso9660ParseRecord */
+
+/* Records never cross a sector, but we read many sectors at a time. */
 static int iso9660LoadEntries(PHYSFS_Io *io, const int joliet,
                               const char *base, const PHYSFS_uint64 dirstart,
-                              const PHYSFS_uint64 dirend, void *unpkarc)
+                              const PHYSFS_uint64 dirend, const int defer,
+                              void *unpkarc)
 {
+    const PHYSFS_uint64 dirlen = dirend - dirstart;
+    const size_t buflen = (dirlen < ISO9660_DIR_READ_SIZE) ? (size_t) dirlen : ISO9660_DIR_READ_SIZE;
+    PHYSFS_uint8 *buf;
     PHYSFS_uint64 readpos = dirstart;
+    int retval = 1;
+
+    if (dirend <= dirstart)
+        return 1;  /* nothing in here at all. */
 
-    while (1)
+    buf = (PHYSFS_uint8 *) allocator.Malloc(buflen);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+
+    while ((retval) && (readpos < dirend))
     {
-        PHYSFS_uint8 recordlen;
-        PHYSFS_uint8 extattrlen;
-        PHYSFS_uint32 extent;
-        PHYSFS_uint32 datalen;
-        PHYSFS_uint8 ignore[4];
-        PHYSFS_uint8 year, month, day, hour, minute, second, offset;
-        PHYSFS_uint8 flags;
-        PHYSFS_uint8 fnamelen;
-        PHYSFS_uint8 fname[256];
-        PHYSFS_sint64 timestamp;
-        struct tm t;
-        int isdir;
-        int multiextent;
-
-        BAIL_IF_ERRPASS(!io->seek(io, readpos), 0);
-
-        /* recordlen = 0 -> no more entries or fill entry */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &recordlen, 1), 0);
-        if (recordlen > 0)
-            readpos += recordlen;  /* ready to seek to next record. */
-        else
-        {
-            PHYSFS_uint64 nextpos;
-
-            /* if we are in the last sector of the directory & it's 0 -> end */
-            if ((dirend - 2048) <= (readpos - 1))
-                break; /* finished */
-
-            /* else skip to the next sector & continue; */
-            nextpos = (((readpos - 1) / 2048) + 1) * 2048;
-
-            /* whoops, can't make forward progress! */
-            BAIL_IF(nextpos == readpos, PHYSFS_ERR_CORRUPT, 0);
-
-            readpos = nextpos;
-            continue;  /* start back at upper loop. */
-        } /* else */
-
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &extattrlen, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &extent, 4), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* extent be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &datalen, 4), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* datalen be */
-
-        /* record timestamp */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &year, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &month, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &day, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &hour, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &minute, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &second, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &offset, 1), 0);
-
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &flags, 1), 0);
-        isdir = (flags & (1 << 1)) != 0;
-        multiextent = (flags & (1 << 7)) != 0;
-        BAIL_IF(multiextent, PHYSFS_ERR_UNSUPPORTED, 0);  /* !!! FIXME */
-
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 1), 0); /* unit size */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 1), 0); /* interleave gap */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0); /* seqnum le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0); /* seqnum be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &fnamelen, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, fname, fnamelen), 0);
-
-        t.tm_sec = second;
-        t.tm_min = minute;
-        t.tm_hour = hour;
-        t.tm_mday = day;
-        t.tm_mon = month - 1;
-        t.tm_year = year;
-        t.tm_wday = 0;
-        t.tm_yday = 0;
-        t.tm_isdst = -1;
-        timestamp = (PHYSFS_sint64) mktime(&t);
-
-        extent += extattrlen;  /* skip extended attribute record. */
-
-        /* infinite loop, corrupt file? */
-        BAIL_IF((extent * 2048) == dirstart, PHYSFS_ERR_CORRUPT, 0);
-
-        if (!iso9660AddEntry(io, joliet, isdir, base, fname, fnamelen,
-                             timestamp, extent * 2048, datalen, unpkarc))
+        const size_t avail = ((dirend - readpos) < buflen) ? (size_t) (dirend - readpos) : buflen;
+        size_t i = 0;
+
+        if ( (!io->seek(io, readpos)) || (!__PHYSFS_readAll(io, buf, avail)) )
         {
-            return 0;
+            retval = 0;
+            break;
         } /* if */
+
+        while (i < avail)
+        {
+            const size_t recordlen = buf[i];
+            if (recordlen == 0)
+            {
+                /* rest of this sector is padding, skip to the next one. */
+                i = (size_t) (((((readpos + i) / 2048) + 1) * 2048) - readpos);
+                continue;
+            } /* if */
+
+            else if ((i + recordlen) > avail)  /* straddles the buffer? */
+            {
+                if ((i == 0) || (avail < buflen))  /* no, past the dir's end. */
+                {
+                    PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+                    retval = 0;
+                } /* if */
+                break;  /* read again from this record. */
+            } /* else if */
+
+            if (!iso9660ParseRecord(io, joliet, base, dirstart, buf + i,
+                                    recordlen, defer, unpkarc))
+            {
+                retval = 0;
+                break;
+            } /* if */
+
+            i += recordlen;
+        } /* while */
+
+        readpos += i;
     } /* while */
 
-    return 1;
+    allocator.Free(buf);
+    return retval;
 } /* iso9660LoadEntries */
 
+/* UNPK_DirLoader for deferred dirs; (joliet) is the UNPK_setDirLoader arg. */
+static int iso9660LoadDeferredDir(void *unpkarc, PHYSFS_Io *io,
+                                  const int joliet, const char *path,
+                                  const PHYSFS_uint64 pos,
+                                  const PHYSFS_uint64 len)
+{
+    return iso9660LoadEntries(io, joliet, path, pos, pos + len, 1, unpkarc);
+} /* iso9660LoadDeferredDir */
+
 
 static int parseVolumeDescriptor(PHYSFS_Io *io, PHYSFS_uint64 *_rootpos,
                                  PHYSFS_uint64 *_rootlen, int *_joliet,
                                  int *_claimed)
 {
     PHYSFS_uint64 pos = 32768; /* start at the Primary Volume Descriptor */
+    PHYSFS_uint8 sector[2048];  /* each volume descriptor is 2048 bytes */
     int found = 0;
     int done = 0;
 
@@ -237,23 +309,19 @@ static int parseVolumeDescriptor(PHYSFS_Io *io, PHYSFS_uint64 *_rootpos,
 
     while (!done)
     {
+        const PHYSFS_uint8 *escapeseqs = sector + 88;
         PHYSFS_uint8 type;
-        PHYSFS_uint8 identifier[5];
-        PHYSFS_uint8 version;
         PHYSFS_uint8 flags;
-        PHYSFS_uint8 escapeseqs[32];
-        PHYSFS_uint8 ignore[32];
         PHYSFS_uint16 blocksize;
         PHYSFS_uint32 extent;
         PHYSFS_uint32 datalen;
 
         BAIL_IF_ERRPASS(!io->seek(io, pos), 0);
-        pos += 2048;  /* each volume descriptor is 2048 bytes */
+        pos += 2048;
 
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &type, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, identifier, 5), 0);
+        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, sector, sizeof (sector)), 0);
 
-        if (memcmp(identifier, "CD001", 5) != 0)  /* maybe not an iso? */
+        if (memcmp(sector + 1, "CD001", 5) != 0)  /* maybe not an iso? */
         {
             BAIL_IF(!*_claimed, PHYSFS_ERR_UNSUPPORTED, 0);
             continue;  /* just skip this one */
@@ -261,39 +329,21 @@ static int parseVolumeDescriptor(PHYSFS_Io *io, PHYSFS_uint64 *_rootpos,
 
         *_claimed = 1; /* okay, this is probably an iso. */
 
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &version, 1), 0);  /* version */
-        BAIL_IF(version != 1, PHYSFS_ERR_UNSUPPORTED, 0);
-
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &flags, 1), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 32), 0);  /* system id */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 32), 0);  /* volume id */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 8), 0);  /* reserved */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0);  /* space le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0);  /* space be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, escapeseqs, 32), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0);  /* setsize le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0);  /* setsize be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0);  /* seq num le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0);  /* seq num be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &blocksize, 2), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 2), 0); /* blocklen be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* pthtablen le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* pthtablen be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* pthtabpos le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* optpthtabpos le */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* pthtabpos be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* optpthtabpos be */
-
-        /* root directory record... */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 1), 0); /* len */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 1), 0); /* attr len */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &extent, 4), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* extent be */
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, &datalen, 4), 0);
-        BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, ignore, 4), 0); /* datalen be */
+        BAIL_IF(sector[6] != 1, PHYSFS_ERR_UNSUPPORTED, 0);  /* version */
+
+        type = sector[0];
+        flags = sector[7];
+
+        /* 8: system id, volume id, reserved, volume space size, escape
+           sequences at 88, set size, sequence number, then block size. */
+        blocksize = iso9660LE16(sector + 128);
+
+        /* 132: path table size and locations, then the root directory
+           record at 156: its extent is at 158 and its size at 166. */
+        extent = iso9660LE32(sector + 158);
+        datalen = iso9660LE32(sector + 166);
 
         /* !!! FIXME: deal with this properly. */
-        blocksize = PHYSFS_swapULE32(blocksize);
         BAIL_IF(blocksize && (blocksize != 2048), PHYSFS_ERR_UNSUPPORTED, 0);
 
         switch (type)
@@ -302,8 +352,8 @@ static int parseVolumeDescriptor(PHYSFS_Io *io, PHYSFS_uint64 *_rootpos,
             case 2:  /* Supplementary Volume Descriptor */
                 if (found < type)
                 {
-                    *_rootpos = PHYSFS_swapULE32(extent) * 2048;
-                    *_rootlen = PHYSFS_swapULE32(datalen);
+                    *_rootpos = ((PHYSFS_uint64) extent) * 2048;
+                    *_rootlen = datalen;
                     found = type;
 
                     if (found == 2)  /* possible Joliet volume */
@@ -337,6 +387,7 @@ static void *ISO9660_openArchive(PHYSFS_Io *io, const char *filename,
     PHYSFS_uint64 rootpos = 0;
     PHYSFS_uint64 len = 0;
     int joliet = 0;
+    int defer = 0;
     void *unpkarc = NULL;
 
     assert(io != NULL);  /* shouldn't ever happen. */
@@ -347,15 +398,24 @@ static void *ISO9660_openArchive(PHYSFS_Io *io, const char *filename,
         return NULL;
 
     /* !!! FIXME: check case_sensitive and only_usascii params for this archive. */
-    unpkarc = UNPK_openArchive(io, 1, 0);
+    unpkarc = UNPK_openArchive(io, 1, 0, 0);
     BAIL_IF_ERRPASS(!unpkarc, NULL);
 
-    if (!iso9660LoadEntries(io, joliet, "", rootpos, rootpos + len, unpkarc))
+    if (UNPK_loadIndex(unpkarc, "ISO", filename))
+        return unpkarc;  /* skip walking the whole disc's directories. */
+
+    defer = ISO9660_DEFER_DIRS && (PHYSFS_getMountIndexDir() == NULL);
+    if (defer)
+        UNPK_setDirLoader(unpkarc, iso9660LoadDeferredDir, joliet);
+
+    if (!iso9660LoadEntries(io, joliet, "", rootpos, rootpos + len, defer, unpkarc))
     {
         UNPK_abandonArchive(unpkarc);
         return NULL;
     } /* if */
 
+    UNPK_saveIndex(unpkarc, "ISO", filename);
+
     return unpkarc;
 } /* ISO9660_openArchive */
 
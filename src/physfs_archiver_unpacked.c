@@ -16,16 +16,28 @@
 #define __PHYSICSFS_INTERNAL__
 #include "physfs_internal.h"
 
+/*
+ * Each archive keeps up to this many closed files' state around for the next
+ *  open, so opening a file costs one duplicate of the archive's i/o instead
+ *  of that and two allocations.
+ */
+#ifndef UNPK_FILE_POOL_SIZE
+#define UNPK_FILE_POOL_SIZE 16
+#endif
+
 typedef struct
 {
     __PHYSFS_DirTree tree;
     PHYSFS_Io *io;
+    __PHYSFS_Pool files;  /* closed UNPKfiles, ready to reuse. */
+    UNPK_DirLoader loader;  /* for deferred dirs, if the format has them. */
+    int loaderArg;
 } UNPKinfo;
 
 typedef struct
 {
     __PHYSFS_DirTreeEntry tree;
-    PHYSFS_uint64 startPos;
+    PHYSFS_uint64 startPos;  /* for deferred dirs, what the loader wants. */
     PHYSFS_uint64 size;
     PHYSFS_sint64 ctime;
     PHYSFS_sint64 mtime;
@@ -35,15 +47,47 @@ typedef struct
 {
     PHYSFS_Io *io;
     UNPKentry *entry;
+    UNPKinfo *info;
     PHYSFS_uint32 curPos;
 } UNPKfileinfo;
 
+/* An open file's PHYSFS_Io and its state, in one allocation. */
+typedef struct
+{
+    PHYSFS_Io io;
+    UNPKfileinfo finfo;
+} UNPKfile;
+
+
+static void freePooledFile(void *file)
+{
+    allocator.Free(file);
+} /* freePooledFile */
+
+static UNPKfile *allocFile(UNPKinfo *info)
+{
+    UNPKfile *retval = (UNPKfile *) __PHYSFS_poolGet(&info->files);
+    if (retval == NULL)
+        retval = (UNPKfile *) allocator.Malloc(sizeof (UNPKfile));
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    memset(retval, '\0', sizeof (*retval));
+    retval->finfo.info = info;
+    return retval;
+} /* allocFile */
+
+static void freeFile(UNPKfile *file)
+{
+    if (!__PHYSFS_poolPut(&file->finfo.info->files, file))
+        allocator.Free(file);
+} /* freeFile */
+
 
 void UNPK_closeArchive(void *opaque)
 {
     UNPKinfo *info = ((UNPKinfo *) opaque);
     if (info)
     {
+        __PHYSFS_poolDeinit(&info->files, freePooledFile);
         __PHYSFS_DirTreeDeinit(&info->tree);
 
         if (info->io)
@@ -118,26 +162,21 @@ static PHYSFS_sint64 UNPK_length(PHYSFS_Io *io)
 static PHYSFS_Io *UNPK_duplicate(PHYSFS_Io *_io)
 {
     UNPKfileinfo *origfinfo = (UNPKfileinfo *) _io->opaque;
-    PHYSFS_Io *io = NULL;
-    PHYSFS_Io *retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    UNPKfileinfo *finfo = (UNPKfileinfo *) allocator.Malloc(sizeof (UNPKfileinfo));
-    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, UNPK_duplicate_failed);
-    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, UNPK_duplicate_failed);
-
-    io = origfinfo->io->duplicate(origfinfo->io);
-    if (!io) goto UNPK_duplicate_failed;
-    finfo->io = io;
-    finfo->entry = origfinfo->entry;
-    finfo->curPos = 0;
-    memcpy(retval, _io, sizeof (PHYSFS_Io));
-    retval->opaque = finfo;
-    return retval;
+    UNPKfile *file = allocFile(origfinfo->info);
+    BAIL_IF_ERRPASS(!file, NULL);
 
-UNPK_duplicate_failed:
-    if (finfo != NULL) allocator.Free(finfo);
-    if (retval != NULL) allocator.Free(retval);
-    if (io != NULL) io->destroy(io);
-    return NULL;
+    file->finfo.io = origfinfo->io->duplicate(origfinfo->io);
+    if (!file->finfo.io)
+    {
+        freeFile(file);
+        return NULL;
+    } /* if */
+
+    file->finfo.entry = origfinfo->entry;
+    file->finfo.curPos = 0;
+    memcpy(&file->io, _io, sizeof (PHYSFS_Io));
+    file->io.opaque = &file->finfo;
+    return &file->io;
 } /* UNPK_duplicate */
 
 static int UNPK_flush(PHYSFS_Io *io) { return 1;  /* no write support. */ }
@@ -146,8 +185,7 @@ static void UNPK_destroy(PHYSFS_Io *io)
 {
     UNPKfileinfo *finfo = (UNPKfileinfo *) io->opaque;
     finfo->io->destroy(finfo->io);
-    allocator.Free(finfo);
-    allocator.Free(io);
+    freeFile((UNPKfile *) io);  /* io is the first thing in an UNPKfile. */
 } /* UNPK_destroy */
 
 
@@ -165,6 +203,23 @@ static const PHYSFS_Io UNPK_Io =
 };
 
 
+int UNPK_getIoRange(PHYSFS_Io *io, PHYSFS_Io **parent,
+                    PHYSFS_uint64 *offset, PHYSFS_uint64 *len, int *raw)
+{
+    const UNPKfileinfo *finfo;
+
+    if (io->destroy != UNPK_destroy)
+        return 0;
+
+    finfo = (const UNPKfileinfo *) io->opaque;
+    *parent = finfo->io;
+    *offset = finfo->entry->startPos;
+    *len = finfo->entry->size;
+    *raw = 1;  /* we don't do compression. */
+    return 1;
+} /* UNPK_getIoRange */
+
+
 static inline UNPKentry *findEntry(UNPKinfo *info, const char *path)
 {
     return (UNPKentry *) __PHYSFS_DirTreeFind(&info->tree, path);
@@ -173,19 +228,17 @@ static inline UNPKentry *findEntry(UNPKinfo *info, const char *path)
 
 PHYSFS_Io *UNPK_openRead(void *opaque, const char *name)
 {
-    PHYSFS_Io *retval = NULL;
     UNPKinfo *info = (UNPKinfo *) opaque;
     UNPKfileinfo *finfo = NULL;
     UNPKentry *entry = findEntry(info, name);
+    UNPKfile *file;
 
     BAIL_IF_ERRPASS(!entry, NULL);
     BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
 
-    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, UNPK_openRead_failed);
-
-    finfo = (UNPKfileinfo *) allocator.Malloc(sizeof (UNPKfileinfo));
-    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, UNPK_openRead_failed);
+    file = allocFile(info);
+    BAIL_IF_ERRPASS(!file, NULL);
+    finfo = &file->finfo;
 
     finfo->io = info->io->duplicate(info->io);
     GOTO_IF_ERRPASS(!finfo->io, UNPK_openRead_failed);
@@ -196,21 +249,14 @@ PHYSFS_Io *UNPK_openRead(void *opaque, const char *name)
     finfo->curPos = 0;
     finfo->entry = entry;
 
-    memcpy(retval, &UNPK_Io, sizeof (*retval));
-    retval->opaque = finfo;
-    return retval;
+    memcpy(&file->io, &UNPK_Io, sizeof (PHYSFS_Io));
+    file->io.opaque = finfo;
+    return &file->io;
 
 UNPK_openRead_failed:
-    if (finfo != NULL)
-    {
-        if (finfo->io != NULL)
-            finfo->io->destroy(finfo->io);
-        allocator.Free(finfo);
-    } /* if */
-
-    if (retval != NULL)
-        allocator.Free(retval);
-
+    if (finfo->io != NULL)
+        finfo->io->destroy(finfo->io);
+    freeFile(file);
     return NULL;
 } /* UNPK_openRead */
 
@@ -239,12 +285,10 @@ int UNPK_mkdir(void *opaque, const char *name)
 } /* UNPK_mkdir */
 
 
-int UNPK_stat(void *opaque, const char *path, PHYSFS_Stat *stat)
+static int statEntry(void *opaque, __PHYSFS_DirTreeEntry *_entry,
+                     PHYSFS_Stat *stat)
 {
-    UNPKinfo *info = (UNPKinfo *) opaque;
-    const UNPKentry *entry = findEntry(info, path);
-
-    BAIL_IF_ERRPASS(!entry, 0);
+    const UNPKentry *entry = (const UNPKentry *) _entry;
 
     if (entry->tree.isdir)
     {
@@ -263,6 +307,15 @@ int UNPK_stat(void *opaque, const char *path, PHYSFS_Stat *stat)
     stat->readonly = 1;
 
     return 1;
+} /* statEntry */
+
+
+int UNPK_stat(void *opaque, const char *path, PHYSFS_Stat *stat)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    UNPKentry *entry = findEntry(info, path);
+    BAIL_IF_ERRPASS(!entry, 0);
+    return statEntry(info, &entry->tree, stat);
 } /* UNPK_stat */
 
 
@@ -285,18 +338,106 @@ void *UNPK_addEntry(void *opaque, char *name, const int isdir,
 } /* UNPK_addEntry */
 
 
-void *UNPK_openArchive(PHYSFS_Io *io, const int case_sensitive, const int only_usascii)
+void *UNPK_addDeferredDir(void *opaque, char *name,
+                          const PHYSFS_sint64 ctime, const PHYSFS_sint64 mtime,
+                          const PHYSFS_uint64 pos, const PHYSFS_uint64 len)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    UNPKentry *entry = (UNPKentry *) UNPK_addEntry(info, name, 1, ctime, mtime, 0, 0);
+    BAIL_IF_ERRPASS(!entry, NULL);
+    assert(info->loader != NULL);  /* UNPK_setDirLoader() wasn't called? */
+    entry->startPos = pos;
+    entry->size = len;
+    __PHYSFS_DirTreeDefer(&info->tree, &entry->tree);
+    return entry;
+} /* UNPK_addDeferredDir */
+
+
+static int loadDir(void *opaque, __PHYSFS_DirTreeEntry *_entry)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    UNPKentry *entry = (UNPKentry *) _entry;
+    const __PHYSFS_DirTreeEntry *i;
+    size_t len = 1;
+    char *path;
+    char *ptr;
+    int retval;
+
+    /* the loader wants the full path, but entries only know their name. */
+    for (i = _entry; i != info->tree.root; i = i->parent)
+        len += strlen(i->name) + 1;
+
+    path = (char *) __PHYSFS_smallAlloc(len);
+    BAIL_IF(!path, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    ptr = path + len - 1;
+    *ptr = '\0';
+    for (i = _entry; i != info->tree.root; i = i->parent)
+    {
+        const size_t namelen = strlen(i->name);
+        if (i != _entry)
+            *(--ptr) = '/';
+        ptr -= namelen;
+        memcpy(ptr, i->name, namelen);
+    } /* for */
+
+    retval = info->loader(info, info->io, info->loaderArg, ptr,
+                          entry->startPos, entry->size);
+    __PHYSFS_smallFree(path);
+
+    if (retval)
+        entry->startPos = entry->size = 0;  /* just a plain dir now. */
+
+    return retval;
+} /* loadDir */
+
+
+void UNPK_setDirLoader(void *opaque, UNPK_DirLoader loader, const int arg)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    info->loader = loader;
+    info->loaderArg = arg;
+    info->tree.loadDir = loadDir;
+} /* UNPK_setDirLoader */
+
+
+int UNPK_loadIndex(void *opaque, const char *arc, const char *name)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    return __PHYSFS_DirTreeLoadIndex(&info->tree, arc, name, info->io, NULL, 0);
+} /* UNPK_loadIndex */
+
+
+void UNPK_saveIndex(void *opaque, const char *arc, const char *name)
+{
+    UNPKinfo *info = (UNPKinfo *) opaque;
+    __PHYSFS_DirTreeSaveIndex(&info->tree, arc, name, info->io, NULL, 0);
+} /* UNPK_saveIndex */
+
+
+void *UNPK_openArchive(PHYSFS_Io *io, const int case_sensitive,
+                       const int only_usascii, const PHYSFS_uint64 entrycount)
 {
     UNPKinfo *info = (UNPKinfo *) allocator.Malloc(sizeof (UNPKinfo));
     BAIL_IF(!info, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
 
-    if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (UNPKentry), case_sensitive, only_usascii))
+    if (!__PHYSFS_poolInit(&info->files, UNPK_FILE_POOL_SIZE))
+    {
+        allocator.Free(info);
+        return NULL;
+    } /* if */
+
+    if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (UNPKentry), case_sensitive,
+                              only_usascii, entrycount))
     {
+        __PHYSFS_poolDeinit(&info->files, freePooledFile);
         allocator.Free(info);
         return NULL;
     } /* if */
 
+    info->tree.statEntry = statEntry;
     info->io = io;
+    info->loader = NULL;
+    info->loaderArg = 0;
 
     return info;
 } /* UNPK_openArchive */
@@ -15,12 +15,47 @@
 #include <errno.h>
 #include <time.h>
 
+/*
+ * The bundled miniz inflater is used unless the build picks another one:
+ *  PHYSFS_ZIP_USE_ZLIB uses the system's zlib (or zlib-ng, built for zlib
+ *  compatibility) for everything, and PHYSFS_ZIP_USE_LIBDEFLATE decodes
+ *  entries that are read in one go with libdeflate, leaving the rest to
+ *  miniz. CMake sets these from its PHYSFS_ZIP_INFLATE option.
+ */
+#ifndef PHYSFS_ZIP_USE_ZLIB
+#define PHYSFS_ZIP_USE_ZLIB 0
+#endif
+#ifndef PHYSFS_ZIP_USE_LIBDEFLATE
+#define PHYSFS_ZIP_USE_LIBDEFLATE 0
+#endif
+
+#if PHYSFS_ZIP_USE_ZLIB
+#include <zlib.h>
+#else
 #if (PHYSFS_BYTEORDER == PHYSFS_LIL_ENDIAN)
 #define MINIZ_LITTLE_ENDIAN 1
 #else
 #define MINIZ_LITTLE_ENDIAN 0
 #endif
 #include "physfs_miniz.h"
+#endif
+
+#if PHYSFS_ZIP_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+
+/*
+ * Zstandard-compressed entries (method 93) need libzstd, so they're only
+ *  supported if the build defines this (CMake's PHYSFS_ZIP_ZSTD option).
+ *  Other methods, besides stored and deflate, fail to open.
+ */
+#ifndef PHYSFS_ZIP_SUPPORTS_ZSTD
+#define PHYSFS_ZIP_SUPPORTS_ZSTD 0
+#endif
+
+#if PHYSFS_ZIP_SUPPORTS_ZSTD
+#include <zstd.h>
+#endif
 
 /*
  * A buffer of ZIP_READBUFSIZE is allocated for each compressed file opened,
@@ -36,6 +71,75 @@
  */
 #define ZIP_READBUFSIZE   (16 * 1024)
 
+/*
+ * Seeking backwards in a compressed entry means decompressing it again from
+ *  the start. For entries of at least ZIP_SEEKPOINT_MINSIZE uncompressed
+ *  bytes, we snapshot the inflater every ZIP_SEEKPOINT_INTERVAL bytes as we
+ *  decompress (at most ZIP_SEEKPOINT_MAX snapshots per open file, spacing
+ *  them further apart in bigger files), and seeks restart from the nearest
+ *  snapshot instead. Each snapshot costs a little over 40 kilobytes.
+ *
+ * Define ZIP_SEEKPOINT_MINSIZE to 0 to turn this off.
+ */
+#ifndef ZIP_SEEKPOINT_MINSIZE
+#define ZIP_SEEKPOINT_MINSIZE  (4 * 1024 * 1024)
+#endif
+#define ZIP_SEEKPOINT_INTERVAL (1024 * 1024)
+#define ZIP_SEEKPOINT_MAX      64
+
+/*
+ * A read that asks for all of a compressed entry from its start, like
+ *  PHYSFS_readBytes() of the file's whole length, reads all of the entry's
+ *  compressed data into one buffer and decompresses it in a single call
+ *  straight into the caller's buffer, instead of streaming it through
+ *  ZIP_READBUFSIZE bytes at a time. Entries with more than
+ *  ZIP_INFLATE_WHOLE_MAX compressed bytes are always streamed.
+ *
+ * Define ZIP_INFLATE_WHOLE_MAX to 0 to turn this off.
+ */
+#ifndef ZIP_INFLATE_WHOLE_MAX
+#define ZIP_INFLATE_WHOLE_MAX (64 * 1024 * 1024)
+#endif
+
+/*
+ * Compressed entries of up to ZIP_CACHE_MAXENTRY uncompressed bytes are
+ *  decompressed completely when opened, and kept in a per-archive cache of
+ *  up to ZIP_CACHE_MAXTOTAL bytes, dropping the least-recently opened ones
+ *  first. Opening a cached entry again doesn't touch the archive at all; it
+ *  just hands back a memory Io that shares the cached buffer.
+ *
+ * Define ZIP_CACHE_MAXTOTAL to 0 to turn this off.
+ */
+#ifndef ZIP_CACHE_MAXENTRY
+#define ZIP_CACHE_MAXENTRY (64 * 1024)
+#endif
+#ifndef ZIP_CACHE_MAXTOTAL
+#define ZIP_CACHE_MAXTOTAL (4 * 1024 * 1024)
+#endif
+#define ZIP_CACHE_BUCKETS  64
+
+/*
+ * Closing a file puts its state in a per-archive pool of up to
+ *  ZIP_FILE_POOL_SIZE, still holding its decompression buffer and inflater,
+ *  and the next open takes it from there instead of allocating all that
+ *  again. Each pooled file that has read a compressed entry costs about
+ *  60 kilobytes.
+ *
+ * Define ZIP_FILE_POOL_SIZE to 0 to turn this off.
+ */
+#ifndef ZIP_FILE_POOL_SIZE
+#define ZIP_FILE_POOL_SIZE 4
+#endif
+
+/*
+ * With PHYSFS_setResolveOnMount(), mounting checks every file's local header
+ *  in archive order, reading ZIP_RESOLVE_WINDOW bytes at a time, so the
+ *  headers of neighbouring small files come in with one read.
+ */
+#ifndef ZIP_RESOLVE_WINDOW
+#define ZIP_RESOLVE_WINDOW (64 * 1024)
+#endif
+
 
 /*
  * Entries are "unresolved" until they are first opened. At that time,
@@ -43,7 +147,10 @@
  *  at the actual file data instead of the header, and symlinks will be
  *  followed and optimized. This means that we don't seek and read around the
  *  archive until forced to do so, and after the first time, we had to do
- *  less reading and parsing, which is very CD-ROM friendly.
+ *  less reading and parsing, which is very CD-ROM friendly. With
+ *  PHYSFS_setResolveOnMount(), zip_resolve_all() does the files (but not
+ *  the symlinks) at mount time instead, and the mount index keeps the
+ *  results.
  */
 typedef enum
 {
@@ -64,19 +171,32 @@ typedef struct _ZIPentry
 {
     __PHYSFS_DirTreeEntry tree;         /* manages directory tree         */
     struct _ZIPentry *symlink;          /* NULL or file we symlink to     */
-    ZipResolveType resolved;            /* Have we resolved file/symlink? */
     PHYSFS_uint64 offset;               /* offset of data in archive      */
-    PHYSFS_uint16 version;              /* version made by                */
-    PHYSFS_uint16 version_needed;       /* version needed to extract      */
-    PHYSFS_uint16 general_bits;         /* general purpose bits           */
-    PHYSFS_uint16 compression_method;   /* compression method             */
-    PHYSFS_uint32 crc;                  /* crc-32                         */
     PHYSFS_uint64 compressed_size;      /* compressed size                */
     PHYSFS_uint64 uncompressed_size;    /* uncompressed size              */
     PHYSFS_sint64 last_mod_time;        /* last file mod time             */
+    ZipResolveType resolved;            /* Have we resolved file/symlink? */
+    PHYSFS_uint32 crc;                  /* crc-32                         */
     PHYSFS_uint32 dos_mod_time;         /* original MS-DOS style mod time */
+    PHYSFS_uint16 version;              /* version made by                */
+    PHYSFS_uint16 version_needed;       /* version needed to extract      */
+    PHYSFS_uint16 general_bits;         /* general purpose bits           */
+    PHYSFS_uint16 compression_method;   /* compression method             */
+    int verified;                       /* nonzero once its crc matched.  */
 } ZIPentry;
 
+/*
+ * One ZIPcacheitem is kept for each decompressed entry in the cache.
+ */
+typedef struct _ZIPcacheitem
+{
+    ZIPentry *entry;                 /* entry that was decompressed.      */
+    PHYSFS_Io *io;                   /* memory Io that owns the data.     */
+    struct _ZIPcacheitem *hashnext;  /* next item in hash bucket.         */
+    struct _ZIPcacheitem *prev;      /* more recently used item, or NULL. */
+    struct _ZIPcacheitem *next;      /* less recently used item, or NULL. */
+} ZIPcacheitem;
+
 /*
  * One ZIPinfo is kept for each open ZIP archive.
  */
@@ -86,13 +206,39 @@ typedef struct
     PHYSFS_Io *io;            /* the i/o interface for this archive.    */
     int zip64;                /* non-zero if this is a Zip64 archive.   */
     int has_crypto;           /* non-zero if any entry uses encryption. */
+    ZIPcacheitem *cache_hash[ZIP_CACHE_BUCKETS];  /* cached entries.    */
+    ZIPcacheitem *cache_head;  /* most recently used cache item.        */
+    ZIPcacheitem *cache_tail;  /* least recently used cache item.       */
+    PHYSFS_uint64 cache_size;  /* bytes of decompressed data cached.    */
+    __PHYSFS_Pool files;       /* closed ZIPfiles, ready to reuse.      */
+#if PHYSFS_SUPPORTS_STATS
+    PHYSFS_Stats *stats;       /* where to count decompression, or NULL. */
+#endif
 } ZIPinfo;
 
+#if PHYSFS_ZIP_USE_ZLIB
+typedef z_stream ZIPinflaterstate;  /* zlib's own state is opaque. */
+#else
+typedef inflate_state ZIPinflaterstate;
+#endif
+
+/*
+ * A snapshot of the inflater, to resume decompressing from later.
+ */
+typedef struct
+{
+    PHYSFS_uint64 uncompressed_position;  /* tell() at this point.      */
+    PHYSFS_uint64 compressed_position;    /* compressed bytes consumed. */
+    ZIPinflaterstate *state;              /* copy of inflater state.    */
+    PHYSFS_uint32 crc;                    /* crc-32 of data before it.  */
+} ZIPseekpoint;
+
 /*
  * One ZIPfileinfo is kept for each open file in a ZIP archive.
  */
 typedef struct
 {
+    ZIPinfo *info;                        /* archive this is in.        */
     ZIPentry *entry;                      /* Info on file.              */
     PHYSFS_Io *io;                        /* physical file handle.      */
     PHYSFS_uint32 compressed_position;    /* offset in compressed data. */
@@ -101,8 +247,34 @@ typedef struct
     PHYSFS_uint32 crypto_keys[3];         /* for "traditional" crypto.  */
     PHYSFS_uint32 initial_crypto_keys[3]; /* for "traditional" crypto.  */
     z_stream stream;                      /* zlib stream state.         */
+    ZIPseekpoint *seekpoints;             /* snapshots, in file order.  */
+    PHYSFS_uint32 seekpoint_count;        /* number of seekpoints.      */
+    PHYSFS_uint64 seekpoint_interval;     /* zero if no seekpoints.     */
+    PHYSFS_uint32 crc;                    /* crc-32 of data read so far. */
+    int verify;                           /* check crc at end of file?  */
+    int verify_raw;                       /* checksums were on at open. */
+    int corrupt;                          /* crc failed; reads fail too. */
+#if PHYSFS_ZIP_USE_LIBDEFLATE
+    struct libdeflate_decompressor *whole;  /* for whole-entry reads.   */
+#endif
+#if PHYSFS_ZIP_SUPPORTS_ZSTD
+    ZSTD_DStream *zstd;                   /* zstd decoder, once needed. */
+    ZSTD_inBuffer zstd_in;                /* zstd's view of (buffer).   */
+#endif
+#if PHYSFS_SUPPORTS_STATS
+    PHYSFS_Stats *stats;                  /* the archive's counters.    */
+#endif
 } ZIPfileinfo;
 
+/*
+ * An open file's PHYSFS_Io and its ZIPfileinfo, in one allocation.
+ */
+typedef struct
+{
+    PHYSFS_Io io;
+    ZIPfileinfo finfo;
+} ZIPfile;
+
 
 /* Magic numbers... */
 #define ZIP_LOCAL_FILE_SIG                          0x04034b50
@@ -112,8 +284,13 @@ typedef struct
 #define ZIP64_END_OF_CENTRAL_DIRECTORY_LOCATOR_SIG  0x07064b50
 #define ZIP64_EXTENDED_INFO_EXTRA_FIELD_SIG         0x0001
 
+/* fixed part of a local file header, before its filename and extra field. */
+#define ZIP_LOCAL_HEADER_LEN 30
+
 /* compression methods... */
 #define COMPMETH_NONE 0
+#define COMPMETH_DEFLATE 8
+#define COMPMETH_ZSTD 93
 /* ...and others... */
 
 
@@ -247,6 +424,50 @@ static void initializeZStream(z_stream *pstr)
 } /* initializeZStream */
 
 
+/*
+ * Start decompressing from scratch again, keeping the inflater's memory.
+ */
+static void zip_reset_inflater(ZIPfileinfo *finfo)
+{
+    z_stream *pstr = &finfo->stream;
+    inflateReset(pstr);
+    pstr->next_in = NULL;
+    pstr->avail_in = 0;
+    pstr->next_out = NULL;
+    pstr->avail_out = 0;
+} /* zip_reset_inflater */
+
+
+/* Start decoding an entry from the beginning, whatever its compression. */
+static void zip_reset_decoder(ZIPfileinfo *finfo)
+{
+    #if PHYSFS_ZIP_SUPPORTS_ZSTD
+    if (finfo->entry->compression_method == COMPMETH_ZSTD)
+    {
+        ZSTD_DCtx_reset(finfo->zstd, ZSTD_reset_session_only);
+        memset(&finfo->zstd_in, '\0', sizeof (finfo->zstd_in));
+        return;
+    } /* if */
+    #endif
+
+    zip_reset_inflater(finfo);
+} /* zip_reset_decoder */
+
+
+static int zip_compression_is_supported(const ZIPentry *entry)
+{
+    switch (entry->compression_method)
+    {
+        case COMPMETH_NONE: return 1;
+        case COMPMETH_DEFLATE: return 1;
+        #if PHYSFS_ZIP_SUPPORTS_ZSTD
+        case COMPMETH_ZSTD: return 1;
+        #endif
+        default: return 0;
+    } /* switch */
+} /* zip_compression_is_supported */
+
+
 static PHYSFS_ErrorCode zlib_error_code(int rc)
 {
     switch (rc)
@@ -269,6 +490,56 @@ static int zlib_err(const int rc)
     return rc;
 } /* zlib_err */
 
+
+/* Copy the inflater's state, for a seekpoint. NULL on failure. */
+static ZIPinflaterstate *zip_snapshot_inflater(ZIPfileinfo *finfo)
+{
+    ZIPinflaterstate *retval;
+    retval = (ZIPinflaterstate *) allocator.Malloc(sizeof (ZIPinflaterstate));
+    BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+
+    #if PHYSFS_ZIP_USE_ZLIB
+    if (zlib_err(inflateCopy(retval, &finfo->stream)) != Z_OK)
+    {
+        allocator.Free(retval);
+        return NULL;
+    } /* if */
+    #else
+    memcpy(retval, finfo->stream.state, sizeof (inflate_state));
+    #endif
+
+    return retval;
+} /* zip_snapshot_inflater */
+
+
+static void zip_free_inflater_snapshot(ZIPinflaterstate *state)
+{
+    #if PHYSFS_ZIP_USE_ZLIB
+    inflateEnd(state);
+    #endif
+    allocator.Free(state);
+} /* zip_free_inflater_snapshot */
+
+
+/* Put the inflater back the way it was at a snapshot. */
+static int zip_restore_inflater(ZIPfileinfo *finfo, ZIPinflaterstate *state)
+{
+    #if PHYSFS_ZIP_USE_ZLIB
+    /* zlib's state points back at its z_stream, so copy right into ours. */
+    inflateEnd(&finfo->stream);
+    if (zlib_err(inflateCopy(&finfo->stream, state)) != Z_OK)
+    {
+        /* keep a working inflater, since buffer says we have one. */
+        initializeZStream(&finfo->stream);
+        inflateInit2(&finfo->stream, -MAX_WBITS);
+        return 0;
+    } /* if */
+    #else
+    memcpy(finfo->stream.state, state, sizeof (inflate_state));
+    #endif
+    return 1;
+} /* zip_restore_inflater */
+
 /*
  * Read an unsigned 64-bit int and swap to native byte order.
  */
@@ -304,6 +575,352 @@ static int readui16(PHYSFS_Io *io, PHYSFS_uint16 *val)
 } /* readui16 */
 
 
+/* Decide if an open file should collect seekpoints as it decompresses. */
+static void zip_init_seekpoints(ZIPfileinfo *finfo)
+{
+    const ZIPentry *entry = finfo->entry;
+    PHYSFS_uint64 interval = ZIP_SEEKPOINT_INTERVAL;
+
+    finfo->seekpoints = NULL;
+    finfo->seekpoint_count = 0;
+    finfo->seekpoint_interval = 0;
+
+    if ( (ZIP_SEEKPOINT_MINSIZE == 0) ||
+         (entry->compression_method != COMPMETH_DEFLATE) ||  /* zstd, too. */
+         (entry->uncompressed_size < ZIP_SEEKPOINT_MINSIZE) ||
+         (zip_entry_is_tradional_crypto(entry)) )  /* can't rewind the keys. */
+        return;
+
+    if ((entry->uncompressed_size / ZIP_SEEKPOINT_MAX) > interval)
+        interval = entry->uncompressed_size / ZIP_SEEKPOINT_MAX;
+
+    finfo->seekpoint_interval = interval;
+} /* zip_init_seekpoints */
+
+
+static void zip_free_seekpoints(ZIPfileinfo *finfo)
+{
+    PHYSFS_uint32 i;
+    for (i = 0; i < finfo->seekpoint_count; i++)
+        zip_free_inflater_snapshot(finfo->seekpoints[i].state);
+    allocator.Free(finfo->seekpoints);
+    finfo->seekpoints = NULL;
+    finfo->seekpoint_count = 0;
+} /* zip_free_seekpoints */
+
+
+/* Snapshot the inflater if we've gone far enough past the last seekpoint. */
+static void zip_maybe_add_seekpoint(ZIPfileinfo *finfo)
+{
+    const PHYSFS_uint32 count = finfo->seekpoint_count;
+    const PHYSFS_uint64 pos = (PHYSFS_uint64) finfo->stream.total_out;
+    PHYSFS_uint64 nextpos = finfo->seekpoint_interval;
+    ZIPseekpoint *ptr;
+    ZIPinflaterstate *state;
+
+    if (count > 0)
+        nextpos += finfo->seekpoints[count - 1].uncompressed_position;
+
+    if ((pos < nextpos) || (count >= ZIP_SEEKPOINT_MAX))
+        return;
+
+    /* failing to allocate here isn't fatal; we just seek more slowly. */
+    state = zip_snapshot_inflater(finfo);
+    if (!state)
+        return;
+
+    ptr = (ZIPseekpoint *) allocator.Realloc(finfo->seekpoints,
+                                    (count + 1) * sizeof (ZIPseekpoint));
+    if (!ptr)
+    {
+        zip_free_inflater_snapshot(state);
+        return;
+    } /* if */
+
+    finfo->seekpoints = ptr;
+    ptr += count;
+    ptr->uncompressed_position = pos;
+    ptr->compressed_position = (PHYSFS_uint64) finfo->stream.total_in;
+    ptr->state = state;
+    ptr->crc = finfo->crc;
+    finfo->seekpoint_count++;
+} /* zip_maybe_add_seekpoint */
+
+
+/*
+ * Find the best seekpoint to get to (offset) from where we are now. NULL if
+ *  there isn't one better than decompressing onward (or from the start).
+ */
+static const ZIPseekpoint *zip_find_seekpoint(const ZIPfileinfo *finfo,
+                                              const PHYSFS_uint64 offset)
+{
+    const ZIPseekpoint *retval = NULL;
+    PHYSFS_uint32 lo = 0;
+    PHYSFS_uint32 hi = finfo->seekpoint_count;
+
+    while (lo < hi)  /* binary search for the last point <= offset. */
+    {
+        const PHYSFS_uint32 mid = lo + ((hi - lo) / 2);
+        if (finfo->seekpoints[mid].uncompressed_position <= offset)
+        {
+            retval = &finfo->seekpoints[mid];
+            lo = mid + 1;
+        } /* if */
+        else
+        {
+            hi = mid;
+        } /* else */
+    } /* while */
+
+    /* going forward and already past this point? Just keep decoding. */
+    if ( (retval != NULL) && (offset >= finfo->uncompressed_position) &&
+         (retval->uncompressed_position <= finfo->uncompressed_position) )
+        retval = NULL;
+
+    return retval;
+} /* zip_find_seekpoint */
+
+
+static int zip_restore_seekpoint(ZIPfileinfo *finfo, const ZIPseekpoint *pt)
+{
+    PHYSFS_Io *io = finfo->io;
+    BAIL_IF_ERRPASS(!io->seek(io, finfo->entry->offset + pt->compressed_position), 0);
+    BAIL_IF_ERRPASS(!zip_restore_inflater(finfo, pt->state), 0);
+    finfo->stream.next_in = finfo->buffer;
+    finfo->stream.avail_in = 0;
+    finfo->stream.total_in = (uLong) pt->compressed_position;
+    finfo->stream.total_out = (uLong) pt->uncompressed_position;
+    finfo->compressed_position = (PHYSFS_uint32) pt->compressed_position;
+    finfo->uncompressed_position = (PHYSFS_uint32) pt->uncompressed_position;
+    finfo->crc = pt->crc;
+    return 1;
+} /* zip_restore_seekpoint */
+
+
+/* Decompress up to (maxread) bytes into (buf), ZIP_READBUFSIZE at a time. */
+static PHYSFS_sint64 zip_inflate_stream(ZIPfileinfo *finfo, void *buf,
+                                        const PHYSFS_sint64 maxread)
+{
+    const ZIPentry *entry = finfo->entry;
+    PHYSFS_sint64 retval = 0;
+
+    finfo->stream.next_out = buf;
+    finfo->stream.avail_out = (uInt) maxread;
+
+    while (retval < maxread)
+    {
+        const PHYSFS_uint32 before = (PHYSFS_uint32) finfo->stream.total_out;
+        PHYSFS_uint32 produced;
+        int rc;
+
+        if (finfo->stream.avail_in == 0)
+        {
+            PHYSFS_sint64 br;
+
+            br = entry->compressed_size - finfo->compressed_position;
+            if (br > 0)
+            {
+                if (br > ZIP_READBUFSIZE)
+                    br = ZIP_READBUFSIZE;
+
+                br = zip_read_decrypt(finfo, finfo->buffer, (PHYSFS_uint64) br);
+                if (br <= 0)
+                    break;
+
+                finfo->compressed_position += (PHYSFS_uint32) br;
+                finfo->stream.next_in = finfo->buffer;
+                finfo->stream.avail_in = (unsigned int) br;
+            } /* if */
+        } /* if */
+
+        rc = zlib_err(inflate(&finfo->stream, Z_SYNC_FLUSH));
+        produced = (PHYSFS_uint32) finfo->stream.total_out - before;
+        if (finfo->verify)  /* per step, so seekpoints get it right. */
+        {
+            const PHYSFS_uint8 *out = ((PHYSFS_uint8 *) buf) + retval;
+            finfo->crc = __PHYSFS_crc32(finfo->crc, out, produced);
+        } /* if */
+        retval += produced;
+
+        if (rc != Z_OK)
+            break;
+
+        if (finfo->seekpoint_interval)
+            zip_maybe_add_seekpoint(finfo);
+    } /* while */
+
+    return retval;
+} /* zip_inflate_stream */
+
+
+#if PHYSFS_ZIP_SUPPORTS_ZSTD
+/* Decode up to (maxread) bytes of a Zstandard entry into (buf). */
+static PHYSFS_sint64 zip_zstd_stream(ZIPfileinfo *finfo, void *buf,
+                                     const PHYSFS_sint64 maxread)
+{
+    const ZIPentry *entry = finfo->entry;
+    ZSTD_inBuffer *in = &finfo->zstd_in;
+    ZSTD_outBuffer out;
+
+    out.dst = buf;
+    out.size = (size_t) maxread;
+    out.pos = 0;
+
+    while (out.pos < out.size)
+    {
+        size_t rc;
+
+        if (in->pos == in->size)
+        {
+            PHYSFS_sint64 br;
+
+            br = entry->compressed_size - finfo->compressed_position;
+            if (br <= 0)
+                break;  /* out of input; truncated entry? */
+            else if (br > ZIP_READBUFSIZE)
+                br = ZIP_READBUFSIZE;
+
+            br = zip_read_decrypt(finfo, finfo->buffer, (PHYSFS_uint64) br);
+            if (br <= 0)
+                break;
+
+            finfo->compressed_position += (PHYSFS_uint32) br;
+            in->src = finfo->buffer;
+            in->size = (size_t) br;
+            in->pos = 0;
+        } /* if */
+
+        rc = ZSTD_decompressStream(finfo->zstd, &out, in);
+        if (ZSTD_isError(rc))
+        {
+            PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+            break;
+        } /* if */
+    } /* while */
+
+    if (finfo->verify)
+        finfo->crc = __PHYSFS_crc32(finfo->crc, buf, out.pos);
+
+    return (PHYSFS_sint64) out.pos;
+} /* zip_zstd_stream */
+#endif
+
+
+/* Is this read for all of a compressed entry that hasn't been started yet? */
+static int zip_can_inflate_whole(const ZIPfileinfo *finfo,
+                                 const PHYSFS_sint64 maxread)
+{
+    const ZIPentry *entry = finfo->entry;
+    return ( (ZIP_INFLATE_WHOLE_MAX > 0) &&
+             (finfo->uncompressed_position == 0) &&
+             (finfo->compressed_position == 0) &&
+             (((PHYSFS_uint64) maxread) == entry->uncompressed_size) &&
+             (entry->compressed_size <= ZIP_INFLATE_WHOLE_MAX) );
+} /* zip_can_inflate_whole */
+
+
+/* Deflate all of (compressed) into (buf) with one call. */
+static PHYSFS_sint64 zip_deflate_whole(ZIPfileinfo *finfo, void *buf,
+                                       const PHYSFS_sint64 maxread,
+                                       PHYSFS_uint8 *compressed,
+                                       const PHYSFS_uint64 complen)
+{
+    PHYSFS_sint64 retval = -1;
+
+    #if PHYSFS_ZIP_USE_LIBDEFLATE
+    size_t produced = 0;
+
+    if (finfo->whole == NULL)  /* libdeflate allocates this itself. */
+        finfo->whole = libdeflate_alloc_decompressor();
+    BAIL_IF(!finfo->whole, PHYSFS_ERR_OUT_OF_MEMORY, -1);
+
+    if (libdeflate_deflate_decompress(finfo->whole, compressed,
+                                      (size_t) complen, buf,
+                                      (size_t) maxread, &produced)
+                                                       == LIBDEFLATE_SUCCESS)
+        retval = (PHYSFS_sint64) produced;
+    else
+        PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+    #else
+    /* a first call with Z_FINISH decodes straight into the output. */
+    finfo->stream.next_in = compressed;
+    finfo->stream.avail_in = (uInt) complen;
+    finfo->stream.next_out = buf;
+    finfo->stream.avail_out = (uInt) maxread;
+    if (zlib_err(inflate(&finfo->stream, Z_FINISH)) == Z_STREAM_END)
+        retval = (PHYSFS_sint64) finfo->stream.total_out;
+    finfo->stream.next_in = NULL;
+    finfo->stream.avail_in = 0;
+    #endif
+
+    return retval;
+} /* zip_deflate_whole */
+
+
+#if PHYSFS_ZIP_SUPPORTS_ZSTD
+/* Decode all of Zstandard (compressed) into (buf) with one call. */
+static PHYSFS_sint64 zip_zstd_whole(ZIPfileinfo *finfo, void *buf,
+                                    const PHYSFS_sint64 maxread,
+                                    PHYSFS_uint8 *compressed,
+                                    const PHYSFS_uint64 complen)
+{
+    const size_t rc = ZSTD_decompressDCtx(finfo->zstd, buf, (size_t) maxread,
+                                          compressed, (size_t) complen);
+    BAIL_IF(ZSTD_isError(rc), PHYSFS_ERR_CORRUPT, -1);
+    return (PHYSFS_sint64) rc;
+} /* zip_zstd_whole */
+#endif
+
+
+/*
+ * Read all of an entry's compressed data and decompress it into (buf) with
+ *  one call. Only for reads that zip_can_inflate_whole() says yes to.
+ */
+static PHYSFS_sint64 zip_inflate_whole(ZIPfileinfo *finfo, void *buf,
+                                       const PHYSFS_sint64 maxread)
+{
+    const ZIPentry *entry = finfo->entry;
+    PHYSFS_uint64 complen = entry->compressed_size;
+    PHYSFS_sint64 retval;
+    PHYSFS_uint8 *compressed;
+    PHYSFS_sint64 br;
+
+    if (zip_entry_is_tradional_crypto(entry))  /* header was read at open. */
+    {
+        BAIL_IF(complen < 12, PHYSFS_ERR_CORRUPT, -1);
+        complen -= 12;
+    } /* if */
+
+    BAIL_IF(complen == 0, PHYSFS_ERR_CORRUPT, -1);
+    compressed = (PHYSFS_uint8 *) allocator.Malloc((size_t) complen);
+    BAIL_IF(!compressed, PHYSFS_ERR_OUT_OF_MEMORY, -1);
+
+    br = zip_read_decrypt(finfo, compressed, complen);
+    if (br != (PHYSFS_sint64) complen)
+    {
+        allocator.Free(compressed);
+        BAIL_IF(br >= 0, PHYSFS_ERR_CORRUPT, -1);  /* truncated archive. */
+        return -1;  /* error is already set. */
+    } /* if */
+
+    finfo->compressed_position = (PHYSFS_uint32) complen;
+
+    #if PHYSFS_ZIP_SUPPORTS_ZSTD
+    if (entry->compression_method == COMPMETH_ZSTD)
+        retval = zip_zstd_whole(finfo, buf, maxread, compressed, complen);
+    else
+    #endif
+        retval = zip_deflate_whole(finfo, buf, maxread, compressed, complen);
+
+    allocator.Free(compressed);
+
+    if ((retval > 0) && (finfo->verify))
+        finfo->crc = __PHYSFS_crc32(finfo->crc, buf, (size_t) retval);
+
+    return retval;
+} /* zip_inflate_whole */
+
+
 static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
 {
     ZIPfileinfo *finfo = (ZIPfileinfo *) _io->opaque;
@@ -316,51 +933,53 @@ static PHYSFS_sint64 ZIP_read(PHYSFS_Io *_io, void *buf, PHYSFS_uint64 len)
     if (avail < maxread)
         maxread = avail;
 
+    /* don't let a bad crc look like a clean EOF on the next read. */
+    BAIL_IF(finfo->corrupt, PHYSFS_ERR_CORRUPT, -1);
     BAIL_IF_ERRPASS(maxread == 0, 0);    /* quick rejection. */
 
     if (entry->compression_method == COMPMETH_NONE)
+    {
         retval = zip_read_decrypt(finfo, buf, maxread);
+        if ((retval > 0) && (finfo->verify))
+            finfo->crc = __PHYSFS_crc32(finfo->crc, buf, (size_t) retval);
+    } /* if */
     else
     {
-        finfo->stream.next_out = buf;
-        finfo->stream.avail_out = (uInt) maxread;
+        #if PHYSFS_SUPPORTS_STATS
+        const PHYSFS_uint64 started = __PHYSFS_platformNanoseconds();
+        #endif
+
+        if (zip_can_inflate_whole(finfo, maxread))
+            retval = zip_inflate_whole(finfo, buf, maxread);
+        #if PHYSFS_ZIP_SUPPORTS_ZSTD
+        else if (entry->compression_method == COMPMETH_ZSTD)
+            retval = zip_zstd_stream(finfo, buf, maxread);
+        #endif
+        else
+            retval = zip_inflate_stream(finfo, buf, maxread);
 
-        while (retval < maxread)
+        __PHYSFS_STAT_ADD(finfo->stats, inflateNanoseconds,
+                          __PHYSFS_platformNanoseconds() - started);
+        if (retval > 0)
         {
-            const PHYSFS_uint32 before = (PHYSFS_uint32) finfo->stream.total_out;
-            int rc;
-
-            if (finfo->stream.avail_in == 0)
-            {
-                PHYSFS_sint64 br;
-
-                br = entry->compressed_size - finfo->compressed_position;
-                if (br > 0)
-                {
-                    if (br > ZIP_READBUFSIZE)
-                        br = ZIP_READBUFSIZE;
-
-                    br = zip_read_decrypt(finfo, finfo->buffer, (PHYSFS_uint64) br);
-                    if (br <= 0)
-                        break;
-
-                    finfo->compressed_position += (PHYSFS_uint32) br;
-                    finfo->stream.next_in = finfo->buffer;
-                    finfo->stream.avail_in = (unsigned int) br;
-                } /* if */
-            } /* if */
-
-            rc = zlib_err(inflate(&finfo->stream, Z_SYNC_FLUSH));
-            retval += (finfo->stream.total_out - before);
-
-            if (rc != Z_OK)
-                break;
-        } /* while */
+            __PHYSFS_STAT_ADD(finfo->stats, inflateBytes, retval);
+        } /* if */
     } /* else */
 
     if (retval > 0)
         finfo->uncompressed_position += (PHYSFS_uint32) retval;
 
+    if ((finfo->verify) &&
+        (finfo->uncompressed_position == entry->uncompressed_size))
+    {
+        if (finfo->crc != entry->crc)
+        {
+            finfo->corrupt = 1;
+            BAIL(PHYSFS_ERR_CORRUPT, -1);
+        } /* if */
+        __PHYSFS_ATOMIC_SETINT(&entry->verified, 1);
+    } /* if */
+
     return retval;
 } /* ZIP_read */
 
@@ -390,6 +1009,17 @@ static int ZIP_seek(PHYSFS_Io *_io, PHYSFS_uint64 offset)
     {
         PHYSFS_sint64 newpos = offset + entry->offset;
         BAIL_IF_ERRPASS(!io->seek(io, newpos), 0);
+
+        /* we can't know the crc past a gap we didn't read, but reading it
+           all again from the start gets it back. */
+        if (offset == 0)
+        {
+            finfo->crc = 0;
+            finfo->verify = finfo->verify_raw;
+        } /* if */
+        else if (offset != finfo->uncompressed_position)
+            finfo->verify = 0;
+
         finfo->uncompressed_position = (PHYSFS_uint32) offset;
     } /* if */
 
@@ -397,24 +1027,29 @@ static int ZIP_seek(PHYSFS_Io *_io, PHYSFS_uint64 offset)
     {
         /*
          * If seeking backwards, we need to redecode the file
-         *  from the start and throw away the compressed bits until we hit
-         *  the offset we need. If seeking forward, we still need to
-         *  decode, but we don't rewind first.
+         *  from the start (or the closest seekpoint before the offset) and
+         *  throw away the compressed bits until we hit the offset we need.
+         *  If seeking forward, we still need to decode, but we don't rewind
+         *  first, unless there's a seekpoint that gets us closer.
          */
+        const ZIPseekpoint *pt = zip_find_seekpoint(finfo, offset);
+
         if (offset < finfo->uncompressed_position)
+            __PHYSFS_STAT_ADD(finfo->stats, seekRewinds, 1);
+
+        if (pt != NULL)
         {
-            /* we do a copy so state is sane if inflateInit2() fails. */
-            z_stream str;
-            initializeZStream(&str);
-            if (zlib_err(inflateInit2(&str, -MAX_WBITS)) != Z_OK)
-                return 0;
+            BAIL_IF_ERRPASS(!zip_restore_seekpoint(finfo, pt), 0);
+        } /* if */
 
+        else if (offset < finfo->uncompressed_position)
+        {
             if (!io->seek(io, entry->offset + (encrypted ? 12 : 0)))
                 return 0;
 
-            inflateEnd(&finfo->stream);
-            memcpy(&finfo->stream, &str, sizeof (z_stream));
+            zip_reset_decoder(finfo);
             finfo->uncompressed_position = finfo->compressed_position = 0;
+            finfo->crc = 0;
 
             if (encrypted)
                 memcpy(finfo->crypto_keys, finfo->initial_crypto_keys, 12);
@@ -445,53 +1080,146 @@ static PHYSFS_sint64 ZIP_length(PHYSFS_Io *io)
 } /* ZIP_length */
 
 
-static PHYSFS_Io *zip_get_io(PHYSFS_Io *io, ZIPinfo *inf, ZIPentry *entry);
-
-static PHYSFS_Io *ZIP_duplicate(PHYSFS_Io *io)
+static void zip_free_pooled_file(void *_file)
 {
-    ZIPfileinfo *origfinfo = (ZIPfileinfo *) io->opaque;
-    PHYSFS_Io *retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    ZIPfileinfo *finfo = (ZIPfileinfo *) allocator.Malloc(sizeof (ZIPfileinfo));
-    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, failed);
-    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, failed);
-    memset(finfo, '\0', sizeof (*finfo));
+    ZIPfile *file = (ZIPfile *) _file;
+    if (file->finfo.stream.state != NULL)
+        inflateEnd(&file->finfo.stream);
+    #if PHYSFS_ZIP_USE_LIBDEFLATE
+    if (file->finfo.whole != NULL)
+        libdeflate_free_decompressor(file->finfo.whole);
+    #endif
+    #if PHYSFS_ZIP_SUPPORTS_ZSTD
+    if (file->finfo.zstd != NULL)
+        ZSTD_freeDStream(file->finfo.zstd);
+    #endif
+    if (file->finfo.buffer != NULL)
+        allocator.Free(file->finfo.buffer);
+    allocator.Free(file);
+} /* zip_free_pooled_file */
 
-    finfo->entry = origfinfo->entry;
-    finfo->io = zip_get_io(origfinfo->io, NULL, finfo->entry);
-    GOTO_IF_ERRPASS(!finfo->io, failed);
 
-    initializeZStream(&finfo->stream);
-    if (finfo->entry->compression_method != COMPMETH_NONE)
+/*
+ * Get a ZIPfile for reading (entry), from the archive's pool if possible.
+ *  Everything but (io) is set up: pooled ones keep their buffer and
+ *  decoders, which just get reset here. A decoder is only created the
+ *  first time a file is used for an entry that needs it.
+ */
+static ZIPfile *zip_alloc_file(ZIPinfo *info, ZIPentry *entry)
+{
+    ZIPfile *retval = (ZIPfile *) __PHYSFS_poolGet(&info->files);
+    PHYSFS_uint8 *buffer = NULL;
+    #if PHYSFS_ZIP_USE_LIBDEFLATE
+    struct libdeflate_decompressor *whole = NULL;
+    #endif
+    #if PHYSFS_ZIP_SUPPORTS_ZSTD
+    ZSTD_DStream *zstd = NULL;
+    #endif
+    z_stream stream;
+
+    initializeZStream(&stream);
+    if (retval != NULL)
     {
-        finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
-        GOTO_IF(!finfo->buffer, PHYSFS_ERR_OUT_OF_MEMORY, failed);
-        if (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) != Z_OK)
-            goto failed;
+        buffer = retval->finfo.buffer;
+        stream.state = retval->finfo.stream.state;
+        #if PHYSFS_ZIP_USE_LIBDEFLATE
+        whole = retval->finfo.whole;
+        #endif
+        #if PHYSFS_ZIP_SUPPORTS_ZSTD
+        zstd = retval->finfo.zstd;
+        #endif
     } /* if */
+    else
+    {
+        retval = (ZIPfile *) allocator.Malloc(sizeof (ZIPfile));
+        BAIL_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    } /* else */
 
-    memcpy(retval, io, sizeof (PHYSFS_Io));
-    retval->opaque = finfo;
-    return retval;
+    memset(retval, '\0', sizeof (ZIPfile));
+    retval->finfo.info = info;
+    retval->finfo.entry = entry;
+    retval->finfo.buffer = buffer;
+    retval->finfo.verify = PHYSFS_isVerifyingChecksums();
+    retval->finfo.verify_raw = retval->finfo.verify;
+    memcpy(&retval->finfo.stream, &stream, sizeof (z_stream));
+    #if PHYSFS_ZIP_USE_LIBDEFLATE
+    retval->finfo.whole = whole;
+    #endif
+    #if PHYSFS_ZIP_SUPPORTS_ZSTD
+    retval->finfo.zstd = zstd;
+    #endif
+    #if PHYSFS_SUPPORTS_STATS
+    retval->finfo.stats = info->stats;
+    #endif
 
-failed:
-    if (finfo != NULL)
+    if (entry->compression_method == COMPMETH_NONE)
+        return retval;
+
+    if (buffer == NULL)
     {
-        if (finfo->io != NULL)
-            finfo->io->destroy(finfo->io);
+        buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
+        GOTO_IF(!buffer, PHYSFS_ERR_OUT_OF_MEMORY, failed);
+        retval->finfo.buffer = buffer;
+    } /* if */
 
-        if (finfo->buffer != NULL)
+    #if PHYSFS_ZIP_SUPPORTS_ZSTD
+    if (entry->compression_method == COMPMETH_ZSTD)
+    {
+        if (zstd == NULL)  /* libzstd allocates this itself. */
         {
-            allocator.Free(finfo->buffer);
-            inflateEnd(&finfo->stream);
+            retval->finfo.zstd = ZSTD_createDStream();
+            GOTO_IF(!retval->finfo.zstd, PHYSFS_ERR_OUT_OF_MEMORY, failed);
         } /* if */
-
-        allocator.Free(finfo);
+        zip_reset_decoder(&retval->finfo);
+        return retval;
     } /* if */
+    #endif
 
-    if (retval != NULL)
-        allocator.Free(retval);
+    if (stream.state != NULL)
+        zip_reset_inflater(&retval->finfo);
+    else if (zlib_err(inflateInit2(&retval->finfo.stream, -MAX_WBITS)) != Z_OK)
+        goto failed;
 
+    return retval;
+
+failed:
+    zip_free_pooled_file(retval);
     return NULL;
+} /* zip_alloc_file */
+
+
+/* Puts (file) back in its archive's pool, or frees it. (io) must be gone. */
+static void zip_release_file(ZIPfile *file)
+{
+    zip_free_seekpoints(&file->finfo);
+    if (!__PHYSFS_poolPut(&file->finfo.info->files, file))
+        zip_free_pooled_file(file);
+} /* zip_release_file */
+
+
+static PHYSFS_Io *zip_get_io(PHYSFS_Io *io, ZIPinfo *inf, ZIPentry *entry);
+
+static PHYSFS_Io *ZIP_duplicate(PHYSFS_Io *io)
+{
+    ZIPfileinfo *origfinfo = (ZIPfileinfo *) io->opaque;
+    ZIPfile *file = zip_alloc_file(origfinfo->info, origfinfo->entry);
+    ZIPfileinfo *finfo;
+
+    BAIL_IF_ERRPASS(!file, NULL);
+    finfo = &file->finfo;
+
+    finfo->io = zip_get_io(origfinfo->io, NULL, finfo->entry);
+    if (!finfo->io)
+    {
+        zip_release_file(file);
+        return NULL;
+    } /* if */
+
+    zip_init_seekpoints(finfo);
+
+    memcpy(&file->io, io, sizeof (PHYSFS_Io));
+    file->io.opaque = finfo;
+    return &file->io;
 } /* ZIP_duplicate */
 
 static int ZIP_flush(PHYSFS_Io *io) { return 1;  /* no write support. */ }
@@ -500,15 +1228,7 @@ static void ZIP_destroy(PHYSFS_Io *io)
 {
     ZIPfileinfo *finfo = (ZIPfileinfo *) io->opaque;
     finfo->io->destroy(finfo->io);
-
-    if (finfo->entry->compression_method != COMPMETH_NONE)
-        inflateEnd(&finfo->stream);
-
-    if (finfo->buffer != NULL)
-        allocator.Free(finfo->buffer);
-
-    allocator.Free(finfo);
-    allocator.Free(io);
+    zip_release_file((ZIPfile *) io);  /* io is first thing in a ZIPfile. */
 } /* ZIP_destroy */
 
 
@@ -526,6 +1246,148 @@ static const PHYSFS_Io ZIP_Io =
 };
 
 
+/* crc-32 a stored (entry)'s bytes, straight out of the archive's (io). */
+static int zip_crc_stored(PHYSFS_Io *io, const ZIPentry *entry,
+                          PHYSFS_uint32 *crc)
+{
+    const PHYSFS_uint8 *arcbuf;
+    PHYSFS_uint64 arclen = 0;
+    PHYSFS_uint64 remain = entry->uncompressed_size;
+    PHYSFS_uint8 *buf;
+    PHYSFS_Io *dup;
+    int retval = 1;
+
+    *crc = 0;
+
+    arcbuf = (const PHYSFS_uint8 *) __PHYSFS_getIoBuffer(io, &arclen);
+    if ((arcbuf != NULL) && (entry->offset <= arclen) &&
+        (remain <= (arclen - entry->offset)))
+    {
+        arcbuf += entry->offset;
+        while (remain > 0)  /* size_t might be smaller than the entry. */
+        {
+            const size_t chunk = (size_t) ((remain < 0x40000000) ? remain : 0x40000000);
+            *crc = __PHYSFS_crc32(*crc, arcbuf, chunk);
+            arcbuf += chunk;
+            remain -= chunk;
+        } /* while */
+        return 1;
+    } /* if */
+
+    /* a duplicate, so we don't move the open file's position. */
+    buf = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
+    BAIL_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    dup = io->duplicate(io);
+    if ((!dup) || (!dup->seek(dup, entry->offset)))
+        retval = 0;
+
+    while ((retval) && (remain > 0))
+    {
+        const PHYSFS_uint64 chunk = (remain < ZIP_READBUFSIZE) ? remain : ZIP_READBUFSIZE;
+        if (!__PHYSFS_readAll(dup, buf, (size_t) chunk))
+            retval = 0;
+        else
+        {
+            *crc = __PHYSFS_crc32(*crc, buf, (size_t) chunk);
+            remain -= chunk;
+        } /* else */
+    } /* while */
+
+    if (dup)
+        dup->destroy(dup);
+    allocator.Free(buf);
+    return retval;
+} /* zip_crc_stored */
+
+
+int ZIP_verifyIo(PHYSFS_Io *io, const int check)
+{
+    const ZIPfileinfo *finfo;
+    ZIPentry *entry;
+    PHYSFS_uint32 crc = 0;
+
+    if (io->destroy != ZIP_destroy)
+        return 1;
+
+    finfo = (const ZIPfileinfo *) io->opaque;
+    entry = finfo->entry;
+    if ((!finfo->verify_raw) || (__PHYSFS_ATOMIC_GETINT(&entry->verified)))
+        return 1;
+    else if (finfo->corrupt)
+        BAIL(PHYSFS_ERR_CORRUPT, 0);
+    else if (entry->compression_method != COMPMETH_NONE)
+        return 1;  /* never handed out raw; read() is the only way in. */
+    else if (zip_entry_is_tradional_crypto(entry))
+        return 1;  /* same. */
+    else if (!check)
+        return 0;
+
+    BAIL_IF_ERRPASS(!zip_crc_stored(finfo->io, entry, &crc), 0);
+    BAIL_IF(crc != entry->crc, PHYSFS_ERR_CORRUPT, 0);
+    __PHYSFS_ATOMIC_SETINT(&entry->verified, 1);
+    return 1;
+} /* ZIP_verifyIo */
+
+
+/* stored, unencrypted entries in a memory-resident archive need no copy. */
+const void *ZIP_getIoBuffer(PHYSFS_Io *io, PHYSFS_uint64 *len)
+{
+    const ZIPfileinfo *finfo;
+    const ZIPentry *entry;
+    const PHYSFS_uint8 *arcbuf;
+    PHYSFS_uint64 arclen = 0;
+    PHYSFS_ErrorCode prev;
+    int verified;
+
+    if (io->destroy != ZIP_destroy)
+        return NULL;
+
+    finfo = (const ZIPfileinfo *) io->opaque;
+    entry = finfo->entry;
+    if (entry->compression_method != COMPMETH_NONE)
+        return NULL;
+    else if (zip_entry_is_tradional_crypto(entry))
+        return NULL;
+
+    arcbuf = (const PHYSFS_uint8 *) __PHYSFS_getIoBuffer(finfo->io, &arclen);
+    if ((arcbuf == NULL) || (entry->offset > arclen) ||
+        (entry->uncompressed_size > (arclen - entry->offset)))
+        return NULL;
+
+    /* Callers read this instead of calling read(), which checks the crc, so
+       check it here. If it's bad, they copy through read() and fail there. */
+    prev = PHYSFS_getLastErrorCode();
+    verified = ZIP_verifyIo(io, 1);
+    (void) PHYSFS_getLastErrorCode();  /* we don't fail; leave the caller's. */
+    PHYSFS_setErrorCode(prev);
+    if (!verified)
+        return NULL;
+
+    *len = entry->uncompressed_size;
+    return arcbuf + entry->offset;
+} /* ZIP_getIoBuffer */
+
+
+int ZIP_getIoRange(PHYSFS_Io *io, PHYSFS_Io **parent,
+                   PHYSFS_uint64 *offset, PHYSFS_uint64 *len, int *raw)
+{
+    const ZIPfileinfo *finfo;
+    const ZIPentry *entry;
+
+    if (io->destroy != ZIP_destroy)
+        return 0;
+
+    finfo = (const ZIPfileinfo *) io->opaque;
+    entry = finfo->entry;  /* opened, so already resolved. */
+    *parent = finfo->io;
+    *offset = entry->offset;
+    *len = entry->compressed_size;
+    *raw = ( (entry->compression_method == COMPMETH_NONE) &&
+             (!zip_entry_is_tradional_crypto(entry)) );
+    return 1;
+} /* ZIP_getIoRange */
+
+
 
 static PHYSFS_sint64 zip_find_end_of_central_dir(PHYSFS_Io *io, PHYSFS_sint64 *len)
 {
@@ -771,6 +1633,25 @@ static int zip_resolve_symlink(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
     if (entry->compression_method == COMPMETH_NONE)
         rc = __PHYSFS_readAll(io, path, size);
 
+    #if PHYSFS_ZIP_SUPPORTS_ZSTD
+    else if (entry->compression_method == COMPMETH_ZSTD)
+    {
+        const size_t complen = (size_t) entry->compressed_size;
+        PHYSFS_uint8 *compressed = (PHYSFS_uint8*) __PHYSFS_smallAlloc(complen);
+        if (compressed != NULL)
+        {
+            if (__PHYSFS_readAll(io, compressed, complen))
+            {
+                const size_t zrc = ZSTD_decompress(path, size, compressed, complen);
+                rc = (!ZSTD_isError(zrc) && (zrc == size));
+                if (!rc)
+                    PHYSFS_setErrorCode(PHYSFS_ERR_CORRUPT);
+            } /* if */
+            __PHYSFS_smallFree(compressed);
+        } /* if */
+    } /* else if */
+    #endif
+
     else  /* symlink target path is compressed... */
     {
         z_stream stream;
@@ -811,15 +1692,26 @@ static int zip_resolve_symlink(PHYSFS_Io *io, ZIPinfo *info, ZIPentry *entry)
 } /* zip_resolve_symlink */
 
 
+static inline PHYSFS_uint16 zip_le16(const PHYSFS_uint8 *p)
+{
+    return (PHYSFS_uint16) (((PHYSFS_uint16) p[0]) | (((PHYSFS_uint16) p[1]) << 8));
+} /* zip_le16 */
+
+static inline PHYSFS_uint32 zip_le32(const PHYSFS_uint8 *p)
+{
+    return ((PHYSFS_uint32) p[0]) | (((PHYSFS_uint32) p[1]) << 8) |
+           (((PHYSFS_uint32) p[2]) << 16) | (((PHYSFS_uint32) p[3]) << 24);
+} /* zip_le32 */
+
+
 /*
- * Parse the local file header of an entry, and update entry->offset.
+ * Check the ZIP_LOCAL_HEADER_LEN bytes at (hdr) against (entry), and return
+ *  the full length of the local header (where the data starts, relative to
+ *  entry->offset), or zero if it's corrupt. This doesn't set an error.
  */
-static int zip_parse_local(PHYSFS_Io *io, ZIPentry *entry)
+static PHYSFS_uint32 zip_check_local(ZIPentry *entry, const PHYSFS_uint8 *hdr)
 {
     PHYSFS_uint32 ui32;
-    PHYSFS_uint16 ui16;
-    PHYSFS_uint16 fnamelen;
-    PHYSFS_uint16 extralen;
 
     /*
      * crc and (un)compressed_size are always zero if this is a "JAR"
@@ -834,33 +1726,46 @@ static int zip_parse_local(PHYSFS_Io *io, ZIPentry *entry)
        !!! FIXME:  which is probably true for Jar files, fwiw, but we don't
        !!! FIXME:  care about these values anyhow. */
 
-    BAIL_IF_ERRPASS(!io->seek(io, entry->offset), 0);
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
-    BAIL_IF(ui32 != ZIP_LOCAL_FILE_SIG, PHYSFS_ERR_CORRUPT, 0);
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), 0);
+    if (zip_le32(hdr) != ZIP_LOCAL_FILE_SIG)
+        return 0;
+    else if (zip_le16(hdr + 8) != entry->compression_method)
+        return 0;
+
+    ui32 = zip_le32(hdr + 14);
+    if (ui32 && (ui32 != entry->crc))
+        return 0;
+
+    ui32 = zip_le32(hdr + 18);
+    if (ui32 && (ui32 != 0xFFFFFFFF) && (ui32 != entry->compressed_size))
+        return 0;
+
+    ui32 = zip_le32(hdr + 22);
+    if (ui32 && (ui32 != 0xFFFFFFFF) && (ui32 != entry->uncompressed_size))
+        return 0;
+
     /* Windows Explorer might rewrite the entire central directory, setting
        this field to 2.0/MS-DOS for all files, so favor the local version,
        which it leaves intact if it didn't alter that specific file. */
-    entry->version_needed = ui16;
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), 0);  /* general bits. */
-    BAIL_IF_ERRPASS(!readui16(io, &ui16), 0);
-    BAIL_IF(ui16 != entry->compression_method, PHYSFS_ERR_CORRUPT, 0);
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);  /* date/time */
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
-    BAIL_IF(ui32 && (ui32 != entry->crc), PHYSFS_ERR_CORRUPT, 0);
+    entry->version_needed = zip_le16(hdr + 4);
 
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
-    BAIL_IF(ui32 && (ui32 != 0xFFFFFFFF) &&
-                  (ui32 != entry->compressed_size), PHYSFS_ERR_CORRUPT, 0);
+    return ZIP_LOCAL_HEADER_LEN + zip_le16(hdr + 26) + zip_le16(hdr + 28);
+} /* zip_check_local */
 
-    BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
-    BAIL_IF(ui32 && (ui32 != 0xFFFFFFFF) &&
-                 (ui32 != entry->uncompressed_size), PHYSFS_ERR_CORRUPT, 0);
 
-    BAIL_IF_ERRPASS(!readui16(io, &fnamelen), 0);
-    BAIL_IF_ERRPASS(!readui16(io, &extralen), 0);
+/*
+ * Parse the local file header of an entry, and update entry->offset.
+ */
+static int zip_parse_local(PHYSFS_Io *io, ZIPentry *entry)
+{
+    PHYSFS_uint8 hdr[ZIP_LOCAL_HEADER_LEN];
+    PHYSFS_uint32 hdrlen;
 
-    entry->offset += fnamelen + extralen + 30;
+    BAIL_IF_ERRPASS(!io->seek(io, entry->offset), 0);
+    BAIL_IF_ERRPASS(!__PHYSFS_readAll(io, hdr, sizeof (hdr)), 0);
+    hdrlen = zip_check_local(entry, hdr);
+    BAIL_IF(!hdrlen, PHYSFS_ERR_CORRUPT, 0);
+
+    entry->offset += hdrlen;
     return 1;
 } /* zip_parse_local */
 
@@ -993,10 +1898,9 @@ static PHYSFS_sint64 zip_dos_time_to_physfs_time(PHYSFS_uint32 dostime)
 } /* zip_dos_time_to_physfs_time */
 
 
-static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
-                                const PHYSFS_uint64 ofs_fixup)
+static ZIPentry *zip_load_entry(ZIPinfo *info, PHYSFS_Io *io,
+                                const int zip64, const PHYSFS_uint64 ofs_fixup)
 {
-    PHYSFS_Io *io = info->io;
     ZIPentry entry;
     ZIPentry *retval = NULL;
     PHYSFS_uint16 fnamelen, extralen, commentlen;
@@ -1142,41 +2046,200 @@ static ZIPentry *zip_load_entry(ZIPinfo *info, const int zip64,
         BAIL_IF(len != 0, PHYSFS_ERR_CORRUPT, NULL);
     } /* if */
 
-    BAIL_IF(starting_disk != 0, PHYSFS_ERR_CORRUPT, NULL);
+    BAIL_IF(starting_disk != 0, PHYSFS_ERR_CORRUPT, NULL);
+
+    retval->offset = offset + ofs_fixup;
+
+    /* seek to the start of the next entry in the central directory... */
+    BAIL_IF_ERRPASS(!io->seek(io, si64 + extralen + commentlen), NULL);
+
+    return retval;  /* success. */
+} /* zip_load_entry */
+
+
+/*
+ * Pull the whole central directory into memory with one read, and hand back
+ *  an Io that parses out of that, so we don't make several tiny reads per
+ *  entry on the real Io. Returns NULL if that isn't possible (the directory
+ *  is absurdly large, out of memory, etc), and the caller should just fall
+ *  back to reading from the archive directly.
+ */
+static PHYSFS_Io *zip_buffer_central_dir(PHYSFS_Io *io,
+                                         const PHYSFS_uint64 central_ofs,
+                                         const PHYSFS_uint64 central_len)
+{
+    PHYSFS_Io *retval = NULL;
+    void *buf;
+
+    if ((central_len == 0) || (central_len > ((size_t) -1)))
+        return NULL;
+
+    buf = allocator.Malloc(central_len);
+    if (!buf)
+        return NULL;
+
+    if (io->seek(io, central_ofs) && __PHYSFS_readAll(io, buf, (size_t) central_len))
+        retval = __PHYSFS_createMemoryIo(buf, central_len, allocator.Free);
 
-    retval->offset = offset + ofs_fixup;
+    if (!retval)
+        allocator.Free(buf);
 
-    /* seek to the start of the next entry in the central directory... */
-    BAIL_IF_ERRPASS(!io->seek(io, si64 + extralen + commentlen), NULL);
+    return retval;
+} /* zip_buffer_central_dir */
 
-    return retval;  /* success. */
-} /* zip_load_entry */
 
+static int zip_init_tree(ZIPinfo *info, const PHYSFS_uint64 entrycount);
 
 /* This leaves things allocated on error; the caller will clean up the mess. */
-static int zip_load_entries(ZIPinfo *info,
-                            const PHYSFS_uint64 data_ofs,
-                            const PHYSFS_uint64 central_ofs,
-                            const PHYSFS_uint64 entry_count)
+static int zip_parse_entries(ZIPinfo *info, PHYSFS_Io *io,
+                             const PHYSFS_uint64 data_ofs,
+                             const PHYSFS_uint64 entry_count)
 {
-    PHYSFS_Io *io = info->io;
     const int zip64 = info->zip64;
     PHYSFS_uint64 i;
 
-    BAIL_IF_ERRPASS(!io->seek(io, central_ofs), 0);
-
     for (i = 0; i < entry_count; i++)
     {
-        ZIPentry *entry = zip_load_entry(info, zip64, data_ofs);
+        ZIPentry *entry = zip_load_entry(info, io, zip64, data_ofs);
         BAIL_IF_ERRPASS(!entry, 0);
         if (zip_entry_is_tradional_crypto(entry))
             info->has_crypto = 1;
     } /* for */
 
     return 1;
+} /* zip_parse_entries */
+
+
+/* This leaves things allocated on error; the caller will clean up the mess. */
+static int zip_load_entries(ZIPinfo *info,
+                            const PHYSFS_uint64 data_ofs,
+                            const PHYSFS_uint64 central_ofs,
+                            const PHYSFS_uint64 central_len,
+                            const PHYSFS_uint64 entry_count)
+{
+    PHYSFS_Io *io = zip_buffer_central_dir(info->io, central_ofs, central_len);
+
+    if (io != NULL)
+    {
+        const PHYSFS_ErrorCode prev = PHYSFS_getLastErrorCode();
+        const int rc = zip_parse_entries(info, io, data_ofs, entry_count);
+        io->destroy(io);
+        (void) PHYSFS_getLastErrorCode();
+        PHYSFS_setErrorCode(prev);
+        if (rc)
+            return 1;
+
+        /* the end of central dir record can understate the directory's
+           size, which cuts the buffered copy short. Parsing straight from
+           the archive never cared, so start over and do that. */
+        __PHYSFS_DirTreeDeinit(&info->tree);
+        BAIL_IF_ERRPASS(!zip_init_tree(info, entry_count), 0);
+        info->has_crypto = 0;
+    } /* if */
+
+    /* oh well, parse it straight from the archive. */
+    BAIL_IF_ERRPASS(!info->io->seek(info->io, central_ofs), 0);
+    return zip_parse_entries(info, info->io, data_ofs, entry_count);
 } /* zip_load_entries */
 
 
+static int zip_resolve_all_cmp(void *_a, size_t one, size_t two)
+{
+    ZIPentry **a = (ZIPentry **) _a;
+    if (a[one]->offset < a[two]->offset)
+        return -1;
+    return (a[one]->offset > a[two]->offset) ? 1 : 0;
+} /* zip_resolve_all_cmp */
+
+static void zip_resolve_all_swap(void *_a, size_t one, size_t two)
+{
+    ZIPentry **a = (ZIPentry **) _a;
+    ZIPentry *tmp = a[one];
+    a[one] = a[two];
+    a[two] = tmp;
+} /* zip_resolve_all_swap */
+
+
+/*
+ * Resolve every unresolved file now, for PHYSFS_setResolveOnMount(), going
+ *  through the local headers in archive order so this is one forward pass
+ *  over the disk. Symlinks are left for zip_resolve(), since following them
+ *  means more reading; a corrupt header marks the file broken, as opening it
+ *  would have. This is best-effort: if the i/o fails, the rest are left for
+ *  their first open. Returns non-zero if any entry changed.
+ */
+static int zip_resolve_all(ZIPinfo *info)
+{
+    PHYSFS_Io *io = info->io;
+    const size_t max = info->tree.hashEntries;
+    ZIPentry **entries = NULL;
+    PHYSFS_uint8 *window = NULL;
+    PHYSFS_uint64 winpos = 0;
+    size_t winlen = 0;
+    size_t count = 0;
+    size_t i;
+
+    if (max == 0)
+        return 0;
+
+    entries = (ZIPentry **) allocator.Malloc(sizeof (ZIPentry *) * max);
+    window = (PHYSFS_uint8 *) allocator.Malloc(ZIP_RESOLVE_WINDOW);
+    if ((!entries) || (!window))
+    {
+        allocator.Free(entries);
+        allocator.Free(window);
+        return 0;
+    } /* if */
+
+    for (i = 0; i < info->tree.hashBuckets; i++)
+    {
+        __PHYSFS_DirTreeEntry *dte;
+        for (dte = info->tree.hash[i]; dte != NULL; dte = dte->hashnext)
+        {
+            ZIPentry *entry = (ZIPentry *) dte;
+            if ((entry->resolved == ZIP_UNRESOLVED_FILE) && (!dte->isdir) &&
+                (count < max))
+                entries[count++] = entry;
+        } /* for */
+    } /* for */
+
+    __PHYSFS_sort(entries, count, zip_resolve_all_cmp, zip_resolve_all_swap);
+
+    for (i = 0; i < count; i++)
+    {
+        ZIPentry *entry = entries[i];
+        const PHYSFS_uint64 ofs = entry->offset;
+        PHYSFS_uint32 hdrlen;
+
+        if ((ofs < winpos) || ((ofs + ZIP_LOCAL_HEADER_LEN) > (winpos + winlen)))
+        {
+            PHYSFS_sint64 br;
+            if (!io->seek(io, ofs))
+                break;
+            br = io->read(io, window, ZIP_RESOLVE_WINDOW);
+            if (br < ZIP_LOCAL_HEADER_LEN)
+                break;  /* error or truncated; zip_resolve will report it. */
+            winpos = ofs;
+            winlen = (size_t) br;
+        } /* if */
+
+        hdrlen = zip_check_local(entry, window + ((size_t) (ofs - winpos)));
+        if (!hdrlen)
+            entry->resolved = ZIP_BROKEN_FILE;
+        else
+        {
+            entry->offset += hdrlen;
+            entry->resolved = ZIP_RESOLVED;
+        } /* else */
+    } /* for */
+
+    allocator.Free(window);
+    allocator.Free(entries);
+
+    return (i > 0);
+} /* zip_resolve_all */
+
+
 static PHYSFS_sint64 zip64_find_end_of_central_dir(PHYSFS_Io *io,
                                                    PHYSFS_sint64 _pos,
                                                    PHYSFS_uint64 offset)
@@ -1269,6 +2332,7 @@ static PHYSFS_sint64 zip64_find_end_of_central_dir(PHYSFS_Io *io,
 static int zip64_parse_end_of_central_dir(ZIPinfo *info,
                                           PHYSFS_uint64 *data_start,
                                           PHYSFS_uint64 *dir_ofs,
+                                          PHYSFS_uint64 *dir_len,
                                           PHYSFS_uint64 *entry_count,
                                           PHYSFS_sint64 pos)
 {
@@ -1344,7 +2408,7 @@ static int zip64_parse_end_of_central_dir(ZIPinfo *info,
     BAIL_IF(ui64 != *entry_count, PHYSFS_ERR_CORRUPT, 0);
 
     /* size of the central directory */
-    BAIL_IF_ERRPASS(!readui64(io, &ui64), 0);
+    BAIL_IF_ERRPASS(!readui64(io, dir_len), 0);
 
     /* offset of central directory */
     BAIL_IF_ERRPASS(!readui64(io, dir_ofs), 0);
@@ -1362,8 +2426,10 @@ static int zip64_parse_end_of_central_dir(ZIPinfo *info,
 
 
 static int zip_parse_end_of_central_dir(ZIPinfo *info,
+                                        PHYSFS_sint64 *eocd_pos,
                                         PHYSFS_uint64 *data_start,
                                         PHYSFS_uint64 *dir_ofs,
+                                        PHYSFS_uint64 *dir_len,
                                         PHYSFS_uint64 *entry_count)
 {
     PHYSFS_Io *io = info->io;
@@ -1379,6 +2445,7 @@ static int zip_parse_end_of_central_dir(ZIPinfo *info,
     pos = zip_find_end_of_central_dir(io, &len);
     BAIL_IF_ERRPASS(pos == -1, 0);
     BAIL_IF_ERRPASS(!io->seek(io, pos), 0);
+    *eocd_pos = pos;
 
     /* check signature again, just in case. */
     BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
@@ -1387,7 +2454,7 @@ static int zip_parse_end_of_central_dir(ZIPinfo *info,
     /* Seek back to see if "Zip64 end of central directory locator" exists. */
     /* this record is 20 bytes before end-of-central-dir */
     rc = zip64_parse_end_of_central_dir(info, data_start, dir_ofs,
-                                        entry_count, pos - 20);
+                                        dir_len, entry_count, pos - 20);
 
     /* Error or success? Bounce out of here. Keep going if not zip64. */
     if ((rc == 0) || (rc == 1))
@@ -1417,6 +2484,7 @@ static int zip_parse_end_of_central_dir(ZIPinfo *info,
 
     /* size of the central directory */
     BAIL_IF_ERRPASS(!readui32(io, &ui32), 0);
+    *dir_len = (PHYSFS_uint64) ui32;
 
     /* offset of central directory */
     BAIL_IF_ERRPASS(!readui32(io, &offset32), 0);
@@ -1450,6 +2518,182 @@ static int zip_parse_end_of_central_dir(ZIPinfo *info,
 } /* zip_parse_end_of_central_dir */
 
 
+static inline size_t zip_cache_bucket(const ZIPentry *entry)
+{
+    return (((size_t) entry) / sizeof (ZIPentry)) % ZIP_CACHE_BUCKETS;
+} /* zip_cache_bucket */
+
+
+static int zip_entry_is_cacheable(const ZIPentry *entry)
+{
+    return ( (ZIP_CACHE_MAXTOTAL > 0) &&
+             (entry->compression_method != COMPMETH_NONE) &&
+             (entry->uncompressed_size > 0) &&
+             (entry->uncompressed_size <= ZIP_CACHE_MAXENTRY) &&
+             (!zip_entry_is_tradional_crypto(entry)) );
+} /* zip_entry_is_cacheable */
+
+
+static void zip_cache_unlink(ZIPinfo *info, ZIPcacheitem *item)
+{
+    if (item->prev)
+        item->prev->next = item->next;
+    else
+        info->cache_head = item->next;
+
+    if (item->next)
+        item->next->prev = item->prev;
+    else
+        info->cache_tail = item->prev;
+
+    item->prev = item->next = NULL;
+} /* zip_cache_unlink */
+
+
+static void zip_cache_link_head(ZIPinfo *info, ZIPcacheitem *item)
+{
+    item->prev = NULL;
+    item->next = info->cache_head;
+    if (info->cache_head)
+        info->cache_head->prev = item;
+    else
+        info->cache_tail = item;
+    info->cache_head = item;
+} /* zip_cache_link_head */
+
+
+static void zip_cache_evict(ZIPinfo *info, ZIPcacheitem *item)
+{
+    ZIPcacheitem **bucket = &info->cache_hash[zip_cache_bucket(item->entry)];
+
+    while (*bucket != item)
+        bucket = &(*bucket)->hashnext;
+    *bucket = item->hashnext;
+
+    zip_cache_unlink(info, item);
+    info->cache_size -= item->entry->uncompressed_size;
+    item->io->destroy(item->io);  /* open duplicates keep the data alive. */
+    allocator.Free(item);
+} /* zip_cache_evict */
+
+
+/*
+ * Returns a new Io for a cached (entry), or NULL if it isn't cached. If
+ *  checksums are on and this entry was cached before they were, the cached
+ *  copy is checked first; if it's bad, it's dropped and we return NULL, so
+ *  the caller decompresses it again and reports the bad crc properly.
+ */
+static PHYSFS_Io *zip_cache_open(ZIPinfo *info, ZIPentry *entry)
+{
+    ZIPcacheitem *item = info->cache_hash[zip_cache_bucket(entry)];
+
+    while ((item != NULL) && (item->entry != entry))
+        item = item->hashnext;
+
+    if (item == NULL)
+        return NULL;
+
+    if ((PHYSFS_isVerifyingChecksums()) && (!__PHYSFS_ATOMIC_GETINT(&entry->verified)))
+    {
+        PHYSFS_uint64 len = 0;
+        const void *buf = __PHYSFS_getIoBuffer(item->io, &len);
+        assert(buf != NULL);  /* it's a memory Io. */
+        if (__PHYSFS_crc32(0, buf, (size_t) len) != entry->crc)
+        {
+            zip_cache_evict(info, item);
+            return NULL;
+        } /* if */
+        __PHYSFS_ATOMIC_SETINT(&entry->verified, 1);
+    } /* if */
+
+    if (item != info->cache_head)
+    {
+        zip_cache_unlink(info, item);
+        zip_cache_link_head(info, item);
+    } /* if */
+
+    return item->io->duplicate(item->io);
+} /* zip_cache_open */
+
+
+/*
+ * Decompress all of (io), a freshly-opened (entry), into the cache, and
+ *  return a memory Io of it in place of (io). A bad crc fails the open, the
+ *  way it would fail the last read. If this fails for any other reason,
+ *  (io) is just handed back uncached, with the caller's error code left
+ *  alone, and reads of it fail (or come up short) as they would have.
+ */
+static PHYSFS_Io *zip_cache_add(ZIPinfo *info, ZIPentry *entry, PHYSFS_Io *io)
+{
+    const PHYSFS_ErrorCode prev = PHYSFS_getLastErrorCode();
+    const size_t len = (size_t) entry->uncompressed_size;
+    ZIPcacheitem *item = NULL;
+    PHYSFS_Io *memio = NULL;
+    PHYSFS_Io *retval = NULL;
+    void *buf = NULL;
+
+    buf = allocator.Malloc(len);
+    GOTO_IF(!buf, PHYSFS_ERR_OUT_OF_MEMORY, zip_cache_add_failed);
+    if (!__PHYSFS_readAll(io, buf, len))  /* bad data, or a bad crc. */
+    {
+        if (((ZIPfileinfo *) io->opaque)->corrupt)
+        {
+            allocator.Free(buf);
+            io->destroy(io);
+            return NULL;  /* ZIP_read() set PHYSFS_ERR_CORRUPT. */
+        } /* if */
+        goto zip_cache_add_failed;
+    } /* if */
+    item = (ZIPcacheitem *) allocator.Malloc(sizeof (ZIPcacheitem));
+    GOTO_IF(!item, PHYSFS_ERR_OUT_OF_MEMORY, zip_cache_add_failed);
+    memio = __PHYSFS_createMemoryIo(buf, len, allocator.Free);
+    GOTO_IF_ERRPASS(!memio, zip_cache_add_failed);
+    buf = NULL;  /* memio owns it now. */
+    retval = memio->duplicate(memio);
+    GOTO_IF_ERRPASS(!retval, zip_cache_add_failed);
+
+    /* make room, oldest first. */
+    while ((info->cache_tail) && ((info->cache_size + len) > ZIP_CACHE_MAXTOTAL))
+        zip_cache_evict(info, info->cache_tail);
+
+    item->entry = entry;
+    item->io = memio;
+    item->hashnext = info->cache_hash[zip_cache_bucket(entry)];
+    info->cache_hash[zip_cache_bucket(entry)] = item;
+    zip_cache_link_head(info, item);
+    info->cache_size += len;
+
+    io->destroy(io);
+    PHYSFS_setErrorCode(prev);
+    return retval;
+
+zip_cache_add_failed:
+    if (memio)
+        memio->destroy(memio);
+    allocator.Free(buf);
+    allocator.Free(item);
+
+    /* can't cache it; rewind and hand back the real thing. */
+    if (!io->seek(io, 0))
+    {
+        io->destroy(io);
+        return NULL;
+    } /* if */
+
+    (void) PHYSFS_getLastErrorCode();  /* we didn't fail after all. */
+    PHYSFS_setErrorCode(prev);
+    return io;
+} /* zip_cache_add */
+
+
+#if PHYSFS_SUPPORTS_STATS
+void ZIP_setStats(void *opaque, PHYSFS_Stats *stats)
+{
+    ((ZIPinfo *) opaque)->stats = stats;
+} /* ZIP_setStats */
+#endif
+
+
 static void ZIP_closeArchive(void *opaque)
 {
     ZIPinfo *info = (ZIPinfo *) (opaque);
@@ -1457,6 +2701,11 @@ static void ZIP_closeArchive(void *opaque)
     if (!info)
         return;
 
+    while (info->cache_tail)
+        zip_cache_evict(info, info->cache_tail);
+
+    __PHYSFS_poolDeinit(&info->files, zip_free_pooled_file);
+
     if (info->io)
         info->io->destroy(info->io);
 
@@ -1466,14 +2715,166 @@ static void ZIP_closeArchive(void *opaque)
 } /* ZIP_closeArchive */
 
 
+static int zip_stat_entry(void *opaque, __PHYSFS_DirTreeEntry *_entry,
+                          PHYSFS_Stat *stat)
+{
+    ZIPinfo *info = (ZIPinfo *) opaque;
+    ZIPentry *entry = (ZIPentry *) _entry;
+
+    if (!zip_resolve(info->io, info, entry))
+        return 0;
+
+    else if (entry->resolved == ZIP_DIRECTORY)
+    {
+        stat->filesize = 0;
+        stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
+    } /* if */
+
+    else if (zip_entry_is_symlink(entry))
+    {
+        stat->filesize = 0;
+        stat->filetype = PHYSFS_FILETYPE_SYMLINK;
+    } /* else if */
+
+    else
+    {
+        stat->filesize = (PHYSFS_sint64) entry->uncompressed_size;
+        stat->filetype = PHYSFS_FILETYPE_REGULAR;
+    } /* else */
+
+    stat->modtime = ((entry) ? entry->last_mod_time : 0);
+    stat->createtime = stat->modtime;
+    stat->accesstime = -1;
+    stat->readonly = 1; /* .zip files are always read only */
+
+    return 1;
+} /* zip_stat_entry */
+
+
+/* clean up an entry for or from the mount index; see indexEntry. */
+static int zip_index_entry(__PHYSFS_DirTreeEntry *_entry)
+{
+    ZIPentry *entry = (ZIPentry *) _entry;
+
+    /* a followed symlink points at another entry, and there's no state to
+       put it back to unfollowed, since its offset has moved past the
+       header. zip_resolve_all() leaves symlinks alone, so this is just in
+       case; refuse the index rather than save a pointer. */
+    if (entry->symlink != NULL)
+        return 0;
+
+    /* an index in the archive is archive data; make sure it's sane. Dirs
+       that DirTree filled in stay ZIP_UNRESOLVED_FILE until zip_resolve(). */
+    else if (entry->tree.isdir)
+        return ((entry->resolved == ZIP_DIRECTORY) ||
+                (entry->resolved == ZIP_UNRESOLVED_FILE));
+    else if (entry->resolved == ZIP_DIRECTORY)
+        return 0;
+
+    switch (entry->resolved)
+    {
+        case ZIP_UNRESOLVED_FILE:
+        case ZIP_UNRESOLVED_SYMLINK:
+        case ZIP_RESOLVED:
+        case ZIP_BROKEN_FILE:
+        case ZIP_BROKEN_SYMLINK:
+            break;
+        default:
+            return 0;  /* nothing mid-resolve gets saved, either. */
+    } /* switch */
+
+    entry->verified = 0;  /* check it again next mount; it might change. */
+    return 1;
+} /* zip_index_entry */
+
+
+/*
+ * physfsrepack -i puts a mount index in the archive itself, right before the
+ *  central directory, and ends the zipfile comment with a locator for it:
+ *  magic, index length, index crc-32, then the offset, size and entry count
+ *  of the central directory it was built for, all little endian. Unlike an
+ *  index in PHYSFS_setMountIndexDir(), this doesn't care where the archive
+ *  lives. Anything that moves or rewrites the central directory (zip -u,
+ *  prepending a self-extractor stub) won't match the locator any more, and
+ *  we parse the central directory as usual.
+ */
+#define ZIP_INDEX_LOCATOR_MAGIC "PHYSFSIL"
+#define ZIP_INDEX_LOCATOR_LEN 44
+
+static int zip_load_embedded_index(ZIPinfo *info, const PHYSFS_sint64 eocd,
+                                   const PHYSFS_uint64 cdir_ofs,
+                                   const PHYSFS_uint64 cdir_len,
+                                   const PHYSFS_uint64 count,
+                                   PHYSFS_uint8 *flags)
+{
+    PHYSFS_Io *io = info->io;
+    const PHYSFS_sint64 len = io->length(io);
+    PHYSFS_uint8 magic[8];
+    PHYSFS_uint64 idxlen, ofs, dirlen, entries;
+    PHYSFS_uint32 crc;
+    PHYSFS_uint16 commentlen;
+    void *buf;
+    int retval;
+
+    /* the locator has to be the last thing in the zipfile comment. */
+    if ((len < 0) || (!io->seek(io, eocd + 20)) || (!readui16(io, &commentlen)))
+        return 0;
+    else if (commentlen < ZIP_INDEX_LOCATOR_LEN)
+        return 0;
+    else if ((eocd + 22 + commentlen) != len)
+        return 0;
+    else if (!io->seek(io, len - ZIP_INDEX_LOCATOR_LEN))
+        return 0;
+    else if (!__PHYSFS_readAll(io, magic, sizeof (magic)))
+        return 0;
+    else if (memcmp(magic, ZIP_INDEX_LOCATOR_MAGIC, sizeof (magic)) != 0)
+        return 0;
+    else if ( (!readui64(io, &idxlen)) || (!readui32(io, &crc)) ||
+              (!readui64(io, &ofs)) || (!readui64(io, &dirlen)) ||
+              (!readui64(io, &entries)) )
+        return 0;
+    else if ((ofs != cdir_ofs) || (dirlen != cdir_len) || (entries != count))
+        return 0;  /* written for some other central directory. */
+    else if ((idxlen == 0) || (idxlen > cdir_ofs) || (idxlen > ((size_t) -1)))
+        return 0;
+
+    buf = allocator.Malloc((size_t) idxlen);
+    if (!buf)
+        return 0;
+
+    retval = ( (io->seek(io, cdir_ofs - idxlen)) &&
+               (__PHYSFS_readAll(io, buf, (size_t) idxlen)) &&
+               (__PHYSFS_crc32(0, buf, (size_t) idxlen) == crc) &&
+               (__PHYSFS_DirTreeLoadIndexData(&info->tree, "ZIP", buf,
+                                              (size_t) idxlen, flags, 2)) );
+    allocator.Free(buf);
+    return retval;
+} /* zip_load_embedded_index */
+
+
+static int zip_init_tree(ZIPinfo *info, const PHYSFS_uint64 entrycount)
+{
+    ZIPentry *root;
+
+    BAIL_IF_ERRPASS(!__PHYSFS_DirTreeInit(&info->tree, sizeof (ZIPentry), 1, 0, entrycount), 0);
+    info->tree.statEntry = zip_stat_entry;
+    info->tree.indexEntry = zip_index_entry;
+    root = (ZIPentry *) info->tree.root;
+    root->resolved = ZIP_DIRECTORY;
+    return 1;
+} /* zip_init_tree */
+
+
 static void *ZIP_openArchive(PHYSFS_Io *io, const char *name,
                              int forWriting, int *claimed)
 {
     ZIPinfo *info = NULL;
-    ZIPentry *root = NULL;
+    PHYSFS_sint64 eocd;  /* end of central dir position */
     PHYSFS_uint64 dstart = 0;  /* data start */
     PHYSFS_uint64 cdir_ofs;  /* central dir offset */
+    PHYSFS_uint64 cdir_len;  /* central dir size */
     PHYSFS_uint64 count;
+    PHYSFS_uint8 flags[2];  /* zip64 and has_crypto, for the mount index. */
 
     assert(io != NULL);  /* shouldn't ever happen. */
 
@@ -1488,17 +2889,53 @@ static void *ZIP_openArchive(PHYSFS_Io *io, const char *name,
 
     info->io = io;
 
-    if (!zip_parse_end_of_central_dir(info, &dstart, &cdir_ofs, &count))
+    if (!__PHYSFS_poolInit(&info->files, ZIP_FILE_POOL_SIZE))
         goto ZIP_openarchive_failed;
-    else if (!__PHYSFS_DirTreeInit(&info->tree, sizeof (ZIPentry), 1, 0))
+
+    /* we don't know the entry count yet, and an index might mean we never do. */
+    if (!zip_init_tree(info, 0))
         goto ZIP_openarchive_failed;
 
-    root = (ZIPentry *) info->tree.root;
-    root->resolved = ZIP_DIRECTORY;
+    flags[0] = flags[1] = 0;
+    if (__PHYSFS_DirTreeLoadIndex(&info->tree, "ZIP", name, io, flags, sizeof (flags)))
+    {
+        info->zip64 = (int) flags[0];
+        info->has_crypto = (int) flags[1];
+
+        /* an index saved without resolving gets the offsets added now. */
+        if (PHYSFS_isResolvingOnMount() && zip_resolve_all(info))
+            __PHYSFS_DirTreeSaveIndex(&info->tree, "ZIP", name, io, flags, sizeof (flags));
+        return info;  /* didn't have to touch the central directory. */
+    } /* if */
+
+    if (!zip_parse_end_of_central_dir(info, &eocd, &dstart, &cdir_ofs, &cdir_len, &count))
+        goto ZIP_openarchive_failed;
+
+    if (zip_load_embedded_index(info, eocd, cdir_ofs, cdir_len, count, flags))
+    {
+        info->zip64 = (int) flags[0];
+        info->has_crypto = (int) flags[1];
+        if (PHYSFS_isResolvingOnMount())
+            zip_resolve_all(info);
+        /* saved to the index dir too, which skips even reading the EOCD. */
+        __PHYSFS_DirTreeSaveIndex(&info->tree, "ZIP", name, io, flags, sizeof (flags));
+        return info;
+    } /* if */
 
-    if (!zip_load_entries(info, dstart, cdir_ofs, count))
+    /* now we know how many entries there are; size the (empty) tree for it. */
+    __PHYSFS_DirTreeDeinit(&info->tree);
+    if (!zip_init_tree(info, count))
+        goto ZIP_openarchive_failed;
+    else if (!zip_load_entries(info, dstart, cdir_ofs, cdir_len, count))
         goto ZIP_openarchive_failed;
 
+    if (PHYSFS_isResolvingOnMount())
+        zip_resolve_all(info);
+
+    flags[0] = (PHYSFS_uint8) info->zip64;
+    flags[1] = (PHYSFS_uint8) info->has_crypto;
+    __PHYSFS_DirTreeSaveIndex(&info->tree, "ZIP", name, io, flags, sizeof (flags));
+
     assert(info->tree.root->sibling == NULL);
     return info;
 
@@ -1542,6 +2979,7 @@ static PHYSFS_Io *ZIP_openRead(void *opaque, const char *filename)
     ZIPinfo *info = (ZIPinfo *) opaque;
     ZIPentry *entry = zip_find_entry(info, filename);
     ZIPfileinfo *finfo = NULL;
+    ZIPfile *file = NULL;
     PHYSFS_Io *io = NULL;
     PHYSFS_uint8 *password = NULL;
 
@@ -1567,28 +3005,30 @@ static PHYSFS_Io *ZIP_openRead(void *opaque, const char *filename)
     BAIL_IF_ERRPASS(!zip_resolve(info->io, info, entry), NULL);
 
     BAIL_IF(entry->tree.isdir, PHYSFS_ERR_NOT_A_FILE, NULL);
+    BAIL_IF(!zip_compression_is_supported((entry->symlink != NULL) ?
+                                          entry->symlink : entry),
+            PHYSFS_ERR_UNSUPPORTED, NULL);
 
-    retval = (PHYSFS_Io *) allocator.Malloc(sizeof (PHYSFS_Io));
-    GOTO_IF(!retval, PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openRead_failed);
+    if (password == NULL)
+    {
+        ZIPentry *target = (entry->symlink != NULL) ? entry->symlink : entry;
+        if (zip_entry_is_cacheable(target))
+        {
+            retval = zip_cache_open(info, target);
+            if (retval != NULL)
+                return retval;
+        } /* if */
+    } /* if */
 
-    finfo = (ZIPfileinfo *) allocator.Malloc(sizeof (ZIPfileinfo));
-    GOTO_IF(!finfo, PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openRead_failed);
-    memset(finfo, '\0', sizeof (ZIPfileinfo));
+    file = zip_alloc_file(info, (entry->symlink != NULL) ? entry->symlink : entry);
+    BAIL_IF_ERRPASS(!file, NULL);
+    finfo = &file->finfo;
 
     io = zip_get_io(info->io, info, entry);
     GOTO_IF_ERRPASS(!io, ZIP_openRead_failed);
     finfo->io = io;
-    finfo->entry = ((entry->symlink != NULL) ? entry->symlink : entry);
-    initializeZStream(&finfo->stream);
 
-    if (finfo->entry->compression_method != COMPMETH_NONE)
-    {
-        finfo->buffer = (PHYSFS_uint8 *) allocator.Malloc(ZIP_READBUFSIZE);
-        if (!finfo->buffer)
-            GOTO(PHYSFS_ERR_OUT_OF_MEMORY, ZIP_openRead_failed);
-        else if (zlib_err(inflateInit2(&finfo->stream, -MAX_WBITS)) != Z_OK)
-            goto ZIP_openRead_failed;
-    } /* if */
+    zip_init_seekpoints(finfo);
 
     if (!zip_entry_is_tradional_crypto(entry))
         GOTO_IF(password != NULL, PHYSFS_ERR_BAD_PASSWORD, ZIP_openRead_failed);
@@ -1602,29 +3042,19 @@ static PHYSFS_Io *ZIP_openRead(void *opaque, const char *filename)
             goto ZIP_openRead_failed;
     } /* if */
 
-    memcpy(retval, &ZIP_Io, sizeof (PHYSFS_Io));
-    retval->opaque = finfo;
+    memcpy(&file->io, &ZIP_Io, sizeof (PHYSFS_Io));
+    file->io.opaque = finfo;
+    retval = &file->io;
+
+    if ((password == NULL) && zip_entry_is_cacheable(finfo->entry))
+        return zip_cache_add(info, finfo->entry, retval);
 
     return retval;
 
 ZIP_openRead_failed:
-    if (finfo != NULL)
-    {
-        if (finfo->io != NULL)
-            finfo->io->destroy(finfo->io);
-
-        if (finfo->buffer != NULL)
-        {
-            allocator.Free(finfo->buffer);
-            inflateEnd(&finfo->stream);
-        } /* if */
-
-        allocator.Free(finfo);
-    } /* if */
-
-    if (retval != NULL)
-        allocator.Free(retval);
-
+    if (finfo->io != NULL)
+        finfo->io->destroy(finfo->io);
+    zip_release_file(file);
     return NULL;
 } /* ZIP_openRead */
 
@@ -1661,33 +3091,7 @@ static int ZIP_stat(void *opaque, const char *filename, PHYSFS_Stat *stat)
     if (entry == NULL)
         return 0;
 
-    else if (!zip_resolve(info->io, info, entry))
-        return 0;
-
-    else if (entry->resolved == ZIP_DIRECTORY)
-    {
-        stat->filesize = 0;
-        stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
-    } /* if */
-
-    else if (zip_entry_is_symlink(entry))
-    {
-        stat->filesize = 0;
-        stat->filetype = PHYSFS_FILETYPE_SYMLINK;
-    } /* else if */
-
-    else
-    {
-        stat->filesize = (PHYSFS_sint64) entry->uncompressed_size;
-        stat->filetype = PHYSFS_FILETYPE_REGULAR;
-    } /* else */
-
-    stat->modtime = ((entry) ? entry->last_mod_time : 0);
-    stat->createtime = stat->modtime;
-    stat->accesstime = -1;
-    stat->readonly = 1; /* .zip files are always read only */
-
-    return 1;
+    return zip_stat_entry(info, &entry->tree, stat);
 } /* ZIP_stat */
 
 
@@ -0,0 +1,261 @@
+/**
+ * PhysicsFS; a portable, flexible file i/o abstraction.
+ *
+ * Documentation is in physfs.h. It's verbose, honest.  :)
+ *
+ * CRC-32 (the zlib/PKZIP one, reflected polynomial 0xEDB88320), for checking
+ *  archive entries as they're read. There's a portable slice-by-8 version,
+ *  a PCLMULQDQ version for x86 CPUs that have it (picked at runtime), and an
+ *  ARMv8 CRC instruction version when the compiler targets a CPU with those.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#ifndef PHYSFS_NO_CRC32_SIMD
+#  if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#    define PHYSFS_HAVE_CRC32_PCLMUL 1
+#    define PHYSFS_CRC32_PCLMUL_TARGET __attribute__((target("pclmul,sse2")))
+#    include <cpuid.h>
+#    include <emmintrin.h>
+#    include <wmmintrin.h>
+#  elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#    define PHYSFS_HAVE_CRC32_PCLMUL 1
+#    define PHYSFS_CRC32_PCLMUL_TARGET
+#    include <intrin.h>
+#    include <emmintrin.h>
+#    include <wmmintrin.h>
+#  elif defined(__ARM_FEATURE_CRC32) && !defined(__ARM_BIG_ENDIAN)
+#    define PHYSFS_HAVE_CRC32_ARM 1
+#    include <arm_acle.h>
+#  endif
+#endif
+
+/* after the intrinsics headers: mm_malloc.h trips our malloc() poisoning. */
+#define __PHYSICSFS_INTERNAL__
+#include "physfs_internal.h"
+
+typedef PHYSFS_uint32 (*Crc32Kernel)(PHYSFS_uint32 crc, const PHYSFS_uint8 *buf, size_t len);
+
+static PHYSFS_uint32 crc32Table[8][256];
+static Crc32Kernel crc32Kernel = NULL;
+
+
+static PHYSFS_uint32 crc32SliceBy8(PHYSFS_uint32 crc, const PHYSFS_uint8 *buf,
+                                   size_t len)
+{
+    while (len >= 8)
+    {
+        /* assembled by hand: any alignment, any byte order. */
+        const PHYSFS_uint32 one = crc ^ (((PHYSFS_uint32) buf[0]) |
+                                         (((PHYSFS_uint32) buf[1]) << 8) |
+                                         (((PHYSFS_uint32) buf[2]) << 16) |
+                                         (((PHYSFS_uint32) buf[3]) << 24));
+        const PHYSFS_uint32 two = ((PHYSFS_uint32) buf[4]) |
+                                  (((PHYSFS_uint32) buf[5]) << 8) |
+                                  (((PHYSFS_uint32) buf[6]) << 16) |
+                                  (((PHYSFS_uint32) buf[7]) << 24);
+        crc = crc32Table[7][one & 0xFF] ^
+              crc32Table[6][(one >> 8) & 0xFF] ^
+              crc32Table[5][(one >> 16) & 0xFF] ^
+              crc32Table[4][one >> 24] ^
+              crc32Table[3][two & 0xFF] ^
+              crc32Table[2][(two >> 8) & 0xFF] ^
+              crc32Table[1][(two >> 16) & 0xFF] ^
+              crc32Table[0][two >> 24];
+        buf += 8;
+        len -= 8;
+    } /* while */
+
+    while (len--)
+        crc = crc32Table[0][(crc ^ *(buf++)) & 0xFF] ^ (crc >> 8);
+
+    return crc;
+} /* crc32SliceBy8 */
+
+
+#if PHYSFS_HAVE_CRC32_PCLMUL
+/*
+ * Folds 64 bytes at a time with carry-less multiplies, then reduces with
+ *  Barrett reduction, as in Intel's "Fast CRC Computation for Generic
+ *  Polynomials Using PCLMULQDQ Instruction" paper. The constants are that
+ *  paper's, for the bit-reflected CRC-32 polynomial. (len) must be at least
+ *  64 and a multiple of 16.
+ */
+static PHYSFS_CRC32_PCLMUL_TARGET PHYSFS_uint32 crc32FoldPclmul(
+                                                   PHYSFS_uint32 crc,
+                                                   const PHYSFS_uint8 *buf,
+                                                   size_t len)
+{
+    const __m128i k1k2 = _mm_set_epi32(0x00000001, 0xC6E41596, 0x00000001, 0x54442BD4);
+    const __m128i k3k4 = _mm_set_epi32(0x00000000, 0xCCAA009E, 0x00000001, 0x751997D0);
+    const __m128i k5k0 = _mm_set_epi32(0x00000000, 0x00000000, 0x00000001, 0x63CD6124);
+    const __m128i poly = _mm_set_epi32(0x00000001, 0xF7011641, 0x00000001, 0xDB710641);
+    const __m128i mask32 = _mm_set_epi32(0, -1, 0, -1);
+    __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *) (buf + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *) (buf + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *) (buf + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *) (buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int) crc));
+    buf += 64;
+    len -= 64;
+
+    x0 = k1k2;
+    while (len >= 64)  /* four folds in parallel. */
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, x0, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, x0, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, x0, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, x0, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) (buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *) (buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *) (buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *) (buf + 0x30)));
+        buf += 64;
+        len -= 64;
+    } /* while */
+
+    /* fold the four down to one... */
+    x0 = k3k4;
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    while (len >= 16)  /* ...and any 16 byte blocks that are left into it. */
+    {
+        x5 = _mm_clmulepi64_si128(x1, x0, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, x0, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *) buf));
+        buf += 16;
+        len -= 16;
+    } /* while */
+
+    /* 128 bits to 64... */
+    x2 = _mm_clmulepi64_si128(x1, x0, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x0 = k5k0;
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask32);
+    x1 = _mm_clmulepi64_si128(x1, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* ...then Barrett reduction to 32. */
+    x0 = poly;
+    x2 = _mm_and_si128(x1, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x10);
+    x2 = _mm_and_si128(x2, mask32);
+    x2 = _mm_clmulepi64_si128(x2, x0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (PHYSFS_uint32) _mm_cvtsi128_si32(_mm_srli_si128(x1, 4));
+} /* crc32FoldPclmul */
+
+static PHYSFS_uint32 crc32Pclmul(PHYSFS_uint32 crc, const PHYSFS_uint8 *buf,
+                                 size_t len)
+{
+    if (len >= 64)
+    {
+        const size_t chunk = len & ~((size_t) 15);
+        crc = crc32FoldPclmul(crc, buf, chunk);
+        buf += chunk;
+        len -= chunk;
+    } /* if */
+
+    return crc32SliceBy8(crc, buf, len);
+} /* crc32Pclmul */
+
+static int cpuHasPclmul(void)
+{
+#if defined(_MSC_VER)
+    int regs[4];
+    __cpuid(regs, 1);
+    return ((regs[2] & (1 << 1)) != 0) && ((regs[3] & (1 << 26)) != 0);
+#else
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return 0;
+    return ((ecx & bit_PCLMUL) != 0) && ((edx & bit_SSE2) != 0);
+#endif
+} /* cpuHasPclmul */
+#endif
+
+
+#if PHYSFS_HAVE_CRC32_ARM
+static PHYSFS_uint32 crc32Arm(PHYSFS_uint32 crc, const PHYSFS_uint8 *buf,
+                              size_t len)
+{
+    while ((len > 0) && (((size_t) buf) & 7))
+    {
+        crc = __crc32b(crc, *(buf++));
+        len--;
+    } /* while */
+
+    while (len >= 8)
+    {
+        crc = __crc32d(crc, *((const PHYSFS_uint64 *) buf));
+        buf += 8;
+        len -= 8;
+    } /* while */
+
+    while (len--)
+        crc = __crc32b(crc, *(buf++));
+
+    return crc;
+} /* crc32Arm */
+#endif
+
+
+void __PHYSFS_crc32Init(void)
+{
+    PHYSFS_uint32 i;
+    int j;
+
+    if (crc32Kernel != NULL)
+        return;  /* already done. */
+
+    for (i = 0; i < 256; i++)
+    {
+        PHYSFS_uint32 crc = i;
+        for (j = 0; j < 8; j++)
+            crc = (crc & 1) ? (0xEDB88320 ^ (crc >> 1)) : (crc >> 1);
+        crc32Table[0][i] = crc;
+    } /* for */
+
+    for (i = 0; i < 256; i++)
+    {
+        for (j = 1; j < 8; j++)
+        {
+            const PHYSFS_uint32 prev = crc32Table[j - 1][i];
+            crc32Table[j][i] = crc32Table[0][prev & 0xFF] ^ (prev >> 8);
+        } /* for */
+    } /* for */
+
+    crc32Kernel = crc32SliceBy8;
+
+    #if PHYSFS_HAVE_CRC32_PCLMUL
+    if (cpuHasPclmul())
+        crc32Kernel = crc32Pclmul;
+    #elif PHYSFS_HAVE_CRC32_ARM
+    crc32Kernel = crc32Arm;
+    #endif
+} /* __PHYSFS_crc32Init */
+
+
+PHYSFS_uint32 __PHYSFS_crc32(PHYSFS_uint32 crc, const void *buf, size_t len)
+{
+    assert(crc32Kernel != NULL);  /* __PHYSFS_crc32Init() wasn't called? */
+    return crc32Kernel(crc ^ 0xFFFFFFFF, (const PHYSFS_uint8 *) buf, len) ^ 0xFFFFFFFF;
+} /* __PHYSFS_crc32 */
+
+/* end of physfs_crc32.c ... */
@@ -134,6 +134,47 @@ int __PHYSFS_ATOMIC_INCR(int *ptrval);
 int __PHYSFS_ATOMIC_DECR(int *ptrval);
 #endif
 
+/* publish a pointer to other threads, and pick up a published one, so
+   whatever it points to was finished before it was published. */
+#if defined(__ATOMIC_ACQUIRE)
+#define __PHYSFS_ATOMIC_GETPTR(ptrval) __atomic_load_n((ptrval), __ATOMIC_ACQUIRE)
+#define __PHYSFS_ATOMIC_SETPTR(ptrval, val) __atomic_store_n((ptrval), (val), __ATOMIC_RELEASE)
+#elif defined(_MSC_VER) && (_MSC_VER >= 1500)
+/* volatile accesses are acquire/release with Visual C's default /volatile:ms. */
+#define __PHYSFS_ATOMIC_GETPTR(ptrval) (*(ptrval))
+#define __PHYSFS_ATOMIC_SETPTR(ptrval, val) ((void) _InterlockedExchangePointer((void * volatile *) (ptrval), (void *) (val)))
+#else
+#define __PHYSFS_ATOMIC_GETPTR(ptrval) (*(ptrval))
+#define __PHYSFS_ATOMIC_SETPTR(ptrval, val) ((void) (*(ptrval) = (val)))
+#endif
+
+/* the same for an int flag, set once and read by any thread. */
+#if defined(__ATOMIC_ACQUIRE)
+#define __PHYSFS_ATOMIC_GETINT(ptrval) __atomic_load_n((ptrval), __ATOMIC_ACQUIRE)
+#define __PHYSFS_ATOMIC_SETINT(ptrval, val) __atomic_store_n((ptrval), (val), __ATOMIC_RELEASE)
+#elif defined(_MSC_VER) && (_MSC_VER >= 1500)
+#define __PHYSFS_ATOMIC_GETINT(ptrval) (*((volatile int *) (ptrval)))
+#define __PHYSFS_ATOMIC_SETINT(ptrval, val) ((void) _InterlockedExchange((volatile long *) (ptrval), (long) (val)))
+#else
+#define __PHYSFS_ATOMIC_GETINT(ptrval) (*((volatile int *) (ptrval)))
+#define __PHYSFS_ATOMIC_SETINT(ptrval, val) ((void) (*((volatile int *) (ptrval)) = (val)))
+#endif
+
+/* thread-local storage, for per-thread state that needs no locking.
+   Build with PHYSFS_NO_THREAD_LOCAL defined to force the slower,
+   mutex-protected fallback. */
+#ifndef PHYSFS_NO_THREAD_LOCAL
+#if defined(_MSC_VER) && (_MSC_VER >= 1500)
+#define __PHYSFS_THREAD_LOCAL __declspec(thread)
+#elif defined(__clang__) || (defined(__GNUC__) && (((__GNUC__ * 10000) + (__GNUC_MINOR__ * 100)) >= 30300))
+#define __PHYSFS_THREAD_LOCAL __thread
+#elif defined(__STDC_VERSION__) && (__STDC_VERSION__ >= 201112L)
+#define __PHYSFS_THREAD_LOCAL _Thread_local
+#else
+#define PHYSFS_NO_THREAD_LOCAL 1
+#endif
+#endif
+
 
 /*
  * Interface for small allocations. If you need a little scratch space for
@@ -216,12 +257,93 @@ void __PHYSFS_smallFree(void *ptr);
 #ifndef PHYSFS_SUPPORTS_VDF
 #define PHYSFS_SUPPORTS_VDF PHYSFS_SUPPORTS_DEFAULT
 #endif
+#ifndef PHYSFS_SUPPORTS_STATS
+#define PHYSFS_SUPPORTS_STATS PHYSFS_SUPPORTS_DEFAULT
+#endif
+
+/*
+ * Performance counters for PHYSFS_getStats(). __PHYSFS_STAT_ADD() counts
+ *  (val) in field (f) of (stats), an archive's counters (which may be a NULL
+ *  pointer, but not a literal NULL) and in the global totals. These are
+ *  relaxed atomics where the compiler offers them; elsewhere, racing
+ *  threads can lose counts, which is fine for what these are used for.
+ *  Everything compiles to nothing if PHYSFS_SUPPORTS_STATS is 0.
+ */
+#if PHYSFS_SUPPORTS_STATS
+#if defined(__ATOMIC_RELAXED)
+#define __PHYSFS_STAT_ATOMIC_ADD(ptr, val) ((void) __atomic_fetch_add((ptr), (val), __ATOMIC_RELAXED))
+#define __PHYSFS_STAT_ATOMIC_GET(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_ARM64))
+#define __PHYSFS_STAT_ATOMIC_ADD(ptr, val) ((void) _InterlockedExchangeAdd64((volatile __int64 *) (ptr), (__int64) (val)))
+#define __PHYSFS_STAT_ATOMIC_GET(ptr) (*((volatile PHYSFS_uint64 *) (ptr)))
+#else
+#define __PHYSFS_STAT_ATOMIC_ADD(ptr, val) ((void) (*(ptr) += (val)))
+#define __PHYSFS_STAT_ATOMIC_GET(ptr) (*((volatile PHYSFS_uint64 *) (ptr)))
+#endif
+
+extern PHYSFS_Stats __PHYSFS_globalStats;
+
+#define __PHYSFS_STAT_ADD_GLOBAL(f, val) \
+    __PHYSFS_STAT_ATOMIC_ADD(&__PHYSFS_globalStats.f, (PHYSFS_uint64) (val))
+#define __PHYSFS_STAT_ADD(stats, f, val) do { \
+    PHYSFS_Stats *__statptr = (stats); \
+    if (__statptr != NULL) \
+        __PHYSFS_STAT_ATOMIC_ADD(&__statptr->f, (PHYSFS_uint64) (val)); \
+    __PHYSFS_STAT_ADD_GLOBAL(f, val); \
+} while (0)
+#else
+#define __PHYSFS_STAT_ADD_GLOBAL(f, val)
+#define __PHYSFS_STAT_ADD(stats, f, val)
+#endif
 
 #if PHYSFS_SUPPORTS_7Z
 /* 7zip support needs a global init function called at startup (no deinit). */
 extern void SZIP_global_init(void);
 #endif
 
+/* Archivers whose file PHYSFS_Ios can expose their data without copying
+   provide these for __PHYSFS_getIoBuffer(). They return NULL for any
+   PHYSFS_Io they didn't create. */
+#if PHYSFS_SUPPORTS_ZIP
+extern const void *ZIP_getIoBuffer(PHYSFS_Io *io, PHYSFS_uint64 *len);
+#endif
+#if PHYSFS_SUPPORTS_7Z
+extern const void *SZIP_getIoBuffer(PHYSFS_Io *io, PHYSFS_uint64 *len);
+#endif
+
+/* Archivers whose file PHYSFS_Ios are a slice of the archive's own Io
+   provide these for __PHYSFS_getIoRange(). They return zero for any
+   PHYSFS_Io they didn't create. */
+#if PHYSFS_SUPPORTS_ZIP
+extern int ZIP_getIoRange(PHYSFS_Io *io, PHYSFS_Io **parent,
+                          PHYSFS_uint64 *offset, PHYSFS_uint64 *len, int *raw);
+#endif
+extern int UNPK_getIoRange(PHYSFS_Io *io, PHYSFS_Io **parent,
+                           PHYSFS_uint64 *offset, PHYSFS_uint64 *len, int *raw);
+
+/* Archivers that check checksums as files are read provide this for
+   __PHYSFS_verifyIo(), which see. It returns 1 for any PHYSFS_Io it didn't
+   create. */
+#if PHYSFS_SUPPORTS_ZIP
+extern int ZIP_verifyIo(PHYSFS_Io *io, const int check);
+#endif
+
+#if PHYSFS_SUPPORTS_STATS && PHYSFS_SUPPORTS_ZIP
+/* Tell a mounted ZIP archive where to count its decompression work. */
+extern void ZIP_setStats(void *opaque, PHYSFS_Stats *stats);
+#endif
+
+/* The DIR archiver's side of PHYSFS_enumerateWithStat(): enumerate() that
+   hands every name to (cb) with the stat the OS listing came with. */
+extern PHYSFS_EnumerateCallbackResult DIR_enumerateStat(void *opaque,
+                                     const char *dname,
+                                     PHYSFS_EnumerateStatCallback cb,
+                                     const char *origdir, void *callbackdata);
+/* non-zero if this DIR archive was mounted with PHYSFS_setCaseInsensitive(). */
+extern int DIR_isCaseInsensitive(void *opaque);
+/* drop what a DIR archive cached for PHYSFS_setDirectoryCaching(). */
+extern void DIR_refreshCache(void *opaque);
+
 /* The latest supported PHYSFS_Io::version value. */
 #define CURRENT_PHYSFS_IO_API_VERSION 0
 
@@ -356,6 +478,14 @@ PHYSFS_uint32 __PHYSFS_hashStringCaseFold(const char *str);
  */
 PHYSFS_uint32 __PHYSFS_hashStringCaseFoldUSAscii(const char *str);
 
+/*
+ * CRC-32 of (len) bytes at (buf), as used by zlib and PKZIP, continuing from
+ *  (crc); start with a (crc) of zero. Uses CPU instructions for this where
+ *  they're available. __PHYSFS_crc32Init() is called by PHYSFS_init().
+ */
+void __PHYSFS_crc32Init(void);
+PHYSFS_uint32 __PHYSFS_crc32(PHYSFS_uint32 crc, const void *buf, size_t len);
+
 
 /*
  * The current allocator. Not valid before PHYSFS_init is called!
@@ -372,6 +502,56 @@ extern PHYSFS_Allocator __PHYSFS_AllocatorHooks;
  */
 PHYSFS_Io *__PHYSFS_createNativeIo(const char *path, const int mode);
 
+#ifdef PHYSFS_PLATFORM_POSIX
+/*
+ * Same as __PHYSFS_createNativeIo(), but (path) is relative to (dirfd), from
+ *  __PHYSFS_platformOpenDirFd(). (dirname) is where (dirfd) was opened, with
+ *  a trailing separator, for Ios that have to reopen the file by name.
+ */
+PHYSFS_Io *__PHYSFS_createNativeIoAt(const int dirfd, const char *dirname,
+                                     const char *path, const int mode);
+#endif
+
+/*
+ * Create a read-only PHYSFS_Io for a file in the physical filesystem by
+ *  mapping the whole file into memory. Duplicates share the mapping.
+ *  This path is in platform-dependent notation. Returns NULL if the
+ *  platform can't map this file; use __PHYSFS_createNativeIo() instead.
+ */
+PHYSFS_Io *__PHYSFS_createMappedIo(const char *path);
+
+/*
+ * If the entire contents of (io) are already sitting in memory, return a
+ *  pointer to them and put their size in (len). The pointer stays valid
+ *  as long as (io) does. Returns NULL, without setting an error, if getting
+ *  at the data would need a copy.
+ */
+const void *__PHYSFS_getIoBuffer(PHYSFS_Io *io, PHYSFS_uint64 *len);
+
+/*
+ * Find where (io)'s data physically lives, looking through archive entries
+ *  (and archives inside archives) to the Io at the bottom. (*base) is set to
+ *  that Io, and (*offset) and (*len) to the span of (io)'s data inside it.
+ *  (*raw) is non-zero if that span is (io)'s contents verbatim; otherwise
+ *  it's compressed, encrypted, etc, and only good for knowing where on disk
+ *  the reads will go. (*base) belongs to (io), and is only valid as long as
+ *  (io) is; don't destroy it. Returns zero if (io)'s length is unknown.
+ */
+int __PHYSFS_getIoRange(PHYSFS_Io *io, PHYSFS_Io **base,
+                        PHYSFS_uint64 *offset, PHYSFS_uint64 *len, int *raw);
+
+/*
+ * Before handing out (io)'s raw data from __PHYSFS_getIoRange() to be read
+ *  some way other than (io)->read(), which is where checksums are checked
+ *  when PHYSFS_setVerifyChecksums() is on: returns 1 if that's fine, because
+ *  (io) doesn't check, it's been checked already, or (check) is non-zero and
+ *  checking all of it right now passed. Returns 0 if the check failed, with
+ *  PHYSFS_ERR_CORRUPT set, or if (check) is zero and it still needs doing,
+ *  with no error set; read it with (io)->read() instead. Entries are only
+ *  checked once per mount.
+ */
+int __PHYSFS_verifyIo(PHYSFS_Io *io, const int check);
+
 /*
  * Create a PHYSFS_Io for a buffer of memory (READ-ONLY). If you already
  *  have one of these, just use its duplicate() method, and it'll increment
@@ -388,10 +568,41 @@ PHYSFS_Io *__PHYSFS_createMemoryIo(const void *buf, PHYSFS_uint64 len,
 int __PHYSFS_readAll(PHYSFS_Io *io, void *buf, const size_t len);
 
 
+/*
+ * A stack of up to (max) idle objects of one kind, to hand back out instead
+ *  of freeing and reallocating them. The pool doesn't know what's in them:
+ *  the caller decides what a recycled block still needs set up, and frees
+ *  blocks itself when __PHYSFS_poolPut() says the pool is full. A (max) of
+ *  zero disables pooling. Safe to use from multiple threads.
+ */
+typedef struct __PHYSFS_Pool
+{
+    void *mutex;
+    void **blocks;
+    size_t count;
+    size_t max;
+} __PHYSFS_Pool;
+
+/* Returns zero, with the error code set, if out of memory. */
+int __PHYSFS_poolInit(__PHYSFS_Pool *pool, const size_t max);
+
+/* Returns an idle block, or NULL if there aren't any. */
+void *__PHYSFS_poolGet(__PHYSFS_Pool *pool);
+
+/* Keeps (block) for later. Returns zero if the pool is full. */
+int __PHYSFS_poolPut(__PHYSFS_Pool *pool, void *block);
+
+/* Calls (destroy) on every idle block. (pool) can be all zeros. */
+void __PHYSFS_poolDeinit(__PHYSFS_Pool *pool, void (*destroy)(void *block));
+
+
 /* These are shared between some archivers. */
 
-/* LOTS of legacy formats that only use US ASCII, not actually UTF-8, so let them optimize here. */
-void *UNPK_openArchive(PHYSFS_Io *io, const int case_sensitive, const int only_usascii);
+/* LOTS of legacy formats that only use US ASCII, not actually UTF-8, so let them optimize here.
+   (case_sensitive) is ignored while PHYSFS_setCaseInsensitive() is enabled.
+   (entrycount) is a hint for __PHYSFS_DirTreeInit(); zero if unknown. */
+void *UNPK_openArchive(PHYSFS_Io *io, const int case_sensitive,
+                       const int only_usascii, const PHYSFS_uint64 entrycount);
 void UNPK_abandonArchive(void *opaque);
 void UNPK_closeArchive(void *opaque);
 void *UNPK_addEntry(void *opaque, char *name, const int isdir,
@@ -404,6 +615,20 @@ int UNPK_remove(void *opaque, const char *name);
 int UNPK_mkdir(void *opaque, const char *name);
 int UNPK_stat(void *opaque, const char *fn, PHYSFS_Stat *st);
 #define UNPK_enumerate __PHYSFS_DirTreeEnumerate
+int UNPK_loadIndex(void *opaque, const char *arc, const char *name);
+void UNPK_saveIndex(void *opaque, const char *arc, const char *name);
+
+/* For formats that can list one directory at a time: (loader) is called the
+   first time a dir added with UNPK_addDeferredDir() is looked into, with the
+   dir's full path and the (pos) and (len) given there, and should
+   UNPK_addEntry() the dir's children. (arg) is passed through untouched. */
+typedef int (*UNPK_DirLoader)(void *opaque, PHYSFS_Io *io, const int arg,
+                              const char *path, const PHYSFS_uint64 pos,
+                              const PHYSFS_uint64 len);
+void UNPK_setDirLoader(void *opaque, UNPK_DirLoader loader, const int arg);
+void *UNPK_addDeferredDir(void *opaque, char *name,
+                          const PHYSFS_sint64 ctime, const PHYSFS_sint64 mtime,
+                          const PHYSFS_uint64 pos, const PHYSFS_uint64 len);
 
 
 
@@ -412,11 +637,14 @@ int UNPK_stat(void *opaque, const char *fn, PHYSFS_Stat *st);
 
 typedef struct __PHYSFS_DirTreeEntry
 {
-    char *name;                              /* Full path in archive.        */
+    char *name;                              /* Last element of path.        */
+    struct __PHYSFS_DirTreeEntry *parent;    /* dir that holds this entry.   */
     struct __PHYSFS_DirTreeEntry *hashnext;  /* next item in hash bucket.    */
     struct __PHYSFS_DirTreeEntry *children;  /* linked list of kids, if dir. */
     struct __PHYSFS_DirTreeEntry *sibling;   /* next item in same dir.       */
-    int isdir;
+    PHYSFS_uint32 hash;                      /* unreduced hash of full path. */
+    PHYSFS_uint16 isdir;
+    PHYSFS_uint16 deferred;  /* non-zero if dir's children aren't added yet. */
 } __PHYSFS_DirTreeEntry;
 
 typedef struct __PHYSFS_DirTree
@@ -424,21 +652,86 @@ typedef struct __PHYSFS_DirTree
     __PHYSFS_DirTreeEntry *root;    /* root of directory tree.             */
     __PHYSFS_DirTreeEntry **hash;  /* all entries hashed for fast lookup. */
     size_t hashBuckets;            /* number of buckets in hash.          */
+    size_t hashEntries;            /* number of entries in hash.          */
     size_t entrylen;    /* size in bytes of entries (including subclass). */
+    void *arena;          /* newest block that entries are allocated from. */
+    size_t arenaUsed;     /* bytes handed out from newest block.           */
+    size_t arenaAvail;    /* total bytes in newest block.                  */
     int case_sensitive;  /* non-zero to treat entries as case-sensitive in DirTreeFind */
     int only_usascii;  /* non-zero to treat paths as US ASCII only (one byte per char, only 'A' through 'Z' are considered for case folding). */
+    /* optional: fill in (stat) for (entry), as the archiver's stat() would.
+       (opaque) is the archive, which must start with its DirTree. */
+    int (*statEntry)(void *opaque, __PHYSFS_DirTreeEntry *entry, PHYSFS_Stat *stat);
+    /* optional: add the children of (entry), a dir that was passed to
+       __PHYSFS_DirTreeDefer(). (opaque) is the archive, as above. */
+    int (*loadDir)(void *opaque, __PHYSFS_DirTreeEntry *entry);
+    /* optional: before a mount index saves (entry), a scratch copy of one,
+       clear whatever in it can't be saved byte for byte: pointers, and
+       state that only means something for this mount. Return zero if it
+       can't be saved at all, and no index is written. This is called again
+       on every entry a mount index loads, which might have come from the
+       archive itself; return zero there if (entry) isn't something this
+       archiver could have saved, and the index is thrown away. */
+    int (*indexEntry)(__PHYSFS_DirTreeEntry *entry);
+    size_t deferredDirs;  /* dirs still waiting on loadDir.  */
 } __PHYSFS_DirTree;
 
 
-/* LOTS of legacy formats that only use US ASCII, not actually UTF-8, so let them optimize here. */
-int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen, const int case_sensitive, const int only_usascii);
+/* LOTS of legacy formats that only use US ASCII, not actually UTF-8, so let them optimize here.
+   (entrycount) is how many entries the archive says it has, if it says, so
+   the hash can start out that big instead of growing as they're added. It's
+   only a hint, and zero is fine; a bogus count doesn't allocate much. */
+int __PHYSFS_DirTreeInit(__PHYSFS_DirTree *dt, const size_t entrylen,
+                         const int case_sensitive, const int only_usascii,
+                         const PHYSFS_uint64 entrycount);
 void *__PHYSFS_DirTreeAdd(__PHYSFS_DirTree *dt, char *name, const int isdir);
 void *__PHYSFS_DirTreeFind(__PHYSFS_DirTree *dt, const char *path);
 PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerate(void *opaque,
                               const char *dname, PHYSFS_EnumerateCallback cb,
                               const char *origdir, void *callbackdata);
+/* Like __PHYSFS_DirTreeEnumerate, but stats through dt->statEntry, which
+   must be set. */
+PHYSFS_EnumerateCallbackResult __PHYSFS_DirTreeEnumerateStat(void *opaque,
+                              const char *dname,
+                              PHYSFS_EnumerateStatCallback cb,
+                              const char *origdir, void *callbackdata);
 void __PHYSFS_DirTreeDeinit(__PHYSFS_DirTree *dt);
 
+/*
+ * Archivers that can list one directory at a time can add a dir's entry
+ *  and Defer its children; dt->loadDir adds them the first time something
+ *  looks inside it (DirTreeFind of a path below it, or enumerating it).
+ *  DirTreeLoad does that now if (entry) is still deferred, and returns zero
+ *  on failure, leaving it deferred so the next look tries again.
+ */
+void __PHYSFS_DirTreeDefer(__PHYSFS_DirTree *dt, __PHYSFS_DirTreeEntry *entry);
+int __PHYSFS_DirTreeLoad(__PHYSFS_DirTree *dt, __PHYSFS_DirTreeEntry *entry);
+
+/*
+ * Mount index support (see PHYSFS_setMountIndexDir()). (arc) names the
+ *  archiver and (archivePath) is the "name" handed to openArchive. (extra)
+ *  is (extralen) bytes of archiver-specific state to store with the tree.
+ *  Entry data after the __PHYSFS_DirTreeEntry is saved byte for byte, so
+ *  anything in it that holds pointers must set dt->indexEntry to clear them.
+ *  LoadIndex replaces a freshly-inited
+ *  (dt) and returns non-zero if a valid index was found, zero if the caller
+ *  should parse the archive (and probably SaveIndex afterwards).
+ *  SaveIndex is best-effort and reports nothing.
+ *  LoadIndexData is LoadIndex for an index the archiver found itself,
+ *  (len) bytes at (buf), which has to be aligned like malloc() memory.
+ *  It only checks that the index fits this build and (dt); it's up to
+ *  the archiver to know the index is for this archive.
+ */
+int __PHYSFS_DirTreeLoadIndex(__PHYSFS_DirTree *dt, const char *arc,
+                              const char *archivePath, PHYSFS_Io *io,
+                              void *extra, const size_t extralen);
+int __PHYSFS_DirTreeLoadIndexData(__PHYSFS_DirTree *dt, const char *arc,
+                                  const void *buf, const size_t len,
+                                  void *extra, const size_t extralen);
+void __PHYSFS_DirTreeSaveIndex(const __PHYSFS_DirTree *dt, const char *arc,
+                               const char *archivePath, PHYSFS_Io *io,
+                               const void *extra, const size_t extralen);
+
 
 
 /*--------------------------------------------------------------------------*/
@@ -532,6 +825,16 @@ void *__PHYSFS_platformOpenWrite(const char *filename);
  */
 void *__PHYSFS_platformOpenAppend(const char *filename);
 
+/*
+ * Create a new file for writing. (filename) is in platform-dependent
+ *  notation. This is __PHYSFS_platformOpenWrite(), except that it fails if
+ *  the file already exists, atomically with creating it, so that two callers
+ *  (in this process or others) can never both get the same file.
+ *
+ * Call PHYSFS_setErrorCode() and return (NULL) if the file can't be created.
+ */
+void *__PHYSFS_platformOpenNew(const char *filename);
+
 /*
  * Read more data from a platform-specific file handle. (opaque) should be
  *  cast to whatever data type your platform uses. Read a maximum of (len)
@@ -547,6 +850,52 @@ void *__PHYSFS_platformOpenAppend(const char *filename);
  */
 PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buf, PHYSFS_uint64 len);
 
+#ifndef PHYSFS_NO_POSITIONAL_READ
+/*
+ * Read more data from a file, starting at (offset) bytes from its start,
+ *  like __PHYSFS_platformRead(), but without using or moving the file
+ *  pointer. Several threads may do this on the same (opaque) at once.
+ *  A read that starts at or past the end of the file returns zero.
+ *  Platforms that can't do this define PHYSFS_NO_POSITIONAL_READ.
+ */
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buf,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 offset);
+
+/*
+ * Start a __PHYSFS_platformReadAt() on (opaque), a handle from
+ *  __PHYSFS_platformOpenRead(), and return without waiting for it. When it's
+ *  done, call (done) from some other thread with (data), what ReadAt would
+ *  have returned, and the error code if that's -1. (opaque) and (buf) stay
+ *  valid until then. Return zero, without calling (done), if it can't be
+ *  done this way right now (no OS support, too much already in flight,
+ *  etc); the caller reads it some other way. Don't set an error code.
+ *  The caller holds the stateLock, so this never runs at the same time as
+ *  itself or __PHYSFS_platformStopAsyncReads().
+ *
+ * This is for OS-level asynchronous I/O (io_uring, I/O completion ports);
+ *  platforms without any can just return zero.
+ */
+typedef void (*__PHYSFS_AsyncReadDone)(void *data, PHYSFS_sint64 rc,
+                                       PHYSFS_ErrorCode err);
+int __PHYSFS_platformReadAtAsync(void *opaque, void *buf, PHYSFS_uint64 len,
+                                 PHYSFS_uint64 offset,
+                                 __PHYSFS_AsyncReadDone done, void *data);
+
+/*
+ * Wait for every read started by __PHYSFS_platformReadAtAsync() to call its
+ *  (done), then release whatever it set up. This is called during deinit,
+ *  and another async read may be started later.
+ */
+void __PHYSFS_platformStopAsyncReads(void);
+#endif
+
+/*
+ * Return the OS's own handle for a platform-specific file handle (the file
+ *  descriptor on Unix, the HANDLE on Windows, etc), as an integer, for
+ *  PHYSFS_getNativeRange(). This can't fail.
+ */
+PHYSFS_sint64 __PHYSFS_platformGetOsHandle(void *opaque);
+
 /*
  * Write more data to a platform-specific file handle. (opaque) should be
  *  cast to whatever data type your platform uses. Write a maximum of (len)
@@ -630,6 +979,49 @@ int __PHYSFS_platformFlush(void *opaque);
  */
 void __PHYSFS_platformClose(void *opaque);
 
+/*
+ * Map an entire file into memory, read-only. (len) is filled in with the
+ *  size of the mapping, which is the size of the file. Mappings must stay
+ *  valid after any OS file handles used to create them are closed.
+ *
+ * Platforms that can't (or won't) do this, or files that can't be mapped
+ *  (empty files, files too large for the address space), should fail; the
+ *  caller falls back to __PHYSFS_platformOpenRead() and friends.
+ *
+ *  Return NULL on failure, pointer to the mapped bytes on success.
+ */
+const void *__PHYSFS_platformMapFile(const char *filename, PHYSFS_uint64 *len);
+
+/*
+ * Release a mapping returned from __PHYSFS_platformMapFile(). (len) is the
+ *  length that function reported.
+ */
+void __PHYSFS_platformUnmapFile(const void *ptr, const PHYSFS_uint64 len);
+
+/*
+ * Hint that (len) bytes of platform-specific file handle (opaque), starting
+ *  at (offset), are going to be read soon, so the OS can start pulling them
+ *  into its cache now. This is only advice; platforms that can't do it can
+ *  just return. Don't set an error code.
+ */
+void __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 offset,
+                               PHYSFS_uint64 len);
+
+/*
+ * Same as __PHYSFS_platformPrefetch(), for (len) bytes starting at (ptr)
+ *  inside a mapping from __PHYSFS_platformMapFile().
+ */
+void __PHYSFS_platformPrefetchMapping(const void *ptr, PHYSFS_uint64 len);
+
+/*
+ * Pull all (len) bytes of a mapping from __PHYSFS_platformMapFile(),
+ *  starting at (ptr), into memory and keep them there until it's unmapped.
+ *  Return zero if that can't be done (no support, or over the OS's limit on
+ *  locked memory); the caller can copy the bytes somewhere instead. Don't
+ *  set an error code.
+ */
+int __PHYSFS_platformLockMapping(const void *ptr, PHYSFS_uint64 len);
+
 /*
  * Platform implementation of PHYSFS_getCdRomDirsCallback()...
  *  CD directories are discovered and reported to the callback one at a time.
@@ -681,6 +1073,14 @@ char *__PHYSFS_platformCalcPrefDir(const char *org, const char *app);
 void *__PHYSFS_platformGetThreadID(void);
 
 
+/*
+ * Return a monotonic timestamp in nanoseconds. It has no fixed epoch and is
+ *  only good for measuring how long something took; resolution is whatever
+ *  the platform's best clock gives us.
+ */
+PHYSFS_uint64 __PHYSFS_platformNanoseconds(void);
+
+
 /*
  * Enumerate a directory of files. This follows the rules for the
  *  PHYSFS_Archiver::enumerate() method, except that the (dirName) that is
@@ -693,6 +1093,16 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
                                PHYSFS_EnumerateCallback callback,
                                const char *origdir, void *callbackdata);
 
+/*
+ * Same as __PHYSFS_platformEnumerate(), but (callback) also gets each
+ *  entry's metadata, filled in as __PHYSFS_platformStat(path, stat, 0)
+ *  would, from the directory listing where the platform provides it.
+ */
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStat(
+                               const char *dirname,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata);
+
 /*
  * Make a directory in the actual filesystem. (path) is specified in
  *  platform-dependent notation. On error, return zero and set the error
@@ -714,6 +1124,43 @@ int __PHYSFS_platformMkDir(const char *path);
  */
 int __PHYSFS_platformDelete(const char *path);
 
+/*
+ * Rename file (src) to (dst) in the actual filesystem, replacing (dst) if
+ *  it exists. Where the platform can, this is atomic: anything opening (dst)
+ *  gets either the old file or the new one, never a mix. Both are specified
+ *  in platform-dependent notation, and are on the same filesystem.
+ *
+ * On error, return zero and set the error message. Return non-zero on success.
+ */
+int __PHYSFS_platformRename(const char *src, const char *dst);
+
+
+#ifdef PHYSFS_PLATFORM_POSIX
+/*
+ * Directory-relative versions of the calls the DIR archiver makes, so it can
+ *  open its directory once and stop building (and having the kernel walk)
+ *  the full path on every access. __PHYSFS_platformOpenDirFd() returns -1,
+ *  without setting an error, if the platform can't do this; use the plain
+ *  calls instead. Otherwise, the others behave like their plain versions,
+ *  with (path) relative to (dirfd). (path) can be "" for (dirfd) itself,
+ *  for stat and enumerate. (mode) is 'r', 'w', or 'a'.
+ */
+int __PHYSFS_platformOpenDirFd(const char *dirname);
+void __PHYSFS_platformCloseDirFd(const int dirfd);
+void *__PHYSFS_platformOpenAt(const int dirfd, const char *path, const int mode);
+int __PHYSFS_platformStatAt(const int dirfd, const char *path, PHYSFS_Stat *stat, const int follow);
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateAt(const int dirfd,
+                               const char *path,
+                               PHYSFS_EnumerateCallback callback,
+                               const char *origdir, void *callbackdata);
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStatAt(
+                               const int dirfd, const char *path,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata);
+int __PHYSFS_platformMkDirAt(const int dirfd, const char *path);
+int __PHYSFS_platformDeleteAt(const int dirfd, const char *path);
+#endif
+
 
 /*
  * Create a platform-specific mutex. This can be whatever datatype your
@@ -761,10 +1208,58 @@ int __PHYSFS_platformGrabMutex(void *mutex);
  */
 void __PHYSFS_platformReleaseMutex(void *mutex);
 
+/*
+ * Start a thread that runs (fn)(data) and then exits. Return an opaque
+ *  handle for __PHYSFS_platformWaitThread(), or NULL if a thread couldn't be
+ *  made. Systems without threads can just return NULL; callers must be
+ *  ready for that, usually by doing the work themselves.
+ */
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data);
+
+/*
+ * Block until a thread from __PHYSFS_platformCreateThread() has returned
+ *  from its function, then clean up (thread).
+ */
+void __PHYSFS_platformWaitThread(void *thread);
+
+/*
+ * Return the number of CPU cores this process can use, for sizing groups of
+ *  threads. Return 1 if you don't know.
+ */
+int __PHYSFS_platformCPUCount(void);
+
+/*
+ * Create a counting semaphore that starts at zero. Return an opaque handle,
+ *  or NULL on failure (and set an error code).
+ */
+void *__PHYSFS_platformCreateSemaphore(void);
+
+/*
+ * Destroy a semaphore. Nothing may be waiting on it.
+ */
+void __PHYSFS_platformDestroySemaphore(void *sem);
+
+/*
+ * Increment the semaphore's count, waking a thread waiting on it, if any.
+ */
+void __PHYSFS_platformPostSemaphore(void *sem);
+
+/*
+ * Block until the semaphore's count is above zero, then decrement it.
+ */
+void __PHYSFS_platformWaitSemaphore(void *sem);
+
 
 /* !!! FIXME: move to public API? */
 PHYSFS_uint32 __PHYSFS_utf8codepoint(const char **_str);
 
+/*
+ * Caseless compare of (str1) with the path element at (*_str2), which ends
+ *  at '/' or '\0'. Non-zero if they match; (*_str2) is moved to the end of
+ *  the element in that case.
+ */
+int __PHYSFS_utf8stricmpPathElement(const char *str1, const char **_str2);
+
 
 #if PHYSFS_HAVE_PRAGMA_VISIBILITY
 #pragma GCC visibility pop
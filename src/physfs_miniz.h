@@ -556,10 +556,34 @@ static int mz_inflateInit2(mz_streamp pStream, int window_bits)
   return MZ_OK;
 }
 
+/* start over, keeping the allocated state. */
+static int mz_inflateReset(mz_streamp pStream)
+{
+  inflate_state *pDecomp;
+  if ((!pStream) || (!pStream->state)) return MZ_STREAM_ERROR;
+
+  pStream->data_type = 0;
+  pStream->adler = 0;
+  pStream->msg = NULL;
+  pStream->total_in = 0;
+  pStream->total_out = 0;
+  pStream->reserved = 0;
+
+  pDecomp = (inflate_state*)pStream->state;
+  tinfl_init(&pDecomp->m_decomp);
+  pDecomp->m_dict_ofs = 0;
+  pDecomp->m_dict_avail = 0;
+  pDecomp->m_last_status = TINFL_STATUS_NEEDS_MORE_INPUT;
+  pDecomp->m_first_call = 1;
+  pDecomp->m_has_flushed = 0;
+
+  return MZ_OK;
+}
+
 static int mz_inflate(mz_streamp pStream, int flush)
 {
   inflate_state* pState;
-  mz_uint n, first_call, decomp_flags = TINFL_FLAG_COMPUTE_ADLER32;
+  mz_uint n, first_call, decomp_flags = 0;
   size_t in_bytes, out_bytes, orig_avail_in;
   tinfl_status status;
 
@@ -568,7 +592,8 @@ static int mz_inflate(mz_streamp pStream, int flush)
   if ((flush) && (flush != MZ_SYNC_FLUSH) && (flush != MZ_FINISH)) return MZ_STREAM_ERROR;
 
   pState = (inflate_state*)pStream->state;
-  if (pState->m_window_bits > 0) decomp_flags |= TINFL_FLAG_PARSE_ZLIB_HEADER;
+  /* raw deflate streams (ZIP entries) have no adler32 to check, so don't compute one. */
+  if (pState->m_window_bits > 0) decomp_flags |= TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32;
   orig_avail_in = pStream->avail_in;
 
   first_call = pState->m_first_call; pState->m_first_call = 0;
@@ -662,8 +687,10 @@ static int mz_inflateEnd(mz_streamp pStream)
 /* make this a drop-in replacement for zlib... */
   #define voidpf void*
   #define uInt unsigned int
+  #define uLong mz_ulong
   #define z_stream              mz_stream
   #define inflateInit2          mz_inflateInit2
+  #define inflateReset          mz_inflateReset
   #define inflate               mz_inflate
   #define inflateEnd            mz_inflateEnd
   #define Z_SYNC_FLUSH          MZ_SYNC_FLUSH
@@ -20,11 +20,13 @@
 #define INCL_DOSPROCESS
 #define INCL_DOSDEVICES
 #define INCL_DOSDEVIOCTL
+#define INCL_DOSPROFILE
 #define INCL_DOSMISC
 #include <os2.h>
 #include <uconv.h>
 
 #include <errno.h>
+#include <process.h>
 #include <time.h>
 #include <ctype.h>
 
@@ -610,6 +612,17 @@ void *__PHYSFS_platformOpenAppend(const char *filename)
 } /* __PHYSFS_platformOpenAppend */
 
 
+void *__PHYSFS_platformOpenNew(const char *filename)
+{
+    return (void *) openFile(filename,
+                        OPEN_ACTION_FAIL_IF_EXISTS |
+                        OPEN_ACTION_CREATE_IF_NEW,
+                        OPEN_FLAGS_FAIL_ON_ERROR | OPEN_FLAGS_NO_LOCALITY |
+                        OPEN_FLAGS_NOINHERIT | OPEN_SHARE_DENYWRITE |
+                        OPEN_ACCESS_WRITEONLY);
+} /* __PHYSFS_platformOpenNew */
+
+
 PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buf, PHYSFS_uint64 len)
 {
     ULONG br = 0;
@@ -621,6 +634,12 @@ PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buf, PHYSFS_uint64 len)
 } /* __PHYSFS_platformRead */
 
 
+PHYSFS_sint64 __PHYSFS_platformGetOsHandle(void *opaque)
+{
+    return (PHYSFS_sint64) (HFILE) opaque;
+} /* __PHYSFS_platformGetOsHandle */
+
+
 PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buf,
                                      PHYSFS_uint64 len)
 {
@@ -682,6 +701,39 @@ void __PHYSFS_platformClose(void *opaque)
 } /* __PHYSFS_platformClose */
 
 
+const void *__PHYSFS_platformMapFile(const char *filename, PHYSFS_uint64 *len)
+{
+    /* OS/2 has no file mapping; callers fall back to regular reads. */
+    BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
+} /* __PHYSFS_platformMapFile */
+
+
+void __PHYSFS_platformUnmapFile(const void *ptr, const PHYSFS_uint64 len)
+{
+    assert(0 && "Shouldn't have a mapping to unmap on OS/2");
+} /* __PHYSFS_platformUnmapFile */
+
+
+void __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 offset,
+                               PHYSFS_uint64 len)
+{
+    /* no readahead hints on OS/2. */
+} /* __PHYSFS_platformPrefetch */
+
+
+void __PHYSFS_platformPrefetchMapping(const void *ptr, PHYSFS_uint64 len)
+{
+    assert(0 && "Shouldn't have a mapping to prefetch on OS/2");
+} /* __PHYSFS_platformPrefetchMapping */
+
+
+int __PHYSFS_platformLockMapping(const void *ptr, PHYSFS_uint64 len)
+{
+    assert(0 && "Shouldn't have a mapping to lock on OS/2");
+    return 0;
+} /* __PHYSFS_platformLockMapping */
+
+
 int __PHYSFS_platformDelete(const char *path)
 {
     char *cppath = cvtUtf8ToCodepage(path);
@@ -702,6 +754,30 @@ done:
 } /* __PHYSFS_platformDelete */
 
 
+int __PHYSFS_platformRename(const char *src, const char *dst)
+{
+    char *cpsrc = cvtUtf8ToCodepage(src);
+    char *cpdst = NULL;
+    APIRET rc;
+    int retval = 0;
+
+    BAIL_IF_ERRPASS(!cpsrc, 0);
+    cpdst = cvtUtf8ToCodepage(dst);
+    GOTO_IF_ERRPASS(!cpdst, done);
+
+    /* DosMove() won't replace (dst), so this isn't atomic here. */
+    (void) DosDelete(cpdst);
+    rc = DosMove(cpsrc, cpdst);
+    GOTO_IF(rc != NO_ERROR, errcodeFromAPIRET(rc), done);
+    retval = 1;  /* success */
+
+done:
+    allocator.Free(cpdst);
+    allocator.Free(cpsrc);
+    return retval;
+} /* __PHYSFS_platformRename */
+
+
 /* Convert to a format PhysicsFS can grok... */
 PHYSFS_sint64 os2TimeToUnixTime(const FDATE *date, const FTIME *time)
 {
@@ -721,19 +797,13 @@ PHYSFS_sint64 os2TimeToUnixTime(const FDATE *date, const FTIME *time)
 } /* os2TimeToUnixTime */
 
 
-int __PHYSFS_platformStat(const char *filename, PHYSFS_Stat *stat, const int follow)
+static void statFromOs2Info(PHYSFS_Stat *stat, const ULONG attr,
+                            const ULONG size,
+                            const FDATE *cdate, const FTIME *ctime,
+                            const FDATE *adate, const FTIME *atime,
+                            const FDATE *mdate, const FTIME *mtime)
 {
-    char *cpfname = cvtUtf8ToCodepage(filename);
-    FILESTATUS3 fs;
-    int retval = 0;
-    APIRET rc;
-
-    BAIL_IF_ERRPASS(!cpfname, 0);
-
-    rc = DosQueryPathInfo(cpfname, FIL_STANDARD, &fs, sizeof (fs));
-    GOTO_IF(rc != NO_ERROR, errcodeFromAPIRET(rc), done);
-
-    if (fs.attrFile & FILE_DIRECTORY)
+    if (attr & FILE_DIRECTORY)
     {
         stat->filetype = PHYSFS_FILETYPE_DIRECTORY;
         stat->filesize = 0;
@@ -741,23 +811,42 @@ int __PHYSFS_platformStat(const char *filename, PHYSFS_Stat *stat, const int fol
     else
     {
         stat->filetype = PHYSFS_FILETYPE_REGULAR;
-        stat->filesize = fs.cbFile;
+        stat->filesize = size;
     } /* else */
 
-    stat->modtime = os2TimeToUnixTime(&fs.fdateLastWrite, &fs.ftimeLastWrite);
+    stat->modtime = os2TimeToUnixTime(mdate, mtime);
     if (stat->modtime < 0)
         stat->modtime = 0;
 
-    stat->accesstime = os2TimeToUnixTime(&fs.fdateLastAccess, &fs.ftimeLastAccess);
+    stat->accesstime = os2TimeToUnixTime(adate, atime);
     if (stat->accesstime < 0)
         stat->accesstime = 0;
 
-    stat->createtime = os2TimeToUnixTime(&fs.fdateCreation, &fs.ftimeCreation);
+    stat->createtime = os2TimeToUnixTime(cdate, ctime);
     if (stat->createtime < 0)
         stat->createtime = 0;
 
-    stat->readonly = ((fs.attrFile & FILE_READONLY) == FILE_READONLY);
-    return 1;  /* success */
+    stat->readonly = ((attr & FILE_READONLY) == FILE_READONLY);
+} /* statFromOs2Info */
+
+
+int __PHYSFS_platformStat(const char *filename, PHYSFS_Stat *stat, const int follow)
+{
+    char *cpfname = cvtUtf8ToCodepage(filename);
+    FILESTATUS3 fs;
+    int retval = 0;
+    APIRET rc;
+
+    BAIL_IF_ERRPASS(!cpfname, 0);
+
+    rc = DosQueryPathInfo(cpfname, FIL_STANDARD, &fs, sizeof (fs));
+    GOTO_IF(rc != NO_ERROR, errcodeFromAPIRET(rc), done);
+
+    statFromOs2Info(stat, fs.attrFile, fs.cbFile,
+                    &fs.fdateCreation, &fs.ftimeCreation,
+                    &fs.fdateLastAccess, &fs.ftimeLastAccess,
+                    &fs.fdateLastWrite, &fs.ftimeLastWrite);
+    retval = 1;  /* success */
 
 done:
     allocator.Free(cpfname); 
@@ -765,6 +854,73 @@ done:
 } /* __PHYSFS_platformStat */
 
 
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStat(
+                               const char *dirname,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    size_t utf8len = strlen(dirname);
+    char *utf8 = (char *) __PHYSFS_smallAlloc(utf8len + 5);
+    char *cpspec = NULL;
+    FILEFINDBUF3 fb;
+    HDIR hdir = HDIR_CREATE;
+    ULONG count = 1;
+    APIRET rc;
+
+    BAIL_IF(!utf8, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+
+    strcpy(utf8, dirname);
+    if (utf8[utf8len - 1] != '\\')
+        strcpy(utf8 + utf8len, "\\*.*");
+    else
+        strcpy(utf8 + utf8len, "*.*");
+
+    cpspec = cvtUtf8ToCodepage(utf8);
+    __PHYSFS_smallFree(utf8);
+    BAIL_IF_ERRPASS(!cpspec, PHYSFS_ENUM_ERROR);
+
+    rc = DosFindFirst(cpspec, &hdir,
+                      FILE_DIRECTORY | FILE_ARCHIVED |
+                      FILE_READONLY | FILE_HIDDEN | FILE_SYSTEM,
+                      &fb, sizeof (fb), &count, FIL_STANDARD);
+    allocator.Free(cpspec);
+
+    BAIL_IF(rc != NO_ERROR, errcodeFromAPIRET(rc), PHYSFS_ENUM_ERROR);
+
+    while (count == 1)
+    {
+        if ((strcmp(fb.achName, ".") != 0) && (strcmp(fb.achName, "..") != 0))
+        {
+            utf8 = cvtCodepageToUtf8(fb.achName);
+            if (!utf8)
+                retval = PHYSFS_ENUM_ERROR;
+            else
+            {
+                PHYSFS_Stat st;
+                statFromOs2Info(&st, fb.attrFile, fb.cbFile,
+                                &fb.fdateCreation, &fb.ftimeCreation,
+                                &fb.fdateLastAccess, &fb.ftimeLastAccess,
+                                &fb.fdateLastWrite, &fb.ftimeLastWrite);
+                retval = callback(callbackdata, origdir, utf8, &st);
+                allocator.Free(utf8);
+                if (retval == PHYSFS_ENUM_ERROR)
+                    PHYSFS_setErrorCode(PHYSFS_ERR_APP_CALLBACK);
+            } /* else */
+        } /* if */
+
+        if (retval != PHYSFS_ENUM_OK)
+            break;
+
+        DosFindNext(hdir, &fb, sizeof (fb), &count);
+    } /* while */
+
+    DosFindClose(hdir);
+
+    return retval;
+} /* __PHYSFS_platformEnumerateStat */
+
+
 void *__PHYSFS_platformGetThreadID(void)
 {
     PTIB ptib;
@@ -780,6 +936,28 @@ void *__PHYSFS_platformGetThreadID(void)
 } /* __PHYSFS_platformGetThreadID */
 
 
+PHYSFS_uint64 __PHYSFS_platformNanoseconds(void)
+{
+    static ULONG freq = 0;  /* fixed at boot, so races are harmless. */
+    QWORD qw;
+    PHYSFS_uint64 now;
+
+    if ((freq == 0) && (DosTmrQueryFreq(&freq) != NO_ERROR))
+        freq = 0;
+
+    if ((freq == 0) || (DosTmrQueryTime(&qw) != NO_ERROR))
+    {
+        ULONG ms = 0;
+        DosQuerySysInfo(QSV_MS_COUNT, QSV_MS_COUNT, &ms, sizeof (ms));
+        return ((PHYSFS_uint64) ms) * 1000000;
+    } /* if */
+
+    now = (((PHYSFS_uint64) qw.ulHi) << 32) | ((PHYSFS_uint64) qw.ulLo);
+    return ((now / freq) * __PHYSFS_UI64(1000000000)) +
+           (((now % freq) * __PHYSFS_UI64(1000000000)) / freq);
+} /* __PHYSFS_platformNanoseconds */
+
+
 void *__PHYSFS_platformCreateMutex(void)
 {
     HMTX hmtx = NULLHANDLE;
@@ -807,6 +985,136 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
     DosReleaseMutexSem((HMTX) mutex);
 } /* __PHYSFS_platformReleaseMutex */
 
+
+typedef struct
+{
+    TID tid;
+    void (*fn)(void *);
+    void *data;
+} Os2Thread;
+
+/* _beginthread(), not DosCreateThread(), so the C runtime is set up. */
+static void os2ThreadEntry(void *_t)
+{
+    Os2Thread *t = (Os2Thread *) _t;
+    t->fn(t->data);
+} /* os2ThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data)
+{
+    Os2Thread *t = (Os2Thread *) allocator.Malloc(sizeof (Os2Thread));
+    int tid;
+    BAIL_IF(!t, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    t->fn = fn;
+    t->data = data;
+    tid = _beginthread(os2ThreadEntry, NULL, 256 * 1024, t);
+    if (tid == -1)
+    {
+        allocator.Free(t);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+    t->tid = (TID) tid;
+    return t;
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformWaitThread(void *thread)
+{
+    Os2Thread *t = (Os2Thread *) thread;
+    TID tid = t->tid;
+    DosWaitThread(&tid, DCWW_WAIT);
+    allocator.Free(t);
+} /* __PHYSFS_platformWaitThread */
+
+
+int __PHYSFS_platformCPUCount(void)
+{
+#ifdef QSV_NUMPROCESSORS
+    ULONG count = 0;
+    if (DosQuerySysInfo(QSV_NUMPROCESSORS, QSV_NUMPROCESSORS,
+                        &count, sizeof (count)) == NO_ERROR)
+        return (count > 0) ? (int) count : 1;
+#endif
+    return 1;
+} /* __PHYSFS_platformCPUCount */
+
+
+/* OS/2 has no counting semaphores; an event sem plus a count will do. */
+typedef struct
+{
+    HMTX mutex;
+    HEV event;  /* posted while (count) is above zero. */
+    ULONG count;
+} Os2Semaphore;
+
+
+void *__PHYSFS_platformCreateSemaphore(void)
+{
+    Os2Semaphore *s = (Os2Semaphore *) allocator.Malloc(sizeof (Os2Semaphore));
+    APIRET rc;
+
+    BAIL_IF(!s, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    s->count = 0;
+    rc = DosCreateMutexSem(NULL, &s->mutex, 0, 0);
+    if (rc != NO_ERROR)
+    {
+        allocator.Free(s);
+        BAIL(errcodeFromAPIRET(rc), NULL);
+    } /* if */
+
+    rc = DosCreateEventSem(NULL, &s->event, 0, FALSE);
+    if (rc != NO_ERROR)
+    {
+        DosCloseMutexSem(s->mutex);
+        allocator.Free(s);
+        BAIL(errcodeFromAPIRET(rc), NULL);
+    } /* if */
+
+    return s;
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+    Os2Semaphore *s = (Os2Semaphore *) sem;
+    DosCloseEventSem(s->event);
+    DosCloseMutexSem(s->mutex);
+    allocator.Free(s);
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+    Os2Semaphore *s = (Os2Semaphore *) sem;
+    DosRequestMutexSem(s->mutex, SEM_INDEFINITE_WAIT);
+    s->count++;
+    DosPostEventSem(s->event);
+    DosReleaseMutexSem(s->mutex);
+} /* __PHYSFS_platformPostSemaphore */
+
+
+void __PHYSFS_platformWaitSemaphore(void *sem)
+{
+    Os2Semaphore *s = (Os2Semaphore *) sem;
+    while (1)
+    {
+        DosRequestMutexSem(s->mutex, SEM_INDEFINITE_WAIT);
+        if (s->count > 0)
+        {
+            if (--s->count == 0)
+            {
+                ULONG posts;
+                DosResetEventSem(s->event, &posts);
+            } /* if */
+            DosReleaseMutexSem(s->mutex);
+            return;
+        } /* if */
+        DosReleaseMutexSem(s->mutex);
+        DosWaitEventSem(s->event, SEM_INDEFINITE_WAIT);
+    } /* while */
+} /* __PHYSFS_platformWaitSemaphore */
+
 #endif  /* PHYSFS_PLATFORM_OS2 */
 
 /* end of physfs_platform_os2.c ... */
@@ -15,14 +15,35 @@
 #include <ctype.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <pwd.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
 
 #include "physfs_internal.h"
 
+/* the *at() calls came with POSIX.1-2008; older systems use full paths. */
+#if defined(AT_FDCWD) && defined(AT_SYMLINK_NOFOLLOW) && defined(O_DIRECTORY) && !defined(PHYSFS_NO_OPENAT)
+#define PHYSFS_HAVE_OPENAT 1
+#endif
+
+/* Linux 5.1+ has io_uring for async reads; we talk to it without liburing.
+   Whether the running kernel allows it is checked when it's first needed. */
+#if defined(PHYSFS_PLATFORM_LINUX) && !defined(PHYSFS_PLATFORM_ANDROID) && !defined(PHYSFS_NO_IO_URING) && defined(__has_include)
+#  if __has_include(<linux/io_uring.h>)
+#    include <sys/syscall.h>
+#    include <sys/uio.h>
+#    include <linux/io_uring.h>
+#    if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter)
+#      define PHYSFS_HAVE_IO_URING 1
+#    endif
+#  endif
+#endif
+
 
 static PHYSFS_ErrorCode errcodeFromErrnoError(const int err)
 {
@@ -116,17 +137,14 @@ char *__PHYSFS_platformCalcUserDir(void)
 } /* __PHYSFS_platformCalcUserDir */
 
 
-PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
+/* Hand everything in (dir) to (callback), then close it. */
+static PHYSFS_EnumerateCallbackResult enumerateDir(DIR *dir,
                                PHYSFS_EnumerateCallback callback,
                                const char *origdir, void *callbackdata)
 {
-    DIR *dir;
     struct dirent *ent;
     PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
 
-    dir = opendir(dirname);
-    BAIL_IF(dir == NULL, errcodeFromErrno(), PHYSFS_ENUM_ERROR);
-
     while ((retval == PHYSFS_ENUM_OK) && ((ent = readdir(dir)) != NULL))
     {
         const char *name = ent->d_name;
@@ -144,9 +162,147 @@ PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
     closedir(dir);
 
     return retval;
+} /* enumerateDir */
+
+
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
+                               PHYSFS_EnumerateCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    DIR *dir = opendir(dirname);
+    BAIL_IF(dir == NULL, errcodeFromErrno(), PHYSFS_ENUM_ERROR);
+    return enumerateDir(dir, callback, origdir, callbackdata);
 } /* __PHYSFS_platformEnumerate */
 
 
+static void statFromStatBuf(const struct stat *statbuf, PHYSFS_Stat *st)
+{
+    if (S_ISREG(statbuf->st_mode))
+    {
+        st->filetype = PHYSFS_FILETYPE_REGULAR;
+        st->filesize = statbuf->st_size;
+    } /* if */
+
+    else if(S_ISDIR(statbuf->st_mode))
+    {
+        st->filetype = PHYSFS_FILETYPE_DIRECTORY;
+        st->filesize = 0;
+    } /* else if */
+
+    else if(S_ISLNK(statbuf->st_mode))
+    {
+        st->filetype = PHYSFS_FILETYPE_SYMLINK;
+        st->filesize = 0;
+    } /* else if */
+
+    else
+    {
+        st->filetype = PHYSFS_FILETYPE_OTHER;
+        st->filesize = statbuf->st_size;
+    } /* else */
+
+    st->modtime = statbuf->st_mtime;
+    st->createtime = statbuf->st_ctime;
+    st->accesstime = statbuf->st_atime;
+} /* statFromStatBuf */
+
+
+/*
+ * lstat() and access(W_OK) (name), which was just read from (dir), opened
+ *  from (dirname). Where the *at() calls exist this works relative to the
+ *  open directory, so there's no path to build and the kernel doesn't walk
+ *  (dirname) again for every entry. Returns -1 and sets errno on failure.
+ */
+static int lstatDirEntry(DIR *dir, const char *dirname, const char *name,
+                         struct stat *statbuf, int *readonly)
+{
+#ifdef AT_SYMLINK_NOFOLLOW
+    const int fd = dirfd(dir);
+    const int rc = fstatat(fd, name, statbuf, AT_SYMLINK_NOFOLLOW);
+    if (rc != -1)
+        *readonly = (faccessat(fd, name, W_OK, 0) == -1);
+    return rc;
+#else
+    const size_t len = strlen(dirname) + strlen(name) + 2;
+    char *path = (char *) __PHYSFS_smallAlloc(len);
+    int rc = -1;
+
+    if (path == NULL)
+        errno = ENOMEM;
+    else
+    {
+        int err;
+        snprintf(path, len, "%s/%s", dirname, name);
+        rc = lstat(path, statbuf);
+        if (rc != -1)
+            *readonly = (access(path, W_OK) == -1);
+        err = errno;
+        __PHYSFS_smallFree(path);
+        errno = err;
+    } /* else */
+
+    return rc;
+#endif
+} /* lstatDirEntry */
+
+
+/* Hand everything in (dir), opened from (dirname), to (callback) with its
+   metadata, then close it. */
+static PHYSFS_EnumerateCallbackResult enumerateDirStat(DIR *dir,
+                               const char *dirname,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    struct dirent *ent;
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+
+    while ((retval == PHYSFS_ENUM_OK) && ((ent = readdir(dir)) != NULL))
+    {
+        const char *name = ent->d_name;
+        struct stat statbuf;
+        PHYSFS_Stat st;
+        int readonly = 1;
+
+        if (name[0] == '.')  /* ignore "." and ".." */
+        {
+            if ((name[1] == '\0') || ((name[1] == '.') && (name[2] == '\0')))
+                continue;
+        } /* if */
+
+        if (lstatDirEntry(dir, dirname, name, &statbuf, &readonly) == -1)
+        {
+            if (errno == ENOENT)
+                continue;  /* deleted since readdir() saw it; skip it. */
+            PHYSFS_setErrorCode(errcodeFromErrno());
+            retval = PHYSFS_ENUM_ERROR;
+            break;
+        } /* if */
+
+        statFromStatBuf(&statbuf, &st);
+        st.readonly = readonly;
+
+        retval = callback(callbackdata, origdir, name, &st);
+        if (retval == PHYSFS_ENUM_ERROR)
+            PHYSFS_setErrorCode(PHYSFS_ERR_APP_CALLBACK);
+    } /* while */
+
+    closedir(dir);
+
+    return retval;
+} /* enumerateDirStat */
+
+
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStat(
+                               const char *dirname,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    DIR *dir = opendir(dirname);
+    BAIL_IF(dir == NULL, errcodeFromErrno(), PHYSFS_ENUM_ERROR);
+    return enumerateDirStat(dir, dirname, callback, origdir, callbackdata);
+} /* __PHYSFS_platformEnumerateStat */
+
+
 int __PHYSFS_platformMkDir(const char *path)
 {
     const int rc = mkdir(path, S_IRWXU);
@@ -165,7 +321,8 @@ static inline void set_CLOEXEC(int fildes)
 }
 #endif
 
-static void *doOpen(const char *filename, int mode)
+/* (dirfd) is -1 to open (filename) as is, without openat(). */
+static void *doOpen(const int dirfd, const char *filename, int mode)
 {
     const int appending = (mode & O_APPEND);
     int fd;
@@ -182,6 +339,11 @@ static void *doOpen(const char *filename, int mode)
 #endif
 
     do {
+        #ifdef PHYSFS_HAVE_OPENAT
+        if (dirfd != -1)
+            fd = openat(dirfd, filename, mode, S_IRUSR | S_IWUSR);
+        else
+        #endif
         fd = open(filename, mode, S_IRUSR | S_IWUSR);
     } while ((fd < 0) && (errno == EINTR));
     BAIL_IF(fd < 0, errcodeFromErrno(), NULL);
@@ -214,22 +376,28 @@ static void *doOpen(const char *filename, int mode)
 
 void *__PHYSFS_platformOpenRead(const char *filename)
 {
-    return doOpen(filename, O_RDONLY);
+    return doOpen(-1, filename, O_RDONLY);
 } /* __PHYSFS_platformOpenRead */
 
 
 void *__PHYSFS_platformOpenWrite(const char *filename)
 {
-    return doOpen(filename, O_WRONLY | O_CREAT | O_TRUNC);
+    return doOpen(-1, filename, O_WRONLY | O_CREAT | O_TRUNC);
 } /* __PHYSFS_platformOpenWrite */
 
 
 void *__PHYSFS_platformOpenAppend(const char *filename)
 {
-    return doOpen(filename, O_WRONLY | O_CREAT | O_APPEND);
+    return doOpen(-1, filename, O_WRONLY | O_CREAT | O_APPEND);
 } /* __PHYSFS_platformOpenAppend */
 
 
+void *__PHYSFS_platformOpenNew(const char *filename)
+{
+    return doOpen(-1, filename, O_WRONLY | O_CREAT | O_EXCL);
+} /* __PHYSFS_platformOpenNew */
+
+
 PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buffer,
                                     PHYSFS_uint64 len)
 {
@@ -249,6 +417,402 @@ PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buffer,
 } /* __PHYSFS_platformRead */
 
 
+PHYSFS_sint64 __PHYSFS_platformGetOsHandle(void *opaque)
+{
+    return (PHYSFS_sint64) *((int *) opaque);
+} /* __PHYSFS_platformGetOsHandle */
+
+
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buffer,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    const int fd = *((int *) opaque);
+    ssize_t rc = 0;
+
+    if (!__PHYSFS_ui64FitsAddressSpace(len))
+        BAIL(PHYSFS_ERR_INVALID_ARGUMENT, -1);
+    else if (((PHYSFS_uint64) ((off_t) offset)) != offset)
+        return 0;  /* can't be inside the file. */
+
+    do {
+        rc = pread(fd, buffer, (size_t) len, (off_t) offset);
+    } while ((rc == -1) && (errno == EINTR));
+    BAIL_IF(rc == -1, errcodeFromErrno(), -1);
+    assert(rc >= 0);
+    assert(rc <= len);
+    return (PHYSFS_sint64) rc;
+} /* __PHYSFS_platformReadAt */
+
+
+#if PHYSFS_HAVE_IO_URING
+/*
+ * Async reads all go through one io_uring, set up the first time one is
+ *  asked for, with one thread that waits for completions and calls back.
+ *  Any thread can submit, holding uringLock. We never have more reads in
+ *  flight than there are submission slots (less one, kept for the request
+ *  that tells the thread to stop), so the completion ring, which is twice
+ *  as big, can't overflow. If the kernel (or a sandbox) won't give us a
+ *  ring, we don't ask again until the next init, and callers use threads.
+ */
+#ifndef PHYSFS_IO_URING_ENTRIES
+#define PHYSFS_IO_URING_ENTRIES 64
+#endif
+
+/* a completion's result is an int, so don't ask for more than this at once. */
+#define PHYSFS_IO_URING_MAX_READ 0x40000000
+
+typedef struct
+{
+    void *handle;  /* from __PHYSFS_platformOpenRead(). */
+    PHYSFS_uint8 *buf;  /* where the next piece goes. */
+    PHYSFS_uint64 len;  /* bytes still to read. */
+    PHYSFS_uint64 offset;  /* where the next piece comes from. */
+    PHYSFS_sint64 total;  /* bytes read so far. */
+    struct iovec iov;
+    __PHYSFS_AsyncReadDone done;
+    void *data;
+} UringRead;
+
+typedef struct
+{
+    int fd;
+    void *sqmap;
+    size_t sqmaplen;
+    void *cqmap;
+    size_t cqmaplen;
+    struct io_uring_sqe *sqes;
+    size_t sqeslen;
+    unsigned *sqhead;
+    unsigned *sqtail;
+    unsigned *sqarray;
+    unsigned sqmask;
+    unsigned *cqhead;
+    unsigned *cqtail;
+    struct io_uring_cqe *cqes;
+    unsigned cqmask;
+    unsigned entries;
+    unsigned inflight;  /* reads submitted that haven't called back yet. */
+    int stopping;  /* no new reads; the thread quits once (inflight) is 0. */
+    void *thread;
+} Uring;
+
+static pthread_mutex_t uringLock = PTHREAD_MUTEX_INITIALIZER;
+static Uring *uring = NULL;
+static int uringUnavailable = 0;
+
+static void uringDestroy(Uring *u)
+{
+    if (u->sqes) munmap(u->sqes, u->sqeslen);
+    if (u->cqmap) munmap(u->cqmap, u->cqmaplen);
+    if (u->sqmap) munmap(u->sqmap, u->sqmaplen);
+    close(u->fd);
+    allocator.Free(u);
+} /* uringDestroy */
+
+
+static void *uringMap(const int fd, const size_t len, const off_t what)
+{
+    void *retval = mmap(NULL, len, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, what);
+    return (retval == MAP_FAILED) ? NULL : retval;
+} /* uringMap */
+
+
+/* queue (r)'s next piece, or the stop request if (r) is NULL. Needs uringLock. */
+static int uringQueue(Uring *u, UringRead *r)
+{
+    const unsigned tail = *u->sqtail;  /* only we change this. */
+    const unsigned head = __atomic_load_n(u->sqhead, __ATOMIC_ACQUIRE);
+    const unsigned idx = tail & u->sqmask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+
+    if ((tail - head) >= u->entries)
+        return 0;  /* no room until the kernel catches up. */
+
+    memset(sqe, '\0', sizeof (*sqe));
+    if (r == NULL)
+        sqe->opcode = IORING_OP_NOP;  /* (user_data) 0 means "stop." */
+    else
+    {
+        r->iov.iov_base = r->buf;
+        r->iov.iov_len = (size_t) ((r->len < PHYSFS_IO_URING_MAX_READ) ? r->len : PHYSFS_IO_URING_MAX_READ);
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = *((int *) r->handle);
+        sqe->off = (__u64) r->offset;
+        sqe->addr = (__u64) (size_t) &r->iov;
+        sqe->len = 1;
+        sqe->user_data = (__u64) (size_t) r;
+    } /* else */
+
+    u->sqarray[idx] = idx;
+    __atomic_store_n(u->sqtail, tail + 1, __ATOMIC_RELEASE);
+
+    while ((syscall(__NR_io_uring_enter, u->fd, 1, 0, 0, NULL, 0) == -1) &&
+           (errno == EINTR)) { /* spin */ }
+
+    /* Without SQPOLL, the kernel only takes entries inside io_uring_enter, so
+        if it failed (EAGAIN, EBUSY...) and didn't take ours, it never will.
+        Take it back, so the caller can do this read some other way, instead
+        of it sitting there and never calling back. */
+    if (__atomic_load_n(u->sqhead, __ATOMIC_ACQUIRE) == tail)
+    {
+        __atomic_store_n(u->sqtail, tail, __ATOMIC_RELEASE);
+        return 0;
+    } /* if */
+
+    return 1;
+} /* uringQueue */
+
+
+static void uringFinishRead(Uring *u, UringRead *r, const int res)
+{
+    if (res > 0)
+    {
+        r->total += (PHYSFS_sint64) res;
+        r->buf += res;
+        r->len -= (PHYSFS_uint64) res;
+        r->offset += (PHYSFS_uint64) res;
+
+        if (r->len > 0)  /* more to go; queue it, or do it right here. */
+        {
+            int queued;
+            pthread_mutex_lock(&uringLock);
+            queued = uringQueue(u, r);
+            pthread_mutex_unlock(&uringLock);
+            if (queued)
+                return;
+
+            while (r->len > 0)
+            {
+                const PHYSFS_sint64 rc = __PHYSFS_platformReadAt(r->handle, r->buf, r->len, r->offset);
+                if (rc <= 0)
+                    break;  /* an error after some data is just a short read. */
+                r->total += rc;
+                r->buf += (size_t) rc;
+                r->len -= (PHYSFS_uint64) rc;
+                r->offset += (PHYSFS_uint64) rc;
+            } /* while */
+        } /* if */
+    } /* if */
+
+    if ((res < 0) && (r->total == 0))
+        r->done(r->data, -1, errcodeFromErrnoError(-res));
+    else
+        r->done(r->data, r->total, PHYSFS_ERR_OK);
+
+    pthread_mutex_lock(&uringLock);
+    u->inflight--;
+    pthread_mutex_unlock(&uringLock);
+    allocator.Free(r);
+} /* uringFinishRead */
+
+
+static void uringWorker(void *_u)
+{
+    Uring *u = (Uring *) _u;
+
+    while (1)
+    {
+        unsigned head = *u->cqhead;  /* only we change this. */
+        unsigned tail;
+        int quit;
+
+        if (syscall(__NR_io_uring_enter, u->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1)
+        {
+            if (errno != EINTR)
+                sched_yield();  /* shouldn't happen; don't spin too hard. */
+        } /* if */
+
+        /* the lock orders us after whoever submitted what we're reaping. */
+        pthread_mutex_lock(&uringLock);
+        tail = __atomic_load_n(u->cqtail, __ATOMIC_ACQUIRE);
+        pthread_mutex_unlock(&uringLock);
+
+        while (head != tail)
+        {
+            const struct io_uring_cqe *cqe = &u->cqes[head & u->cqmask];
+            UringRead *r = (UringRead *) (size_t) cqe->user_data;
+            const int res = cqe->res;
+            head++;
+            __atomic_store_n(u->cqhead, head, __ATOMIC_RELEASE);
+            if (r != NULL)  /* NULL is the wakeup to look at (stopping). */
+                uringFinishRead(u, r, res);
+        } /* while */
+
+        pthread_mutex_lock(&uringLock);
+        quit = ((u->stopping) && (u->inflight == 0));
+        pthread_mutex_unlock(&uringLock);
+        if (quit)
+            break;
+    } /* while */
+} /* uringWorker */
+
+
+static Uring *uringCreate(void)
+{
+    struct io_uring_params params;
+    Uring *u = (Uring *) allocator.Malloc(sizeof (Uring));
+    if (u == NULL)
+        return NULL;
+
+    memset(u, '\0', sizeof (*u));
+    memset(&params, '\0', sizeof (params));
+    u->fd = (int) syscall(__NR_io_uring_setup, PHYSFS_IO_URING_ENTRIES, &params);
+    if (u->fd < 0)
+    {
+        allocator.Free(u);
+        return NULL;
+    } /* if */
+
+    u->sqmaplen = params.sq_off.array + (params.sq_entries * sizeof (unsigned));
+    u->cqmaplen = params.cq_off.cqes + (params.cq_entries * sizeof (struct io_uring_cqe));
+    u->sqeslen = params.sq_entries * sizeof (struct io_uring_sqe);
+    u->sqmap = uringMap(u->fd, u->sqmaplen, IORING_OFF_SQ_RING);
+    u->cqmap = uringMap(u->fd, u->cqmaplen, IORING_OFF_CQ_RING);
+    u->sqes = (struct io_uring_sqe *) uringMap(u->fd, u->sqeslen, IORING_OFF_SQES);
+    if (!u->sqmap || !u->cqmap || !u->sqes)
+    {
+        uringDestroy(u);
+        return NULL;
+    } /* if */
+
+    u->sqhead = (unsigned *) (((char *) u->sqmap) + params.sq_off.head);
+    u->sqtail = (unsigned *) (((char *) u->sqmap) + params.sq_off.tail);
+    u->sqarray = (unsigned *) (((char *) u->sqmap) + params.sq_off.array);
+    u->sqmask = *((unsigned *) (((char *) u->sqmap) + params.sq_off.ring_mask));
+    u->cqhead = (unsigned *) (((char *) u->cqmap) + params.cq_off.head);
+    u->cqtail = (unsigned *) (((char *) u->cqmap) + params.cq_off.tail);
+    u->cqes = (struct io_uring_cqe *) (((char *) u->cqmap) + params.cq_off.cqes);
+    u->cqmask = *((unsigned *) (((char *) u->cqmap) + params.cq_off.ring_mask));
+    u->entries = params.sq_entries;
+
+    u->thread = __PHYSFS_platformCreateThread(uringWorker, u);
+    if (u->thread == NULL)
+    {
+        uringDestroy(u);
+        return NULL;
+    } /* if */
+
+    return u;
+} /* uringCreate */
+
+
+int __PHYSFS_platformReadAtAsync(void *opaque, void *buf, PHYSFS_uint64 len,
+                                 PHYSFS_uint64 offset,
+                                 __PHYSFS_AsyncReadDone done, void *data)
+{
+    UringRead *r;
+    int retval = 0;
+
+    if (!__PHYSFS_ui64FitsAddressSpace(len))
+        return 0;
+    else if (((PHYSFS_uint64) ((off_t) offset)) != offset)
+        return 0;  /* let __PHYSFS_platformReadAt() sort it out. */
+
+    r = (UringRead *) allocator.Malloc(sizeof (UringRead));
+    if (r == NULL)
+        return 0;
+
+    r->handle = opaque;
+    r->buf = (PHYSFS_uint8 *) buf;
+    r->len = len;
+    r->offset = offset;
+    r->total = 0;
+    r->done = done;
+    r->data = data;
+
+    pthread_mutex_lock(&uringLock);
+    if ((uring == NULL) && (!uringUnavailable))
+    {
+        const PHYSFS_ErrorCode prev = PHYSFS_getLastErrorCode();
+        uring = uringCreate();
+        uringUnavailable = (uring == NULL);
+        PHYSFS_setErrorCode(prev);  /* put back what getLastErrorCode took. */
+    } /* if */
+
+    if ( (uring != NULL) && (!uring->stopping) &&
+         (uring->inflight < (uring->entries - 1)) && (uringQueue(uring, r)) )
+    {
+        uring->inflight++;
+        retval = 1;
+    } /* if */
+    pthread_mutex_unlock(&uringLock);
+
+    if (!retval)
+        allocator.Free(r);
+
+    return retval;
+} /* __PHYSFS_platformReadAtAsync */
+
+
+/*
+ * The thread notices (stopping) after each batch of completions, so with
+ *  reads still in flight, their completions wake it. With none, it needs the
+ *  stop request to wake up; if the kernel keeps refusing that, we give up
+ *  after a while and leave the thread and ring behind, rather than hang.
+ */
+#ifndef PHYSFS_IO_URING_STOP_TRIES
+#define PHYSFS_IO_URING_STOP_TRIES 1000  /* a millisecond apart. */
+#endif
+
+void __PHYSFS_platformStopAsyncReads(void)
+{
+    Uring *u;
+    int tries = 0;
+    struct timespec ts;
+
+    ts.tv_sec = 0;
+    ts.tv_nsec = 1000000;
+
+    pthread_mutex_lock(&uringLock);
+    u = uring;
+    if (u != NULL)
+    {
+        u->stopping = 1;
+        /* there's always a slot for this, but the kernel might say no. */
+        while ((u->inflight == 0) && (!uringQueue(u, NULL)))
+        {
+            if (++tries >= PHYSFS_IO_URING_STOP_TRIES)
+            {
+                u = NULL;  /* abandon it; see above. */
+                break;
+            } /* if */
+            pthread_mutex_unlock(&uringLock);
+            nanosleep(&ts, NULL);
+            pthread_mutex_lock(&uringLock);
+        } /* while */
+    } /* if */
+    pthread_mutex_unlock(&uringLock);
+
+    if (u != NULL)
+    {
+        __PHYSFS_platformWaitThread(u->thread);  /* drains what's in flight. */
+        uringDestroy(u);
+    } /* if */
+
+    pthread_mutex_lock(&uringLock);
+    uring = NULL;
+    uringUnavailable = 0;  /* try again after the next init. */
+    pthread_mutex_unlock(&uringLock);
+} /* __PHYSFS_platformStopAsyncReads */
+
+#else
+
+int __PHYSFS_platformReadAtAsync(void *opaque, void *buf, PHYSFS_uint64 len,
+                                 PHYSFS_uint64 offset,
+                                 __PHYSFS_AsyncReadDone done, void *data)
+{
+    return 0;  /* no OS-level async reads here; the caller uses threads. */
+} /* __PHYSFS_platformReadAtAsync */
+
+
+void __PHYSFS_platformStopAsyncReads(void)
+{
+    /* nothing to do. */
+} /* __PHYSFS_platformStopAsyncReads */
+#endif
+
+
 PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
                                      PHYSFS_uint64 len)
 {
@@ -321,6 +885,103 @@ void __PHYSFS_platformClose(void *opaque)
 } /* __PHYSFS_platformClose */
 
 
+const void *__PHYSFS_platformMapFile(const char *filename, PHYSFS_uint64 *len)
+{
+    struct stat statbuf;
+    void *retval;
+    int fd;
+    int rc;
+
+    do {
+        fd = open(filename, O_RDONLY);
+    } while ((fd < 0) && (errno == EINTR));
+    BAIL_IF(fd < 0, errcodeFromErrno(), NULL);
+
+    if (fstat(fd, &statbuf) == -1)
+    {
+        const int err = errno;
+        close(fd);
+        BAIL(errcodeFromErrnoError(err), NULL);
+    } /* if */
+
+    /* can't map empty files, or files bigger than the address space. */
+    if ( (!S_ISREG(statbuf.st_mode)) || (statbuf.st_size <= 0) ||
+         (((PHYSFS_uint64) statbuf.st_size) != ((size_t) statbuf.st_size)) )
+    {
+        close(fd);
+        BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
+    } /* if */
+
+    retval = mmap(NULL, (size_t) statbuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    rc = errno;
+    close(fd);  /* the mapping keeps its own reference to the file. */
+    BAIL_IF(retval == MAP_FAILED, errcodeFromErrnoError(rc), NULL);
+
+    *len = (PHYSFS_uint64) statbuf.st_size;
+    return retval;
+} /* __PHYSFS_platformMapFile */
+
+
+void __PHYSFS_platformUnmapFile(const void *ptr, const PHYSFS_uint64 len)
+{
+    munmap((void *) ptr, (size_t) len);
+} /* __PHYSFS_platformUnmapFile */
+
+
+void __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 offset,
+                               PHYSFS_uint64 len)
+{
+    const int fd = *((int *) opaque);
+
+    if (((PHYSFS_uint64) ((off_t) offset)) != offset)
+        return;  /* can't be inside the file. */
+    else if (((PHYSFS_uint64) ((off_t) len)) != len)
+        len = 0;  /* "to the end of the file." */
+
+#if defined(POSIX_FADV_WILLNEED)
+    (void) posix_fadvise(fd, (off_t) offset, (off_t) len, POSIX_FADV_WILLNEED);
+#elif defined(F_RDADVISE)  /* Apple platforms. */
+    {
+        struct radvisory ra;
+        ra.ra_offset = (off_t) offset;
+        ra.ra_count = (len > 0x7FFFFFFF) ? 0x7FFFFFFF : (int) len;
+        (void) fcntl(fd, F_RDADVISE, &ra);
+    }
+#else
+    (void) fd;
+#endif
+} /* __PHYSFS_platformPrefetch */
+
+
+void __PHYSFS_platformPrefetchMapping(const void *ptr, PHYSFS_uint64 len)
+{
+#if defined(POSIX_MADV_WILLNEED) && defined(_SC_PAGESIZE)
+    /* the start has to be page-aligned. */
+    const size_t pagesize = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t end = ((size_t) ptr) + ((size_t) len);
+    const size_t start = ((size_t) ptr) & ~(pagesize - 1);
+    if ((pagesize > 0) && ((pagesize & (pagesize - 1)) == 0))
+        (void) posix_madvise((void *) start, end - start, POSIX_MADV_WILLNEED);
+#endif
+} /* __PHYSFS_platformPrefetchMapping */
+
+
+int __PHYSFS_platformLockMapping(const void *ptr, PHYSFS_uint64 len)
+{
+#if defined(_POSIX_MEMLOCK_RANGE) && (_POSIX_MEMLOCK_RANGE > 0) && defined(_SC_PAGESIZE)
+    /* the start has to be page-aligned here, too. munmap() unlocks it. */
+    const size_t pagesize = (size_t) sysconf(_SC_PAGESIZE);
+    const size_t end = ((size_t) ptr) + ((size_t) len);
+    const size_t start = ((size_t) ptr) & ~(pagesize - 1);
+    if ((pagesize == 0) || ((pagesize & (pagesize - 1)) != 0))
+        return 0;
+    return (mlock((const void *) start, end - start) == 0);
+#else
+    return 0;
+#endif
+} /* __PHYSFS_platformLockMapping */
+
+
 int __PHYSFS_platformDelete(const char *path)
 {
     BAIL_IF(remove(path) == -1, errcodeFromErrno(), 0);
@@ -328,43 +989,199 @@ int __PHYSFS_platformDelete(const char *path)
 } /* __PHYSFS_platformDelete */
 
 
+int __PHYSFS_platformRename(const char *src, const char *dst)
+{
+    BAIL_IF(rename(src, dst) == -1, errcodeFromErrno(), 0);
+    return 1;
+} /* __PHYSFS_platformRename */
+
+
 int __PHYSFS_platformStat(const char *fname, PHYSFS_Stat *st, const int follow)
 {
     struct stat statbuf;
     const int rc = follow ? stat(fname, &statbuf) : lstat(fname, &statbuf);
     BAIL_IF(rc == -1, errcodeFromErrno(), 0);
+    statFromStatBuf(&statbuf, st);
+    st->readonly = (access(fname, W_OK) == -1);
+    return 1;
+} /* __PHYSFS_platformStat */
+
+
+#ifdef PHYSFS_HAVE_OPENAT
+
+#ifdef O_CLOEXEC
+#define DIRFD_OPEN_FLAGS (O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+#else
+#define DIRFD_OPEN_FLAGS (O_RDONLY | O_DIRECTORY)
+#endif
+
+/* "" means the directory itself, which the *at() calls spell ".". */
+#define DIRFD_PATH(path) ((*(path) == '\0') ? "." : (path))
+
+static int openDirFdAt(const int dirfd, const char *path)
+{
+    int fd;
+
+    do {
+        fd = openat(dirfd, DIRFD_PATH(path), DIRFD_OPEN_FLAGS);
+    } while ((fd < 0) && (errno == EINTR));
+
+#if !defined(O_CLOEXEC) && defined(FD_CLOEXEC)
+    if (fd >= 0)
+        set_CLOEXEC(fd);
+#endif
+
+    return fd;
+} /* openDirFdAt */
+
+
+int __PHYSFS_platformOpenDirFd(const char *dirname)
+{
+    return openDirFdAt(AT_FDCWD, dirname);
+} /* __PHYSFS_platformOpenDirFd */
+
+
+void __PHYSFS_platformCloseDirFd(const int dirfd)
+{
+    close(dirfd);
+} /* __PHYSFS_platformCloseDirFd */
+
+
+void *__PHYSFS_platformOpenAt(const int dirfd, const char *path, const int mode)
+{
+    if (mode == 'r')
+        return doOpen(dirfd, path, O_RDONLY);
+    else if (mode == 'w')
+        return doOpen(dirfd, path, O_WRONLY | O_CREAT | O_TRUNC);
+    return doOpen(dirfd, path, O_WRONLY | O_CREAT | O_APPEND);
+} /* __PHYSFS_platformOpenAt */
+
+
+int __PHYSFS_platformStatAt(const int dirfd, const char *path,
+                            PHYSFS_Stat *st, const int follow)
+{
+    const char *fname = DIRFD_PATH(path);
+    struct stat statbuf;
+    const int rc = fstatat(dirfd, fname, &statbuf, follow ? 0 : AT_SYMLINK_NOFOLLOW);
+    BAIL_IF(rc == -1, errcodeFromErrno(), 0);
+    statFromStatBuf(&statbuf, st);
+    st->readonly = (faccessat(dirfd, fname, W_OK, 0) == -1);
+    return 1;
+} /* __PHYSFS_platformStatAt */
+
+
+/* like opendir(), but relative to (dirfd). */
+static DIR *openDirAt(const int dirfd, const char *path)
+{
+    const int fd = openDirFdAt(dirfd, path);
+    DIR *dir;
 
-    if (S_ISREG(statbuf.st_mode))
+    BAIL_IF(fd < 0, errcodeFromErrno(), NULL);
+    dir = fdopendir(fd);
+    if (dir == NULL)
     {
-        st->filetype = PHYSFS_FILETYPE_REGULAR;
-        st->filesize = statbuf.st_size;
+        const int err = errno;
+        close(fd);
+        BAIL(errcodeFromErrnoError(err), NULL);
     } /* if */
 
-    else if(S_ISDIR(statbuf.st_mode))
-    {
-        st->filetype = PHYSFS_FILETYPE_DIRECTORY;
-        st->filesize = 0;
-    } /* else if */
+    return dir;
+} /* openDirAt */
 
-    else if(S_ISLNK(statbuf.st_mode))
-    {
-        st->filetype = PHYSFS_FILETYPE_SYMLINK;
-        st->filesize = 0;
-    } /* else if */
 
-    else
-    {
-        st->filetype = PHYSFS_FILETYPE_OTHER;
-        st->filesize = statbuf.st_size;
-    } /* else */
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateAt(const int dirfd,
+                               const char *path,
+                               PHYSFS_EnumerateCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    DIR *dir = openDirAt(dirfd, path);
+    BAIL_IF_ERRPASS(dir == NULL, PHYSFS_ENUM_ERROR);
+    return enumerateDir(dir, callback, origdir, callbackdata);
+} /* __PHYSFS_platformEnumerateAt */
 
-    st->modtime = statbuf.st_mtime;
-    st->createtime = statbuf.st_ctime;
-    st->accesstime = statbuf.st_atime;
 
-    st->readonly = (access(fname, W_OK) == -1);
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStatAt(
+                               const int dirfd, const char *path,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    /* lstatDirEntry() works from the DIR's own fd, not its name. */
+    DIR *dir = openDirAt(dirfd, path);
+    BAIL_IF_ERRPASS(dir == NULL, PHYSFS_ENUM_ERROR);
+    return enumerateDirStat(dir, NULL, callback, origdir, callbackdata);
+} /* __PHYSFS_platformEnumerateStatAt */
+
+
+int __PHYSFS_platformMkDirAt(const int dirfd, const char *path)
+{
+    const int rc = mkdirat(dirfd, path, S_IRWXU);
+    BAIL_IF(rc == -1, errcodeFromErrno(), 0);
     return 1;
-} /* __PHYSFS_platformStat */
+} /* __PHYSFS_platformMkDirAt */
+
+
+int __PHYSFS_platformDeleteAt(const int dirfd, const char *path)
+{
+    /* remove() tries unlink(), then rmdir() if it was a directory. */
+    int rc = unlinkat(dirfd, path, 0);
+    if ((rc == -1) && ((errno == EISDIR) || (errno == EPERM)))
+    {
+        const int err = errno;
+        rc = unlinkat(dirfd, path, AT_REMOVEDIR);
+        if ((rc == -1) && (errno == ENOTDIR))
+            errno = err;  /* it wasn't a directory after all. */
+    } /* if */
+    BAIL_IF(rc == -1, errcodeFromErrno(), 0);
+    return 1;
+} /* __PHYSFS_platformDeleteAt */
+
+#else
+
+int __PHYSFS_platformOpenDirFd(const char *dirname)
+{
+    return -1;  /* caller uses full paths instead. */
+} /* __PHYSFS_platformOpenDirFd */
+
+void __PHYSFS_platformCloseDirFd(const int dirfd) {}
+
+void *__PHYSFS_platformOpenAt(const int dirfd, const char *path, const int mode)
+{
+    BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
+} /* __PHYSFS_platformOpenAt */
+
+int __PHYSFS_platformStatAt(const int dirfd, const char *path,
+                            PHYSFS_Stat *st, const int follow)
+{
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);
+} /* __PHYSFS_platformStatAt */
+
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateAt(const int dirfd,
+                               const char *path,
+                               PHYSFS_EnumerateCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    BAIL(PHYSFS_ERR_UNSUPPORTED, PHYSFS_ENUM_ERROR);
+} /* __PHYSFS_platformEnumerateAt */
+
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStatAt(
+                               const int dirfd, const char *path,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    BAIL(PHYSFS_ERR_UNSUPPORTED, PHYSFS_ENUM_ERROR);
+} /* __PHYSFS_platformEnumerateStatAt */
+
+int __PHYSFS_platformMkDirAt(const int dirfd, const char *path)
+{
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);
+} /* __PHYSFS_platformMkDirAt */
+
+int __PHYSFS_platformDeleteAt(const int dirfd, const char *path)
+{
+    BAIL(PHYSFS_ERR_UNSUPPORTED, 0);
+} /* __PHYSFS_platformDeleteAt */
+
+#endif  /* PHYSFS_HAVE_OPENAT */
 
 
 typedef struct
@@ -381,6 +1198,26 @@ void *__PHYSFS_platformGetThreadID(void)
 } /* __PHYSFS_platformGetThreadID */
 
 
+PHYSFS_uint64 __PHYSFS_platformNanoseconds(void)
+{
+#if defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    {
+        return (((PHYSFS_uint64) ts.tv_sec) * __PHYSFS_UI64(1000000000)) +
+               ((PHYSFS_uint64) ts.tv_nsec);
+    } /* if */
+#endif
+
+    {
+        struct timeval tv;
+        gettimeofday(&tv, NULL);
+        return (((PHYSFS_uint64) tv.tv_sec) * __PHYSFS_UI64(1000000000)) +
+               (((PHYSFS_uint64) tv.tv_usec) * 1000);
+    }
+} /* __PHYSFS_platformNanoseconds */
+
+
 void *__PHYSFS_platformCreateMutex(void)
 {
     int rc;
@@ -443,6 +1280,116 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
     } /* if */
 } /* __PHYSFS_platformReleaseMutex */
 
+
+typedef struct
+{
+    pthread_t thread;
+    void (*fn)(void *);
+    void *data;
+} PthreadThread;
+
+static void *pthreadEntry(void *_t)
+{
+    PthreadThread *t = (PthreadThread *) _t;
+    t->fn(t->data);
+    return NULL;
+} /* pthreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data)
+{
+    PthreadThread *t = (PthreadThread *) allocator.Malloc(sizeof (PthreadThread));
+    BAIL_IF(!t, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    t->fn = fn;
+    t->data = data;
+    if (pthread_create(&t->thread, NULL, pthreadEntry, t) != 0)
+    {
+        allocator.Free(t);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+    return t;
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformWaitThread(void *thread)
+{
+    PthreadThread *t = (PthreadThread *) thread;
+    pthread_join(t->thread, NULL);
+    allocator.Free(t);
+} /* __PHYSFS_platformWaitThread */
+
+
+int __PHYSFS_platformCPUCount(void)
+{
+#ifdef _SC_NPROCESSORS_ONLN
+    const long rc = sysconf(_SC_NPROCESSORS_ONLN);
+    if (rc > 0)
+        return (rc > 1024) ? 1024 : (int) rc;
+#endif
+    return 1;
+} /* __PHYSFS_platformCPUCount */
+
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    PHYSFS_uint32 count;
+} PthreadSemaphore;
+
+/* not sem_init(): some platforms (hi, macOS) don't do unnamed semaphores. */
+void *__PHYSFS_platformCreateSemaphore(void)
+{
+    PthreadSemaphore *s;
+    s = (PthreadSemaphore *) allocator.Malloc(sizeof (PthreadSemaphore));
+    BAIL_IF(!s, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    if (pthread_mutex_init(&s->mutex, NULL) != 0)
+    {
+        allocator.Free(s);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    if (pthread_cond_init(&s->cond, NULL) != 0)
+    {
+        pthread_mutex_destroy(&s->mutex);
+        allocator.Free(s);
+        BAIL(PHYSFS_ERR_OS_ERROR, NULL);
+    } /* if */
+
+    s->count = 0;
+    return s;
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+    PthreadSemaphore *s = (PthreadSemaphore *) sem;
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->mutex);
+    allocator.Free(s);
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+    PthreadSemaphore *s = (PthreadSemaphore *) sem;
+    pthread_mutex_lock(&s->mutex);
+    s->count++;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+} /* __PHYSFS_platformPostSemaphore */
+
+
+void __PHYSFS_platformWaitSemaphore(void *sem)
+{
+    PthreadSemaphore *s = (PthreadSemaphore *) sem;
+    pthread_mutex_lock(&s->mutex);
+    while (s->count == 0)
+        pthread_cond_wait(&s->cond, &s->mutex);
+    s->count--;
+    pthread_mutex_unlock(&s->mutex);
+} /* __PHYSFS_platformWaitSemaphore */
+
 #endif  /* PHYSFS_PLATFORM_POSIX */
 
 /* end of physfs_platform_posix.c ... */
@@ -119,6 +119,15 @@ static inline BOOL winInitializeCriticalSection(LPCRITICAL_SECTION lpcs)
     #endif
 } /* winInitializeCriticalSection */
 
+static inline HANDLE winCreateSemaphore(void)
+{
+    #if defined(PHYSFS_PLATFORM_WINRT) || (_WIN32_WINNT >= 0x0600) // Windows Vista+
+    return CreateSemaphoreExW(NULL, 0, 0x7FFFFFFF, NULL, 0, SEMAPHORE_ALL_ACCESS);
+    #else
+    return CreateSemaphoreW(NULL, 0, 0x7FFFFFFF, NULL);
+    #endif
+} /* winCreateSemaphore */
+
 static inline HANDLE winCreateFileW(const WCHAR *wfname, const DWORD mode,
                                     const DWORD creation)
 {
@@ -172,6 +181,24 @@ static PHYSFS_sint64 winGetFileSize(HANDLE h)
     #endif
 } /* winGetFileSize */
 
+static inline HANDLE winCreateFileMappingW(HANDLE h)
+{
+    #if defined(PHYSFS_PLATFORM_WINRT)
+    return CreateFileMappingFromApp(h, NULL, PAGE_READONLY, 0, NULL);
+    #else
+    return CreateFileMappingW(h, NULL, PAGE_READONLY, 0, 0, NULL);
+    #endif
+} /* winCreateFileMappingW */
+
+static inline void *winMapViewOfFile(HANDLE maph)
+{
+    #if defined(PHYSFS_PLATFORM_WINRT)
+    return MapViewOfFileFromApp(maph, FILE_MAP_READ, 0, 0);
+    #else
+    return MapViewOfFile(maph, FILE_MAP_READ, 0, 0, 0);
+    #endif
+} /* winMapViewOfFile */
+
 
 static PHYSFS_ErrorCode errcodeFromWinApiError(const DWORD err)
 {
@@ -631,6 +658,25 @@ void *__PHYSFS_platformGetThreadID(void)
 } /* __PHYSFS_platformGetThreadID */
 
 
+PHYSFS_uint64 __PHYSFS_platformNanoseconds(void)
+{
+    static LARGE_INTEGER freq;  /* fixed at boot, so races are harmless. */
+    LARGE_INTEGER now;
+
+    if (freq.QuadPart == 0)
+    {
+        if (!QueryPerformanceFrequency(&freq))
+            return ((PHYSFS_uint64) GetTickCount()) * 1000000;
+    } /* if */
+
+    QueryPerformanceCounter(&now);
+
+    /* split it up so we don't overflow the multiply on long uptimes. */
+    return ((((PHYSFS_uint64) now.QuadPart) / freq.QuadPart) * __PHYSFS_UI64(1000000000)) +
+           (((((PHYSFS_uint64) now.QuadPart) % freq.QuadPart) * __PHYSFS_UI64(1000000000)) / freq.QuadPart);
+} /* __PHYSFS_platformNanoseconds */
+
+
 PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerate(const char *dirname,
                                PHYSFS_EnumerateCallback callback,
                                const char *origdir, void *callbackdata)
@@ -756,6 +802,13 @@ void *__PHYSFS_platformOpenAppend(const char *filename)
 } /* __PHYSFS_platformOpenAppend */
 
 
+void *__PHYSFS_platformOpenNew(const char *filename)
+{
+    HANDLE h = doOpen(filename, GENERIC_WRITE, CREATE_NEW);
+    return (h == INVALID_HANDLE_VALUE) ? NULL : (void *) h;
+} /* __PHYSFS_platformOpenNew */
+
+
 PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buf, PHYSFS_uint64 len)
 {
     HANDLE h = (HANDLE) opaque;
@@ -780,6 +833,254 @@ PHYSFS_sint64 __PHYSFS_platformRead(void *opaque, void *buf, PHYSFS_uint64 len)
 } /* __PHYSFS_platformRead */
 
 
+PHYSFS_sint64 __PHYSFS_platformGetOsHandle(void *opaque)
+{
+    return (PHYSFS_sint64) (size_t) (HANDLE) opaque;
+} /* __PHYSFS_platformGetOsHandle */
+
+
+PHYSFS_sint64 __PHYSFS_platformReadAt(void *opaque, void *buf,
+                                      PHYSFS_uint64 len, PHYSFS_uint64 offset)
+{
+    HANDLE h = (HANDLE) opaque;
+    PHYSFS_uint8 *ptr = (PHYSFS_uint8 *) buf;
+    PHYSFS_sint64 totalRead = 0;
+
+    if (!__PHYSFS_ui64FitsAddressSpace(len))
+        BAIL(PHYSFS_ERR_INVALID_ARGUMENT, -1);
+
+    while (len > 0)
+    {
+        const DWORD thislen = (len > 0xFFFFFFFF) ? 0xFFFFFFFF : (DWORD) len;
+        DWORD numRead = 0;
+        OVERLAPPED ov;
+
+        /* on a synchronous handle this reads at (offset) and doesn't
+           return until it's done; the file pointer is ignored. */
+        memset(&ov, '\0', sizeof (ov));
+        ov.Offset = (DWORD) (offset & 0xFFFFFFFF);
+        ov.OffsetHigh = (DWORD) (offset >> 32);
+        if (!ReadFile(h, ptr, thislen, &numRead, &ov))
+        {
+            if (GetLastError() == ERROR_HANDLE_EOF)
+                break;
+            BAIL(errcodeFromWinApi(), -1);
+        } /* if */
+        len -= (PHYSFS_uint64) numRead;
+        offset += (PHYSFS_uint64) numRead;
+        ptr += numRead;
+        totalRead += (PHYSFS_sint64) numRead;
+        if (numRead != thislen)
+            break;
+    } /* while */
+
+    return totalRead;
+} /* __PHYSFS_platformReadAt */
+
+
+#if defined(PHYSFS_PLATFORM_WINRT) || (_WIN32_WINNT < 0x0600)
+int __PHYSFS_platformReadAtAsync(void *opaque, void *buf, PHYSFS_uint64 len,
+                                 PHYSFS_uint64 offset,
+                                 __PHYSFS_AsyncReadDone done, void *data)
+{
+    return 0;  /* no ReOpenFile(); the caller uses threads. */
+} /* __PHYSFS_platformReadAtAsync */
+
+
+void __PHYSFS_platformStopAsyncReads(void)
+{
+    /* nothing to do. */
+} /* __PHYSFS_platformStopAsyncReads */
+
+#else
+/*
+ * Async reads use overlapped i/o on a completion port, serviced by one
+ *  thread that calls back when each read is done. The handles we hand out
+ *  elsewhere are synchronous, so each read reopens its file for overlapped
+ *  i/o (which is cheap: ReOpenFile() doesn't look up the path again) and
+ *  marks it for sequential access, since that's how it'll be read. A
+ *  read too big for one ReadFile() is resubmitted from the thread.
+ *
+ * FILE_FLAG_NO_BUFFERING isn't used: it needs sector-aligned offsets,
+ *  lengths and buffers, and we read arbitrary spans into the app's memory.
+ */
+typedef struct
+{
+    OVERLAPPED ov;  /* must be first; completions give us this pointer. */
+    HANDLE handle;  /* our overlapped reopen of the file. */
+    PHYSFS_uint8 *buf;  /* where the next piece goes. */
+    PHYSFS_uint64 len;  /* bytes still to read. */
+    PHYSFS_uint64 offset;  /* where the next piece comes from. */
+    PHYSFS_sint64 total;  /* bytes read so far. */
+    __PHYSFS_AsyncReadDone done;
+    void *data;
+} WinAsyncRead;
+
+static HANDLE asyncReadPort = NULL;
+static void *asyncReadThread = NULL;
+static volatile LONG asyncReadsInFlight = 0;
+static int asyncReadPortUnavailable = 0;
+
+/* start (r)'s next piece. The completion comes to asyncReadPort either way. */
+static int winQueueRead(WinAsyncRead *r)
+{
+    const DWORD thislen = (r->len > 0x7FFFFFFF) ? 0x7FFFFFFF : (DWORD) r->len;
+    memset(&r->ov, '\0', sizeof (r->ov));
+    r->ov.Offset = (DWORD) (r->offset & 0xFFFFFFFF);
+    r->ov.OffsetHigh = (DWORD) (r->offset >> 32);
+    return (ReadFile(r->handle, r->buf, thislen, NULL, &r->ov) ||
+            (GetLastError() == ERROR_IO_PENDING));
+} /* winQueueRead */
+
+
+static void winFinishRead(WinAsyncRead *r, const DWORD err)
+{
+    CloseHandle(r->handle);
+
+    if ((err != 0) && (err != ERROR_HANDLE_EOF) && (r->total == 0))
+        r->done(r->data, -1, errcodeFromWinApiError(err));
+    else
+        r->done(r->data, r->total, PHYSFS_ERR_OK);
+
+    allocator.Free(r);
+    InterlockedDecrement(&asyncReadsInFlight);
+} /* winFinishRead */
+
+
+static void winAsyncReadWorker(void *port)
+{
+    int stopping = 0;
+
+    while ((!stopping) || (asyncReadsInFlight > 0))
+    {
+        DWORD numRead = 0;
+        ULONG_PTR key = 0;
+        OVERLAPPED *ov = NULL;
+        WinAsyncRead *r;
+        DWORD err = 0;
+
+        if (!GetQueuedCompletionStatus((HANDLE) port, &numRead, &key, &ov, INFINITE))
+        {
+            if (ov == NULL)
+                continue;  /* nothing dequeued; shouldn't happen with INFINITE. */
+            err = GetLastError();  /* the read failed (or hit EOF). */
+        } /* if */
+
+        if (ov == NULL)
+        {
+            stopping = 1;  /* posted by __PHYSFS_platformStopAsyncReads(). */
+            continue;
+        } /* if */
+
+        r = (WinAsyncRead *) ov;
+        if ((err == 0) && (numRead > 0))
+        {
+            r->total += (PHYSFS_sint64) numRead;
+            r->buf += numRead;
+            r->len -= (PHYSFS_uint64) numRead;
+            r->offset += (PHYSFS_uint64) numRead;
+            if ((r->len > 0) && (winQueueRead(r)))
+                continue;  /* more to go; it'll come back through the port. */
+            else if (r->len > 0)
+                err = GetLastError();
+        } /* if */
+
+        winFinishRead(r, err);
+    } /* while */
+} /* winAsyncReadWorker */
+
+
+int __PHYSFS_platformReadAtAsync(void *opaque, void *buf, PHYSFS_uint64 len,
+                                 PHYSFS_uint64 offset,
+                                 __PHYSFS_AsyncReadDone done, void *data)
+{
+    WinAsyncRead *r;
+
+    if (!__PHYSFS_ui64FitsAddressSpace(len))
+        return 0;
+    else if (asyncReadPortUnavailable)
+        return 0;
+    else if (asyncReadPort == NULL)
+    {
+        const PHYSFS_ErrorCode prev = PHYSFS_getLastErrorCode();
+        asyncReadPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+        if (asyncReadPort != NULL)
+        {
+            asyncReadThread = __PHYSFS_platformCreateThread(winAsyncReadWorker,
+                                                            asyncReadPort);
+            if (asyncReadThread == NULL)
+            {
+                CloseHandle(asyncReadPort);
+                asyncReadPort = NULL;
+            } /* if */
+        } /* if */
+
+        PHYSFS_setErrorCode(prev);  /* put back what getLastErrorCode took. */
+        if (asyncReadPort == NULL)
+        {
+            asyncReadPortUnavailable = 1;
+            return 0;
+        } /* if */
+    } /* else if */
+
+    r = (WinAsyncRead *) allocator.Malloc(sizeof (WinAsyncRead));
+    if (r == NULL)
+        return 0;
+
+    r->handle = ReOpenFile((HANDLE) opaque, GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN);
+    if (r->handle == INVALID_HANDLE_VALUE)
+    {
+        allocator.Free(r);
+        return 0;
+    } /* if */
+
+    if (CreateIoCompletionPort(r->handle, asyncReadPort, 0, 0) == NULL)
+    {
+        CloseHandle(r->handle);
+        allocator.Free(r);
+        return 0;
+    } /* if */
+
+    r->buf = (PHYSFS_uint8 *) buf;
+    r->len = len;
+    r->offset = offset;
+    r->total = 0;
+    r->done = done;
+    r->data = data;
+
+    InterlockedIncrement(&asyncReadsInFlight);
+    if (!winQueueRead(r))  /* failed without queueing a completion. */
+    {
+        InterlockedDecrement(&asyncReadsInFlight);
+        CloseHandle(r->handle);
+        allocator.Free(r);
+        return 0;  /* let the caller hit (and report) it the slow way. */
+    } /* if */
+
+    return 1;
+} /* __PHYSFS_platformReadAtAsync */
+
+
+void __PHYSFS_platformStopAsyncReads(void)
+{
+    if (asyncReadPort != NULL)
+    {
+        /* the thread drains what's in flight before it returns. */
+        PostQueuedCompletionStatus(asyncReadPort, 0, 0, NULL);
+        __PHYSFS_platformWaitThread(asyncReadThread);
+        CloseHandle(asyncReadPort);
+    } /* if */
+
+    asyncReadPort = NULL;
+    asyncReadThread = NULL;
+    asyncReadsInFlight = 0;
+    asyncReadPortUnavailable = 0;  /* try again after the next init. */
+} /* __PHYSFS_platformStopAsyncReads */
+#endif
+
+
 PHYSFS_sint64 __PHYSFS_platformWrite(void *opaque, const void *buffer,
                                      PHYSFS_uint64 len)
 {
@@ -847,6 +1148,89 @@ void __PHYSFS_platformClose(void *opaque)
 } /* __PHYSFS_platformClose */
 
 
+const void *__PHYSFS_platformMapFile(const char *filename, PHYSFS_uint64 *len)
+{
+    HANDLE h = (HANDLE) __PHYSFS_platformOpenRead(filename);
+    HANDLE maph = NULL;
+    PHYSFS_sint64 filelen;
+    void *retval = NULL;
+
+    BAIL_IF_ERRPASS(!h, NULL);
+
+    filelen = winGetFileSize(h);
+    if (filelen < 0)
+    {
+        const PHYSFS_ErrorCode err = errcodeFromWinApi();
+        CloseHandle(h);
+        BAIL(err, NULL);
+    } /* if */
+
+    /* can't map empty files, or files bigger than the address space. */
+    if ((filelen == 0) || (((PHYSFS_uint64) filelen) != ((SIZE_T) filelen)))
+    {
+        CloseHandle(h);
+        BAIL(PHYSFS_ERR_UNSUPPORTED, NULL);
+    } /* if */
+
+    maph = winCreateFileMappingW(h);
+    if (maph != NULL)
+        retval = winMapViewOfFile(maph);
+
+    if (retval == NULL)
+    {
+        const PHYSFS_ErrorCode err = errcodeFromWinApi();
+        if (maph != NULL)
+            CloseHandle(maph);
+        CloseHandle(h);
+        BAIL(err, NULL);
+    } /* if */
+
+    /* the view keeps the mapping and file alive until it is unmapped. */
+    CloseHandle(maph);
+    CloseHandle(h);
+
+    *len = (PHYSFS_uint64) filelen;
+    return retval;
+} /* __PHYSFS_platformMapFile */
+
+
+void __PHYSFS_platformUnmapFile(const void *ptr, const PHYSFS_uint64 len)
+{
+    (void) UnmapViewOfFile(ptr);
+} /* __PHYSFS_platformUnmapFile */
+
+
+void __PHYSFS_platformPrefetch(void *opaque, PHYSFS_uint64 offset,
+                               PHYSFS_uint64 len)
+{
+    /* Win32 has no readahead hint for a file handle. Archives are usually
+       mapped, though, and __PHYSFS_platformPrefetchMapping() does work. */
+} /* __PHYSFS_platformPrefetch */
+
+
+void __PHYSFS_platformPrefetchMapping(const void *ptr, PHYSFS_uint64 len)
+{
+    #if defined(PHYSFS_PLATFORM_WINRT) || (_WIN32_WINNT >= 0x0602) // Windows 8+
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = (PVOID) ptr;
+    range.NumberOfBytes = (SIZE_T) len;
+    (void) PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+    #endif
+} /* __PHYSFS_platformPrefetchMapping */
+
+
+int __PHYSFS_platformLockMapping(const void *ptr, PHYSFS_uint64 len)
+{
+    /* usually fails past the (small) minimum working set; that's okay.
+       UnmapViewOfFile() unlocks it. */
+    #ifdef PHYSFS_PLATFORM_WINRT
+    return 0;
+    #else
+    return (VirtualLock((LPVOID) ptr, (SIZE_T) len) != 0);
+    #endif
+} /* __PHYSFS_platformLockMapping */
+
+
 static int doPlatformDelete(LPWSTR wpath)
 {
     WIN32_FILE_ATTRIBUTE_DATA info;
@@ -874,6 +1258,29 @@ int __PHYSFS_platformDelete(const char *path)
 } /* __PHYSFS_platformDelete */
 
 
+int __PHYSFS_platformRename(const char *src, const char *dst)
+{
+    LPWSTR wsrc = NULL;
+    LPWSTR wdst = NULL;
+    BOOL rc;
+
+    UTF8_TO_UNICODE_STACK(wsrc, src);
+    BAIL_IF(!wsrc, PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    UTF8_TO_UNICODE_STACK(wdst, dst);
+    if (!wdst)
+    {
+        __PHYSFS_smallFree(wsrc);
+        BAIL(PHYSFS_ERR_OUT_OF_MEMORY, 0);
+    } /* if */
+
+    rc = MoveFileExW(wsrc, wdst, MOVEFILE_REPLACE_EXISTING);
+    __PHYSFS_smallFree(wdst);
+    __PHYSFS_smallFree(wsrc);
+    BAIL_IF(!rc, errcodeFromWinApi(), 0);
+    return 1;
+} /* __PHYSFS_platformRename */
+
+
 void *__PHYSFS_platformCreateMutex(void)
 {
     LPCRITICAL_SECTION lpcs;
@@ -910,6 +1317,80 @@ void __PHYSFS_platformReleaseMutex(void *mutex)
 } /* __PHYSFS_platformReleaseMutex */
 
 
+typedef struct
+{
+    HANDLE handle;
+    void (*fn)(void *);
+    void *data;
+} WinThread;
+
+static DWORD WINAPI winThreadEntry(LPVOID _t)
+{
+    WinThread *t = (WinThread *) _t;
+    t->fn(t->data);
+    return 0;
+} /* winThreadEntry */
+
+
+void *__PHYSFS_platformCreateThread(void (*fn)(void *), void *data)
+{
+    WinThread *t = (WinThread *) allocator.Malloc(sizeof (WinThread));
+    BAIL_IF(!t, PHYSFS_ERR_OUT_OF_MEMORY, NULL);
+    t->fn = fn;
+    t->data = data;
+    t->handle = CreateThread(NULL, 0, winThreadEntry, t, 0, NULL);
+    if (t->handle == NULL)
+    {
+        allocator.Free(t);
+        BAIL(errcodeFromWinApi(), NULL);
+    } /* if */
+    return t;
+} /* __PHYSFS_platformCreateThread */
+
+
+void __PHYSFS_platformWaitThread(void *thread)
+{
+    WinThread *t = (WinThread *) thread;
+    WaitForSingleObjectEx(t->handle, INFINITE, FALSE);
+    CloseHandle(t->handle);
+    allocator.Free(t);
+} /* __PHYSFS_platformWaitThread */
+
+
+int __PHYSFS_platformCPUCount(void)
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (info.dwNumberOfProcessors > 0) ? (int) info.dwNumberOfProcessors : 1;
+} /* __PHYSFS_platformCPUCount */
+
+
+void *__PHYSFS_platformCreateSemaphore(void)
+{
+    const HANDLE h = winCreateSemaphore();
+    BAIL_IF(h == NULL, errcodeFromWinApi(), NULL);
+    return (void *) h;
+} /* __PHYSFS_platformCreateSemaphore */
+
+
+void __PHYSFS_platformDestroySemaphore(void *sem)
+{
+    CloseHandle((HANDLE) sem);
+} /* __PHYSFS_platformDestroySemaphore */
+
+
+void __PHYSFS_platformPostSemaphore(void *sem)
+{
+    ReleaseSemaphore((HANDLE) sem, 1, NULL);
+} /* __PHYSFS_platformPostSemaphore */
+
+
+void __PHYSFS_platformWaitSemaphore(void *sem)
+{
+    WaitForSingleObjectEx((HANDLE) sem, INFINITE, FALSE);
+} /* __PHYSFS_platformWaitSemaphore */
+
+
 static PHYSFS_sint64 FileTimeToPhysfsTime(const FILETIME *ft)
 {
     SYSTEMTIME st_utc;
@@ -968,6 +1449,43 @@ static int isSymlink(const WCHAR *wpath, const DWORD attr)
 } /* isSymlink */
 
 
+static void statFromWinAttrs(PHYSFS_Stat *st, const DWORD attr,
+                             const DWORD sizehigh, const DWORD sizelow,
+                             const FILETIME *ctime, const FILETIME *atime,
+                             const FILETIME *mtime, const int issymlink)
+{
+    st->modtime = FileTimeToPhysfsTime(mtime);
+    st->accesstime = FileTimeToPhysfsTime(atime);
+    st->createtime = FileTimeToPhysfsTime(ctime);
+
+    if (issymlink)
+    {
+        st->filetype = PHYSFS_FILETYPE_SYMLINK;
+        st->filesize = 0;
+    } /* if */
+
+    else if (attr & FILE_ATTRIBUTE_DIRECTORY)
+    {
+        st->filetype = PHYSFS_FILETYPE_DIRECTORY;
+        st->filesize = 0;
+    } /* else if */
+
+    else if (attr & (FILE_ATTRIBUTE_OFFLINE | FILE_ATTRIBUTE_DEVICE))
+    {
+        st->filetype = PHYSFS_FILETYPE_OTHER;
+        st->filesize = (((PHYSFS_uint64) sizehigh) << 32) | sizelow;
+    } /* else if */
+
+    else
+    {
+        st->filetype = PHYSFS_FILETYPE_REGULAR;
+        st->filesize = (((PHYSFS_uint64) sizehigh) << 32) | sizelow;
+    } /* else */
+
+    st->readonly = ((attr & FILE_ATTRIBUTE_READONLY) != 0);
+} /* statFromWinAttrs */
+
+
 int __PHYSFS_platformStat(const char *filename, PHYSFS_Stat *st, const int follow)
 {
     WIN32_FILE_ATTRIBUTE_DATA winstat;
@@ -988,38 +1506,83 @@ int __PHYSFS_platformStat(const char *filename, PHYSFS_Stat *st, const int follo
     __PHYSFS_smallFree(wstr);
     BAIL_IF(!rc, errcodeFromWinApiError(err), 0);
 
-    st->modtime = FileTimeToPhysfsTime(&winstat.ftLastWriteTime);
-    st->accesstime = FileTimeToPhysfsTime(&winstat.ftLastAccessTime);
-    st->createtime = FileTimeToPhysfsTime(&winstat.ftCreationTime);
+    statFromWinAttrs(st, winstat.dwFileAttributes,
+                     winstat.nFileSizeHigh, winstat.nFileSizeLow,
+                     &winstat.ftCreationTime, &winstat.ftLastAccessTime,
+                     &winstat.ftLastWriteTime, issymlink);
+    return 1;
+} /* __PHYSFS_platformStat */
 
-    if (issymlink)
+
+PHYSFS_EnumerateCallbackResult __PHYSFS_platformEnumerateStat(
+                               const char *dirname,
+                               PHYSFS_EnumerateStatCallback callback,
+                               const char *origdir, void *callbackdata)
+{
+    PHYSFS_EnumerateCallbackResult retval = PHYSFS_ENUM_OK;
+    HANDLE dir = INVALID_HANDLE_VALUE;
+    WIN32_FIND_DATAW entw;
+    size_t len = strlen(dirname);
+    char *searchPath = NULL;
+    WCHAR *wSearchPath = NULL;
+
+    /* Allocate a new string for path, maybe '\\', "*", and NULL terminator */
+    searchPath = (char *) __PHYSFS_smallAlloc(len + 3);
+    BAIL_IF(!searchPath, PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ENUM_ERROR);
+
+    strcpy(searchPath, dirname);
+    if (searchPath[len - 1] != '\\')
     {
-        st->filetype = PHYSFS_FILETYPE_SYMLINK;
-        st->filesize = 0;
+        searchPath[len++] = '\\';
+        searchPath[len] = '\0';
     } /* if */
+    strcat(searchPath, "*");
 
-    else if (winstat.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
-    {
-        st->filetype = PHYSFS_FILETYPE_DIRECTORY;
-        st->filesize = 0;
-    } /* else if */
+    UTF8_TO_UNICODE_STACK(wSearchPath, searchPath);
+    __PHYSFS_smallFree(searchPath);
+    BAIL_IF_ERRPASS(!wSearchPath, PHYSFS_ENUM_ERROR);
 
-    else if (winstat.dwFileAttributes & (FILE_ATTRIBUTE_OFFLINE | FILE_ATTRIBUTE_DEVICE))
-    {
-        st->filetype = PHYSFS_FILETYPE_OTHER;
-        st->filesize = (((PHYSFS_uint64) winstat.nFileSizeHigh) << 32) | winstat.nFileSizeLow;
-    } /* else if */
+    dir = winFindFirstFileW(wSearchPath, &entw);
+    __PHYSFS_smallFree(wSearchPath);
+    BAIL_IF(dir==INVALID_HANDLE_VALUE, errcodeFromWinApi(), PHYSFS_ENUM_ERROR);
 
-    else
+    do
     {
-        st->filetype = PHYSFS_FILETYPE_REGULAR;
-        st->filesize = (((PHYSFS_uint64) winstat.nFileSizeHigh) << 32) | winstat.nFileSizeLow;
-    } /* else */
+        const WCHAR *fn = entw.cFileName;
+        const DWORD attr = entw.dwFileAttributes;
+        PHYSFS_Stat st;
+        char *utf8;
 
-    st->readonly = ((winstat.dwFileAttributes & FILE_ATTRIBUTE_READONLY) != 0);
+        if (fn[0] == '.')  /* ignore "." and ".." */
+        {
+            if ((fn[1] == '\0') || ((fn[1] == '.') && (fn[2] == '\0')))
+                continue;
+        } /* if */
 
-    return 1;
-} /* __PHYSFS_platformStat */
+        /* the find data already has everything GetFileAttributesExW and
+           isSymlink() would have gone back to the filesystem for. */
+        statFromWinAttrs(&st, attr, entw.nFileSizeHigh, entw.nFileSizeLow,
+                         &entw.ftCreationTime, &entw.ftLastAccessTime,
+                         &entw.ftLastWriteTime,
+                         ((attr & PHYSFS_FILE_ATTRIBUTE_REPARSE_POINT) &&
+                          (entw.dwReserved0 == PHYSFS_IO_REPARSE_TAG_SYMLINK)));
+
+        utf8 = unicodeToUtf8Heap(fn);
+        if (utf8 == NULL)
+            retval = PHYSFS_ENUM_ERROR;
+        else
+        {
+            retval = callback(callbackdata, origdir, utf8, &st);
+            allocator.Free(utf8);
+            if (retval == PHYSFS_ENUM_ERROR)
+                PHYSFS_setErrorCode(PHYSFS_ERR_APP_CALLBACK);
+        } /* else */
+    } while ((retval == PHYSFS_ENUM_OK) && (FindNextFileW(dir, &entw) != 0));
+
+    FindClose(dir);
+
+    return retval;
+} /* __PHYSFS_platformEnumerateStat */
 
 #endif  /* PHYSFS_PLATFORM_WINDOWS */
 
@@ -30,6 +30,7 @@
 #  define PHYSFS_PLATFORM_WINDOWS 1
 #elif defined(__OS2__) || defined(OS2)
 #  define PHYSFS_PLATFORM_OS2 1
+#  define PHYSFS_NO_POSITIONAL_READ 1
 #elif ((defined __MACH__) && (defined __APPLE__))
 /* To check if iOS or not, we need to include this file */
 #  include <TargetConditionals.h>
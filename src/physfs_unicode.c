@@ -568,5 +568,49 @@ int PHYSFS_ucs4stricmp(const PHYSFS_uint32 *str1, const PHYSFS_uint32 *str2)
 
 #undef UTFSTRICMP
 
+/*
+ * Caseless compare of (str1) against one element of a path at (*_str2),
+ *  which ends at a '/' or the end of the string. Returns non-zero if they
+ *  match, and moves (*_str2) to the end of the element.
+ */
+int __PHYSFS_utf8stricmpPathElement(const char *str1, const char **_str2)
+{
+    const char *str2 = *_str2;
+    PHYSFS_uint32 folded1[3], folded2[3];
+    int head1 = 0, tail1 = 0, head2 = 0, tail2 = 0;
+    while (1)
+    {
+        PHYSFS_uint32 cp1, cp2;
+        if (head1 != tail1)
+            cp1 = folded1[tail1++];
+        else
+        {
+            head1 = PHYSFS_caseFold(utf8codepoint(&str1), folded1);
+            cp1 = folded1[0];
+            tail1 = 1;
+        } /* else */
+
+        if (head2 != tail2)
+            cp2 = folded2[tail2++];
+        else if (*str2 == '/')
+            cp2 = 0;  /* end of this element; don't consume the separator. */
+        else
+        {
+            head2 = PHYSFS_caseFold(utf8codepoint(&str2), folded2);
+            cp2 = folded2[0];
+            tail2 = 1;
+        } /* else */
+
+        if (cp1 != cp2)
+            return 0;
+        else if (cp1 == 0)
+            break;  /* complete match. */
+    } /* while */
+
+    /* utf8codepoint() doesn't advance past the null terminator. */
+    *_str2 = str2;
+    return 1;
+} /* __PHYSFS_utf8stricmpPathElement */
+
 /* end of physfs_unicode.c ... */
 
@@ -0,0 +1,1450 @@
+/**
+ * Benchmarks for PhysicsFS.
+ *
+ * This builds synthetic archives in every format it knows how to write,
+ *  then times mounting, opening, enumerating, reading and seeking in them,
+ *  and prints the results as CSV, one measurement per line, so runs can be
+ *  compared with a script. Run with --help for options.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#define _CRT_SECURE_NO_WARNINGS 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#endif
+
+#include "physfs.h"
+
+#define BENCH_MAX_THREADS 64
+
+static int opt_files = 256;  /* small files per archive. */
+static int opt_filesize = 64 * 1024;  /* biggest small file. */
+static int opt_bigsize = 8 * 1024 * 1024;  /* one big file per archive. */
+static int opt_mounts = 32;  /* archives for the search path bench. */
+static int opt_threads = 8;  /* most threads for the scaling bench. */
+static int opt_iterations = 2000;  /* lookups/seeks per measurement. */
+static int opt_keep = 0;  /* leave the generated data around? */
+static const char *opt_dir = "physfs_bench_data";
+
+
+/* timing ... */
+
+static double now_seconds(void)
+{
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0)
+        QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return ((double) now.QuadPart) / ((double) freq.QuadPart);
+#elif defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((double) ts.tv_sec) + (((double) ts.tv_nsec) / 1000000000.0);
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((double) tv.tv_sec) + (((double) tv.tv_usec) / 1000000.0);
+#endif
+} /* now_seconds */
+
+
+/* threads ... */
+
+#ifdef _WIN32
+typedef HANDLE bench_thread;
+
+static DWORD WINAPI win32_thread_entry(LPVOID arg)
+{
+    void (*fn)(void *) = ((void (**)(void *)) arg)[0];
+    void *data = ((void **) arg)[1];
+    fn(data);
+    return 0;
+} /* win32_thread_entry */
+#else
+typedef pthread_t bench_thread;
+#endif
+
+typedef struct
+{
+    void (*fn)(void *);
+    void *data;
+    bench_thread thread;
+} BenchThread;
+
+#ifndef _WIN32
+static void *pthread_entry(void *arg)
+{
+    BenchThread *t = (BenchThread *) arg;
+    t->fn(t->data);
+    return NULL;
+} /* pthread_entry */
+#endif
+
+static int start_thread(BenchThread *t, void (*fn)(void *), void *data)
+{
+    t->fn = fn;
+    t->data = data;
+#ifdef _WIN32
+    t->thread = CreateThread(NULL, 0, win32_thread_entry, t, 0, NULL);
+    return (t->thread != NULL);
+#else
+    return (pthread_create(&t->thread, NULL, pthread_entry, t) == 0);
+#endif
+} /* start_thread */
+
+static void wait_thread(BenchThread *t)
+{
+#ifdef _WIN32
+    WaitForSingleObject(t->thread, INFINITE);
+    CloseHandle(t->thread);
+#else
+    pthread_join(t->thread, NULL);
+#endif
+} /* wait_thread */
+
+
+/* output ... */
+
+static void report(const char *bench, const char *format, int threads,
+                   double value, const char *unit)
+{
+    printf("%s,%s,%d,%.3f,%s\n", bench, format, threads, value, unit);
+    fflush(stdout);
+} /* report */
+
+static void fail(const char *what)
+{
+    fprintf(stderr, "physfs_bench: %s failed: %s\n", what,
+            PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+    exit(1);
+} /* fail */
+
+
+/* synthetic data ... */
+
+static PHYSFS_uint32 rng(PHYSFS_uint32 *state)
+{
+    *state = (*state * 1103515245) + 12345;
+    return (*state >> 8) & 0xFFFFFF;
+} /* rng */
+
+/* text-ish data, so deflate has something to work with. */
+static void fill_data(PHYSFS_uint8 *buf, size_t len, PHYSFS_uint32 seed)
+{
+    static const char *words[] = {
+        "physfs ", "archive ", "mount ", "read ", "seek ", "file ",
+        "directory ", "zip ", "search ", "path ", "buffer ", "data\n",
+        "level ", "texture ", "sound ", "model ", "0123 ", "4567 "
+    };
+    const size_t numwords = sizeof (words) / sizeof (words[0]);
+    size_t i = 0;
+
+    while (i < len)
+    {
+        const char *w = words[rng(&seed) % numwords];
+        while ((*w) && (i < len))
+            buf[i++] = (PHYSFS_uint8) *(w++);
+    } /* while */
+} /* fill_data */
+
+
+typedef struct
+{
+    PHYSFS_uint8 *data;
+    size_t len;
+    size_t alloc;
+} Buffer;
+
+static void buf_reserve(Buffer *b, size_t extra)
+{
+    if (b->len + extra > b->alloc)
+    {
+        size_t newalloc = b->alloc ? b->alloc : 4096;
+        while (newalloc < b->len + extra)
+            newalloc *= 2;
+        b->data = (PHYSFS_uint8 *) realloc(b->data, newalloc);
+        if (!b->data)
+        {
+            fprintf(stderr, "physfs_bench: out of memory\n");
+            exit(1);
+        } /* if */
+        b->alloc = newalloc;
+    } /* if */
+} /* buf_reserve */
+
+static void buf_append(Buffer *b, const void *data, size_t len)
+{
+    buf_reserve(b, len);
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+} /* buf_append */
+
+static void buf_zeros(Buffer *b, size_t len)
+{
+    buf_reserve(b, len);
+    memset(b->data + b->len, '\0', len);
+    b->len += len;
+} /* buf_zeros */
+
+static void buf_u8(Buffer *b, PHYSFS_uint32 v)
+{
+    const PHYSFS_uint8 x = (PHYSFS_uint8) v;
+    buf_append(b, &x, 1);
+} /* buf_u8 */
+
+static void buf_le16(Buffer *b, PHYSFS_uint32 v)
+{
+    buf_u8(b, v & 0xFF);
+    buf_u8(b, (v >> 8) & 0xFF);
+} /* buf_le16 */
+
+static void buf_le32(Buffer *b, PHYSFS_uint32 v)
+{
+    buf_le16(b, v & 0xFFFF);
+    buf_le16(b, (v >> 16) & 0xFFFF);
+} /* buf_le32 */
+
+static void buf_le64(Buffer *b, PHYSFS_uint64 v)
+{
+    buf_le32(b, (PHYSFS_uint32) (v & 0xFFFFFFFF));
+    buf_le32(b, (PHYSFS_uint32) (v >> 32));
+} /* buf_le64 */
+
+static void buf_be16(Buffer *b, PHYSFS_uint32 v)
+{
+    buf_u8(b, (v >> 8) & 0xFF);
+    buf_u8(b, v & 0xFF);
+} /* buf_be16 */
+
+static void buf_be32(Buffer *b, PHYSFS_uint32 v)
+{
+    buf_be16(b, (v >> 16) & 0xFFFF);
+    buf_be16(b, v & 0xFFFF);
+} /* buf_be32 */
+
+/* fixed-size, zero-padded string field. */
+static void buf_name(Buffer *b, const char *str, size_t len)
+{
+    const size_t slen = strlen(str);
+    buf_append(b, str, (slen < len) ? slen : len);
+    if (slen < len)
+        buf_zeros(b, len - slen);
+} /* buf_name */
+
+static void put_le32(PHYSFS_uint8 *ptr, PHYSFS_uint32 v)
+{
+    ptr[0] = (PHYSFS_uint8) (v & 0xFF);
+    ptr[1] = (PHYSFS_uint8) ((v >> 8) & 0xFF);
+    ptr[2] = (PHYSFS_uint8) ((v >> 16) & 0xFF);
+    ptr[3] = (PHYSFS_uint8) ((v >> 24) & 0xFF);
+} /* put_le32 */
+
+static void put_le64(PHYSFS_uint8 *ptr, PHYSFS_uint64 v)
+{
+    put_le32(ptr, (PHYSFS_uint32) (v & 0xFFFFFFFF));
+    put_le32(ptr + 4, (PHYSFS_uint32) (v >> 32));
+} /* put_le64 */
+
+
+static PHYSFS_uint32 crc_table[256];
+
+static void crc32_init(void)
+{
+    PHYSFS_uint32 i;
+    for (i = 0; i < 256; i++)
+    {
+        PHYSFS_uint32 c = i;
+        int j;
+        for (j = 0; j < 8; j++)
+            c = (c & 1) ? (0xEDB88320 ^ (c >> 1)) : (c >> 1);
+        crc_table[i] = c;
+    } /* for */
+} /* crc32_init */
+
+static PHYSFS_uint32 crc32(const PHYSFS_uint8 *buf, size_t len)
+{
+    PHYSFS_uint32 crc = 0xFFFFFFFF;
+    while (len--)
+        crc = crc_table[(crc ^ *(buf++)) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFF;
+} /* crc32 */
+
+
+/*
+ * A small deflate compressor: one block with the fixed Huffman codes, and
+ *  greedy matches from a single-entry hash table. It compresses worse and
+ *  slower than zlib, but it makes real back-references for the inflater
+ *  to chew on, which is all we need.
+ */
+
+typedef struct
+{
+    Buffer *out;
+    PHYSFS_uint32 bits;
+    int nbits;
+} BitWriter;
+
+static void put_bits(BitWriter *bw, PHYSFS_uint32 value, int count)
+{
+    bw->bits |= value << bw->nbits;
+    bw->nbits += count;
+    while (bw->nbits >= 8)
+    {
+        buf_u8(bw->out, bw->bits & 0xFF);
+        bw->bits >>= 8;
+        bw->nbits -= 8;
+    } /* while */
+} /* put_bits */
+
+/* Huffman codes go out most significant bit first. */
+static void put_code(BitWriter *bw, PHYSFS_uint32 code, int len)
+{
+    PHYSFS_uint32 rev = 0;
+    int i;
+    for (i = 0; i < len; i++)
+        rev |= ((code >> i) & 1) << (len - 1 - i);
+    put_bits(bw, rev, len);
+} /* put_code */
+
+static void put_litlen(BitWriter *bw, int v)
+{
+    if (v <= 143)
+        put_code(bw, 0x30 + v, 8);
+    else if (v <= 255)
+        put_code(bw, 0x190 + (v - 144), 9);
+    else if (v <= 279)
+        put_code(bw, v - 256, 7);
+    else
+        put_code(bw, 0xC0 + (v - 280), 8);
+} /* put_litlen */
+
+static void put_match(BitWriter *bw, int len, int dist)
+{
+    static const int lbase[] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19,
+        23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const int lextra[] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2,
+        2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const int dbase[] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65,
+        97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+        8193, 12289, 16385, 24577 };
+    static const int dextra[] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5,
+        6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+    int i;
+
+    for (i = 28; lbase[i] > len; i--) { /* spin */ }
+    put_litlen(bw, 257 + i);
+    put_bits(bw, (PHYSFS_uint32) (len - lbase[i]), lextra[i]);
+
+    for (i = 29; dbase[i] > dist; i--) { /* spin */ }
+    put_code(bw, (PHYSFS_uint32) i, 5);
+    put_bits(bw, (PHYSFS_uint32) (dist - dbase[i]), dextra[i]);
+} /* put_match */
+
+#define DEFLATE_HASH_BITS 15
+
+static void deflate_buffer(Buffer *out, const PHYSFS_uint8 *in, size_t len)
+{
+    static int head[1 << DEFLATE_HASH_BITS];
+    BitWriter bw;
+    size_t i = 0;
+
+    memset(&bw, '\0', sizeof (bw));
+    bw.out = out;
+    memset(head, 0xFF, sizeof (head));  /* all -1. */
+
+    put_bits(&bw, 1, 1);  /* final block. */
+    put_bits(&bw, 1, 2);  /* fixed Huffman codes. */
+
+    while (i < len)
+    {
+        int matchlen = 0;
+        if (i + 3 <= len)
+        {
+            const PHYSFS_uint32 h = ((in[i] << 10) ^ (in[i+1] << 5) ^ in[i+2]) &
+                                    ((1 << DEFLATE_HASH_BITS) - 1);
+            const int cand = head[h];
+            head[h] = (int) i;
+            if ((cand >= 0) && ((i - cand) <= 32768))
+            {
+                const size_t maxlen = ((len - i) < 258) ? (len - i) : 258;
+                while ((matchlen < (int) maxlen) && (in[cand + matchlen] == in[i + matchlen]))
+                    matchlen++;
+                if (matchlen >= 3)
+                    put_match(&bw, matchlen, (int) (i - cand));
+            } /* if */
+        } /* if */
+
+        if (matchlen >= 3)
+            i += matchlen;
+        else
+            put_litlen(&bw, in[i++]);
+    } /* while */
+
+    put_litlen(&bw, 256);  /* end of block. */
+    if (bw.nbits > 0)
+        put_bits(&bw, 0, 8 - bw.nbits);
+} /* deflate_buffer */
+
+
+/* The files every archive holds. */
+
+typedef struct
+{
+    char name[32];
+    char shortname[16];  /* for formats with 8 character names. */
+    PHYSFS_uint8 *data;
+    size_t len;
+} BenchFile;
+
+static BenchFile *files = NULL;
+static int numfiles = 0;  /* opt_files small ones, then the big one. */
+
+static void make_files(void)
+{
+    PHYSFS_uint32 seed = 0xC0FFEE;
+    int i;
+
+    numfiles = opt_files + 1;
+    files = (BenchFile *) calloc(numfiles, sizeof (BenchFile));
+    if (!files)
+        fail("allocating files");
+
+    for (i = 0; i < numfiles; i++)
+    {
+        BenchFile *f = &files[i];
+        if (i == opt_files)
+        {
+            strcpy(f->name, "BIG.DAT");
+            strcpy(f->shortname, "BIG");
+            f->len = (size_t) opt_bigsize;
+        } /* if */
+        else
+        {
+            sprintf(f->name, "F%04d.TXT", i);
+            sprintf(f->shortname, "F%04d", i);
+            f->len = 1024 + (rng(&seed) % (opt_filesize > 1024 ? opt_filesize - 1024 : 1));
+        } /* else */
+
+        f->data = (PHYSFS_uint8 *) malloc(f->len ? f->len : 1);
+        if (!f->data)
+            fail("allocating files");
+        fill_data(f->data, f->len, rng(&seed));
+    } /* for */
+} /* make_files */
+
+
+/* archive writers. Each builds a whole archive in (b). */
+
+static void build_zip(Buffer *b, const BenchFile *list, int count,
+                      int deflate, int zip64)
+{
+    PHYSFS_uint64 *offsets = (PHYSFS_uint64 *) malloc(sizeof (PHYSFS_uint64) * count);
+    PHYSFS_uint64 *complens = (PHYSFS_uint64 *) malloc(sizeof (PHYSFS_uint64) * count);
+    PHYSFS_uint32 *crcs = (PHYSFS_uint32 *) malloc(sizeof (PHYSFS_uint32) * count);
+    PHYSFS_uint64 cdstart, cdlen, z64pos;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const BenchFile *f = &list[i];
+        const size_t namelen = strlen(f->name);
+        Buffer comp;
+        const PHYSFS_uint8 *payload = f->data;
+        size_t paylen = f->len;
+
+        memset(&comp, '\0', sizeof (comp));
+        if (deflate)
+        {
+            deflate_buffer(&comp, f->data, f->len);
+            payload = comp.data;
+            paylen = comp.len;
+        } /* if */
+
+        offsets[i] = b->len;
+        complens[i] = paylen;
+        crcs[i] = crc32(f->data, f->len);
+
+        buf_le32(b, 0x04034b50);
+        buf_le16(b, zip64 ? 45 : 20);
+        buf_le16(b, 0);
+        buf_le16(b, deflate ? 8 : 0);
+        buf_le16(b, 0);  /* mod time */
+        buf_le16(b, 0x21);  /* mod date */
+        buf_le32(b, crcs[i]);
+        buf_le32(b, zip64 ? 0xFFFFFFFF : (PHYSFS_uint32) paylen);
+        buf_le32(b, zip64 ? 0xFFFFFFFF : (PHYSFS_uint32) f->len);
+        buf_le16(b, (PHYSFS_uint32) namelen);
+        buf_le16(b, zip64 ? 20 : 0);
+        buf_append(b, f->name, namelen);
+        if (zip64)
+        {
+            buf_le16(b, 0x0001);
+            buf_le16(b, 16);
+            buf_le64(b, f->len);
+            buf_le64(b, paylen);
+        } /* if */
+        buf_append(b, payload, paylen);
+        free(comp.data);
+    } /* for */
+
+    cdstart = b->len;
+    for (i = 0; i < count; i++)
+    {
+        const BenchFile *f = &list[i];
+        const size_t namelen = strlen(f->name);
+
+        buf_le32(b, 0x02014b50);
+        buf_le16(b, zip64 ? 45 : 20);
+        buf_le16(b, zip64 ? 45 : 20);
+        buf_le16(b, 0);
+        buf_le16(b, deflate ? 8 : 0);
+        buf_le16(b, 0);
+        buf_le16(b, 0x21);
+        buf_le32(b, crcs[i]);
+        buf_le32(b, zip64 ? 0xFFFFFFFF : (PHYSFS_uint32) complens[i]);
+        buf_le32(b, zip64 ? 0xFFFFFFFF : (PHYSFS_uint32) f->len);
+        buf_le16(b, (PHYSFS_uint32) namelen);
+        buf_le16(b, zip64 ? 28 : 0);
+        buf_le16(b, 0);  /* comment */
+        buf_le16(b, 0);  /* disk */
+        buf_le16(b, 0);  /* internal attr */
+        buf_le32(b, 0);  /* external attr */
+        buf_le32(b, zip64 ? 0xFFFFFFFF : (PHYSFS_uint32) offsets[i]);
+        buf_append(b, f->name, namelen);
+        if (zip64)
+        {
+            buf_le16(b, 0x0001);
+            buf_le16(b, 24);
+            buf_le64(b, f->len);
+            buf_le64(b, complens[i]);
+            buf_le64(b, offsets[i]);
+        } /* if */
+    } /* for */
+    cdlen = b->len - cdstart;
+
+    if (zip64)
+    {
+        z64pos = b->len;
+        buf_le32(b, 0x06064b50);
+        buf_le64(b, 44);
+        buf_le16(b, 45);
+        buf_le16(b, 45);
+        buf_le32(b, 0);
+        buf_le32(b, 0);
+        buf_le64(b, count);
+        buf_le64(b, count);
+        buf_le64(b, cdlen);
+        buf_le64(b, cdstart);
+
+        buf_le32(b, 0x07064b50);
+        buf_le32(b, 0);
+        buf_le64(b, z64pos);
+        buf_le32(b, 1);
+    } /* if */
+
+    buf_le32(b, 0x06054b50);
+    buf_le16(b, 0);
+    buf_le16(b, 0);
+    buf_le16(b, zip64 ? 0xFFFF : (PHYSFS_uint32) count);
+    buf_le16(b, zip64 ? 0xFFFF : (PHYSFS_uint32) count);
+    buf_le32(b, zip64 ? 0xFFFFFFFF : (PHYSFS_uint32) cdlen);
+    buf_le32(b, zip64 ? 0xFFFFFFFF : (PHYSFS_uint32) cdstart);
+    buf_le16(b, 0);
+
+    free(offsets);
+    free(complens);
+    free(crcs);
+} /* build_zip */
+
+static void build_zip_stored(Buffer *b) { build_zip(b, files, numfiles, 0, 0); }
+static void build_zip_deflated(Buffer *b) { build_zip(b, files, numfiles, 1, 0); }
+static void build_zip64(Buffer *b) { build_zip(b, files, numfiles, 1, 1); }
+
+
+/* 7z variable-length number. */
+static void buf_7znum(Buffer *b, PHYSFS_uint64 v)
+{
+    int i;
+    for (i = 0; i < 8; i++)
+    {
+        if (v < (((PHYSFS_uint64) 1) << (7 * (i + 1))))
+        {
+            const PHYSFS_uint32 mask = (0xFF << (8 - i)) & 0xFF;
+            int j;
+            buf_u8(b, mask | (PHYSFS_uint32) (v >> (8 * i)));
+            for (j = 0; j < i; j++)
+                buf_u8(b, (PHYSFS_uint32) ((v >> (8 * j)) & 0xFF));
+            return;
+        } /* if */
+    } /* for */
+
+    buf_u8(b, 0xFF);
+    buf_le64(b, v);
+} /* buf_7znum */
+
+/*
+ * One solid folder holding every file. We don't have an LZMA encoder, so
+ *  it uses the Copy coder; mounting still has to parse the whole header and
+ *  reading still goes through the 7z folder machinery.
+ */
+static void build_7z(Buffer *b)
+{
+    Buffer hdr;
+    PHYSFS_uint64 packsize = 0;
+    PHYSFS_uint64 namebytes = 0;
+    PHYSFS_uint8 *sig;
+    int i;
+
+    memset(&hdr, '\0', sizeof (hdr));
+
+    buf_zeros(b, 32);  /* signature header, filled in at the end. */
+    for (i = 0; i < numfiles; i++)
+    {
+        buf_append(b, files[i].data, files[i].len);
+        packsize += files[i].len;
+        namebytes += (strlen(files[i].name) + 1) * 2;
+    } /* for */
+
+    buf_u8(&hdr, 0x01);  /* kHeader */
+    buf_u8(&hdr, 0x04);  /* kMainStreamsInfo */
+
+    buf_u8(&hdr, 0x06);  /* kPackInfo */
+    buf_7znum(&hdr, 0);  /* pack pos */
+    buf_7znum(&hdr, 1);  /* pack streams */
+    buf_u8(&hdr, 0x09);  /* kSize */
+    buf_7znum(&hdr, packsize);
+    buf_u8(&hdr, 0x00);  /* kEnd */
+
+    buf_u8(&hdr, 0x07);  /* kUnPackInfo */
+    buf_u8(&hdr, 0x0B);  /* kFolder */
+    buf_7znum(&hdr, 1);  /* folders */
+    buf_u8(&hdr, 0);  /* not external */
+    buf_7znum(&hdr, 1);  /* coders */
+    buf_u8(&hdr, 0x01);  /* simple coder, 1-byte id, no properties */
+    buf_u8(&hdr, 0x00);  /* Copy */
+    buf_u8(&hdr, 0x0C);  /* kCodersUnPackSize */
+    buf_7znum(&hdr, packsize);
+    buf_u8(&hdr, 0x00);  /* kEnd */
+
+    buf_u8(&hdr, 0x08);  /* kSubStreamsInfo */
+    buf_u8(&hdr, 0x0D);  /* kNumUnPackStream */
+    buf_7znum(&hdr, numfiles);
+    buf_u8(&hdr, 0x09);  /* kSize */
+    for (i = 0; i < numfiles - 1; i++)
+        buf_7znum(&hdr, files[i].len);
+    buf_u8(&hdr, 0x00);  /* kEnd */
+
+    buf_u8(&hdr, 0x00);  /* kEnd (streams info) */
+
+    buf_u8(&hdr, 0x05);  /* kFilesInfo */
+    buf_7znum(&hdr, numfiles);
+    buf_u8(&hdr, 0x11);  /* kName */
+    buf_7znum(&hdr, namebytes + 1);
+    buf_u8(&hdr, 0);  /* not external */
+    for (i = 0; i < numfiles; i++)
+    {
+        const char *ptr;
+        for (ptr = files[i].name; *ptr; ptr++)
+            buf_le16(&hdr, (PHYSFS_uint8) *ptr);
+        buf_le16(&hdr, 0);
+    } /* for */
+    buf_u8(&hdr, 0x00);  /* kEnd (files info) */
+    buf_u8(&hdr, 0x00);  /* kEnd (header) */
+
+    buf_append(b, hdr.data, hdr.len);
+
+    sig = b->data;
+    memcpy(sig, "7z\xBC\xAF\x27\x1C", 6);
+    sig[6] = 0;
+    sig[7] = 4;
+    put_le64(sig + 12, packsize);  /* next header offset, after sig. */
+    put_le64(sig + 20, hdr.len);
+    put_le32(sig + 28, crc32(hdr.data, hdr.len));
+    put_le32(sig + 8, crc32(sig + 12, 20));
+    free(hdr.data);
+} /* build_7z */
+
+
+static void iso_dirrecord(Buffer *b, PHYSFS_uint32 extent, PHYSFS_uint32 len,
+                          int isdir, const char *name, size_t namelen)
+{
+    const size_t reclen = 33 + namelen + ((namelen % 2) ? 0 : 1);
+    buf_u8(b, (PHYSFS_uint32) reclen);
+    buf_u8(b, 0);
+    buf_le32(b, extent);
+    buf_be32(b, extent);
+    buf_le32(b, len);
+    buf_be32(b, len);
+    buf_u8(b, 120);  /* 2020 */
+    buf_u8(b, 1);
+    buf_u8(b, 1);
+    buf_u8(b, 0);
+    buf_u8(b, 0);
+    buf_u8(b, 0);
+    buf_u8(b, 0);
+    buf_u8(b, isdir ? 2 : 0);
+    buf_u8(b, 0);
+    buf_u8(b, 0);
+    buf_le16(b, 1);
+    buf_be16(b, 1);
+    buf_u8(b, (PHYSFS_uint32) namelen);
+    buf_append(b, name, namelen);
+    if ((namelen % 2) == 0)
+        buf_u8(b, 0);
+} /* iso_dirrecord */
+
+static void build_iso(Buffer *b)
+{
+    Buffer dir;
+    PHYSFS_uint32 dirsectors;
+    PHYSFS_uint32 sector;
+    PHYSFS_uint32 totalsectors;
+    int pass;
+    int i;
+
+    memset(&dir, '\0', sizeof (dir));
+
+    /* first pass figures out how big the directory is, second writes it. */
+    dirsectors = 1;
+    for (pass = 0; pass < 2; pass++)
+    {
+        dir.len = 0;
+        sector = 18 + dirsectors;
+        iso_dirrecord(&dir, 18, dirsectors * 2048, 1, "\0", 1);
+        iso_dirrecord(&dir, 18, dirsectors * 2048, 1, "\1", 1);
+        for (i = 0; i < numfiles; i++)
+        {
+            char name[40];
+            const size_t namelen = (size_t) sprintf(name, "%s;1", files[i].name);
+            const size_t reclen = 33 + namelen + ((namelen % 2) ? 0 : 1);
+            if (((dir.len % 2048) + reclen) > 2048)  /* can't span sectors. */
+                buf_zeros(&dir, 2048 - (dir.len % 2048));
+            iso_dirrecord(&dir, sector, (PHYSFS_uint32) files[i].len, 0, name, namelen);
+            sector += (PHYSFS_uint32) ((files[i].len + 2047) / 2048);
+        } /* for */
+        dirsectors = (PHYSFS_uint32) ((dir.len + 2047) / 2048);
+    } /* for */
+    buf_zeros(&dir, (dirsectors * 2048) - dir.len);
+    totalsectors = sector;
+
+    buf_zeros(b, 16 * 2048);  /* system area. */
+
+    /* primary volume descriptor. */
+    buf_u8(b, 1);
+    buf_append(b, "CD001", 5);
+    buf_u8(b, 1);
+    buf_u8(b, 0);
+    buf_name(b, "PHYSFS_BENCH", 32);
+    buf_name(b, "PHYSFS_BENCH", 32);
+    buf_zeros(b, 8);
+    buf_le32(b, totalsectors);
+    buf_be32(b, totalsectors);
+    buf_zeros(b, 32);
+    buf_le16(b, 1);
+    buf_be16(b, 1);
+    buf_le16(b, 1);
+    buf_be16(b, 1);
+    buf_le16(b, 2048);
+    buf_be16(b, 2048);
+    buf_zeros(b, 8 + 16);  /* no path tables; nobody reads them. */
+    iso_dirrecord(b, 18, dirsectors * 2048, 1, "\0", 1);
+    buf_zeros(b, (17 * 2048) - b->len);
+
+    /* terminator. */
+    buf_u8(b, 255);
+    buf_append(b, "CD001", 5);
+    buf_u8(b, 1);
+    buf_zeros(b, 2048 - 7);
+
+    buf_append(b, dir.data, dir.len);
+    free(dir.data);
+
+    for (i = 0; i < numfiles; i++)
+    {
+        buf_append(b, files[i].data, files[i].len);
+        buf_zeros(b, ((files[i].len + 2047) / 2048 * 2048) - files[i].len);
+    } /* for */
+} /* build_iso */
+
+
+static void build_grp(Buffer *b)
+{
+    int i;
+    buf_append(b, "KenSilverman", 12);
+    buf_le32(b, numfiles);
+    for (i = 0; i < numfiles; i++)
+    {
+        buf_name(b, files[i].name, 12);
+        buf_le32(b, (PHYSFS_uint32) files[i].len);
+    } /* for */
+    for (i = 0; i < numfiles; i++)
+        buf_append(b, files[i].data, files[i].len);
+} /* build_grp */
+
+static void build_wad(Buffer *b)
+{
+    PHYSFS_uint32 pos = 12;
+    int i;
+
+    buf_append(b, "PWAD", 4);
+    buf_le32(b, numfiles);
+    buf_le32(b, 0);  /* directory offset, filled in below. */
+    for (i = 0; i < numfiles; i++)
+        buf_append(b, files[i].data, files[i].len);
+
+    put_le32(b->data + 8, (PHYSFS_uint32) b->len);
+    for (i = 0; i < numfiles; i++)
+    {
+        buf_le32(b, pos);
+        buf_le32(b, (PHYSFS_uint32) files[i].len);
+        buf_name(b, files[i].shortname, 8);
+        pos += (PHYSFS_uint32) files[i].len;
+    } /* for */
+} /* build_wad */
+
+static void build_hog(Buffer *b)
+{
+    int i;
+    buf_append(b, "DHF", 3);
+    for (i = 0; i < numfiles; i++)
+    {
+        buf_name(b, files[i].name, 13);
+        buf_le32(b, (PHYSFS_uint32) files[i].len);
+        buf_append(b, files[i].data, files[i].len);
+    } /* for */
+} /* build_hog */
+
+static void build_qpak(Buffer *b)
+{
+    PHYSFS_uint32 pos = 12;
+    int i;
+
+    buf_append(b, "PACK", 4);
+    buf_le32(b, 0);  /* directory offset, filled in below. */
+    buf_le32(b, numfiles * 64);
+    for (i = 0; i < numfiles; i++)
+        buf_append(b, files[i].data, files[i].len);
+
+    put_le32(b->data + 4, (PHYSFS_uint32) b->len);
+    for (i = 0; i < numfiles; i++)
+    {
+        buf_name(b, files[i].name, 56);
+        buf_le32(b, pos);
+        buf_le32(b, (PHYSFS_uint32) files[i].len);
+        pos += (PHYSFS_uint32) files[i].len;
+    } /* for */
+} /* build_qpak */
+
+static void build_mvl(Buffer *b)
+{
+    int i;
+    buf_append(b, "DMVL", 4);
+    buf_le32(b, numfiles);
+    for (i = 0; i < numfiles; i++)
+    {
+        buf_name(b, files[i].name, 13);
+        buf_le32(b, (PHYSFS_uint32) files[i].len);
+    } /* for */
+    for (i = 0; i < numfiles; i++)
+        buf_append(b, files[i].data, files[i].len);
+} /* build_mvl */
+
+
+typedef struct
+{
+    const char *name;  /* what we call it in the output. */
+    const char *filename;  /* what we write in the data dir. */
+    const char *ext;  /* archiver that's needed, NULL for a directory. */
+    void (*build)(Buffer *b);
+    int shortnames;  /* uses BenchFile::shortname. */
+    int available;
+} BenchFormat;
+
+static BenchFormat formats[] = {
+    { "dir", "dir", NULL, NULL, 0, 0 },
+    { "zip-stored", "stored.zip", "ZIP", build_zip_stored, 0, 0 },
+    { "zip-deflated", "deflated.zip", "ZIP", build_zip_deflated, 0, 0 },
+    { "zip64", "zip64.zip", "ZIP", build_zip64, 0, 0 },
+    { "7z-solid", "solid.7z", "7Z", build_7z, 0, 0 },
+    { "iso9660", "image.iso", "ISO", build_iso, 0, 0 },
+    { "grp", "pack.grp", "GRP", build_grp, 0, 0 },
+    { "wad", "pack.wad", "WAD", build_wad, 1, 0 },
+    { "hog", "pack.hog", "HOG", build_hog, 0, 0 },
+    { "qpak", "pack.pak", "PAK", build_qpak, 0, 0 },
+    { "mvl", "pack.mvl", "MVL", build_mvl, 0, 0 }
+};
+#define NUM_FORMATS ((int) (sizeof (formats) / sizeof (formats[0])))
+
+static const char *file_name(const BenchFormat *fmt, int idx)
+{
+    return fmt->shortnames ? files[idx].shortname : files[idx].name;
+} /* file_name */
+
+
+/* generating the data dir ... */
+
+static char *datadir = NULL;  /* real path of opt_dir, with a dirsep. */
+
+static char *real_path(const char *name)
+{
+    const size_t len = strlen(datadir) + strlen(name) + 1;
+    char *retval = (char *) malloc(len);
+    if (!retval)
+        fail("allocating a path");
+    sprintf(retval, "%s%s", datadir, name);
+    return retval;
+} /* real_path */
+
+static void write_file(const char *path, const void *data, size_t len)
+{
+    PHYSFS_File *f = PHYSFS_openWrite(path);
+    if (!f)
+        fail(path);
+    if (PHYSFS_writeBytes(f, data, len) != (PHYSFS_sint64) len)
+        fail(path);
+    if (!PHYSFS_close(f))
+        fail(path);
+} /* write_file */
+
+static int archiver_available(const char *ext)
+{
+    const PHYSFS_ArchiveInfo **i;
+    for (i = PHYSFS_supportedArchiveTypes(); *i != NULL; i++)
+    {
+        if (PHYSFS_utf8stricmp((*i)->extension, ext) == 0)
+            return 1;
+    } /* for */
+    return 0;
+} /* archiver_available */
+
+static char mount_name[32];
+
+static const char *search_mount_name(int idx)
+{
+    sprintf(mount_name, "mount%03d.zip", idx);
+    return mount_name;
+} /* search_mount_name */
+
+static void generate_data(void)
+{
+    const char *sep = PHYSFS_getDirSeparator();
+    const char *base = PHYSFS_getWriteDir();
+    char path[64];
+    int i;
+
+    if (!PHYSFS_mkdir(opt_dir))
+        fail("creating the data directory");
+
+    datadir = (char *) malloc(strlen(base) + strlen(opt_dir) + (strlen(sep) * 2) + 1);
+    if (!datadir)
+        fail("allocating a path");
+    sprintf(datadir, "%s%s%s%s", base, sep, opt_dir, sep);
+
+    for (i = 0; i < NUM_FORMATS; i++)
+    {
+        BenchFormat *fmt = &formats[i];
+        Buffer b;
+
+        fmt->available = (fmt->ext == NULL) || archiver_available(fmt->ext);
+        if (!fmt->available)
+        {
+            fprintf(stderr, "physfs_bench: no %s support, skipping %s\n",
+                    fmt->ext, fmt->name);
+            continue;
+        } /* if */
+
+        if (fmt->build == NULL)  /* a real directory. */
+        {
+            int j;
+            sprintf(path, "%s/%s", opt_dir, fmt->filename);
+            if (!PHYSFS_mkdir(path))
+                fail("creating a directory");
+            for (j = 0; j < numfiles; j++)
+            {
+                sprintf(path, "%s/%s/%s", opt_dir, fmt->filename, files[j].name);
+                write_file(path, files[j].data, files[j].len);
+            } /* for */
+            continue;
+        } /* if */
+
+        memset(&b, '\0', sizeof (b));
+        fmt->build(&b);
+        sprintf(path, "%s/%s", opt_dir, fmt->filename);
+        write_file(path, b.data, b.len);
+        free(b.data);
+    } /* for */
+
+    /* lots of little archives, each with their own files, for lookups. */
+    if (archiver_available("ZIP"))
+    {
+        BenchFile mfiles[16];
+        char data[64];
+        for (i = 0; i < opt_mounts; i++)
+        {
+            Buffer b;
+            int j;
+            memset(&b, '\0', sizeof (b));
+            for (j = 0; j < 16; j++)
+            {
+                sprintf(mfiles[j].name, "m%03d/file%02d.txt", i, j);
+                mfiles[j].len = (size_t) sprintf(data, "mount %d file %d\n", i, j);
+                mfiles[j].data = (PHYSFS_uint8 *) data;
+            } /* for */
+            build_zip(&b, mfiles, 16, 0, 0);
+            sprintf(path, "%s/%s", opt_dir, search_mount_name(i));
+            write_file(path, b.data, b.len);
+            free(b.data);
+        } /* for */
+    } /* if */
+} /* generate_data */
+
+static void remove_data(void)
+{
+    char path[128];
+    int i;
+
+    for (i = 0; i < NUM_FORMATS; i++)
+    {
+        if (formats[i].build == NULL)
+        {
+            int j;
+            for (j = 0; j < numfiles; j++)
+            {
+                sprintf(path, "%s/%s/%s", opt_dir, formats[i].filename, files[j].name);
+                PHYSFS_delete(path);
+            } /* for */
+        } /* if */
+        sprintf(path, "%s/%s", opt_dir, formats[i].filename);
+        PHYSFS_delete(path);
+    } /* for */
+
+    for (i = 0; i < opt_mounts; i++)
+    {
+        sprintf(path, "%s/%s", opt_dir, search_mount_name(i));
+        PHYSFS_delete(path);
+    } /* for */
+
+    PHYSFS_delete(opt_dir);
+} /* remove_data */
+
+
+/* the benchmarks ... */
+
+static void mount_format(const BenchFormat *fmt)
+{
+    char *path = real_path(fmt->filename);
+    if (!PHYSFS_mount(path, "/", 1))
+        fail(path);
+    free(path);
+} /* mount_format */
+
+static void unmount_format(const BenchFormat *fmt)
+{
+    char *path = real_path(fmt->filename);
+    if (!PHYSFS_unmount(path))
+        fail(path);
+    free(path);
+} /* unmount_format */
+
+static PHYSFS_uint64 read_whole_file(const char *name, PHYSFS_uint8 *buf,
+                                     size_t buflen)
+{
+    PHYSFS_uint64 total = 0;
+    PHYSFS_sint64 br;
+    PHYSFS_File *f = PHYSFS_openRead(name);
+    if (!f)
+        fail(name);
+    while ((br = PHYSFS_readBytes(f, buf, buflen)) > 0)
+        total += (PHYSFS_uint64) br;
+    PHYSFS_close(f);
+    return total;
+} /* read_whole_file */
+
+static void bench_mount(const BenchFormat *fmt)
+{
+    const int reps = 20;
+    double start;
+    int i;
+
+    start = now_seconds();
+    for (i = 0; i < reps; i++)
+    {
+        mount_format(fmt);
+        unmount_format(fmt);
+    } /* for */
+    report("mount", fmt->name, 1, ((now_seconds() - start) / reps) * 1000000.0, "us");
+} /* bench_mount */
+
+static void bench_open(const BenchFormat *fmt)
+{
+    PHYSFS_uint32 seed = 1;
+    double start;
+    int i;
+
+    start = now_seconds();
+    for (i = 0; i < opt_iterations; i++)
+    {
+        PHYSFS_File *f = PHYSFS_openRead(file_name(fmt, (int) (rng(&seed) % opt_files)));
+        if (!f)
+            fail("openRead");
+        PHYSFS_close(f);
+    } /* for */
+    report("open_hit", fmt->name, 1, ((now_seconds() - start) / opt_iterations) * 1000000000.0, "ns");
+
+    start = now_seconds();
+    for (i = 0; i < opt_iterations; i++)
+    {
+        if (PHYSFS_openRead("NO_SUCH.FILE") != NULL)
+            fail("openRead of a missing file");
+    } /* for */
+    report("open_miss", fmt->name, 1, ((now_seconds() - start) / opt_iterations) * 1000000000.0, "ns");
+} /* bench_open */
+
+static int count_callback(void *data, const char *origdir, const char *fname)
+{
+    (*((int *) data))++;
+    return PHYSFS_ENUM_OK;
+} /* count_callback */
+
+static void bench_enumerate(const BenchFormat *fmt)
+{
+    const int reps = 50;
+    double start;
+    int count = 0;
+    int i;
+
+    start = now_seconds();
+    for (i = 0; i < reps; i++)
+        PHYSFS_enumerate("/", count_callback, &count);
+    report("enumerate", fmt->name, 1, count / (now_seconds() - start), "entries/s");
+} /* bench_enumerate */
+
+static void bench_sequential(const BenchFormat *fmt, PHYSFS_uint8 *buf)
+{
+    PHYSFS_uint64 total = 0;
+    PHYSFS_uint64 expected = 0;
+    double start;
+    int i;
+
+    start = now_seconds();
+    for (i = 0; i < numfiles; i++)
+        total += read_whole_file(file_name(fmt, i), buf, 64 * 1024);
+
+    for (i = 0; i < numfiles; i++)
+        expected += files[i].len;
+    if (total != expected)
+    {
+        fprintf(stderr, "physfs_bench: %s: read %.0f bytes, expected %.0f\n",
+                fmt->name, (double) total, (double) expected);
+        exit(1);
+    } /* if */
+    report("read_sequential", fmt->name, 1, (total / (1024.0 * 1024.0)) / (now_seconds() - start), "MB/s");
+} /* bench_sequential */
+
+static void bench_random(const BenchFormat *fmt, PHYSFS_uint8 *buf)
+{
+    const int chunk = 4096;
+    const int reps = opt_iterations / 4 + 1;
+    PHYSFS_uint32 seed = 2;
+    PHYSFS_uint64 total = 0;
+    PHYSFS_File *f;
+    double start;
+    int i;
+
+    f = PHYSFS_openRead(file_name(fmt, opt_files));
+    if (!f)
+        fail("openRead");
+
+    start = now_seconds();
+    for (i = 0; i < reps; i++)
+    {
+        const PHYSFS_uint64 pos = ((PHYSFS_uint64) rng(&seed) * 64) % (opt_bigsize - chunk);
+        PHYSFS_sint64 br;
+        if (!PHYSFS_seek(f, pos))
+            fail("seek");
+        br = PHYSFS_readBytes(f, buf, chunk);
+        if (br > 0)
+            total += (PHYSFS_uint64) br;
+    } /* for */
+    report("read_random_4k", fmt->name, 1, (total / (1024.0 * 1024.0)) / (now_seconds() - start), "MB/s");
+
+    /* seeking back and forth without reading much: what PHYSFS_seek costs. */
+    start = now_seconds();
+    for (i = 0; i < reps; i++)
+    {
+        const PHYSFS_uint64 pos = ((PHYSFS_uint64) rng(&seed) * 64) % opt_bigsize;
+        if (!PHYSFS_seek(f, pos))
+            fail("seek");
+        PHYSFS_readBytes(f, buf, 1);
+    } /* for */
+    report("seek", fmt->name, 1, ((now_seconds() - start) / reps) * 1000000.0, "us");
+
+    PHYSFS_close(f);
+} /* bench_random */
+
+
+typedef struct
+{
+    const BenchFormat *fmt;
+    PHYSFS_uint32 seed;
+    int reps;
+    PHYSFS_uint8 *buf;
+} ThreadWork;
+
+static void thread_worker(void *_work)
+{
+    ThreadWork *work = (ThreadWork *) _work;
+    int i;
+    for (i = 0; i < work->reps; i++)
+    {
+        const int idx = (int) (rng(&work->seed) % opt_files);
+        read_whole_file(file_name(work->fmt, idx), work->buf, 16 * 1024);
+    } /* for */
+} /* thread_worker */
+
+static void bench_threads(const BenchFormat *fmt)
+{
+    BenchThread threads[BENCH_MAX_THREADS];
+    ThreadWork work[BENCH_MAX_THREADS];
+    const int reps = opt_iterations / 8 + 1;
+    int nthreads;
+
+    for (nthreads = 1; nthreads <= opt_threads; nthreads *= 2)
+    {
+        double start;
+        int started = 0;
+        int i;
+
+        start = now_seconds();
+        for (i = 0; i < nthreads; i++)
+        {
+            work[i].fmt = fmt;
+            work[i].seed = (PHYSFS_uint32) (i + 1);
+            work[i].reps = reps;
+            work[i].buf = (PHYSFS_uint8 *) malloc(16 * 1024);
+            if (!work[i].buf)
+                fail("allocating a buffer");
+            if (!start_thread(&threads[i], thread_worker, &work[i]))
+                break;
+            started++;
+        } /* for */
+
+        for (i = 0; i < started; i++)
+            wait_thread(&threads[i]);
+
+        report("threads_open_read", fmt->name, started,
+               (started * reps) / (now_seconds() - start), "files/s");
+
+        for (i = 0; i < nthreads; i++)
+            free(work[i].buf);
+
+        if (started < nthreads)
+            break;  /* couldn't start them all; no point going bigger. */
+    } /* for */
+} /* bench_threads */
+
+
+static void bench_search_path(void)
+{
+    char name[64];
+    PHYSFS_uint32 seed = 3;
+    int indexed;
+    int i;
+
+    if (!archiver_available("ZIP"))
+        return;
+
+    for (i = 0; i < opt_mounts; i++)
+    {
+        char *path = real_path(search_mount_name(i));
+        if (!PHYSFS_mount(path, "/", 1))
+            fail(path);
+        free(path);
+    } /* for */
+
+    for (indexed = 0; indexed <= 1; indexed++)
+    {
+        const char *fmtname = indexed ? "zip-mounts-indexed" : "zip-mounts";
+        double start;
+
+        PHYSFS_setSearchPathIndexed(indexed);
+
+        /* files in the last archive: every other one is asked first. */
+        start = now_seconds();
+        for (i = 0; i < opt_iterations; i++)
+        {
+            PHYSFS_File *f;
+            sprintf(name, "m%03d/file%02d.txt", opt_mounts - 1, (int) (rng(&seed) % 16));
+            f = PHYSFS_openRead(name);
+            if (!f)
+                fail(name);
+            PHYSFS_close(f);
+        } /* for */
+        report("open_hit_last", fmtname, opt_mounts, ((now_seconds() - start) / opt_iterations) * 1000000000.0, "ns");
+
+        start = now_seconds();
+        for (i = 0; i < opt_iterations; i++)
+        {
+            sprintf(name, "m%03d/missing%02d.txt", (int) (rng(&seed) % opt_mounts), i % 100);
+            if (PHYSFS_openRead(name) != NULL)
+                fail("openRead of a missing file");
+        } /* for */
+        report("open_miss", fmtname, opt_mounts, ((now_seconds() - start) / opt_iterations) * 1000000000.0, "ns");
+    } /* for */
+
+    PHYSFS_setSearchPathIndexed(0);
+
+    for (i = 0; i < opt_mounts; i++)
+    {
+        char *path = real_path(search_mount_name(i));
+        PHYSFS_unmount(path);
+        free(path);
+    } /* for */
+} /* bench_search_path */
+
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+        "USAGE: %s [options]\n"
+        "  --dir NAME        data directory, under the current one (%s)\n"
+        "  --files N         small files per archive (%d)\n"
+        "  --filesize BYTES  biggest small file (%d)\n"
+        "  --bigsize BYTES   size of the big file in each archive (%d)\n"
+        "  --mounts N        archives for the search path bench (%d)\n"
+        "  --threads N       most threads for the scaling bench (%d)\n"
+        "  --iterations N    lookups/seeks per measurement (%d)\n"
+        "  --quick           small data, few iterations\n"
+        "  --keep            don't delete the generated data\n"
+        "\n"
+        "Output is CSV: benchmark,format,threads,value,unit\n",
+        argv0, opt_dir, opt_files, opt_filesize, opt_bigsize, opt_mounts,
+        opt_threads, opt_iterations);
+} /* usage */
+
+static int parse_args(int argc, char **argv)
+{
+    int i;
+    for (i = 1; i < argc; i++)
+    {
+        const char *arg = argv[i];
+        const int hasval = (i + 1 < argc);
+        if ((strcmp(arg, "--dir") == 0) && hasval)
+            opt_dir = argv[++i];
+        else if ((strcmp(arg, "--files") == 0) && hasval)
+            opt_files = atoi(argv[++i]);
+        else if ((strcmp(arg, "--filesize") == 0) && hasval)
+            opt_filesize = atoi(argv[++i]);
+        else if ((strcmp(arg, "--bigsize") == 0) && hasval)
+            opt_bigsize = atoi(argv[++i]);
+        else if ((strcmp(arg, "--mounts") == 0) && hasval)
+            opt_mounts = atoi(argv[++i]);
+        else if ((strcmp(arg, "--threads") == 0) && hasval)
+            opt_threads = atoi(argv[++i]);
+        else if ((strcmp(arg, "--iterations") == 0) && hasval)
+            opt_iterations = atoi(argv[++i]);
+        else if (strcmp(arg, "--keep") == 0)
+            opt_keep = 1;
+        else if (strcmp(arg, "--quick") == 0)
+        {
+            opt_files = 32;
+            opt_filesize = 16 * 1024;
+            opt_bigsize = 1024 * 1024;
+            opt_mounts = 8;
+            opt_threads = 4;
+            opt_iterations = 200;
+        } /* else if */
+        else
+        {
+            usage(argv[0]);
+            return 0;
+        } /* else */
+    } /* for */
+
+    if ((opt_files < 1) || (opt_files > 9999) || (opt_filesize < 1) ||
+        (opt_bigsize < 65536) || (opt_mounts < 1) || (opt_mounts > 999) ||
+        (opt_threads < 1) || (opt_iterations < 1) ||
+        (strlen(opt_dir) > 32) || (strchr(opt_dir, '/') != NULL))
+    {
+        usage(argv[0]);
+        return 0;
+    } /* if */
+
+    if (opt_threads > BENCH_MAX_THREADS)
+        opt_threads = BENCH_MAX_THREADS;
+
+    return 1;
+} /* parse_args */
+
+
+int main(int argc, char **argv)
+{
+    PHYSFS_uint8 *buf;
+    int i;
+
+    if (!parse_args(argc, argv))
+        return 2;
+
+    if (!PHYSFS_init(argv[0]))
+        fail("PHYSFS_init");
+
+    /* archives go under the current directory. */
+    if (!PHYSFS_setWriteDir("."))
+        fail("PHYSFS_setWriteDir");
+
+    crc32_init();
+    make_files();
+    generate_data();
+
+    buf = (PHYSFS_uint8 *) malloc(64 * 1024);
+    if (!buf)
+        fail("allocating a buffer");
+
+    printf("benchmark,format,threads,value,unit\n");
+
+    for (i = 0; i < NUM_FORMATS; i++)
+    {
+        const BenchFormat *fmt = &formats[i];
+        if (!fmt->available)
+            continue;
+
+        bench_mount(fmt);
+        mount_format(fmt);
+        bench_open(fmt);
+        bench_enumerate(fmt);
+        bench_sequential(fmt, buf);
+        bench_random(fmt, buf);
+        bench_threads(fmt);
+        unmount_format(fmt);
+    } /* for */
+
+    bench_search_path();
+
+    free(buf);
+
+    if (!opt_keep)
+        remove_data();
+
+    for (i = 0; i < numfiles; i++)
+        free(files[i].data);
+    free(files);
+    free(datadir);
+
+    PHYSFS_deinit();
+    return 0;
+} /* main */
+
+/* end of physfs_bench.c ... */
@@ -0,0 +1,1591 @@
+/**
+ * Regression tests for PhysicsFS.
+ *
+ * Each test builds the archives it needs in a scratch directory under the
+ *  current one, runs against them, and cleans up again if it passes. Run
+ *  with the name of a test, or no arguments to run them all; CMake hands
+ *  each one to ctest separately. The exit status is zero if everything
+ *  passed.
+ *
+ * Please see the file LICENSE.txt in the source's root directory.
+ */
+
+#define _CRT_SECURE_NO_WARNINGS 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN 1
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+#include "physfs.h"
+
+
+/* checking ... */
+
+static const char *argv0 = NULL;  /* for tests that restart PhysicsFS. */
+static const char *current_test = NULL;
+
+static int check_failed(int line, const char *what)
+{
+    fprintf(stderr, "physfs_regress: %s: line %d: %s failed (last error: %s)\n",
+            current_test, line, what,
+            PHYSFS_getErrorByCode(PHYSFS_getLastErrorCode()));
+    return 0;
+} /* check_failed */
+
+/* PHYSFS_deinit() closes whatever a failed test leaves open. */
+#define CHECK(x) do { if (!(x)) return check_failed(__LINE__, #x); } while (0)
+
+
+/* threads ... */
+
+#ifdef _WIN32
+typedef HANDLE regress_thread;
+#else
+typedef pthread_t regress_thread;
+#endif
+
+typedef struct
+{
+    void (*fn)(void *);
+    void *data;
+    regress_thread thread;
+} RegressThread;
+
+#ifdef _WIN32
+static DWORD WINAPI win32_thread_entry(LPVOID arg)
+{
+    RegressThread *t = (RegressThread *) arg;
+    t->fn(t->data);
+    return 0;
+} /* win32_thread_entry */
+#else
+static void *pthread_entry(void *arg)
+{
+    RegressThread *t = (RegressThread *) arg;
+    t->fn(t->data);
+    return NULL;
+} /* pthread_entry */
+#endif
+
+static int start_thread(RegressThread *t, void (*fn)(void *), void *data)
+{
+    t->fn = fn;
+    t->data = data;
+#ifdef _WIN32
+    t->thread = CreateThread(NULL, 0, win32_thread_entry, t, 0, NULL);
+    return (t->thread != NULL);
+#else
+    return (pthread_create(&t->thread, NULL, pthread_entry, t) == 0);
+#endif
+} /* start_thread */
+
+static void wait_thread(RegressThread *t)
+{
+#ifdef _WIN32
+    WaitForSingleObject(t->thread, INFINITE);
+    CloseHandle(t->thread);
+#else
+    pthread_join(t->thread, NULL);
+#endif
+} /* wait_thread */
+
+
+/* building archives ... */
+
+typedef struct
+{
+    PHYSFS_uint8 *data;
+    size_t len;
+    size_t alloc;
+} Buffer;
+
+static void buf_append(Buffer *b, const void *data, size_t len)
+{
+    if (len == 0)
+        return;  /* (data) might be NULL. */
+    else if (b->len + len > b->alloc)
+    {
+        size_t newalloc = b->alloc ? b->alloc : 4096;
+        while (newalloc < b->len + len)
+            newalloc *= 2;
+        b->data = (PHYSFS_uint8 *) realloc(b->data, newalloc);
+        if (!b->data)
+        {
+            fprintf(stderr, "physfs_regress: out of memory\n");
+            exit(1);
+        } /* if */
+        b->alloc = newalloc;
+    } /* if */
+    memcpy(b->data + b->len, data, len);
+    b->len += len;
+} /* buf_append */
+
+static void buf_le16(Buffer *b, PHYSFS_uint32 v)
+{
+    PHYSFS_uint8 x[2];
+    x[0] = (PHYSFS_uint8) (v & 0xFF);
+    x[1] = (PHYSFS_uint8) ((v >> 8) & 0xFF);
+    buf_append(b, x, sizeof (x));
+} /* buf_le16 */
+
+static void buf_le32(Buffer *b, PHYSFS_uint32 v)
+{
+    buf_le16(b, v & 0xFFFF);
+    buf_le16(b, (v >> 16) & 0xFFFF);
+} /* buf_le32 */
+
+static PHYSFS_uint32 crc32(const PHYSFS_uint8 *buf, size_t len)
+{
+    PHYSFS_uint32 crc = 0xFFFFFFFF;
+    while (len--)
+    {
+        int i;
+        crc ^= *(buf++);
+        for (i = 0; i < 8; i++)
+            crc = (crc & 1) ? (0xEDB88320 ^ (crc >> 1)) : (crc >> 1);
+    } /* while */
+    return crc ^ 0xFFFFFFFF;
+} /* crc32 */
+
+/* text-ish data that's different for every seed. */
+static PHYSFS_uint8 *make_data(size_t len, PHYSFS_uint32 seed)
+{
+    PHYSFS_uint8 *retval = (PHYSFS_uint8 *) malloc(len ? len : 1);
+    size_t i;
+    if (!retval)
+    {
+        fprintf(stderr, "physfs_regress: out of memory\n");
+        exit(1);
+    } /* if */
+    for (i = 0; i < len; i++)
+    {
+        seed = (seed * 1103515245) + 12345;
+        retval[i] = (PHYSFS_uint8) ('a' + ((seed >> 16) % 26));
+    } /* for */
+    return retval;
+} /* make_data */
+
+typedef struct
+{
+    const char *name;
+    const PHYSFS_uint8 *data;
+    size_t len;
+    int deflate;  /* as uncompressed deflate blocks; the inflater can't tell. */
+    PHYSFS_uint32 crcxor;  /* nonzero to store a wrong crc. */
+} RegressFile;
+
+static void build_zip(Buffer *b, const RegressFile *list, int count)
+{
+    PHYSFS_uint32 *offsets = (PHYSFS_uint32 *) malloc(sizeof (PHYSFS_uint32) * count);
+    PHYSFS_uint32 *complens = (PHYSFS_uint32 *) malloc(sizeof (PHYSFS_uint32) * count);
+    PHYSFS_uint32 cdstart, cdlen;
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const RegressFile *f = &list[i];
+        const size_t namelen = strlen(f->name);
+        Buffer comp;
+
+        memset(&comp, '\0', sizeof (comp));
+        if (!f->deflate)
+            buf_append(&comp, f->data, f->len);
+        else
+        {
+            size_t pos = 0;
+            do
+            {
+                const size_t chunk = ((f->len - pos) < 65535) ? (f->len - pos) : 65535;
+                const PHYSFS_uint8 final = (pos + chunk == f->len) ? 1 : 0;
+                buf_append(&comp, &final, 1);
+                buf_le16(&comp, (PHYSFS_uint32) chunk);
+                buf_le16(&comp, (PHYSFS_uint32) (chunk ^ 0xFFFF));
+                buf_append(&comp, f->data + pos, chunk);
+                pos += chunk;
+            } while (pos < f->len);
+        } /* else */
+
+        offsets[i] = (PHYSFS_uint32) b->len;
+        complens[i] = (PHYSFS_uint32) comp.len;
+
+        buf_le32(b, 0x04034b50);
+        buf_le16(b, 20);
+        buf_le16(b, 0);
+        buf_le16(b, f->deflate ? 8 : 0);
+        buf_le16(b, 0);  /* mod time */
+        buf_le16(b, 0x21);  /* mod date */
+        buf_le32(b, crc32(f->data, f->len) ^ f->crcxor);
+        buf_le32(b, complens[i]);
+        buf_le32(b, (PHYSFS_uint32) f->len);
+        buf_le16(b, (PHYSFS_uint32) namelen);
+        buf_le16(b, 0);
+        buf_append(b, f->name, namelen);
+        buf_append(b, comp.data, comp.len);
+        free(comp.data);
+    } /* for */
+
+    cdstart = (PHYSFS_uint32) b->len;
+    for (i = 0; i < count; i++)
+    {
+        const RegressFile *f = &list[i];
+        const size_t namelen = strlen(f->name);
+
+        buf_le32(b, 0x02014b50);
+        buf_le16(b, 20);
+        buf_le16(b, 20);
+        buf_le16(b, 0);
+        buf_le16(b, f->deflate ? 8 : 0);
+        buf_le16(b, 0);
+        buf_le16(b, 0x21);
+        buf_le32(b, crc32(f->data, f->len) ^ f->crcxor);
+        buf_le32(b, complens[i]);
+        buf_le32(b, (PHYSFS_uint32) f->len);
+        buf_le16(b, (PHYSFS_uint32) namelen);
+        buf_le16(b, 0);
+        buf_le16(b, 0);  /* comment */
+        buf_le16(b, 0);  /* disk */
+        buf_le16(b, 0);  /* internal attr */
+        buf_le32(b, 0);  /* external attr */
+        buf_le32(b, offsets[i]);
+        buf_append(b, f->name, namelen);
+    } /* for */
+    cdlen = ((PHYSFS_uint32) b->len) - cdstart;
+
+    buf_le32(b, 0x06054b50);
+    buf_le16(b, 0);
+    buf_le16(b, 0);
+    buf_le16(b, (PHYSFS_uint32) count);
+    buf_le16(b, (PHYSFS_uint32) count);
+    buf_le32(b, cdlen);
+    buf_le32(b, cdstart);
+    buf_le16(b, 0);
+
+    free(offsets);
+    free(complens);
+} /* build_zip */
+
+
+/* the scratch directory ... */
+
+static char datadir_name[64];  /* relative to the write dir. */
+static char *datadir = NULL;  /* real path, with a dirsep. */
+
+/* real path of (name) in the scratch dir; free() it. */
+static char *real_path(const char *name)
+{
+    char *retval = (char *) malloc(strlen(datadir) + strlen(name) + 1);
+    if (!retval)
+    {
+        fprintf(stderr, "physfs_regress: out of memory\n");
+        exit(1);
+    } /* if */
+    sprintf(retval, "%s%s", datadir, name);
+    return retval;
+} /* real_path */
+
+static int write_file(const char *name, const void *data, size_t len)
+{
+    char path[256];
+    PHYSFS_File *f;
+    int retval;
+
+    sprintf(path, "%s/%s", datadir_name, name);
+    f = PHYSFS_openWrite(path);
+    if (!f)
+        return 0;
+    retval = (PHYSFS_writeBytes(f, data, len) == (PHYSFS_sint64) len);
+    return PHYSFS_close(f) && retval;
+} /* write_file */
+
+static int write_zip(const char *name, const RegressFile *list, int count)
+{
+    Buffer b;
+    int retval;
+    memset(&b, '\0', sizeof (b));
+    build_zip(&b, list, count);
+    retval = write_file(name, b.data, b.len);
+    free(b.data);
+    return retval;
+} /* write_zip */
+
+/* delete everything in the scratch dir under (dir), through a mount of it. */
+static void remove_contents(const char *dir)
+{
+    char **list;
+    char **i;
+    char path[320];
+
+    sprintf(path, "/.regress_cleanup%s%s", (*dir) ? "/" : "", dir);
+    list = PHYSFS_enumerateFiles(path);
+    for (i = list; (i != NULL) && (*i != NULL); i++)
+    {
+        PHYSFS_Stat st;
+        char sub[256];
+        if ((strlen(dir) + strlen(*i) + 2) > sizeof (sub))
+            continue;  /* we don't make anything like that. */
+        sprintf(sub, "%s%s%s", dir, (*dir) ? "/" : "", *i);
+        sprintf(path, "/.regress_cleanup/%s", sub);
+        if (PHYSFS_stat(path, &st) && (st.filetype == PHYSFS_FILETYPE_DIRECTORY))
+            remove_contents(sub);
+        sprintf(path, "%s/%s", datadir_name, sub);
+        PHYSFS_delete(path);
+    } /* for */
+    PHYSFS_freeList(list);
+} /* remove_contents */
+
+static void remove_data(int all)
+{
+    char *path = real_path("");
+    if (PHYSFS_mount(path, "/.regress_cleanup", 0))
+    {
+        remove_contents("");
+        PHYSFS_unmount(path);
+    } /* if */
+    free(path);
+    if (all)
+        PHYSFS_delete(datadir_name);
+} /* remove_data */
+
+static int make_datadir(const char *name)
+{
+    const char *sep = PHYSFS_getDirSeparator();
+    const char *base;
+
+    if (!PHYSFS_setWriteDir("."))  /* scratch dirs go under the current one. */
+        return 0;
+
+    base = PHYSFS_getWriteDir();
+    sprintf(datadir_name, "regress_%s", name);
+    if (!PHYSFS_mkdir(datadir_name))
+        return 0;
+
+    datadir = (char *) malloc(strlen(base) + strlen(datadir_name) + (strlen(sep) * 2) + 1);
+    if (!datadir)
+        return 0;
+    sprintf(datadir, "%s%s%s%s", base, sep, datadir_name, sep);
+    remove_data(0);  /* anything left from a run that failed. */
+    return 1;
+} /* make_datadir */
+
+static int read_all(const char *fname, PHYSFS_uint8 *buf, size_t buflen,
+                    PHYSFS_sint64 *len)
+{
+    PHYSFS_File *f = PHYSFS_openRead(fname);
+    if (!f)
+        return 0;
+    *len = PHYSFS_readBytes(f, buf, buflen);
+    PHYSFS_close(f);
+    return 1;
+} /* read_all */
+
+
+/* all of (fname) from the search path, in a buffer to free(). */
+static PHYSFS_uint8 *load_file(const char *fname, size_t *len)
+{
+    PHYSFS_File *f = PHYSFS_openRead(fname);
+    PHYSFS_sint64 flen = f ? PHYSFS_fileLength(f) : -1;
+    PHYSFS_uint8 *retval = NULL;
+
+    if (flen >= 0)
+    {
+        retval = (PHYSFS_uint8 *) malloc((size_t) flen + 1);
+        if (retval && (PHYSFS_readBytes(f, retval, (PHYSFS_uint64) flen) != flen))
+        {
+            free(retval);
+            retval = NULL;
+        } /* if */
+        *len = (size_t) flen;
+    } /* if */
+
+    if (f)
+        PHYSFS_close(f);
+    return retval;
+} /* load_file */
+
+
+/* the tests ... */
+
+/* PHYSFS_setVerifyChecksums(), with a zip that has the wrong crc stored. */
+static int test_checksum(void)
+{
+    PHYSFS_uint8 *stored = make_data(100 * 1024, 1);
+    PHYSFS_uint8 *small = make_data(600, 2);
+    PHYSFS_uint8 *big = make_data(200 * 1024, 3);  /* too big to cache. */
+    PHYSFS_uint8 *buf = (PHYSFS_uint8 *) malloc(256 * 1024);
+    RegressFile files[3];
+    PHYSFS_File *f;
+    PHYSFS_sint64 br;
+    PHYSFS_sint64 oshandle;
+    PHYSFS_uint64 offset, len;
+    PHYSFS_AsyncRead *req;
+    const void *ptr;
+    char *good, *bad;
+    int i;
+
+    files[0].name = "stored.bin"; files[0].data = stored; files[0].len = 100 * 1024;
+    files[1].name = "small.txt"; files[1].data = small; files[1].len = 600;
+    files[2].name = "big.txt"; files[2].data = big; files[2].len = 200 * 1024;
+    for (i = 0; i < 3; i++)
+    {
+        files[i].deflate = (i != 0);
+        files[i].crcxor = 0;
+    } /* for */
+    CHECK(write_zip("good.zip", files, 3));
+    for (i = 0; i < 3; i++)
+        files[i].crcxor = 0x1;
+    CHECK(write_zip("bad.zip", files, 3));
+
+    good = real_path("good.zip");
+    bad = real_path("bad.zip");
+    CHECK(buf != NULL);
+
+    /* off by default: a bad crc goes unnoticed. */
+    CHECK(!PHYSFS_isVerifyingChecksums());
+    CHECK(PHYSFS_mount(bad, NULL, 1));
+    CHECK(read_all("small.txt", buf, 256 * 1024, &br) && (br == 600));  /* cached now. */
+    CHECK(read_all("big.txt", buf, 256 * 1024, &br) && (br == 200 * 1024));
+    ptr = PHYSFS_mapFile("stored.bin", &len);
+    CHECK((ptr != NULL) && (len == 100 * 1024));
+    CHECK(PHYSFS_unmapFile(ptr));
+
+    PHYSFS_setVerifyChecksums(1);
+    CHECK(PHYSFS_isVerifyingChecksums());
+
+    /* the read that reaches the end fails, and so does every one after. */
+    CHECK((f = PHYSFS_openRead("big.txt")) != NULL);
+    CHECK(PHYSFS_readBytes(f, buf, 256 * 1024) == -1);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_CORRUPT);
+    CHECK(PHYSFS_readBytes(f, buf, 16) == -1);
+    CHECK(PHYSFS_seek(f, 0));
+    CHECK(PHYSFS_readBytes(f, buf, 16) == -1);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_CORRUPT);
+    CHECK(PHYSFS_close(f));
+
+    CHECK((f = PHYSFS_openRead("stored.bin")) != NULL);
+    CHECK(PHYSFS_readBytes(f, buf, 256 * 1024) == -1);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_CORRUPT);
+    CHECK(PHYSFS_close(f));
+
+    /* a gap turns the check off, but going back to the start turns it on. */
+    CHECK((f = PHYSFS_openRead("stored.bin")) != NULL);
+    CHECK(PHYSFS_seek(f, 50 * 1024));
+    CHECK(PHYSFS_readBytes(f, buf, 256 * 1024) == 50 * 1024);
+    CHECK(PHYSFS_seek(f, 0));
+    CHECK(PHYSFS_readBytes(f, buf, 256 * 1024) == -1);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_CORRUPT);
+    CHECK(PHYSFS_close(f));
+
+    /* small ones are decompressed when opened, even from the cache. */
+    CHECK(PHYSFS_openRead("small.txt") == NULL);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_CORRUPT);
+
+    /* and calls that hand out the data without a read check it first. */
+    CHECK(PHYSFS_mapFile("stored.bin", &len) == NULL);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_CORRUPT);
+    CHECK((f = PHYSFS_openRead("stored.bin")) != NULL);
+    CHECK(!PHYSFS_getNativeRange(f, &oshandle, &offset, &len));
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_CORRUPT);
+    CHECK((req = PHYSFS_readBytesAsync(f, 0, buf, 100 * 1024, NULL, NULL)) != NULL);
+    CHECK(PHYSFS_waitAsyncRead(req) == -1);
+    CHECK(PHYSFS_close(f));
+    CHECK(PHYSFS_unmount(bad));
+
+    /* good crcs pass everywhere, more than once. */
+    CHECK(PHYSFS_mount(good, NULL, 1));
+    for (i = 0; i < 2; i++)
+    {
+        CHECK(read_all("small.txt", buf, 256 * 1024, &br) && (br == 600));
+        CHECK(memcmp(buf, small, 600) == 0);
+        CHECK(read_all("big.txt", buf, 256 * 1024, &br) && (br == 200 * 1024));
+        CHECK(memcmp(buf, big, 200 * 1024) == 0);
+        ptr = PHYSFS_mapFile("stored.bin", &len);
+        CHECK((ptr != NULL) && (len == 100 * 1024));
+        CHECK(memcmp(ptr, stored, 100 * 1024) == 0);
+        CHECK(PHYSFS_unmapFile(ptr));
+        CHECK((f = PHYSFS_openRead("stored.bin")) != NULL);
+        CHECK(PHYSFS_getNativeRange(f, &oshandle, &offset, &len));
+        CHECK(len == 100 * 1024);
+        CHECK(PHYSFS_close(f));
+    } /* for */
+    CHECK(PHYSFS_unmount(good));
+
+    free(good);
+    free(bad);
+    free(buf);
+    free(stored);
+    free(small);
+    free(big);
+    return 1;
+} /* test_checksum */
+
+
+/* replace every (from) in (buf) with (to), which is as long. */
+static int replace_bytes(PHYSFS_uint8 *buf, size_t len, const char *from,
+                         const char *to)
+{
+    const size_t slen = strlen(from);
+    int retval = 0;
+    size_t i;
+    for (i = 0; (i + slen) <= len; i++)
+    {
+        if (memcmp(buf + i, from, slen) == 0)
+        {
+            memcpy(buf + i, to, slen);
+            retval++;
+        } /* if */
+    } /* for */
+    return retval;
+} /* replace_bytes */
+
+/* how many files the mount index dir (mounted at /idx) holds; (*name) gets the last. */
+static int count_indexes(char *name)
+{
+    char **list = PHYSFS_enumerateFiles("/idx");
+    char **i;
+    int retval = 0;
+    for (i = list; (i != NULL) && (*i != NULL); i++, retval++)
+        sprintf(name, "%.63s", *i);
+    PHYSFS_freeList(list);
+    return retval;
+} /* count_indexes */
+
+/*
+ * PHYSFS_setMountIndexDir(): the index is saved and then used, and ignored
+ *  when the archive changes or is mounted from somewhere else. To tell an
+ *  index that was used from one that was quietly rewritten, this renames an
+ *  entry in the index file; only a mount that loaded it sees the new name.
+ */
+static int test_mountindex(void)
+{
+    PHYSFS_uint8 *a = make_data(5000, 10);
+    PHYSFS_uint8 *b = make_data(90000, 11);
+    PHYSFS_uint8 *idx;
+    PHYSFS_uint8 buf[8];
+    RegressFile files[3];
+    char name[64];
+    char arcidx[64];  /* arc.zip's index; it's named for the path. */
+    char path[256];
+    char *arc, *moved, *indexdir;
+    size_t len;
+    PHYSFS_uint8 *data;
+    PHYSFS_sint64 br;
+
+    files[0].name = "file_a.txt"; files[0].data = a; files[0].len = 5000;
+    files[1].name = "dir/file_b.txt"; files[1].data = b; files[1].len = 90000;
+    files[2].name = "file_c.txt"; files[2].data = a; files[2].len = 100;
+    files[0].deflate = 0; files[1].deflate = 1; files[2].deflate = 0;
+    files[0].crcxor = files[1].crcxor = files[2].crcxor = 0;
+    CHECK(write_zip("arc.zip", files, 2));
+
+    sprintf(path, "%s/index", datadir_name);
+    CHECK(PHYSFS_mkdir(path));
+    arc = real_path("arc.zip");
+    moved = real_path("moved.zip");
+    indexdir = real_path("index");
+
+    CHECK(PHYSFS_getMountIndexDir() == NULL);
+    CHECK(PHYSFS_setMountIndexDir(indexdir));
+    CHECK(strcmp(PHYSFS_getMountIndexDir(), indexdir) == 0);
+    CHECK(PHYSFS_mount(indexdir, "/idx", 1));
+
+    /* the first mount parses the archive and saves an index. */
+    CHECK(count_indexes(name) == 0);
+    CHECK(PHYSFS_mount(arc, NULL, 1));
+    CHECK(PHYSFS_exists("dir/file_b.txt"));
+    CHECK(PHYSFS_unmount(arc));
+    CHECK(count_indexes(arcidx) == 1);
+
+    /* the next one loads it. */
+    sprintf(path, "/idx/%s", arcidx);
+    CHECK((idx = load_file(path, &len)) != NULL);
+    CHECK(replace_bytes(idx, len, "file_a.txt", "file_q.txt") == 1);
+    sprintf(path, "index/%s", arcidx);
+    CHECK(write_file(path, idx, len));
+    CHECK(PHYSFS_mount(arc, NULL, 1));
+    CHECK(PHYSFS_exists("file_q.txt"));
+    CHECK(!PHYSFS_exists("file_a.txt"));
+    CHECK((data = load_file("file_q.txt", &len)) != NULL);
+    CHECK((len == 5000) && (memcmp(data, a, 5000) == 0));
+    free(data);
+    CHECK((data = load_file("dir/file_b.txt", &len)) != NULL);
+    CHECK((len == 90000) && (memcmp(data, b, 90000) == 0));
+    free(data);
+    CHECK(PHYSFS_unmount(arc));
+
+    /* a copy somewhere else has its own index, and doesn't use that one. */
+    CHECK(PHYSFS_mount(datadir, "/data", 1));
+    CHECK((data = load_file("/data/arc.zip", &len)) != NULL);
+    CHECK(write_file("moved.zip", data, len));
+    free(data);
+    CHECK(PHYSFS_mount(moved, NULL, 1));
+    CHECK(PHYSFS_exists("file_a.txt"));
+    CHECK(!PHYSFS_exists("file_q.txt"));
+    CHECK(PHYSFS_unmount(moved));
+    CHECK(count_indexes(name) == 2);
+
+    /* an archive that changed since is parsed again, and reindexed, even
+       with someone else's save of the same index in progress. */
+    CHECK(write_zip("arc.zip", files, 3));
+    sprintf(path, "index/%s.tmp0", arcidx);
+    CHECK(write_file(path, "busy", 4));
+    CHECK(PHYSFS_mount(arc, NULL, 1));
+    CHECK(PHYSFS_exists("file_a.txt"));
+    CHECK(PHYSFS_exists("file_c.txt"));
+    CHECK(!PHYSFS_exists("file_q.txt"));
+    CHECK(PHYSFS_unmount(arc));
+    CHECK(count_indexes(name) == 3);
+    sprintf(path, "/idx/%s.tmp0", arcidx);
+    CHECK(read_all(path, buf, sizeof (buf), &br) && (br == 4));
+    CHECK(memcmp(buf, "busy", 4) == 0);  /* left alone. */
+    sprintf(path, "%s/index/%s.tmp0", datadir_name, arcidx);
+    CHECK(PHYSFS_delete(path));
+    CHECK(count_indexes(name) == 2);
+
+    /* and a damaged index is ignored. */
+    free(idx);
+    sprintf(path, "/idx/%s", arcidx);
+    CHECK((idx = load_file(path, &len)) != NULL);
+    CHECK(replace_bytes(idx, len, "file_c.txt", "file_q.txt") == 1);  /* rewritten. */
+    sprintf(path, "index/%s", arcidx);
+    CHECK(write_file(path, idx, len / 2));
+    CHECK(PHYSFS_mount(arc, NULL, 1));
+    CHECK(PHYSFS_exists("file_a.txt"));
+    CHECK(!PHYSFS_exists("file_q.txt"));
+    CHECK(read_all("file_c.txt", buf, sizeof (buf), &br) && (br == 8));
+    CHECK(memcmp(buf, a, 8) == 0);
+    CHECK(PHYSFS_unmount(arc));
+
+    CHECK(PHYSFS_setMountIndexDir(NULL));
+    CHECK(PHYSFS_getMountIndexDir() == NULL);
+
+    free(idx);
+    free(arc);
+    free(moved);
+    free(indexdir);
+    free(a);
+    free(b);
+    return 1;
+} /* test_mountindex */
+
+
+#define ASYNC_FILESIZE 280000
+#define ASYNC_READS 32
+#define ASYNC_STRIDE 9000
+#define ASYNC_READLEN 12000
+
+typedef struct
+{
+    void *buffer;
+    PHYSFS_sint64 result;
+    int calls;
+    int wrongbuf;
+} AsyncSlot;
+
+/* each request gets its own slot, so callbacks on any thread are fine. */
+static void async_callback(void *data, PHYSFS_AsyncRead *req, void *buffer,
+                           PHYSFS_sint64 result)
+{
+    AsyncSlot *slot = (AsyncSlot *) data;
+    (void) req;
+    slot->wrongbuf |= (buffer != slot->buffer);
+    slot->result = result;
+    slot->calls++;
+} /* async_callback */
+
+/* lots of overlapping async reads of (fname) at once, some past the end. */
+static int async_reads(const char *fname, const PHYSFS_uint8 *expect,
+                       PHYSFS_uint8 *bufs, int close_early)
+{
+    PHYSFS_AsyncRead *reqs[ASYNC_READS];
+    AsyncSlot slots[ASYNC_READS];
+    PHYSFS_File *f;
+    int i;
+
+    CHECK((f = PHYSFS_openRead(fname)) != NULL);
+    memset(slots, '\0', sizeof (slots));
+    for (i = 0; i < ASYNC_READS; i++)
+    {
+        slots[i].buffer = bufs + (i * ASYNC_READLEN);
+        reqs[i] = PHYSFS_readBytesAsync(f, (PHYSFS_uint64) i * ASYNC_STRIDE,
+                                        slots[i].buffer, ASYNC_READLEN,
+                                        async_callback, &slots[i]);
+        CHECK(reqs[i] != NULL);
+    } /* for */
+
+    /* the reads don't use the handle's position, or need it open. */
+    if (close_early)
+        CHECK(PHYSFS_close(f));
+    else
+    {
+        PHYSFS_uint8 first[16];
+        CHECK(PHYSFS_readBytes(f, first, sizeof (first)) == sizeof (first));
+        CHECK(memcmp(first, expect, sizeof (first)) == 0);
+        CHECK(PHYSFS_tell(f) == sizeof (first));
+    } /* else */
+
+    for (i = 0; i < ASYNC_READS; i++)
+    {
+        const PHYSFS_uint64 ofs = (PHYSFS_uint64) i * ASYNC_STRIDE;
+        const PHYSFS_uint64 avail = (ofs < ASYNC_FILESIZE) ? (ASYNC_FILESIZE - ofs) : 0;
+        const PHYSFS_sint64 want = (PHYSFS_sint64) ((avail < ASYNC_READLEN) ? avail : ASYNC_READLEN);
+
+        if (i & 1)  /* poll some of them, wait on the rest. */
+        {
+            while (!PHYSFS_isAsyncReadDone(reqs[i])) { /* spin */ }
+            CHECK(slots[i].calls == 1);  /* done means the callback returned. */
+        } /* if */
+
+        CHECK(PHYSFS_waitAsyncRead(reqs[i]) == want);
+        CHECK(slots[i].calls == 1);
+        CHECK(slots[i].result == want);
+        CHECK(!slots[i].wrongbuf);
+        CHECK(memcmp(slots[i].buffer, expect + ofs, (size_t) want) == 0);
+    } /* for */
+
+    if (!close_early)
+        CHECK(PHYSFS_close(f));
+    return 1;
+} /* async_reads */
+
+/* PHYSFS_readBytesAsync() from a plain file, a stored zip entry and a deflated one. */
+static int test_async(void)
+{
+    PHYSFS_uint8 *data = make_data(ASYNC_FILESIZE, 20);
+    PHYSFS_uint8 *bufs = (PHYSFS_uint8 *) malloc(ASYNC_READS * ASYNC_READLEN);
+    static const char *names[] = {
+        "/native/plain.bin", "stored.bin", "deflated.bin"
+    };
+    PHYSFS_AsyncRead *req;
+    PHYSFS_File *f;
+    RegressFile files[2];
+    char *arc;
+    int i;
+
+    CHECK(bufs != NULL);
+    files[0].name = "stored.bin"; files[0].deflate = 0;
+    files[1].name = "deflated.bin"; files[1].deflate = 1;
+    for (i = 0; i < 2; i++)
+    {
+        files[i].data = data;
+        files[i].len = ASYNC_FILESIZE;
+        files[i].crcxor = 0;
+    } /* for */
+    CHECK(write_zip("async.zip", files, 2));
+    CHECK(write_file("plain.bin", data, ASYNC_FILESIZE));
+
+    arc = real_path("async.zip");
+    CHECK(PHYSFS_mount(arc, NULL, 1));
+    CHECK(PHYSFS_mount(datadir, "/native", 1));
+
+    for (i = 0; i < 3; i++)
+    {
+        CHECK(async_reads(names[i], data, bufs, 0));
+        CHECK(async_reads(names[i], data, bufs, 1));
+    } /* for */
+
+    /* a read that starts at the end gets nothing, like PHYSFS_readBytes(). */
+    CHECK((f = PHYSFS_openRead("stored.bin")) != NULL);
+    CHECK((req = PHYSFS_readBytesAsync(f, ASYNC_FILESIZE, bufs, 16, NULL, NULL)) != NULL);
+    CHECK(PHYSFS_waitAsyncRead(req) == 0);
+    CHECK(PHYSFS_close(f));
+
+    /* everything has to be waited on before this. */
+    CHECK(PHYSFS_unmount(arc));
+
+    free(arc);
+    free(bufs);
+    free(data);
+    return 1;
+} /* test_async */
+
+
+#define PRELOAD_FILES 6
+#define PRELOAD_FILESIZE (1024 * 1024)
+
+static int preload_check_files(const RegressFile *files)
+{
+    int i;
+    for (i = 0; i < PRELOAD_FILES; i++)
+    {
+        size_t len;
+        PHYSFS_uint8 *data = load_file(files[i].name, &len);
+        CHECK(data != NULL);
+        CHECK((len == files[i].len) && (memcmp(data, files[i].data, len) == 0));
+        free(data);
+    } /* for */
+    return 1;
+} /* preload_check_files */
+
+/*
+ * PHYSFS_mountPreload(). There's no telling from outside when a preload is
+ *  done, so this checks that files read right while it runs and after, and
+ *  that unmounting or shutting down in the middle of one is safe.
+ */
+static int test_preload(void)
+{
+    static const char *names[PRELOAD_FILES] = {
+        "ui/a.bin", "ui/b.bin", "ui/c.bin", "d.txt", "e.txt", "f.txt"
+    };
+    RegressFile files[PRELOAD_FILES];
+    PHYSFS_File *f;
+    char *arc, *missing;
+    int i, pass;
+
+    for (i = 0; i < PRELOAD_FILES; i++)
+    {
+        files[i].name = names[i];
+        files[i].len = PRELOAD_FILESIZE - (i * 1000);
+        files[i].data = make_data(files[i].len, 30 + i);
+        files[i].deflate = (i >= 3);
+        files[i].crcxor = 0;
+    } /* for */
+    CHECK(write_zip("preload.zip", files, PRELOAD_FILES));
+    CHECK(write_file("plain.txt", files[0].data, 100));
+    arc = real_path("preload.zip");
+    missing = real_path("missing.zip");
+
+    for (pass = 0; pass < 2; pass++)
+    {
+        PHYSFS_setMapArchives(pass);  /* copied into RAM, or a locked mapping. */
+        CHECK(PHYSFS_isMappingArchives() == pass);
+
+        /* files opened before and during the preload read the same. */
+        CHECK(PHYSFS_mountPreload(arc, "/", 1));
+        CHECK((f = PHYSFS_openRead(names[0])) != NULL);
+        CHECK(preload_check_files(files));
+        CHECK(PHYSFS_mountPreload(arc, "/", 1));  /* already there: no-op. */
+        CHECK(preload_check_files(files));
+
+        /* open files keep it mounted, preload or not. */
+        CHECK(!PHYSFS_unmount(arc));
+        CHECK(PHYSFS_close(f));
+        CHECK(PHYSFS_unmount(arc));
+        CHECK(!PHYSFS_exists(names[0]));
+
+        /* unmount right away, while it's surely still going. */
+        CHECK(PHYSFS_mountPreload(arc, "/", 1));
+        CHECK(PHYSFS_unmount(arc));
+        CHECK(PHYSFS_mountPreload(arc, "/again", 1));
+        CHECK(PHYSFS_exists("/again/ui/c.bin"));
+        CHECK(PHYSFS_unmount(arc));
+    } /* for */
+
+    /* directories just mount; a missing archive fails like PHYSFS_mount(). */
+    CHECK(PHYSFS_mountPreload(datadir, "/dir", 1));
+    CHECK(PHYSFS_exists("/dir/plain.txt"));
+    CHECK(PHYSFS_unmount(datadir));
+    CHECK(!PHYSFS_mountPreload(missing, "/", 1));
+
+    /* shutting down abandons a preload in progress. */
+    CHECK(PHYSFS_mountPreload(arc, "/", 1));
+    CHECK((f = PHYSFS_openRead(names[5])) != NULL);
+    CHECK(PHYSFS_deinit());
+    CHECK(PHYSFS_init(argv0));
+    CHECK(PHYSFS_setWriteDir("."));
+    CHECK(PHYSFS_mountPreload(arc, "/", 1));
+    CHECK(preload_check_files(files));
+
+    for (i = 0; i < PRELOAD_FILES; i++)
+        free((void *) files[i].data);
+    free(arc);
+    free(missing);
+    return 1;
+} /* test_preload */
+
+
+#define ERROR_THREADS 8
+#define ERROR_ITERATIONS 20000
+
+typedef struct
+{
+    int id;
+    int mismatches;  /* saw some other thread's error, or a stale one. */
+} ErrorThread;
+
+static void error_thread(void *data)
+{
+    static const PHYSFS_ErrorCode codes[] = {
+        PHYSFS_ERR_OUT_OF_MEMORY, PHYSFS_ERR_NOT_FOUND, PHYSFS_ERR_BUSY,
+        PHYSFS_ERR_CORRUPT, PHYSFS_ERR_IO, PHYSFS_ERR_APP_CALLBACK
+    };
+    ErrorThread *et = (ErrorThread *) data;
+    int i;
+
+    for (i = 0; i < ERROR_ITERATIONS; i++)
+    {
+        const PHYSFS_ErrorCode code = codes[(et->id + i) % (sizeof (codes) / sizeof (codes[0]))];
+
+        if ((i % 100) == 0)  /* and now and then, a real failure. */
+        {
+            if ((PHYSFS_openRead("no/such/file") != NULL) ||
+                (PHYSFS_getLastErrorCode() != PHYSFS_ERR_NOT_FOUND))
+                et->mismatches++;
+        } /* if */
+
+        PHYSFS_setErrorCode(code);
+        if (PHYSFS_getLastErrorCode() != code)
+            et->mismatches++;
+        else if (PHYSFS_getLastErrorCode() != PHYSFS_ERR_OK)  /* reading clears it. */
+            et->mismatches++;
+    } /* for */
+
+    PHYSFS_setErrorCode(PHYSFS_ERR_IO);  /* left behind when the thread ends. */
+} /* error_thread */
+
+/* each thread's error code is its own, with lots of threads setting them. */
+static int test_errors(void)
+{
+    RegressThread threads[ERROR_THREADS];
+    ErrorThread data[ERROR_THREADS];
+    int i, round;
+
+    PHYSFS_setErrorCode(PHYSFS_ERR_PERMISSION);
+
+    for (round = 0; round < 4; round++)  /* threads come and go. */
+    {
+        for (i = 0; i < ERROR_THREADS; i++)
+        {
+            data[i].id = i;
+            data[i].mismatches = 0;
+            CHECK(start_thread(&threads[i], error_thread, &data[i]));
+        } /* for */
+
+        for (i = 0; i < ERROR_THREADS; i++)
+            wait_thread(&threads[i]);
+
+        for (i = 0; i < ERROR_THREADS; i++)
+            CHECK(data[i].mismatches == 0);
+    } /* for */
+
+    /* none of that touched this thread's error. */
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_PERMISSION);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_OK);
+
+    /* and it still works after a restart. */
+    PHYSFS_setErrorCode(PHYSFS_ERR_BUSY);
+    CHECK(PHYSFS_deinit());
+    CHECK(PHYSFS_init(argv0));
+    CHECK(PHYSFS_setWriteDir("."));
+    PHYSFS_setErrorCode(PHYSFS_ERR_IO);
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_IO);
+    return 1;
+} /* test_errors */
+
+
+/* PHYSFS_mountMemory()'s (del) callback; counts the calls. */
+static int memory_freed = 0;
+static void count_memory_freed(void *ptr)
+{
+    (void) ptr;
+    memory_freed++;
+} /* count_memory_freed */
+
+/* is (ptr) in the (len) bytes at (buf)? */
+static int points_into(const void *ptr, const void *buf, size_t len)
+{
+    const PHYSFS_uint8 *p = (const PHYSFS_uint8 *) ptr;
+    const PHYSFS_uint8 *b = (const PHYSFS_uint8 *) buf;
+    return (p >= b) && (p < (b + len));
+} /* points_into */
+
+/*
+ * PHYSFS_mapFile(): a pointer straight into the archive when the data is
+ *  there to point at, a copy when it isn't, and either way released once
+ *  per call. A zero-copy mapping holds its archive open; a copy doesn't, so
+ *  whether PHYSFS_unmount() fails tells them apart for archives on disk.
+ */
+static int test_mapfile(void)
+{
+    PHYSFS_uint8 *stored = make_data(70000, 20);
+    PHYSFS_uint8 *packed = make_data(200 * 1024, 21);  /* too big to decompress on open. */
+    RegressFile files[3];
+    const void *ptr, *ptr2, *copy;
+    PHYSFS_uint64 len;
+    char *zip;
+    Buffer b;
+    int pass;
+
+    files[0].name = "stored.bin"; files[0].data = stored; files[0].len = 70000;
+    files[1].name = "packed.txt"; files[1].data = packed; files[1].len = 200 * 1024;
+    files[2].name = "empty.txt"; files[2].data = stored; files[2].len = 0;
+    files[0].deflate = 0; files[1].deflate = 1; files[2].deflate = 0;
+    files[0].crcxor = files[1].crcxor = files[2].crcxor = 0;
+    CHECK(write_zip("map.zip", files, 3));
+    zip = real_path("map.zip");
+
+    memset(&b, '\0', sizeof (b));
+    build_zip(&b, files, 3);
+
+    /* from memory: stored data is pointed at where it sits. */
+    CHECK(PHYSFS_mountMemory(b.data, b.len, count_memory_freed, "map.zip", NULL, 1));
+    ptr = PHYSFS_mapFile("stored.bin", &len);
+    CHECK((ptr != NULL) && (len == 70000));
+    CHECK(points_into(ptr, b.data, b.len));
+    CHECK(memcmp(ptr, stored, 70000) == 0);
+
+    /* the same data twice is the same pointer, released twice. */
+    ptr2 = PHYSFS_mapFile("stored.bin", &len);
+    CHECK((ptr2 == ptr) && (len == 70000));
+
+    /* data that's compressed, and not cached decompressed, is a copy. */
+    copy = PHYSFS_mapFile("packed.txt", &len);
+    CHECK((copy != NULL) && (len == 200 * 1024));
+    CHECK(!points_into(copy, b.data, b.len));
+    CHECK(memcmp(copy, packed, 200 * 1024) == 0);
+
+    ptr2 = PHYSFS_mapFile("empty.txt", &len);
+    CHECK((ptr2 != NULL) && (len == 0));
+    CHECK(PHYSFS_unmapFile(ptr2));
+
+    /* mappings into it keep the archive mounted. */
+    CHECK(!PHYSFS_unmount("map.zip"));
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_FILES_STILL_OPEN);
+    CHECK(PHYSFS_unmapFile(ptr));
+    CHECK(!PHYSFS_unmount("map.zip"));
+    CHECK(PHYSFS_unmapFile(ptr));
+    CHECK(!PHYSFS_unmapFile(ptr));
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_INVALID_ARGUMENT);
+    CHECK(PHYSFS_unmount("map.zip"));
+    CHECK(memory_freed == 1);
+
+    /* the copy outlives the archive, and isn't released with it. */
+    CHECK(memcmp(copy, packed, 200 * 1024) == 0);
+    CHECK(PHYSFS_unmapFile(copy));
+    CHECK(!PHYSFS_unmapFile(copy));
+    CHECK(!PHYSFS_unmapFile(stored));  /* never mapped at all. */
+    CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_INVALID_ARGUMENT);
+    CHECK(!PHYSFS_unmapFile(NULL));
+
+    /* from disk: zero-copy only while archives are memory-mapped. */
+    for (pass = 0; pass < 2; pass++)
+    {
+        const int mapped = (pass == 0);
+        PHYSFS_setMapArchives(mapped);
+        CHECK(PHYSFS_mount(zip, NULL, 1));
+        ptr = PHYSFS_mapFile("stored.bin", &len);
+        CHECK((ptr != NULL) && (len == 70000));
+        CHECK(memcmp(ptr, stored, 70000) == 0);
+        copy = PHYSFS_mapFile("packed.txt", &len);
+        CHECK((copy != NULL) && (len == 200 * 1024));
+        CHECK(memcmp(copy, packed, 200 * 1024) == 0);
+        ptr2 = PHYSFS_mapFile("empty.txt", &len);
+        CHECK((ptr2 != NULL) && (len == 0));
+        CHECK(PHYSFS_unmapFile(ptr2));
+        CHECK(PHYSFS_unmapFile(copy));
+
+        if (mapped)
+        {
+            CHECK(!PHYSFS_unmount(zip));
+            CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_FILES_STILL_OPEN);
+            CHECK(PHYSFS_unmapFile(ptr));
+            CHECK(PHYSFS_unmount(zip));
+        } /* if */
+        else
+        {
+            CHECK(PHYSFS_unmount(zip));
+            CHECK(memcmp(ptr, stored, 70000) == 0);
+            CHECK(PHYSFS_unmapFile(ptr));
+        } /* else */
+    } /* for */
+    PHYSFS_setMapArchives(1);
+
+    /* PHYSFS_deinit() releases whatever's left, archive and all. */
+    memory_freed = 0;
+    CHECK(PHYSFS_mountMemory(b.data, b.len, count_memory_freed, "map.zip", NULL, 1));
+    CHECK(PHYSFS_mount(zip, NULL, 1));
+    CHECK(PHYSFS_mapFile("stored.bin", &len) != NULL);
+    CHECK(PHYSFS_mapFile("packed.txt", &len) != NULL);
+    CHECK(PHYSFS_mapFile("/stored.bin", &len) != NULL);
+    CHECK(PHYSFS_deinit());
+    CHECK(memory_freed == 1);
+    CHECK(PHYSFS_init(argv0));
+    CHECK(PHYSFS_setWriteDir("."));
+
+    free(b.data);
+    free(zip);
+    free(stored);
+    free(packed);
+    return 1;
+} /* test_mapfile */
+
+
+static PHYSFS_uint32 get_le32(const PHYSFS_uint8 *p)
+{
+    return ((PHYSFS_uint32) p[0]) | (((PHYSFS_uint32) p[1]) << 8) |
+           (((PHYSFS_uint32) p[2]) << 16) | (((PHYSFS_uint32) p[3]) << 24);
+} /* get_le32 */
+
+/* overwrite the low half of a little-endian uint32 in place; returns 1. */
+static int set_le16(PHYSFS_uint8 *p, PHYSFS_uint32 v)
+{
+    p[0] = (PHYSFS_uint8) (v & 0xFF);
+    p[1] = (PHYSFS_uint8) ((v >> 8) & 0xFF);
+    return 1;
+} /* set_le16 */
+
+/*
+ * The per-archive cache of small decompressed entries: an entry is the same
+ *  from the cache as it was decompressed, and one whose data runs out before
+ *  its stated size still opens, as it did before there was a cache, and just
+ *  reads short. Opening it doesn't disturb an error the app had pending.
+ */
+static int test_zipcache(void)
+{
+    PHYSFS_uint8 *small = make_data(600, 30);
+    PHYSFS_uint8 buf[1024];
+    RegressFile files[2];
+    PHYSFS_File *f;
+    PHYSFS_sint64 br;
+    PHYSFS_uint8 *p;
+    char *zip;
+    Buffer b;
+    int i;
+
+    files[0].name = "small.txt"; files[0].data = small; files[0].len = 600;
+    files[1].name = "short.txt"; files[1].data = small; files[1].len = 600;
+    for (i = 0; i < 2; i++)
+    {
+        files[i].deflate = 1;
+        files[i].crcxor = 0;
+    } /* for */
+
+    /* say short.txt is 700 bytes, in both its headers. */
+    memset(&b, '\0', sizeof (b));
+    build_zip(&b, files, 2);
+    for (i = 0, p = b.data; (p + 46 + 9) <= (b.data + b.len); p++)
+    {
+        if ((memcmp(p, "PK\3\4", 4) == 0) && (memcmp(p + 30, "short.txt", 9) == 0))
+            i += set_le16(p + 22, 700);
+        else if ((memcmp(p, "PK\1\2", 4) == 0) && (memcmp(p + 46, "short.txt", 9) == 0))
+            i += set_le16(p + 24, 700);
+    } /* for */
+    CHECK(i == 2);
+    CHECK(write_file("cache.zip", b.data, b.len));
+    free(b.data);
+    zip = real_path("cache.zip");
+    CHECK(PHYSFS_mount(zip, NULL, 1));
+
+    /* decompressed on the first open, from the cache after. */
+    for (i = 0; i < 3; i++)
+    {
+        CHECK(read_all("small.txt", buf, sizeof (buf), &br) && (br == 600));
+        CHECK(memcmp(buf, small, 600) == 0);
+    } /* for */
+
+    for (i = 0; i < 2; i++)
+    {
+        PHYSFS_setErrorCode(PHYSFS_ERR_BUSY);
+        CHECK((f = PHYSFS_openRead("short.txt")) != NULL);
+        CHECK(PHYSFS_getLastErrorCode() == PHYSFS_ERR_BUSY);
+        CHECK(PHYSFS_fileLength(f) == 700);
+        br = PHYSFS_readBytes(f, buf, sizeof (buf));
+        CHECK(br < 700);
+        CHECK((br < 0) || (memcmp(buf, small, (size_t) br) == 0));
+        CHECK(PHYSFS_close(f));
+    } /* for */
+
+    CHECK(PHYSFS_unmount(zip));
+    free(zip);
+    free(small);
+    return 1;
+} /* test_zipcache */
+
+
+/*
+ * The central directory is read into memory in one go, sized from the end
+ *  of central directory record. Some writers get that size wrong; parsing
+ *  the directory straight from the archive never needed it, so an archive
+ *  that says its directory is smaller than it is still has to mount. Only
+ *  zip64 archives can say so harmlessly: the plain record's size also
+ *  places the directory, but the zip64 one is found through its locator.
+ */
+static int test_centraldir(void)
+{
+    PHYSFS_uint8 *data = make_data(3000, 40);
+    PHYSFS_uint8 buf[4096];
+    PHYSFS_uint8 eocd[22];
+    RegressFile files[3];
+    PHYSFS_uint32 cdstart, cdlen, zip64eocd;
+    PHYSFS_sint64 br;
+    char **list;
+    char **i;
+    char *zip;
+    Buffer b;
+    int n;
+
+    files[0].name = "one.txt"; files[0].data = data; files[0].len = 1000;
+    files[1].name = "dir/two.bin"; files[1].data = data + 1000; files[1].len = 1000;
+    files[2].name = "dir/three.txt"; files[2].data = data + 2000; files[2].len = 1000;
+    for (n = 0; n < 3; n++)
+    {
+        files[n].deflate = (n != 1);
+        files[n].crcxor = 0;
+    } /* for */
+
+    /* put zip64 end records, saying half the real size, before the EOCD. */
+    memset(&b, '\0', sizeof (b));
+    build_zip(&b, files, 3);
+    b.len -= sizeof (eocd);
+    memcpy(eocd, b.data + b.len, sizeof (eocd));
+    CHECK(memcmp(eocd, "PK\5\6", 4) == 0);
+    cdlen = get_le32(eocd + 12);
+    cdstart = get_le32(eocd + 16);
+    CHECK(cdstart + cdlen == b.len);
+
+    zip64eocd = (PHYSFS_uint32) b.len;
+    buf_le32(&b, 0x06064b50);
+    buf_le32(&b, 44); buf_le32(&b, 0);  /* size of the rest of this. */
+    buf_le16(&b, 45);
+    buf_le16(&b, 45);
+    buf_le32(&b, 0);  /* disk */
+    buf_le32(&b, 0);  /* disk with the central dir */
+    buf_le32(&b, 3); buf_le32(&b, 0);  /* entries on this disk */
+    buf_le32(&b, 3); buf_le32(&b, 0);  /* entries */
+    buf_le32(&b, cdlen / 2); buf_le32(&b, 0);  /* wrong! */
+    buf_le32(&b, cdstart); buf_le32(&b, 0);
+
+    buf_le32(&b, 0x07064b50);
+    buf_le32(&b, 0);  /* disk with the zip64 record */
+    buf_le32(&b, zip64eocd); buf_le32(&b, 0);
+    buf_le32(&b, 1);  /* disks */
+
+    buf_append(&b, eocd, sizeof (eocd));
+    CHECK(write_file("short_cd.zip", b.data, b.len));
+    free(b.data);
+
+    zip = real_path("short_cd.zip");
+    CHECK(PHYSFS_mount(zip, NULL, 1));
+    for (n = 0; n < 3; n++)
+    {
+        CHECK(read_all(files[n].name, buf, sizeof (buf), &br) && (br == 1000));
+        CHECK(memcmp(buf, files[n].data, 1000) == 0);
+    } /* for */
+
+    list = PHYSFS_enumerateFiles("dir");
+    CHECK(list != NULL);
+    for (i = list, n = 0; *i != NULL; i++)
+        n++;
+    PHYSFS_freeList(list);
+    CHECK(n == 2);
+
+    CHECK(PHYSFS_unmount(zip));
+    free(zip);
+    free(data);
+    return 1;
+} /* test_centraldir */
+
+
+#define GLOB_SIGMA "\xCE\xA3" "igma.txt"  /* capital sigma; see test_glob(). */
+#define GLOB_MAX_MATCHES 32
+
+typedef struct
+{
+    char *matches[GLOB_MAX_MATCHES];
+    int count;
+    int overflow;
+} GlobResults;
+
+static PHYSFS_EnumerateCallbackResult glob_callback(void *data,
+                                        const char *origdir, const char *fname)
+{
+    GlobResults *r = (GlobResults *) data;
+    char *str;
+
+    if (r->count >= GLOB_MAX_MATCHES)
+    {
+        r->overflow = 1;
+        return PHYSFS_ENUM_STOP;
+    } /* if */
+
+    str = (char *) malloc(strlen(origdir) + strlen(fname) + 2);
+    if (!str)
+        return PHYSFS_ENUM_ERROR;
+    sprintf(str, "%s%s%s", origdir, (*origdir) ? "/" : "", fname);
+    r->matches[r->count++] = str;
+    return PHYSFS_ENUM_OK;
+} /* glob_callback */
+
+static int glob_cmp(const void *a, const void *b)
+{
+    return strcmp(*((char * const *) a), *((char * const *) b));
+} /* glob_cmp */
+
+/*
+ * Does (pattern) match exactly the paths in (expect), a space-separated
+ *  list in strcmp() order? Matches come in no particular order, so they're
+ *  sorted first.
+ */
+static int glob_matches(const char *pattern, const char *expect)
+{
+    GlobResults r;
+    char got[1024];
+    int retval;
+    int i;
+
+    memset(&r, '\0', sizeof (r));
+    retval = PHYSFS_enumerateGlob(pattern, glob_callback, &r);
+    qsort(r.matches, (size_t) r.count, sizeof (char *), glob_cmp);
+
+    got[0] = '\0';
+    for (i = 0; i < r.count; i++)
+    {
+        if ((strlen(got) + strlen(r.matches[i]) + 2) < sizeof (got))
+        {
+            if (i > 0)
+                strcat(got, " ");
+            strcat(got, r.matches[i]);
+        } /* if */
+        free(r.matches[i]);
+    } /* for */
+
+    if ((!retval) || (r.overflow) || (strcmp(got, expect) != 0))
+    {
+        fprintf(stderr, "physfs_regress: %s: '%s' found '%s', wanted '%s'\n",
+                current_test, pattern, got, expect);
+        return 0;
+    } /* if */
+    return 1;
+} /* glob_matches */
+
+/* the patterns, for a tree from glob_files mounted at "m/n". */
+static int glob_patterns(const int folded)
+{
+    /* "**" at the front, taking in the mount point too. */
+    CHECK(glob_matches("**/b.txt", "m/n/a/b.txt m/n/z/b.txt"));
+    /* recursive, including no directories at all. */
+    CHECK(glob_matches("m/n/**/*.txt", folded ?
+            "m/n/a/b.txt m/n/a/x/c.txt m/n/a/x/y/d.TXT m/n/a/" GLOB_SIGMA " m/n/top.txt m/n/z/b.txt" :
+            "m/n/a/b.txt m/n/a/x/c.txt m/n/a/" GLOB_SIGMA " m/n/top.txt m/n/z/b.txt"));
+    /* in the middle, with '?'. */
+    CHECK(glob_matches("m/n/a/**/?.txt", folded ?
+            "m/n/a/b.txt m/n/a/x/c.txt m/n/a/x/y/d.TXT" : "m/n/a/b.txt m/n/a/x/c.txt"));
+    CHECK(glob_matches("m/n/?/b.txt", "m/n/a/b.txt m/n/z/b.txt"));
+    /* in the middle, with a wildcard in the mount point. */
+    CHECK(glob_matches("m/*/a/**/y/*", "m/n/a/x/y/d.TXT m/n/a/x/y/e.dat"));
+    CHECK(glob_matches("*/n/a/**/x", "m/n/a/x"));
+    /* trailing: everything under there, directories too, but not itself. */
+    CHECK(glob_matches("m/n/a/x/**", "m/n/a/x/c.txt m/n/a/x/y m/n/a/x/y/d.TXT m/n/a/x/y/e.dat"));
+    CHECK(glob_matches("m/**", "m/n m/n/a m/n/a/b.txt m/n/a/x m/n/a/x/c.txt "
+                               "m/n/a/x/y m/n/a/x/y/d.TXT m/n/a/x/y/e.dat "
+                               "m/n/a/" GLOB_SIGMA " m/n/top.txt m/n/z m/n/z/b.txt"));
+    /* '*' has to give back what it ate, more than once. */
+    CHECK(glob_matches("m/n/**/*.*t", folded ?
+            "m/n/a/b.txt m/n/a/x/c.txt m/n/a/x/y/d.TXT m/n/a/x/y/e.dat m/n/a/" GLOB_SIGMA " m/n/top.txt m/n/z/b.txt" :
+            "m/n/a/b.txt m/n/a/x/c.txt m/n/a/x/y/e.dat m/n/a/" GLOB_SIGMA " m/n/top.txt m/n/z/b.txt"));
+    CHECK(glob_matches("m/n/*t*xt", "m/n/top.txt"));
+    CHECK(glob_matches("m/n/**/*t*t*t*t", ""));
+    /* and nothing at all is fine. */
+    CHECK(glob_matches("m/n/nope/**", ""));
+    CHECK(glob_matches("q/**", ""));
+
+    /* names in the archive fold; the mount point doesn't. */
+    CHECK(glob_matches("m/n/**/D.t?t", folded ? "m/n/a/x/y/d.TXT" : ""));
+    CHECK(glob_matches("m/n/**/*.TXT", folded ?
+            "m/n/a/b.txt m/n/a/x/c.txt m/n/a/x/y/d.TXT m/n/a/" GLOB_SIGMA " m/n/top.txt m/n/z/b.txt" :
+            "m/n/a/x/y/d.TXT"));
+    CHECK(glob_matches("m/n/A/*.txt", folded ? "m/n/A/b.txt m/n/A/" GLOB_SIGMA : ""));
+    CHECK(glob_matches("M/n/**/b.txt", ""));
+    return 1;
+} /* glob_patterns */
+
+/*
+ * PHYSFS_enumerateGlob(), on the same tree as a .zip (which is a DirTree)
+ *  and as a directory on disk, case-sensitive and then case-folded, and on a
+ *  GRP, whose names only fold 'A' through 'Z'. Capital sigma has no
+ *  decomposed form for a filesystem to store instead, and folding it to
+ *  small sigma takes more than ASCII, so only the full fold matches it.
+ */
+static int test_glob(void)
+{
+    static const char *glob_files[] = {
+        "top.txt", "a/b.txt", "a/" GLOB_SIGMA, "a/x/c.txt",
+        "a/x/y/d.TXT", "a/x/y/e.dat", "z/b.txt"
+    };
+    const int nfiles = (int) (sizeof (glob_files) / sizeof (glob_files[0]));
+    RegressFile files[sizeof (glob_files) / sizeof (glob_files[0])];
+    const PHYSFS_ArchiveInfo **types;
+    char *zip, *tree, *grp;
+    char path[256];
+    int folded;
+    int hasgrp = 0;
+    Buffer b;
+    int i;
+
+    for (i = 0; i < nfiles; i++)
+    {
+        files[i].name = glob_files[i];
+        files[i].data = (const PHYSFS_uint8 *) glob_files[i];
+        files[i].len = strlen(glob_files[i]);
+        files[i].deflate = (i & 1);
+        files[i].crcxor = 0;
+    } /* for */
+    CHECK(write_zip("glob.zip", files, nfiles));
+
+    sprintf(path, "%s/tree/a/x/y", datadir_name);
+    CHECK(PHYSFS_mkdir(path));
+    sprintf(path, "%s/tree/z", datadir_name);
+    CHECK(PHYSFS_mkdir(path));
+    for (i = 0; i < nfiles; i++)
+    {
+        sprintf(path, "tree/%s", glob_files[i]);
+        CHECK(write_file(path, glob_files[i], strlen(glob_files[i])));
+    } /* for */
+
+    zip = real_path("glob.zip");
+    tree = real_path("tree");
+
+    /* nothing's mounted yet; each pass below mounts one of them at a time. */
+    CHECK(glob_matches("**", ""));
+
+    for (folded = 0; folded <= 1; folded++)
+    {
+        PHYSFS_setCaseInsensitive(folded);
+
+        CHECK(PHYSFS_mount(zip, "m/n", 1));
+        CHECK(glob_patterns(folded));
+        CHECK(glob_matches("m/n/a/\xCF\x83*", folded ? "m/n/a/" GLOB_SIGMA : ""));
+        CHECK(PHYSFS_unmount(zip));
+
+        CHECK(PHYSFS_mount(tree, "m/n", 1));
+        CHECK(glob_patterns(folded));
+        CHECK(glob_matches("m/n/a/\xCF\x83*", folded ? "m/n/a/" GLOB_SIGMA : ""));
+        CHECK(PHYSFS_unmount(tree));
+    } /* for */
+    PHYSFS_setCaseInsensitive(0);
+
+    for (types = PHYSFS_supportedArchiveTypes(); *types; types++)
+        hasgrp |= (strcmp((*types)->extension, "GRP") == 0);
+
+    if (hasgrp)  /* always case-insensitive, but only for ASCII. */
+    {
+        static const char *grp_files[] = { "TOP.TXT", "B.TXT", "\xC3\x9C" "BER.TXT" };
+        memset(&b, '\0', sizeof (b));
+        buf_append(&b, "KenSilverman", 12);
+        buf_le32(&b, 3);
+        for (i = 0; i < 3; i++)
+        {
+            char name[12];
+            memset(name, ' ', sizeof (name));
+            memcpy(name, grp_files[i], strlen(grp_files[i]));
+            buf_append(&b, name, sizeof (name));
+            buf_le32(&b, 4);
+        } /* for */
+        for (i = 0; i < 3; i++)
+            buf_append(&b, "data", 4);
+        CHECK(write_file("glob.grp", b.data, b.len));
+        free(b.data);
+
+        grp = real_path("glob.grp");
+        CHECK(PHYSFS_mount(grp, "m/n", 1));
+        CHECK(glob_matches("m/n/*.txt", "m/n/B.TXT m/n/TOP.TXT m/n/\xC3\x9C" "BER.TXT"));
+        CHECK(glob_matches("m/n/?.t*", "m/n/B.TXT"));
+        CHECK(glob_matches("m/n/\xC3\x9C" "b*", "m/n/\xC3\x9C" "BER.TXT"));
+        CHECK(glob_matches("m/n/\xC3\xBC" "b*", ""));  /* not folded. */
+        CHECK(glob_matches("m/n/**", "m/n/B.TXT m/n/TOP.TXT m/n/\xC3\x9C" "BER.TXT"));
+        CHECK(PHYSFS_unmount(grp));
+        free(grp);
+    } /* if */
+
+    free(zip);
+    free(tree);
+    return 1;
+} /* test_glob */
+
+
+typedef struct
+{
+    const char *name;
+    int (*fn)(void);
+} RegressTest;
+
+static const RegressTest tests[] = {
+    { "checksum", test_checksum },
+    { "mountindex", test_mountindex },
+    { "async", test_async },
+    { "preload", test_preload },
+    { "errors", test_errors },
+    { "mapfile", test_mapfile },
+    { "zipcache", test_zipcache },
+    { "centraldir", test_centraldir },
+    { "glob", test_glob }
+};
+
+#define NUM_TESTS ((int) (sizeof (tests) / sizeof (tests[0])))
+
+
+static int run_test(const RegressTest *test)
+{
+    int retval;
+
+    current_test = test->name;
+    if (!PHYSFS_init(argv0))
+        return check_failed(__LINE__, "PHYSFS_init");
+    else if (!make_datadir(test->name))
+        retval = check_failed(__LINE__, "making the scratch directory");
+    else
+    {
+        retval = test->fn();
+        if (retval)
+        {
+            /* anything the test left mounted could hold a file open. */
+            PHYSFS_deinit();
+            if (!PHYSFS_init(argv0) || !PHYSFS_setWriteDir("."))
+                retval = check_failed(__LINE__, "starting over to clean up");
+            else
+                remove_data(1);
+        } /* if */
+    } /* else */
+
+    free(datadir);
+    datadir = NULL;
+    PHYSFS_deinit();
+    printf("%s: %s\n", test->name, retval ? "ok" : "FAILED");
+    return retval;
+} /* run_test */
+
+
+int main(int argc, char **argv)
+{
+    int failures = 0;
+    int i, j;
+
+    argv0 = argv[0];
+
+    if (argc < 2)
+    {
+        for (i = 0; i < NUM_TESTS; i++)
+            failures += !run_test(&tests[i]);
+        return failures ? 1 : 0;
+    } /* if */
+
+    for (j = 1; j < argc; j++)
+    {
+        for (i = 0; i < NUM_TESTS; i++)
+        {
+            if (strcmp(argv[j], tests[i].name) == 0)
+                break;
+        } /* for */
+
+        if (i < NUM_TESTS)
+            failures += !run_test(&tests[i]);
+        else
+        {
+            fprintf(stderr, "physfs_regress: no test named '%s'. Tests:", argv[j]);
+            for (i = 0; i < NUM_TESTS; i++)
+                fprintf(stderr, " %s", tests[i].name);
+            fprintf(stderr, "\n");
+            return 2;
+        } /* else */
+    } /* for */
+
+    return failures ? 1 : 0;
+} /* main */
+
+/* end of physfs_regress.c ... */